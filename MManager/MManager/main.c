@@ -12,6 +12,7 @@ Device driver entry point.
 
 #include "mmanager-globals.h"
 #include "mmanager-dispatch.h"
+#include "mm/vad.h"
 
 #include "rtl/osversion.h"
 
@@ -58,6 +59,13 @@ EXTERN_C NTSTATUS DriverEntry(
 
 	PDEVICE_OBJECT DeviceObject = NULL;
 	BOOLEAN        SymbolicLink = FALSE;
+
+	// Lookaside lists of the VAD tables, before any request
+	Status = XMiInitializeVadLookasideLists();
+	if (!NT_SUCCESS(Status)) {
+		MMDebug(("Failed to initialise lookaside lists (0x%08X).\r\n", Status));
+		return Status;
+	}
 	
 	// Set all the routines
 	DriverObject->DriverUnload = MmanDriverUnload;
@@ -101,6 +109,7 @@ EXTERN_C NTSTATUS DriverEntry(
 			IoDeleteSymbolicLink(&SymbolicName);
 		if (DeviceObject != NULL)
 			IoDeleteDevice(DeviceObject);
+		XMiDeleteVadLookasideLists();
 		MMDebug(("----------------------------------------------------------------\r\n"));
 		return Status;
 	}
@@ -0,0 +1,186 @@
+/*+================================================================================================
+Module Name: pfndb.c
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+
+Abstract:
+Sequential scan of the page frame number (PFN) database.
+Pages are bucketed by list (MMPFNENTRY1.PageLocation), by prototype (shared) or private status
+and, for private pages, by owning address space. The owner of a page is the top-level page table
+found by following MMPFN.u4.PteFrame, which is then matched with KPROCESS.DirectoryTableBase.
+No kernel routine is used so that the code can be shared with user-mode tools.
+
+================================================================================================+*/
+
+#include "pfndb.h"
+
+#if defined(_M_AMD64) || defined(__x86_64__)
+#define XPFN_PREFETCH
+#include <xmmintrin.h>
+#endif // _M_AMD64 || __x86_64__
+
+// Distance, in entries, between the entry scanned and the entry prefetched.
+#define XPFN_PREFETCH_DISTANCE 0x10
+
+/// <summary>
+/// Find or insert the owner entry of a top-level page table.
+/// </summary>
+static PXPFN_OWNER XMipGetPfnOwner(
+	_Inout_ PXPFN_SCAN Scan,
+	_In_    ULONG64    PageFrameNumber,
+	_In_    BOOLEAN    Insert
+) {
+	ULONG Mask  = Scan->MaximumOwners - 1;
+	ULONG Index = (ULONG)((PageFrameNumber * 0x9E3779B97F4A7C15) >> 32) & Mask;
+
+	for (ULONG cx = 0x00; cx < Scan->MaximumOwners; cx++) {
+		PXPFN_OWNER Owner = &Scan->Owners[(Index + cx) & Mask];
+		if (Owner->PageFrameNumber == PageFrameNumber)
+			return Owner;
+
+		if (Owner->PageFrameNumber == XPFN_NO_OWNER) {
+			if (!Insert)
+				return NULL;
+			Owner->PageFrameNumber = PageFrameNumber;
+			Scan->NumberOfOwners++;
+			return Owner;
+		}
+	}
+	return NULL;
+}
+
+/// <summary>
+/// Follow the page table pages up to the top-level page table, whose PteFrame is itself.
+/// </summary>
+static ULONG64 XMipFindTopLevelTable(
+	_Inout_ PXPFN_SCAN Scan,
+	_In_    ULONG64    PteFrame
+) {
+	PXPFN_CACHE_ENTRY Entry = &Scan->Cache[PteFrame & (XPFN_CACHE_SIZE - 1)];
+	if (Entry->PageFrameNumber == PteFrame)
+		return Entry->Owner;
+
+	ULONG64 Owner           = XPFN_NO_OWNER;
+	ULONG64 PageFrameNumber = PteFrame;
+	for (ULONG Depth = 0x00; Depth < XPFN_MAXIMUM_DEPTH; Depth++) {
+		ULONG64 U4 = 0x00;
+		if (!Scan->ReadU4(Scan->Context, PageFrameNumber, &U4))
+			break;
+
+		if (XPFN_PTE_FRAME(U4) == PageFrameNumber) {
+			Owner = PageFrameNumber;
+			break;
+		}
+		PageFrameNumber = XPFN_PTE_FRAME(U4);
+	}
+
+	// Failures are cached too, the same page table would fail again
+	Entry->PageFrameNumber = PteFrame;
+	Entry->Owner           = Owner;
+	return Owner;
+}
+
+_Use_decl_annotations_
+EXTERN_C VOID XMiInitializePfnScan(
+	_Out_                     PXPFN_SCAN    Scan,
+	_Out_writes_(MaximumOwners) PXPFN_OWNER Owners,
+	_In_                      ULONG         MaximumOwners,
+	_In_                      PXPFN_READ_U4 ReadU4,
+	_In_opt_                  PVOID         Context
+) {
+	RtlZeroMemory(Scan, sizeof(XPFN_SCAN));
+	Scan->ReadU4        = ReadU4;
+	Scan->Context       = Context;
+	Scan->MaximumOwners = MaximumOwners;
+	Scan->Owners        = Owners;
+
+	for (ULONG cx = 0x00; cx < MaximumOwners; cx++) {
+		RtlZeroMemory(&Owners[cx], sizeof(XPFN_OWNER));
+		Owners[cx].PageFrameNumber = XPFN_NO_OWNER;
+	}
+	for (ULONG cx = 0x00; cx < XPFN_CACHE_SIZE; cx++)
+		Scan->Cache[cx].PageFrameNumber = XPFN_NO_OWNER;
+}
+
+_Use_decl_annotations_
+EXTERN_C VOID XMiScanPfnBatch(
+	_Inout_ PXPFN_SCAN Scan,
+	_In_reads_bytes_(NumberOfEntries * XPFN_ENTRY_SIZE) CONST UCHAR* Entries,
+	_In_    ULONG64    FirstPageFrameNumber,
+	_In_    ULONG64    NumberOfEntries
+) {
+	UNREFERENCED_PARAMETER(FirstPageFrameNumber);
+
+	for (ULONG64 cx = 0x00; cx < NumberOfEntries; cx++) {
+		CONST UCHAR* Entry = Entries + (cx * XPFN_ENTRY_SIZE);
+
+#if defined(XPFN_PREFETCH)
+		// The database is read once, front to back
+		if (cx + XPFN_PREFETCH_DISTANCE < NumberOfEntries)
+			_mm_prefetch((CONST CHAR*)(Entry + (XPFN_PREFETCH_DISTANCE * XPFN_ENTRY_SIZE)), _MM_HINT_NTA);
+#endif // XPFN_PREFETCH
+
+		ULONG   List = XPFN_PAGE_LOCATION(Entry[XPFN_E1]);
+		ULONG64 U4   = *(CONST ULONG64*)(Entry + XPFN_U4);
+		Scan->Total.Pages[List]++;
+
+		// Pages not mapped by any PTE
+		if (List == XPfnListZeroed || List == XPfnListFree || List == XPfnListBad)
+			continue;
+
+		// Shared pages are mapped by the prototype PTEs of a section
+		if (U4 & XPFN_PROTOTYPE_PTE) {
+			Scan->Shared.Pages[List]++;
+			continue;
+		}
+		Scan->Private.Pages[List]++;
+
+		// Owner of private pages
+		PXPFN_OWNER Owner = NULL;
+		ULONG64     Table = XMipFindTopLevelTable(Scan, XPFN_PTE_FRAME(U4));
+		if (Table != XPFN_NO_OWNER)
+			Owner = XMipGetPfnOwner(Scan, Table, TRUE);
+
+		if (Owner != NULL)
+			Owner->Counters.Pages[List]++;
+		else
+			Scan->Unattributed.Pages[List]++;
+	}
+}
+
+_Use_decl_annotations_
+EXTERN_C VOID XMiMergePfnScan(
+	_Inout_ PXPFN_SCAN Destination,
+	_In_    PXPFN_SCAN Source
+) {
+	for (ULONG List = 0x00; List < XPfnListMaximum; List++) {
+		Destination->Total.Pages[List]        += Source->Total.Pages[List];
+		Destination->Shared.Pages[List]       += Source->Shared.Pages[List];
+		Destination->Private.Pages[List]      += Source->Private.Pages[List];
+		Destination->Unattributed.Pages[List] += Source->Unattributed.Pages[List];
+	}
+
+	for (ULONG cx = 0x00; cx < Source->MaximumOwners; cx++) {
+		PXPFN_OWNER SourceOwner = &Source->Owners[cx];
+		if (SourceOwner->PageFrameNumber == XPFN_NO_OWNER)
+			continue;
+
+		PXPFN_OWNER Owner = XMipGetPfnOwner(Destination, SourceOwner->PageFrameNumber, TRUE);
+		for (ULONG List = 0x00; List < XPfnListMaximum; List++) {
+			if (Owner != NULL)
+				Owner->Counters.Pages[List] += SourceOwner->Counters.Pages[List];
+			else
+				Destination->Unattributed.Pages[List] += SourceOwner->Counters.Pages[List];
+		}
+	}
+}
+
+_Use_decl_annotations_
+EXTERN_C PXPFN_OWNER XMiFindPfnOwner(
+	_In_ PXPFN_SCAN Scan,
+	_In_ ULONG64    DirectoryTableBase
+) {
+	return XMipGetPfnOwner(Scan, (DirectoryTableBase & (ULONG64)0x000FFFFFFFFFF000) >> 12, FALSE);
+}
@@ -0,0 +1,166 @@
+/*+================================================================================================
+Module Name: pfndb.h
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+
+Abstract:
+Sequential scan of the page frame number (PFN) database.
+Pages are bucketed by list (MMPFNENTRY1.PageLocation), by prototype (shared) or private status
+and, for private pages, by owning address space. The owner of a page is the top-level page table
+found by following MMPFN.u4.PteFrame, which is then matched with KPROCESS.DirectoryTableBase.
+No kernel routine is used so that the code can be shared with user-mode tools.
+
+================================================================================================+*/
+
+#ifndef __X_PFNDB_H_GUARD__
+#define __X_PFNDB_H_GUARD__
+
+#ifndef _NTIFS_
+#include <ntifs.h>
+#endif // !_NTIFS_
+
+// XPfn Memory Pool Tag -- XPfn
+#define XPFN_MM_TAG (ULONG)0x6e665058
+
+// Fields of the MMPFN structure from mmtypes.h.
+#define XPFN_ENTRY_SIZE       0x30
+#define XPFN_PTE_ADDRESS      0x08 // MMPFN.PteAddress
+#define XPFN_REFERENCE_COUNT  0x20 // MMPFN.u3.ReferenceCount
+#define XPFN_E1               0x22 // MMPFN.u3.e1
+#define XPFN_U4               0x28 // MMPFN.u4
+
+// Bits of MMPFNENTRY1 and of MMPFN.u4.
+#define XPFN_PAGE_LOCATION(e1) ((e1) & 0x07)
+#define XPFN_PTE_FRAME(u4)     ((u4) & (ULONG64)0x0000000FFFFFFFFF)
+#define XPFN_PROTOTYPE_PTE     (ULONG64)0x8000000000000000
+
+// Number of page table PFNs whose owner is cached, must be a power of two.
+#define XPFN_CACHE_SIZE 0x1000
+
+// Maximum number of page tables followed to find the top-level page table.
+#define XPFN_MAXIMUM_DEPTH 0x05
+
+/// <summary>
+/// Lists of physical pages, values of MMPFNENTRY1.PageLocation (MMLISTS).
+/// </summary>
+typedef enum _XPFN_LIST {
+	XPfnListZeroed,
+	XPfnListFree,
+	XPfnListStandby,
+	XPfnListModified,
+	XPfnListModifiedNoWrite,
+	XPfnListBad,
+	XPfnListActive,
+	XPfnListTransition,
+	XPfnListMaximum
+} XPFN_LIST, * PXPFN_LIST;
+
+/// <summary>
+/// Number of pages per list.
+/// </summary>
+typedef struct _XPFN_COUNTERS {
+	ULONG64 Pages[XPfnListMaximum];
+} XPFN_COUNTERS, * PXPFN_COUNTERS;
+
+/// <summary>
+/// Private pages of one address space.
+/// </summary>
+typedef struct _XPFN_OWNER {
+	ULONG64       PageFrameNumber; // PFN of the top-level page table, XPFN_NO_OWNER if the slot is free
+	XPFN_COUNTERS Counters;
+} XPFN_OWNER, * PXPFN_OWNER;
+
+// Value of a free owner or cache slot.
+#define XPFN_NO_OWNER (ULONG64)-1
+
+/// <summary>
+/// Top-level page table of a page table page.
+/// </summary>
+typedef struct _XPFN_CACHE_ENTRY {
+	ULONG64 PageFrameNumber;
+	ULONG64 Owner;
+} XPFN_CACHE_ENTRY, * PXPFN_CACHE_ENTRY;
+
+/// <summary>
+/// Routine used to read MMPFN.u4 of a page outside the batch being scanned.
+/// </summary>
+typedef BOOLEAN(*PXPFN_READ_U4)(
+	_In_opt_ PVOID    Context,
+	_In_     ULONG64  PageFrameNumber,
+	_Out_    PULONG64 U4
+);
+
+/// <summary>
+/// State of a scan of the PFN database.
+/// </summary>
+typedef struct _XPFN_SCAN {
+	XPFN_COUNTERS Total;        // All pages
+	XPFN_COUNTERS Shared;       // Pages mapped by prototype PTEs
+	XPFN_COUNTERS Private;      // Pages mapped by process or system PTEs
+	XPFN_COUNTERS Unattributed; // Private pages whose owner could not be found
+
+	PXPFN_READ_U4 ReadU4;
+	PVOID         Context;
+
+	ULONG       NumberOfOwners;
+	ULONG       MaximumOwners;  // Size of the owner table, must be a power of two
+	PXPFN_OWNER Owners;         // Open addressing hash table of the owners
+
+	XPFN_CACHE_ENTRY Cache[XPFN_CACHE_SIZE];
+} XPFN_SCAN, * PXPFN_SCAN;
+
+
+/// <summary>
+/// Initialise a scan of the PFN database.
+/// </summary>
+/// <param name="Scan">Scan to initialise.</param>
+/// <param name="Owners">Owner table, MaximumOwners entries.</param>
+/// <param name="MaximumOwners">Number of entries of the owner table, a power of two.</param>
+/// <param name="ReadU4">Routine used to follow the page table pages.</param>
+/// <param name="Context">Optional context passed to ReadU4.</param>
+EXTERN_C VOID XMiInitializePfnScan(
+	_Out_                     PXPFN_SCAN    Scan,
+	_Out_writes_(MaximumOwners) PXPFN_OWNER Owners,
+	_In_                      ULONG         MaximumOwners,
+	_In_                      PXPFN_READ_U4 ReadU4,
+	_In_opt_                  PVOID         Context
+);
+
+/// <summary>
+/// Scan a contiguous run of MMPFN entries.
+/// </summary>
+/// <param name="Scan">Scan to add the pages to.</param>
+/// <param name="Entries">Array of MMPFN entries, XPFN_ENTRY_SIZE bytes each.</param>
+/// <param name="FirstPageFrameNumber">PFN of the first entry.</param>
+/// <param name="NumberOfEntries">Number of entries of the array.</param>
+EXTERN_C VOID XMiScanPfnBatch(
+	_Inout_ PXPFN_SCAN Scan,
+	_In_reads_bytes_(NumberOfEntries * XPFN_ENTRY_SIZE) CONST UCHAR* Entries,
+	_In_    ULONG64    FirstPageFrameNumber,
+	_In_    ULONG64    NumberOfEntries
+);
+
+/// <summary>
+/// Add the counters and owners of a scan to another one, used to merge scans of disjoint ranges.
+/// </summary>
+/// <param name="Destination">Scan to add to.</param>
+/// <param name="Source">Scan to add.</param>
+EXTERN_C VOID XMiMergePfnScan(
+	_Inout_ PXPFN_SCAN Destination,
+	_In_    PXPFN_SCAN Source
+);
+
+/// <summary>
+/// Find the private pages of an address space.
+/// </summary>
+/// <param name="Scan">Completed scan.</param>
+/// <param name="DirectoryTableBase">KPROCESS.DirectoryTableBase of the process.</param>
+/// <returns>Owner entry, or NULL if no page was found.</returns>
+EXTERN_C PXPFN_OWNER XMiFindPfnOwner(
+	_In_ PXPFN_SCAN Scan,
+	_In_ ULONG64    DirectoryTableBase
+);
+
+#endif // !__X_PFNDB_H_GUARD__
@@ -0,0 +1,140 @@
+/*+================================================================================================
+Module Name: pte.c
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+
+Abstract:
+All the routines used to walk the x64 page tables of a process and classify the pages of a range
+of Virtual Page Numbers (VPNs).
+Page tables are read by physical address via a caller supplied routine.
+
+================================================================================================+*/
+
+#include "pte.h"
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text(PAGE, XMiInitializePteWalker)
+#pragma alloc_text(PAGE, XMiWalkPageTables)
+#pragma alloc_text(PAGE, XMiReadPhysicalTable)
+#endif // ALLOC_PRAGMA
+
+// Number of Virtual Page Numbers (VPNs) mapped by one entry of a given level.
+#define XPTE_LEVEL_SPAN(Level) ((ULONG64)1 << (0x09 * (XPTE_LEVELS - 1 - (Level))))
+
+// Index of a Virtual Page Number (VPN) in the table of a given level.
+#define XPTE_LEVEL_INDEX(Vpn, Level) (ULONG)(((Vpn) >> (0x09 * (XPTE_LEVELS - 1 - (Level)))) & (XPTE_PER_PAGE - 1))
+
+_Use_decl_annotations_
+EXTERN_C VOID XMiInitializePteWalker(
+	_Out_    PXPTE_WALKER     Walker,
+	_In_     ULONG64          DirectoryTableBase,
+	_In_     PXPTE_READ_TABLE ReadTable,
+	_In_opt_ PVOID            Context
+) {
+	// Ensure current IRQL allow paging.
+	PAGED_CODE();
+
+	Walker->DirectoryTableBase = DirectoryTableBase & XPTE_PHYSICAL_MASK;
+	Walker->ReadTable          = ReadTable;
+	Walker->Context            = Context;
+
+	// Nothing cached yet
+	for (ULONG cx = 0x00; cx < XPTE_LEVELS; cx++)
+		Walker->TableAddress[cx] = (ULONG64)-1;
+}
+
+_Use_decl_annotations_
+EXTERN_C NTSTATUS XMiWalkPageTables(
+	_Inout_ PXPTE_WALKER Walker,
+	_In_    ULONG64      StartingVpn,
+	_In_    ULONG64      EndingVpn,
+	_Inout_ PXPTE_STATS  Stats
+) {
+	// Ensure current IRQL allow paging.
+	PAGED_CODE();
+
+	ULONG64 Vpn = StartingVpn;
+	while (Vpn <= EndingVpn) {
+		ULONG64 TableAddress = Walker->DirectoryTableBase;
+
+		for (ULONG Level = 0x00; Level < XPTE_LEVELS; Level++) {
+
+			// Read the table unless already cached
+			if (Walker->TableAddress[Level] != TableAddress) {
+				if (!Walker->ReadTable(Walker->Context, TableAddress, Walker->Table[Level])) {
+					Walker->TableAddress[Level] = (ULONG64)-1;
+					return STATUS_UNSUCCESSFUL;
+				}
+				Walker->TableAddress[Level] = TableAddress;
+
+				// Lower level tables are no longer reachable from the cache
+				for (ULONG cx = Level + 1; cx < XPTE_LEVELS; cx++)
+					Walker->TableAddress[cx] = (ULONG64)-1;
+			}
+
+			ULONG   Index = XPTE_LEVEL_INDEX(Vpn, Level);
+			MMPTE   Entry = Walker->Table[Level][Index];
+			ULONG64 Span  = XPTE_LEVEL_SPAN(Level);
+
+			// Number of pages left in the range and mapped by this entry
+			ULONG64 Count = Span - (Vpn & (Span - 1));
+			if (Count > (EndingVpn - Vpn) + 1)
+				Count = (EndingVpn - Vpn) + 1;
+
+			// Leaf entries, classify the whole run within the page table
+			if (Level == (XPTE_LEVELS - 1)) {
+				XPTE_BATCH Batch = { 0x00 };
+				XMiClassifyPteBatch(&Walker->Table[Level][Index].u.Long, Count, &Batch);
+
+				Stats->ValidPages      += Batch.Count[XPteStateValid];
+				Stats->TransitionPages += Batch.Count[XPteStateTransition];
+				Stats->PagedOutPages   += Batch.Count[XPteStatePagedOut];
+				Stats->PrototypePages  += Batch.Count[XPteStatePrototype];
+				Stats->DemandZeroPages += Batch.Count[XPteStateDemandZero];
+				Vpn += Count;
+				break;
+			}
+
+			// Skip the whole range mapped by an empty or non-resident upper level entry
+			if (!Entry.u.Hard.Valid) {
+				if (Entry.u.Long == 0x00)
+					Stats->DemandZeroPages += Count;
+				else
+					Stats->PagedOutPages += Count;
+				Vpn += Count;
+				break;
+			}
+
+			// 1GB and 2MB large pages
+			if (Entry.u.Hard.LargePage) {
+				Stats->ValidPages += Count;
+				Vpn += Count;
+				break;
+			}
+
+			TableAddress = (ULONG64)Entry.u.Hard.PageFrameNumber << PAGE_SHIFT;
+		}
+	}
+	return STATUS_SUCCESS;
+}
+
+_Use_decl_annotations_
+EXTERN_C BOOLEAN XMiReadPhysicalTable(
+	_In_opt_ PVOID   Context,
+	_In_     ULONG64 PhysicalAddress,
+	_Out_writes_(XPTE_PER_PAGE) PMMPTE Table
+) {
+	UNREFERENCED_PARAMETER(Context);
+
+	// Ensure current IRQL allow paging.
+	PAGED_CODE();
+
+	MM_COPY_ADDRESS Address = { 0x00 };
+	Address.PhysicalAddress.QuadPart = (LONGLONG)PhysicalAddress;
+
+	SIZE_T   Bytes  = 0x00;
+	NTSTATUS Status = MmCopyMemory(Table, Address, PAGE_SIZE, MM_COPY_MEMORY_PHYSICAL, &Bytes);
+	return NT_SUCCESS(Status) && Bytes == PAGE_SIZE;
+}
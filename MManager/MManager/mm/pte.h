@@ -0,0 +1,103 @@
+/*+================================================================================================
+Module Name: pte.h
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+
+Abstract:
+All the routines used to walk the x64 page tables of a process and classify the pages of a range
+of Virtual Page Numbers (VPNs).
+Page tables are read by physical address via a caller supplied routine.
+
+================================================================================================+*/
+
+#ifndef __X_PTE_H_GUARD__
+#define __X_PTE_H_GUARD__
+
+#include "mmtypes.h"
+#include "ptebatch.h"
+
+// XPTE Memory Pool Tag -- XPte
+#define XPTE_MM_TAG (ULONG)0x65745058
+
+// Number of entries in a page table page.
+#define XPTE_PER_PAGE (ULONG)0x200
+
+// Number of paging levels: PML4, PDPT, PD and PT.
+#define XPTE_LEVELS (ULONG)0x04
+
+// Physical address bits of a page table entry or of CR3.
+#define XPTE_PHYSICAL_MASK (ULONG64)0x000FFFFFFFFFF000
+
+/// <summary>
+/// Routine used to read a whole page table page by physical address.
+/// </summary>
+typedef BOOLEAN(*PXPTE_READ_TABLE)(
+	_In_opt_ PVOID   Context,
+	_In_     ULONG64 PhysicalAddress,
+	_Out_writes_(XPTE_PER_PAGE) PMMPTE Table
+);
+
+/// <summary>
+/// Number of pages in each state for a range of Virtual Page Numbers (VPNs).
+/// </summary>
+typedef struct _XPTE_STATS {
+	ULONG64 ValidPages;      // Resident in the working set
+	ULONG64 TransitionPages; // On the standby or modified list
+	ULONG64 PagedOutPages;   // In a paging file, or page table not resident
+	ULONG64 PrototypePages;  // Resolved via a prototype PTE
+	ULONG64 DemandZeroPages; // Never touched or demand zero
+} XPTE_STATS, * PXPTE_STATS;
+
+/// <summary>
+/// Page table walker. The last page table page read at each level is kept to avoid reading the
+/// same upper level tables again for each range.
+/// </summary>
+typedef struct _XPTE_WALKER {
+	ULONG64          DirectoryTableBase;  // Physical address of the PML4
+	PXPTE_READ_TABLE ReadTable;           // Routine used to read page table pages
+	PVOID            Context;             // Context of the ReadTable routine
+
+	ULONG64          TableAddress[XPTE_LEVELS];  // Physical address of the cached tables
+	MMPTE            Table[XPTE_LEVELS][XPTE_PER_PAGE];
+} XPTE_WALKER, * PXPTE_WALKER;
+
+
+_IRQL_requires_max_(APC_LEVEL)
+EXTERN_C VOID XMiInitializePteWalker(
+	_Out_    PXPTE_WALKER     Walker,
+	_In_     ULONG64          DirectoryTableBase,
+	_In_     PXPTE_READ_TABLE ReadTable,
+	_In_opt_ PVOID            Context
+);
+
+/// <summary>
+/// Walk the page tables over a range of Virtual Page Numbers (VPNs) and classify each page.
+/// Empty or non-resident upper level entries account for all the pages they map without reading
+/// the lower level tables.
+/// </summary>
+/// <param name="Walker">Pointer to an initialised page table walker.</param>
+/// <param name="StartingVpn">First Virtual Page Number (VPN) of the range.</param>
+/// <param name="EndingVpn">Last Virtual Page Number (VPN) of the range.</param>
+/// <param name="Stats">Pointer to the statistics to update.</param>
+/// <returns>STATUS_UNSUCCESSFUL if a page table page could not be read, STATUS_SUCCESS otherwise.</returns>
+_IRQL_requires_max_(APC_LEVEL)
+EXTERN_C NTSTATUS XMiWalkPageTables(
+	_Inout_ PXPTE_WALKER Walker,
+	_In_    ULONG64      StartingVpn,
+	_In_    ULONG64      EndingVpn,
+	_Inout_ PXPTE_STATS  Stats
+);
+
+/// <summary>
+/// Default ReadTable routine, reading physical memory via MmCopyMemory.
+/// </summary>
+_IRQL_requires_max_(APC_LEVEL)
+EXTERN_C BOOLEAN XMiReadPhysicalTable(
+	_In_opt_ PVOID   Context,
+	_In_     ULONG64 PhysicalAddress,
+	_Out_writes_(XPTE_PER_PAGE) PMMPTE Table
+);
+
+#endif // !__X_PTE_H_GUARD__
@@ -0,0 +1,138 @@
+/*+================================================================================================
+Module Name: ptebatch.c
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+
+Abstract:
+Batch classification of raw x64 page table entries (PTEs).
+PTEs are classified four at a time with SSE2 mask and compare operations on x64, with a scalar
+fallback on other architectures. No kernel routine is used so that the code can be shared with
+user-mode tools.
+
+================================================================================================+*/
+
+#include "ptebatch.h"
+
+#if defined(_M_AMD64) || defined(__x86_64__)
+#define XPTE_BATCH_SSE2
+#include <emmintrin.h>
+#endif // _M_AMD64 || __x86_64__
+
+/// <summary>
+/// Number of bits set in a 64-bit word, without relying on the POPCNT instruction.
+/// </summary>
+static __inline ULONG64 XMipPopCount64(
+	_In_ ULONG64 Value
+) {
+	Value = Value - ((Value >> 1) & 0x5555555555555555);
+	Value = (Value & 0x3333333333333333) + ((Value >> 2) & 0x3333333333333333);
+	Value = (Value + (Value >> 4)) & 0x0F0F0F0F0F0F0F0F;
+	return (Value * 0x0101010101010101) >> 56;
+}
+
+/// <summary>
+/// Classify up to 64 PTEs one at a time into per state words.
+/// </summary>
+static __inline VOID XMipClassifyPteScalar(
+	_In_reads_(NumberOfPtes) CONST ULONG64* Ptes,
+	_In_                     ULONG          NumberOfPtes,
+	_In_                     ULONG          FirstBit,
+	_Inout_updates_(XPteStateMaximum) ULONG64 Words[XPteStateMaximum]
+) {
+	for (ULONG cx = 0x00; cx < NumberOfPtes; cx++) {
+		ULONG64 Pte = Ptes[cx];
+		ULONG64 Bit = (ULONG64)1 << (FirstBit + cx);
+
+		if (Pte & XPTE_VALID_BIT) {
+			Words[XPteStateValid] |= Bit;
+			if (Pte & XPTE_DIRTY_BIT)
+				Words[XPteStateDirty] |= Bit;
+			continue;
+		}
+
+		if (Pte & XPTE_SWIZZLE_BIT)
+			Words[XPteStateSwizzled] |= Bit;
+
+		if (Pte & XPTE_PROTOTYPE_BIT)
+			Words[XPteStatePrototype] |= Bit;
+		else if (Pte & XPTE_TRANSITION_BIT)
+			Words[XPteStateTransition] |= Bit;
+		else if (Pte & XPTE_PAGEFILE_HIGH)
+			Words[XPteStatePagedOut] |= Bit;
+		else
+			Words[XPteStateDemandZero] |= Bit;
+	}
+}
+
+#if defined(XPTE_BATCH_SSE2)
+/// <summary>
+/// Classify a multiple of 4 PTEs, up to 64, into per state words.
+/// The low and high 32 bits of four PTEs are gathered in two vectors, each tested bit is then
+/// shifted into the sign bit so that a single movemask returns the bit of the four PTEs.
+/// </summary>
+static __inline VOID XMipClassifyPteSse2(
+	_In_reads_(NumberOfPtes) CONST ULONG64* Ptes,
+	_In_                     ULONG          NumberOfPtes,
+	_Inout_updates_(XPteStateMaximum) ULONG64 Words[XPteStateMaximum]
+) {
+	CONST __m128i Zero = _mm_setzero_si128();
+
+	for (ULONG cx = 0x00; cx < NumberOfPtes; cx += 0x04) {
+		__m128 A = _mm_castsi128_ps(_mm_loadu_si128((CONST __m128i*)&Ptes[cx]));
+		__m128 B = _mm_castsi128_ps(_mm_loadu_si128((CONST __m128i*)&Ptes[cx + 0x02]));
+
+		__m128i Low  = _mm_castps_si128(_mm_shuffle_ps(A, B, _MM_SHUFFLE(2, 0, 2, 0)));
+		__m128i High = _mm_castps_si128(_mm_shuffle_ps(A, B, _MM_SHUFFLE(3, 1, 3, 1)));
+
+		ULONG64 Valid      = (ULONG64)_mm_movemask_ps(_mm_castsi128_ps(_mm_slli_epi32(Low, 31)));
+		ULONG64 Swizzle    = (ULONG64)_mm_movemask_ps(_mm_castsi128_ps(_mm_slli_epi32(Low, 27)));
+		ULONG64 Dirty      = (ULONG64)_mm_movemask_ps(_mm_castsi128_ps(_mm_slli_epi32(Low, 25)));
+		ULONG64 Prototype  = (ULONG64)_mm_movemask_ps(_mm_castsi128_ps(_mm_slli_epi32(Low, 21)));
+		ULONG64 Transition = (ULONG64)_mm_movemask_ps(_mm_castsi128_ps(_mm_slli_epi32(Low, 20)));
+		ULONG64 HighZero   = (ULONG64)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(High, Zero)));
+
+		ULONG64 Invalid = ~Valid & 0x0F;
+		ULONG64 Soft    = Invalid & ~Prototype & ~Transition;
+
+		Words[XPteStateValid]      |= Valid << cx;
+		Words[XPteStateDirty]      |= (Valid & Dirty) << cx;
+		Words[XPteStateSwizzled]   |= (Invalid & Swizzle) << cx;
+		Words[XPteStatePrototype]  |= (Invalid & Prototype) << cx;
+		Words[XPteStateTransition] |= (Invalid & ~Prototype & Transition) << cx;
+		Words[XPteStatePagedOut]   |= (Soft & ~HighZero) << cx;
+		Words[XPteStateDemandZero] |= (Soft & HighZero) << cx;
+	}
+}
+#endif // XPTE_BATCH_SSE2
+
+_Use_decl_annotations_
+EXTERN_C VOID XMiClassifyPteBatch(
+	_In_reads_(NumberOfPtes) CONST ULONG64* Ptes,
+	_In_                     ULONG64        NumberOfPtes,
+	_Inout_                  PXPTE_BATCH    Batch
+) {
+	// Process 64 PTEs at a time, one bitmap word per state
+	for (ULONG64 Offset = 0x00; Offset < NumberOfPtes; Offset += 0x40) {
+		ULONG64 Words[XPteStateMaximum] = { 0x00 };
+
+		ULONG Block = (ULONG)(NumberOfPtes - Offset);
+		if (Block > 0x40)
+			Block = 0x40;
+
+#if defined(XPTE_BATCH_SSE2)
+		ULONG Vector = Block & ~(ULONG)0x03;
+		XMipClassifyPteSse2(&Ptes[Offset], Vector, Words);
+		XMipClassifyPteScalar(&Ptes[Offset + Vector], Block - Vector, Vector, Words);
+#else
+		XMipClassifyPteScalar(&Ptes[Offset], Block, 0x00, Words);
+#endif // XPTE_BATCH_SSE2
+
+		for (ULONG State = 0x00; State < XPteStateMaximum; State++) {
+			Batch->Count[State] += XMipPopCount64(Words[State]);
+			if (Batch->Bitmap[State] != NULL)
+				Batch->Bitmap[State][Offset / 0x40] = Words[State];
+		}
+	}
+}
@@ -0,0 +1,67 @@
+/*+================================================================================================
+Module Name: ptebatch.h
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+
+Abstract:
+Batch classification of raw x64 page table entries (PTEs).
+PTEs are classified four at a time with SSE2 mask and compare operations on x64, with a scalar
+fallback on other architectures. No kernel routine is used so that the code can be shared with
+user-mode tools.
+
+================================================================================================+*/
+
+#ifndef __X_PTEBATCH_H_GUARD__
+#define __X_PTEBATCH_H_GUARD__
+
+#ifndef _NTIFS_
+#include <ntifs.h>
+#endif // !_NTIFS_
+
+// Bits of the MMPTE_* structures from mmtypes.h used for the classification.
+#define XPTE_VALID_BIT      (ULONG64)0x0000000000000001 // MMPTE_HARDWARE.Valid
+#define XPTE_SWIZZLE_BIT    (ULONG64)0x0000000000000010 // MMPTE_SOFTWARE.SwizzleBit
+#define XPTE_DIRTY_BIT      (ULONG64)0x0000000000000040 // MMPTE_HARDWARE.Dirty
+#define XPTE_PROTOTYPE_BIT  (ULONG64)0x0000000000000400 // MMPTE_PROTOTYPE.Prototype
+#define XPTE_TRANSITION_BIT (ULONG64)0x0000000000000800 // MMPTE_TRANSITION.Transition
+#define XPTE_PAGEFILE_HIGH  (ULONG64)0xFFFFFFFF00000000 // MMPTE_SOFTWARE.PageFileHigh
+
+/// <summary>
+/// State of a page table entry. A PTE can be in more than one state: valid PTEs can be dirty and
+/// invalid PTEs can have the swizzle bit set.
+/// </summary>
+typedef enum _XPTE_STATE {
+	XPteStateValid,      // Valid
+	XPteStateDirty,      // Valid and dirty
+	XPteStateTransition, // Invalid, transition
+	XPteStatePrototype,  // Invalid, prototype
+	XPteStateSwizzled,   // Invalid, swizzle bit set
+	XPteStatePagedOut,   // Invalid, in a paging file
+	XPteStateDemandZero, // Invalid, empty or demand zero
+	XPteStateMaximum
+} XPTE_STATE, * PXPTE_STATE;
+
+/// <summary>
+/// Result of the classification of an array of PTEs.
+/// </summary>
+typedef struct _XPTE_BATCH {
+	ULONG64  Count[XPteStateMaximum];  // Number of PTEs per state, added to by each classification.
+	PULONG64 Bitmap[XPteStateMaximum]; // Optional bitmaps, one bit per PTE of the array.
+} XPTE_BATCH, * PXPTE_BATCH;
+
+
+/// <summary>
+/// Classify an array of raw 64-bit PTEs.
+/// </summary>
+/// <param name="Ptes">Array of raw page table entries.</param>
+/// <param name="NumberOfPtes">Number of entries in the array.</param>
+/// <param name="Batch">Counters to add to, and optional bitmaps of at least (NumberOfPtes + 63) / 64 words.</param>
+EXTERN_C VOID XMiClassifyPteBatch(
+	_In_reads_(NumberOfPtes) CONST ULONG64* Ptes,
+	_In_                     ULONG64        NumberOfPtes,
+	_Inout_                  PXPTE_BATCH    Batch
+);
+
+#endif // !__X_PTEBATCH_H_GUARD__
@@ -13,13 +13,50 @@ APC must be disabled.
 
 #include "vad.h"
 
+// Entries of the VAD tables, reused from one request to the next instead of going back to the pool.
+static LOOKASIDE_LIST_EX XVadEntryLookaside;
+static LOOKASIDE_LIST_EX XVadFileLookaside;
+
 #ifdef ALLOC_PRAGMA
+#pragma alloc_text(PAGE, XMiInitializeVadLookasideLists)
+#pragma alloc_text(PAGE, XMiDeleteVadLookasideLists)
 #pragma alloc_text(PAGE, XMiInitializeVadTable)
 #pragma alloc_text(PAGE, XMiUninitializeVadTable)
 #pragma alloc_text(PAGE, XMiBuildVadTable)
+#pragma alloc_text(PAGE, XMiUpdateVadTableStatistics)
+#pragma alloc_text(PAGE, XMiGetVadFileEntry)
 #pragma alloc_text(PAGE, XMiGetVadNodeAbstractInfo)
 #endif // ALLOC_PRAGMA
 
+_Use_decl_annotations_
+EXTERN_C NTSTATUS XMiInitializeVadLookasideLists(
+	VOID
+) {
+	// Ensure current IRQL allow paging.
+	PAGED_CODE();
+
+	// Depth tuned by the system
+	NTSTATUS Status = ExInitializeLookasideListEx(&XVadEntryLookaside, NULL, NULL, PagedPool, 0x00, sizeof(XVAD_TABLE_ENTRY), XVAD_MM_TAG, 0x00);
+	if (!NT_SUCCESS(Status))
+		return Status;
+
+	Status = ExInitializeLookasideListEx(&XVadFileLookaside, NULL, NULL, PagedPool, 0x00, sizeof(XVAD_FILE_ENTRY), XVAD_MM_TAG, 0x00);
+	if (!NT_SUCCESS(Status))
+		ExDeleteLookasideListEx(&XVadEntryLookaside);
+	return Status;
+}
+
+_Use_decl_annotations_
+EXTERN_C VOID XMiDeleteVadLookasideLists(
+	VOID
+) {
+	// Ensure current IRQL allow paging.
+	PAGED_CODE();
+
+	ExDeleteLookasideListEx(&XVadFileLookaside);
+	ExDeleteLookasideListEx(&XVadEntryLookaside);
+}
+
 _Use_decl_annotations_
 EXTERN_C NTSTATUS XMiInitializeVadTable(
 	_In_  CONST PEPROCESS Process,
@@ -36,6 +73,25 @@ EXTERN_C NTSTATUS XMiInitializeVadTable(
 	// Allocate required data
 	XVadTable->Process = (PEPROCESS)Process;
 	InitializeListHead(&XVadTable->InsertOrderList);
+	InitializeListHead(&XVadTable->FileList);
+
+	// Reset the commit aggregation
+	XVadTable->TotalPrivateCommit = 0x00;
+	XVadTable->TotalSharedCommit  = 0x00;
+	XVadTable->NumberOfFiles      = 0x00;
+	XVadTable->UnresolvedFiles    = 0x00;
+	XVadTable->UnresolvedPages    = 0x00;
+	RtlZeroMemory(XVadTable->VadTypes, sizeof(XVadTable->VadTypes));
+	RtlZeroMemory(XVadTable->Protections, sizeof(XVadTable->Protections));
+	RtlZeroMemory(XVadTable->NameCache, sizeof(XVadTable->NameCache));
+
+	// Page table walker of the current process, the caller is attached to the process.
+	XVadTable->Walker = NULL;
+#if defined(_M_AMD64)
+	XVadTable->Walker = ExAllocatePool2(POOL_FLAG_NON_PAGED, sizeof(XPTE_WALKER), XPTE_MM_TAG);
+	if (XVadTable->Walker != NULL)
+		XMiInitializePteWalker(XVadTable->Walker, __readcr3(), XMiReadPhysicalTable, NULL);
+#endif // _M_AMD64
 
 	return STATUS_SUCCESS;
 }
@@ -50,6 +106,12 @@ EXTERN_C NTSTATUS XMiUninitializeVadTable(
 	// Ensure current IRQL allow paging.
 	PAGED_CODE();
 
+	// Release the page table walker
+	if (XVadTable->Walker != NULL) {
+		ExFreePoolWithTag(XVadTable->Walker, XPTE_MM_TAG);
+		XVadTable->Walker = NULL;
+	}
+
 	// Check if there is any nodes
 	if (XVadTable->NumberOfNodes == 0x00)
 		return STATUS_SUCCESS;
@@ -59,7 +121,14 @@ EXTERN_C NTSTATUS XMiUninitializeVadTable(
 		PLIST_ENTRY       Entry = RemoveTailList(&XVadTable->InsertOrderList);
 		PXVAD_TABLE_ENTRY Vad = CONTAINING_RECORD(Entry, XVAD_TABLE_ENTRY, List);
 		if (Vad != NULL) {
-			ExFreePoolWithTag(Vad, XVAD_MM_TAG);
+			ExFreeToLookasideListEx(&XVadEntryLookaside, Vad);
+		}
+	}
+	while (!IsListEmpty(&XVadTable->FileList)) {
+		PLIST_ENTRY      Entry = RemoveTailList(&XVadTable->FileList);
+		PXVAD_FILE_ENTRY File  = CONTAINING_RECORD(Entry, XVAD_FILE_ENTRY, List);
+		if (File != NULL) {
+			ExFreeToLookasideListEx(&XVadFileLookaside, File);
 		}
 	}
 
@@ -79,9 +148,10 @@ EXTERN_C PXVAD_TABLE_ENTRY XMiBuildVadTable(
 		XVadTree->MaximumLevel = Level;
 
 	// Allocate memory to store the new node
-	PXVAD_TABLE_ENTRY NewVadEntry = ExAllocatePool2(POOL_FLAG_PAGED, sizeof(XVAD_TABLE_ENTRY), XVAD_MM_TAG);
+	PXVAD_TABLE_ENTRY NewVadEntry = ExAllocateFromLookasideListEx(&XVadEntryLookaside);
 	if (NewVadEntry == NULL)
 		return NULL;
+	RtlZeroMemory(NewVadEntry, sizeof(XVAD_TABLE_ENTRY));
 	NewVadEntry->Level = Level;
 	XVadTree->NumberOfNodes++;
 
@@ -93,6 +163,23 @@ EXTERN_C PXVAD_TABLE_ENTRY XMiBuildVadTable(
 	XMiGetVadNodeAbstractInfo(VadNode, NewVadEntry);
 	InsertTailList(&XVadTree->InsertOrderList, &NewVadEntry->List);
 
+	// Get the name of the mapped file
+	if (NewVadEntry->ControlArea != NULL)
+		NewVadEntry->File = XMiGetVadFileEntry(XVadTree, NewVadEntry->ControlArea);
+
+	// Get the state of the pages, none rather than the pages walked before a table failed to be read
+	if (XVadTree->Walker != NULL) {
+		NTSTATUS Status = XMiWalkPageTables(XVadTree->Walker, NewVadEntry->StartingVpn, NewVadEntry->EndingVpn, &NewVadEntry->Pages);
+		if (!NT_SUCCESS(Status)) {
+			RtlZeroMemory(&NewVadEntry->Pages, sizeof(XPTE_STATS));
+			NewVadEntry->PagesUnresolved = TRUE;
+			XVadTree->UnresolvedPages++;
+		}
+	}
+
+	// Aggregate the commit while walking the tree
+	XMiUpdateVadTableStatistics(XVadTree, NewVadEntry);
+
 	// Handle the root node
 	if (Parent == NULL) {
 		NewVadEntry->Parent = (struct XVAD_TABLE_ENTRY*)NewVadEntry;
@@ -125,6 +212,109 @@ EXTERN_C PXVAD_TABLE_ENTRY XMiBuildVadTable(
 	return NewVadEntry;
 }
 
+_Use_decl_annotations_
+EXTERN_C VOID XMiUpdateVadTableStatistics(
+	_In_ PXVAD_TABLE       XVadTable,
+	_In_ PXVAD_TABLE_ENTRY TableEntry
+) {
+	// Ensure current IRQL allow paging.
+	PAGED_CODE();
+
+	ULONG64 NumberOfPages = (TableEntry->EndingVpn - TableEntry->StartingVpn) + 1;
+
+	// Private and shared totals
+	if (TableEntry->VadFlags.PrivateMemory)
+		XVadTable->TotalPrivateCommit += TableEntry->CommitCharge;
+	else
+		XVadTable->TotalSharedCommit += TableEntry->CommitCharge;
+
+	// Histogram per type and per protection
+	PXVAD_COMMIT_STATS Stats = &XVadTable->VadTypes[TableEntry->VadFlags.VadType];
+	Stats->NumberOfNodes++;
+	Stats->CommitCharge  += TableEntry->CommitCharge;
+	Stats->NumberOfPages += NumberOfPages;
+
+	Stats = &XVadTable->Protections[TableEntry->VadFlags.Protection];
+	Stats->NumberOfNodes++;
+	Stats->CommitCharge  += TableEntry->CommitCharge;
+	Stats->NumberOfPages += NumberOfPages;
+
+	// Nothing else to do for non file-backed memory
+	PXVAD_FILE_ENTRY File = TableEntry->File;
+	if (File == NULL)
+		return;
+
+	File->Stats.NumberOfNodes++;
+	File->Stats.CommitCharge  += TableEntry->CommitCharge;
+	File->Stats.NumberOfPages += NumberOfPages;
+}
+
+_Use_decl_annotations_
+EXTERN_C PXVAD_FILE_ENTRY XMiGetVadFileEntry(
+	_In_ PXVAD_TABLE   XVadTable,
+	_In_ PCONTROL_AREA ControlArea
+) {
+	// Ensure current IRQL allow paging.
+	PAGED_CODE();
+
+	// Open addressing on the address of the CONTROL_AREA, without the pool header bits.
+	ULONG Mask  = XVAD_NAME_CACHE_SIZE - 1;
+	ULONG Index = (ULONG)((((ULONG64)ControlArea >> 0x04) * 0x9E3779B97F4A7C15) >> 32) & Mask;
+
+	PXVAD_NAME_CACHE_ENTRY CacheEntry = NULL;
+	for (ULONG cx = 0x00; cx < XVAD_NAME_CACHE_SIZE; cx++) {
+		PXVAD_NAME_CACHE_ENTRY Current = &XVadTable->NameCache[(Index + cx) & Mask];
+		if (Current->ControlArea == ControlArea)
+			return Current->File;
+		if (Current->ControlArea == NULL) {
+			CacheEntry = Current;
+			break;
+		}
+	}
+
+	// First time this CONTROL_AREA is seen, get the FILE_OBJECT if any.
+	PXVAD_FILE_ENTRY File = NULL;
+	if (ControlArea->FilePointer.Value != 0x00) {
+		PFILE_OBJECT    FileObject = (PFILE_OBJECT)(ControlArea->FilePointer.Value & 0xFFFFFFFFFFFFFFF0);
+		PUNICODE_STRING Name       = &FileObject->FileName;
+
+		// The same file can be mapped through different CONTROL_AREA, e.g. as an image and as data.
+		PLIST_ENTRY Entry = XVadTable->FileList.Flink;
+		while (Entry != &XVadTable->FileList) {
+			PXVAD_FILE_ENTRY Current = CONTAINING_RECORD(Entry, XVAD_FILE_ENTRY, List);
+			if (RtlEqualUnicodeString(Current->Name, Name, TRUE)) {
+				File = Current;
+				break;
+			}
+			Entry = Entry->Flink;
+		}
+
+		// New mapped file
+		if (File == NULL) {
+			File = ExAllocateFromLookasideListEx(&XVadFileLookaside);
+			if (File == NULL) {
+				// Not cached, the next VADs of this CONTROL_AREA try again.
+				XVadTable->UnresolvedFiles++;
+				return NULL;
+			}
+			RtlZeroMemory(File, sizeof(XVAD_FILE_ENTRY));
+			File->Index       = XVadTable->NumberOfFiles;
+			File->ControlArea = ControlArea;
+			File->Name        = Name;
+
+			InsertTailList(&XVadTable->FileList, &File->List);
+			XVadTable->NumberOfFiles++;
+		}
+	}
+
+	// Cache is full, the next VADs of this CONTROL_AREA go through the list again.
+	if (CacheEntry != NULL) {
+		CacheEntry->ControlArea = ControlArea;
+		CacheEntry->File        = File;
+	}
+	return File;
+}
+
 _Use_decl_annotations_
 EXTERN_C VOID XMiGetVadNodeAbstractInfo(
 	_In_ PMMVAD            VadNode,
@@ -155,16 +345,10 @@ EXTERN_C VOID XMiGetVadNodeAbstractInfo(
 	TableEntry->VadFlags2 = VadNode->u2.VadFlags2;
 
 	// Check for a control area. Applicable only in case this is mapped memory.
+	// The name of the file is resolved once per CONTROL_AREA by XMiGetVadFileEntry.
 	if (!TableEntry->VadFlags.PrivateMemory) {
-		if (VadNode->Subsection != NULL) {
+		if (VadNode->Subsection != NULL)
 			TableEntry->ControlArea = VadNode->Subsection->ControlArea;
-
-			// Now check for the FileObject if any
-			if (TableEntry->ControlArea->FilePointer.Value != 0x00) {
-				TableEntry->FileObject = (PFILE_OBJECT)(TableEntry->ControlArea->FilePointer.Value & 0xFFFFFFFFFFFFFFF0);
-				TableEntry->Name = &TableEntry->FileObject->FileName;
-			}
-		}
 	}
 
 	// Get commit charge
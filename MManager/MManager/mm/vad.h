@@ -15,6 +15,7 @@ APC must be disabled.
 #define __X_VAD_H_GUARD__
 
 #include "mmtypes.h"
+#include "pte.h"
 
 // XVAD Memory Pool Tag -- XVad
 #define XVAD_MM_TAG (ULONG)0x64615658
@@ -22,6 +23,46 @@ APC must be disabled.
 // This is not a reliable way to get the VadRoot but could not find any better for the moment.
 #define XMM_GET_PROCESS_VAD_ROOT(ps) (PMMVAD) *(PULONG64)((PUCHAR)ps + 0x7d8)
 
+// Number of distinct MI_VAD_TYPE values.
+#define XVAD_TYPE_COUNT (ULONG)(VadLargePageSection + 1)
+
+// Number of distinct VAD protection values (5 bits).
+#define XVAD_PROTECTION_COUNT (ULONG)0x20
+
+// Number of CONTROL_AREA in the name cache, must be a power of two.
+#define XVAD_NAME_CACHE_SIZE (ULONG)0x200
+
+// Index of the name of VADs not mapping a file.
+#define XVAD_NO_FILE (ULONG)-1
+
+/// <summary>
+/// Commit aggregation for a group of Virtual Address Descriptors (VADs).
+/// </summary>
+typedef struct _XVAD_COMMIT_STATS {
+	ULONG   NumberOfNodes;  // Number of VADs in the group
+	ULONG64 CommitCharge;   // Sum of the commit charge of the VADs
+	ULONG64 NumberOfPages;  // Sum of the size of the VADs, in pages
+} XVAD_COMMIT_STATS, * PXVAD_COMMIT_STATS;
+
+/// <summary>
+/// Commit aggregation for all the VADs mapping the same file.
+/// </summary>
+typedef struct _XVAD_FILE_ENTRY {
+	LIST_ENTRY        List;
+	ULONG             Index;       // Index of the file in the string table of the snapshot
+	PCONTROL_AREA     ControlArea; // CONTROL_AREA of the first VAD mapping the file
+	PUNICODE_STRING   Name;        // Name of the mapped file
+	XVAD_COMMIT_STATS Stats;
+} XVAD_FILE_ENTRY, * PXVAD_FILE_ENTRY;
+
+/// <summary>
+/// Mapped file already resolved from a CONTROL_AREA.
+/// </summary>
+typedef struct _XVAD_NAME_CACHE_ENTRY {
+	PCONTROL_AREA    ControlArea;
+	PXVAD_FILE_ENTRY File;        // NULL if the CONTROL_AREA has no file
+} XVAD_NAME_CACHE_ENTRY, * PXVAD_NAME_CACHE_ENTRY;
+
 /// <summary>
 /// Virtual Address Descriptor (VAD) abstraction structure.
 /// </summary>
@@ -38,7 +79,6 @@ typedef struct _XVAD_TABLE_ENTRY {
 	};
 
 	PCONTROL_AREA ControlArea;  // Pointer to the CONTROL_AREA if mapped memory 
-	PFILE_OBJECT  FileObject;   // Pointer to the FILE_OBJECT if mapped memory.
 	ULONG64       StartingVpn;  // Start of Virtual Page Number(VPN).
 	ULONG64       EndingVpn;    // Start of Virtual Page Number (VPN).
 	ULONG64       CommitCharge;
@@ -65,8 +105,12 @@ typedef struct _XVAD_TABLE_ENTRY {
 		ULONG        LongVadFlags2;
 	};
 
-	// Name of the mapped file, if any.
-	PUNICODE_STRING Name;
+	// Mapped file, if any, shared by all the VADs mapping it.
+	PXVAD_FILE_ENTRY File;
+
+	// State of the pages from the page tables.
+	XPTE_STATS Pages;
+	BOOLEAN    PagesUnresolved; // Page tables could not be read, Pages not known
 } XVAD_TABLE_ENTRY, * PXVAD_TABLE_ENTRY;
 
 /// <summary>
@@ -82,9 +126,38 @@ typedef struct _XVAD_TABLE {
 
 	LIST_ENTRY        InsertOrderList;    // Order in which all nodes have been loaded
 	PXVAD_TABLE_ENTRY Root;               // First entry of the table
+
+	XVAD_COMMIT_STATS VadTypes[XVAD_TYPE_COUNT];          // Aggregation per MI_VAD_TYPE
+	XVAD_COMMIT_STATS Protections[XVAD_PROTECTION_COUNT]; // Aggregation per protection
+	ULONG             NumberOfFiles;      // Total number of distinct mapped files
+	ULONG             UnresolvedFiles;    // Mapped VADs whose file could not be tracked, out of memory
+	ULONG             UnresolvedPages;    // VADs whose page tables could not be read
+	LIST_ENTRY        FileList;           // List of XVAD_FILE_ENTRY, in index order
+
+	XVAD_NAME_CACHE_ENTRY NameCache[XVAD_NAME_CACHE_SIZE]; // Mapped file per CONTROL_AREA
+
+	PXPTE_WALKER      Walker;             // Page table walker of the process, if any
 } XVAD_TABLE, * PXVAD_TABLE;
 
 
+/// <summary>
+/// Initialise the lookaside lists the entries of the VAD tables are allocated from.
+/// </summary>
+/// <returns>STATUS_SUCCESS, or the status of ExInitializeLookasideListEx.</returns>
+_IRQL_requires_max_(PASSIVE_LEVEL)
+EXTERN_C NTSTATUS XMiInitializeVadLookasideLists(
+	VOID
+);
+
+/// <summary>
+/// Delete the lookaside lists, once all the VAD tables have been uninitialised.
+/// </summary>
+_IRQL_requires_max_(PASSIVE_LEVEL)
+EXTERN_C VOID XMiDeleteVadLookasideLists(
+	VOID
+);
+
+
 _IRQL_requires_max_(APC_LEVEL)
 EXTERN_C NTSTATUS XMiInitializeVadTable(
 	_In_  CONST PEPROCESS Process,
@@ -106,6 +179,32 @@ EXTERN_C PXVAD_TABLE_ENTRY XMiBuildVadTable(
 	_In_     ULONG             Level
 );
 
+/// <summary>
+/// Add a VAD to the commit aggregation of the table: totals, MI_VAD_TYPE and protection histograms
+/// and per mapped file totals.
+/// </summary>
+/// <param name="XVadTable">Pointer to global VAD table.</param>
+/// <param name="TableEntry">Pointer to the VAD entry to aggregate.</param>
+_IRQL_requires_max_(APC_LEVEL)
+EXTERN_C VOID XMiUpdateVadTableStatistics(
+	_In_ PXVAD_TABLE       XVadTable,
+	_In_ PXVAD_TABLE_ENTRY TableEntry
+);
+
+/// <summary>
+/// Get the mapped file of a CONTROL_AREA. The FILE_OBJECT is only followed the first time a CONTROL_AREA
+/// is seen, and files mapped through different CONTROL_AREA share the same entry.
+/// </summary>
+/// <param name="XVadTable">Pointer to global VAD table.</param>
+/// <param name="ControlArea">Pointer to the CONTROL_AREA of a mapped VAD.</param>
+/// <returns>Pointer to the mapped file, NULL if none or if it could not be tracked, in which case it is
+/// counted in UnresolvedFiles.</returns>
+_IRQL_requires_max_(APC_LEVEL)
+EXTERN_C PXVAD_FILE_ENTRY XMiGetVadFileEntry(
+	_In_ PXVAD_TABLE   XVadTable,
+	_In_ PCONTROL_AREA ControlArea
+);
+
 /// <summary>
 /// Extract all the information from a Virtual Address Descriptor (VAD) node.
 /// 
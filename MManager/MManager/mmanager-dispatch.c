@@ -29,6 +29,9 @@ EXTERN_C VOID MmanDriverUnload(
 	UNICODE_STRING SymbolicName = RTL_CONSTANT_STRING(MMANAGER_SYMBOLIC_LINK_NAME);
 	IoDeleteSymbolicLink(&SymbolicName);
 	IoDeleteDevice(DriverObject->DeviceObject);
+
+	// No request is running anymore
+	XMiDeleteVadLookasideLists();
 }
 
 _Use_decl_annotations_
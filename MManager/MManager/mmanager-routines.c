@@ -170,14 +170,19 @@ EXTERN_C NTSTATUS MmanIoctlGetProcessVads(
 		goto exit;
 	}
 
-	// Get the header 
+	// Get the header, cleared as the buffer comes from the caller
 	PMMANAGER_VADLIST_HEADER Header = UserBuffer;
+	RtlZeroMemory(Header, sizeof(MMANAGER_VADLIST_HEADER));
 	Header->Size = sizeof(MMANAGER_VADLIST_HEADER);
 	Header->MaximumLevel = VadTable.MaximumLevel;
 	Header->NumberOfNodes = VadTable.NumberOfNodes;
 	Header->TotalPrivateCommit = VadTable.TotalPrivateCommit;
 	Header->TotalSharedCommit = VadTable.TotalSharedCommit;
 	Header->Eprocess = VadTable.Process;
+	Header->UnresolvedFiles = VadTable.UnresolvedFiles;
+	Header->UnresolvedPages = VadTable.UnresolvedPages;
+	RtlCopyMemory(Header->VadTypes, VadTable.VadTypes, sizeof(Header->VadTypes));
+	RtlCopyMemory(Header->Protections, VadTable.Protections, sizeof(Header->Protections));
 
 	// Get address of first entry
 	PVOID EntryPoint = (PUCHAR)Header + Header->Size;
@@ -194,6 +199,7 @@ EXTERN_C NTSTATUS MmanIoctlGetProcessVads(
 
 		// New entry in output memory
 		PMMANAGER_VADLIST_ENTRY OutEntry = EntryPoint;
+		RtlZeroMemory(OutEntry, sizeof(MMANAGER_VADLIST_ENTRY));
 		OutEntry->List.Blink = XLATE_TO_UM_ADDRESS(UmAddress, Header, Blink);
 
 		if (OutEntry == Header->First)
@@ -208,15 +214,23 @@ EXTERN_C NTSTATUS MmanIoctlGetProcessVads(
 		OutEntry->LongVadFlags1 = TableEntry->LongVadFlags1;
 		OutEntry->LongVadFlags2 = TableEntry->LongVadFlags2;
 
-		if (TableEntry->Name != NULL) {
-			OutEntry->FileNameSize = TableEntry->Name->Length;
-			RtlCopyMemory(OutEntry->FileName, TableEntry->Name->Buffer, OutEntry->FileNameSize);
+		OutEntry->ValidPages      = TableEntry->Pages.ValidPages;
+		OutEntry->TransitionPages = TableEntry->Pages.TransitionPages;
+		OutEntry->PagedOutPages   = TableEntry->Pages.PagedOutPages;
+		OutEntry->PrototypePages  = TableEntry->Pages.PrototypePages;
+		OutEntry->DemandZeroPages = TableEntry->Pages.DemandZeroPages;
+		OutEntry->PagesUnresolved = TableEntry->PagesUnresolved;
+
+		// Names are sent once in the file table, entries only refer to them.
+		OutEntry->FileIndex = MMANAGER_NO_FILE;
+		if (TableEntry->File != NULL) {
+			OutEntry->FileIndex = TableEntry->File->Index;
 		}
 		else if (TableEntry->ControlArea != NULL) {
 			OutEntry->CommitPageCount = TableEntry->ControlArea->u3.CommittedPageCount;
 		}
 
-		OutEntry->Size = sizeof(MMANAGER_VADLIST_ENTRY) + OutEntry->FileNameSize;
+		OutEntry->Size = sizeof(MMANAGER_VADLIST_ENTRY);
 		Header->Size += OutEntry->Size;
 
 		// Check for end of the parsing
@@ -235,6 +249,29 @@ EXTERN_C NTSTATUS MmanIoctlGetProcessVads(
 
 	// Set last data
 	Header->Last = XLATE_TO_UM_ADDRESS(UmAddress, Header, EntryPoint);;
+
+	// Per mapped file aggregation and name after the last entry, in index order
+	Header->Size    = ALIGN_UP_BY(Header->Size, sizeof(ULONG64));
+	PVOID FilePoint = (PUCHAR)Header + Header->Size;
+	if (VadTable.NumberOfFiles != 0x00)
+		Header->FirstFile = XLATE_TO_UM_ADDRESS(UmAddress, Header, FilePoint);
+
+	ListEntry = VadTable.FileList.Flink;
+	while (ListEntry != &VadTable.FileList) {
+		PXVAD_FILE_ENTRY       File    = CONTAINING_RECORD(ListEntry, XVAD_FILE_ENTRY, List);
+		PMMANAGER_VADLIST_FILE OutFile = FilePoint;
+
+		RtlCopyMemory(&OutFile->Stats, &File->Stats, sizeof(MMANAGER_VADLIST_STATS));
+		OutFile->FileNameSize = File->Name->Length;
+		RtlCopyMemory(OutFile->FileName, File->Name->Buffer, OutFile->FileNameSize);
+
+		OutFile->Size = ALIGN_UP_BY(sizeof(MMANAGER_VADLIST_FILE) + OutFile->FileNameSize, sizeof(ULONG64));
+		Header->Size += OutFile->Size;
+		Header->NumberOfFiles++;
+
+		FilePoint = (PUCHAR)FilePoint + OutFile->Size;
+		ListEntry = ListEntry->Flink;
+	}
 	*BufferOutSize = Header->Size;
 exit:
 	// Release memory
@@ -266,8 +303,6 @@ EXTERN_C ULONG64 MmanpCalculateStructureSize(
 			break;
 
 		TotalSize += sizeof(MMANAGER_VADLIST_ENTRY);
-		if (TableEntry->Name != NULL)
-			TotalSize += TableEntry->Name->Length + sizeof(WCHAR);
 
 		// Next entry
 		if (Entry->Flink == &VadTable.InsertOrderList)
@@ -275,6 +310,15 @@ EXTERN_C ULONG64 MmanpCalculateStructureSize(
 		Entry = Entry->Flink;
 	} while (TRUE);
 
+	// Per mapped file aggregation and names
+	TotalSize = ALIGN_UP_BY(TotalSize, sizeof(ULONG64));
+	Entry     = VadTable.FileList.Flink;
+	while (Entry != &VadTable.FileList) {
+		PXVAD_FILE_ENTRY File = CONTAINING_RECORD(Entry, XVAD_FILE_ENTRY, List);
+		TotalSize += ALIGN_UP_BY(sizeof(MMANAGER_VADLIST_FILE) + File->Name->Length, sizeof(ULONG64));
+		Entry = Entry->Flink;
+	}
+
 	// Return the aligned memory.
 	while ((TotalSize % PAGE_SIZE) != 0x00)
 		TotalSize++;
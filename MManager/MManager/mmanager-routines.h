@@ -19,13 +19,22 @@ Handle User-Mode IOCTL requests.
 #define XLATE_TO_UM_ADDRESS(UM, KM, Address) \
 	(PVOID)(((PUCHAR)UM) + ((PUCHAR)Address - ((PUCHAR)KM)))
 
+// Number of entries in the MI_VAD_TYPE histogram.
+#define MMANAGER_VAD_TYPE_COUNT   XVAD_TYPE_COUNT
+
+// Number of entries in the protection histogram.
+#define MMANAGER_PROTECTION_COUNT XVAD_PROTECTION_COUNT
+
+// Index of the mapped file of VADs not mapping a file.
+#define MMANAGER_NO_FILE XVAD_NO_FILE
+
 typedef struct _MMANAGER_VADLIST_ENTRY {
 	struct {
 		struct _MMANAGER_VADLIST_ENTRY* Flink;
 		struct _MMANAGER_VADLIST_ENTRY* Blink;
 	} List;
 
-	ULONG64 Size;            // Size of the entry (structure + PWCHAR if filename)
+	ULONG64 Size;            // Size of the entry
 
 	PVOID   VadAddress;      // Address of the VAD node
 	ULONG   Level;           // Node depth level
@@ -33,6 +42,11 @@ typedef struct _MMANAGER_VADLIST_ENTRY {
 	ULONG64 VpnEnding;       // Start of Virtual Page Number (VPN).
 	ULONG64 CommitCharge;    // Number of bytes commit
 	ULONG64 CommitPageCount; // Number of pages commit
+	ULONG64 ValidPages;      // Number of pages resident
+	ULONG64 TransitionPages; // Number of pages on the standby or modified list
+	ULONG64 PagedOutPages;   // Number of pages in a paging file
+	ULONG64 PrototypePages;  // Number of pages resolved via a prototype PTE
+	ULONG64 DemandZeroPages; // Number of pages never touched or demand zero
 
 	// First set of flags.
 	union {
@@ -53,11 +67,28 @@ typedef struct _MMANAGER_VADLIST_ENTRY {
 		MMVAD_FLAGS2 VadFlags2;
 	};
 
-	ULONG   FileNameSize;  // Size of the filename
-	WCHAR   FileName[ANYSIZE_ARRAY]; // Pointer to the filename
+	ULONG   FileIndex;       // Index of the mapped file in the file table, MMANAGER_NO_FILE if none
+	BOOLEAN PagesUnresolved; // Page tables could not be read, page counts not known
 } MMANAGER_VADLIST_ENTRY, * PMMANAGER_VADLIST_ENTRY;
 
 
+typedef struct _MMANAGER_VADLIST_STATS {
+	ULONG   NumberOfNodes;   // Number of VADs in the group
+	ULONG64 CommitCharge;    // Sum of the commit charge of the VADs
+	ULONG64 NumberOfPages;   // Sum of the size of the VADs, in pages
+} MMANAGER_VADLIST_STATS, * PMMANAGER_VADLIST_STATS;
+C_ASSERT(sizeof(MMANAGER_VADLIST_STATS) == sizeof(XVAD_COMMIT_STATS));
+
+
+typedef struct _MMANAGER_VADLIST_FILE {
+	ULONG64                Size;  // Size of the entry (structure + PWCHAR), aligned on 8 bytes
+	MMANAGER_VADLIST_STATS Stats; // Aggregation of all the VADs mapping the file
+
+	ULONG   FileNameSize;            // Size of the filename
+	WCHAR   FileName[ANYSIZE_ARRAY]; // Pointer to the filename
+} MMANAGER_VADLIST_FILE, * PMMANAGER_VADLIST_FILE;
+
+
 typedef struct _MMANAGER_VADLIST_HEADER {
 	ULONG64           Size;               // Size of the data (header + all entries)
 	ULONG             MaximumLevel;       // Deepest level
@@ -68,6 +99,14 @@ typedef struct _MMANAGER_VADLIST_HEADER {
 
 	PMMANAGER_VADLIST_ENTRY First;
 	PMMANAGER_VADLIST_ENTRY Last;
+
+	MMANAGER_VADLIST_STATS VadTypes[MMANAGER_VAD_TYPE_COUNT];      // Aggregation per MI_VAD_TYPE
+	MMANAGER_VADLIST_STATS Protections[MMANAGER_PROTECTION_COUNT]; // Aggregation per protection
+
+	ULONG                  NumberOfFiles;   // Number of distinct mapped files
+	ULONG                  UnresolvedFiles; // Mapped VADs whose file could not be tracked
+	ULONG                  UnresolvedPages; // VADs whose page tables could not be read
+	PMMANAGER_VADLIST_FILE FirstFile;     // First file of the table, in index order and Size bytes apart
 } MMANAGER_VADLIST_HEADER, * PMMANAGER_VADLIST_HEADER;
 
 
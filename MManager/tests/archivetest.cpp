@@ -0,0 +1,229 @@
+/*+================================================================================================
+Module Name: archivetest.cpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+
+Abstract:
+Check that a VAD list archive survives an interrupted append and a stale time index.
+Synthetic snapshots are appended, the last block torn as if the process had been killed while
+writing it, and more snapshots appended: every complete block must be readable and decoded as
+written. The index is then made to miss a block, to point in the middle of the archive and to
+be deleted, and must each time be rebuilt when opening the archive.
+
+Build: c++ -std=c++17 -O2 -g [-fsanitize=address,undefined] ../vadlist/archive.cpp archivetest.cpp -o archivetest
+
+================================================================================================+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../vadlist/archive.h"
+
+// Archive written by default, in the current directory.
+#define ARCHIVETEST_PATH "archivetest.vada"
+
+// Number of VADs of a snapshot.
+#define ARCHIVETEST_NODES (ULONG)0x40
+
+static ULONG ArchiveTestErrors = 0x00;
+
+#define ARCHIVETEST_CHECK(Condition, ...)  \
+	do {                                   \
+		if (!(Condition)) {                \
+			printf("[-] " __VA_ARGS__);    \
+			printf("\n");                  \
+			ArchiveTestErrors++;           \
+		}                                  \
+	} while (0)
+
+/// <summary>
+/// Build the snapshot of index Seed.
+/// </summary>
+static ARCHIVE_SNAPSHOT ArchiveTestSnapshot(
+	_In_ ULONG Seed
+) {
+	ARCHIVE_SNAPSHOT Snapshot;
+	Snapshot.Timestamp = 1700000000 + (ULONG64)Seed * 60;
+	Snapshot.Eprocess  = 0xFFFFA00000000080 + (ULONG64)Seed * 0x1000;
+	Snapshot.ProcessId = 0x04 * (Seed + 0x01);
+
+	ARCHIVE_STRING Name;
+	for (CONST CHAR* Char = "\\Windows\\System32\\ntdll.dll"; *Char != '\0'; Char++)
+		Name.push_back((WCHAR)*Char);
+	Name.push_back((WCHAR)(L'0' + (Seed % 10)));
+	Snapshot.Files.push_back(Name);
+
+	for (ULONG cx = 0x00; cx < ARCHIVETEST_NODES; cx++) {
+		ARCHIVE_ENTRY Entry = { 0x00 };
+		Entry.VadAddress    = 0xFFFFA10000000000 + ((ULONG64)Seed << 20) + (ULONG64)cx * 0x80;
+		Entry.Level         = cx % 0x07;
+		Entry.VpnStarting   = 0x7FF000 + (ULONG64)cx * 0x20 + Seed;
+		Entry.VpnEnding     = Entry.VpnStarting + 0x10;
+		Entry.CommitCharge  = cx + Seed;
+		Entry.ValidPages    = cx % 0x11;
+		Entry.LongVadFlags  = 0x3000 | (cx % 0x03);
+		Entry.FileIndex     = (cx % 0x02) == 0x00 ? 0x00 : ARCHIVE_NO_FILE;
+		Snapshot.Entries.push_back(Entry);
+	}
+	return Snapshot;
+}
+
+
+/// <summary>
+/// Append the snapshot of index Seed.
+/// </summary>
+static VOID ArchiveTestAppend(
+	_In_z_ CONST CHAR* Path,
+	_In_   ULONG       Seed
+) {
+	ARCHIVE_SNAPSHOT Snapshot = ArchiveTestSnapshot(Seed);
+	ARCHIVETEST_CHECK(CVadArchive::Append(Path, Snapshot), "unable to append snapshot %u", Seed);
+}
+
+
+/// <summary>
+/// Read a whole file, empty if missing.
+/// </summary>
+static std::vector<UCHAR> ArchiveTestRead(
+	_In_z_ CONST CHAR* Path
+) {
+	std::vector<UCHAR> Content;
+	FILE* File = fopen(Path, "rb");
+	if (File == NULL)
+		return Content;
+
+	UCHAR  Buffer[0x1000];
+	SIZE_T Read = 0x00;
+	while ((Read = fread(Buffer, 0x01, sizeof(Buffer), File)) != 0x00)
+		Content.insert(Content.end(), Buffer, Buffer + Read);
+	fclose(File);
+	return Content;
+}
+
+
+/// <summary>
+/// Replace the content of a file.
+/// </summary>
+static VOID ArchiveTestWrite(
+	_In_z_ CONST CHAR*               Path,
+	_In_   CONST std::vector<UCHAR>& Content
+) {
+	FILE* File = fopen(Path, "wb");
+	ARCHIVETEST_CHECK(File != NULL, "unable to write %s", Path);
+	if (File == NULL)
+		return;
+	if (!Content.empty())
+		fwrite(Content.data(), 0x01, Content.size(), File);
+	fclose(File);
+}
+
+
+/// <summary>
+/// Open the archive and check that it holds exactly the snapshots of the given seeds.
+/// </summary>
+static VOID ArchiveTestVerify(
+	_In_z_ CONST CHAR*               Path,
+	_In_   CONST std::vector<ULONG>& Seeds,
+	_In_z_ CONST CHAR*               Step
+) {
+	CVadArchive Archive;
+	if (!Archive.Open(Path)) {
+		ARCHIVETEST_CHECK(FALSE, "%s: unable to open the archive", Step);
+		return;
+	}
+	ARCHIVETEST_CHECK(Archive.GetNumberOfBlocks() == Seeds.size(),
+		"%s: %llu of %zu blocks indexed", Step, (unsigned long long)Archive.GetNumberOfBlocks(), Seeds.size());
+
+	for (ULONG64 Block = 0x00; Block < Archive.GetNumberOfBlocks() && Block < Seeds.size(); Block++) {
+		ARCHIVE_SNAPSHOT Expected = ArchiveTestSnapshot(Seeds[Block]);
+		ARCHIVE_SNAPSHOT Snapshot;
+		if (!Archive.ReadBlock(Block, Snapshot)) {
+			ARCHIVETEST_CHECK(FALSE, "%s: unable to read block %llu", Step, (unsigned long long)Block);
+			continue;
+		}
+
+		BOOLEAN Same = Snapshot.Timestamp == Expected.Timestamp
+			&& Snapshot.Eprocess == Expected.Eprocess
+			&& Snapshot.ProcessId == Expected.ProcessId
+			&& Snapshot.Files == Expected.Files
+			&& Snapshot.Entries.size() == Expected.Entries.size();
+		for (SIZE_T cx = 0x00; Same && cx < Expected.Entries.size(); cx++) {
+			CONST ARCHIVE_ENTRY& Left  = Snapshot.Entries[cx];
+			CONST ARCHIVE_ENTRY& Right = Expected.Entries[cx];
+			Same = Left.VadAddress == Right.VadAddress
+				&& Left.Level == Right.Level
+				&& Left.VpnStarting == Right.VpnStarting
+				&& Left.VpnEnding == Right.VpnEnding
+				&& Left.CommitCharge == Right.CommitCharge
+				&& Left.ValidPages == Right.ValidPages
+				&& Left.LongVadFlags == Right.LongVadFlags
+				&& Left.FileIndex == Right.FileIndex;
+		}
+		ARCHIVETEST_CHECK(Same, "%s: block %llu differs from snapshot %u", Step, (unsigned long long)Block, Seeds[Block]);
+	}
+
+	ULONG64 Seek = Archive.Seek(ArchiveTestSnapshot(Seeds.back()).Timestamp);
+	ARCHIVETEST_CHECK(Seek == Seeds.size() - 1, "%s: last snapshot found at block %llu", Step, (unsigned long long)Seek);
+}
+
+
+int main(int argc, char** argv) {
+	CONST CHAR* Path = argc > 1 ? argv[1] : ARCHIVETEST_PATH;
+	std::string IndexPath = std::string(Path) + ARCHIVE_INDEX_EXTENSION;
+	remove(Path);
+	remove(IndexPath.c_str());
+
+	// 3 snapshots, the last one torn in the middle of its payload
+	for (ULONG Seed = 0x00; Seed < 0x03; Seed++)
+		ArchiveTestAppend(Path, Seed);
+	std::vector<UCHAR> Content = ArchiveTestRead(Path);
+	std::vector<UCHAR> Index   = ArchiveTestRead(IndexPath.c_str());
+	ARCHIVE_INDEX_ENTRY Last = { 0x00 };
+	if (Index.size() == 0x03 * sizeof(ARCHIVE_INDEX_ENTRY))
+		memcpy(&Last, &Index[0x02 * sizeof(ARCHIVE_INDEX_ENTRY)], sizeof(ARCHIVE_INDEX_ENTRY));
+	ARCHIVETEST_CHECK(Last.Offset != 0x00 && Last.Offset < Content.size(), "unexpected index after 3 appends");
+	Content.resize((SIZE_T)Last.Offset + (Content.size() - (SIZE_T)Last.Offset) / 0x02);
+	ArchiveTestWrite(Path, Content);
+	ArchiveTestVerify(Path, { 0x00, 0x01 }, "torn block");
+
+	// 3 more snapshots, written over the torn block
+	for (ULONG Seed = 0x03; Seed < 0x06; Seed++)
+		ArchiveTestAppend(Path, Seed);
+	ArchiveTestVerify(Path, { 0x00, 0x01, 0x03, 0x04, 0x05 }, "append after torn block");
+
+	// Torn block header, with the index still up to date
+	Content = ArchiveTestRead(Path);
+	Content.resize(Content.size() + sizeof(ARCHIVE_BLOCK_HEADER) / 0x02, 0x00);
+	memcpy(&Content[Content.size() - sizeof(ARCHIVE_BLOCK_HEADER) / 0x02], "VADB", 0x04);
+	ArchiveTestWrite(Path, Content);
+	ArchiveTestAppend(Path, 0x06);
+	ArchiveTestVerify(Path, { 0x00, 0x01, 0x03, 0x04, 0x05, 0x06 }, "torn block header");
+
+	// Index missing a block in the middle
+	Index = ArchiveTestRead(IndexPath.c_str());
+	std::vector<UCHAR> Stale(Index);
+	Stale.erase(Stale.begin() + 0x02 * sizeof(ARCHIVE_INDEX_ENTRY), Stale.begin() + 0x03 * sizeof(ARCHIVE_INDEX_ENTRY));
+	ArchiveTestWrite(IndexPath.c_str(), Stale);
+	ArchiveTestVerify(Path, { 0x00, 0x01, 0x03, 0x04, 0x05, 0x06 }, "index missing a block");
+
+	// Index pointing past the start of a block
+	Index = ArchiveTestRead(IndexPath.c_str());
+	Stale = Index;
+	ARCHIVE_INDEX_ENTRY* Entry = (ARCHIVE_INDEX_ENTRY*)&Stale[0x01 * sizeof(ARCHIVE_INDEX_ENTRY)];
+	Entry->Offset += 0x08;
+	ArchiveTestWrite(IndexPath.c_str(), Stale);
+	ArchiveTestVerify(Path, { 0x00, 0x01, 0x03, 0x04, 0x05, 0x06 }, "index with a wrong offset");
+	ARCHIVETEST_CHECK(ArchiveTestRead(IndexPath.c_str()) == Index, "rebuilt index differs from the appended one");
+
+	// Index deleted, and an append before the next open
+	remove(IndexPath.c_str());
+	ArchiveTestAppend(Path, 0x07);
+	ArchiveTestVerify(Path, { 0x00, 0x01, 0x03, 0x04, 0x05, 0x06, 0x07 }, "index deleted");
+
+	remove(Path);
+	remove(IndexPath.c_str());
+	printf("[>] %u error(s)\n", ArchiveTestErrors);
+	return ArchiveTestErrors == 0x00 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
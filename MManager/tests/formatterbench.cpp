@@ -0,0 +1,476 @@
+/*+================================================================================================
+Module Name: formatterbench.cpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+
+Abstract:
+Benchmark of the row formatter of the VAD list against the wprintf calls it replaced.
+Synthetic VADs, some mapping files with quotes, non-ASCII characters and surrogate pairs in their
+name, are written to temporary files by both paths. The rows of the text table, of the CSV and of
+the JSON Lines output are also checked against the fields rendered one by one with snprintf, with
+a small buffer so that fields are split by the flushes. The number of rows can be given on the
+command line.
+
+Build: c++ -std=c++17 -O2 -g [-fsanitize=address,undefined] ../vadlist/formatter.cpp formatterbench.cpp -o formatterbench
+
+================================================================================================+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <wchar.h>
+#include <chrono>
+#include <random>
+#include <string>
+
+#include "../vadlist/formatter.h"
+
+// Default number of rows.
+#define FORMATTERBENCH_ROWS (SIZE_T)0x40000
+
+// Rows checked for each output format.
+#define FORMATTERBENCH_CHECKED_ROWS (SIZE_T)0x400
+
+// Buffer of the formatter when checking the rows, smaller than a row.
+#define FORMATTERBENCH_SMALL_BUFFER (SIZE_T)0x100
+
+/// <summary>
+/// Synthetic VAD, as listed by vadlist.
+/// </summary>
+typedef struct _FORMATTERBENCH_ROW {
+	ULONG64      VadAddress;
+	ULONG        Level;
+	ULONG64      VpnStarting;
+	ULONG64      VpnEnding;
+	ULONG64      CommitCharge;
+	ULONG64      ValidPages;
+	ULONG64      TransitionPages;
+	BOOLEAN      PrivateMemory;
+	ULONG        VadType;
+	ULONG        Protection;
+	std::wstring FileName;
+	ULONG64      CommitPageCount;
+} FORMATTERBENCH_ROW, * PFORMATTERBENCH_ROW;
+
+// Columns of vadlist.
+static CONST FORMAT_COLUMN FormatterBenchColumns[] = {
+	{ "VAD",            19 },
+	{ "Level",           7 },
+	{ "VPN Start",      11 },
+	{ "VPN End",        11 },
+	{ "Commit",         10 },
+	{ "Valid",          10 },
+	{ "Trans",           7 },
+	{ "Memory",          9 },
+	{ "Type",           13 },
+	{ "Protection",     30 },
+	{ "Pagefile/Image", 0x00 }
+};
+
+static CONST CHAR* FormatterBenchTypes[] = {
+	"", "Phys", "Exe", "AWE", "WrtWatch", "LargePag", "Rotate", "LargePagSec"
+};
+
+static CONST CHAR* FormatterBenchProtections[] = {
+	"", "READONLY", "EXECUTE", "EXECUTE_READ", "READWRITE", "WRITECOPY", "EXECUTE_READWRITE", "EXECUTE_WRITECOPY",
+	"NOCACHE", "READONLY NOCACHE", "EXECUTE NOCACHE", "EXECUTE_READ NOCACHE", "READWRITE NOCACHE", "WRITECOPY NOCACHE",
+	"EXECUTE_READWRITE NOCACHE", "EXECUTE_WRITECOPY NOCACHE", "GUARD_PAGE", "READONLY GUARD_PAGE", "EXECUTE GUARD_PAGE",
+	"EXECUTE_READ GUARD_PAGE", "READWRITE GUARD_PAGE", "WRITECOPY GUARD_PAGE", "EXECUTE_READWRITE GUARD_PAGE",
+	"EXECUTE_WRITECOPY GUARD_PAGE", "NO_ACCESS", "READONLY NO_ACCESS", "EXECUTE NO_ACCESS", "EXECUTE_READ NO_ACCESS",
+	"READWRITE NO_ACCESS", "WRITECOPY NO_ACCESS", "EXECUTE_READWRITE NO_ACCESS", "EXECUTE_WRITECOPY NO_ACCESS"
+};
+
+/// <summary>
+/// Build the rows of a synthetic process.
+/// </summary>
+static std::vector<FORMATTERBENCH_ROW> FormatterBenchRows(
+	_In_ SIZE_T NumberOfRows
+) {
+	static CONST WCHAR* Names[] = {
+		L"\\Windows\\System32\\ntdll.dll",
+		L"\\Windows\\System32\\kernel32.dll",
+		L"\\Users\\Ren\u00E9e\\AppData\\Local\\Temp\\\"quoted\".dat",
+		L"\\Program Files\\\u65E5\u672C\\tool.exe",
+		L"\\Temp\\\xD83D\xDE00\\emoji.bin",
+		L"\\Temp\\tab\there.log"
+	};
+
+	std::mt19937_64                 Random(0x464F524D);
+	std::vector<FORMATTERBENCH_ROW> Rows(NumberOfRows);
+	ULONG64                         Vpn = 0x7FFE0;
+	for (SIZE_T cx = 0x00; cx < NumberOfRows; cx++) {
+		FORMATTERBENCH_ROW& Row = Rows[cx];
+		Row.VadAddress      = 0xFFFF800000000000 | (Random() & 0x7FFFFFFFFFF0);
+		Row.Level           = (ULONG)(Random() % 0x18);
+		Row.VpnStarting     = Vpn;
+		Row.VpnEnding       = Vpn + (Random() % 0x1000);
+		Row.CommitCharge    = Random() % 0x100000;
+		Row.ValidPages      = Random() % 0x1000;
+		Row.TransitionPages = Random() % 0x100;
+		Row.PrivateMemory   = (Random() % 0x02) == 0x00;
+		Row.VadType         = (ULONG)(Random() % _ARRAYSIZE(FormatterBenchTypes));
+		Row.Protection      = (ULONG)(Random() % _ARRAYSIZE(FormatterBenchProtections));
+		Row.CommitPageCount = 0x00;
+		switch (Random() % 0x03) {
+		case 0x00:
+			Row.FileName = Names[Random() % _ARRAYSIZE(Names)];
+			break;
+		case 0x01:
+			Row.CommitPageCount = Random() % 0x10000;
+			break;
+		default:
+			break;
+		}
+		Vpn = Row.VpnEnding + 0x01 + (Random() % 0x100);
+	}
+	return Rows;
+}
+
+
+/// <summary>
+/// Write the rows with wprintf, as PrintProcessVads did, with the C99 length modifiers.
+/// </summary>
+static VOID FormatterBenchPrintf(
+	_In_ FILE*                                  Stream,
+	_In_ CONST std::vector<FORMATTERBENCH_ROW>& Rows
+) {
+	fwprintf(Stream, L"VAD              Level  VPN Start    VPN End  Commit    Valid     Trans  Type         Protection         Pagefile/Image\r\n");
+	fwprintf(Stream, L"---              -----  ---------    -------  ------    -----     -----  ----         ----------         --------------\r\n");
+	for (CONST FORMATTERBENCH_ROW& Row : Rows) {
+		fwprintf(Stream, L"%p %5d  %9llx  %9llx  %-8lld  %-8lld  %-5lld  %ls",
+			(PVOID)Row.VadAddress,
+			Row.Level,
+			Row.VpnStarting,
+			Row.VpnEnding,
+			Row.CommitCharge,
+			Row.ValidPages,
+			Row.TransitionPages,
+			Row.PrivateMemory ? L"Private " : L"Mapped  "
+		);
+
+		switch (Row.VadType) {
+		case 0x01:
+			fwprintf(Stream, L"Phys ");
+			break;
+		case 0x02:
+			fwprintf(Stream, L"Exe  ");
+			break;
+		case 0x03:
+			fwprintf(Stream, L"AWE  ");
+			break;
+		case 0x04:
+			fwprintf(Stream, L"WrtWatch  ");
+			break;
+		case 0x05:
+			fwprintf(Stream, L"LargePag  ");
+			break;
+		case 0x06:
+			fwprintf(Stream, L"Rotate  ");
+			break;
+		case 0x07:
+			fwprintf(Stream, L"LargePagSec  ");
+			break;
+		default:
+			fwprintf(Stream, L"     ");
+			break;
+		}
+
+		switch (Row.Protection & 0x07) {
+		case 0x01:
+			fwprintf(Stream, L"READONLY           ");
+			break;
+		case 0x02:
+			fwprintf(Stream, L"EXECUTE            ");
+			break;
+		case 0x03:
+			fwprintf(Stream, L"EXECUTE_READ       ");
+			break;
+		case 0x04:
+			fwprintf(Stream, L"READWRITE          ");
+			break;
+		case 0x05:
+			fwprintf(Stream, L"WRITECOPY          ");
+			break;
+		case 0x06:
+			fwprintf(Stream, L"EXECUTE_READWRITE  ");
+			break;
+		case 0x07:
+			fwprintf(Stream, L"EXECUTE_WRITECOPY  ");
+			break;
+		}
+		switch (Row.Protection >> 0x03) {
+		case 0x01:
+			fwprintf(Stream, L"NOCACHE            ");
+			break;
+		case 0x02:
+			fwprintf(Stream, L"GUARD_PAGE         ");
+			break;
+		case 0x03:
+			fwprintf(Stream, L"NO_ACCESS          ");
+			break;
+		}
+
+		if (!Row.FileName.empty())
+			fwprintf(Stream, L"%.*ls", (INT)Row.FileName.size(), Row.FileName.c_str());
+		else if (Row.CommitPageCount != 0x00)
+			fwprintf(Stream, L"Pagefile section, shared commit %#llx", Row.CommitPageCount);
+		fwprintf(Stream, L"\r\n");
+	}
+}
+
+
+/// <summary>
+/// Write the rows with the formatter, as PrintProcessVads does.
+/// </summary>
+static VOID FormatterBenchFormat(
+	_In_ FILE*                                  Stream,
+	_In_ FORMAT_SINK                            Sink,
+	_In_ CONST std::vector<FORMATTERBENCH_ROW>& Rows,
+	_In_ SIZE_T                                 NumberOfRows,
+	_In_ SIZE_T                                 Capacity
+) {
+	CRowFormatter Formatter(Sink, FormatterBenchColumns, _ARRAYSIZE(FormatterBenchColumns), Stream, Capacity);
+	Formatter.WriteHeader();
+
+	for (SIZE_T cx = 0x00; cx < NumberOfRows; cx++) {
+		CONST FORMATTERBENCH_ROW& Row = Rows[cx];
+		Formatter.AddHex(Row.VadAddress, sizeof(PVOID) * 2);
+		Formatter.AddDecimal(Row.Level);
+		Formatter.AddHex(Row.VpnStarting);
+		Formatter.AddHex(Row.VpnEnding);
+		Formatter.AddDecimal(Row.CommitCharge);
+		Formatter.AddDecimal(Row.ValidPages);
+		Formatter.AddDecimal(Row.TransitionPages);
+		Formatter.AddString(Row.PrivateMemory ? "Private" : "Mapped");
+		Formatter.AddString(FormatterBenchTypes[Row.VadType]);
+		Formatter.AddString(FormatterBenchProtections[Row.Protection]);
+
+		if (!Row.FileName.empty()) {
+			Formatter.AddWideString(Row.FileName.c_str(), Row.FileName.size());
+		}
+		else if (Row.CommitPageCount != 0x00) {
+			CHAR Section[0x40] = { 0x00 };
+			snprintf(Section, sizeof(Section), "Pagefile section, shared commit %#llx", (unsigned long long)Row.CommitPageCount);
+			Formatter.AddString(Section);
+		}
+		Formatter.EndRow();
+	}
+	Formatter.Flush();
+}
+
+
+/// <summary>
+/// UTF-8 encoding of a file name, unpaired surrogates replaced.
+/// </summary>
+static std::string FormatterBenchUtf8(
+	_In_ CONST std::wstring& Name
+) {
+	std::string Result;
+	for (SIZE_T cx = 0x00; cx < Name.size(); cx++) {
+		ULONG CodePoint = (ULONG)Name[cx];
+		if (CodePoint >= 0xD800 && CodePoint <= 0xDBFF && cx + 1 < Name.size() && (ULONG)Name[cx + 1] >= 0xDC00 && (ULONG)Name[cx + 1] <= 0xDFFF)
+			CodePoint = 0x10000 + ((CodePoint - 0xD800) << 10) + ((ULONG)Name[++cx] - 0xDC00);
+		else if (CodePoint >= 0xD800 && CodePoint <= 0xDFFF)
+			CodePoint = 0xFFFD;
+
+		CHAR Encoded[0x08] = { 0x00 };
+		if (CodePoint < 0x80)
+			snprintf(Encoded, sizeof(Encoded), "%c", (CHAR)CodePoint);
+		else if (CodePoint < 0x800)
+			snprintf(Encoded, sizeof(Encoded), "%c%c", (CHAR)(0xC0 | (CodePoint >> 6)), (CHAR)(0x80 | (CodePoint & 0x3F)));
+		else if (CodePoint < 0x10000)
+			snprintf(Encoded, sizeof(Encoded), "%c%c%c", (CHAR)(0xE0 | (CodePoint >> 12)), (CHAR)(0x80 | ((CodePoint >> 6) & 0x3F)), (CHAR)(0x80 | (CodePoint & 0x3F)));
+		else
+			snprintf(Encoded, sizeof(Encoded), "%c%c%c%c", (CHAR)(0xF0 | (CodePoint >> 18)), (CHAR)(0x80 | ((CodePoint >> 12) & 0x3F)), (CHAR)(0x80 | ((CodePoint >> 6) & 0x3F)), (CHAR)(0x80 | (CodePoint & 0x3F)));
+		Result += Encoded;
+	}
+	return Result;
+}
+
+
+/// <summary>
+/// Quoted and escaped string of the CSV and JSON Lines outputs.
+/// </summary>
+static std::string FormatterBenchQuote(
+	_In_ FORMAT_SINK        Sink,
+	_In_ CONST std::string& String
+) {
+	std::string Result = "\"";
+	for (CHAR Character : String) {
+		if (Sink == FormatSinkCsv) {
+			Result += Character == '"' ? "\"\"" : std::string(0x01, Character);
+			continue;
+		}
+
+		CHAR Escaped[0x08] = { 0x00 };
+		if (Character == '"' || Character == '\\')
+			snprintf(Escaped, sizeof(Escaped), "\\%c", Character);
+		else if (Character == '\n')
+			snprintf(Escaped, sizeof(Escaped), "\\n");
+		else if (Character == '\r')
+			snprintf(Escaped, sizeof(Escaped), "\\r");
+		else if (Character == '\t')
+			snprintf(Escaped, sizeof(Escaped), "\\t");
+		else if ((UCHAR)Character < 0x20)
+			snprintf(Escaped, sizeof(Escaped), "\\u%04x", (UCHAR)Character);
+		else
+			snprintf(Escaped, sizeof(Escaped), "%c", Character);
+		Result += Escaped;
+	}
+	return Result + "\"";
+}
+
+
+/// <summary>
+/// Expected output, each field rendered with snprintf.
+/// </summary>
+static std::string FormatterBenchExpected(
+	_In_ FORMAT_SINK                            Sink,
+	_In_ CONST std::vector<FORMATTERBENCH_ROW>& Rows,
+	_In_ SIZE_T                                 NumberOfRows
+) {
+	CONST ULONG NumberOfColumns = _ARRAYSIZE(FormatterBenchColumns);
+
+	// Fields of every line, numbers are not quoted
+	std::vector<std::vector<std::pair<std::string, BOOLEAN>>> Lines;
+	if (Sink != FormatSinkJsonLines) {
+		std::vector<std::pair<std::string, BOOLEAN>> Header;
+		std::vector<std::pair<std::string, BOOLEAN>> Underline;
+		for (CONST FORMAT_COLUMN& Column : FormatterBenchColumns) {
+			Header.push_back({ Column.Name, TRUE });
+			Underline.push_back({ std::string(strlen(Column.Name), '-'), FALSE });
+		}
+		Lines.push_back(Header);
+		if (Sink == FormatSinkText)
+			Lines.push_back(Underline);
+	}
+
+	CONST CHAR* Prefix = Sink == FormatSinkText ? "" : "0x";
+	BOOLEAN     HexQuoted = Sink == FormatSinkJsonLines;
+	for (SIZE_T cx = 0x00; cx < NumberOfRows; cx++) {
+		CONST FORMATTERBENCH_ROW& Row = Rows[cx];
+		CHAR Field[0x40] = { 0x00 };
+		std::vector<std::pair<std::string, BOOLEAN>> Line;
+
+		snprintf(Field, sizeof(Field), "%s%016llx", Prefix, (unsigned long long)Row.VadAddress);
+		Line.push_back({ Field, HexQuoted });
+		snprintf(Field, sizeof(Field), "%u", Row.Level);
+		Line.push_back({ Field, FALSE });
+		snprintf(Field, sizeof(Field), "%s%llx", Prefix, (unsigned long long)Row.VpnStarting);
+		Line.push_back({ Field, HexQuoted });
+		snprintf(Field, sizeof(Field), "%s%llx", Prefix, (unsigned long long)Row.VpnEnding);
+		Line.push_back({ Field, HexQuoted });
+		snprintf(Field, sizeof(Field), "%llu", (unsigned long long)Row.CommitCharge);
+		Line.push_back({ Field, FALSE });
+		snprintf(Field, sizeof(Field), "%llu", (unsigned long long)Row.ValidPages);
+		Line.push_back({ Field, FALSE });
+		snprintf(Field, sizeof(Field), "%llu", (unsigned long long)Row.TransitionPages);
+		Line.push_back({ Field, FALSE });
+		Line.push_back({ Row.PrivateMemory ? "Private" : "Mapped", TRUE });
+		Line.push_back({ FormatterBenchTypes[Row.VadType], TRUE });
+		Line.push_back({ FormatterBenchProtections[Row.Protection], TRUE });
+		if (!Row.FileName.empty()) {
+			Line.push_back({ FormatterBenchUtf8(Row.FileName), TRUE });
+		}
+		else if (Row.CommitPageCount != 0x00) {
+			snprintf(Field, sizeof(Field), "Pagefile section, shared commit %#llx", (unsigned long long)Row.CommitPageCount);
+			Line.push_back({ Field, TRUE });
+		}
+		Lines.push_back(Line);
+	}
+
+	std::string Output;
+	for (CONST auto& Line : Lines) {
+		for (SIZE_T Column = 0x00; Column < Line.size(); Column++) {
+			CONST std::string& Value  = Line[Column].first;
+			BOOLEAN            Quoted = Line[Column].second && Sink != FormatSinkText;
+
+			if (Sink == FormatSinkCsv && Column != 0x00)
+				Output += ",";
+			if (Sink == FormatSinkJsonLines)
+				Output += std::string(Column == 0x00 ? "{" : ",") + "\"" + FormatterBenchColumns[Column].Name + "\":";
+			Output += Quoted ? FormatterBenchQuote(Sink, Value) : Value;
+
+			if (Sink == FormatSinkText && Column + 1 < NumberOfColumns) {
+				SIZE_T Width = FormatterBenchColumns[Column].Width;
+				Output += std::string(Value.size() < Width ? Width - Value.size() : 0x01, ' ');
+			}
+		}
+		if (Sink == FormatSinkJsonLines)
+			Output += Line.empty() ? "{}" : "}";
+		Output += "\n";
+	}
+	return Output;
+}
+
+
+/// <summary>
+/// Content of a temporary file.
+/// </summary>
+static std::string FormatterBenchRead(
+	_In_ FILE* Stream
+) {
+	std::string Content;
+	CHAR        Buffer[0x1000];
+	SIZE_T      Read = 0x00;
+	rewind(Stream);
+	while ((Read = fread(Buffer, 0x01, sizeof(Buffer), Stream)) != 0x00)
+		Content.append(Buffer, Read);
+	return Content;
+}
+
+
+int main(int argc, char** argv) {
+	SIZE_T NumberOfRows = argc > 1 ? (SIZE_T)strtoull(argv[1], NULL, 0x00) : FORMATTERBENCH_ROWS;
+	if (NumberOfRows == 0x00) {
+		printf("usage: %s [rows]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	std::vector<FORMATTERBENCH_ROW> Rows = FormatterBenchRows(NumberOfRows);
+
+	// Every output format, fields split by the flushes of a small buffer
+	ULONG  Differences = 0x00;
+	SIZE_T Checked     = NumberOfRows < FORMATTERBENCH_CHECKED_ROWS ? NumberOfRows : FORMATTERBENCH_CHECKED_ROWS;
+	for (FORMAT_SINK Sink : { FormatSinkText, FormatSinkCsv, FormatSinkJsonLines }) {
+		for (SIZE_T Capacity : { FORMATTERBENCH_SMALL_BUFFER, (SIZE_T)FORMAT_BUFFER_SIZE }) {
+			FILE* Stream = tmpfile();
+			if (Stream == NULL) {
+				printf("[-] Unable to create a temporary file\n");
+				return EXIT_FAILURE;
+			}
+			FormatterBenchFormat(Stream, Sink, Rows, Checked, Capacity);
+			if (FormatterBenchRead(Stream) != FormatterBenchExpected(Sink, Rows, Checked)) {
+				printf("[-] Output %d differs with a buffer of %zu bytes\n", (INT)Sink, Capacity);
+				Differences++;
+			}
+			fclose(Stream);
+		}
+	}
+
+	// Whole table, printf then the formatter
+	FILE* PrintfStream    = tmpfile();
+	FILE* FormatterStream = tmpfile();
+	if (PrintfStream == NULL || FormatterStream == NULL) {
+		printf("[-] Unable to create a temporary file\n");
+		return EXIT_FAILURE;
+	}
+	auto TimeStart = std::chrono::steady_clock::now();
+	FormatterBenchPrintf(PrintfStream, Rows);
+	fflush(PrintfStream);
+	double PrintfTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - TimeStart).count();
+
+	TimeStart = std::chrono::steady_clock::now();
+	FormatterBenchFormat(FormatterStream, FormatSinkText, Rows, Rows.size(), FORMAT_BUFFER_SIZE);
+	fflush(FormatterStream);
+	double FormatterTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - TimeStart).count();
+
+	fclose(PrintfStream);
+	fclose(FormatterStream);
+
+	printf("[>] %zu row(s)\n", NumberOfRows);
+	printf("[>] wprintf   : %8.2f ms, %6.1f ns per row\n", PrintfTime, (PrintfTime * 1000000.0) / (double)NumberOfRows);
+	printf("[>] Formatter : %8.2f ms, %6.1f ns per row\n", FormatterTime, (FormatterTime * 1000000.0) / (double)NumberOfRows);
+	printf("[>] %u difference(s)\n", Differences);
+	return Differences == 0x00 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
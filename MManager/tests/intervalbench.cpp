@@ -0,0 +1,164 @@
+/*+================================================================================================
+Module Name: intervalbench.cpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+
+Abstract:
+Benchmark of the interval index of the VAD list against a binary search of the sorted intervals.
+Random non-overlapping intervals, shaped like the VPN ranges of a process, are indexed and looked
+up at random values. Every point, range and largest gap query is also checked against the sorted
+intervals. The number of intervals and of lookups can be given on the command line.
+
+Build: c++ -std=c++17 -O2 -g [-fsanitize=address,undefined] ../vadlist/interval.cpp intervalbench.cpp -o intervalbench
+
+================================================================================================+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+#include "../vadlist/interval.h"
+
+// Default number of intervals, and of lookups.
+#define INTERVALBENCH_INTERVALS (SIZE_T)0x10000
+#define INTERVALBENCH_LOOKUPS   (SIZE_T)0x400000
+
+// Range and gap queries, checked one by one against the sorted intervals.
+#define INTERVALBENCH_QUERIES (SIZE_T)0x1000
+
+// Largest value looked up, 47-bit user-mode VPNs.
+#define INTERVALBENCH_LIMIT (ULONG64)0x7FFFFFFFF
+
+/// <summary>
+/// Position of the interval containing a value, by binary search of the sorted intervals.
+/// </summary>
+static SIZE_T IntervalBenchFind(
+	_In_ CONST std::vector<INTERVAL>& Intervals,
+	_In_ ULONG64                      Value
+) {
+	auto Next = std::upper_bound(Intervals.begin(), Intervals.end(), Value,
+		[](ULONG64 Left, CONST INTERVAL& Right) { return Left < Right.Start; }
+	);
+	if (Next == Intervals.begin() || (Next - 1)->End < Value)
+		return INTERVAL_NONE;
+	return (SIZE_T)(Next - Intervals.begin() - 1);
+}
+
+
+/// <summary>
+/// Largest free range within [First, Last], by walking the sorted intervals.
+/// </summary>
+static INTERVAL_GAP IntervalBenchFindLargestGap(
+	_In_ CONST std::vector<INTERVAL>& Intervals,
+	_In_ ULONG64                      First,
+	_In_ ULONG64                      Last
+) {
+	INTERVAL_GAP Largest = { 0x00, 0x00 };
+	ULONG64      Cursor  = First;
+	BOOLEAN      Done    = FALSE;
+	for (CONST INTERVAL& Interval : Intervals) {
+		if (Interval.End < Cursor)
+			continue;
+		if (Interval.Start > Last)
+			break;
+		if (Interval.Start > Cursor && Interval.Start - Cursor > Largest.Length)
+			Largest = { Cursor, Interval.Start - Cursor };
+		if (Interval.End >= Last) {
+			Done = TRUE;
+			break;
+		}
+		Cursor = Interval.End + 1;
+	}
+	if (!Done && Last - Cursor + 1 > Largest.Length)
+		Largest = { Cursor, Last - Cursor + 1 };
+	return Largest;
+}
+
+
+int main(int argc, char** argv) {
+	SIZE_T NumberOfIntervals = argc > 1 ? (SIZE_T)strtoull(argv[1], NULL, 0x00) : INTERVALBENCH_INTERVALS;
+	SIZE_T NumberOfLookups   = argc > 2 ? (SIZE_T)strtoull(argv[2], NULL, 0x00) : INTERVALBENCH_LOOKUPS;
+	if (NumberOfIntervals == 0x00 || NumberOfLookups == 0x00) {
+		printf("usage: %s [intervals] [lookups]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	// Mostly small reservations close to each other, some far apart
+	std::mt19937_64       Random(0x5EED);
+	std::vector<INTERVAL> Intervals;
+	ULONG64               Start = 0x10;
+	for (SIZE_T cx = 0x00; cx < NumberOfIntervals; cx++) {
+		ULONG64 Length = (Random() % 0x08) == 0x00 ? 0x100 + (Random() % 0x10000) : 0x01 + (Random() % 0x40);
+		ULONG64 Gap    = (Random() % 0x10) == 0x00 ? Random() % 0x100000 : Random() % 0x10;
+		Intervals.push_back({ Start, Start + Length - 1, (PVOID)(ULONG_PTR)cx });
+		Start += Length + Gap;
+	}
+	ULONG64 Limit = std::min(Start + 0x1000, INTERVALBENCH_LIMIT);
+
+	// Given out of order
+	std::vector<INTERVAL> Shuffled(Intervals);
+	std::shuffle(Shuffled.begin(), Shuffled.end(), Random);
+	auto           BuildStart = std::chrono::steady_clock::now();
+	CIntervalIndex Index;
+	Index.Build(Shuffled);
+	double BuildTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - BuildStart).count();
+
+	std::vector<ULONG64> Values(NumberOfLookups);
+	for (ULONG64& Value : Values)
+		Value = Random() % Limit;
+
+	// Point lookups
+	ULONG Differences = 0x00;
+	for (SIZE_T cx = 0x00; cx < Values.size(); cx += 0x10) {
+		if (Index.Find(Values[cx]) != IntervalBenchFind(Intervals, Values[cx]))
+			Differences++;
+	}
+
+	SIZE_T Found     = 0x00;
+	auto   TimeStart = std::chrono::steady_clock::now();
+	for (ULONG64 Value : Values)
+		Found += Index.Find(Value) != INTERVAL_NONE;
+	double IndexTime = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - TimeStart).count();
+
+	SIZE_T Expected = 0x00;
+	TimeStart = std::chrono::steady_clock::now();
+	for (ULONG64 Value : Values)
+		Expected += IntervalBenchFind(Intervals, Value) != INTERVAL_NONE;
+	double SearchTime = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - TimeStart).count();
+	if (Found != Expected)
+		Differences++;
+
+	// Range and largest gap queries
+	for (SIZE_T cx = 0x00; cx < INTERVALBENCH_QUERIES; cx++) {
+		ULONG64 First = Random() % Limit;
+		ULONG64 Last  = First + (Random() % 0x200000);
+
+		SIZE_T Begin = 0x00;
+		SIZE_T End   = 0x00;
+		Index.FindRange(First, Last, Begin, End);
+		auto Low  = std::lower_bound(Intervals.begin(), Intervals.end(), First,
+			[](CONST INTERVAL& Left, ULONG64 Right) { return Left.End < Right; });
+		auto High = std::upper_bound(Intervals.begin(), Intervals.end(), Last,
+			[](ULONG64 Left, CONST INTERVAL& Right) { return Left < Right.Start; });
+		SIZE_T ExpectedBegin = (SIZE_T)(Low - Intervals.begin());
+		SIZE_T ExpectedEnd   = std::max(ExpectedBegin, (SIZE_T)(High - Intervals.begin()));
+		if ((Begin != End || ExpectedBegin != ExpectedEnd) && (Begin != ExpectedBegin || End != ExpectedEnd))
+			Differences++;
+
+		INTERVAL_GAP Gap         = Index.FindLargestGap(First, Last);
+		INTERVAL_GAP ExpectedGap = IntervalBenchFindLargestGap(Intervals, First, Last);
+		if (Gap.Length != ExpectedGap.Length || (Gap.Length != 0x00 && Gap.Start != ExpectedGap.Start))
+			Differences++;
+	}
+
+	printf("[>] %zu interval(s), built in %.3f ms\n", NumberOfIntervals, BuildTime);
+	printf("[>] %zu lookup(s), %zu hit(s)\n", NumberOfLookups, Found);
+	printf("[>] Index         : %8.2f ns per lookup\n", IndexTime / (double)NumberOfLookups);
+	printf("[>] Binary search : %8.2f ns per lookup\n", SearchTime / (double)NumberOfLookups);
+	printf("[>] %u difference(s)\n", Differences);
+	return Differences == 0x00 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,566 @@
+/*+================================================================================================
+Module Name: archive.cpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+
+Abstract:
+Append-only columnar archive of VAD list snapshots.
+Each snapshot is one block that can be decoded on its own: entries are sorted by VPN and stored
+one column after the other as variable-length integers, VPNs and VAD addresses as deltas, the
+three flag words through a dictionary and file names once per block. A side index of fixed-size
+records gives the offset of each block, binary searched by time.
+Only depends on the C runtime, so that it builds on Windows and on POSIX systems.
+
+================================================================================================+*/
+
+#include <algorithm>
+#include <map>
+#include <tuple>
+
+#include "archive.h"
+
+// 64-bit file offsets
+#ifdef _WIN32
+#include <io.h>
+
+#define ArchiveSeek _fseeki64
+#define ArchiveTell _ftelli64
+#define ArchiveTruncate(File, Size) (_chsize_s(_fileno(File), (Size)) == 0x00)
+#else
+#include <unistd.h>
+
+#define ArchiveSeek fseeko
+#define ArchiveTell ftello
+#define ArchiveTruncate(File, Size) (ftruncate(fileno(File), (off_t)(Size)) == 0x00)
+#endif // _WIN32
+
+// Bits of MMVAD_FLAGS1 not already stored in the commit charge column.
+#define ARCHIVE_FLAGS1_MASK (ULONG)0x80000000
+
+// Largest payload accepted when reading a block.
+#define ARCHIVE_MAXIMUM_BLOCK_SIZE (ULONG)0x10000000
+
+// Largest number of low zero bits removed from the VAD addresses, pool blocks are 16 bytes aligned.
+#define ARCHIVE_MAXIMUM_ADDRESS_SHIFT (ULONG)0x04
+
+/// <summary>
+/// Columns stored as plain variable-length integers, after the VPNs.
+/// </summary>
+static ULONG64 ARCHIVE_ENTRY::* CONST ArchiveCounterColumns[] = {
+	&ARCHIVE_ENTRY::CommitCharge,
+	&ARCHIVE_ENTRY::CommitPageCount,
+	&ARCHIVE_ENTRY::ValidPages,
+	&ARCHIVE_ENTRY::TransitionPages,
+	&ARCHIVE_ENTRY::PagedOutPages,
+	&ARCHIVE_ENTRY::PrototypePages,
+	&ARCHIVE_ENTRY::DemandZeroPages
+};
+
+/// <summary>
+/// Bounds checked cursor over a payload.
+/// </summary>
+typedef struct _ARCHIVE_CURSOR {
+	CONST UCHAR* Data;
+	SIZE_T       Length;
+	SIZE_T       Offset;
+	BOOLEAN      Failed;  // Read past the end or malformed integer
+} ARCHIVE_CURSOR, * PARCHIVE_CURSOR;
+
+
+/// <summary>
+/// Append an unsigned LEB128 integer.
+/// </summary>
+static VOID ArchivePutVarint(
+	_Inout_ std::vector<UCHAR>& Buffer,
+	_In_    ULONG64             Value
+) {
+	while (Value >= 0x80) {
+		Buffer.push_back((UCHAR)(Value | 0x80));
+		Value >>= 0x07;
+	}
+	Buffer.push_back((UCHAR)Value);
+}
+
+
+static ULONG64 ArchiveGetVarint(
+	_Inout_ ARCHIVE_CURSOR& Cursor
+) {
+	ULONG64 Value = 0x00;
+	for (ULONG Shift = 0x00; Shift < 64; Shift += 0x07) {
+		if (Cursor.Offset >= Cursor.Length)
+			break;
+
+		UCHAR Byte = Cursor.Data[Cursor.Offset++];
+		Value |= (ULONG64)(Byte & 0x7F) << Shift;
+		if ((Byte & 0x80) == 0x00)
+			return Value;
+	}
+	Cursor.Failed = TRUE;
+	return 0x00;
+}
+
+
+/// <summary>
+/// Map signed deltas to unsigned integers, small magnitudes to small values.
+/// </summary>
+static inline ULONG64 ArchiveZigZag(
+	_In_ LONG64 Value
+) {
+	return ((ULONG64)Value << 1) ^ (ULONG64)(Value >> 63);
+}
+
+
+static inline LONG64 ArchiveUnZigZag(
+	_In_ ULONG64 Value
+) {
+	return (LONG64)(Value >> 1) ^ -(LONG64)(Value & 0x01);
+}
+
+
+static ULONG ArchiveChecksum(
+	_In_ CONST std::vector<UCHAR>& Payload
+) {
+	ULONG Hash = 0x811C9DC5;
+	for (UCHAR Byte : Payload) {
+		Hash ^= Byte;
+		Hash *= 0x01000193;
+	}
+	return Hash;
+}
+
+
+/// <summary>
+/// Walk the block headers from the start of an archive, a block cut short by an interrupted append
+/// ending the walk.
+/// </summary>
+/// <returns>Offset of the end of the last complete block.</returns>
+static LONG64 ArchiveWalkBlocks(
+	_In_      FILE*                             Archive,
+	_In_      LONG64                            ArchiveSize,
+	_Out_opt_ std::vector<ARCHIVE_INDEX_ENTRY>* Entries
+) {
+	LONG64 Offset = sizeof(ARCHIVE_HEADER);
+	while (Offset + (LONG64)sizeof(ARCHIVE_BLOCK_HEADER) <= ArchiveSize) {
+		ARCHIVE_BLOCK_HEADER Header = { 0x00 };
+		if (ArchiveSeek(Archive, Offset, SEEK_SET) != 0x00
+			|| fread(&Header, sizeof(ARCHIVE_BLOCK_HEADER), 0x01, Archive) != 0x01
+			|| Header.Magic != ARCHIVE_BLOCK_MAGIC)
+			break;
+
+		LONG64 Next = Offset + (LONG64)sizeof(ARCHIVE_BLOCK_HEADER) + Header.Size;
+		if (Next > ArchiveSize)
+			break;
+
+		if (Entries != NULL)
+			Entries->push_back({ Header.Timestamp, (ULONG64)Offset });
+		Offset = Next;
+	}
+	return Offset;
+}
+
+
+/// <summary>
+/// Check that the last record of the index is the block ending the archive.
+/// </summary>
+static BOOLEAN ArchiveIsIndexTail(
+	_In_ FILE*                      Archive,
+	_In_ LONG64                     ArchiveSize,
+	_In_ CONST ARCHIVE_INDEX_ENTRY& Last
+) {
+	ARCHIVE_BLOCK_HEADER Header = { 0x00 };
+	return ArchiveSeek(Archive, (LONG64)Last.Offset, SEEK_SET) == 0x00
+		&& fread(&Header, sizeof(ARCHIVE_BLOCK_HEADER), 0x01, Archive) == 0x01
+		&& Header.Magic == ARCHIVE_BLOCK_MAGIC
+		&& Header.Timestamp == Last.Timestamp
+		&& (LONG64)(Last.Offset + sizeof(ARCHIVE_BLOCK_HEADER) + Header.Size) == ArchiveSize;
+}
+
+
+CVadArchive::~CVadArchive() {
+	if (this->m_Archive != NULL)
+		fclose(this->m_Archive);
+	if (this->m_Index != NULL)
+		fclose(this->m_Index);
+}
+
+
+_Use_decl_annotations_
+BOOLEAN CVadArchive::Append(
+	_In_z_ CONST CHAR*       Path,
+	_In_   ARCHIVE_SNAPSHOT& Snapshot
+) {
+	// Sorted entries give small VPN deltas
+	std::stable_sort(Snapshot.Entries.begin(), Snapshot.Entries.end(),
+		[](CONST ARCHIVE_ENTRY& Left, CONST ARCHIVE_ENTRY& Right) {
+			return Left.VpnStarting < Right.VpnStarting;
+		}
+	);
+
+	ARCHIVE_BLOCK_HEADER Header  = { 0x00 };
+	std::vector<UCHAR>   Payload;
+	Encode(Snapshot, Header, Payload);
+
+	// Read and written in place, a block torn by an interrupted append is cut off first
+	FILE* Archive = fopen(Path, "r+b");
+	if (Archive == NULL)
+		Archive = fopen(Path, "w+b");
+	if (Archive == NULL)
+		return FALSE;
+
+	BOOLEAN Success = ArchiveSeek(Archive, 0x00, SEEK_END) == 0x00;
+	LONG64  Offset  = ArchiveTell(Archive);
+
+	// New archive, with a new index
+	BOOLEAN Created = FALSE;
+	if (Success && Offset < (LONG64)sizeof(ARCHIVE_HEADER)) {
+		Created = TRUE;
+		ARCHIVE_HEADER FileHeader = { ARCHIVE_MAGIC, ARCHIVE_VERSION };
+		Success = ArchiveTruncate(Archive, 0x00)
+			&& ArchiveSeek(Archive, 0x00, SEEK_SET) == 0x00
+			&& fwrite(&FileHeader, sizeof(ARCHIVE_HEADER), 0x01, Archive) == 0x01;
+		Offset  = sizeof(ARCHIVE_HEADER);
+	}
+
+	// The index is appended to only if its last record ends the archive, otherwise it is deleted
+	// and rebuilt when opening the archive.
+	std::string IndexPath   = std::string(Path) + ARCHIVE_INDEX_EXTENSION;
+	FILE*       Index       = fopen(IndexPath.c_str(), Created ? "w+b" : "r+b");
+	BOOLEAN     IndexIsTail = FALSE;
+	if (Success && Index != NULL && ArchiveSeek(Index, 0x00, SEEK_END) == 0x00) {
+		LONG64              IndexSize = ArchiveTell(Index);
+		ARCHIVE_INDEX_ENTRY Last      = { 0x00 };
+		if (IndexSize == 0x00) {
+			IndexIsTail = Offset == (LONG64)sizeof(ARCHIVE_HEADER);
+		}
+		else if ((IndexSize % sizeof(ARCHIVE_INDEX_ENTRY)) == 0x00
+			&& ArchiveSeek(Index, IndexSize - (LONG64)sizeof(ARCHIVE_INDEX_ENTRY), SEEK_SET) == 0x00
+			&& fread(&Last, sizeof(ARCHIVE_INDEX_ENTRY), 0x01, Index) == 0x01) {
+			IndexIsTail = ArchiveIsIndexTail(Archive, Offset, Last);
+		}
+	}
+	if (Success && !IndexIsTail) {
+		LONG64 End = ArchiveWalkBlocks(Archive, Offset, NULL);
+		if (End != Offset)
+			Success = ArchiveTruncate(Archive, End);
+		Offset = End;
+	}
+
+	if (Success) {
+		Success = ArchiveSeek(Archive, Offset, SEEK_SET) == 0x00
+			&& fwrite(&Header, sizeof(ARCHIVE_BLOCK_HEADER), 0x01, Archive) == 0x01
+			&& (Payload.empty() || fwrite(Payload.data(), Payload.size(), 0x01, Archive) == 0x01);
+	}
+	Success = (fclose(Archive) == 0x00) && Success;
+	if (!Success) {
+		if (Index != NULL)
+			fclose(Index);
+		return FALSE;
+	}
+
+	if (Index != NULL && IndexIsTail) {
+		ARCHIVE_INDEX_ENTRY Entry = { Snapshot.Timestamp, (ULONG64)Offset };
+		BOOLEAN Written = ArchiveSeek(Index, 0x00, SEEK_END) == 0x00
+			&& fwrite(&Entry, sizeof(ARCHIVE_INDEX_ENTRY), 0x01, Index) == 0x01;
+		Written = (fclose(Index) == 0x00) && Written;
+		if (!Written)
+			remove(IndexPath.c_str());
+	}
+	else {
+		if (Index != NULL)
+			fclose(Index);
+		remove(IndexPath.c_str());
+	}
+	return TRUE;
+}
+
+
+_Use_decl_annotations_
+BOOLEAN CVadArchive::Open(
+	_In_z_ CONST CHAR* Path
+) {
+	this->m_Archive = fopen(Path, "rb");
+	if (this->m_Archive == NULL)
+		return FALSE;
+
+	ARCHIVE_HEADER FileHeader = { 0x00 };
+	if (fread(&FileHeader, sizeof(ARCHIVE_HEADER), 0x01, this->m_Archive) != 0x01
+		|| FileHeader.Magic != ARCHIVE_MAGIC
+		|| FileHeader.Version != ARCHIVE_VERSION)
+		return FALSE;
+
+	// Number of blocks in the index
+	std::string IndexPath = std::string(Path) + ARCHIVE_INDEX_EXTENSION;
+	this->m_Index = fopen(IndexPath.c_str(), "rb");
+	if (this->m_Index != NULL && ArchiveSeek(this->m_Index, 0x00, SEEK_END) == 0x00)
+		this->m_NumberOfBlocks = (ULONG64)ArchiveTell(this->m_Index) / sizeof(ARCHIVE_INDEX_ENTRY);
+
+	// The index must list every block, one after the other up to the end of the archive
+	ArchiveSeek(this->m_Archive, 0x00, SEEK_END);
+	LONG64 ArchiveSize = ArchiveTell(this->m_Archive);
+
+	BOOLEAN Complete = this->m_Index != NULL;
+	LONG64  Expected = sizeof(ARCHIVE_HEADER);
+	for (ULONG64 cx = 0x00; Complete && cx < this->m_NumberOfBlocks; cx++) {
+		ARCHIVE_INDEX_ENTRY  Entry  = { 0x00 };
+		ARCHIVE_BLOCK_HEADER Header = { 0x00 };
+		Complete = this->ReadIndexEntry(cx, Entry)
+			&& (LONG64)Entry.Offset == Expected
+			&& ArchiveSeek(this->m_Archive, Expected, SEEK_SET) == 0x00
+			&& fread(&Header, sizeof(ARCHIVE_BLOCK_HEADER), 0x01, this->m_Archive) == 0x01
+			&& Header.Magic == ARCHIVE_BLOCK_MAGIC
+			&& Header.Timestamp == Entry.Timestamp;
+		Expected += (LONG64)sizeof(ARCHIVE_BLOCK_HEADER) + Header.Size;
+	}
+	if (Complete && Expected == ArchiveSize)
+		return TRUE;
+	return this->RebuildIndex(IndexPath.c_str());
+}
+
+
+_Use_decl_annotations_
+ULONG64 CVadArchive::Seek(
+	_In_ ULONG64 Timestamp
+) {
+	ULONG64 Low  = 0x00;
+	ULONG64 High = this->m_NumberOfBlocks;
+
+	while (Low < High) {
+		ULONG64             Middle = Low + ((High - Low) / 2);
+		ARCHIVE_INDEX_ENTRY Entry  = { 0x00 };
+		if (!this->ReadIndexEntry(Middle, Entry))
+			return this->m_NumberOfBlocks;
+
+		if (Entry.Timestamp < Timestamp)
+			Low = Middle + 1;
+		else
+			High = Middle;
+	}
+	return Low;
+}
+
+
+_Use_decl_annotations_
+BOOLEAN CVadArchive::ReadBlock(
+	_In_  ULONG64           Block,
+	_Out_ ARCHIVE_SNAPSHOT& Snapshot
+) {
+	ARCHIVE_INDEX_ENTRY Entry = { 0x00 };
+	if (!this->ReadIndexEntry(Block, Entry))
+		return FALSE;
+
+	ARCHIVE_BLOCK_HEADER Header = { 0x00 };
+	if (ArchiveSeek(this->m_Archive, (LONG64)Entry.Offset, SEEK_SET) != 0x00
+		|| fread(&Header, sizeof(ARCHIVE_BLOCK_HEADER), 0x01, this->m_Archive) != 0x01
+		|| Header.Magic != ARCHIVE_BLOCK_MAGIC
+		|| Header.Size > ARCHIVE_MAXIMUM_BLOCK_SIZE)
+		return FALSE;
+
+	std::vector<UCHAR> Payload(Header.Size);
+	if (!Payload.empty() && fread(Payload.data(), Payload.size(), 0x01, this->m_Archive) != 0x01)
+		return FALSE;
+	if (ArchiveChecksum(Payload) != Header.Checksum)
+		return FALSE;
+	return Decode(Header, Payload, Snapshot);
+}
+
+
+_Use_decl_annotations_
+BOOLEAN CVadArchive::ReadIndexEntry(
+	_In_  ULONG64              Block,
+	_Out_ ARCHIVE_INDEX_ENTRY& Entry
+) {
+	if (Block >= this->m_NumberOfBlocks || this->m_Index == NULL)
+		return FALSE;
+	return ArchiveSeek(this->m_Index, (LONG64)(Block * sizeof(ARCHIVE_INDEX_ENTRY)), SEEK_SET) == 0x00
+		&& fread(&Entry, sizeof(ARCHIVE_INDEX_ENTRY), 0x01, this->m_Index) == 0x01;
+}
+
+
+_Use_decl_annotations_
+BOOLEAN CVadArchive::RebuildIndex(
+	_In_z_ CONST CHAR* IndexPath
+) {
+	if (this->m_Index != NULL)
+		fclose(this->m_Index);
+	this->m_NumberOfBlocks = 0x00;
+
+	this->m_Index = fopen(IndexPath, "w+b");
+	if (this->m_Index == NULL)
+		return FALSE;
+
+	// A block cut short by an interrupted append ends the archive, until the next append cuts it off
+	ArchiveSeek(this->m_Archive, 0x00, SEEK_END);
+	LONG64 ArchiveSize = ArchiveTell(this->m_Archive);
+
+	std::vector<ARCHIVE_INDEX_ENTRY> Entries;
+	ArchiveWalkBlocks(this->m_Archive, ArchiveSize, &Entries);
+	if (!Entries.empty() && fwrite(Entries.data(), sizeof(ARCHIVE_INDEX_ENTRY), Entries.size(), this->m_Index) != Entries.size())
+		return FALSE;
+	this->m_NumberOfBlocks = Entries.size();
+	return fflush(this->m_Index) == 0x00;
+}
+
+
+_Use_decl_annotations_
+VOID CVadArchive::Encode(
+	_In_  CONST ARCHIVE_SNAPSHOT& Snapshot,
+	_Out_ ARCHIVE_BLOCK_HEADER&   Header,
+	_Out_ std::vector<UCHAR>&     Payload
+) {
+	Payload.clear();
+
+	// Dictionary of the flag words, most VADs share a handful of combinations
+	std::map<std::tuple<ULONG, ULONG, ULONG>, ULONG> Dictionary;
+	std::vector<ULONG>                               FlagIndexes;
+	std::vector<UCHAR>                               DictionaryData;
+	FlagIndexes.reserve(Snapshot.Entries.size());
+
+	for (CONST ARCHIVE_ENTRY& Entry : Snapshot.Entries) {
+		auto Key = std::make_tuple(Entry.LongVadFlags, Entry.LongVadFlags1 & ARCHIVE_FLAGS1_MASK, Entry.LongVadFlags2);
+		auto Result = Dictionary.emplace(Key, (ULONG)Dictionary.size());
+		if (Result.second) {
+			ArchivePutVarint(DictionaryData, std::get<0>(Key));
+			ArchivePutVarint(DictionaryData, std::get<1>(Key) >> 31);
+			ArchivePutVarint(DictionaryData, std::get<2>(Key));
+		}
+		FlagIndexes.push_back(Result.first->second);
+	}
+	Payload.insert(Payload.end(), DictionaryData.begin(), DictionaryData.end());
+
+	// File names, one byte per ASCII character
+	for (CONST ARCHIVE_STRING& File : Snapshot.Files) {
+		ArchivePutVarint(Payload, File.size());
+		for (WCHAR Character : File)
+			ArchivePutVarint(Payload, Character);
+	}
+
+	// Alignment of the VAD nodes
+	ULONG64 Addresses = 0x00;
+	for (CONST ARCHIVE_ENTRY& Entry : Snapshot.Entries)
+		Addresses |= Entry.VadAddress;
+
+	ULONG AddressShift = 0x00;
+	while (AddressShift < ARCHIVE_MAXIMUM_ADDRESS_SHIFT && (Addresses & (1ULL << AddressShift)) == 0x00)
+		AddressShift++;
+
+	// One column after the other
+	for (CONST ARCHIVE_ENTRY& Entry : Snapshot.Entries)
+		ArchivePutVarint(Payload, Entry.Level);
+
+	ULONG64 Previous = 0x00;
+	for (CONST ARCHIVE_ENTRY& Entry : Snapshot.Entries) {
+		ArchivePutVarint(Payload, ArchiveZigZag((LONG64)((Entry.VadAddress >> AddressShift) - Previous)));
+		Previous = Entry.VadAddress >> AddressShift;
+	}
+
+	Previous = 0x00;
+	for (CONST ARCHIVE_ENTRY& Entry : Snapshot.Entries) {
+		ArchivePutVarint(Payload, ArchiveZigZag((LONG64)(Entry.VpnStarting - Previous)));
+		Previous = Entry.VpnStarting;
+	}
+	for (CONST ARCHIVE_ENTRY& Entry : Snapshot.Entries)
+		ArchivePutVarint(Payload, ArchiveZigZag((LONG64)(Entry.VpnEnding - Entry.VpnStarting)));
+
+	for (ULONG64 ARCHIVE_ENTRY::* Column : ArchiveCounterColumns) {
+		for (CONST ARCHIVE_ENTRY& Entry : Snapshot.Entries)
+			ArchivePutVarint(Payload, Entry.*Column);
+	}
+
+	for (ULONG FlagIndex : FlagIndexes)
+		ArchivePutVarint(Payload, FlagIndex);
+	for (CONST ARCHIVE_ENTRY& Entry : Snapshot.Entries)
+		ArchivePutVarint(Payload, (Entry.FileIndex != ARCHIVE_NO_FILE) ? (ULONG64)Entry.FileIndex + 1 : 0x00);
+
+	Header.Magic         = ARCHIVE_BLOCK_MAGIC;
+	Header.Size          = (ULONG)Payload.size();
+	Header.Timestamp     = Snapshot.Timestamp;
+	Header.Eprocess      = Snapshot.Eprocess;
+	Header.ProcessId     = Snapshot.ProcessId;
+	Header.NumberOfNodes = (ULONG)Snapshot.Entries.size();
+	Header.NumberOfFlags = (ULONG)Dictionary.size();
+	Header.NumberOfFiles = (ULONG)Snapshot.Files.size();
+	Header.Checksum      = ArchiveChecksum(Payload);
+	Header.AddressShift  = AddressShift;
+}
+
+
+_Use_decl_annotations_
+BOOLEAN CVadArchive::Decode(
+	_In_  CONST ARCHIVE_BLOCK_HEADER& Header,
+	_In_  CONST std::vector<UCHAR>&   Payload,
+	_Out_ ARCHIVE_SNAPSHOT&           Snapshot
+) {
+	ARCHIVE_CURSOR Cursor = { Payload.data(), Payload.size(), 0x00, FALSE };
+
+	Snapshot.Timestamp = Header.Timestamp;
+	Snapshot.Eprocess  = Header.Eprocess;
+	Snapshot.ProcessId = Header.ProcessId;
+	Snapshot.Entries.clear();
+	Snapshot.Files.clear();
+
+	// Every entry takes at least one byte per column, so the counts are bounded by the payload
+	if (Header.NumberOfNodes > Payload.size() || Header.NumberOfFlags > Payload.size()
+		|| Header.NumberOfFiles > Payload.size() || Header.AddressShift > ARCHIVE_MAXIMUM_ADDRESS_SHIFT)
+		return FALSE;
+
+	std::vector<ULONG> Flags(Header.NumberOfFlags * 0x03);
+	for (ULONG cx = 0x00; cx < Header.NumberOfFlags; cx++) {
+		Flags[(cx * 0x03) + 0] = (ULONG)ArchiveGetVarint(Cursor);
+		Flags[(cx * 0x03) + 1] = (ULONG)(ArchiveGetVarint(Cursor) << 31);
+		Flags[(cx * 0x03) + 2] = (ULONG)ArchiveGetVarint(Cursor);
+	}
+
+	Snapshot.Files.resize(Header.NumberOfFiles);
+	for (ARCHIVE_STRING& File : Snapshot.Files) {
+		ULONG64 Length = ArchiveGetVarint(Cursor);
+		if (Cursor.Failed || Length > (Cursor.Length - Cursor.Offset))
+			return FALSE;
+
+		File.resize((SIZE_T)Length);
+		for (WCHAR& Character : File)
+			Character = (WCHAR)ArchiveGetVarint(Cursor);
+	}
+
+	// Columns
+	Snapshot.Entries.resize(Header.NumberOfNodes);
+	for (ARCHIVE_ENTRY& Entry : Snapshot.Entries)
+		Entry.Level = (ULONG)ArchiveGetVarint(Cursor);
+
+	ULONG64 Previous = 0x00;
+	for (ARCHIVE_ENTRY& Entry : Snapshot.Entries) {
+		Previous        += (ULONG64)ArchiveUnZigZag(ArchiveGetVarint(Cursor));
+		Entry.VadAddress = Previous << Header.AddressShift;
+	}
+
+	Previous = 0x00;
+	for (ARCHIVE_ENTRY& Entry : Snapshot.Entries) {
+		Entry.VpnStarting = Previous + (ULONG64)ArchiveUnZigZag(ArchiveGetVarint(Cursor));
+		Previous          = Entry.VpnStarting;
+	}
+	for (ARCHIVE_ENTRY& Entry : Snapshot.Entries)
+		Entry.VpnEnding = Entry.VpnStarting + (ULONG64)ArchiveUnZigZag(ArchiveGetVarint(Cursor));
+
+	for (ULONG64 ARCHIVE_ENTRY::* Column : ArchiveCounterColumns) {
+		for (ARCHIVE_ENTRY& Entry : Snapshot.Entries)
+			Entry.*Column = ArchiveGetVarint(Cursor);
+	}
+
+	for (ARCHIVE_ENTRY& Entry : Snapshot.Entries) {
+		ULONG64 FlagIndex = ArchiveGetVarint(Cursor);
+		if (FlagIndex >= Header.NumberOfFlags)
+			return FALSE;
+
+		Entry.LongVadFlags  = Flags[(FlagIndex * 0x03) + 0];
+		Entry.LongVadFlags1 = Flags[(FlagIndex * 0x03) + 1] | (ULONG)(Entry.CommitCharge & ~ARCHIVE_FLAGS1_MASK);
+		Entry.LongVadFlags2 = Flags[(FlagIndex * 0x03) + 2];
+	}
+	for (ARCHIVE_ENTRY& Entry : Snapshot.Entries) {
+		ULONG64 FileIndex = ArchiveGetVarint(Cursor);
+		if (FileIndex > Header.NumberOfFiles)
+			return FALSE;
+		Entry.FileIndex = (ULONG)(FileIndex - 1);
+	}
+	return !Cursor.Failed && Cursor.Offset == Cursor.Length;
+}
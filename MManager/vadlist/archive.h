@@ -0,0 +1,189 @@
+/*+================================================================================================
+Module Name: archive.h
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+
+Abstract:
+Append-only columnar archive of VAD list snapshots.
+Each snapshot is one block that can be decoded on its own: entries are sorted by VPN and stored
+one column after the other as variable-length integers, VPNs and VAD addresses as deltas, the
+three flag words through a dictionary and file names once per block. A side index of fixed-size
+records gives the offset of each block, binary searched by time.
+Only depends on the C runtime, so that it builds on Windows and on POSIX systems.
+
+================================================================================================+*/
+
+#ifndef __VADLIST_ARCHIVE_H_GUARD__
+#define __VADLIST_ARCHIVE_H_GUARD__
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "../../kshim/kshim.h"
+
+// Archive file magic -- "VADA"
+#define ARCHIVE_MAGIC (ULONG)0x41444156
+
+// Block magic -- "VADB"
+#define ARCHIVE_BLOCK_MAGIC (ULONG)0x42444156
+
+// Current version of the format.
+#define ARCHIVE_VERSION (ULONG)0x01
+
+// Extension of the time index, appended to the name of the archive.
+#define ARCHIVE_INDEX_EXTENSION ".idx"
+
+// Index of the file of VADs not mapping a file.
+#define ARCHIVE_NO_FILE (ULONG)-1
+
+/// <summary>
+/// First bytes of an archive.
+/// </summary>
+typedef struct _ARCHIVE_HEADER {
+	ULONG Magic;   // ARCHIVE_MAGIC
+	ULONG Version; // ARCHIVE_VERSION
+} ARCHIVE_HEADER, * PARCHIVE_HEADER;
+
+/// <summary>
+/// Header of one snapshot, followed by Size bytes of payload.
+/// </summary>
+typedef struct _ARCHIVE_BLOCK_HEADER {
+	ULONG   Magic;          // ARCHIVE_BLOCK_MAGIC
+	ULONG   Size;           // Size of the payload
+	ULONG64 Timestamp;      // Time of the snapshot, in seconds since 1970-01-01 UTC
+	ULONG64 Eprocess;       // Address of the EPROCESS structure
+	ULONG   ProcessId;      // ID of the process
+	ULONG   NumberOfNodes;  // Number of VADs
+	ULONG   NumberOfFlags;  // Number of entries of the flag dictionary
+	ULONG   NumberOfFiles;  // Number of entries of the file name table
+	ULONG   Checksum;       // FNV-1a of the payload
+	ULONG   AddressShift;   // Low zero bits shared by all the VAD addresses, not stored
+} ARCHIVE_BLOCK_HEADER, * PARCHIVE_BLOCK_HEADER;
+
+/// <summary>
+/// Record of the time index, one per block.
+/// </summary>
+typedef struct _ARCHIVE_INDEX_ENTRY {
+	ULONG64 Timestamp; // Time of the snapshot
+	ULONG64 Offset;    // Offset of the ARCHIVE_BLOCK_HEADER in the archive
+} ARCHIVE_INDEX_ENTRY, * PARCHIVE_INDEX_ENTRY;
+
+/// <summary>
+/// One VAD of a snapshot.
+/// </summary>
+typedef struct _ARCHIVE_ENTRY {
+	ULONG64 VadAddress;      // Address of the VAD node
+	ULONG   Level;           // Node depth level
+	ULONG64 VpnStarting;     // Start of Virtual Page Number (VPN)
+	ULONG64 VpnEnding;       // End of Virtual Page Number (VPN)
+	ULONG64 CommitCharge;    // Number of pages commit
+	ULONG64 CommitPageCount; // Number of pages commited by the section
+	ULONG64 ValidPages;      // Number of pages resident
+	ULONG64 TransitionPages; // Number of pages on the standby or modified list
+	ULONG64 PagedOutPages;   // Number of pages in a paging file
+	ULONG64 PrototypePages;  // Number of pages resolved via a prototype PTE
+	ULONG64 DemandZeroPages; // Number of pages never touched or demand zero
+	ULONG   LongVadFlags;
+	ULONG   LongVadFlags1;
+	ULONG   LongVadFlags2;
+	ULONG   FileIndex;       // Index in the file names of the snapshot, ARCHIVE_NO_FILE if none
+} ARCHIVE_ENTRY, * PARCHIVE_ENTRY;
+
+/// <summary>
+/// UTF-16 file name.
+/// </summary>
+typedef std::basic_string<WCHAR> ARCHIVE_STRING;
+
+/// <summary>
+/// VAD list of a process at a point in time.
+/// </summary>
+typedef struct _ARCHIVE_SNAPSHOT {
+	ULONG64 Timestamp;
+	ULONG64 Eprocess;
+	ULONG   ProcessId;
+
+	std::vector<ARCHIVE_ENTRY>  Entries;
+	std::vector<ARCHIVE_STRING> Files;
+} ARCHIVE_SNAPSHOT, * PARCHIVE_SNAPSHOT;
+
+class CVadArchive {
+
+public:
+	CVadArchive() = default;
+	~CVadArchive();
+
+	CVadArchive(CONST CVadArchive&) = delete;
+	CVadArchive& operator=(CONST CVadArchive&) = delete;
+
+	/// <summary>
+	/// Append a snapshot to an archive, created if needed, and to its time index.
+	/// Snapshots are expected in time order. The entries are sorted by VPN.
+	/// A block torn by an interrupted append is cut off first, the index then rebuilt by Open.
+	/// </summary>
+	_Must_inspect_result_
+	static BOOLEAN Append(
+		_In_z_ CONST CHAR*       Path,
+		_In_   ARCHIVE_SNAPSHOT& Snapshot
+	);
+
+	/// <summary>
+	/// Open an archive to read it. The time index is rebuilt if missing or incomplete.
+	/// </summary>
+	_Must_inspect_result_
+	BOOLEAN Open(
+		_In_z_ CONST CHAR* Path
+	);
+
+	ULONG64 GetNumberOfBlocks() const { return this->m_NumberOfBlocks; }
+
+	/// <summary>
+	/// Binary search of the first block taken at or after Timestamp.
+	/// </summary>
+	/// <returns>Index of the block, GetNumberOfBlocks() if none.</returns>
+	ULONG64 Seek(
+		_In_ ULONG64 Timestamp
+	);
+
+	/// <summary>
+	/// Read and decode one block.
+	/// </summary>
+	_Must_inspect_result_
+	BOOLEAN ReadBlock(
+		_In_  ULONG64           Block,
+		_Out_ ARCHIVE_SNAPSHOT& Snapshot
+	);
+
+private:
+	_Must_inspect_result_
+	BOOLEAN ReadIndexEntry(
+		_In_  ULONG64              Block,
+		_Out_ ARCHIVE_INDEX_ENTRY& Entry
+	);
+
+	_Must_inspect_result_
+	BOOLEAN RebuildIndex(
+		_In_z_ CONST CHAR* IndexPath
+	);
+
+	static VOID Encode(
+		_In_  CONST ARCHIVE_SNAPSHOT& Snapshot,
+		_Out_ ARCHIVE_BLOCK_HEADER&   Header,
+		_Out_ std::vector<UCHAR>&     Payload
+	);
+
+	_Must_inspect_result_
+	static BOOLEAN Decode(
+		_In_  CONST ARCHIVE_BLOCK_HEADER& Header,
+		_In_  CONST std::vector<UCHAR>&   Payload,
+		_Out_ ARCHIVE_SNAPSHOT&           Snapshot
+	);
+
+	FILE*   m_Archive{ NULL };
+	FILE*   m_Index{ NULL };
+	ULONG64 m_NumberOfBlocks{ 0x00 };
+};
+
+#endif // !__VADLIST_ARCHIVE_H_GUARD__
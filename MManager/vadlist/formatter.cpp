@@ -0,0 +1,351 @@
+/*+================================================================================================
+Module Name: formatter.cpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+
+Abstract:
+Buffered row formatter. Rows are rendered into a reusable buffer, written to the stream in large
+blocks, as an aligned text table, comma-separated values or JSON Lines.
+Only depends on the C runtime, so that it builds on Windows and on POSIX systems.
+
+================================================================================================+*/
+
+#include <string.h>
+#include "formatter.h"
+
+// Digits of the hexadecimal and decimal conversions.
+static CONST CHAR FormatDigits[] = "0123456789abcdef";
+
+
+_Use_decl_annotations_
+CRowFormatter::CRowFormatter(
+	_In_ FORMAT_SINK          Sink,
+	_In_ CONST FORMAT_COLUMN* Columns,
+	_In_ ULONG                NumberOfColumns,
+	_In_ FILE*                Stream,
+	_In_ SIZE_T               Capacity
+) : m_Sink(Sink), m_Columns(Columns), m_NumberOfColumns(NumberOfColumns), m_Stream(Stream) {
+
+	// Enough room for the longest number and its padding
+	if (Capacity < 0x100)
+		Capacity = 0x100;
+	this->m_Buffer.resize(Capacity);
+}
+
+
+CRowFormatter::~CRowFormatter() {
+	this->Flush();
+}
+
+
+VOID CRowFormatter::WriteHeader() {
+	if (this->m_Sink == FormatSinkJsonLines)
+		return;
+
+	for (ULONG cx = 0x00; cx < this->m_NumberOfColumns; cx++)
+		this->AddString(this->m_Columns[cx].Name);
+	this->EndRow();
+	if (this->m_Sink != FormatSinkText)
+		return;
+
+	// Underline each header in the text table
+	for (ULONG cx = 0x00; cx < this->m_NumberOfColumns; cx++) {
+		SIZE_T Length = strlen(this->m_Columns[cx].Name);
+
+		this->BeginField(FALSE);
+		this->Reserve(Length);
+		memset(&this->m_Buffer[this->m_Length], '-', Length);
+		this->m_Length += Length;
+		this->EndField(FALSE);
+	}
+	this->EndRow();
+}
+
+
+_Use_decl_annotations_
+VOID CRowFormatter::AddHex(
+	_In_ ULONG64 Value,
+	_In_ ULONG   Digits
+) {
+	CHAR  Scratch[0x20] = { 0x00 };
+	ULONG Length        = 0x00;
+
+	// Digits from the least significant one, at least one of them
+	do {
+		Scratch[sizeof(Scratch) - ++Length] = FormatDigits[Value & 0x0F];
+		Value >>= 0x04;
+	} while (Value != 0x00);
+	while (Length < Digits && Length < sizeof(Scratch) - 0x02)
+		Scratch[sizeof(Scratch) - ++Length] = '0';
+
+	// Prefix outside of the text table, and JSON has no hexadecimal numbers
+	BOOLEAN Quoted = this->m_Sink == FormatSinkJsonLines;
+	if (this->m_Sink != FormatSinkText) {
+		Scratch[sizeof(Scratch) - ++Length] = 'x';
+		Scratch[sizeof(Scratch) - ++Length] = '0';
+	}
+
+	this->BeginField(Quoted);
+	this->Write(&Scratch[sizeof(Scratch) - Length], Length);
+	this->EndField(Quoted);
+}
+
+
+_Use_decl_annotations_
+VOID CRowFormatter::AddDecimal(
+	_In_ ULONG64 Value
+) {
+	CHAR  Scratch[0x20] = { 0x00 };
+	ULONG Length        = 0x00;
+
+	do {
+		Scratch[sizeof(Scratch) - ++Length] = FormatDigits[Value % 10];
+		Value /= 10;
+	} while (Value != 0x00);
+
+	this->BeginField(FALSE);
+	this->Write(&Scratch[sizeof(Scratch) - Length], Length);
+	this->EndField(FALSE);
+}
+
+
+_Use_decl_annotations_
+VOID CRowFormatter::AddString(
+	_In_ CONST CHAR* String
+) {
+	this->AddString(String, String != NULL ? strlen(String) : 0x00);
+}
+
+
+_Use_decl_annotations_
+VOID CRowFormatter::AddString(
+	_In_reads_(Length) CONST CHAR* String,
+	_In_               SIZE_T      Length
+) {
+	this->BeginField(this->m_Sink != FormatSinkText);
+
+	// Plain copy for the text table
+	if (this->m_Sink == FormatSinkText) {
+		this->Write(String, Length);
+		this->EndField(FALSE);
+		return;
+	}
+
+	for (SIZE_T cx = 0x00; cx < Length; cx++)
+		this->PutEscaped((UCHAR)String[cx]);
+	this->EndField(TRUE);
+}
+
+
+_Use_decl_annotations_
+VOID CRowFormatter::AddWideString(
+	_In_reads_(Length) CONST WCHAR* String,
+	_In_               SIZE_T       Length
+) {
+	this->BeginField(this->m_Sink != FormatSinkText);
+
+	for (SIZE_T cx = 0x00; cx < Length; cx++) {
+		ULONG CodePoint = String[cx];
+
+		// Surrogate pairs, unpaired surrogates are replaced
+		if (CodePoint >= 0xD800 && CodePoint <= 0xDBFF && (cx + 1) < Length
+			&& String[cx + 1] >= 0xDC00 && String[cx + 1] <= 0xDFFF) {
+			CodePoint = 0x10000 + ((CodePoint - 0xD800) << 10) + (String[cx + 1] - 0xDC00);
+			cx++;
+		}
+		else if (CodePoint >= 0xD800 && CodePoint <= 0xDFFF) {
+			CodePoint = 0xFFFD;
+		}
+
+		// ASCII characters may have to be escaped
+		if (CodePoint < 0x80) {
+			if (this->m_Sink == FormatSinkText) {
+				this->Reserve(0x01);
+				this->Put((CHAR)CodePoint);
+			}
+			else {
+				this->PutEscaped(CodePoint);
+			}
+			continue;
+		}
+
+		this->Reserve(0x04);
+		if (CodePoint < 0x800) {
+			this->Put((CHAR)(0xC0 | (CodePoint >> 6)));
+		}
+		else if (CodePoint < 0x10000) {
+			this->Put((CHAR)(0xE0 | (CodePoint >> 12)));
+			this->Put((CHAR)(0x80 | ((CodePoint >> 6) & 0x3F)));
+		}
+		else {
+			this->Put((CHAR)(0xF0 | (CodePoint >> 18)));
+			this->Put((CHAR)(0x80 | ((CodePoint >> 12) & 0x3F)));
+			this->Put((CHAR)(0x80 | ((CodePoint >> 6) & 0x3F)));
+		}
+		this->Put((CHAR)(0x80 | (CodePoint & 0x3F)));
+	}
+	this->EndField(this->m_Sink != FormatSinkText);
+}
+
+
+VOID CRowFormatter::EndRow() {
+	this->Reserve(0x04);
+
+	// Text table and CSV rows end with the last field
+	if (this->m_Sink == FormatSinkJsonLines) {
+		if (this->m_Column == 0x00)
+			this->Put('{');
+		this->Put('}');
+	}
+	this->Put('\n');
+	this->m_Column = 0x00;
+}
+
+
+VOID CRowFormatter::Flush() {
+	if (this->m_Length != 0x00)
+		fwrite(this->m_Buffer.data(), sizeof(CHAR), this->m_Length, this->m_Stream);
+
+	// Length of the current field already written
+	this->m_FieldFlushed += this->m_Length - this->m_FieldStart;
+	this->m_FieldStart    = 0x00;
+	this->m_Length        = 0x00;
+}
+
+
+_Use_decl_annotations_
+VOID CRowFormatter::BeginField(
+	_In_ BOOLEAN Quoted
+) {
+	// Separator, quote and JSON key
+	switch (this->m_Sink) {
+	case FormatSinkCsv:
+		this->Reserve(0x02);
+		if (this->m_Column != 0x00)
+			this->Put(',');
+		break;
+	case FormatSinkJsonLines: {
+		CONST CHAR* Name       = this->m_Column < this->m_NumberOfColumns ? this->m_Columns[this->m_Column].Name : "";
+		SIZE_T      NameLength = strlen(Name);
+
+		this->Reserve(0x02);
+		this->Put(this->m_Column == 0x00 ? '{' : ',');
+		this->Put('"');
+		this->Write(Name, NameLength);
+		this->Reserve(0x03);
+		this->Put('"');
+		this->Put(':');
+		break;
+	}
+	case FormatSinkText:
+	default:
+		this->Reserve(0x01);
+		break;
+	}
+	if (Quoted)
+		this->Put('"');
+
+	this->m_FieldStart   = this->m_Length;
+	this->m_FieldFlushed = 0x00;
+}
+
+
+_Use_decl_annotations_
+VOID CRowFormatter::EndField(
+	_In_ BOOLEAN Quoted
+) {
+	if (Quoted) {
+		this->Reserve(0x01);
+		this->Put('"');
+	}
+
+	// Pad the columns of the text table, at least one space between two columns, none after the last one
+	if (this->m_Sink == FormatSinkText && (this->m_Column + 1) < this->m_NumberOfColumns) {
+		SIZE_T Length = this->m_FieldFlushed + (this->m_Length - this->m_FieldStart);
+		SIZE_T Width  = this->m_Columns[this->m_Column].Width;
+		SIZE_T Pad    = (Length < Width) ? (Width - Length) : 0x01;
+
+		this->Reserve(Pad);
+		memset(&this->m_Buffer[this->m_Length], ' ', Pad);
+		this->m_Length += Pad;
+	}
+	this->m_Column++;
+}
+
+
+_Use_decl_annotations_
+VOID CRowFormatter::PutEscaped(
+	_In_ ULONG CodePoint
+) {
+	this->Reserve(FORMAT_MAXIMUM_CHARACTER_SIZE);
+
+	// CSV only doubles the quotes
+	if (this->m_Sink == FormatSinkCsv) {
+		if (CodePoint == '"')
+			this->Put('"');
+		this->Put((CHAR)CodePoint);
+		return;
+	}
+
+	switch (CodePoint) {
+	case '"':
+	case '\\':
+		this->Put('\\');
+		this->Put((CHAR)CodePoint);
+		break;
+	case '\n':
+		this->Put('\\');
+		this->Put('n');
+		break;
+	case '\r':
+		this->Put('\\');
+		this->Put('r');
+		break;
+	case '\t':
+		this->Put('\\');
+		this->Put('t');
+		break;
+	default:
+		if (CodePoint < 0x20) {
+			this->Put('\\');
+			this->Put('u');
+			this->Put('0');
+			this->Put('0');
+			this->Put(FormatDigits[CodePoint >> 4]);
+			this->Put(FormatDigits[CodePoint & 0x0F]);
+		}
+		else {
+			this->Put((CHAR)CodePoint);
+		}
+		break;
+	}
+}
+
+
+_Use_decl_annotations_
+VOID CRowFormatter::Write(
+	_In_reads_(Length) CONST CHAR* Data,
+	_In_               SIZE_T      Length
+) {
+	// Most writes fit in the buffer
+	if (this->m_Length + Length <= this->m_Buffer.size()) {
+		memcpy(&this->m_Buffer[this->m_Length], Data, Length);
+		this->m_Length += Length;
+		return;
+	}
+
+	while (Length != 0x00) {
+		this->Reserve(0x01);
+
+		SIZE_T Size = this->m_Buffer.size() - this->m_Length;
+		if (Size > Length)
+			Size = Length;
+		memcpy(&this->m_Buffer[this->m_Length], Data, Size);
+
+		this->m_Length += Size;
+		Data           += Size;
+		Length         -= Size;
+	}
+}
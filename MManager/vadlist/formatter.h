@@ -0,0 +1,156 @@
+/*+================================================================================================
+Module Name: formatter.h
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+
+Abstract:
+Buffered row formatter. Rows are rendered into a reusable buffer, written to the stream in large
+blocks, as an aligned text table, comma-separated values or JSON Lines.
+Only depends on the C runtime, so that it builds on Windows and on POSIX systems.
+
+================================================================================================+*/
+
+#ifndef __VADLIST_FORMATTER_H_GUARD__
+#define __VADLIST_FORMATTER_H_GUARD__
+
+#include <stdio.h>
+#include <vector>
+
+#include "../../kshim/kshim.h"
+
+// Default size of the output buffer.
+#define FORMAT_BUFFER_SIZE 0x10000
+
+// Longest output of a single character of a string: JSON escape sequence of a control character.
+#define FORMAT_MAXIMUM_CHARACTER_SIZE 0x06
+
+/// <summary>
+/// Output format of the rows.
+/// </summary>
+typedef enum _FORMAT_SINK {
+	FormatSinkText,      // Aligned columns
+	FormatSinkCsv,       // Comma-separated values, with a header line
+	FormatSinkJsonLines  // One JSON object per line
+} FORMAT_SINK, * PFORMAT_SINK;
+
+/// <summary>
+/// Column of the rows.
+/// </summary>
+typedef struct _FORMAT_COLUMN {
+	CONST CHAR* Name;  // Header of the column and key of the JSON objects
+	ULONG       Width; // Width of the column in the text table, 0 for no padding
+} FORMAT_COLUMN, * PFORMAT_COLUMN;
+
+class CRowFormatter {
+
+public:
+	CRowFormatter(
+		_In_ FORMAT_SINK          Sink,
+		_In_ CONST FORMAT_COLUMN* Columns,
+		_In_ ULONG                NumberOfColumns,
+		_In_ FILE*                Stream,
+		_In_ SIZE_T               Capacity = FORMAT_BUFFER_SIZE
+	);
+
+	~CRowFormatter();
+
+	/// <summary>
+	/// Write the name of the columns, underlined in the text table. Nothing for JSON Lines.
+	/// </summary>
+	VOID WriteHeader();
+
+	/// <summary>
+	/// Add an hexadecimal field, zero padded to Digits if not 0.
+	/// </summary>
+	VOID AddHex(
+		_In_ ULONG64 Value,
+		_In_ ULONG   Digits = 0x00
+	);
+
+	VOID AddDecimal(
+		_In_ ULONG64 Value
+	);
+
+	VOID AddString(
+		_In_ CONST CHAR* String
+	);
+
+	VOID AddString(
+		_In_reads_(Length) CONST CHAR* String,
+		_In_               SIZE_T      Length
+	);
+
+	/// <summary>
+	/// Add an UTF-16 string field, written as UTF-8.
+	/// </summary>
+	VOID AddWideString(
+		_In_reads_(Length) CONST WCHAR* String,
+		_In_               SIZE_T       Length
+	);
+
+	/// <summary>
+	/// Terminate the current row. Missing fields are left empty.
+	/// </summary>
+	VOID EndRow();
+
+	/// <summary>
+	/// Write the content of the buffer to the stream.
+	/// </summary>
+	VOID Flush();
+
+private:
+	VOID BeginField(
+		_In_ BOOLEAN Quoted
+	);
+
+	VOID EndField(
+		_In_ BOOLEAN Quoted
+	);
+
+	/// <summary>
+	/// Make room for Size bytes, flushing the buffer if needed.
+	/// </summary>
+	inline VOID Reserve(
+		_In_ SIZE_T Size
+	) {
+		if (this->m_Length + Size > this->m_Buffer.size())
+			this->Flush();
+	}
+
+	inline VOID Put(
+		_In_ CHAR Character
+	) {
+		this->m_Buffer[this->m_Length++] = Character;
+	}
+
+	VOID PutEscaped(
+		_In_ ULONG CodePoint
+	);
+
+	VOID Write(
+		_In_reads_(Length) CONST CHAR* Data,
+		_In_               SIZE_T      Length
+	);
+
+	FORMAT_SINK          m_Sink;
+	CONST FORMAT_COLUMN* m_Columns;
+	ULONG                m_NumberOfColumns;
+	FILE*                m_Stream;
+
+	/// <summary>
+	/// Output buffer, m_Length bytes used.
+	/// </summary>
+	std::vector<CHAR> m_Buffer;
+	SIZE_T            m_Length{ 0x00 };
+
+	/// <summary>
+	/// Index of the next field of the row and offset of the current field in the buffer.
+	/// </summary>
+	ULONG  m_Column{ 0x00 };
+	SIZE_T m_FieldStart{ 0x00 };
+	SIZE_T m_FieldFlushed{ 0x00 };
+};
+
+#endif // !__VADLIST_FORMATTER_H_GUARD__
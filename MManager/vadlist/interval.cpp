@@ -0,0 +1,215 @@
+/*+================================================================================================
+Module Name: interval.cpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+
+Abstract:
+Index of non-overlapping intervals, e.g. the VPN ranges of a VAD list.
+The starts are stored in Eytzinger (BFS) order so that a lookup walks down the array with
+predictable, prefetchable accesses. The free gaps between two intervals are kept in a maximum
+segment tree. Point, range and largest gap queries are O(log n).
+Only depends on the C runtime, so that it builds on Windows and on POSIX systems.
+
+================================================================================================+*/
+
+#include <algorithm>
+
+#include "interval.h"
+
+// Fetch the starts of the descendants 4 levels down, 16 of them are two cache lines.
+// Prefetching past the end of the array does not fault.
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define INTERVAL_PREFETCH(Address) _mm_prefetch((CONST CHAR*)(Address), _MM_HINT_T0)
+#elif defined(__GNUC__)
+#define INTERVAL_PREFETCH(Address) __builtin_prefetch((CONST VOID*)(Address))
+#else
+#define INTERVAL_PREFETCH(Address)
+#endif // _MSC_VER
+
+/// <summary>
+/// Larger of two gap tree nodes, the lower one on ties.
+/// </summary>
+static inline CONST INTERVAL_GAP_NODE& MaximumGapNode(
+	_In_ CONST INTERVAL_GAP_NODE& Left,
+	_In_ CONST INTERVAL_GAP_NODE& Right
+) {
+	if (Left.Position == INTERVAL_NO_GAP)
+		return Right;
+	if (Right.Position == INTERVAL_NO_GAP)
+		return Left;
+	if (Right.Length > Left.Length || (Right.Length == Left.Length && Right.Position < Left.Position))
+		return Right;
+	return Left;
+}
+
+
+_Use_decl_annotations_
+VOID CIntervalIndex::Build(
+	_In_ std::vector<INTERVAL> Intervals
+) {
+	std::sort(Intervals.begin(), Intervals.end(),
+		[](CONST INTERVAL& Left, CONST INTERVAL& Right) {
+			return Left.Start < Right.Start;
+		}
+	);
+	this->m_Intervals = std::move(Intervals);
+
+	// Eytzinger layout, slot 0 unused
+	SIZE_T Count = this->m_Intervals.size();
+	this->m_Starts.assign(Count + 1, 0x00);
+	this->m_Positions.assign(Count + 1, 0x00);
+	this->BuildEytzinger(0x00, 0x01);
+
+	// Gap i lies between the intervals i and i + 1
+	SIZE_T NumberOfGaps = Count > 0x01 ? Count - 1 : 0x00;
+	this->m_Leaves = 0x01;
+	while (this->m_Leaves < NumberOfGaps)
+		this->m_Leaves <<= 1;
+
+	this->m_GapTree.assign(this->m_Leaves * 2, { 0x00, INTERVAL_NO_GAP });
+	for (SIZE_T cx = 0x00; cx < NumberOfGaps; cx++) {
+		INTERVAL_GAP_NODE& Leaf = this->m_GapTree[this->m_Leaves + cx];
+		Leaf.Length   = this->m_Intervals[cx + 1].Start - this->m_Intervals[cx].End - 1;
+		Leaf.Position = (ULONG)cx;
+	}
+	for (SIZE_T Node = this->m_Leaves - 1; Node > 0x00; Node--)
+		this->m_GapTree[Node] = MaximumGapNode(this->m_GapTree[Node * 2], this->m_GapTree[(Node * 2) + 1]);
+}
+
+
+_Use_decl_annotations_
+SIZE_T CIntervalIndex::Find(
+	_In_ ULONG64 Value
+) const {
+	SIZE_T Count = this->UpperBound(Value);
+	if (Count == 0x00)
+		return INTERVAL_NONE;
+
+	// Last interval starting at or before the value
+	if (this->m_Intervals[Count - 1].End < Value)
+		return INTERVAL_NONE;
+	return Count - 1;
+}
+
+
+_Use_decl_annotations_
+VOID CIntervalIndex::FindRange(
+	_In_  ULONG64 First,
+	_In_  ULONG64 Last,
+	_Out_ SIZE_T& Begin,
+	_Out_ SIZE_T& End
+) const {
+	Begin = End = 0x00;
+	if (First > Last)
+		return;
+
+	// The interval starting before First may still overlap it
+	Begin = this->UpperBound(First);
+	if (Begin != 0x00 && this->m_Intervals[Begin - 1].End >= First)
+		Begin--;
+	End = this->UpperBound(Last);
+}
+
+
+_Use_decl_annotations_
+INTERVAL_GAP CIntervalIndex::FindLargestGap(
+	_In_ ULONG64 First,
+	_In_ ULONG64 Last
+) const {
+	INTERVAL_GAP Gap = { First, 0x00 };
+	if (First > Last)
+		return Gap;
+
+	SIZE_T Begin = 0x00;
+	SIZE_T End   = 0x00;
+	this->FindRange(First, Last, Begin, End);
+
+	// Nothing in the range
+	if (Begin == End) {
+		Gap.Length = Last - First + 1;
+		return Gap;
+	}
+
+	// Before the first interval
+	CONST INTERVAL& Lowest = this->m_Intervals[Begin];
+	if (Lowest.Start > First)
+		Gap.Length = Lowest.Start - First;
+
+	// Between two intervals of the range, entirely within the range
+	INTERVAL_GAP_NODE Node = this->FindLargestGapNode(Begin, End - 1);
+	if (Node.Position != INTERVAL_NO_GAP && Node.Length > Gap.Length) {
+		Gap.Start  = this->m_Intervals[Node.Position].End + 1;
+		Gap.Length = Node.Length;
+	}
+
+	// After the last interval
+	CONST INTERVAL& Highest = this->m_Intervals[End - 1];
+	if (Highest.End < Last && (Last - Highest.End) > Gap.Length) {
+		Gap.Start  = Highest.End + 1;
+		Gap.Length = Last - Highest.End;
+	}
+	return Gap;
+}
+
+
+_Use_decl_annotations_
+SIZE_T CIntervalIndex::UpperBound(
+	_In_ ULONG64 Value
+) const {
+	CONST ULONG64* Starts = this->m_Starts.data();
+	SIZE_T         Count  = this->m_Intervals.size();
+	SIZE_T         Node   = 0x01;
+
+	// Branchless descent, right when the start is not above the value
+	while (Node <= Count) {
+		INTERVAL_PREFETCH((SIZE_T)Starts + (Node * 0x10 * sizeof(ULONG64)));
+		Node = (Node * 2) + (Starts[Node] <= Value);
+	}
+
+	// Undo the right turns taken after the last left turn, the node left is the first start above
+	// the value, or none.
+	while (Node & 0x01)
+		Node >>= 1;
+	Node >>= 1;
+	return (Node == 0x00) ? Count : this->m_Positions[Node];
+}
+
+
+_Use_decl_annotations_
+INTERVAL_GAP_NODE CIntervalIndex::FindLargestGapNode(
+	_In_ SIZE_T Begin,
+	_In_ SIZE_T End
+) const {
+	INTERVAL_GAP_NODE Left  = { 0x00, INTERVAL_NO_GAP };
+	INTERVAL_GAP_NODE Right = { 0x00, INTERVAL_NO_GAP };
+	if (Begin >= End)
+		return Left;
+
+	// Bottom-up on [Begin, End), nodes from the left before the ones from the right
+	for (Begin += this->m_Leaves, End += this->m_Leaves; Begin < End; Begin >>= 1, End >>= 1) {
+		if (Begin & 0x01)
+			Left = MaximumGapNode(Left, this->m_GapTree[Begin++]);
+		if (End & 0x01)
+			Right = MaximumGapNode(this->m_GapTree[--End], Right);
+	}
+	return MaximumGapNode(Left, Right);
+}
+
+
+_Use_decl_annotations_
+SIZE_T CIntervalIndex::BuildEytzinger(
+	_In_ SIZE_T Position,
+	_In_ SIZE_T Node
+) {
+	if (Node >= this->m_Starts.size())
+		return Position;
+
+	// In-order walk of the implicit tree visits the sorted intervals in order
+	Position = this->BuildEytzinger(Position, Node * 2);
+	this->m_Starts[Node]    = this->m_Intervals[Position].Start;
+	this->m_Positions[Node] = (ULONG)Position;
+	return this->BuildEytzinger(Position + 1, (Node * 2) + 1);
+}
@@ -0,0 +1,141 @@
+/*+================================================================================================
+Module Name: interval.h
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+
+Abstract:
+Index of non-overlapping intervals, e.g. the VPN ranges of a VAD list.
+The starts are stored in Eytzinger (BFS) order so that a lookup walks down the array with
+predictable, prefetchable accesses. The free gaps between two intervals are kept in a maximum
+segment tree. Point, range and largest gap queries are O(log n).
+Only depends on the C runtime, so that it builds on Windows and on POSIX systems.
+
+================================================================================================+*/
+
+#ifndef __VADLIST_INTERVAL_H_GUARD__
+#define __VADLIST_INTERVAL_H_GUARD__
+
+#include <vector>
+
+#include "../../kshim/kshim.h"
+
+// Position returned when no interval matches.
+#define INTERVAL_NONE (SIZE_T)-1
+
+// Position of the empty leaves of the gap tree.
+#define INTERVAL_NO_GAP (ULONG)-1
+
+/// <summary>
+/// Closed interval [Start, End] and its owner.
+/// </summary>
+typedef struct _INTERVAL {
+	ULONG64 Start;
+	ULONG64 End;
+	PVOID   Context;
+} INTERVAL, * PINTERVAL;
+
+/// <summary>
+/// Free range between intervals.
+/// </summary>
+typedef struct _INTERVAL_GAP {
+	ULONG64 Start;  // First free value
+	ULONG64 Length; // Number of free values, 0 if none
+} INTERVAL_GAP, * PINTERVAL_GAP;
+
+/// <summary>
+/// Node of the gap tree.
+/// </summary>
+typedef struct _INTERVAL_GAP_NODE {
+	ULONG64 Length;   // Number of free values
+	ULONG   Position; // Interval before the gap, INTERVAL_NO_GAP for empty leaves
+} INTERVAL_GAP_NODE, * PINTERVAL_GAP_NODE;
+
+class CIntervalIndex {
+
+public:
+	/// <summary>
+	/// Sort the intervals and build the search and gap structures. Intervals must not overlap.
+	/// </summary>
+	VOID Build(
+		_In_ std::vector<INTERVAL> Intervals
+	);
+
+	SIZE_T GetNumberOfIntervals() const { return this->m_Intervals.size(); }
+
+	/// <summary>
+	/// Interval at a position, in ascending order.
+	/// </summary>
+	CONST INTERVAL& operator[](
+		_In_ SIZE_T Position
+	) const { return this->m_Intervals[Position]; }
+
+	/// <summary>
+	/// Find the interval containing a value.
+	/// </summary>
+	/// <returns>Position of the interval, INTERVAL_NONE if the value is not covered.</returns>
+	SIZE_T Find(
+		_In_ ULONG64 Value
+	) const;
+
+	/// <summary>
+	/// Find the intervals overlapping [First, Last], as positions [Begin, End).
+	/// </summary>
+	VOID FindRange(
+		_In_  ULONG64 First,
+		_In_  ULONG64 Last,
+		_Out_ SIZE_T& Begin,
+		_Out_ SIZE_T& End
+	) const;
+
+	/// <summary>
+	/// Find the largest free range within [First, Last].
+	/// </summary>
+	/// <returns>Lowest of the largest free ranges, of length 0 if [First, Last] is fully covered.</returns>
+	INTERVAL_GAP FindLargestGap(
+		_In_ ULONG64 First,
+		_In_ ULONG64 Last
+	) const;
+
+private:
+	/// <summary>
+	/// Number of intervals starting at or before a value.
+	/// </summary>
+	SIZE_T UpperBound(
+		_In_ ULONG64 Value
+	) const;
+
+	/// <summary>
+	/// Largest of the gaps following the intervals [Begin, End), the lowest one on ties.
+	/// </summary>
+	INTERVAL_GAP_NODE FindLargestGapNode(
+		_In_ SIZE_T Begin,
+		_In_ SIZE_T End
+	) const;
+
+	SIZE_T BuildEytzinger(
+		_In_ SIZE_T Position,
+		_In_ SIZE_T Node
+	);
+
+	/// <summary>
+	/// Intervals in ascending order.
+	/// </summary>
+	std::vector<INTERVAL> m_Intervals;
+
+	/// <summary>
+	/// Starts in Eytzinger order, 1-based, and position of each of them in m_Intervals.
+	/// </summary>
+	std::vector<ULONG64> m_Starts;
+	std::vector<ULONG>   m_Positions;
+
+	/// <summary>
+	/// Maximum segment tree over the gaps, leaves at m_Leaves + position, each node holding the
+	/// largest gap below it.
+	/// </summary>
+	std::vector<INTERVAL_GAP_NODE> m_GapTree;
+	SIZE_T                         m_Leaves{ 0x00 };
+};
+
+#endif // !__VADLIST_INTERVAL_H_GUARD__
@@ -13,27 +13,138 @@ Console application entry point.
 #include <Windows.h>
 #include <memory>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "mmanager.h"
 
+/// <summary>
+/// Print the snapshots of an archive taken between two times, in seconds since 1970-01-01 UTC.
+/// </summary>
+static BOOLEAN PrintArchive(
+	_In_z_ CONST CHAR* Path,
+	_In_   ULONG64     From,
+	_In_   ULONG64     To,
+	_In_   FORMAT_SINK Sink
+) {
+	CVadArchive Archive;
+	if (!Archive.Open(Path))
+		return FALSE;
+
+	CONST FORMAT_COLUMN Columns[] = {
+		{ "Time",       12 },
+		{ "PID",         7 },
+		{ "VAD",        19 },
+		{ "Level",       7 },
+		{ "VPN Start",  11 },
+		{ "VPN End",    11 },
+		{ "Commit",     10 },
+		{ "Valid",      10 },
+		{ "Trans",       7 },
+		{ "Flags",      10 },
+		{ "Flags1",     10 },
+		{ "Flags2",     10 },
+		{ "File",     0x00 }
+	};
+	CRowFormatter Formatter(Sink, Columns, ARRAYSIZE(Columns), stdout);
+	Formatter.WriteHeader();
+
+	// Blocks are in time order, only the first one is searched
+	ARCHIVE_SNAPSHOT Snapshot;
+	for (ULONG64 Block = Archive.Seek(From); Block < Archive.GetNumberOfBlocks(); Block++) {
+		if (!Archive.ReadBlock(Block, Snapshot))
+			return FALSE;
+		if (Snapshot.Timestamp > To)
+			break;
+
+		for (CONST ARCHIVE_ENTRY& Entry : Snapshot.Entries) {
+			Formatter.AddDecimal(Snapshot.Timestamp);
+			Formatter.AddDecimal(Snapshot.ProcessId);
+			Formatter.AddHex(Entry.VadAddress, sizeof(PVOID) * 2);
+			Formatter.AddDecimal(Entry.Level);
+			Formatter.AddHex(Entry.VpnStarting);
+			Formatter.AddHex(Entry.VpnEnding);
+			Formatter.AddDecimal(Entry.CommitCharge);
+			Formatter.AddDecimal(Entry.ValidPages);
+			Formatter.AddDecimal(Entry.TransitionPages);
+			Formatter.AddHex(Entry.LongVadFlags, 0x08);
+			Formatter.AddHex(Entry.LongVadFlags1, 0x08);
+			Formatter.AddHex(Entry.LongVadFlags2, 0x08);
+			if (Entry.FileIndex < Snapshot.Files.size()) {
+				CONST ARCHIVE_STRING& File = Snapshot.Files[Entry.FileIndex];
+				Formatter.AddWideString(File.data(), File.size());
+			}
+			Formatter.EndRow();
+		}
+	}
+	return TRUE;
+}
+
 INT32 main(
 	_In_ int         argc,
 	_In_ const char* argv[]
 ) {
-	// Banner
-	wprintf(L"================================================================================================\r\n");
-	wprintf(L"Module Name: Virtual Address Descriptor List (vadlist)                                          \r\n");
-	wprintf(L"Author     : Paul L. (@am0nsec)                                                                 \r\n");
-	wprintf(L"Origin     : https://github.com/am0nsec/wkpe/                                                   \r\n\r\n");
-	wprintf(L"Tested OS  : Windows 10 (20h2) - 19044.1706                                                     \r\n");
-	wprintf(L"================================================================================================\r\n\r\n");
+	// Output format of the VAD list and archive to append to or to read
+	FORMAT_SINK Sink        = FormatSinkText;
+	CONST CHAR* ArchivePath = NULL;
+	BOOLEAN     ReadArchive = FALSE;
+	ULONG64     From        = 0x00;
+	ULONG64     To          = (ULONG64)-1;
+	ULONG64     FirstQuery  = 0x00;
+	ULONG64     LastQuery   = (ULONG64)-1;
+	for (INT cx = 0x02; cx < argc; cx++) {
+		if (strcmp(argv[cx], "-csv") == 0x00)
+			Sink = FormatSinkCsv;
+		else if (strcmp(argv[cx], "-jsonl") == 0x00)
+			Sink = FormatSinkJsonLines;
+		else if (strcmp(argv[cx], "-a") == 0x00 && (cx + 1) < argc)
+			ArchivePath = argv[++cx];
+		else if (strcmp(argv[cx], "-from") == 0x00 && (cx + 1) < argc)
+			From = strtoull(argv[++cx], NULL, 0x00);
+		else if (strcmp(argv[cx], "-to") == 0x00 && (cx + 1) < argc)
+			To = strtoull(argv[++cx], NULL, 0x00);
+		else if (strcmp(argv[cx], "-q") == 0x00 && (cx + 1) < argc) {
+			// Address or range of addresses, "<first>[-<last>]"
+			CHAR* Separator = NULL;
+			FirstQuery = LastQuery = strtoull(argv[++cx], &Separator, 0x00);
+			if (*Separator == '-')
+				LastQuery = strtoull(Separator + 1, NULL, 0x00);
+		}
+	}
+	if (argc > 0x02 && strcmp(argv[0x01], "-r") == 0x00) {
+		ReadArchive = TRUE;
+		ArchivePath = argv[0x02];
+	}
+
+	// File names are written as UTF-8
+	SetConsoleOutputCP(CP_UTF8);
+
+	// Banner, only in front of the text table
+	if (Sink == FormatSinkText && !ReadArchive) {
+		wprintf(L"================================================================================================\r\n");
+		wprintf(L"Module Name: Virtual Address Descriptor List (vadlist)                                          \r\n");
+		wprintf(L"Author     : Paul L. (@am0nsec)                                                                 \r\n");
+		wprintf(L"Origin     : https://github.com/am0nsec/wkpe/                                                   \r\n\r\n");
+		wprintf(L"Tested OS  : Windows 10 (20h2) - 19044.1706                                                     \r\n");
+		wprintf(L"================================================================================================\r\n\r\n");
+	}
 	
 	// Check for parameters
 	if (argc < 0x02) {
-		printf("Usage: vadlist.exe <process id>\r\n\r\n");
+		printf("Usage: vadlist.exe <process id> [-csv | -jsonl] [-q <address>[-<address>]] [-a <archive>]\r\n");
+		printf("       vadlist.exe -r <archive> [-from <time>] [-to <time>] [-csv | -jsonl]\r\n\r\n");
 		return EXIT_FAILURE;
 	}
 
+	// Snapshots from an archive, no need for the driver
+	if (ReadArchive) {
+		if (!PrintArchive(ArchivePath, From, To, Sink)) {
+			printf("Failed to read the archive.\r\n\r\n");
+			return EXIT_FAILURE;
+		}
+		return EXIT_SUCCESS;
+	}
+
 	// Check for the PID provided
 	ULONG ProcessId = atoi(argv[0x01]);;
 	if (ProcessId <= 0x04 || (ProcessId % 4) != 0x00) {
@@ -53,7 +164,19 @@ INT32 main(
 		printf("Failed to retrieve VAD list.\r\n\r\n");
 		return EXIT_FAILURE;
 	}
-	MManager->PrintProcessVads();
+	// Keep a snapshot instead of printing it
+	if (ArchivePath != NULL) {
+		if (!MManager->ArchiveProcessVads(ArchivePath)) {
+			printf("Failed to append to the archive.\r\n\r\n");
+			return EXIT_FAILURE;
+		}
+		return EXIT_SUCCESS;
+	}
+
+	// Summary only of the whole list
+	MManager->PrintProcessVads(Sink, FirstQuery, LastQuery);
+	if (Sink == FormatSinkText && FirstQuery == 0x00 && LastQuery == (ULONG64)-1)
+		MManager->PrintProcessSummary();
 
 	return EXIT_SUCCESS;
 }
@@ -11,6 +11,7 @@ User mode interface to query VAD list of a process.
 ================================================================================================+*/
 
 #include <stdio.h>
+#include <time.h>
 #include "mmanager.h"
 
 
@@ -99,111 +100,412 @@ BOOLEAN CMManager::FindProcessVads(
 	if (!Success) {
 		wprintf(L"IOCTL_MMANAGER_GET_PROCESS_VADS failed (%d).\r\n", GetLastError());
 		HeapFree(GetProcessHeap(), 0x00, this->m_ListHeader);
+		this->m_ListHeader = NULL;
+		return Success;
+	}
+
+	// Index the file table, entries refer to the files by index
+	this->m_ProcessId = ProcessId;
+	this->m_Files.clear();
+	PMMANAGER_VADLIST_FILE File = this->m_ListHeader->FirstFile;
+	for (ULONG cx = 0x00; cx < this->m_ListHeader->NumberOfFiles; cx++) {
+		this->m_Files.push_back(File);
+		File = (PMMANAGER_VADLIST_FILE)((PUCHAR)File + File->Size);
 	}
+
+	// Index the VADs by VPN
+	std::vector<INTERVAL> Intervals;
+	Intervals.reserve(this->m_ListHeader->NumberOfNodes);
+	for (PMMANAGER_VADLIST_ENTRY Entry = this->m_ListHeader->First; Entry != NULL; Entry = Entry->List.Flink)
+		Intervals.push_back({ Entry->VpnStarting, Entry->VpnEnding, Entry });
+	this->m_Index.Build(std::move(Intervals));
 	return Success;
 }
 
 
-VOID CMManager::PrintProcessVads() {
+_Use_decl_annotations_
+VOID CMManager::PrintProcessVads(
+	_In_ FORMAT_SINK Sink,
+	_In_ ULONG64     FirstAddress,
+	_In_ ULONG64     LastAddress
+) {
 	if (this->m_ListHeader == NULL)
 		return;
 
-	// Header of the table
-	wprintf(L"VAD              Level  VPN Start    VPN End  Commit    Type         Protection         Pagefile/Image\r\n");
-	wprintf(L"---              -----  ---------    -------  ------    ----         ----------         --------------\r\n");
-	PMMANAGER_VADLIST_ENTRY Entry = this->m_ListHeader->First;
-	do {
-		// VAD node generic information
-		wprintf(L"%p %5d  %9llx  %9llx  %-8I64d  %s",
-			Entry->VadAddress,
-			Entry->Level,
-
-			Entry->VpnStarting,
-			Entry->VpnEnding,
-			Entry->CommitCharge,
-			Entry->VadFlags.PrivateMemory != 0x00 ? L"Private " : L"Mapped  "
+	CONST FORMAT_COLUMN Columns[] = {
+		{ "VAD",            19 },
+		{ "Level",           7 },
+		{ "VPN Start",      11 },
+		{ "VPN End",        11 },
+		{ "Commit",         10 },
+		{ "Valid",          10 },
+		{ "Trans",           7 },
+		{ "Memory",          9 },
+		{ "Type",           13 },
+		{ "Protection",     30 },
+		{ "Pagefile/Image", 0x00 }
+	};
+	CONST CHAR* VadTypeNames[MMANAGER_VAD_TYPE_COUNT] = {
+		"",
+		"Phys",
+		"Exe",
+		"AWE",
+		"WrtWatch",
+		"LargePag",
+		"Rotate",
+		"LargePagSec"
+	};
+	CONST CHAR* ProtectionNames[MM_PROTECTION_OPERATION_MASK + 1] = {
+		"",
+		"READONLY",
+		"EXECUTE",
+		"EXECUTE_READ",
+		"READWRITE",
+		"WRITECOPY",
+		"EXECUTE_READWRITE",
+		"EXECUTE_WRITECOPY"
+	};
+	CONST CHAR* ProtectionModifiers[(MM_NOACCESS >> 0x03) + 1] = {
+		"",
+		"NOCACHE",
+		"GUARD_PAGE",
+		"NO_ACCESS"
+	};
+
+	// All the protection strings, rather than building them for each VAD
+	CHAR Protections[MMANAGER_PROTECTION_COUNT][0x20] = { 0x00 };
+	for (ULONG cx = 0x00; cx < MMANAGER_PROTECTION_COUNT; cx++) {
+		CONST CHAR* Name     = ProtectionNames[cx & MM_PROTECTION_OPERATION_MASK];
+		CONST CHAR* Modifier = ProtectionModifiers[cx >> 0x03];
+
+		snprintf(Protections[cx], sizeof(Protections[cx]), "%s%s%s",
+			Name,
+			(Name[0x00] != 0x00 && Modifier[0x00] != 0x00) ? " " : "",
+			Modifier
 		);
+	}
 
-		// VAD node type information
-		switch ((MI_VAD_TYPE)Entry->VadFlags.VadType) {
-		case VadDevicePhysicalMemory:
-			wprintf(L"Phys ");
-			break;
-		case VadImageMap:
-			wprintf(L"Exe  ");
-			break;
-		case VadAwe:
-			wprintf(L"AWE  ");
-			break;
-		case VadWriteWatch:
-			wprintf(L"WrtWatch  ");
-			break;
-		case VadLargePages:
-			wprintf(L"LargePag  ");
-			break;
-		case VadRotatePhysical:
-			wprintf(L"Rotate  ");
-			break;
-		case VadLargePageSection:
-			wprintf(L"LargePagSec  ");
-			break;
-		case VadNone:
-		default:
-			wprintf(L"     ");
-			break;
-		}
-		
-		// VAD node permissions
-		switch (Entry->VadFlags.Protection & MM_PROTECTION_OPERATION_MASK) {
-		case MM_READONLY:
-			wprintf(L"READONLY           ");
-			break;
-		case MM_EXECUTE:
-			wprintf(L"EXECUTE            ");
-			break;
-		case MM_EXECUTE_READ:
-			wprintf(L"EXECUTE_READ       ");
-			break;
-		case MM_READWRITE:
-			wprintf(L"READWRITE          ");
-			break;
-		case MM_WRITECOPY:
-			wprintf(L"WRITECOPY          ");
-			break;
-		case MM_EXECUTE_READWRITE:
-			wprintf(L"EXECUTE_READWRITE  ");
-			break;
-		case MM_EXECUTE_WRITECOPY:
-			wprintf(L"EXECUTE_WRITECOPY  ");
-			break;
+	// Rows are rendered in a buffer and written in large blocks
+	CRowFormatter Formatter(Sink, Columns, ARRAYSIZE(Columns), stdout);
+	Formatter.WriteHeader();
+
+	// Only the VADs overlapping the range, in VPN order
+	SIZE_T Begin = 0x00;
+	SIZE_T End   = 0x00;
+	this->m_Index.FindRange(FirstAddress >> MMANAGER_PAGE_SHIFT, LastAddress >> MMANAGER_PAGE_SHIFT, Begin, End);
+
+	for (SIZE_T Position = Begin; Position < End; Position++) {
+		PMMANAGER_VADLIST_ENTRY Entry = (PMMANAGER_VADLIST_ENTRY)this->m_Index[Position].Context;
+
+		// VAD node generic information
+		Formatter.AddHex((ULONG64)Entry->VadAddress, sizeof(PVOID) * 2);
+		Formatter.AddDecimal(Entry->Level);
+		Formatter.AddHex(Entry->VpnStarting);
+		Formatter.AddHex(Entry->VpnEnding);
+		Formatter.AddDecimal(Entry->CommitCharge);
+		if (Entry->PagesUnresolved) {
+			Formatter.AddString("?");
+			Formatter.AddString("?");
 		}
-		if ((Entry->VadFlags.Protection & ~MM_PROTECTION_OPERATION_MASK) != 0x00) {
-			switch (Entry->VadFlags.Protection >> 0x03) {
-			case (MM_NOCACHE >> 0x03):
-				wprintf(L"NOCACHE            ");
-				break;
-			case (MM_GUARD_PAGE >> 0x03):
-				wprintf(L"GUARD_PAGE         ");
-				break;
-			case (MM_NOACCESS >> 0x03):
-				wprintf(L"NO_ACCESS          ");
-				break;
-			}
+		else {
+			Formatter.AddDecimal(Entry->ValidPages);
+			Formatter.AddDecimal(Entry->TransitionPages);
 		}
+		Formatter.AddString(Entry->VadFlags.PrivateMemory != 0x00 ? "Private" : "Mapped");
+
+		// VAD node type and permissions
+		Formatter.AddString(VadTypeNames[Entry->VadFlags.VadType]);
+		Formatter.AddString(Protections[Entry->VadFlags.Protection]);
 
 		// Display file name if mapped
-		if (Entry->FileName[0x00] != 0x00) {
-			wprintf(L"%s", (PWCHAR)Entry->FileName);
+		if (Entry->FileIndex < this->m_Files.size()) {
+			PMMANAGER_VADLIST_FILE File = this->m_Files[Entry->FileIndex];
+			Formatter.AddWideString(File->FileName, File->FileNameSize / sizeof(WCHAR));
 		}
 		else if (Entry->CommitPageCount != 0x00) {
-			wprintf(L"Pagefile section, shared commit %#I64x", Entry->CommitPageCount);
+			CHAR Section[0x40] = { 0x00 };
+			snprintf(Section, sizeof(Section), "Pagefile section, shared commit %#llx", Entry->CommitPageCount);
+			Formatter.AddString(Section);
 		}
-		wprintf(L"\r\n");
-	} while (Entry = Entry->List.Flink);
+		Formatter.EndRow();
+	}
+	Formatter.Flush();
 
+	// Only rows for CSV and JSON Lines
+	if (Sink != FormatSinkText)
+		return;
 	wprintf(L"\r\n");
 	wprintf(L"EPROCESS     : 0x%p\r\n", this->m_ListHeader->Eprocess);
 	wprintf(L"Total VADs   : %d\r\n", this->m_ListHeader->NumberOfNodes);
 	wprintf(L"Maximum depth: %d\r\n", this->m_ListHeader->MaximumLevel);
+
+	// Largest free range of the queried addresses, or of the whole user address space
+	ULONG64 FirstVpn = FirstAddress >> MMANAGER_PAGE_SHIFT;
+	ULONG64 LastVpn  = LastAddress >> MMANAGER_PAGE_SHIFT;
+	if (FirstVpn < MMANAGER_LOWEST_USER_VPN)
+		FirstVpn = MMANAGER_LOWEST_USER_VPN;
+	if (LastVpn > MMANAGER_HIGHEST_USER_VPN)
+		LastVpn = MMANAGER_HIGHEST_USER_VPN;
+
+	INTERVAL_GAP Gap = this->m_Index.FindLargestGap(FirstVpn, LastVpn);
+	if (Gap.Length != 0x00) {
+		wprintf(L"Largest gap  : 0x%I64x-0x%I64x (%#I64x pages)\r\n",
+			Gap.Start << MMANAGER_PAGE_SHIFT,
+			((Gap.Start + Gap.Length) << MMANAGER_PAGE_SHIFT) - 1,
+			Gap.Length
+		);
+	}
+	wprintf(L"\r\n");
+}
+
+VOID CMManager::PrintProcessSummary() {
+	if (this->m_ListHeader == NULL)
+		return;
+
+	CONST PCWSTR VadTypeNames[MMANAGER_VAD_TYPE_COUNT] = {
+		L"None",
+		L"DevicePhysicalMemory",
+		L"ImageMap",
+		L"Awe",
+		L"WriteWatch",
+		L"LargePages",
+		L"RotatePhysical",
+		L"LargePageSection"
+	};
+	CONST PCWSTR ProtectionNames[MM_PROTECTION_OPERATION_MASK + 1] = {
+		L"ZERO_ACCESS",
+		L"READONLY",
+		L"EXECUTE",
+		L"EXECUTE_READ",
+		L"READWRITE",
+		L"WRITECOPY",
+		L"EXECUTE_READWRITE",
+		L"EXECUTE_WRITECOPY"
+	};
+	CONST PCWSTR ProtectionModifiers[(MM_NOACCESS >> 0x03) + 1] = {
+		L"",
+		L"NOCACHE",
+		L"GUARD_PAGE",
+		L"NO_ACCESS"
+	};
+
+	wprintf(L"Private commit: %#I64x\r\n", this->m_ListHeader->TotalPrivateCommit);
+	wprintf(L"Shared commit : %#I64x\r\n", this->m_ListHeader->TotalSharedCommit);
+	if (this->m_ListHeader->UnresolvedFiles != 0x00)
+		wprintf(L"Unresolved    : %d mapped VADs without their file, out of memory\r\n", this->m_ListHeader->UnresolvedFiles);
+	if (this->m_ListHeader->UnresolvedPages != 0x00)
+		wprintf(L"Unresolved    : %d VADs without their pages, page tables unreadable\r\n", this->m_ListHeader->UnresolvedPages);
+	wprintf(L"\r\n");
+
+	// Histogram per type
+	wprintf(L"Type                  VADs       Commit        Pages\r\n");
+	wprintf(L"----                  ----       ------        -----\r\n");
+	for (ULONG cx = 0x00; cx < MMANAGER_VAD_TYPE_COUNT; cx++) {
+		PMMANAGER_VADLIST_STATS Stats = &this->m_ListHeader->VadTypes[cx];
+		if (Stats->NumberOfNodes == 0x00)
+			continue;
+		wprintf(L"%-20s %5d %12I64x %12I64x\r\n",
+			VadTypeNames[cx],
+			Stats->NumberOfNodes,
+			Stats->CommitCharge,
+			Stats->NumberOfPages
+		);
+	}
+	wprintf(L"\r\n");
+
+	// Histogram per protection
+	wprintf(L"Protection                       VADs       Commit        Pages\r\n");
+	wprintf(L"----------                       ----       ------        -----\r\n");
+	for (ULONG cx = 0x00; cx < MMANAGER_PROTECTION_COUNT; cx++) {
+		PMMANAGER_VADLIST_STATS Stats = &this->m_ListHeader->Protections[cx];
+		if (Stats->NumberOfNodes == 0x00)
+			continue;
+		wprintf(L"%-18s %-11s %5d %12I64x %12I64x\r\n",
+			ProtectionNames[cx & MM_PROTECTION_OPERATION_MASK],
+			ProtectionModifiers[cx >> 0x03],
+			Stats->NumberOfNodes,
+			Stats->CommitCharge,
+			Stats->NumberOfPages
+		);
+	}
+	wprintf(L"\r\n");
+
+	// Totals per mapped file
+	wprintf(L" VADs       Commit        Pages  File\r\n");
+	wprintf(L" ----       ------        -----  ----\r\n");
+	for (PMMANAGER_VADLIST_FILE File : this->m_Files) {
+		wprintf(L"%5d %12I64x %12I64x  %.*s\r\n",
+			File->Stats.NumberOfNodes,
+			File->Stats.CommitCharge,
+			File->Stats.NumberOfPages,
+			(INT)(File->FileNameSize / sizeof(WCHAR)),
+			File->FileName
+		);
+	}
+	wprintf(L"\r\n");
+
+	// Fragmentation of the user address space
+	MMANAGER_ADDRESS_SPACE_STATS AddressSpace;
+	if (!this->GetAddressSpaceStats(AddressSpace))
+		return;
+
+	CONST PCWSTR GapBucketNames[MMANAGER_GAP_BUCKET_COUNT] = {
+		L"< 64 KB",
+		L"64 KB - 1 MB",
+		L"1 MB - 16 MB",
+		L"16 MB - 256 MB",
+		L"256 MB - 4 GB",
+		L"4 GB - 64 GB",
+		L"64 GB - 1 TB",
+		L">= 1 TB"
+	};
+	ULONG64 UserPages = MMANAGER_HIGHEST_USER_VPN - MMANAGER_LOWEST_USER_VPN + 1;
+
+	wprintf(L"Reserved pages: %#I64x (%.2f%% of the user address space)\r\n",
+		AddressSpace.ReservedPages,
+		(AddressSpace.ReservedPages * 100.0) / UserPages
+	);
+	wprintf(L"Free pages    : %#I64x in %d ranges\r\n", AddressSpace.FreePages, AddressSpace.NumberOfGaps);
+	if (AddressSpace.Largest.Length != 0x00) {
+		wprintf(L"Largest free  : 0x%I64x-0x%I64x (%#I64x pages)\r\n",
+			AddressSpace.Largest.Start << MMANAGER_PAGE_SHIFT,
+			((AddressSpace.Largest.Start + AddressSpace.Largest.Length) << MMANAGER_PAGE_SHIFT) - 1,
+			AddressSpace.Largest.Length
+		);
+
+		// Share of the free pages outside of the largest free range
+		wprintf(L"Fragmentation : %.2f%%\r\n",
+			100.0 - ((AddressSpace.Largest.Length * 100.0) / AddressSpace.FreePages)
+		);
+	}
+	wprintf(L"\r\n");
+
+	// Histogram of the free ranges per size
+	wprintf(L"Free range         Ranges        Pages\r\n");
+	wprintf(L"----------         ------        -----\r\n");
+	for (ULONG cx = 0x00; cx < MMANAGER_GAP_BUCKET_COUNT; cx++) {
+		if (AddressSpace.Gaps[cx].NumberOfGaps == 0x00)
+			continue;
+		wprintf(L"%-16s %8d %12I64x\r\n",
+			GapBucketNames[cx],
+			AddressSpace.Gaps[cx].NumberOfGaps,
+			AddressSpace.Gaps[cx].NumberOfPages
+		);
+	}
+	wprintf(L"\r\n");
+
+	// VAD density per 1 GB region
+	wprintf(L"Region                            VADs\r\n");
+	wprintf(L"------                            ----\r\n");
+	for (CONST MMANAGER_REGION_STATS& Region : AddressSpace.Regions) {
+		wprintf(L"0x%012I64x-0x%012I64x %5d\r\n",
+			Region.Region << (MMANAGER_REGION_SHIFT + MMANAGER_PAGE_SHIFT),
+			((Region.Region + 1) << (MMANAGER_REGION_SHIFT + MMANAGER_PAGE_SHIFT)) - 1,
+			Region.NumberOfNodes
+		);
+	}
 	wprintf(L"\r\n");
+}
+
+
+/// <summary>
+/// Account for a free range of the user address space.
+/// </summary>
+static VOID AddAddressSpaceGap(
+	_Inout_ MMANAGER_ADDRESS_SPACE_STATS& Stats,
+	_In_    ULONG64                       Start,
+	_In_    ULONG64                       Length
+) {
+	if (Length == 0x00)
+		return;
+
+	// Buckets by powers of 16 from 64 KB, i.e. 16 pages
+	ULONG   Bucket = 0x00;
+	ULONG64 Pages  = Length >> 0x04;
+	while (Pages != 0x00 && Bucket < (MMANAGER_GAP_BUCKET_COUNT - 1)) {
+		Bucket++;
+		Pages >>= 0x04;
+	}
+	Stats.Gaps[Bucket].NumberOfGaps++;
+	Stats.Gaps[Bucket].NumberOfPages += Length;
+
+	Stats.FreePages += Length;
+	Stats.NumberOfGaps++;
+	if (Length > Stats.Largest.Length) {
+		Stats.Largest.Start  = Start;
+		Stats.Largest.Length = Length;
+	}
+}
+
+
+_Use_decl_annotations_
+BOOLEAN CMManager::GetAddressSpaceStats(
+	_Out_ MMANAGER_ADDRESS_SPACE_STATS& Stats
+) {
+	Stats = MMANAGER_ADDRESS_SPACE_STATS();
+	if (this->m_ListHeader == NULL)
+		return FALSE;
+
+	// Single pass over the VADs in VPN order, the gaps are the ranges between two of them
+	ULONG64 Next = MMANAGER_LOWEST_USER_VPN;
+	for (SIZE_T Position = 0x00; Position < this->m_Index.GetNumberOfIntervals(); Position++) {
+		CONST INTERVAL& Vad = this->m_Index[Position];
+		if (Vad.End < MMANAGER_LOWEST_USER_VPN || Vad.Start > MMANAGER_HIGHEST_USER_VPN)
+			continue;
+
+		ULONG64 Start = Vad.Start > Next ? Vad.Start : Next;
+		ULONG64 End   = Vad.End < MMANAGER_HIGHEST_USER_VPN ? Vad.End : MMANAGER_HIGHEST_USER_VPN;
+		AddAddressSpaceGap(Stats, Next, Start - Next);
+		Stats.ReservedPages += End - Start + 1;
+		Next = End + 1;
+
+		// VADs are counted in the region of their first page
+		ULONG64 Region = Start >> MMANAGER_REGION_SHIFT;
+		if (Stats.Regions.empty() || Stats.Regions.back().Region != Region)
+			Stats.Regions.push_back({ Region, 0x00 });
+		Stats.Regions.back().NumberOfNodes++;
+	}
+	AddAddressSpaceGap(Stats, Next, (MMANAGER_HIGHEST_USER_VPN + 1) - Next);
+	return TRUE;
+}
+
+
+_Use_decl_annotations_
+BOOLEAN CMManager::ArchiveProcessVads(
+	_In_z_ CONST CHAR* Path
+) {
+	if (this->m_ListHeader == NULL)
+		return FALSE;
+
+	ARCHIVE_SNAPSHOT Snapshot = { 0x00 };
+	Snapshot.Timestamp = (ULONG64)time(NULL);
+	Snapshot.Eprocess  = (ULONG64)this->m_ListHeader->Eprocess;
+	Snapshot.ProcessId = this->m_ProcessId;
+
+	// File names are already interned by the driver
+	for (PMMANAGER_VADLIST_FILE File : this->m_Files)
+		Snapshot.Files.emplace_back((CONST WCHAR*)File->FileName, File->FileNameSize / sizeof(WCHAR));
+
+	PMMANAGER_VADLIST_ENTRY Entry = this->m_ListHeader->First;
+	do {
+		ARCHIVE_ENTRY Archived = { 0x00 };
+		Archived.VadAddress      = (ULONG64)Entry->VadAddress;
+		Archived.Level           = Entry->Level;
+		Archived.VpnStarting     = Entry->VpnStarting;
+		Archived.VpnEnding       = Entry->VpnEnding;
+		Archived.CommitCharge    = Entry->CommitCharge;
+		Archived.CommitPageCount = Entry->CommitPageCount;
+		Archived.ValidPages      = Entry->ValidPages;
+		Archived.TransitionPages = Entry->TransitionPages;
+		Archived.PagedOutPages   = Entry->PagedOutPages;
+		Archived.PrototypePages  = Entry->PrototypePages;
+		Archived.DemandZeroPages = Entry->DemandZeroPages;
+		Archived.LongVadFlags    = Entry->LongVadFlags;
+		Archived.LongVadFlags1   = Entry->LongVadFlags1;
+		Archived.LongVadFlags2   = Entry->LongVadFlags2;
+		Archived.FileIndex       = Entry->FileIndex < this->m_Files.size() ? Entry->FileIndex : ARCHIVE_NO_FILE;
+		Snapshot.Entries.push_back(Archived);
+	} while (Entry = Entry->List.Flink);
+
+	return CVadArchive::Append(Path, Snapshot);
 }
\ No newline at end of file
@@ -15,6 +15,11 @@ User mode interface to query VAD list of a process.
 
 #include <Windows.h>
 #include <winioctl.h>
+#include <vector>
+
+#include "archive.h"
+#include "formatter.h"
+#include "interval.h"
 
 // Query the VAD tree of a process
 #define IOCTL_MMANAGER_FIND_PROCESS_VADS CTL_CODE( \
@@ -57,6 +62,26 @@ User mode interface to query VAD list of a process.
 #define MM_PROTECTION_OPERATION_MASK 7 // mask off guard page and nocache.
 #define MM_PROTECTION_EXECUTE_MASK   2
 
+// Number of entries in the MI_VAD_TYPE histogram.
+#define MMANAGER_VAD_TYPE_COUNT   8
+
+// Number of entries in the protection histogram.
+#define MMANAGER_PROTECTION_COUNT 0x20
+
+// Index of the mapped file of VADs not mapping a file.
+#define MMANAGER_NO_FILE (ULONG)-1
+
+// Size of a page and range of user mode VPNs, from 64 KB to MM_HIGHEST_USER_ADDRESS.
+#define MMANAGER_PAGE_SHIFT        12
+#define MMANAGER_LOWEST_USER_VPN   (ULONG64)0x10
+#define MMANAGER_HIGHEST_USER_VPN  (ULONG64)0x7FFFFFFEF
+
+// Number of buckets of the free gap histogram, by powers of 16 from 64 KB.
+#define MMANAGER_GAP_BUCKET_COUNT  8
+
+// Regions of the VAD density, 1 GB in pages.
+#define MMANAGER_REGION_SHIFT      18
+
 typedef enum _MI_VAD_TYPE {
 	VadNone,
 	VadDevicePhysicalMemory,
@@ -159,7 +184,7 @@ typedef struct _MMANAGER_VADLIST_ENTRY {
 		struct _MMANAGER_VADLIST_ENTRY* Blink;
 	} List;
 
-	ULONG64 Size;            // Size of the entry (structure + PWCHAR if filename)
+	ULONG64 Size;            // Size of the entry
 
 	PVOID   VadAddress;      // Address of the VAD node
 	ULONG   Level;           // Node depth level
@@ -167,6 +192,11 @@ typedef struct _MMANAGER_VADLIST_ENTRY {
 	ULONG64 VpnEnding;       // Start of Virtual Page Number (VPN).
 	ULONG64 CommitCharge;    // Number of bytes commit
 	ULONG64 CommitPageCount; // Number of pages commited
+	ULONG64 ValidPages;      // Number of pages resident
+	ULONG64 TransitionPages; // Number of pages on the standby or modified list
+	ULONG64 PagedOutPages;   // Number of pages in a paging file
+	ULONG64 PrototypePages;  // Number of pages resolved via a prototype PTE
+	ULONG64 DemandZeroPages; // Number of pages never touched or demand zero
 
 	// First set of flags.
 	union {
@@ -187,10 +217,44 @@ typedef struct _MMANAGER_VADLIST_ENTRY {
 		MMVAD_FLAGS2 VadFlags2;
 	};
 
-	ULONG   FileNameSize;  // Size of the filename
-	WCHAR   FileName[ANYSIZE_ARRAY]; // Pointer to the filename
+	ULONG   FileIndex;       // Index of the mapped file in the file table, MMANAGER_NO_FILE if none
+	BOOLEAN PagesUnresolved; // Page tables could not be read, page counts not known
 } MMANAGER_VADLIST_ENTRY, *PMMANAGER_VADLIST_ENTRY;
 
+typedef struct _MMANAGER_VADLIST_STATS {
+	ULONG   NumberOfNodes;   // Number of VADs in the group
+	ULONG64 CommitCharge;    // Sum of the commit charge of the VADs
+	ULONG64 NumberOfPages;   // Sum of the size of the VADs, in pages
+} MMANAGER_VADLIST_STATS, *PMMANAGER_VADLIST_STATS;
+
+typedef struct _MMANAGER_VADLIST_FILE {
+	ULONG64                Size;  // Size of the entry (structure + PWCHAR), aligned on 8 bytes
+	MMANAGER_VADLIST_STATS Stats; // Aggregation of all the VADs mapping the file
+
+	ULONG   FileNameSize;            // Size of the filename
+	WCHAR   FileName[ANYSIZE_ARRAY]; // Pointer to the filename
+} MMANAGER_VADLIST_FILE, *PMMANAGER_VADLIST_FILE;
+
+typedef struct _MMANAGER_GAP_STATS {
+	ULONG   NumberOfGaps;  // Number of free ranges in the bucket
+	ULONG64 NumberOfPages; // Sum of the size of the free ranges, in pages
+} MMANAGER_GAP_STATS, *PMMANAGER_GAP_STATS;
+
+typedef struct _MMANAGER_REGION_STATS {
+	ULONG64 Region;        // Index of the 1 GB region
+	ULONG   NumberOfNodes; // Number of VADs starting in the region
+} MMANAGER_REGION_STATS, *PMMANAGER_REGION_STATS;
+
+typedef struct _MMANAGER_ADDRESS_SPACE_STATS {
+	ULONG64      ReservedPages; // Pages of the user address space described by a VAD
+	ULONG64      FreePages;     // Pages of the user address space not described by any VAD
+	ULONG        NumberOfGaps;  // Number of free ranges
+	INTERVAL_GAP Largest;       // Largest free range, the lowest one on ties
+
+	MMANAGER_GAP_STATS                 Gaps[MMANAGER_GAP_BUCKET_COUNT]; // Free ranges per size
+	std::vector<MMANAGER_REGION_STATS> Regions;                         // Non-empty regions, ascending
+} MMANAGER_ADDRESS_SPACE_STATS, *PMMANAGER_ADDRESS_SPACE_STATS;
+
 typedef struct _MMANAGER_VADLIST_HEADER {
 	ULONG64           Size;               // Size of the data (header + all entries)
 	ULONG             MaximumLevel;       // Deepest level
@@ -201,6 +265,14 @@ typedef struct _MMANAGER_VADLIST_HEADER {
 
 	PMMANAGER_VADLIST_ENTRY First;
 	PMMANAGER_VADLIST_ENTRY Last;
+
+	MMANAGER_VADLIST_STATS VadTypes[MMANAGER_VAD_TYPE_COUNT];      // Aggregation per MI_VAD_TYPE
+	MMANAGER_VADLIST_STATS Protections[MMANAGER_PROTECTION_COUNT]; // Aggregation per protection
+
+	ULONG                  NumberOfFiles;   // Number of distinct mapped files
+	ULONG                  UnresolvedFiles; // Mapped VADs whose file could not be tracked
+	ULONG                  UnresolvedPages; // VADs whose page tables could not be read
+	PMMANAGER_VADLIST_FILE FirstFile;     // First file of the table, in index order and Size bytes apart
 } MMANAGER_VADLIST_HEADER, *PMMANAGER_VADLIST_HEADER;
 
 class CMManager {
@@ -217,7 +289,32 @@ public:
 		_In_ CONST ULONG ProcessId
 	);
 
-	VOID PrintProcessVads();
+	/// <summary>
+	/// Print the VADs overlapping [FirstAddress, LastAddress], all of them by default.
+	/// </summary>
+	VOID PrintProcessVads(
+		_In_ FORMAT_SINK Sink         = FormatSinkText,
+		_In_ ULONG64     FirstAddress = 0x00,
+		_In_ ULONG64     LastAddress  = (ULONG64)-1
+	);
+
+	VOID PrintProcessSummary();
+
+	/// <summary>
+	/// Free ranges and VAD density of the user address space, in one pass over the VPN index.
+	/// </summary>
+	_Must_inspect_result_
+	BOOLEAN GetAddressSpaceStats(
+		_Out_ MMANAGER_ADDRESS_SPACE_STATS& Stats
+	);
+
+	/// <summary>
+	/// Append the VAD list to a snapshot archive.
+	/// </summary>
+	_Must_inspect_result_
+	BOOLEAN ArchiveProcessVads(
+		_In_z_ CONST CHAR* Path
+	);
 
 private:
 	/// <summary>
@@ -229,6 +326,21 @@ private:
 	/// Pointer to the header of the list.
 	/// </summary>
 	PMMANAGER_VADLIST_HEADER m_ListHeader{ NULL };
+
+	/// <summary>
+	/// Mapped files of the list, by index.
+	/// </summary>
+	std::vector<PMMANAGER_VADLIST_FILE> m_Files;
+
+	/// <summary>
+	/// VADs of the list by VPN, to answer address queries without walking the list.
+	/// </summary>
+	CIntervalIndex m_Index;
+
+	/// <summary>
+	/// ID of the process of the list.
+	/// </summary>
+	ULONG m_ProcessId{ 0x00 };
 };
 
 #endif // !__MMANAGER_H_GUARD__
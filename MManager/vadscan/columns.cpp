@@ -0,0 +1,100 @@
+/*+================================================================================================
+Module Name: columns.cpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+
+Abstract:
+Column-oriented table of the VAD nodes of all the processes of a memory image.
+One vector per field, one row per VAD node. File names are stored once in a dictionary and
+referenced by index.
+
+================================================================================================+*/
+
+#include "columns.h"
+
+
+CVadColumns::CVadColumns() {
+	this->m_FileNames.push_back(std::string());
+	this->m_FileNameIndex[std::string()] = COLUMNS_NO_FILE_NAME;
+}
+
+
+_Use_decl_annotations_
+ULONG CVadColumns::InternFileName(
+	_In_ CONST std::string& FileName
+) {
+	auto Entry = this->m_FileNameIndex.find(FileName);
+	if (Entry != this->m_FileNameIndex.end())
+		return Entry->second;
+
+	ULONG Index = (ULONG)this->m_FileNames.size();
+	this->m_FileNames.push_back(FileName);
+	this->m_FileNameIndex[FileName] = Index;
+	return Index;
+}
+
+
+_Use_decl_annotations_
+VOID CVadColumns::Append(
+	_In_ CONST VADSCAN_PROCESS& Process
+) {
+	ULONG Row = (ULONG)this->m_ProcessId.size();
+	this->m_ProcessId.push_back(Process.ProcessId);
+	this->m_Eprocess.push_back(Process.Eprocess);
+	this->m_ImageFileName.push_back(Process.ImageFileName);
+
+	for (CONST VADSCAN_ENTRY& Entry : Process.Entries) {
+		this->m_Process.push_back(Row);
+		this->m_VadAddress.push_back(Entry.VadAddress);
+		this->m_Level.push_back(Entry.Level);
+		this->m_VpnStarting.push_back(Entry.VpnStarting);
+		this->m_VpnEnding.push_back(Entry.VpnEnding);
+		this->m_CommitCharge.push_back(Entry.CommitCharge);
+		this->m_ValidPages.push_back(Entry.Pages.ValidPages);
+		this->m_TransitionPages.push_back(Entry.Pages.TransitionPages);
+		this->m_PagedOutPages.push_back(Entry.Pages.PagedOutPages);
+		this->m_PrototypePages.push_back(Entry.Pages.PrototypePages);
+		this->m_DemandZeroPages.push_back(Entry.Pages.DemandZeroPages);
+		this->m_VadFlags.push_back(Entry.LongVadFlags);
+		this->m_VadFlags1.push_back(Entry.LongVadFlags1);
+		this->m_VadFlags2.push_back(Entry.LongVadFlags2);
+		this->m_ControlArea.push_back(Entry.ControlArea);
+		this->m_FileName.push_back(this->InternFileName(Entry.FileName));
+	}
+}
+
+
+_Use_decl_annotations_
+BOOLEAN CVadColumns::Write(
+	_In_ FILE* File
+) const {
+	fprintf(File, "pid\tprocess\teprocess\tvad\tlevel\tvpn_start\tvpn_end\tcommit\tvalid\ttransition\tpaged_out\tprototype\tdemand_zero\tflags\tflags1\tflags2\tcontrol_area\tfile\n");
+
+	for (SIZE_T cx = 0x00; cx < this->m_VadAddress.size(); cx++) {
+		ULONG Process = this->m_Process[cx];
+
+		fprintf(File, "%llu\t%s\t0x%llx\t0x%llx\t%u\t0x%llx\t0x%llx\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu\t0x%08x\t0x%08x\t0x%08x\t0x%llx\t%s\n",
+			(unsigned long long)this->m_ProcessId[Process],
+			this->m_ImageFileName[Process].c_str(),
+			(unsigned long long)this->m_Eprocess[Process],
+			(unsigned long long)this->m_VadAddress[cx],
+			this->m_Level[cx],
+			(unsigned long long)this->m_VpnStarting[cx],
+			(unsigned long long)this->m_VpnEnding[cx],
+			(unsigned long long)this->m_CommitCharge[cx],
+			(unsigned long long)this->m_ValidPages[cx],
+			(unsigned long long)this->m_TransitionPages[cx],
+			(unsigned long long)this->m_PagedOutPages[cx],
+			(unsigned long long)this->m_PrototypePages[cx],
+			(unsigned long long)this->m_DemandZeroPages[cx],
+			this->m_VadFlags[cx],
+			this->m_VadFlags1[cx],
+			this->m_VadFlags2[cx],
+			(unsigned long long)this->m_ControlArea[cx],
+			this->m_FileNames[this->m_FileName[cx]].c_str()
+		);
+	}
+	return ferror(File) == 0x00;
+}
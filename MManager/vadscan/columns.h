@@ -0,0 +1,85 @@
+/*+================================================================================================
+Module Name: columns.h
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+
+Abstract:
+Column-oriented table of the VAD nodes of all the processes of a memory image.
+One vector per field, one row per VAD node. File names are stored once in a dictionary and
+referenced by index.
+
+================================================================================================+*/
+
+#ifndef __VADSCAN_COLUMNS_H_GUARD__
+#define __VADSCAN_COLUMNS_H_GUARD__
+
+#include <stdio.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../../kshim/kshim.h"
+#include "vadscan.h"
+
+// Index of the empty file name in the dictionary.
+#define COLUMNS_NO_FILE_NAME 0x00
+
+class CVadColumns {
+
+public:
+	CVadColumns();
+
+	/// <summary>
+	/// Append all the VAD nodes of a process.
+	/// </summary>
+	VOID Append(
+		_In_ CONST VADSCAN_PROCESS& Process
+	);
+
+	/// <summary>
+	/// Write the table as tab-separated values with a header line.
+	/// </summary>
+	_Must_inspect_result_
+	BOOLEAN Write(
+		_In_ FILE* File
+	) const;
+
+	SIZE_T GetNumberOfRows() const { return this->m_VadAddress.size(); }
+
+private:
+	_Must_inspect_result_
+	ULONG InternFileName(
+		_In_ CONST std::string& FileName
+	);
+
+	// Process columns, one row per process
+	std::vector<ULONG64>     m_ProcessId;
+	std::vector<ULONG64>     m_Eprocess;
+	std::vector<std::string> m_ImageFileName;
+
+	// VAD columns, one row per VAD node
+	std::vector<ULONG>   m_Process;       // Row of the process
+	std::vector<ULONG64> m_VadAddress;
+	std::vector<ULONG>   m_Level;
+	std::vector<ULONG64> m_VpnStarting;
+	std::vector<ULONG64> m_VpnEnding;
+	std::vector<ULONG64> m_CommitCharge;
+	std::vector<ULONG64> m_ValidPages;
+	std::vector<ULONG64> m_TransitionPages;
+	std::vector<ULONG64> m_PagedOutPages;
+	std::vector<ULONG64> m_PrototypePages;
+	std::vector<ULONG64> m_DemandZeroPages;
+	std::vector<ULONG>   m_VadFlags;
+	std::vector<ULONG>   m_VadFlags1;
+	std::vector<ULONG>   m_VadFlags2;
+	std::vector<ULONG64> m_ControlArea;
+	std::vector<ULONG>   m_FileName;      // Index in the dictionary
+
+	// Dictionary of the file names
+	std::vector<std::string>               m_FileNames;
+	std::unordered_map<std::string, ULONG> m_FileNameIndex;
+};
+
+#endif // !__VADSCAN_COLUMNS_H_GUARD__
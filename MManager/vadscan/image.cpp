@@ -0,0 +1,307 @@
+/*+================================================================================================
+Module Name: image.cpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+
+Abstract:
+Read-only mapping of a physical memory image.
+Supported formats are raw images (file offset is the physical address) and 64-bit complete or
+bitmap crash dumps.
+
+================================================================================================+*/
+
+#include <string.h>
+#include <algorithm>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif // !_WIN32
+
+#include "image.h"
+
+/// <summary>
+/// Number of bits set in a 64-bit word, without relying on the POPCNT instruction.
+/// </summary>
+static inline ULONG64 PopCount64(
+	_In_ ULONG64 Value
+) {
+	Value = Value - ((Value >> 1) & 0x5555555555555555);
+	Value = (Value & 0x3333333333333333) + ((Value >> 2) & 0x3333333333333333);
+	Value = (Value + (Value >> 4)) & 0x0F0F0F0F0F0F0F0F;
+	return (Value * 0x0101010101010101) >> 56;
+}
+
+
+CMemoryImage::CMemoryImage() {
+}
+
+
+CMemoryImage::~CMemoryImage() {
+	this->Close();
+}
+
+
+_Use_decl_annotations_
+BOOLEAN CMemoryImage::Open(
+	_In_z_ CONST char* Path
+) {
+	this->Close();
+
+#ifdef _WIN32
+	this->m_FileHandle = ::CreateFileA(
+		Path,
+		GENERIC_READ,
+		FILE_SHARE_READ,
+		NULL,
+		OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL,
+		NULL
+	);
+	if (this->m_FileHandle == INVALID_HANDLE_VALUE)
+		return FALSE;
+
+	LARGE_INTEGER FileSize = { 0x00 };
+	if (!::GetFileSizeEx(this->m_FileHandle, &FileSize) || FileSize.QuadPart == 0x00) {
+		this->Close();
+		return FALSE;
+	}
+	this->m_Size = (ULONG64)FileSize.QuadPart;
+
+	this->m_MappingHandle = ::CreateFileMappingW(this->m_FileHandle, NULL, PAGE_READONLY, 0x00, 0x00, NULL);
+	if (this->m_MappingHandle == NULL) {
+		this->Close();
+		return FALSE;
+	}
+	this->m_Base = (CONST UCHAR*)::MapViewOfFile(this->m_MappingHandle, FILE_MAP_READ, 0x00, 0x00, 0x00);
+#else
+	this->m_FileDescriptor = ::open(Path, O_RDONLY);
+	if (this->m_FileDescriptor == -1)
+		return FALSE;
+
+	struct stat FileStat;
+	if (::fstat(this->m_FileDescriptor, &FileStat) != 0x00 || FileStat.st_size == 0x00) {
+		this->Close();
+		return FALSE;
+	}
+	this->m_Size = (ULONG64)FileStat.st_size;
+
+	PVOID Base = ::mmap(NULL, this->m_Size, PROT_READ, MAP_SHARED, this->m_FileDescriptor, 0x00);
+	if (Base != MAP_FAILED) {
+		this->m_Base = (CONST UCHAR*)Base;
+
+		// Page tables and pool structures are scattered, read-ahead only faults in unused pages
+		(VOID)::madvise(Base, this->m_Size, MADV_RANDOM);
+	}
+#endif // _WIN32
+	if (this->m_Base == NULL) {
+		this->Close();
+		return FALSE;
+	}
+
+	// Anything without a crash dump header is a raw image
+	if (this->m_Size >= DUMP_HEADER64_SIZE
+		&& this->ReadFileValue<ULONG>(0x00) == DUMP_SIGNATURE64
+		&& this->ReadFileValue<ULONG>(0x04) == DUMP_VALID_DUMP64) {
+		if (!this->ParseCrashDump()) {
+			this->Close();
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+
+VOID CMemoryImage::Close() {
+#ifdef _WIN32
+	if (this->m_Base != NULL)
+		::UnmapViewOfFile(this->m_Base);
+	if (this->m_MappingHandle != NULL)
+		::CloseHandle(this->m_MappingHandle);
+	if (this->m_FileHandle != INVALID_HANDLE_VALUE)
+		::CloseHandle(this->m_FileHandle);
+	this->m_MappingHandle = NULL;
+	this->m_FileHandle    = INVALID_HANDLE_VALUE;
+#else
+	if (this->m_Base != NULL)
+		::munmap((PVOID)this->m_Base, this->m_Size);
+	if (this->m_FileDescriptor != -1)
+		::close(this->m_FileDescriptor);
+	this->m_FileDescriptor = -1;
+#endif // _WIN32
+
+	this->m_Base   = NULL;
+	this->m_Size   = 0x00;
+	this->m_Format = ImageFormatRaw;
+	this->m_Runs.clear();
+	this->m_Bitmap = NULL;
+	this->m_BitmapPages     = 0x00;
+	this->m_FirstPageOffset = 0x00;
+	this->m_BitmapRank.clear();
+
+	this->m_DirectoryTableBase  = 0x00;
+	this->m_PsActiveProcessHead = 0x00;
+	this->m_PfnDataBase         = 0x00;
+}
+
+
+template<typename T>
+T CMemoryImage::ReadFileValue(
+	_In_ ULONG64 Offset
+) const {
+	T Value{};
+	if (Offset + sizeof(T) <= this->m_Size)
+		::memcpy(&Value, this->m_Base + Offset, sizeof(T));
+	return Value;
+}
+
+
+_Use_decl_annotations_
+BOOLEAN CMemoryImage::ParseCrashDump() {
+	this->m_DirectoryTableBase  = this->ReadFileValue<ULONG64>(DUMP_HEADER64_DIRECTORY_TABLE_BASE);
+	this->m_PfnDataBase         = this->ReadFileValue<ULONG64>(DUMP_HEADER64_PFN_DATABASE);
+	this->m_PsActiveProcessHead = this->ReadFileValue<ULONG64>(DUMP_HEADER64_PS_ACTIVE_PROCESS);
+
+	// Complete memory dump, pages are stored run after run following the header
+	if (this->ReadFileValue<ULONG>(DUMP_HEADER64_DUMP_TYPE) == DUMP_TYPE_FULL) {
+		ULONG   NumberOfRuns = this->ReadFileValue<ULONG>(DUMP_HEADER64_PHYSICAL_MEMORY_BLOCK);
+		ULONG64 RunOffset    = DUMP_HEADER64_PHYSICAL_MEMORY_BLOCK + 0x10;
+		ULONG64 FileOffset   = DUMP_HEADER64_SIZE;
+
+		for (ULONG cx = 0x00; cx < NumberOfRuns; cx++) {
+			if (RunOffset + 0x10 > DUMP_HEADER64_SIZE)
+				return FALSE;
+
+			IMAGE_RUN Run = { 0x00 };
+			Run.BasePage   = this->ReadFileValue<ULONG64>(RunOffset);
+			Run.PageCount  = this->ReadFileValue<ULONG64>(RunOffset + 0x08);
+			Run.FileOffset = FileOffset;
+			this->m_Runs.push_back(Run);
+
+			RunOffset  += 0x10;
+			FileOffset += Run.PageCount * PAGE_SIZE;
+		}
+
+		std::sort(this->m_Runs.begin(), this->m_Runs.end(), [](CONST IMAGE_RUN& a, CONST IMAGE_RUN& b) {
+			return a.BasePage < b.BasePage;
+		});
+		this->m_Format = ImageFormatFullDump;
+		return TRUE;
+	}
+
+	// Bitmap dump, one bit per physical page and only the pages set are stored
+	ULONG Signature = this->ReadFileValue<ULONG>(DUMP_HEADER64_SIZE);
+	if ((Signature != DUMP_SUMMARY_SIGNATURE && Signature != DUMP_FULL_SIGNATURE)
+		|| this->ReadFileValue<ULONG>(DUMP_HEADER64_SIZE + 0x04) != DUMP_VALID_SUMMARY)
+		return FALSE;
+
+	this->m_FirstPageOffset = this->ReadFileValue<ULONG64>(DUMP_HEADER64_SIZE + SUMMARY_DUMP64_FIRST_PAGE);
+	this->m_BitmapPages     = this->ReadFileValue<ULONG64>(DUMP_HEADER64_SIZE + SUMMARY_DUMP64_PAGES);
+
+	ULONG64 BitmapOffset = DUMP_HEADER64_SIZE + SUMMARY_DUMP64_BITMAP;
+	ULONG64 NumberOfWords = (this->m_BitmapPages + 63) / 64;
+	if (BitmapOffset + (NumberOfWords * sizeof(ULONG64)) > this->m_Size)
+		return FALSE;
+	this->m_Bitmap = (CONST ULONG64*)(this->m_Base + BitmapOffset);
+
+	// Number of pages stored before each word of the bitmap
+	this->m_BitmapRank.resize(NumberOfWords);
+	ULONG64 Rank = 0x00;
+	for (ULONG64 cx = 0x00; cx < NumberOfWords; cx++) {
+		this->m_BitmapRank[cx] = Rank;
+		Rank += PopCount64(this->m_Bitmap[cx]);
+	}
+
+	this->m_Format = ImageFormatBitmapDump;
+	return TRUE;
+}
+
+
+_Use_decl_annotations_
+CONST UCHAR* CMemoryImage::GetPhysicalPage(
+	_In_ ULONG64 PageFrameNumber
+) const {
+	ULONG64 FileOffset = 0x00;
+
+	switch (this->m_Format) {
+	case ImageFormatRaw:
+		FileOffset = PageFrameNumber * PAGE_SIZE;
+		break;
+
+	case ImageFormatFullDump: {
+		// Last run starting at or before the page
+		auto Run = std::upper_bound(this->m_Runs.begin(), this->m_Runs.end(), PageFrameNumber, [](ULONG64 Pfn, CONST IMAGE_RUN& Run) {
+			return Pfn < Run.BasePage;
+		});
+		if (Run == this->m_Runs.begin())
+			return NULL;
+		Run--;
+		if (PageFrameNumber - Run->BasePage >= Run->PageCount)
+			return NULL;
+		FileOffset = Run->FileOffset + ((PageFrameNumber - Run->BasePage) * PAGE_SIZE);
+		break;
+	}
+
+	case ImageFormatBitmapDump: {
+		if (PageFrameNumber >= this->m_BitmapPages)
+			return NULL;
+
+		ULONG64 Word = this->m_Bitmap[PageFrameNumber / 64];
+		ULONG64 Bit  = (ULONG64)1 << (PageFrameNumber % 64);
+		if ((Word & Bit) == 0x00)
+			return NULL;
+
+		ULONG64 Rank = this->m_BitmapRank[PageFrameNumber / 64] + PopCount64(Word & (Bit - 1));
+		FileOffset = this->m_FirstPageOffset + (Rank * PAGE_SIZE);
+		break;
+	}
+	}
+
+	if (FileOffset + PAGE_SIZE > this->m_Size)
+		return NULL;
+	return this->m_Base + FileOffset;
+}
+
+
+_Use_decl_annotations_
+BOOLEAN CMemoryImage::ReadPhysical(
+	_In_ ULONG64 PhysicalAddress,
+	_Out_writes_bytes_(Size) PVOID Buffer,
+	_In_ ULONG64 Size
+) const {
+	PUCHAR Output = (PUCHAR)Buffer;
+
+	while (Size != 0x00) {
+		CONST UCHAR* Page = this->GetPhysicalPage(PhysicalAddress >> PAGE_SHIFT);
+		if (Page == NULL)
+			return FALSE;
+
+		ULONG64 Offset = PhysicalAddress & (PAGE_SIZE - 1);
+		ULONG64 Count  = std::min<ULONG64>(Size, PAGE_SIZE - Offset);
+		::memcpy(Output, Page + Offset, Count);
+
+		Output          += Count;
+		PhysicalAddress += Count;
+		Size            -= Count;
+	}
+	return TRUE;
+}
+
+
+ULONG64 CMemoryImage::GetNumberOfPages() const {
+	switch (this->m_Format) {
+	case ImageFormatFullDump:
+		if (this->m_Runs.empty())
+			return 0x00;
+		return this->m_Runs.back().BasePage + this->m_Runs.back().PageCount;
+	case ImageFormatBitmapDump:
+		return this->m_BitmapPages;
+	case ImageFormatRaw:
+	default:
+		return this->m_Size / PAGE_SIZE;
+	}
+}
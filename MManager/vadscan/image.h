@@ -0,0 +1,144 @@
+/*+================================================================================================
+Module Name: image.h
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+
+Abstract:
+Read-only mapping of a physical memory image.
+Supported formats are raw images (file offset is the physical address) and 64-bit complete or
+bitmap crash dumps.
+
+================================================================================================+*/
+
+#ifndef __VADSCAN_IMAGE_H_GUARD__
+#define __VADSCAN_IMAGE_H_GUARD__
+
+#include <vector>
+#include "../../kshim/kshim.h"
+
+// Signatures of the crash dump headers.
+#define DUMP_SIGNATURE64         (ULONG)0x45474150 // "PAGE"
+#define DUMP_VALID_DUMP64        (ULONG)0x34365544 // "DU64"
+#define DUMP_SUMMARY_SIGNATURE   (ULONG)0x504d4453 // "SDMP"
+#define DUMP_FULL_SIGNATURE      (ULONG)0x504d4446 // "FDMP"
+#define DUMP_VALID_SUMMARY       (ULONG)0x504d5544 // "DUMP"
+
+// Fields of the DUMP_HEADER64 structure.
+#define DUMP_HEADER64_DIRECTORY_TABLE_BASE  0x0010
+#define DUMP_HEADER64_PFN_DATABASE          0x0018
+#define DUMP_HEADER64_PS_ACTIVE_PROCESS     0x0028
+#define DUMP_HEADER64_MACHINE_IMAGE_TYPE    0x0030
+#define DUMP_HEADER64_PHYSICAL_MEMORY_BLOCK 0x0088
+#define DUMP_HEADER64_DUMP_TYPE             0x0F98
+#define DUMP_HEADER64_SIZE                  0x2000
+
+// Fields of the SUMMARY_DUMP64 structure, following the DUMP_HEADER64 of bitmap dumps.
+#define SUMMARY_DUMP64_FIRST_PAGE  0x0020
+#define SUMMARY_DUMP64_PAGES       0x0030
+#define SUMMARY_DUMP64_BITMAP      0x0038
+
+// Value of DUMP_HEADER64.DumpType for a complete memory dump.
+#define DUMP_TYPE_FULL 0x01
+
+typedef enum _IMAGE_FORMAT {
+	ImageFormatRaw,
+	ImageFormatFullDump,
+	ImageFormatBitmapDump
+} IMAGE_FORMAT, * PIMAGE_FORMAT;
+
+/// <summary>
+/// Run of contiguous physical pages stored contiguously in the file.
+/// </summary>
+typedef struct _IMAGE_RUN {
+	ULONG64 BasePage;   // First Page Frame Number (PFN) of the run
+	ULONG64 PageCount;  // Number of pages in the run
+	ULONG64 FileOffset; // Offset of the first page in the file
+} IMAGE_RUN, * PIMAGE_RUN;
+
+class CMemoryImage {
+
+public:
+	CMemoryImage();
+	~CMemoryImage();
+
+	_Must_inspect_result_
+	BOOLEAN Open(
+		_In_z_ CONST char* Path
+	);
+
+	VOID Close();
+
+	/// <summary>
+	/// Pointer to the content of a physical page, or NULL if the page is not in the image.
+	/// </summary>
+	_Must_inspect_result_
+	CONST UCHAR* GetPhysicalPage(
+		_In_ ULONG64 PageFrameNumber
+	) const;
+
+	_Must_inspect_result_
+	BOOLEAN ReadPhysical(
+		_In_ ULONG64 PhysicalAddress,
+		_Out_writes_bytes_(Size) PVOID Buffer,
+		_In_ ULONG64 Size
+	) const;
+
+	IMAGE_FORMAT GetFormat() const { return this->m_Format; }
+
+	/// <summary>
+	/// Number of physical pages described by the image, including the pages not stored.
+	/// </summary>
+	ULONG64 GetNumberOfPages() const;
+
+	/// <summary>
+	/// Values taken from the crash dump header, zero for raw images.
+	/// </summary>
+	ULONG64 GetDirectoryTableBase() const { return this->m_DirectoryTableBase; }
+	ULONG64 GetPsActiveProcessHead() const { return this->m_PsActiveProcessHead; }
+	ULONG64 GetPfnDataBase() const { return this->m_PfnDataBase; }
+
+private:
+	_Must_inspect_result_
+	BOOLEAN ParseCrashDump();
+
+	template<typename T>
+	T ReadFileValue(
+		_In_ ULONG64 Offset
+	) const;
+
+	/// <summary>
+	/// Base address and size of the mapping of the file.
+	/// </summary>
+	CONST UCHAR* m_Base{ NULL };
+	ULONG64      m_Size{ 0x00 };
+
+#ifdef _WIN32
+	HANDLE m_FileHandle{ INVALID_HANDLE_VALUE };
+	HANDLE m_MappingHandle{ NULL };
+#else
+	int    m_FileDescriptor{ -1 };
+#endif // _WIN32
+
+	IMAGE_FORMAT m_Format{ ImageFormatRaw };
+
+	/// <summary>
+	/// Runs of physical pages of a complete dump, sorted by PFN.
+	/// </summary>
+	std::vector<IMAGE_RUN> m_Runs;
+
+	/// <summary>
+	/// Bitmap of the physical pages of a bitmap dump, and number of bits set before each word.
+	/// </summary>
+	CONST ULONG64*       m_Bitmap{ NULL };
+	ULONG64              m_BitmapPages{ 0x00 };
+	ULONG64              m_FirstPageOffset{ 0x00 };
+	std::vector<ULONG64> m_BitmapRank;
+
+	ULONG64 m_DirectoryTableBase{ 0x00 };
+	ULONG64 m_PsActiveProcessHead{ 0x00 };
+	ULONG64 m_PfnDataBase{ 0x00 };
+};
+
+#endif // !__VADSCAN_IMAGE_H_GUARD__
@@ -0,0 +1,326 @@
+/*+================================================================================================
+Module Name: main.cpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+
+Abstract:
+Console application entry point.
+
+================================================================================================+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <memory>
+#include <thread>
+
+#include "columns.h"
+#include "pfnscan.h"
+#include "scheduler.h"
+#include "vadscan.h"
+
+// State of the scan of a process.
+#define VADSCAN_STATUS_SKIPPED 0x00
+#define VADSCAN_STATUS_SCANNED 0x01
+#define VADSCAN_STATUS_FAILED  0x02
+
+// Protection names, indexed by MM_PROTECTION_OPERATION_MASK bits.
+static CONST char* ProtectionNames[0x08] = {
+	"",
+	"READONLY",
+	"EXECUTE",
+	"EXECUTE_READ",
+	"READWRITE",
+	"WRITECOPY",
+	"EXECUTE_READWRITE",
+	"EXECUTE_WRITECOPY"
+};
+
+// Protection modifiers, indexed by the NOCACHE and GUARD_PAGE bits.
+static CONST char* ProtectionModifiers[0x04] = {
+	"",
+	"NOCACHE",
+	"GUARD_PAGE",
+	"NO_ACCESS"
+};
+
+// VAD type names, indexed by MI_VAD_TYPE.
+static CONST char* VadTypeNames[0x08] = {
+	"",
+	"Phys",
+	"Exe",
+	"AWE",
+	"WrtWatch",
+	"LargePag",
+	"Rotate",
+	"LargePagSec"
+};
+
+static VOID PrintProcessVads(
+	_In_ CONST VADSCAN_PROCESS& Process
+) {
+	printf("Process      : %s (%llu)\n", Process.ImageFileName.c_str(), (unsigned long long)Process.ProcessId);
+	printf("EPROCESS     : 0x%016llx\n", (unsigned long long)Process.Eprocess);
+	printf("DTB          : 0x%016llx\n\n", (unsigned long long)Process.DirectoryTableBase);
+
+	// Header of the table
+	printf("VAD                Level  VPN Start    VPN End  Commit    Valid     Trans  Type         Protection         Pagefile/Image\n");
+	printf("---                -----  ---------    -------  ------    -----     -----  ----         ----------         --------------\n");
+	for (CONST VADSCAN_ENTRY& Entry : Process.Entries) {
+		ULONG Protection = MMVAD_FLAGS_PROTECTION(Entry.LongVadFlags);
+
+		printf("0x%016llx %5u  %9llx  %9llx  %-8llu  %-8llu  %-5llu  %s %-12s %-18s %-11s %s\n",
+			(unsigned long long)Entry.VadAddress,
+			Entry.Level,
+			(unsigned long long)Entry.VpnStarting,
+			(unsigned long long)Entry.VpnEnding,
+			(unsigned long long)Entry.CommitCharge,
+			(unsigned long long)Entry.Pages.ValidPages,
+			(unsigned long long)Entry.Pages.TransitionPages,
+			MMVAD_FLAGS_PRIVATE_MEMORY(Entry.LongVadFlags) ? "Private" : "Mapped ",
+			VadTypeNames[MMVAD_FLAGS_VAD_TYPE(Entry.LongVadFlags)],
+			ProtectionNames[Protection & 0x07],
+			ProtectionModifiers[Protection >> 0x03],
+			Entry.FileName.c_str()
+		);
+	}
+
+	printf("\n");
+	printf("Total VADs   : %zu\n", Process.Entries.size());
+	printf("Maximum depth: %u\n", Process.MaximumLevel);
+	if (Process.Truncated)
+		printf("Warning      : part of the VAD tree could not be read from the image\n");
+	printf("\n");
+}
+
+static VOID PrintPfnCounters(
+	_In_ CONST char*           Name,
+	_In_ CONST XPFN_COUNTERS& Counters
+) {
+	printf("%-24s %12llu %12llu %12llu %12llu %12llu %12llu\n",
+		Name,
+		(unsigned long long)Counters.Pages[XPfnListActive],
+		(unsigned long long)Counters.Pages[XPfnListStandby],
+		(unsigned long long)Counters.Pages[XPfnListModified],
+		(unsigned long long)Counters.Pages[XPfnListModifiedNoWrite],
+		(unsigned long long)Counters.Pages[XPfnListTransition],
+		(unsigned long long)(Counters.Pages[XPfnListZeroed] + Counters.Pages[XPfnListFree])
+	);
+}
+
+static VOID PrintPfnDatabase(
+	_In_ CONST CVadScanner&          Scanner,
+	_In_ CONST std::vector<ULONG64>& Processes,
+	_In_ CPfnScanner&                PfnScanner
+) {
+	PXPFN_SCAN Result = PfnScanner.GetResult();
+
+	printf("Pages                          Active      Standby     Modified   ModNoWrite   Transition    Zero/Free\n");
+	printf("-----                          ------      -------     --------   ----------   ----------    ---------\n");
+	PrintPfnCounters("Total", Result->Total);
+	PrintPfnCounters("Shared (prototype)", Result->Shared);
+	PrintPfnCounters("Private", Result->Private);
+	PrintPfnCounters("Private, no owner", Result->Unattributed);
+	printf("\n");
+
+	// Private pages of each process
+	printf("Process                        Active      Standby     Modified   ModNoWrite   Transition\n");
+	printf("-------                        ------      -------     --------   ----------   ----------\n");
+	for (ULONG64 Address : Processes) {
+		VADSCAN_PROCESS Process;
+		if (!Scanner.ReadProcessInformation(Address, Process))
+			continue;
+
+		PXPFN_OWNER Owner = XMiFindPfnOwner(Result, Process.DirectoryTableBase);
+		if (Owner == NULL)
+			continue;
+
+		char Name[0x20] = { 0x00 };
+		snprintf(Name, sizeof(Name), "%s (%llu)", Process.ImageFileName.c_str(), (unsigned long long)Process.ProcessId);
+		printf("%-24s %12llu %12llu %12llu %12llu %12llu\n",
+			Name,
+			(unsigned long long)Owner->Counters.Pages[XPfnListActive],
+			(unsigned long long)Owner->Counters.Pages[XPfnListStandby],
+			(unsigned long long)Owner->Counters.Pages[XPfnListModified],
+			(unsigned long long)Owner->Counters.Pages[XPfnListModifiedNoWrite],
+			(unsigned long long)Owner->Counters.Pages[XPfnListTransition]
+		);
+	}
+	printf("\n");
+
+	printf("Owners       : %u address spaces\n", Result->NumberOfOwners);
+	if (PfnScanner.GetNumberOfMissingEntries() != 0x00)
+		printf("Missing      : %llu PFN entries not in the image\n", (unsigned long long)PfnScanner.GetNumberOfMissingEntries());
+	printf("\n");
+}
+
+static VOID PrintUsage() {
+	printf("Usage: vadscan <image> [options]\n\n");
+	printf("  -d <address>  Kernel DirectoryTableBase, read from the header of crash dumps\n");
+	printf("  -l <address>  Virtual address of PsActiveProcessHead, read from the header of crash dumps\n");
+	printf("  -e <address>  Virtual address of a single EPROCESS to scan\n");
+	printf("  -p <pid>      Only scan the process with this ID\n");
+	printf("  -t <count>    Number of worker threads, one per core by default\n");
+	printf("  -o <file>     Write all the VAD nodes as tab-separated values instead of the listing\n");
+	printf("  -f            Scan the PFN database instead of the VAD trees\n");
+	printf("  -m <address>  Virtual address of the PFN database, read from the header of crash dumps\n\n");
+}
+
+INT32 main(
+	_In_ int         argc,
+	_In_ const char* argv[]
+) {
+	// Banner
+	printf("================================================================================================\n");
+	printf("Module Name: Offline Virtual Address Descriptor Scanner (vadscan)                                 \n");
+	printf("Author     : Paul L. (@am0nsec)                                                                 \n");
+	printf("Origin     : https://github.com/am0nsec/wkpe/                                                   \n\n");
+	printf("Tested OS  : Windows 10 (20h2) - 19044.1706                                                     \n");
+	printf("================================================================================================\n\n");
+
+	// Check for parameters
+	if (argc < 0x02) {
+		PrintUsage();
+		return EXIT_FAILURE;
+	}
+
+	ULONG64     DirectoryTableBase  = 0x00;
+	ULONG64     PsActiveProcessHead = 0x00;
+	ULONG64     Eprocess            = 0x00;
+	ULONG64     ProcessId           = 0x00;
+	ULONG       NumberOfWorkers     = std::thread::hardware_concurrency();
+	CONST char* OutputPath          = NULL;
+	ULONG64     PfnDatabase         = 0x00;
+	BOOLEAN     ScanPfnDatabase     = FALSE;
+	for (int cx = 0x02; cx < argc; cx++) {
+		if (strcmp(argv[cx], "-f") == 0x00) {
+			ScanPfnDatabase = TRUE;
+			continue;
+		}
+		if ((cx + 1) >= argc || argv[cx][0x00] != '-') {
+			PrintUsage();
+			return EXIT_FAILURE;
+		}
+
+		ULONG64 Value = strtoull(argv[cx + 1], NULL, 0x00);
+		switch (argv[cx][0x01]) {
+		case 'd': DirectoryTableBase  = Value; break;
+		case 'l': PsActiveProcessHead = Value; break;
+		case 'e': Eprocess            = Value; break;
+		case 'p': ProcessId           = Value; break;
+		case 't': NumberOfWorkers     = (ULONG)Value; break;
+		case 'o': OutputPath          = argv[cx + 1]; break;
+		case 'm': PfnDatabase         = Value; break;
+		default:
+			PrintUsage();
+			return EXIT_FAILURE;
+		}
+		cx++;
+	}
+
+	// Map the image
+	std::unique_ptr<CMemoryImage> Image = std::make_unique<CMemoryImage>();
+	if (!Image->Open(argv[0x01])) {
+		printf("Failed to open memory image.\n\n");
+		return EXIT_FAILURE;
+	}
+
+	// Crash dumps have the kernel DTB and process list head in the header
+	if (DirectoryTableBase == 0x00)
+		DirectoryTableBase = Image->GetDirectoryTableBase();
+	if (PsActiveProcessHead == 0x00)
+		PsActiveProcessHead = Image->GetPsActiveProcessHead();
+	if (DirectoryTableBase == 0x00 || (PsActiveProcessHead == 0x00 && Eprocess == 0x00)) {
+		printf("Raw images require the kernel DirectoryTableBase and either PsActiveProcessHead or an EPROCESS.\n\n");
+		return EXIT_FAILURE;
+	}
+
+	// List of processes to scan
+	CVadScanner Scanner(*Image, DirectoryTableBase);
+	std::vector<ULONG64> Processes;
+	if (Eprocess != 0x00) {
+		Processes.push_back(Eprocess);
+	}
+	else if (!Scanner.FindProcesses(PsActiveProcessHead, Processes)) {
+		printf("Failed to walk the list of processes, %zu found before the error.\n\n", Processes.size());
+		if (Processes.empty())
+			return EXIT_FAILURE;
+	}
+
+	CScheduler Scheduler(NumberOfWorkers);
+
+	// Physical pages per list and per process
+	if (ScanPfnDatabase) {
+		if (PfnDatabase == 0x00)
+			PfnDatabase = Image->GetPfnDataBase();
+		if (PfnDatabase == 0x00) {
+			printf("Raw images require the address of the PFN database.\n\n");
+			return EXIT_FAILURE;
+		}
+
+		CPfnScanner PfnScanner(*Image, DirectoryTableBase, PfnDatabase, Image->GetNumberOfPages());
+		PfnScanner.Scan(Scheduler);
+		PrintPfnDatabase(Scanner, Processes, PfnScanner);
+		return EXIT_SUCCESS;
+	}
+
+	// One scanner per worker, each with its own translation cache over the shared mapping
+	std::vector<std::unique_ptr<CVadScanner>> Scanners;
+	for (ULONG cx = 0x00; cx < Scheduler.GetNumberOfWorkers(); cx++)
+		Scanners.push_back(std::make_unique<CVadScanner>(*Image, DirectoryTableBase));
+
+	// Walk the VAD tree of each process, results are stored in the order of the process list
+	std::vector<VADSCAN_PROCESS> Results(Processes.size());
+	std::vector<UCHAR>           Status(Processes.size(), VADSCAN_STATUS_SKIPPED);
+	Scheduler.Run(Processes.size(), [&](ULONG Worker, ULONG64 Task) {
+		CVadScanner* WorkerScanner = Scanners[Worker].get();
+
+		ULONG64 Pid = 0x00;
+		if (ProcessId != 0x00 && (!WorkerScanner->ReadProcessId(Processes[Task], &Pid) || Pid != ProcessId))
+			return;
+		Status[Task] = WorkerScanner->ScanProcess(Processes[Task], Results[Task]) ? VADSCAN_STATUS_SCANNED : VADSCAN_STATUS_FAILED;
+	});
+
+	// Merge the results
+	CVadColumns Columns;
+	for (SIZE_T cx = 0x00; cx < Processes.size(); cx++) {
+		if (Status[cx] == VADSCAN_STATUS_FAILED)
+			printf("Failed to read EPROCESS 0x%016llx.\n\n", (unsigned long long)Processes[cx]);
+		if (Status[cx] != VADSCAN_STATUS_SCANNED)
+			continue;
+
+		if (OutputPath != NULL)
+			Columns.Append(Results[cx]);
+		else
+			PrintProcessVads(Results[cx]);
+	}
+
+	// Table of all the VAD nodes
+	if (OutputPath != NULL) {
+		FILE* File = fopen(OutputPath, "w");
+		if (File == NULL) {
+			printf("Failed to open %s.\n\n", OutputPath);
+			return EXIT_FAILURE;
+		}
+		BOOLEAN Success = Columns.Write(File);
+		if (fclose(File) != 0x00 || !Success) {
+			printf("Failed to write %s.\n\n", OutputPath);
+			return EXIT_FAILURE;
+		}
+		printf("VAD nodes    : %zu written to %s\n", Columns.GetNumberOfRows(), OutputPath);
+	}
+
+	TLB_STATS Stats = { 0x00 };
+	for (CONST std::unique_ptr<CVadScanner>& WorkerScanner : Scanners) {
+		Stats.TranslationHits   += WorkerScanner->GetCacheStats().TranslationHits;
+		Stats.TranslationMisses += WorkerScanner->GetCacheStats().TranslationMisses;
+		Stats.TableHits         += WorkerScanner->GetCacheStats().TableHits;
+		Stats.TableMisses       += WorkerScanner->GetCacheStats().TableMisses;
+	}
+	printf("Workers      : %u, %llu processes stolen\n", Scheduler.GetNumberOfWorkers(), (unsigned long long)Scheduler.GetNumberOfSteals());
+	printf("Translations : %llu hits, %llu misses\n", (unsigned long long)Stats.TranslationHits, (unsigned long long)Stats.TranslationMisses);
+	printf("Page tables  : %llu hits, %llu misses\n\n", (unsigned long long)Stats.TableHits, (unsigned long long)Stats.TableMisses);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,181 @@
+/*+================================================================================================
+Module Name: mmu.cpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+
+Abstract:
+Translation of x64 virtual addresses through the 4-level page tables of a memory image.
+
+================================================================================================+*/
+
+#include <algorithm>
+
+#include "mmu.h"
+#include "../MManager/mm/ptebatch.h"
+
+// Number of Virtual Page Numbers (VPNs) mapped by one entry of a given level.
+#define MMU_LEVEL_SPAN(Level) ((ULONG64)1 << (0x09 * (MMU_LEVELS - 1 - (Level))))
+
+// Index of a Virtual Page Number (VPN) in the table of a given level.
+#define MMU_LEVEL_INDEX(Vpn, Level) (ULONG)(((Vpn) >> (0x09 * (MMU_LEVELS - 1 - (Level)))) & (MMU_PTE_PER_PAGE - 1))
+
+
+CAddressSpace::CAddressSpace(
+	_In_     CONST CMemoryImage& Image,
+	_In_     ULONG64             DirectoryTableBase,
+	_In_opt_ CTranslationCache*  Cache
+) : m_Image(Image), m_DirectoryTableBase(DirectoryTableBase & MMU_PHYSICAL_MASK), m_Cache(Cache) {
+}
+
+
+_Use_decl_annotations_
+CONST ULONG64* CAddressSpace::GetTable(
+	_In_ ULONG64 PhysicalAddress
+) const {
+	if (this->m_Cache != NULL)
+		return this->m_Cache->GetTable(PhysicalAddress);
+	return (CONST ULONG64*)this->m_Image.GetPhysicalPage(PhysicalAddress >> PAGE_SHIFT);
+}
+
+
+_Use_decl_annotations_
+BOOLEAN CAddressSpace::Translate(
+	_In_  ULONG64  VirtualAddress,
+	_Out_ PULONG64 PhysicalAddress
+) const {
+	ULONG64 Vpn          = (VirtualAddress >> PAGE_SHIFT) & 0xFFFFFFFFF;
+	ULONG64 TableAddress = this->m_DirectoryTableBase;
+
+	// Recently translated page
+	ULONG64 PhysicalPage = 0x00;
+	if (this->m_Cache != NULL && this->m_Cache->Lookup(this->m_DirectoryTableBase, Vpn, &PhysicalPage)) {
+		*PhysicalAddress = PhysicalPage | (VirtualAddress & (PAGE_SIZE - 1));
+		return TRUE;
+	}
+
+	for (ULONG Level = 0x00; Level < MMU_LEVELS; Level++) {
+		CONST ULONG64* Table = this->GetTable(TableAddress);
+		if (Table == NULL)
+			return FALSE;
+		ULONG64 Entry = Table[MMU_LEVEL_INDEX(Vpn, Level)];
+
+		if ((Entry & MMU_VALID_BIT) == 0x00) {
+			// Pages on the standby or modified list still hold their content
+			if (Level == (MMU_LEVELS - 1)
+				&& (Entry & MMU_TRANSITION_BIT) != 0x00
+				&& (Entry & MMU_PROTOTYPE_BIT) == 0x00) {
+				PhysicalPage = Entry & MMU_PHYSICAL_MASK;
+				break;
+			}
+			return FALSE;
+		}
+
+		// 1GB and 2MB large pages, cached as the 4KB page of the address
+		if (Level != 0x00 && Level != (MMU_LEVELS - 1) && (Entry & MMU_LARGE_PAGE_BIT) != 0x00) {
+			ULONG64 Size = MMU_LEVEL_SPAN(Level) * PAGE_SIZE;
+			PhysicalPage = ((Entry & MMU_PHYSICAL_MASK) & ~(Size - 1)) | (VirtualAddress & (Size - 1) & ~(ULONG64)(PAGE_SIZE - 1));
+			break;
+		}
+
+		TableAddress = Entry & MMU_PHYSICAL_MASK;
+		PhysicalPage = TableAddress;
+	}
+
+	if (this->m_Cache != NULL)
+		this->m_Cache->Insert(this->m_DirectoryTableBase, Vpn, PhysicalPage);
+	*PhysicalAddress = PhysicalPage | (VirtualAddress & (PAGE_SIZE - 1));
+	return TRUE;
+}
+
+
+_Use_decl_annotations_
+BOOLEAN CAddressSpace::ReadVirtual(
+	_In_ ULONG64 VirtualAddress,
+	_Out_writes_bytes_(Size) PVOID Buffer,
+	_In_ ULONG64 Size
+) const {
+	PUCHAR Output = (PUCHAR)Buffer;
+
+	// Physical pages are not contiguous, translate each page
+	while (Size != 0x00) {
+		ULONG64 PhysicalAddress = 0x00;
+		if (!this->Translate(VirtualAddress, &PhysicalAddress))
+			return FALSE;
+
+		ULONG64 Count = std::min<ULONG64>(Size, PAGE_SIZE - (VirtualAddress & (PAGE_SIZE - 1)));
+		if (!this->m_Image.ReadPhysical(PhysicalAddress, Output, Count))
+			return FALSE;
+
+		Output         += Count;
+		VirtualAddress += Count;
+		Size           -= Count;
+	}
+	return TRUE;
+}
+
+
+_Use_decl_annotations_
+VOID CAddressSpace::ClassifyRange(
+	_In_    ULONG64         StartingVpn,
+	_In_    ULONG64         EndingVpn,
+	_Inout_ PMMU_PAGE_STATS Stats
+) const {
+	ULONG64 Vpn = StartingVpn;
+	while (Vpn <= EndingVpn) {
+		ULONG64 TableAddress = this->m_DirectoryTableBase;
+
+		for (ULONG Level = 0x00; Level < MMU_LEVELS; Level++) {
+			ULONG   Index = MMU_LEVEL_INDEX(Vpn, Level);
+			ULONG64 Span  = MMU_LEVEL_SPAN(Level);
+
+			// Number of pages left in the range and mapped by this entry
+			ULONG64 Count = Span - (Vpn & (Span - 1));
+			if (Count > (EndingVpn - Vpn) + 1)
+				Count = (EndingVpn - Vpn) + 1;
+
+			// Page table not in the image, nothing can be said about the pages
+			CONST ULONG64* Table = this->GetTable(TableAddress);
+			if (Table == NULL) {
+				Stats->PagedOutPages += Count;
+				Vpn += Count;
+				break;
+			}
+
+			// Leaf entries, classify the whole run within the page table
+			if (Level == (MMU_LEVELS - 1)) {
+				XPTE_BATCH Batch = { 0x00 };
+				XMiClassifyPteBatch(&Table[Index], Count, &Batch);
+
+				Stats->ValidPages      += Batch.Count[XPteStateValid];
+				Stats->TransitionPages += Batch.Count[XPteStateTransition];
+				Stats->PagedOutPages   += Batch.Count[XPteStatePagedOut];
+				Stats->PrototypePages  += Batch.Count[XPteStatePrototype];
+				Stats->DemandZeroPages += Batch.Count[XPteStateDemandZero];
+				Vpn += Count;
+				break;
+			}
+
+			// Skip the whole range mapped by an empty or non-resident upper level entry
+			ULONG64 Entry = Table[Index];
+			if ((Entry & MMU_VALID_BIT) == 0x00) {
+				if (Entry == 0x00)
+					Stats->DemandZeroPages += Count;
+				else
+					Stats->PagedOutPages += Count;
+				Vpn += Count;
+				break;
+			}
+
+			// 1GB and 2MB large pages
+			if (Level != 0x00 && (Entry & MMU_LARGE_PAGE_BIT) != 0x00) {
+				Stats->ValidPages += Count;
+				Vpn += Count;
+				break;
+			}
+
+			TableAddress = Entry & MMU_PHYSICAL_MASK;
+		}
+	}
+}
@@ -0,0 +1,102 @@
+/*+================================================================================================
+Module Name: mmu.h
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+
+Abstract:
+Translation of x64 virtual addresses through the 4-level page tables of a memory image.
+
+================================================================================================+*/
+
+#ifndef __VADSCAN_MMU_H_GUARD__
+#define __VADSCAN_MMU_H_GUARD__
+
+#include "../../kshim/kshim.h"
+#include "image.h"
+#include "tlb.h"
+
+// Bits of the hardware PTE used for the translation.
+#define MMU_VALID_BIT      (ULONG64)0x0000000000000001
+#define MMU_LARGE_PAGE_BIT (ULONG64)0x0000000000000080
+#define MMU_PROTOTYPE_BIT  (ULONG64)0x0000000000000400
+#define MMU_TRANSITION_BIT (ULONG64)0x0000000000000800
+#define MMU_PHYSICAL_MASK  (ULONG64)0x000FFFFFFFFFF000
+
+#define MMU_LEVELS        4
+#define MMU_PTE_PER_PAGE  0x200
+
+/// <summary>
+/// Residency of the pages of a range of Virtual Page Numbers (VPNs).
+/// </summary>
+typedef struct _MMU_PAGE_STATS {
+	ULONG64 ValidPages;      // Resident in the working set
+	ULONG64 TransitionPages; // On the standby or modified list
+	ULONG64 PagedOutPages;   // In a paging file, or page table not resident
+	ULONG64 PrototypePages;  // Resolved via a prototype PTE
+	ULONG64 DemandZeroPages; // Never touched or demand zero
+} MMU_PAGE_STATS, * PMMU_PAGE_STATS;
+
+class CAddressSpace {
+
+public:
+	CAddressSpace(
+		_In_     CONST CMemoryImage& Image,
+		_In_     ULONG64             DirectoryTableBase,
+		_In_opt_ CTranslationCache*  Cache = NULL
+	);
+
+	_Must_inspect_result_
+	BOOLEAN Translate(
+		_In_  ULONG64  VirtualAddress,
+		_Out_ PULONG64 PhysicalAddress
+	) const;
+
+	_Must_inspect_result_
+	BOOLEAN ReadVirtual(
+		_In_ ULONG64 VirtualAddress,
+		_Out_writes_bytes_(Size) PVOID Buffer,
+		_In_ ULONG64 Size
+	) const;
+
+	template<typename T>
+	_Must_inspect_result_
+	BOOLEAN Read(
+		_In_  ULONG64 VirtualAddress,
+		_Out_ T*      Value
+	) const {
+		return this->ReadVirtual(VirtualAddress, Value, sizeof(T));
+	}
+
+	/// <summary>
+	/// Classify the pages of a range of VPNs from the content of the page tables.
+	/// </summary>
+	VOID ClassifyRange(
+		_In_    ULONG64         StartingVpn,
+		_In_    ULONG64         EndingVpn,
+		_Inout_ PMMU_PAGE_STATS Stats
+	) const;
+
+	ULONG64 GetDirectoryTableBase() const { return this->m_DirectoryTableBase; }
+
+private:
+	_Must_inspect_result_
+	CONST ULONG64* GetTable(
+		_In_ ULONG64 PhysicalAddress
+	) const;
+
+	/// <summary>
+	/// Page tables of the image are read in place.
+	/// </summary>
+	CONST CMemoryImage& m_Image;
+
+	ULONG64 m_DirectoryTableBase;
+
+	/// <summary>
+	/// Optional cache of translations and page table pages, may be shared by address spaces.
+	/// </summary>
+	CTranslationCache* m_Cache;
+};
+
+#endif // !__VADSCAN_MMU_H_GUARD__
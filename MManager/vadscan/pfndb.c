@@ -0,0 +1,14 @@
+/*+================================================================================================
+Module Name: pfndb.c
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+
+Abstract:
+Build the PFN database scan routines of the driver with the user-mode types.
+
+================================================================================================+*/
+
+#include "../../kshim/kshim.h"
+#include "../MManager/mm/pfndb.c"
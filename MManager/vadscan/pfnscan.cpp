@@ -0,0 +1,96 @@
+/*+================================================================================================
+Module Name: pfnscan.cpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+
+Abstract:
+Offline scan of the page frame number (PFN) database of a memory image.
+The database is read in chunks by the workers of the scheduler, each with its own translation
+cache, and the per-worker results are merged once all the chunks are scanned.
+
+================================================================================================+*/
+
+#include <algorithm>
+
+#include "pfnscan.h"
+
+
+CPfnScanner::CPfnScanner(
+	_In_ CONST CMemoryImage& Image,
+	_In_ ULONG64             DirectoryTableBase,
+	_In_ ULONG64             PfnDatabase,
+	_In_ ULONG64             NumberOfPages
+) : m_Image(Image), m_DirectoryTableBase(DirectoryTableBase), m_PfnDatabase(PfnDatabase), m_NumberOfPages(NumberOfPages) {
+	this->m_Result = std::make_unique<XPFN_SCAN>();
+	this->m_Owners.resize(PFNSCAN_MAXIMUM_OWNERS);
+	XMiInitializePfnScan(this->m_Result.get(), this->m_Owners.data(), PFNSCAN_MAXIMUM_OWNERS, CPfnScanner::ReadU4, NULL);
+}
+
+
+_Use_decl_annotations_
+BOOLEAN CPfnScanner::ReadU4(
+	_In_opt_ PVOID    Context,
+	_In_     ULONG64  PageFrameNumber,
+	_Out_    PULONG64 U4
+) {
+	PPFNSCAN_WORKER Worker = (PPFNSCAN_WORKER)Context;
+	if (Worker == NULL)
+		return FALSE;
+	return Worker->Kernel->Read(Worker->PfnDatabase + (PageFrameNumber * XPFN_ENTRY_SIZE) + XPFN_U4, U4);
+}
+
+
+_Use_decl_annotations_
+VOID CPfnScanner::ScanChunk(
+	_In_ PPFNSCAN_WORKER Worker,
+	_In_ ULONG64         FirstPageFrameNumber,
+	_In_ ULONG64         NumberOfEntries
+) {
+	ULONG64 Address = this->m_PfnDatabase + (FirstPageFrameNumber * XPFN_ENTRY_SIZE);
+	if (Worker->Kernel->ReadVirtual(Address, Worker->Buffer.data(), NumberOfEntries * XPFN_ENTRY_SIZE)) {
+		XMiScanPfnBatch(Worker->Scan.get(), Worker->Buffer.data(), FirstPageFrameNumber, NumberOfEntries);
+		return;
+	}
+
+	// The database is sparse, entries of physical memory holes are not mapped
+	if (NumberOfEntries > PFNSCAN_SMALL_CHUNK_ENTRIES) {
+		for (ULONG64 Offset = 0x00; Offset < NumberOfEntries; Offset += PFNSCAN_SMALL_CHUNK_ENTRIES)
+			this->ScanChunk(Worker, FirstPageFrameNumber + Offset, std::min<ULONG64>(PFNSCAN_SMALL_CHUNK_ENTRIES, NumberOfEntries - Offset));
+		return;
+	}
+	Worker->MissingEntries += NumberOfEntries;
+}
+
+
+_Use_decl_annotations_
+VOID CPfnScanner::Scan(
+	_In_ CScheduler& Scheduler
+) {
+	// One scan state per worker, so that no counter is shared between threads
+	std::vector<std::unique_ptr<PFNSCAN_WORKER>> Workers;
+	for (ULONG cx = 0x00; cx < Scheduler.GetNumberOfWorkers(); cx++) {
+		std::unique_ptr<PFNSCAN_WORKER> Worker = std::make_unique<PFNSCAN_WORKER>();
+		Worker->Cache          = std::make_unique<CTranslationCache>(this->m_Image);
+		Worker->Kernel         = std::make_unique<CAddressSpace>(this->m_Image, this->m_DirectoryTableBase, Worker->Cache.get());
+		Worker->Scan           = std::make_unique<XPFN_SCAN>();
+		Worker->PfnDatabase    = this->m_PfnDatabase;
+		Worker->MissingEntries = 0x00;
+		Worker->Owners.resize(PFNSCAN_MAXIMUM_OWNERS);
+		Worker->Buffer.resize(PFNSCAN_CHUNK_ENTRIES * XPFN_ENTRY_SIZE);
+		XMiInitializePfnScan(Worker->Scan.get(), Worker->Owners.data(), PFNSCAN_MAXIMUM_OWNERS, CPfnScanner::ReadU4, Worker.get());
+		Workers.push_back(std::move(Worker));
+	}
+
+	ULONG64 NumberOfChunks = (this->m_NumberOfPages + PFNSCAN_CHUNK_ENTRIES - 1) / PFNSCAN_CHUNK_ENTRIES;
+	Scheduler.Run(NumberOfChunks, [&](ULONG Worker, ULONG64 Task) {
+		ULONG64 First = Task * PFNSCAN_CHUNK_ENTRIES;
+		this->ScanChunk(Workers[Worker].get(), First, std::min<ULONG64>(PFNSCAN_CHUNK_ENTRIES, this->m_NumberOfPages - First));
+	});
+
+	for (CONST std::unique_ptr<PFNSCAN_WORKER>& Worker : Workers) {
+		XMiMergePfnScan(this->m_Result.get(), Worker->Scan.get());
+		this->m_MissingEntries += Worker->MissingEntries;
+	}
+}
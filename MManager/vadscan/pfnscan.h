@@ -0,0 +1,93 @@
+/*+================================================================================================
+Module Name: pfnscan.h
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+
+Abstract:
+Offline scan of the page frame number (PFN) database of a memory image.
+The database is read in chunks by the workers of the scheduler, each with its own translation
+cache, and the per-worker results are merged once all the chunks are scanned.
+
+================================================================================================+*/
+
+#ifndef __VADSCAN_PFNSCAN_H_GUARD__
+#define __VADSCAN_PFNSCAN_H_GUARD__
+
+#include <memory>
+#include <vector>
+
+#include "../../kshim/kshim.h"
+#include "mmu.h"
+#include "scheduler.h"
+#include "../MManager/mm/pfndb.h"
+
+// Number of MMPFN entries read at once, a multiple of the entries in 3 pages.
+#define PFNSCAN_CHUNK_ENTRIES 0x1000
+
+// Number of MMPFN entries read at once when a chunk is only partially mapped.
+#define PFNSCAN_SMALL_CHUNK_ENTRIES 0x100
+
+// Size of the owner table of each worker and of the merged result.
+#define PFNSCAN_MAXIMUM_OWNERS 0x1000
+
+class CPfnScanner {
+
+public:
+	CPfnScanner(
+		_In_ CONST CMemoryImage& Image,
+		_In_ ULONG64             DirectoryTableBase,
+		_In_ ULONG64             PfnDatabase,
+		_In_ ULONG64             NumberOfPages
+	);
+
+	/// <summary>
+	/// Scan the whole database with the workers of the scheduler.
+	/// </summary>
+	VOID Scan(
+		_In_ CScheduler& Scheduler
+	);
+
+	PXPFN_SCAN GetResult() { return this->m_Result.get(); }
+
+	/// <summary>
+	/// Number of MMPFN entries that could not be read from the image.
+	/// </summary>
+	ULONG64 GetNumberOfMissingEntries() const { return this->m_MissingEntries; }
+
+private:
+	typedef struct _PFNSCAN_WORKER {
+		std::unique_ptr<CTranslationCache> Cache;
+		std::unique_ptr<CAddressSpace>     Kernel;
+		std::unique_ptr<XPFN_SCAN>         Scan;
+		std::vector<XPFN_OWNER>            Owners;
+		std::vector<UCHAR>                 Buffer;
+		ULONG64                            PfnDatabase;
+		ULONG64                            MissingEntries;
+	} PFNSCAN_WORKER, * PPFNSCAN_WORKER;
+
+	static BOOLEAN ReadU4(
+		_In_opt_ PVOID    Context,
+		_In_     ULONG64  PageFrameNumber,
+		_Out_    PULONG64 U4
+	);
+
+	VOID ScanChunk(
+		_In_ PPFNSCAN_WORKER Worker,
+		_In_ ULONG64         FirstPageFrameNumber,
+		_In_ ULONG64         NumberOfEntries
+	);
+
+	CONST CMemoryImage& m_Image;
+
+	ULONG64 m_DirectoryTableBase;
+	ULONG64 m_PfnDatabase;
+	ULONG64 m_NumberOfPages;
+	ULONG64 m_MissingEntries{ 0x00 };
+
+	std::unique_ptr<XPFN_SCAN> m_Result;
+	std::vector<XPFN_OWNER>    m_Owners;
+};
+
+#endif // !__VADSCAN_PFNSCAN_H_GUARD__
@@ -0,0 +1,98 @@
+/*+================================================================================================
+Module Name: scheduler.cpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+
+Abstract:
+Work-stealing scheduler used to scan the processes of a memory image on all cores.
+Each worker owns a queue of tasks. Workers take tasks from the front of their own queue and,
+once it is empty, steal tasks from the back of the queues of the other workers.
+
+================================================================================================+*/
+
+#include <thread>
+
+#include "scheduler.h"
+
+
+CScheduler::CScheduler(
+	_In_ ULONG NumberOfWorkers
+) : m_NumberOfWorkers(NumberOfWorkers != 0x00 ? NumberOfWorkers : 0x01) {
+	for (ULONG cx = 0x00; cx < this->m_NumberOfWorkers; cx++)
+		this->m_Queues.push_back(std::make_unique<WORKER_QUEUE>());
+}
+
+
+_Use_decl_annotations_
+VOID CScheduler::Run(
+	_In_ ULONG64                  NumberOfTasks,
+	_In_ CONST SCHEDULER_ROUTINE& Routine
+) {
+	this->m_NumberOfSteals = 0x00;
+
+	// Contiguous blocks of tasks per worker, no task is added once the workers are started
+	for (ULONG cx = 0x00; cx < this->m_NumberOfWorkers; cx++) {
+		ULONG64 First = (NumberOfTasks * cx) / this->m_NumberOfWorkers;
+		ULONG64 Last  = (NumberOfTasks * (cx + 1)) / this->m_NumberOfWorkers;
+
+		this->m_Queues[cx]->Tasks.clear();
+		for (ULONG64 Task = First; Task < Last; Task++)
+			this->m_Queues[cx]->Tasks.push_back(Task);
+	}
+
+	// The calling thread is the first worker
+	std::vector<std::thread> Threads;
+	for (ULONG cx = 0x01; cx < this->m_NumberOfWorkers; cx++)
+		Threads.emplace_back(&CScheduler::WorkerRoutine, this, cx, std::cref(Routine));
+	this->WorkerRoutine(0x00, Routine);
+
+	for (std::thread& Thread : Threads)
+		Thread.join();
+}
+
+
+_Use_decl_annotations_
+BOOLEAN CScheduler::GetTask(
+	_In_  ULONG    Worker,
+	_Out_ PULONG64 Task
+) {
+	// Own queue first
+	PWORKER_QUEUE Queue = this->m_Queues[Worker].get();
+	{
+		std::lock_guard<std::mutex> Guard(Queue->Lock);
+		if (!Queue->Tasks.empty()) {
+			*Task = Queue->Tasks.front();
+			Queue->Tasks.pop_front();
+			return TRUE;
+		}
+	}
+
+	// Steal from the other workers. Queues are never refilled, so one empty pass ends the worker.
+	for (ULONG cx = 0x01; cx < this->m_NumberOfWorkers; cx++) {
+		Queue = this->m_Queues[(Worker + cx) % this->m_NumberOfWorkers].get();
+
+		std::lock_guard<std::mutex> Guard(Queue->Lock);
+		if (!Queue->Tasks.empty()) {
+			*Task = Queue->Tasks.back();
+			Queue->Tasks.pop_back();
+
+			std::lock_guard<std::mutex> StealGuard(this->m_StealLock);
+			this->m_NumberOfSteals++;
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+
+_Use_decl_annotations_
+VOID CScheduler::WorkerRoutine(
+	_In_ ULONG                    Worker,
+	_In_ CONST SCHEDULER_ROUTINE& Routine
+) {
+	ULONG64 Task = 0x00;
+	while (this->GetTask(Worker, &Task))
+		Routine(Worker, Task);
+}
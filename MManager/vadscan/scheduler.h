@@ -0,0 +1,78 @@
+/*+================================================================================================
+Module Name: scheduler.h
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+
+Abstract:
+Work-stealing scheduler used to scan the processes of a memory image on all cores.
+Each worker owns a queue of tasks. Workers take tasks from the front of their own queue and,
+once it is empty, steal tasks from the back of the queues of the other workers.
+
+================================================================================================+*/
+
+#ifndef __VADSCAN_SCHEDULER_H_GUARD__
+#define __VADSCAN_SCHEDULER_H_GUARD__
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "../../kshim/kshim.h"
+
+/// <summary>
+/// Routine called for each task, with the index of the worker running it.
+/// </summary>
+typedef std::function<VOID(ULONG Worker, ULONG64 Task)> SCHEDULER_ROUTINE;
+
+class CScheduler {
+
+public:
+	CScheduler(
+		_In_ ULONG NumberOfWorkers
+	);
+
+	/// <summary>
+	/// Run the routine for each task in [0, NumberOfTasks) and wait for all of them to complete.
+	/// </summary>
+	VOID Run(
+		_In_ ULONG64                  NumberOfTasks,
+		_In_ CONST SCHEDULER_ROUTINE& Routine
+	);
+
+	ULONG GetNumberOfWorkers() const { return this->m_NumberOfWorkers; }
+
+	/// <summary>
+	/// Number of tasks taken from the queue of another worker during the last run.
+	/// </summary>
+	ULONG64 GetNumberOfSteals() const { return this->m_NumberOfSteals; }
+
+private:
+	typedef struct _WORKER_QUEUE {
+		std::mutex          Lock;
+		std::deque<ULONG64> Tasks;
+	} WORKER_QUEUE, * PWORKER_QUEUE;
+
+	_Must_inspect_result_
+	BOOLEAN GetTask(
+		_In_  ULONG    Worker,
+		_Out_ PULONG64 Task
+	);
+
+	VOID WorkerRoutine(
+		_In_ ULONG                    Worker,
+		_In_ CONST SCHEDULER_ROUTINE& Routine
+	);
+
+	ULONG m_NumberOfWorkers;
+
+	std::vector<std::unique_ptr<WORKER_QUEUE>> m_Queues;
+
+	std::mutex m_StealLock;
+	ULONG64    m_NumberOfSteals{ 0x00 };
+};
+
+#endif // !__VADSCAN_SCHEDULER_H_GUARD__
@@ -0,0 +1,101 @@
+/*+================================================================================================
+Module Name: tlb.cpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+
+Abstract:
+Software translation cache for the offline address translation.
+Translations are kept in a set-associative cache tagged with the DirectoryTableBase (DTB), so
+that one cache can be shared by the kernel and the process address spaces. Page table pages are
+kept in a direct-mapped cache in front of the lookup of the memory image.
+
+================================================================================================+*/
+
+#include "tlb.h"
+
+// Set of a VPN, the DTB is mixed in so that the same VPN of two processes uses different sets.
+#define TLB_SET_INDEX(Dtb, Vpn) (ULONG)(((Vpn) ^ ((Dtb) >> PAGE_SHIFT)) & (TLB_NUMBER_OF_SETS - 1))
+
+
+CTranslationCache::CTranslationCache(
+	_In_ CONST CMemoryImage& Image
+) : m_Image(Image) {
+	this->Flush();
+}
+
+
+VOID CTranslationCache::Flush() {
+	for (ULONG Set = 0x00; Set < TLB_NUMBER_OF_SETS; Set++) {
+		for (ULONG Way = 0x00; Way < TLB_NUMBER_OF_WAYS; Way++)
+			this->m_Sets[Set][Way] = { 0x00, TLB_INVALID_VPN, 0x00 };
+	}
+	for (ULONG cx = 0x00; cx < TLB_NUMBER_OF_TABLES; cx++)
+		this->m_Tables[cx] = { TLB_INVALID_VPN, NULL };
+	this->m_Stats = { 0x00 };
+}
+
+
+_Use_decl_annotations_
+BOOLEAN CTranslationCache::Lookup(
+	_In_  ULONG64  DirectoryTableBase,
+	_In_  ULONG64  Vpn,
+	_Out_ PULONG64 PhysicalPage
+) {
+	PTLB_ENTRY Set = this->m_Sets[TLB_SET_INDEX(DirectoryTableBase, Vpn)];
+
+	for (ULONG Way = 0x00; Way < TLB_NUMBER_OF_WAYS; Way++) {
+		if (Set[Way].Vpn != Vpn || Set[Way].DirectoryTableBase != DirectoryTableBase)
+			continue;
+
+		// Move to the front of the set
+		TLB_ENTRY Entry = Set[Way];
+		for (; Way != 0x00; Way--)
+			Set[Way] = Set[Way - 1];
+		Set[0x00] = Entry;
+
+		*PhysicalPage = Entry.PhysicalPage;
+		this->m_Stats.TranslationHits++;
+		return TRUE;
+	}
+
+	this->m_Stats.TranslationMisses++;
+	return FALSE;
+}
+
+
+_Use_decl_annotations_
+VOID CTranslationCache::Insert(
+	_In_ ULONG64 DirectoryTableBase,
+	_In_ ULONG64 Vpn,
+	_In_ ULONG64 PhysicalPage
+) {
+	PTLB_ENTRY Set = this->m_Sets[TLB_SET_INDEX(DirectoryTableBase, Vpn)];
+
+	// Evict the least recently used way
+	for (ULONG Way = TLB_NUMBER_OF_WAYS - 1; Way != 0x00; Way--)
+		Set[Way] = Set[Way - 1];
+	Set[0x00] = { DirectoryTableBase, Vpn, PhysicalPage };
+}
+
+
+_Use_decl_annotations_
+CONST ULONG64* CTranslationCache::GetTable(
+	_In_ ULONG64 PhysicalAddress
+) {
+	ULONG64          PageFrameNumber = PhysicalAddress >> PAGE_SHIFT;
+	PTLB_TABLE_ENTRY Entry = &this->m_Tables[PageFrameNumber & (TLB_NUMBER_OF_TABLES - 1)];
+
+	if (Entry->PageFrameNumber == PageFrameNumber) {
+		this->m_Stats.TableHits++;
+		return Entry->Table;
+	}
+	this->m_Stats.TableMisses++;
+
+	// Pages missing from the image are not cached, they are rare and always fail the walk
+	CONST ULONG64* Table = (CONST ULONG64*)this->m_Image.GetPhysicalPage(PageFrameNumber);
+	if (Table != NULL)
+		*Entry = { PageFrameNumber, Table };
+	return Table;
+}
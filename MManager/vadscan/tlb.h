@@ -0,0 +1,102 @@
+/*+================================================================================================
+Module Name: tlb.h
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+
+Abstract:
+Software translation cache for the offline address translation.
+Translations are kept in a set-associative cache tagged with the DirectoryTableBase (DTB), so
+that one cache can be shared by the kernel and the process address spaces. Page table pages are
+kept in a direct-mapped cache in front of the lookup of the memory image.
+
+================================================================================================+*/
+
+#ifndef __VADSCAN_TLB_H_GUARD__
+#define __VADSCAN_TLB_H_GUARD__
+
+#include "../../kshim/kshim.h"
+#include "image.h"
+
+// Geometry of the translation cache, the number of sets must be a power of two.
+#define TLB_NUMBER_OF_SETS 0x400
+#define TLB_NUMBER_OF_WAYS 0x04
+
+// Number of page table pages cached, must be a power of two.
+#define TLB_NUMBER_OF_TABLES 0x200
+
+// Tag of a free entry, not a valid Virtual Page Number (VPN).
+#define TLB_INVALID_VPN (ULONG64)-1
+
+/// <summary>
+/// Hit and miss counters of the caches.
+/// </summary>
+typedef struct _TLB_STATS {
+	ULONG64 TranslationHits;
+	ULONG64 TranslationMisses;
+	ULONG64 TableHits;
+	ULONG64 TableMisses;
+} TLB_STATS, * PTLB_STATS;
+
+/// <summary>
+/// Translation of a Virtual Page Number (VPN) of an address space.
+/// </summary>
+typedef struct _TLB_ENTRY {
+	ULONG64 DirectoryTableBase;
+	ULONG64 Vpn;
+	ULONG64 PhysicalPage;  // Physical address of the page
+} TLB_ENTRY, * PTLB_ENTRY;
+
+/// <summary>
+/// Page table page of the memory image.
+/// </summary>
+typedef struct _TLB_TABLE_ENTRY {
+	ULONG64        PageFrameNumber;
+	CONST ULONG64* Table;
+} TLB_TABLE_ENTRY, * PTLB_TABLE_ENTRY;
+
+class CTranslationCache {
+
+public:
+	CTranslationCache(
+		_In_ CONST CMemoryImage& Image
+	);
+
+	VOID Flush();
+
+	/// <summary>
+	/// Physical address of the page mapping a VPN, ways are kept in most recently used order.
+	/// </summary>
+	_Must_inspect_result_
+	BOOLEAN Lookup(
+		_In_  ULONG64  DirectoryTableBase,
+		_In_  ULONG64  Vpn,
+		_Out_ PULONG64 PhysicalPage
+	);
+
+	VOID Insert(
+		_In_ ULONG64 DirectoryTableBase,
+		_In_ ULONG64 Vpn,
+		_In_ ULONG64 PhysicalPage
+	);
+
+	/// <summary>
+	/// Content of a page table page, or NULL if the page is not in the image.
+	/// </summary>
+	_Must_inspect_result_
+	CONST ULONG64* GetTable(
+		_In_ ULONG64 PhysicalAddress
+	);
+
+	CONST TLB_STATS& GetStats() const { return this->m_Stats; }
+
+private:
+	CONST CMemoryImage& m_Image;
+
+	TLB_ENTRY       m_Sets[TLB_NUMBER_OF_SETS][TLB_NUMBER_OF_WAYS];
+	TLB_TABLE_ENTRY m_Tables[TLB_NUMBER_OF_TABLES];
+	TLB_STATS       m_Stats;
+};
+
+#endif // !__VADSCAN_TLB_H_GUARD__
@@ -0,0 +1,253 @@
+/*+================================================================================================
+Module Name: vadscan.cpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+
+Abstract:
+Offline reconstruction of the VAD tree of the processes of a memory image.
+The structures are the same as the ones read by XMiBuildVadTable in the driver:
+EPROCESS -> VadRoot -> MMVAD -> Subsection -> CONTROL_AREA -> FILE_OBJECT.
+
+================================================================================================+*/
+
+#include <string.h>
+#include <utility>
+
+#include "vadscan.h"
+
+
+CVadScanner::CVadScanner(
+	_In_ CONST CMemoryImage& Image,
+	_In_ ULONG64             DirectoryTableBase
+) : m_Image(Image), m_Cache(Image), m_Kernel(Image, DirectoryTableBase, &m_Cache) {
+}
+
+
+_Use_decl_annotations_
+BOOLEAN CVadScanner::FindProcesses(
+	_In_  ULONG64               PsActiveProcessHead,
+	_Out_ std::vector<ULONG64>& Processes
+) const {
+	Processes.clear();
+
+	ULONG64 Flink = 0x00;
+	if (!this->m_Kernel.Read(PsActiveProcessHead, &Flink))
+		return FALSE;
+
+	while (Flink != PsActiveProcessHead) {
+		if (Flink == 0x00 || Processes.size() >= VADSCAN_MAXIMUM_PROCESSES)
+			return FALSE;
+		Processes.push_back(Flink - EPROCESS_ACTIVE_PROCESS_LINKS);
+
+		if (!this->m_Kernel.Read(Flink, &Flink))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+
+_Use_decl_annotations_
+BOOLEAN CVadScanner::ReadProcessId(
+	_In_  ULONG64  Eprocess,
+	_Out_ PULONG64 ProcessId
+) const {
+	return this->m_Kernel.Read(Eprocess + EPROCESS_UNIQUE_PROCESS_ID, ProcessId);
+}
+
+
+_Use_decl_annotations_
+BOOLEAN CVadScanner::ReadProcessInformation(
+	_In_  ULONG64          Eprocess,
+	_Out_ VADSCAN_PROCESS& Process
+) const {
+	Process.Eprocess     = Eprocess;
+	Process.MaximumLevel = 0x00;
+	Process.Truncated    = FALSE;
+	Process.Entries.clear();
+
+	char ImageFileName[0x10] = { 0x00 };
+	if (!this->m_Kernel.Read(Eprocess + EPROCESS_UNIQUE_PROCESS_ID, &Process.ProcessId)
+		|| !this->m_Kernel.Read(Eprocess + KPROCESS_DIRECTORY_TABLE_BASE, &Process.DirectoryTableBase)
+		|| !this->m_Kernel.ReadVirtual(Eprocess + EPROCESS_IMAGE_FILE_NAME, ImageFileName, 0x0F))
+		return FALSE;
+	Process.ImageFileName = ImageFileName;
+	return TRUE;
+}
+
+
+_Use_decl_annotations_
+BOOLEAN CVadScanner::ScanProcess(
+	_In_  ULONG64          Eprocess,
+	_Out_ VADSCAN_PROCESS& Process
+) const {
+	// Process information
+	ULONG64 VadRoot = 0x00;
+	if (!this->ReadProcessInformation(Eprocess, Process)
+		|| !this->m_Kernel.Read(Eprocess + EPROCESS_VAD_ROOT, &VadRoot))
+		return FALSE;
+
+	// The state of user-mode pages is in the page tables of the process
+	CAddressSpace ProcessSpace(this->m_Image, Process.DirectoryTableBase, &this->m_Cache);
+
+	// Same order as XMiBuildVadTable: node, left subtree and then right subtree
+	std::vector<std::pair<ULONG64, ULONG>> Stack;
+	if (VadRoot != 0x00)
+		Stack.push_back({ VadRoot, 0x00 });
+
+	while (!Stack.empty()) {
+		ULONG64 VadNode = Stack.back().first;
+		ULONG   Level   = Stack.back().second;
+		Stack.pop_back();
+
+		// A loop or a tree deeper than possible means the data is inconsistent
+		if (Level >= VADSCAN_MAXIMUM_LEVEL) {
+			Process.Truncated = TRUE;
+			continue;
+		}
+
+		VADSCAN_ENTRY Entry;
+		ULONG64 Left  = 0x00;
+		ULONG64 Right = 0x00;
+		if (!this->ReadVadNode(VadNode, Entry)
+			|| !this->m_Kernel.Read(VadNode + MMVAD_SHORT_LEFT, &Left)
+			|| !this->m_Kernel.Read(VadNode + MMVAD_SHORT_RIGHT, &Right)) {
+			Process.Truncated = TRUE;
+			continue;
+		}
+		Entry.Level = Level;
+		if (Level > Process.MaximumLevel)
+			Process.MaximumLevel = Level;
+
+		ProcessSpace.ClassifyRange(Entry.VpnStarting, Entry.VpnEnding, &Entry.Pages);
+		Process.Entries.push_back(std::move(Entry));
+
+		if (Right != 0x00)
+			Stack.push_back({ Right, Level + 1 });
+		if (Left != 0x00)
+			Stack.push_back({ Left, Level + 1 });
+	}
+	return TRUE;
+}
+
+
+_Use_decl_annotations_
+BOOLEAN CVadScanner::ReadVadNode(
+	_In_  ULONG64        VadNode,
+	_Out_ VADSCAN_ENTRY& Entry
+) const {
+	Entry.VadAddress   = VadNode;
+	Entry.Level        = 0x00;
+	Entry.ControlArea  = 0x00;
+	Entry.Pages        = { 0x00 };
+	Entry.FileName.clear();
+
+	// Calculate Virtual Page Number (VPN)
+	ULONG StartingVpn     = 0x00;
+	ULONG EndingVpn       = 0x00;
+	UCHAR StartingVpnHigh = 0x00;
+	UCHAR EndingVpnHigh   = 0x00;
+	UCHAR CommitHigh      = 0x00;
+	if (!this->m_Kernel.Read(VadNode + MMVAD_SHORT_STARTING_VPN, &StartingVpn)
+		|| !this->m_Kernel.Read(VadNode + MMVAD_SHORT_ENDING_VPN, &EndingVpn)
+		|| !this->m_Kernel.Read(VadNode + MMVAD_SHORT_STARTING_VPN_HIGH, &StartingVpnHigh)
+		|| !this->m_Kernel.Read(VadNode + MMVAD_SHORT_ENDING_VPN_HIGH, &EndingVpnHigh)
+		|| !this->m_Kernel.Read(VadNode + MMVAD_SHORT_COMMIT_CHARGE_HIGH, &CommitHigh))
+		return FALSE;
+	Entry.VpnStarting = ((ULONG64)StartingVpnHigh << 32) | StartingVpn;
+	Entry.VpnEnding   = ((ULONG64)EndingVpnHigh << 32) | EndingVpn;
+
+	// Get all flags. Only MMVAD has the third set, MMVAD_SHORT of private memory may end before.
+	if (!this->m_Kernel.Read(VadNode + MMVAD_SHORT_FLAGS, &Entry.LongVadFlags)
+		|| !this->m_Kernel.Read(VadNode + MMVAD_SHORT_FLAGS1, &Entry.LongVadFlags1))
+		return FALSE;
+	Entry.LongVadFlags2 = 0x00;
+
+	// Get commit charge
+	Entry.CommitCharge = MMVAD_FLAGS1_COMMIT_CHARGE(Entry.LongVadFlags1) | ((ULONG64)CommitHigh << 31);
+	if (MMVAD_FLAGS_PRIVATE_MEMORY(Entry.LongVadFlags))
+		return TRUE;
+
+	// Check for a control area. Applicable only in case this is mapped memory.
+	ULONG64 Subsection = 0x00;
+	if (!this->m_Kernel.Read(VadNode + MMVAD_FLAGS2, &Entry.LongVadFlags2)
+		|| !this->m_Kernel.Read(VadNode + MMVAD_SUBSECTION, &Subsection))
+		return FALSE;
+	if (Subsection == 0x00)
+		return TRUE;
+	if (!this->m_Kernel.Read(Subsection + SUBSECTION_CONTROL_AREA, &Entry.ControlArea))
+		return TRUE;
+
+	if (Entry.ControlArea == 0x00)
+		return TRUE;
+
+	// Name already resolved from another VAD of the same CONTROL_AREA
+	auto Cached = this->m_FileNames.find(Entry.ControlArea);
+	if (Cached != this->m_FileNames.end()) {
+		Entry.FileName = Cached->second;
+		return TRUE;
+	}
+
+	// Now check for the FileObject if any. The name is optional, the node is still valid.
+	ULONG64 FilePointer = 0x00;
+	if (!this->m_Kernel.Read(Entry.ControlArea + CONTROL_AREA_FILE_POINTER, &FilePointer))
+		return TRUE;
+	FilePointer &= 0xFFFFFFFFFFFFFFF0;
+	if (FilePointer != 0x00)
+		(VOID)this->ReadUnicodeString(FilePointer + FILE_OBJECT_FILE_NAME, Entry.FileName);
+	this->m_FileNames.emplace(Entry.ControlArea, Entry.FileName);
+	return TRUE;
+}
+
+
+_Use_decl_annotations_
+BOOLEAN CVadScanner::ReadUnicodeString(
+	_In_  ULONG64      Address,
+	_Out_ std::string& String
+) const {
+	String.clear();
+
+	// UNICODE_STRING: Length, MaximumLength and Buffer
+	USHORT  Length = 0x00;
+	ULONG64 Buffer = 0x00;
+	if (!this->m_Kernel.Read(Address, &Length)
+		|| !this->m_Kernel.Read(Address + 0x08, &Buffer))
+		return FALSE;
+	if (Length == 0x00 || Buffer == 0x00)
+		return TRUE;
+
+	std::vector<USHORT> Utf16(Length / sizeof(USHORT));
+	if (!this->m_Kernel.ReadVirtual(Buffer, Utf16.data(), Utf16.size() * sizeof(USHORT)))
+		return FALSE;
+
+	// UTF-16 to UTF-8
+	for (size_t cx = 0x00; cx < Utf16.size(); cx++) {
+		ULONG CodePoint = Utf16[cx];
+		if (CodePoint >= 0xD800 && CodePoint <= 0xDBFF && (cx + 1) < Utf16.size()
+			&& Utf16[cx + 1] >= 0xDC00 && Utf16[cx + 1] <= 0xDFFF) {
+			CodePoint = 0x10000 + ((CodePoint - 0xD800) << 10) + (Utf16[cx + 1] - 0xDC00);
+			cx++;
+		}
+
+		if (CodePoint < 0x80) {
+			String.push_back((char)CodePoint);
+		}
+		else if (CodePoint < 0x800) {
+			String.push_back((char)(0xC0 | (CodePoint >> 6)));
+			String.push_back((char)(0x80 | (CodePoint & 0x3F)));
+		}
+		else if (CodePoint < 0x10000) {
+			String.push_back((char)(0xE0 | (CodePoint >> 12)));
+			String.push_back((char)(0x80 | ((CodePoint >> 6) & 0x3F)));
+			String.push_back((char)(0x80 | (CodePoint & 0x3F)));
+		}
+		else {
+			String.push_back((char)(0xF0 | (CodePoint >> 18)));
+			String.push_back((char)(0x80 | ((CodePoint >> 12) & 0x3F)));
+			String.push_back((char)(0x80 | ((CodePoint >> 6) & 0x3F)));
+			String.push_back((char)(0x80 | (CodePoint & 0x3F)));
+		}
+	}
+	return TRUE;
+}
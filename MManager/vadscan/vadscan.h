@@ -0,0 +1,167 @@
+/*+================================================================================================
+Module Name: vadscan.h
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+
+Abstract:
+Offline reconstruction of the VAD tree of the processes of a memory image.
+The structures are the same as the ones read by XMiBuildVadTable in the driver:
+EPROCESS -> VadRoot -> MMVAD -> Subsection -> CONTROL_AREA -> FILE_OBJECT.
+
+================================================================================================+*/
+
+#ifndef __VADSCAN_H_GUARD__
+#define __VADSCAN_H_GUARD__
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../../kshim/kshim.h"
+#include "mmu.h"
+
+// Offsets of the structures for Windows 10 (20h2) - 19044.1706 x64, same build as the driver.
+#define KPROCESS_DIRECTORY_TABLE_BASE   0x028
+#define EPROCESS_UNIQUE_PROCESS_ID      0x440
+#define EPROCESS_ACTIVE_PROCESS_LINKS   0x448
+#define EPROCESS_IMAGE_FILE_NAME        0x5a8
+#define EPROCESS_VAD_ROOT               0x7d8
+
+#define MMVAD_SHORT_LEFT                0x000
+#define MMVAD_SHORT_RIGHT               0x008
+#define MMVAD_SHORT_STARTING_VPN        0x018
+#define MMVAD_SHORT_ENDING_VPN          0x01c
+#define MMVAD_SHORT_STARTING_VPN_HIGH   0x020
+#define MMVAD_SHORT_ENDING_VPN_HIGH     0x021
+#define MMVAD_SHORT_COMMIT_CHARGE_HIGH  0x022
+#define MMVAD_SHORT_FLAGS               0x030
+#define MMVAD_SHORT_FLAGS1              0x034
+#define MMVAD_FLAGS2                    0x040
+#define MMVAD_SUBSECTION                0x048
+
+#define SUBSECTION_CONTROL_AREA         0x000
+#define CONTROL_AREA_FILE_POINTER       0x040
+#define FILE_OBJECT_FILE_NAME           0x058
+
+// Bits of MMVAD_FLAGS and MMVAD_FLAGS1.
+#define MMVAD_FLAGS_VAD_TYPE(f)        (((f) >> 0x04) & 0x07)
+#define MMVAD_FLAGS_PROTECTION(f)      (((f) >> 0x07) & 0x1F)
+#define MMVAD_FLAGS_PRIVATE_MEMORY(f)  (((f) >> 0x14) & 0x01)
+#define MMVAD_FLAGS1_COMMIT_CHARGE(f)  ((f) & 0x7FFFFFFF)
+
+// Upper bound of the depth of a VAD tree, to stop on corrupted or smeared trees.
+#define VADSCAN_MAXIMUM_LEVEL 0x40
+
+// Upper bound of the number of processes, to stop on a corrupted process list.
+#define VADSCAN_MAXIMUM_PROCESSES 0x10000
+
+/// <summary>
+/// One VAD node of a process.
+/// </summary>
+typedef struct _VADSCAN_ENTRY {
+	ULONG64        VadAddress;    // Address of the VAD node
+	ULONG          Level;         // Node depth level
+	ULONG64        VpnStarting;   // Start of Virtual Page Number (VPN)
+	ULONG64        VpnEnding;     // End of Virtual Page Number (VPN)
+	ULONG64        CommitCharge;  // Number of pages commit
+	MMU_PAGE_STATS Pages;         // Residency of the pages of the node
+
+	ULONG LongVadFlags;
+	ULONG LongVadFlags1;
+	ULONG LongVadFlags2;
+
+	ULONG64      ControlArea;     // Address of the control area, if mapped
+	std::string  FileName;        // Name of the file mapped, if any, UTF-8 encoded
+} VADSCAN_ENTRY, * PVADSCAN_ENTRY;
+
+/// <summary>
+/// One process and its VAD tree.
+/// </summary>
+typedef struct _VADSCAN_PROCESS {
+	ULONG64     Eprocess;           // Address of the EPROCESS structure
+	ULONG64     ProcessId;          // EPROCESS.UniqueProcessId
+	ULONG64     DirectoryTableBase; // KPROCESS.DirectoryTableBase
+	std::string ImageFileName;      // EPROCESS.ImageFileName
+	ULONG       MaximumLevel;       // Deepest level
+	BOOLEAN     Truncated;          // Part of the tree could not be read
+
+	std::vector<VADSCAN_ENTRY> Entries;
+} VADSCAN_PROCESS, * PVADSCAN_PROCESS;
+
+class CVadScanner {
+
+public:
+	CVadScanner(
+		_In_ CONST CMemoryImage& Image,
+		_In_ ULONG64             DirectoryTableBase
+	);
+
+	/// <summary>
+	/// List the EPROCESS structures linked to PsActiveProcessHead.
+	/// </summary>
+	_Must_inspect_result_
+	BOOLEAN FindProcesses(
+		_In_  ULONG64               PsActiveProcessHead,
+		_Out_ std::vector<ULONG64>& Processes
+	) const;
+
+	_Must_inspect_result_
+	BOOLEAN ReadProcessId(
+		_In_  ULONG64  Eprocess,
+		_Out_ PULONG64 ProcessId
+	) const;
+
+	/// <summary>
+	/// Read the process ID, DirectoryTableBase and image name of an EPROCESS structure.
+	/// </summary>
+	_Must_inspect_result_
+	BOOLEAN ReadProcessInformation(
+		_In_  ULONG64          Eprocess,
+		_Out_ VADSCAN_PROCESS& Process
+	) const;
+
+	/// <summary>
+	/// Read an EPROCESS structure and walk its VAD tree.
+	/// </summary>
+	_Must_inspect_result_
+	BOOLEAN ScanProcess(
+		_In_  ULONG64          Eprocess,
+		_Out_ VADSCAN_PROCESS& Process
+	) const;
+
+	CONST TLB_STATS& GetCacheStats() const { return this->m_Cache.GetStats(); }
+
+private:
+	_Must_inspect_result_
+	BOOLEAN ReadVadNode(
+		_In_  ULONG64        VadNode,
+		_Out_ VADSCAN_ENTRY& Entry
+	) const;
+
+	_Must_inspect_result_
+	BOOLEAN ReadUnicodeString(
+		_In_  ULONG64      Address,
+		_Out_ std::string& String
+	) const;
+
+	CONST CMemoryImage& m_Image;
+
+	/// <summary>
+	/// Translation cache shared by the kernel and the process address spaces.
+	/// </summary>
+	mutable CTranslationCache m_Cache;
+
+	/// <summary>
+	/// Kernel address space, used to read the structures from the system pool.
+	/// </summary>
+	CAddressSpace m_Kernel;
+
+	/// <summary>
+	/// Name of the mapped file per CONTROL_AREA, empty if none, so that each FILE_OBJECT is only read once.
+	/// </summary>
+	mutable std::unordered_map<ULONG64, std::string> m_FileNames;
+};
+
+#endif // !__VADSCAN_H_GUARD__
@@ -10,6 +10,51 @@ Device driver entry point.
 
 #include "ki-globals.h"
 #include "wki/wki.h"
+#include "../../MManager/MManager/mm/pfndb.h"
+
+// Size of the table of the owners of private pages, must be a power of two.
+#define KI_PFN_MAXIMUM_OWNERS 0x1000
+
+// SYSTEM_INFORMATION_CLASS of the list of processes.
+#define KI_SYSTEM_PROCESS_INFORMATION 0x05
+
+/// <summary>
+/// Beginning of the SYSTEM_PROCESS_INFORMATION of a process, only the fields used.
+/// </summary>
+typedef struct _KI_SYSTEM_PROCESS_INFORMATION {
+	ULONG          NextEntryOffset;
+	ULONG          NumberOfThreads;
+	LARGE_INTEGER  WorkingSetPrivateSize;
+	ULONG          HardFaultCount;
+	ULONG          NumberOfThreadsHighWatermark;
+	ULONGLONG      CycleTime;
+	LARGE_INTEGER  CreateTime;
+	LARGE_INTEGER  UserTime;
+	LARGE_INTEGER  KernelTime;
+	UNICODE_STRING ImageName;
+	KPRIORITY      BasePriority;
+	HANDLE         UniqueProcessId;
+} KI_SYSTEM_PROCESS_INFORMATION, * PKI_SYSTEM_PROCESS_INFORMATION;
+#if defined(_M_AMD64)
+C_ASSERT(FIELD_OFFSET(KI_SYSTEM_PROCESS_INFORMATION, UniqueProcessId) == 0x50);
+#endif // _M_AMD64
+
+/// <summary>
+/// Undocumented routine exported by the kernel.
+/// </summary>
+EXTERN_C PCHAR PsGetProcessImageFileName(
+	_In_ PEPROCESS Process
+);
+
+/// <summary>
+/// Undocumented routine exported by the kernel.
+/// </summary>
+EXTERN_C NTSTATUS ZwQuerySystemInformation(
+	_In_      ULONG  SystemInformationClass,
+	_Out_opt_ PVOID  SystemInformation,
+	_In_      ULONG  SystemInformationLength,
+	_Out_opt_ PULONG ReturnLength
+);
 
 /// <summary>
 /// Device driver entry point.
@@ -46,12 +91,21 @@ EXTERN_C VOID ListPoolTags(
 	VOID
 );
 
+/// <summary>
+/// Scan the PFN database and list physical pages per list and per process.
+/// </summary>
+_IRQL_requires_max_(PASSIVE_LEVEL)
+EXTERN_C VOID ListPfnDatabase(
+	VOID
+);
+
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text(INIT, DriverEntry)
 
 #pragma alloc_text(PAGE, DriverUnload)
 #pragma alloc_text(PAGE, TestWKI)
 #pragma alloc_text(PAGE, ListPoolTags)
+#pragma alloc_text(PAGE, ListPfnDatabase)
 #endif // ALLOC_PRAGMA
 
 
@@ -128,6 +182,7 @@ EXTERN_C NTSTATUS DriverEntry(
 
 	TestWKI();
 	ListPoolTags();
+	ListPfnDatabase();
 	return Status;
 }
 
@@ -334,4 +389,164 @@ EXTERN_C VOID ListPoolTags(
 	ExFreePoolWithTag(PoolTags, WKI_MM_TAG);
 	KiDebug(("List kernel memory pool tags ... ok\r\n"));
 	KiDebug(("-----------------------------------------------\r\n"));
+}
+
+
+/// <summary>
+/// Get the list of the processes, one SYSTEM_PROCESS_INFORMATION each.
+/// </summary>
+/// <returns>List to free with ExFreePoolWithTag, NULL if it could not be read.</returns>
+static PKI_SYSTEM_PROCESS_INFORMATION GetProcessList(
+	VOID
+) {
+	ULONG Size = 0x10000;
+	do {
+		PKI_SYSTEM_PROCESS_INFORMATION List = ExAllocatePool2(POOL_FLAG_PAGED, Size, XPFN_MM_TAG);
+		if (List == NULL)
+			return NULL;
+
+		ULONG    ReturnLength = 0x00;
+		NTSTATUS Status       = ZwQuerySystemInformation(KI_SYSTEM_PROCESS_INFORMATION, List, Size, &ReturnLength);
+		if (NT_SUCCESS(Status))
+			return List;
+		ExFreePoolWithTag(List, XPFN_MM_TAG);
+
+		// Processes created in between, ask for more than needed
+		if (Status != STATUS_INFO_LENGTH_MISMATCH || ReturnLength > MAXULONG / 0x02)
+			return NULL;
+		Size = ReturnLength > Size ? ReturnLength + (ReturnLength / 0x02) : Size * 0x02;
+	} while (TRUE);
+}
+
+/// <summary>
+/// Get KPROCESS.DirectoryTableBase of a process, CR3 while attached to the process.
+/// </summary>
+static UINT64 GetProcessDirectoryTableBase(
+	_In_ PEPROCESS Process
+) {
+	KAPC_STATE ApcState = { 0x00 };
+	KeStackAttachProcess(Process, &ApcState);
+	UINT64 DirectoryTableBase = __readcr3();
+	KeUnstackDetachProcess(&ApcState);
+	return DirectoryTableBase;
+}
+
+/// <summary>
+/// Read MMPFN.u4 of a page table page from the live PFN database.
+/// </summary>
+static BOOLEAN ReadPfnU4(
+	_In_opt_ PVOID    Context,
+	_In_     ULONG64  PageFrameNumber,
+	_Out_    PULONG64 U4
+) {
+	PUCHAR Address = (PUCHAR)Context + (PageFrameNumber * XPFN_ENTRY_SIZE) + XPFN_U4;
+
+	// Entries of physical memory holes are not mapped
+	if (!MmIsAddressValid(Address))
+		return FALSE;
+	*U4 = *(PULONG64)Address;
+	return TRUE;
+}
+
+
+_Use_decl_annotations_
+EXTERN_C VOID ListPfnDatabase(
+	VOID
+) {
+	KiDebug(("List PFN database ...\r\n"));
+
+	// Get the address of the PFN database.
+	PVOID XxMmPfnDatabase = WkiGetSymbol("MmPfnDatabase");
+	if (XxMmPfnDatabase == NULL) {
+		KiDebug(("Error \"MmPfnDatabase\" symbol not found.\r\n"));
+		return;
+	}
+	PUCHAR PfnDatabase = (PUCHAR)WkiReadValue(XxMmPfnDatabase, sizeof(UINT64));
+	if (PfnDatabase == NULL)
+		return;
+
+	// Only the entries of physical memory ranges are mapped
+	PPHYSICAL_MEMORY_RANGE Ranges = MmGetPhysicalMemoryRanges();
+	if (Ranges == NULL)
+		return;
+
+	PXPFN_SCAN  Scan   = ExAllocatePool2(POOL_FLAG_NON_PAGED, sizeof(XPFN_SCAN), XPFN_MM_TAG);
+	PXPFN_OWNER Owners = ExAllocatePool2(POOL_FLAG_NON_PAGED, sizeof(XPFN_OWNER) * KI_PFN_MAXIMUM_OWNERS, XPFN_MM_TAG);
+	if (Scan == NULL || Owners == NULL) {
+		if (Scan != NULL)
+			ExFreePoolWithTag(Scan, XPFN_MM_TAG);
+		if (Owners != NULL)
+			ExFreePoolWithTag(Owners, XPFN_MM_TAG);
+		ExFreePool(Ranges);
+		return;
+	}
+	XMiInitializePfnScan(Scan, Owners, KI_PFN_MAXIMUM_OWNERS, ReadPfnU4, PfnDatabase);
+
+	// Sequential scan of each range, entries are read in place
+	for (UINT64 cx = 0x00; Ranges[cx].NumberOfBytes.QuadPart != 0x00; cx++) {
+		UINT64 FirstPage     = (UINT64)Ranges[cx].BaseAddress.QuadPart >> PAGE_SHIFT;
+		UINT64 NumberOfPages = (UINT64)Ranges[cx].NumberOfBytes.QuadPart >> PAGE_SHIFT;
+
+		XMiScanPfnBatch(Scan, PfnDatabase + (FirstPage * XPFN_ENTRY_SIZE), FirstPage, NumberOfPages);
+	}
+	ExFreePool(Ranges);
+
+	// Display all information
+	KdPrint(("                          Active      Standby     Modified   ModNoWrite   Transition    Zero/Free\r\n\r\n"));
+	KdPrint((" Total              %12I64u %12I64u %12I64u %12I64u %12I64u %12I64u\r\n",
+		Scan->Total.Pages[XPfnListActive],
+		Scan->Total.Pages[XPfnListStandby],
+		Scan->Total.Pages[XPfnListModified],
+		Scan->Total.Pages[XPfnListModifiedNoWrite],
+		Scan->Total.Pages[XPfnListTransition],
+		Scan->Total.Pages[XPfnListZeroed] + Scan->Total.Pages[XPfnListFree]
+	));
+	KdPrint((" Shared             %12I64u %12I64u %12I64u %12I64u %12I64u\r\n",
+		Scan->Shared.Pages[XPfnListActive],
+		Scan->Shared.Pages[XPfnListStandby],
+		Scan->Shared.Pages[XPfnListModified],
+		Scan->Shared.Pages[XPfnListModifiedNoWrite],
+		Scan->Shared.Pages[XPfnListTransition]
+	));
+	KdPrint((" Private            %12I64u %12I64u %12I64u %12I64u %12I64u\r\n\r\n",
+		Scan->Private.Pages[XPfnListActive],
+		Scan->Private.Pages[XPfnListStandby],
+		Scan->Private.Pages[XPfnListModified],
+		Scan->Private.Pages[XPfnListModifiedNoWrite],
+		Scan->Private.Pages[XPfnListTransition]
+	));
+
+	// Private pages of each process listed by the system, the idle process has none
+	PKI_SYSTEM_PROCESS_INFORMATION ProcessList = GetProcessList();
+	PKI_SYSTEM_PROCESS_INFORMATION Information = ProcessList;
+	for (; Information != NULL; Information = Information->NextEntryOffset != 0x00
+		? (PKI_SYSTEM_PROCESS_INFORMATION)((PUCHAR)Information + Information->NextEntryOffset)
+		: NULL
+	) {
+		PEPROCESS Process = NULL;
+		if (Information->UniqueProcessId == NULL || !NT_SUCCESS(PsLookupProcessByProcessId(Information->UniqueProcessId, &Process)))
+			continue;
+
+		PXPFN_OWNER Owner = XMiFindPfnOwner(Scan, GetProcessDirectoryTableBase(Process));
+		if (Owner != NULL) {
+			KdPrint((" %-15s %5I64u %12I64u %12I64u %12I64u %12I64u %12I64u\r\n",
+				PsGetProcessImageFileName(Process),
+				(UINT64)HandleToULong(Information->UniqueProcessId),
+				Owner->Counters.Pages[XPfnListActive],
+				Owner->Counters.Pages[XPfnListStandby],
+				Owner->Counters.Pages[XPfnListModified],
+				Owner->Counters.Pages[XPfnListModifiedNoWrite],
+				Owner->Counters.Pages[XPfnListTransition]
+			));
+		}
+		ObDereferenceObject(Process);
+	}
+
+	// Cleanup
+	if (ProcessList != NULL)
+		ExFreePoolWithTag(ProcessList, XPFN_MM_TAG);
+	ExFreePoolWithTag(Owners, XPFN_MM_TAG);
+	ExFreePoolWithTag(Scan, XPFN_MM_TAG);
+	KiDebug(("List PFN database ... ok\r\n"));
+	KiDebug(("-----------------------------------------------\r\n"));
 }
\ No newline at end of file
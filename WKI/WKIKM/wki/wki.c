@@ -113,18 +113,32 @@ EXTERN_C NTSTATUS WkipGetInitialRegistryKey(
 		// Get the partial information
 		Status = ZwQueryValueKey(CurrentVersion, &ValueName, KeyValuePartialInformation, (PVOID)PartialInformation, PartialInfoSize, &PartialInfoSize);
 		if (NT_ERROR(Status)) {
-			ExFreePoolWithTag((PVOID)PartialInfoSize, WKI_MM_TAG);
+			ExFreePoolWithTag((PVOID)PartialInformation, WKI_MM_TAG);
 			ZwClose(CurrentVersion);
 			return STATUS_UNSUCCESSFUL;
 		}
 
-		// Copy the value
-		if (cx == 0x00)
-			RtlCopyMemory(&Major, PartialInformation->Data, PartialInformation->DataLength);
-		else if (cx == 0x01)
-			RtlCopyMemory(CurrentBuildNumber, PartialInformation->Data, PartialInformation->DataLength);
-		else if (cx == 0x02)
-			RtlCopyMemory(&Revision, PartialInformation->Data, PartialInformation->DataLength);
+		// Copy the value, the build number is kept NULL terminated
+		PVOID  Destination     = NULL;
+		SIZE_T DestinationSize = 0x00;
+		if (cx == 0x00) {
+			Destination     = &Major;
+			DestinationSize = sizeof(DWORD);
+		}
+		else if (cx == 0x01) {
+			Destination     = CurrentBuildNumber;
+			DestinationSize = sizeof(CurrentBuildNumber) - sizeof(WCHAR);
+		}
+		else if (cx == 0x02) {
+			Destination     = &Revision;
+			DestinationSize = sizeof(DWORD);
+		}
+		if (PartialInformation->DataLength > DestinationSize) {
+			ExFreePoolWithTag((PVOID)PartialInformation, WKI_MM_TAG);
+			ZwClose(CurrentVersion);
+			return STATUS_UNSUCCESSFUL;
+		}
+		RtlCopyMemory(Destination, PartialInformation->Data, PartialInformation->DataLength);
 
 		// Free memory
 		ExFreePoolWithTag((PVOID)PartialInformation, WKI_MM_TAG);
@@ -145,8 +159,10 @@ EXTERN_C NTSTATUS WkipGetInitialRegistryKey(
 	// Build the string
 	SIZE_T BufferSize = (sizeof(DWORD) * 4) + (sizeof(WCHAR) * 0x0A);
 	LPWSTR Buffer     = ExAllocatePool2(POOL_FLAG_PAGED, BufferSize, WKI_MM_TAG);
-	if (Buffer == NULL)
+	if (Buffer == NULL) {
+		ZwClose(WkiKeyBase);
 		return STATUS_NO_MEMORY;
+	}
 	swprintf_s(Buffer, BufferSize / sizeof(WCHAR), L"%u.%s.%u", Major, CurrentBuildNumber, Revision);
 
 	// Open handle to the key associated with the current OS version.
@@ -162,7 +178,7 @@ EXTERN_C NTSTATUS WkipGetInitialRegistryKey(
 	// Cleanup and exit
 	ZwClose(WkiKeyBase);
 	ExFreePoolWithTag((PVOID)Buffer, WKI_MM_TAG);
-	return STATUS_SUCCESS;
+	return Status;
 }
 
 
@@ -220,8 +236,10 @@ EXTERN_C NTSTATUS WkipGetSymbolEntries(
 		if (NT_ERROR(Status))
 			goto next_entry;
 
-		// Open sub-key
-		RtlInitUnicodeString(&SubKeyName, BasicInfo->Name);
+		// Open sub-key, the name returned is not NULL terminated
+		SubKeyName.Buffer        = BasicInfo->Name;
+		SubKeyName.Length        = (USHORT)BasicInfo->NameLength;
+		SubKeyName.MaximumLength = (USHORT)BasicInfo->NameLength;
 		InitializeObjectAttributes(&SubKeyAttributes, &SubKeyName, OBJ_CASE_INSENSITIVE, SymbolKey, 0x00);
 
 		if (NT_ERROR(ZwOpenKey(&SubKey, GENERIC_READ, &SubKeyAttributes)))
@@ -246,26 +264,16 @@ EXTERN_C NTSTATUS WkipGetSymbolEntries(
 			UNICODE_STRING ValueName = { 0x00 };
 			RtlUnicodeStringInit(&ValueName, SymbolValues[cx]);
 
-			// Get the size of the buffer to be returned
+			// Get the partial information, on the stack as all the values are 32-bit
 			ULONG PartialInfoSize = 0x00;
-			Status = ZwQueryValueKey(SubKey, &ValueName, KeyValuePartialInformation, NULL, 0x00, &PartialInfoSize);
-			if (Status != STATUS_BUFFER_TOO_SMALL) {
-				ExFreePoolWithTag((PVOID)SymbolEntry, WKI_MM_TAG);
-				break;
-			}
-
-			// Allocate memory for value
-			PKEY_VALUE_PARTIAL_INFORMATION PartialInformation = ExAllocatePool2(POOL_FLAG_PAGED, (SIZE_T)PartialInfoSize, WKI_MM_TAG);
-			if (PartialInformation == NULL) {
-				ExFreePoolWithTag((PVOID)SymbolEntry, WKI_MM_TAG);
-				break;
-			}
+			ULONG PartialInfoBuffer[(sizeof(KEY_VALUE_PARTIAL_INFORMATION) + sizeof(UINT32) + sizeof(ULONG) - 1) / sizeof(ULONG)] = { 0x00 };
+			PKEY_VALUE_PARTIAL_INFORMATION PartialInformation = (PKEY_VALUE_PARTIAL_INFORMATION)PartialInfoBuffer;
 
-			// Get the partial information
-			Status = ZwQueryValueKey(SubKey, &ValueName, KeyValuePartialInformation, (PVOID)PartialInformation, PartialInfoSize, &PartialInfoSize);
-			if (NT_ERROR(Status)) {
+			Status = ZwQueryValueKey(SubKey, &ValueName, KeyValuePartialInformation, (PVOID)PartialInformation, sizeof(PartialInfoBuffer), &PartialInfoSize);
+			if (NT_SUCCESS(Status) && PartialInformation->DataLength != sizeof(UINT32))
+				Status = STATUS_INVALID_PARAMETER;
+			if (!NT_SUCCESS(Status)) {
 				ExFreePoolWithTag((PVOID)SymbolEntry, WKI_MM_TAG);
-				ExFreePoolWithTag((PVOID)PartialInformation, WKI_MM_TAG);
 				break;
 			}
 
@@ -279,8 +287,7 @@ EXTERN_C NTSTATUS WkipGetSymbolEntries(
 				Destination = &SymbolEntry->Body.RVA;
 			else if (cx == 0x03)
 				Destination = &SymbolEntry->Body.SEG;
-			RtlCopyMemory(Destination, PartialInformation->Data, PartialInformation->DataLength);
-			ExFreePoolWithTag((PVOID)PartialInformation, WKI_MM_TAG);
+			RtlCopyMemory(Destination, PartialInformation->Data, sizeof(UINT32));
 		}
 
 		// Add new entry in the double-linked list
@@ -291,6 +298,8 @@ EXTERN_C NTSTATUS WkipGetSymbolEntries(
 
 		// Cleanup and next entry
 	next_entry:
+		if (SubKey != NULL)
+			ZwClose(SubKey);
 		if (BasicInfo != NULL)
 			ExFreePoolWithTag((PVOID)BasicInfo, WKI_MM_TAG);
 
@@ -362,6 +371,8 @@ EXTERN_C NTSTATUS WkiInitialise() {
 
 	// Get all symbols
 	Status = WkipGetSymbolEntries(RegistryKey);
+	ZwClose(RegistryKey);
+	RegistryKey = NULL;
 	if (NT_ERROR(Status))
 		goto exit;
 
@@ -376,6 +387,9 @@ exit:
 	if (NT_ERROR(Status)) {
 		if (RegistryKey != NULL)
 			ZwClose(RegistryKey);
+
+		// Release the symbols already loaded
+		WkiInitialised = TRUE;
 		WkiUninitialise();
 	}
 	return Status;
@@ -398,6 +412,8 @@ EXTERN_C VOID WkiUninitialise() {
 		ExFreePoolWithTag(Symbol, WKI_MM_TAG);
 	}
 
+	WkiGlobal.NumberOfSymbols = 0x00;
+	WkiGlobal.KernelBase      = 0x00;
 	WkiInitialised = FALSE;
 }
 
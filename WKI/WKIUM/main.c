@@ -84,6 +84,7 @@ INT main(VOID) {
 		ADD_TABLE_ENTRY(L"ExpPoolBlockShift"),
 		ADD_TABLE_ENTRY(L"PoolTrackTableExpansion"),
 		ADD_TABLE_ENTRY(L"PoolTrackTableExpansionSize"),
+		ADD_TABLE_ENTRY(L"MmPfnDatabase"),
 
 		// General kernel info
 		ADD_TABLE_ENTRY(L"KeNumberProcessors")
@@ -0,0 +1,1580 @@
+/*+================================================================================================
+Module Name: kshim.c
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+
+Abstract:
+Simulation of the kernel routines used by the logic of the drivers, in user mode on Linux.
+Misuses the kernel would bug check on, e.g. a pool allocation freed with another tag, paged memory
+used at DISPATCH_LEVEL or a corrupted list entry, stop the program with the name of the bug check.
+
+================================================================================================+*/
+
+#include "kshim.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <wctype.h>
+
+#if defined(__SANITIZE_ADDRESS__)
+#define KSHIMP_ASAN
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define KSHIMP_ASAN
+#endif // __has_feature(address_sanitizer)
+#endif // __SANITIZE_ADDRESS__
+
+#if defined(KSHIMP_ASAN)
+#include <sanitizer/asan_interface.h>
+#define KSHIMP_POISON(Address, Size)   __asan_poison_memory_region((Address), (Size))
+#define KSHIMP_UNPOISON(Address, Size) __asan_unpoison_memory_region((Address), (Size))
+#else
+#define KSHIMP_POISON(Address, Size)   UNREFERENCED_PARAMETER(Address)
+#define KSHIMP_UNPOISON(Address, Size) UNREFERENCED_PARAMETER(Address)
+#endif // KSHIMP_ASAN
+
+// Content of the uninitialised pool allocations.
+#define KSHIMP_POOL_PATTERN 0xCD
+
+// Objects kept by a lookaside list, the largest depth the kernel tunes the lists to.
+#define KSHIMP_LOOKASIDE_DEPTH 0x100
+
+// Spins on a busy spin lock before yielding, the owner of the lock can be preempted in user mode.
+#define KSHIMP_SPIN_COUNT 0x40
+
+// Largest number of loaded modules.
+#define KSHIMP_MAXIMUM_MODULES 0x20
+
+// Largest format of swprintf_s, in characters.
+#define KSHIMP_MAXIMUM_FORMAT 0x200
+
+// Signature of the registry handles -- KShH
+#define KSHIMP_HANDLE_SIGNATURE (ULONG)0x4868534B
+
+// Pool tags of the work items and of the MDLs -- KShW, KShM
+#define KSHIMP_WORKITEM_TAG (ULONG)0x5768534B
+#define KSHIMP_MDL_TAG      (ULONG)0x4D68534B
+
+// Run-down protection being waited for, and one reference to it.
+#define KSHIMP_RUNDOWN_ACTIVE    (ULONG_PTR)0x01
+#define KSHIMP_RUNDOWN_INCREMENT (ULONG_PTR)0x02
+
+/// <summary>
+/// Header of a pool allocation, just before the allocation.
+/// </summary>
+typedef struct _KSHIMP_POOL_HEADER {
+	ULONG  Tag;
+	ULONG  Offset; // Offset of the allocation from the block allocated
+	SIZE_T Size;
+} KSHIMP_POOL_HEADER, * PKSHIMP_POOL_HEADER;
+
+/// <summary>
+/// Value of a registry key.
+/// </summary>
+typedef struct _KSHIMP_REGISTRY_VALUE {
+	LIST_ENTRY     List;
+	UNICODE_STRING Name;
+	ULONG          Type;
+	ULONG          DataLength;
+	PUCHAR         Data;
+} KSHIMP_REGISTRY_VALUE, * PKSHIMP_REGISTRY_VALUE;
+
+/// <summary>
+/// Registry key.
+/// </summary>
+typedef struct _KSHIMP_REGISTRY_KEY {
+	LIST_ENTRY     List;       // Entry in the sub-keys of the parent
+	UNICODE_STRING Name;
+	LIST_ENTRY     SubKeys;
+	LIST_ENTRY     Values;
+} KSHIMP_REGISTRY_KEY, * PKSHIMP_REGISTRY_KEY;
+
+/// <summary>
+/// Handle of an opened registry key.
+/// </summary>
+typedef struct _KSHIMP_HANDLE {
+	LIST_ENTRY           List;
+	ULONG                Signature;
+	PKSHIMP_REGISTRY_KEY Key;
+} KSHIMP_HANDLE, * PKSHIMP_HANDLE;
+
+/// <summary>
+/// Loaded module.
+/// </summary>
+typedef struct _KSHIMP_MODULE {
+	PVOID  ImageBase;
+	ULONG  ImageSize;
+	USHORT FileNameOffset;
+	CHAR   FullPathName[AUX_KLIB_MODULE_PATH_LEN];
+} KSHIMP_MODULE, * PKSHIMP_MODULE;
+
+/// <summary>
+/// Process, the system process being the only one.
+/// </summary>
+typedef struct _KSHIMP_PROCESS {
+	HANDLE   UniqueProcessId;
+	LONGLONG CreateTime;
+} KSHIMP_PROCESS, * PKSHIMP_PROCESS;
+
+/// <summary>
+/// Work item, with the routine and the context it has been queued with.
+/// </summary>
+struct _IO_WORKITEM {
+	PDEVICE_OBJECT       DeviceObject;
+	PIO_WORKITEM_ROUTINE Routine;
+	PVOID                Context;
+	volatile LONG        Queued;
+};
+
+// IRQL of the current thread.
+static _Thread_local KIRQL KShimpIrql = PASSIVE_LEVEL;
+
+// Pool allocations not freed yet.
+static volatile LONG64 KShimpPoolAllocations = 0x00;
+
+// Failure of every n-th pool allocation, and the allocations counted for it.
+static volatile ULONG   KShimpFailurePeriod    = 0x00;
+static volatile ULONG64 KShimpFailureCount     = 0x00;
+
+// Lock of the registry, of the loaded modules and of the physical memory.
+static pthread_mutex_t KShimpLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Root of the registry, created on first use.
+static PKSHIMP_REGISTRY_KEY KShimpRegistryRoot = NULL;
+
+// Opened registry handles.
+static LIST_ENTRY KShimpHandles     = { &KShimpHandles, &KShimpHandles };
+static ULONG      KShimpOpenHandles = 0x00;
+
+// Loaded modules.
+static KSHIMP_MODULE KShimpModules[KSHIMP_MAXIMUM_MODULES];
+static ULONG         KShimpNumberOfModules   = 0x00;
+static BOOLEAN       KShimpAuxKlibInitialised = FALSE;
+
+// Physical memory.
+static PUCHAR KShimpPhysicalMemory     = NULL;
+static SIZE_T KShimpPhysicalMemorySize = 0x00;
+
+// References to objects not released yet.
+static volatile LONG64 KShimpObjectReferences = 0x00;
+
+// System process, and the process the current thread is attached to, NULL if none.
+static KSHIMP_PROCESS          KShimpSystemProcess   = { (HANDLE)0x04, 0x00 };
+static _Thread_local PEPROCESS KShimpAttachedProcess = NULL;
+
+
+/// <summary>
+/// Stop the program like a bug check.
+/// </summary>
+static VOID KShimpBugCheck(
+	_In_ PCSTR Name,
+	_In_ PCSTR Format,
+	...
+) {
+	va_list Arguments;
+	va_start(Arguments, Format);
+
+	fprintf(stderr, "*** STOP: %s: ", Name);
+	vfprintf(stderr, Format, Arguments);
+	fputc('\n', stderr);
+
+	va_end(Arguments);
+	abort();
+}
+
+/// <summary>
+/// Check the IRQL of a routine that can only run up to a given level.
+/// </summary>
+static VOID KShimpCheckIrql(
+	_In_ KIRQL MaximumIrql,
+	_In_ PCSTR Routine
+) {
+	if (KShimpIrql > MaximumIrql)
+		KShimpBugCheck("IRQL_NOT_LESS_OR_EQUAL", "%s called at IRQL %u, above %u.", Routine, KShimpIrql, MaximumIrql);
+}
+
+_Use_decl_annotations_
+EXTERN_C VOID KShimAssertionFailure(
+	_In_ PCSTR Expression,
+	_In_ PCSTR File,
+	_In_ INT   Line
+) {
+	fprintf(stderr, "*** Assertion failed: %s, %s:%d\n", Expression, File, Line);
+	abort();
+}
+
+_Use_decl_annotations_
+EXTERN_C VOID KShimListEntryFailure(
+	_In_ PLIST_ENTRY Entry
+) {
+	KShimpBugCheck("KERNEL_SECURITY_CHECK_FAILURE", "corrupted list entry 0x%p.", (PVOID)Entry);
+}
+
+
+//
+// IRQL and spin locks.
+//
+
+EXTERN_C KIRQL KeGetCurrentIrql(
+	VOID
+) {
+	return KShimpIrql;
+}
+
+_Use_decl_annotations_
+EXTERN_C VOID KeRaiseIrql(
+	_In_  KIRQL  NewIrql,
+	_Out_ PKIRQL OldIrql
+) {
+	if (NewIrql < KShimpIrql)
+		KShimpBugCheck("IRQL_NOT_GREATER_OR_EQUAL", "raising IRQL from %u to %u.", KShimpIrql, NewIrql);
+	*OldIrql   = KShimpIrql;
+	KShimpIrql = NewIrql;
+}
+
+_Use_decl_annotations_
+EXTERN_C VOID KeLowerIrql(
+	_In_ KIRQL NewIrql
+) {
+	if (NewIrql > KShimpIrql)
+		KShimpBugCheck("IRQL_NOT_LESS_OR_EQUAL", "lowering IRQL from %u to %u.", KShimpIrql, NewIrql);
+	KShimpIrql = NewIrql;
+}
+
+_Use_decl_annotations_
+EXTERN_C VOID KeInitializeSpinLock(
+	_Out_ PKSPIN_LOCK SpinLock
+) {
+	*SpinLock = 0x00;
+}
+
+_Use_decl_annotations_
+EXTERN_C BOOLEAN KeTryToAcquireSpinLockAtDpcLevel(
+	_Inout_ PKSPIN_LOCK SpinLock
+) {
+	if (KShimpIrql < DISPATCH_LEVEL)
+		KShimpBugCheck("IRQL_NOT_GREATER_OR_EQUAL", "spin lock 0x%p acquired at IRQL %u.", (PVOID)SpinLock, KShimpIrql);
+
+	return __atomic_load_n(SpinLock, __ATOMIC_RELAXED) == 0x00
+		&& __atomic_exchange_n(SpinLock, 0x01, __ATOMIC_ACQUIRE) == 0x00;
+}
+
+_Use_decl_annotations_
+EXTERN_C VOID KeAcquireSpinLockAtDpcLevel(
+	_Inout_ PKSPIN_LOCK SpinLock
+) {
+	for (ULONG Spins = 0x00; !KeTryToAcquireSpinLockAtDpcLevel(SpinLock); Spins++) {
+		if (Spins >= KSHIMP_SPIN_COUNT)
+			sched_yield();
+	}
+}
+
+_Use_decl_annotations_
+EXTERN_C VOID KeReleaseSpinLockFromDpcLevel(
+	_Inout_ PKSPIN_LOCK SpinLock
+) {
+	if (__atomic_load_n(SpinLock, __ATOMIC_RELAXED) == 0x00)
+		KShimpBugCheck("SPIN_LOCK_NOT_OWNED", "spin lock 0x%p released but not acquired.", (PVOID)SpinLock);
+	__atomic_store_n(SpinLock, 0x00, __ATOMIC_RELEASE);
+}
+
+_Use_decl_annotations_
+EXTERN_C KIRQL KeAcquireSpinLockRaiseToDpc(
+	_Inout_ PKSPIN_LOCK SpinLock
+) {
+	KIRQL OldIrql = PASSIVE_LEVEL;
+	KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
+	KeAcquireSpinLockAtDpcLevel(SpinLock);
+	return OldIrql;
+}
+
+_Use_decl_annotations_
+EXTERN_C VOID KeReleaseSpinLock(
+	_Inout_ PKSPIN_LOCK SpinLock,
+	_In_    KIRQL       NewIrql
+) {
+	KeReleaseSpinLockFromDpcLevel(SpinLock);
+	KeLowerIrql(NewIrql);
+}
+
+
+//
+// Pool allocations and lookaside lists.
+//
+
+_Use_decl_annotations_
+EXTERN_C PVOID ExAllocatePool2(
+	_In_ POOL_FLAGS Flags,
+	_In_ SIZE_T     NumberOfBytes,
+	_In_ ULONG      Tag
+) {
+	BOOLEAN Paged = (Flags & POOL_FLAG_PAGED) != 0x00;
+	if (Paged == ((Flags & POOL_FLAG_NON_PAGED) != 0x00) || Tag == 0x00)
+		KShimpBugCheck("BAD_POOL_CALLER", "allocation with flags 0x%llx and tag 0x%08x.", (unsigned long long)Flags, Tag);
+	KShimpCheckIrql(Paged ? APC_LEVEL : DISPATCH_LEVEL, "ExAllocatePool2");
+
+	ULONG Period = __atomic_load_n(&KShimpFailurePeriod, __ATOMIC_RELAXED);
+	if (Period != 0x00 && (__atomic_add_fetch(&KShimpFailureCount, 0x01, __ATOMIC_RELAXED) % Period) == 0x00)
+		return NULL;
+
+	// The header is just before the allocation, which is aligned on 16 bytes or on a cache line.
+	SIZE_T Alignment = (Flags & POOL_FLAG_CACHE_ALIGNED) ? 0x40 : 0x10;
+	PUCHAR Block     = NULL;
+	if (NumberOfBytes > ((SIZE_T)-1) - Alignment || posix_memalign((PVOID*)&Block, Alignment, Alignment + NumberOfBytes) != 0x00)
+		return NULL;
+
+	PUCHAR              Allocation = Block + Alignment;
+	PKSHIMP_POOL_HEADER Header     = (PKSHIMP_POOL_HEADER)Allocation - 1;
+	Header->Tag    = Tag;
+	Header->Offset = (ULONG)Alignment;
+	Header->Size   = NumberOfBytes;
+
+	if (Flags & POOL_FLAG_UNINITIALIZED)
+		memset(Allocation, KSHIMP_POOL_PATTERN, NumberOfBytes);
+	else
+		memset(Allocation, 0x00, NumberOfBytes);
+
+	__atomic_add_fetch(&KShimpPoolAllocations, 0x01, __ATOMIC_RELAXED);
+	return Allocation;
+}
+
+_Use_decl_annotations_
+EXTERN_C VOID ExFreePoolWithTag(
+	_In_ PVOID P,
+	_In_ ULONG Tag
+) {
+	if (P == NULL)
+		KShimpBugCheck("BAD_POOL_CALLER", "NULL freed with tag 0x%08x.", Tag);
+	KShimpCheckIrql(DISPATCH_LEVEL, "ExFreePoolWithTag");
+
+	PKSHIMP_POOL_HEADER Header = (PKSHIMP_POOL_HEADER)P - 1;
+	if (Header->Tag != Tag)
+		KShimpBugCheck("BAD_POOL_CALLER", "0x%p freed with tag 0x%08x, allocated with tag 0x%08x.", P, Tag, Header->Tag);
+
+	Header->Tag = 0x00;
+	__atomic_sub_fetch(&KShimpPoolAllocations, 0x01, __ATOMIC_RELAXED);
+	free((PUCHAR)P - Header->Offset);
+}
+
+/// <summary>
+/// Default allocation routine of the lookaside lists.
+/// </summary>
+static PVOID KShimpAllocateLookasideEntry(
+	_In_    POOL_TYPE          PoolType,
+	_In_    SIZE_T             NumberOfBytes,
+	_In_    ULONG              Tag,
+	_Inout_ PLOOKASIDE_LIST_EX Lookaside
+) {
+	UNREFERENCED_PARAMETER(Lookaside);
+	POOL_FLAGS Flags = (PoolType & PagedPool) ? POOL_FLAG_PAGED : POOL_FLAG_NON_PAGED;
+	return ExAllocatePool2(Flags | POOL_FLAG_UNINITIALIZED, NumberOfBytes, Tag);
+}
+
+/// <summary>
+/// Default free routine of the lookaside lists.
+/// </summary>
+static VOID KShimpFreeLookasideEntry(
+	_In_    PVOID              Buffer,
+	_Inout_ PLOOKASIDE_LIST_EX Lookaside
+) {
+	ExFreePoolWithTag(Buffer, Lookaside->Tag);
+}
+
+_Use_decl_annotations_
+EXTERN_C NTSTATUS ExInitializeLookasideListEx(
+	_Out_    PLOOKASIDE_LIST_EX    Lookaside,
+	_In_opt_ PALLOCATE_FUNCTION_EX Allocate,
+	_In_opt_ PFREE_FUNCTION_EX     Free,
+	_In_     POOL_TYPE             PoolType,
+	_In_     ULONG                 Flags,
+	_In_     SIZE_T                Size,
+	_In_     ULONG                 Tag,
+	_In_     USHORT                Depth
+) {
+	UNREFERENCED_PARAMETER(Flags);
+	UNREFERENCED_PARAMETER(Depth);
+	KShimpCheckIrql(DISPATCH_LEVEL, "ExInitializeLookasideListEx");
+
+	if (Size < sizeof(SINGLE_LIST_ENTRY) || Size > (ULONG)-1)
+		return STATUS_INVALID_PARAMETER;
+
+	KeInitializeSpinLock(&Lookaside->Lock);
+	Lookaside->ListHead.Next   = NULL;
+	Lookaside->Depth           = KSHIMP_LOOKASIDE_DEPTH;
+	Lookaside->Count           = 0x00;
+	Lookaside->Type            = PoolType;
+	Lookaside->Tag             = Tag;
+	Lookaside->Size            = (ULONG)Size;
+	Lookaside->Allocate        = Allocate != NULL ? Allocate : KShimpAllocateLookasideEntry;
+	Lookaside->Free            = Free != NULL ? Free : KShimpFreeLookasideEntry;
+	Lookaside->TotalAllocates  = 0x00;
+	Lookaside->AllocateHits    = 0x00;
+	return STATUS_SUCCESS;
+}
+
+_Use_decl_annotations_
+EXTERN_C VOID ExDeleteLookasideListEx(
+	_Inout_ PLOOKASIDE_LIST_EX Lookaside
+) {
+	KShimpCheckIrql(DISPATCH_LEVEL, "ExDeleteLookasideListEx");
+
+	PSINGLE_LIST_ENTRY Entry = NULL;
+	while ((Entry = PopEntryList(&Lookaside->ListHead)) != NULL) {
+		KSHIMP_UNPOISON(Entry, Lookaside->Size);
+		Lookaside->Free(Entry, Lookaside);
+	}
+	Lookaside->Count = 0x00;
+}
+
+_Use_decl_annotations_
+EXTERN_C PVOID ExAllocateFromLookasideListEx(
+	_Inout_ PLOOKASIDE_LIST_EX Lookaside
+) {
+	KShimpCheckIrql((Lookaside->Type & PagedPool) ? APC_LEVEL : DISPATCH_LEVEL, "ExAllocateFromLookasideListEx");
+
+	KIRQL OldIrql = PASSIVE_LEVEL;
+	KeAcquireSpinLock(&Lookaside->Lock, &OldIrql);
+	PSINGLE_LIST_ENTRY Entry = PopEntryList(&Lookaside->ListHead);
+	Lookaside->TotalAllocates++;
+	if (Entry != NULL) {
+		Lookaside->Count--;
+		Lookaside->AllocateHits++;
+	}
+	KeReleaseSpinLock(&Lookaside->Lock, OldIrql);
+
+	if (Entry == NULL)
+		return Lookaside->Allocate(Lookaside->Type, Lookaside->Size, Lookaside->Tag, Lookaside);
+	KSHIMP_UNPOISON(Entry + 1, Lookaside->Size - sizeof(SINGLE_LIST_ENTRY));
+	return Entry;
+}
+
+_Use_decl_annotations_
+EXTERN_C VOID ExFreeToLookasideListEx(
+	_Inout_ PLOOKASIDE_LIST_EX Lookaside,
+	_In_    PVOID              Entry
+) {
+	KShimpCheckIrql((Lookaside->Type & PagedPool) ? APC_LEVEL : DISPATCH_LEVEL, "ExFreeToLookasideListEx");
+
+	// Everything but the link is poisoned while in the list
+	KIRQL OldIrql = PASSIVE_LEVEL;
+	KeAcquireSpinLock(&Lookaside->Lock, &OldIrql);
+	if (Lookaside->Count < Lookaside->Depth) {
+		PushEntryList(&Lookaside->ListHead, (PSINGLE_LIST_ENTRY)Entry);
+		Lookaside->Count++;
+		KSHIMP_POISON((PSINGLE_LIST_ENTRY)Entry + 1, Lookaside->Size - sizeof(SINGLE_LIST_ENTRY));
+		Entry = NULL;
+	}
+	KeReleaseSpinLock(&Lookaside->Lock, OldIrql);
+
+	if (Entry != NULL)
+		Lookaside->Free(Entry, Lookaside);
+}
+
+
+//
+// Unicode strings.
+//
+
+_Use_decl_annotations_
+EXTERN_C VOID RtlInitUnicodeString(
+	_Out_    PUNICODE_STRING DestinationString,
+	_In_opt_ PCWSTR          SourceString
+) {
+	DestinationString->Length        = 0x00;
+	DestinationString->MaximumLength = 0x00;
+	DestinationString->Buffer        = (PWCH)SourceString;
+	if (SourceString == NULL)
+		return;
+
+	SIZE_T Length = wcslen(SourceString) * sizeof(WCHAR);
+	if (Length > 0xFFFF - sizeof(WCHAR))
+		Length = (0xFFFF - sizeof(WCHAR)) & ~(sizeof(WCHAR) - 1);
+	DestinationString->Length        = (USHORT)Length;
+	DestinationString->MaximumLength = (USHORT)(Length + sizeof(WCHAR));
+}
+
+_Use_decl_annotations_
+EXTERN_C NTSTATUS RtlUnicodeStringInit(
+	_Out_    PUNICODE_STRING DestinationString,
+	_In_opt_ PCWSTR          SourceString
+) {
+	DestinationString->Length        = 0x00;
+	DestinationString->MaximumLength = 0x00;
+	DestinationString->Buffer        = (PWCH)SourceString;
+	if (SourceString == NULL)
+		return STATUS_SUCCESS;
+
+	SIZE_T Length = wcslen(SourceString) * sizeof(WCHAR);
+	if (Length > 0xFFFF - sizeof(WCHAR))
+		return STATUS_INVALID_PARAMETER;
+	DestinationString->Length        = (USHORT)Length;
+	DestinationString->MaximumLength = (USHORT)(Length + sizeof(WCHAR));
+	return STATUS_SUCCESS;
+}
+
+_Use_decl_annotations_
+EXTERN_C BOOLEAN RtlEqualUnicodeString(
+	_In_ PCUNICODE_STRING String1,
+	_In_ PCUNICODE_STRING String2,
+	_In_ BOOLEAN          CaseInSensitive
+) {
+	if (String1->Length != String2->Length)
+		return FALSE;
+
+	SIZE_T Length = String1->Length / sizeof(WCHAR);
+	if (!CaseInSensitive)
+		return wmemcmp(String1->Buffer, String2->Buffer, Length) == 0x00;
+
+	for (SIZE_T cx = 0x00; cx < Length; cx++) {
+		if (towupper((wint_t)String1->Buffer[cx]) != towupper((wint_t)String2->Buffer[cx]))
+			return FALSE;
+	}
+	return TRUE;
+}
+
+_Use_decl_annotations_
+EXTERN_C INT swprintf_s(
+	_Out_writes_(SizeInWords) PWCHAR Buffer,
+	_In_                      SIZE_T SizeInWords,
+	_In_                      PCWSTR Format,
+	...
+) {
+	if (Buffer == NULL || SizeInWords == 0x00 || Format == NULL)
+		KShimpBugCheck("INVALID_PARAMETER", "swprintf_s called with an invalid parameter.");
+
+	// Strings of the C runtime: wide with %s and %ls, narrow with %S and %hs.
+	WCHAR  Converted[KSHIMP_MAXIMUM_FORMAT];
+	SIZE_T Length = 0x00;
+	for (PCWSTR Current = Format; *Current != L'\0'; Current++) {
+		if (Length >= _ARRAYSIZE(Converted) - 0x03)
+			KShimpBugCheck("INVALID_PARAMETER", "swprintf_s format too long.");
+		Converted[Length++] = *Current;
+		if (*Current != L'%')
+			continue;
+
+		// Flags, width and precision
+		while (Current[1] != L'\0' && wcschr(L"-+ #0123456789.*", Current[1]) != NULL && Length < _ARRAYSIZE(Converted) - 0x03)
+			Converted[Length++] = *++Current;
+
+		if (Current[1] == L's') {
+			Converted[Length++] = L'l';
+			Converted[Length++] = *++Current;
+		}
+		else if (Current[1] == L'S') {
+			Converted[Length++] = L's';
+			Current++;
+		}
+		else if (Current[1] == L'h' && Current[2] == L's') {
+			Converted[Length++] = L's';
+			Current += 0x02;
+		}
+		else if (Current[1] == L'%') {
+			Converted[Length++] = *++Current;
+		}
+	}
+	Converted[Length] = L'\0';
+
+	va_list Arguments;
+	va_start(Arguments, Format);
+	INT Result = vswprintf(Buffer, SizeInWords, Converted, Arguments);
+	va_end(Arguments);
+
+	if (Result < 0x00) {
+		Buffer[0x00] = L'\0';
+		KShimpBugCheck("INVALID_PARAMETER", "swprintf_s buffer of %zu characters too small.", SizeInWords);
+	}
+	return Result;
+}
+
+
+//
+// Registry.
+//
+
+/// <summary>
+/// Allocate a registry key, with its name.
+/// </summary>
+static PKSHIMP_REGISTRY_KEY KShimpAllocateKey(
+	_In_ PCUNICODE_STRING Name
+) {
+	PKSHIMP_REGISTRY_KEY Key = malloc(sizeof(KSHIMP_REGISTRY_KEY) + Name->Length);
+	if (Key == NULL)
+		return NULL;
+
+	Key->Name.Buffer        = (PWCH)(Key + 1);
+	Key->Name.Length        = Name->Length;
+	Key->Name.MaximumLength = Name->Length;
+	if (Name->Length != 0x00)
+		memcpy(Key->Name.Buffer, Name->Buffer, Name->Length);
+
+	InitializeListHead(&Key->List);
+	InitializeListHead(&Key->SubKeys);
+	InitializeListHead(&Key->Values);
+	return Key;
+}
+
+/// <summary>
+/// Free a registry key, its values and its sub-keys.
+/// </summary>
+static VOID KShimpFreeKey(
+	_In_ PKSHIMP_REGISTRY_KEY Key
+) {
+	while (!IsListEmpty(&Key->SubKeys))
+		KShimpFreeKey(CONTAINING_RECORD(RemoveHeadList(&Key->SubKeys), KSHIMP_REGISTRY_KEY, List));
+	while (!IsListEmpty(&Key->Values))
+		free(CONTAINING_RECORD(RemoveHeadList(&Key->Values), KSHIMP_REGISTRY_VALUE, List));
+	free(Key);
+}
+
+/// <summary>
+/// Find a sub-key, case insensitive.
+/// </summary>
+static PKSHIMP_REGISTRY_KEY KShimpFindSubKey(
+	_In_ PKSHIMP_REGISTRY_KEY Key,
+	_In_ PCUNICODE_STRING     Name
+) {
+	for (PLIST_ENTRY Entry = Key->SubKeys.Flink; Entry != &Key->SubKeys; Entry = Entry->Flink) {
+		PKSHIMP_REGISTRY_KEY SubKey = CONTAINING_RECORD(Entry, KSHIMP_REGISTRY_KEY, List);
+		if (RtlEqualUnicodeString(&SubKey->Name, Name, TRUE))
+			return SubKey;
+	}
+	return NULL;
+}
+
+/// <summary>
+/// Find a value, case insensitive.
+/// </summary>
+static PKSHIMP_REGISTRY_VALUE KShimpFindValue(
+	_In_     PKSHIMP_REGISTRY_KEY Key,
+	_In_opt_ PCUNICODE_STRING     Name
+) {
+	UNICODE_STRING Default = { 0x00 };
+	if (Name == NULL)
+		Name = &Default;
+
+	for (PLIST_ENTRY Entry = Key->Values.Flink; Entry != &Key->Values; Entry = Entry->Flink) {
+		PKSHIMP_REGISTRY_VALUE Value = CONTAINING_RECORD(Entry, KSHIMP_REGISTRY_VALUE, List);
+		if (RtlEqualUnicodeString(&Value->Name, Name, TRUE))
+			return Value;
+	}
+	return NULL;
+}
+
+/// <summary>
+/// Create a sub-key, or get it if it already exists.
+/// </summary>
+static PKSHIMP_REGISTRY_KEY KShimpCreateSubKey(
+	_In_  PKSHIMP_REGISTRY_KEY Key,
+	_In_  PCUNICODE_STRING     Name,
+	_Out_ PBOOLEAN             Created
+) {
+	*Created = FALSE;
+	PKSHIMP_REGISTRY_KEY SubKey = KShimpFindSubKey(Key, Name);
+	if (SubKey != NULL)
+		return SubKey;
+
+	SubKey = KShimpAllocateKey(Name);
+	if (SubKey != NULL) {
+		InsertTailList(&Key->SubKeys, &SubKey->List);
+		*Created = TRUE;
+	}
+	return SubKey;
+}
+
+/// <summary>
+/// Root of the registry, created with the hives on first use. The lock must be held.
+/// </summary>
+static PKSHIMP_REGISTRY_KEY KShimpGetRegistryRoot(
+	VOID
+) {
+	if (KShimpRegistryRoot != NULL)
+		return KShimpRegistryRoot;
+
+	UNICODE_STRING Root     = { 0x00 };
+	UNICODE_STRING Registry = RTL_CONSTANT_STRING(L"Registry");
+	UNICODE_STRING Machine  = RTL_CONSTANT_STRING(L"Machine");
+	UNICODE_STRING User     = RTL_CONSTANT_STRING(L"User");
+	UNICODE_STRING Software = RTL_CONSTANT_STRING(L"SOFTWARE");
+	UNICODE_STRING System   = RTL_CONSTANT_STRING(L"SYSTEM");
+
+	BOOLEAN              Created = FALSE;
+	PKSHIMP_REGISTRY_KEY Key     = KShimpAllocateKey(&Root);
+	if (Key == NULL)
+		KShimpBugCheck("REGISTRY_ERROR", "unable to create the registry.");
+
+	PKSHIMP_REGISTRY_KEY RegistryKey = KShimpCreateSubKey(Key, &Registry, &Created);
+	PKSHIMP_REGISTRY_KEY MachineKey  = RegistryKey != NULL ? KShimpCreateSubKey(RegistryKey, &Machine, &Created) : NULL;
+	if (RegistryKey == NULL
+		|| MachineKey == NULL
+		|| KShimpCreateSubKey(RegistryKey, &User, &Created) == NULL
+		|| KShimpCreateSubKey(MachineKey, &Software, &Created) == NULL
+		|| KShimpCreateSubKey(MachineKey, &System, &Created) == NULL)
+		KShimpBugCheck("REGISTRY_ERROR", "unable to create the hives.");
+
+	KShimpRegistryRoot = Key;
+	return Key;
+}
+
+/// <summary>
+/// Get the key of a handle. The lock must be held.
+/// </summary>
+static PKSHIMP_REGISTRY_KEY KShimpReferenceHandle(
+	_In_opt_ HANDLE Handle
+) {
+	for (PLIST_ENTRY Entry = KShimpHandles.Flink; Entry != &KShimpHandles; Entry = Entry->Flink) {
+		PKSHIMP_HANDLE Current = CONTAINING_RECORD(Entry, KSHIMP_HANDLE, List);
+		if ((HANDLE)Current == Handle && Current->Signature == KSHIMP_HANDLE_SIGNATURE)
+			return Current->Key;
+	}
+	return NULL;
+}
+
+/// <summary>
+/// Open a key, or create the last key of the path. The lock must be held.
+/// </summary>
+static NTSTATUS KShimpOpenKey(
+	_Out_     PHANDLE            KeyHandle,
+	_In_      POBJECT_ATTRIBUTES ObjectAttributes,
+	_In_      BOOLEAN            Create,
+	_Out_opt_ PULONG             Disposition
+) {
+	*KeyHandle = NULL;
+	if (ObjectAttributes == NULL || ObjectAttributes->ObjectName == NULL)
+		return STATUS_INVALID_PARAMETER;
+
+	PCUNICODE_STRING     Path   = ObjectAttributes->ObjectName;
+	SIZE_T               Length = Path->Length / sizeof(WCHAR);
+	SIZE_T               Start  = 0x00;
+	PKSHIMP_REGISTRY_KEY Key    = NULL;
+
+	// Absolute path, or relative to an opened key
+	if (ObjectAttributes->RootDirectory == NULL) {
+		if (Length == 0x00 || Path->Buffer[0x00] != L'\\')
+			return STATUS_OBJECT_NAME_INVALID;
+		Key   = KShimpGetRegistryRoot();
+		Start = 0x01;
+	}
+	else {
+		Key = KShimpReferenceHandle(ObjectAttributes->RootDirectory);
+		if (Key == NULL)
+			return STATUS_INVALID_HANDLE;
+	}
+
+	ULONG Result = REG_OPENED_EXISTING_KEY;
+	while (Start < Length) {
+		SIZE_T End = Start;
+		while (End < Length && Path->Buffer[End] != L'\\')
+			End++;
+		if (End == Start || (End == Length - 0x01 && Path->Buffer[End] == L'\\'))
+			return STATUS_OBJECT_NAME_INVALID;
+
+		UNICODE_STRING Name = { 0x00 };
+		Name.Buffer        = &Path->Buffer[Start];
+		Name.Length        = (USHORT)((End - Start) * sizeof(WCHAR));
+		Name.MaximumLength = Name.Length;
+
+		// Only the last key of the path is created
+		PKSHIMP_REGISTRY_KEY SubKey = KShimpFindSubKey(Key, &Name);
+		if (SubKey == NULL) {
+			if (!Create || End != Length)
+				return STATUS_OBJECT_NAME_NOT_FOUND;
+
+			BOOLEAN Created = FALSE;
+			SubKey = KShimpCreateSubKey(Key, &Name, &Created);
+			if (SubKey == NULL)
+				return STATUS_INSUFFICIENT_RESOURCES;
+			Result = REG_CREATED_NEW_KEY;
+		}
+		Key   = SubKey;
+		Start = End + 0x01;
+	}
+
+	PKSHIMP_HANDLE Handle = malloc(sizeof(KSHIMP_HANDLE));
+	if (Handle == NULL)
+		return STATUS_INSUFFICIENT_RESOURCES;
+	Handle->Signature = KSHIMP_HANDLE_SIGNATURE;
+	Handle->Key       = Key;
+	InsertTailList(&KShimpHandles, &Handle->List);
+	KShimpOpenHandles++;
+
+	*KeyHandle = (HANDLE)Handle;
+	if (Disposition != NULL)
+		*Disposition = Result;
+	return STATUS_SUCCESS;
+}
+
+_Use_decl_annotations_
+EXTERN_C NTSTATUS ZwCreateKey(
+	_Out_      PHANDLE            KeyHandle,
+	_In_       ACCESS_MASK        DesiredAccess,
+	_In_       POBJECT_ATTRIBUTES ObjectAttributes,
+	_Reserved_ ULONG              TitleIndex,
+	_In_opt_   PUNICODE_STRING    Class,
+	_In_       ULONG              CreateOptions,
+	_Out_opt_  PULONG             Disposition
+) {
+	UNREFERENCED_PARAMETER(DesiredAccess);
+	UNREFERENCED_PARAMETER(TitleIndex);
+	UNREFERENCED_PARAMETER(Class);
+	UNREFERENCED_PARAMETER(CreateOptions);
+	KShimpCheckIrql(PASSIVE_LEVEL, "ZwCreateKey");
+
+	pthread_mutex_lock(&KShimpLock);
+	NTSTATUS Status = KShimpOpenKey(KeyHandle, ObjectAttributes, TRUE, Disposition);
+	pthread_mutex_unlock(&KShimpLock);
+	return Status;
+}
+
+_Use_decl_annotations_
+EXTERN_C NTSTATUS ZwOpenKey(
+	_Out_ PHANDLE            KeyHandle,
+	_In_  ACCESS_MASK        DesiredAccess,
+	_In_  POBJECT_ATTRIBUTES ObjectAttributes
+) {
+	UNREFERENCED_PARAMETER(DesiredAccess);
+	KShimpCheckIrql(PASSIVE_LEVEL, "ZwOpenKey");
+
+	pthread_mutex_lock(&KShimpLock);
+	NTSTATUS Status = KShimpOpenKey(KeyHandle, ObjectAttributes, FALSE, NULL);
+	pthread_mutex_unlock(&KShimpLock);
+	return Status;
+}
+
+_Use_decl_annotations_
+EXTERN_C NTSTATUS ZwSetValueKey(
+	_In_       HANDLE          KeyHandle,
+	_In_       PUNICODE_STRING ValueName,
+	_In_opt_   ULONG           TitleIndex,
+	_In_       ULONG           Type,
+	_In_reads_bytes_opt_(DataSize) PVOID Data,
+	_In_       ULONG           DataSize
+) {
+	UNREFERENCED_PARAMETER(TitleIndex);
+	KShimpCheckIrql(PASSIVE_LEVEL, "ZwSetValueKey");
+	if (Data == NULL && DataSize != 0x00)
+		return STATUS_INVALID_PARAMETER;
+
+	USHORT NameLength = ValueName != NULL ? ValueName->Length : 0x00;
+	PKSHIMP_REGISTRY_VALUE Value = malloc(sizeof(KSHIMP_REGISTRY_VALUE) + NameLength + DataSize);
+	if (Value == NULL)
+		return STATUS_INSUFFICIENT_RESOURCES;
+
+	Value->Name.Buffer        = (PWCH)(Value + 1);
+	Value->Name.Length        = NameLength;
+	Value->Name.MaximumLength = NameLength;
+	Value->Type               = Type;
+	Value->DataLength         = DataSize;
+	Value->Data               = (PUCHAR)(Value + 1) + NameLength;
+	if (NameLength != 0x00)
+		memcpy(Value->Name.Buffer, ValueName->Buffer, NameLength);
+	if (DataSize != 0x00)
+		memcpy(Value->Data, Data, DataSize);
+
+	pthread_mutex_lock(&KShimpLock);
+	PKSHIMP_REGISTRY_KEY Key = KShimpReferenceHandle(KeyHandle);
+	if (Key == NULL) {
+		pthread_mutex_unlock(&KShimpLock);
+		free(Value);
+		return STATUS_INVALID_HANDLE;
+	}
+
+	// Replace the previous value
+	PKSHIMP_REGISTRY_VALUE Previous = KShimpFindValue(Key, ValueName);
+	if (Previous != NULL)
+		RemoveEntryList(&Previous->List);
+	InsertTailList(&Key->Values, &Value->List);
+	pthread_mutex_unlock(&KShimpLock);
+
+	free(Previous);
+	return STATUS_SUCCESS;
+}
+
+_Use_decl_annotations_
+EXTERN_C NTSTATUS ZwQueryValueKey(
+	_In_  HANDLE                      KeyHandle,
+	_In_  PUNICODE_STRING             ValueName,
+	_In_  KEY_VALUE_INFORMATION_CLASS KeyValueInformationClass,
+	_Out_writes_bytes_opt_(Length) PVOID KeyValueInformation,
+	_In_  ULONG                       Length,
+	_Out_ PULONG                      ResultLength
+) {
+	KShimpCheckIrql(PASSIVE_LEVEL, "ZwQueryValueKey");
+	*ResultLength = 0x00;
+	if (KeyValueInformationClass != KeyValuePartialInformation)
+		return STATUS_INVALID_INFO_CLASS;
+
+	pthread_mutex_lock(&KShimpLock);
+	NTSTATUS             Status = STATUS_SUCCESS;
+	PKSHIMP_REGISTRY_KEY Key    = KShimpReferenceHandle(KeyHandle);
+	if (Key == NULL) {
+		Status = STATUS_INVALID_HANDLE;
+		goto exit;
+	}
+	PKSHIMP_REGISTRY_VALUE Value = KShimpFindValue(Key, ValueName);
+	if (Value == NULL) {
+		Status = STATUS_OBJECT_NAME_NOT_FOUND;
+		goto exit;
+	}
+
+	// The fixed part is returned if the data does not fit
+	*ResultLength = FIELD_OFFSET(KEY_VALUE_PARTIAL_INFORMATION, Data) + Value->DataLength;
+	if (KeyValueInformation == NULL || Length < (ULONG)FIELD_OFFSET(KEY_VALUE_PARTIAL_INFORMATION, Data)) {
+		Status = STATUS_BUFFER_TOO_SMALL;
+		goto exit;
+	}
+	PKEY_VALUE_PARTIAL_INFORMATION Information = (PKEY_VALUE_PARTIAL_INFORMATION)KeyValueInformation;
+	Information->TitleIndex = 0x00;
+	Information->Type       = Value->Type;
+	Information->DataLength = Value->DataLength;
+	if (Length < *ResultLength) {
+		Status = STATUS_BUFFER_OVERFLOW;
+		goto exit;
+	}
+	memcpy(Information->Data, Value->Data, Value->DataLength);
+
+exit:
+	pthread_mutex_unlock(&KShimpLock);
+	return Status;
+}
+
+_Use_decl_annotations_
+EXTERN_C NTSTATUS ZwEnumerateKey(
+	_In_  HANDLE                KeyHandle,
+	_In_  ULONG                 Index,
+	_In_  KEY_INFORMATION_CLASS KeyInformationClass,
+	_Out_writes_bytes_opt_(Length) PVOID KeyInformation,
+	_In_  ULONG                 Length,
+	_Out_ PULONG                ResultLength
+) {
+	KShimpCheckIrql(PASSIVE_LEVEL, "ZwEnumerateKey");
+	*ResultLength = 0x00;
+	if (KeyInformationClass != KeyBasicInformation)
+		return STATUS_INVALID_INFO_CLASS;
+
+	pthread_mutex_lock(&KShimpLock);
+	NTSTATUS             Status = STATUS_NO_MORE_ENTRIES;
+	PKSHIMP_REGISTRY_KEY Key    = KShimpReferenceHandle(KeyHandle);
+	if (Key == NULL) {
+		Status = STATUS_INVALID_HANDLE;
+		goto exit;
+	}
+
+	PLIST_ENTRY Entry = Key->SubKeys.Flink;
+	for (ULONG cx = 0x00; cx < Index && Entry != &Key->SubKeys; cx++)
+		Entry = Entry->Flink;
+	if (Entry == &Key->SubKeys)
+		goto exit;
+	PKSHIMP_REGISTRY_KEY SubKey = CONTAINING_RECORD(Entry, KSHIMP_REGISTRY_KEY, List);
+
+	// The name is not NULL terminated, the fixed part is returned if it does not fit
+	*ResultLength = FIELD_OFFSET(KEY_BASIC_INFORMATION, Name) + SubKey->Name.Length;
+	if (KeyInformation == NULL || Length < (ULONG)FIELD_OFFSET(KEY_BASIC_INFORMATION, Name)) {
+		Status = STATUS_BUFFER_TOO_SMALL;
+		goto exit;
+	}
+	PKEY_BASIC_INFORMATION Information = (PKEY_BASIC_INFORMATION)KeyInformation;
+	Information->LastWriteTime.QuadPart = 0x00;
+	Information->TitleIndex             = 0x00;
+	Information->NameLength             = SubKey->Name.Length;
+	if (Length < *ResultLength) {
+		Status = STATUS_BUFFER_OVERFLOW;
+		goto exit;
+	}
+	memcpy(Information->Name, SubKey->Name.Buffer, SubKey->Name.Length);
+	Status = STATUS_SUCCESS;
+
+exit:
+	pthread_mutex_unlock(&KShimpLock);
+	return Status;
+}
+
+_Use_decl_annotations_
+EXTERN_C NTSTATUS ZwClose(
+	_In_ HANDLE Handle
+) {
+	KShimpCheckIrql(PASSIVE_LEVEL, "ZwClose");
+
+	pthread_mutex_lock(&KShimpLock);
+	if (KShimpReferenceHandle(Handle) == NULL) {
+		pthread_mutex_unlock(&KShimpLock);
+		return STATUS_INVALID_HANDLE;
+	}
+
+	PKSHIMP_HANDLE Current = (PKSHIMP_HANDLE)Handle;
+	RemoveEntryList(&Current->List);
+	Current->Signature = 0x00;
+	KShimpOpenHandles--;
+	pthread_mutex_unlock(&KShimpLock);
+
+	free(Current);
+	return STATUS_SUCCESS;
+}
+
+
+//
+// Loaded modules.
+//
+
+EXTERN_C NTSTATUS AuxKlibInitialize(
+	VOID
+) {
+	KShimpCheckIrql(PASSIVE_LEVEL, "AuxKlibInitialize");
+	KShimpAuxKlibInitialised = TRUE;
+	return STATUS_SUCCESS;
+}
+
+_Use_decl_annotations_
+EXTERN_C NTSTATUS AuxKlibQueryModuleInformation(
+	_In_      PULONG BufferSize,
+	_In_      ULONG  ElementSize,
+	_Out_writes_bytes_opt_(*BufferSize) PVOID QueryInfo
+) {
+	KShimpCheckIrql(PASSIVE_LEVEL, "AuxKlibQueryModuleInformation");
+	if (!KShimpAuxKlibInitialised)
+		return STATUS_UNSUCCESSFUL;
+	if (ElementSize != sizeof(AUX_MODULE_BASIC_INFO) && ElementSize != sizeof(AUX_MODULE_EXTENDED_INFO))
+		return STATUS_INVALID_PARAMETER_2;
+
+	pthread_mutex_lock(&KShimpLock);
+	NTSTATUS Status = STATUS_SUCCESS;
+	ULONG    Size   = KShimpNumberOfModules * ElementSize;
+	if (QueryInfo != NULL) {
+		if (*BufferSize < Size) {
+			Status = STATUS_BUFFER_TOO_SMALL;
+		}
+		else {
+			memset(QueryInfo, 0x00, Size);
+			for (ULONG cx = 0x00; cx < KShimpNumberOfModules; cx++) {
+				PAUX_MODULE_EXTENDED_INFO Information = (PAUX_MODULE_EXTENDED_INFO)((PUCHAR)QueryInfo + (cx * ElementSize));
+				Information->BasicInfo.ImageBase = KShimpModules[cx].ImageBase;
+				if (ElementSize != sizeof(AUX_MODULE_EXTENDED_INFO))
+					continue;
+
+				Information->ImageSize      = KShimpModules[cx].ImageSize;
+				Information->FileNameOffset = KShimpModules[cx].FileNameOffset;
+				memcpy(Information->FullPathName, KShimpModules[cx].FullPathName, AUX_KLIB_MODULE_PATH_LEN);
+			}
+		}
+	}
+	*BufferSize = Size;
+	pthread_mutex_unlock(&KShimpLock);
+	return Status;
+}
+
+
+//
+// Memory.
+//
+
+/// <summary>
+/// Whether a range is within the image of a loaded module. The lock must be held.
+/// </summary>
+static BOOLEAN KShimpIsKernelRange(
+	_In_ ULONG_PTR Address,
+	_In_ SIZE_T    Size
+) {
+	for (ULONG cx = 0x00; cx < KShimpNumberOfModules; cx++) {
+		ULONG_PTR Base = (ULONG_PTR)KShimpModules[cx].ImageBase;
+		if (Address >= Base && Address - Base <= KShimpModules[cx].ImageSize && Size <= KShimpModules[cx].ImageSize - (Address - Base))
+			return TRUE;
+	}
+	return FALSE;
+}
+
+_Use_decl_annotations_
+EXTERN_C BOOLEAN MmIsAddressValid(
+	_In_ PVOID VirtualAddress
+) {
+	KShimpCheckIrql(DISPATCH_LEVEL, "MmIsAddressValid");
+
+	pthread_mutex_lock(&KShimpLock);
+	BOOLEAN Valid = KShimpIsKernelRange((ULONG_PTR)VirtualAddress, 0x01);
+	pthread_mutex_unlock(&KShimpLock);
+	return Valid;
+}
+
+_Use_decl_annotations_
+EXTERN_C NTSTATUS MmCopyMemory(
+	_In_  PVOID           TargetAddress,
+	_In_  MM_COPY_ADDRESS SourceAddress,
+	_In_  SIZE_T          NumberOfBytes,
+	_In_  ULONG           Flags,
+	_Out_ PSIZE_T         NumberOfBytesTransferred
+) {
+	KShimpCheckIrql(APC_LEVEL, "MmCopyMemory");
+	*NumberOfBytesTransferred = 0x00;
+
+	pthread_mutex_lock(&KShimpLock);
+	CONST VOID* Source = NULL;
+	if (Flags == MM_COPY_MEMORY_PHYSICAL) {
+		ULONG64 Address = (ULONG64)SourceAddress.PhysicalAddress.QuadPart;
+		if (Address <= KShimpPhysicalMemorySize && NumberOfBytes <= KShimpPhysicalMemorySize - Address)
+			Source = KShimpPhysicalMemory + Address;
+	}
+	else if (Flags == MM_COPY_MEMORY_VIRTUAL) {
+		if (KShimpIsKernelRange((ULONG_PTR)SourceAddress.VirtualAddress, NumberOfBytes))
+			Source = SourceAddress.VirtualAddress;
+	}
+	else {
+		pthread_mutex_unlock(&KShimpLock);
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	if (Source != NULL) {
+		memcpy(TargetAddress, Source, NumberOfBytes);
+		*NumberOfBytesTransferred = NumberOfBytes;
+	}
+	pthread_mutex_unlock(&KShimpLock);
+	return Source != NULL ? STATUS_SUCCESS : STATUS_INVALID_ADDRESS;
+}
+
+
+//
+// Debug output.
+//
+
+_Use_decl_annotations_
+EXTERN_C ULONG DbgPrint(
+	_In_ PCSTR Format,
+	...
+) {
+	va_list Arguments;
+	va_start(Arguments, Format);
+	vfprintf(stderr, Format, Arguments);
+	va_end(Arguments);
+	return STATUS_SUCCESS;
+}
+
+
+//
+// Fast mutexes and run-down protection.
+//
+
+_Use_decl_annotations_
+EXTERN_C VOID ExInitializeFastMutex(
+	_Out_ PFAST_MUTEX FastMutex
+) {
+	FastMutex->Count   = 0x00;
+	FastMutex->Owner   = NULL;
+	FastMutex->OldIrql = PASSIVE_LEVEL;
+}
+
+_Use_decl_annotations_
+EXTERN_C VOID ExAcquireFastMutex(
+	_Inout_ PFAST_MUTEX FastMutex
+) {
+	KShimpCheckIrql(APC_LEVEL, "ExAcquireFastMutex");
+	if (__atomic_load_n(&FastMutex->Owner, __ATOMIC_RELAXED) == (PVOID)&KShimpIrql)
+		KShimpBugCheck("MUTEX_ALREADY_OWNED", "fast mutex 0x%p acquired again by its owner.", (PVOID)FastMutex);
+
+	KIRQL OldIrql = PASSIVE_LEVEL;
+	KeRaiseIrql(APC_LEVEL, &OldIrql);
+	for (ULONG Spins = 0x00; __atomic_exchange_n(&FastMutex->Count, 0x01, __ATOMIC_ACQUIRE) != 0x00; Spins++) {
+		if (Spins >= KSHIMP_SPIN_COUNT)
+			sched_yield();
+	}
+	__atomic_store_n(&FastMutex->Owner, (PVOID)&KShimpIrql, __ATOMIC_RELAXED);
+	FastMutex->OldIrql = OldIrql;
+}
+
+_Use_decl_annotations_
+EXTERN_C VOID ExReleaseFastMutex(
+	_Inout_ PFAST_MUTEX FastMutex
+) {
+	if (__atomic_load_n(&FastMutex->Owner, __ATOMIC_RELAXED) != (PVOID)&KShimpIrql)
+		KShimpBugCheck("THREAD_NOT_MUTEX_OWNER", "fast mutex 0x%p released but not acquired.", (PVOID)FastMutex);
+
+	KIRQL OldIrql = FastMutex->OldIrql;
+	__atomic_store_n(&FastMutex->Owner, NULL, __ATOMIC_RELAXED);
+	__atomic_store_n(&FastMutex->Count, 0x00, __ATOMIC_RELEASE);
+	KeLowerIrql(OldIrql);
+}
+
+_Use_decl_annotations_
+EXTERN_C VOID ExInitializeRundownProtection(
+	_Out_ PEX_RUNDOWN_REF RunRef
+) {
+	RunRef->Count = 0x00;
+}
+
+_Use_decl_annotations_
+EXTERN_C BOOLEAN ExAcquireRundownProtection(
+	_Inout_ PEX_RUNDOWN_REF RunRef
+) {
+	ULONG_PTR Count = __atomic_load_n(&RunRef->Count, __ATOMIC_RELAXED);
+	do {
+		if (Count & KSHIMP_RUNDOWN_ACTIVE)
+			return FALSE;
+	} while (!__atomic_compare_exchange_n(&RunRef->Count, &Count, Count + KSHIMP_RUNDOWN_INCREMENT, 0x00, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+	return TRUE;
+}
+
+_Use_decl_annotations_
+EXTERN_C VOID ExReleaseRundownProtection(
+	_Inout_ PEX_RUNDOWN_REF RunRef
+) {
+	ULONG_PTR Count = __atomic_fetch_sub(&RunRef->Count, KSHIMP_RUNDOWN_INCREMENT, __ATOMIC_RELEASE);
+	if (Count < KSHIMP_RUNDOWN_INCREMENT)
+		KShimpBugCheck("KERNEL_SECURITY_CHECK_FAILURE", "run-down protection 0x%p released but not acquired.", (PVOID)RunRef);
+}
+
+_Use_decl_annotations_
+EXTERN_C VOID ExWaitForRundownProtectionRelease(
+	_Inout_ PEX_RUNDOWN_REF RunRef
+) {
+	KShimpCheckIrql(APC_LEVEL, "ExWaitForRundownProtectionRelease");
+
+	__atomic_fetch_or(&RunRef->Count, KSHIMP_RUNDOWN_ACTIVE, __ATOMIC_RELAXED);
+	while (__atomic_load_n(&RunRef->Count, __ATOMIC_ACQUIRE) != KSHIMP_RUNDOWN_ACTIVE)
+		sched_yield();
+}
+
+
+//
+// Work items.
+//
+
+/// <summary>
+/// System thread running the routine of a work item, which is not queued anymore once started.
+/// </summary>
+static PVOID KShimpWorkerThread(
+	_In_ PVOID Parameter
+) {
+	PIO_WORKITEM         IoWorkItem   = (PIO_WORKITEM)Parameter;
+	PDEVICE_OBJECT       DeviceObject = IoWorkItem->DeviceObject;
+	PIO_WORKITEM_ROUTINE Routine      = IoWorkItem->Routine;
+	PVOID                Context      = IoWorkItem->Context;
+	__atomic_store_n(&IoWorkItem->Queued, FALSE, __ATOMIC_RELEASE);
+
+	Routine(DeviceObject, Context);
+	if (KShimpIrql != PASSIVE_LEVEL)
+		KShimpBugCheck("WORKER_THREAD_RETURNED_AT_BAD_IRQL", "work item routine 0x%p returned at IRQL %u.", (PVOID)(ULONG_PTR)Routine, KShimpIrql);
+	if (KShimpAttachedProcess != NULL)
+		KShimpBugCheck("INVALID_PROCESS_ATTACH_ATTEMPT", "work item routine 0x%p returned attached to 0x%p.", (PVOID)(ULONG_PTR)Routine, (PVOID)KShimpAttachedProcess);
+	return NULL;
+}
+
+_Use_decl_annotations_
+EXTERN_C PIO_WORKITEM IoAllocateWorkItem(
+	_In_ PDEVICE_OBJECT DeviceObject
+) {
+	PIO_WORKITEM IoWorkItem = (PIO_WORKITEM)ExAllocatePool2(POOL_FLAG_NON_PAGED, sizeof(struct _IO_WORKITEM), KSHIMP_WORKITEM_TAG);
+	if (IoWorkItem != NULL)
+		IoWorkItem->DeviceObject = DeviceObject;
+	return IoWorkItem;
+}
+
+_Use_decl_annotations_
+EXTERN_C VOID IoQueueWorkItem(
+	_Inout_  PIO_WORKITEM         IoWorkItem,
+	_In_     PIO_WORKITEM_ROUTINE WorkerRoutine,
+	_In_     WORK_QUEUE_TYPE      QueueType,
+	_In_opt_ PVOID                Context
+) {
+	UNREFERENCED_PARAMETER(QueueType);
+	KShimpCheckIrql(DISPATCH_LEVEL, "IoQueueWorkItem");
+	if (__atomic_exchange_n(&IoWorkItem->Queued, TRUE, __ATOMIC_ACQUIRE) != FALSE)
+		KShimpBugCheck("WORKER_INVALID", "work item 0x%p queued again while queued.", (PVOID)IoWorkItem);
+	IoWorkItem->Routine = WorkerRoutine;
+	IoWorkItem->Context = Context;
+
+	pthread_t      Thread;
+	pthread_attr_t Attributes;
+	pthread_attr_init(&Attributes);
+	pthread_attr_setdetachstate(&Attributes, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&Thread, &Attributes, KShimpWorkerThread, IoWorkItem) != 0x00)
+		KShimpBugCheck("WORKER_INVALID", "no system thread for work item 0x%p.", (PVOID)IoWorkItem);
+	pthread_attr_destroy(&Attributes);
+}
+
+_Use_decl_annotations_
+EXTERN_C VOID IoFreeWorkItem(
+	_In_ PIO_WORKITEM IoWorkItem
+) {
+	if (__atomic_load_n(&IoWorkItem->Queued, __ATOMIC_ACQUIRE) != FALSE)
+		KShimpBugCheck("WORKER_INVALID", "work item 0x%p freed while queued.", (PVOID)IoWorkItem);
+	ExFreePoolWithTag(IoWorkItem, KSHIMP_WORKITEM_TAG);
+}
+
+
+//
+// Processes, threads and object references.
+//
+
+EXTERN_C PEPROCESS PsGetCurrentProcess(
+	VOID
+) {
+	return KShimpAttachedProcess != NULL ? KShimpAttachedProcess : (PEPROCESS)&KShimpSystemProcess;
+}
+
+EXTERN_C HANDLE PsGetCurrentThreadId(
+	VOID
+) {
+	return (HANDLE)(ULONG_PTR)pthread_self();
+}
+
+_Use_decl_annotations_
+EXTERN_C HANDLE PsGetProcessId(
+	_In_ PEPROCESS Process
+) {
+	return ((PKSHIMP_PROCESS)Process)->UniqueProcessId;
+}
+
+_Use_decl_annotations_
+EXTERN_C LONGLONG PsGetProcessCreateTimeQuadPart(
+	_In_ PEPROCESS Process
+) {
+	return ((PKSHIMP_PROCESS)Process)->CreateTime;
+}
+
+_Use_decl_annotations_
+EXTERN_C NTSTATUS PsLookupProcessByProcessId(
+	_In_  HANDLE     ProcessId,
+	_Out_ PEPROCESS* Process
+) {
+	KShimpCheckIrql(APC_LEVEL, "PsLookupProcessByProcessId");
+
+	*Process = NULL;
+	if (ProcessId != KShimpSystemProcess.UniqueProcessId)
+		return STATUS_INVALID_PARAMETER;
+	*Process = (PEPROCESS)&KShimpSystemProcess;
+	ObReferenceObject(*Process);
+	return STATUS_SUCCESS;
+}
+
+_Use_decl_annotations_
+EXTERN_C VOID KeStackAttachProcess(
+	_Inout_ PEPROCESS   Process,
+	_Out_   PKAPC_STATE ApcState
+) {
+	KShimpCheckIrql(DISPATCH_LEVEL, "KeStackAttachProcess");
+
+	ApcState->Process     = KShimpAttachedProcess;
+	ApcState->Attached    = TRUE;
+	KShimpAttachedProcess = Process;
+}
+
+_Use_decl_annotations_
+EXTERN_C VOID KeUnstackDetachProcess(
+	_In_ PKAPC_STATE ApcState
+) {
+	if (!ApcState->Attached || KShimpAttachedProcess == NULL)
+		KShimpBugCheck("INVALID_PROCESS_DETACH_ATTEMPT", "detached with state 0x%p, not attached.", (PVOID)ApcState);
+
+	KShimpAttachedProcess = ApcState->Process;
+	ApcState->Attached    = FALSE;
+}
+
+_Use_decl_annotations_
+EXTERN_C VOID ObReferenceObject(
+	_In_ PVOID Object
+) {
+	if (Object == NULL)
+		KShimpBugCheck("REFERENCE_BY_POINTER", "NULL object referenced.");
+	__atomic_add_fetch(&KShimpObjectReferences, 0x01, __ATOMIC_RELAXED);
+}
+
+_Use_decl_annotations_
+EXTERN_C VOID ObDereferenceObject(
+	_In_ PVOID Object
+) {
+	if (Object == NULL || __atomic_sub_fetch(&KShimpObjectReferences, 0x01, __ATOMIC_RELAXED) < 0x00)
+		KShimpBugCheck("REFERENCE_BY_POINTER", "object 0x%p dereferenced but not referenced.", Object);
+}
+
+
+//
+// Virtual memory of the processes.
+//
+
+_Use_decl_annotations_
+EXTERN_C KIRQL KfRaiseIrql(
+	_In_ KIRQL NewIrql
+) {
+	KIRQL OldIrql = PASSIVE_LEVEL;
+	KeRaiseIrql(NewIrql, &OldIrql);
+	return OldIrql;
+}
+
+_Use_decl_annotations_
+EXTERN_C ULONG KeQueryActiveProcessorCountEx(
+	_In_ USHORT GroupNumber
+) {
+	UNREFERENCED_PARAMETER(GroupNumber);
+	LONG Count = (LONG)sysconf(_SC_NPROCESSORS_ONLN);
+	return Count > 0x00 ? (ULONG)Count : 0x01;
+}
+
+_Use_decl_annotations_
+EXTERN_C VOID ProbeForRead(
+	_In_ CONST volatile VOID* Address,
+	_In_ SIZE_T               Length,
+	_In_ ULONG                Alignment
+) {
+	KShimpCheckIrql(APC_LEVEL, "ProbeForRead");
+	if (Length != 0x00 && ((ULONG_PTR)Address & (Alignment - 0x01)) != 0x00)
+		KShimpBugCheck("KMODE_EXCEPTION_NOT_HANDLED", "probe of 0x%p misaligned on %u bytes.", (PVOID)Address, Alignment);
+}
+
+_Use_decl_annotations_
+EXTERN_C PMDL IoAllocateMdl(
+	_In_opt_    PVOID   VirtualAddress,
+	_In_        ULONG   Length,
+	_In_        BOOLEAN SecondaryBuffer,
+	_In_        BOOLEAN ChargeQuota,
+	_Inout_opt_ PIRP    Irp
+) {
+	UNREFERENCED_PARAMETER(SecondaryBuffer);
+	UNREFERENCED_PARAMETER(ChargeQuota);
+	if (Irp != NULL)
+		KShimpBugCheck("BAD_POOL_CALLER", "MDL allocated for IRP 0x%p.", (PVOID)Irp);
+
+	PMDL Mdl = (PMDL)ExAllocatePool2(POOL_FLAG_NON_PAGED, sizeof(MDL), KSHIMP_MDL_TAG);
+	if (Mdl == NULL)
+		return NULL;
+	Mdl->Size       = (CSHORT)sizeof(MDL);
+	Mdl->StartVa    = (PVOID)((ULONG_PTR)VirtualAddress & ~(ULONG_PTR)(PAGE_SIZE - 1));
+	Mdl->ByteOffset = (ULONG)((ULONG_PTR)VirtualAddress & (PAGE_SIZE - 1));
+	Mdl->ByteCount  = Length;
+	return Mdl;
+}
+
+_Use_decl_annotations_
+EXTERN_C VOID IoFreeMdl(
+	_In_ PMDL Mdl
+) {
+	ExFreePoolWithTag(Mdl, KSHIMP_MDL_TAG);
+}
+
+_Use_decl_annotations_
+EXTERN_C VOID MmBuildMdlForNonPagedPool(
+	_Inout_ PMDL MemoryDescriptorList
+) {
+	MemoryDescriptorList->MappedSystemVa = (PUCHAR)MemoryDescriptorList->StartVa + MemoryDescriptorList->ByteOffset;
+}
+
+_Use_decl_annotations_
+EXTERN_C PVOID MmMapLockedPagesSpecifyCache(
+	_In_     PMDL                MemoryDescriptorList,
+	_In_     KPROCESSOR_MODE     AccessMode,
+	_In_     MEMORY_CACHING_TYPE CacheType,
+	_In_opt_ PVOID               RequestedAddress,
+	_In_     ULONG               BugCheckOnFailure,
+	_In_     ULONG               Priority
+) {
+	UNREFERENCED_PARAMETER(CacheType);
+	UNREFERENCED_PARAMETER(RequestedAddress);
+	UNREFERENCED_PARAMETER(BugCheckOnFailure);
+	UNREFERENCED_PARAMETER(Priority);
+
+	// The processes have no address space of their own to map the pages into
+	return AccessMode == KernelMode ? MemoryDescriptorList->MappedSystemVa : NULL;
+}
+
+_Use_decl_annotations_
+EXTERN_C VOID MmUnmapLockedPages(
+	_In_ PVOID BaseAddress,
+	_In_ PMDL  MemoryDescriptorList
+) {
+	if (BaseAddress != MemoryDescriptorList->MappedSystemVa)
+		KShimpBugCheck("PROCESS_HAS_LOCKED_PAGES", "0x%p unmapped but not mapped by MDL 0x%p.", BaseAddress, (PVOID)MemoryDescriptorList);
+}
+
+
+//
+// State of the simulated kernel.
+//
+
+_Use_decl_annotations_
+EXTERN_C NTSTATUS KShimLoadModule(
+	_In_ PCSTR FullPathName,
+	_In_ PVOID ImageBase,
+	_In_ ULONG ImageSize
+) {
+	SIZE_T Length = strlen(FullPathName);
+	if (Length >= AUX_KLIB_MODULE_PATH_LEN)
+		return STATUS_INVALID_PARAMETER;
+
+	pthread_mutex_lock(&KShimpLock);
+	if (KShimpNumberOfModules == KSHIMP_MAXIMUM_MODULES) {
+		pthread_mutex_unlock(&KShimpLock);
+		return STATUS_INSUFFICIENT_RESOURCES;
+	}
+
+	PKSHIMP_MODULE Module = &KShimpModules[KShimpNumberOfModules++];
+	PCSTR          Name   = strrchr(FullPathName, '\\');
+	memset(Module->FullPathName, 0x00, sizeof(Module->FullPathName));
+	memcpy(Module->FullPathName, FullPathName, Length);
+	Module->ImageBase      = ImageBase;
+	Module->ImageSize      = ImageSize;
+	Module->FileNameOffset = (USHORT)(Name != NULL ? (Name - FullPathName) + 0x01 : 0x00);
+	pthread_mutex_unlock(&KShimpLock);
+	return STATUS_SUCCESS;
+}
+
+_Use_decl_annotations_
+EXTERN_C VOID KShimMapPhysicalMemory(
+	_In_opt_ PVOID  Buffer,
+	_In_     SIZE_T Size
+) {
+	pthread_mutex_lock(&KShimpLock);
+	KShimpPhysicalMemory     = (PUCHAR)Buffer;
+	KShimpPhysicalMemorySize = Buffer != NULL ? Size : 0x00;
+	pthread_mutex_unlock(&KShimpLock);
+}
+
+_Use_decl_annotations_
+EXTERN_C VOID KShimFailPoolAllocations(
+	_In_ ULONG Period
+) {
+	__atomic_store_n(&KShimpFailureCount, 0x00, __ATOMIC_RELAXED);
+	__atomic_store_n(&KShimpFailurePeriod, Period, __ATOMIC_RELAXED);
+}
+
+EXTERN_C LONG64 KShimQueryPoolAllocations(
+	VOID
+) {
+	return __atomic_load_n(&KShimpPoolAllocations, __ATOMIC_RELAXED);
+}
+
+EXTERN_C LONG64 KShimQueryObjectReferences(
+	VOID
+) {
+	return __atomic_load_n(&KShimpObjectReferences, __ATOMIC_RELAXED);
+}
+
+EXTERN_C ULONG KShimQueryOpenHandles(
+	VOID
+) {
+	pthread_mutex_lock(&KShimpLock);
+	ULONG OpenHandles = KShimpOpenHandles;
+	pthread_mutex_unlock(&KShimpLock);
+	return OpenHandles;
+}
+
+EXTERN_C VOID KShimReset(
+	VOID
+) {
+	pthread_mutex_lock(&KShimpLock);
+	while (!IsListEmpty(&KShimpHandles))
+		free(CONTAINING_RECORD(RemoveHeadList(&KShimpHandles), KSHIMP_HANDLE, List));
+	KShimpOpenHandles = 0x00;
+
+	if (KShimpRegistryRoot != NULL)
+		KShimpFreeKey(KShimpRegistryRoot);
+	KShimpRegistryRoot = NULL;
+
+	KShimpNumberOfModules    = 0x00;
+	KShimpAuxKlibInitialised = FALSE;
+	KShimpPhysicalMemory     = NULL;
+	KShimpPhysicalMemorySize = 0x00;
+	pthread_mutex_unlock(&KShimpLock);
+	KShimFailPoolAllocations(0x00);
+	__atomic_store_n(&KShimpObjectReferences, 0x00, __ATOMIC_RELAXED);
+}
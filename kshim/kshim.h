@@ -0,0 +1,1125 @@
+/*+================================================================================================
+Module Name: kshim.h
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+
+Abstract:
+Kernel types and routines used by the logic of the drivers, so that the same sources build against
+the WDK in the drivers and run as user-mode programs on Linux. It is also the one portability layer
+of the user-mode tools sharing code with the drivers, built against the SDK on Windows.
+
+In the drivers the shim is the WDK itself, and in the user-mode tools on Windows the SDK, which only
+gives them the basic types. Elsewhere the kernel is simulated in user mode: lists, pool allocations,
+lookaside lists, spin locks and IRQL, fast mutexes and run-down protection, work items run on their
+own threads, process lookup and attachment, MDLs, Unicode strings, the registry, the loaded modules
+and reads of kernel and physical memory. Structured exception handling is only simulated when
+KSHIM_EXCEPTIONS is defined, after the C++ headers, as a try block never raising. The state of the
+simulated kernel is set up with the KShim routines. The types the drivers access are defined with
+their x64 layout, the others are opaque. Wide strings are those of the C runtime, 32-bit on Linux.
+
+The WDK headers are guarded so that the headers of the drivers skip them once the shim is included.
+
+================================================================================================+*/
+
+#ifndef __KSHIM_H_GUARD__
+#define __KSHIM_H_GUARD__
+
+#if defined(_KERNEL_MODE)
+#include <ntifs.h>
+#include <ntstrsafe.h>
+#include <aux_klib.h>
+#elif defined(_WIN32)
+#include <Windows.h>
+
+// The headers of the drivers skip the WDK headers, only their types are shared.
+#define _NTIFS_
+
+#ifndef PAGE_SIZE
+#define PAGE_SIZE  0x1000
+#endif // !PAGE_SIZE
+#ifndef PAGE_SHIFT
+#define PAGE_SHIFT 12
+#endif // !PAGE_SHIFT
+#else
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+// The headers of the drivers skip the WDK headers.
+#define _NTIFS_
+#define _NTSTRSAFE_H_INCLUDED_
+#define _AUX_KLIB_H
+
+// Pragmas of the Microsoft compiler used by the drivers.
+#pragma GCC diagnostic ignored "-Wunknown-pragmas"
+
+#ifdef __cplusplus
+#define EXTERN_C extern "C"
+#else
+#define EXTERN_C extern
+#endif // __cplusplus
+
+//
+// Basic types.
+//
+typedef void            VOID, * PVOID;
+typedef char            CHAR, * PCHAR, * LPSTR;
+typedef const char*     PCSTR, * LPCSTR;
+typedef uint8_t         UCHAR, * PUCHAR;
+typedef uint8_t         BOOLEAN, * PBOOLEAN;
+typedef int16_t         SHORT, CSHORT;
+typedef uint16_t        USHORT, * PUSHORT;
+typedef wchar_t         WCHAR, * PWCHAR, * PWCH, * PWSTR, * LPWSTR;
+typedef const wchar_t*  PCWSTR, * LPCWSTR;
+typedef int             INT;
+typedef int32_t         INT32;
+typedef int32_t         LONG, * PLONG;
+typedef uint32_t        ULONG, * PULONG, DWORD;
+typedef int64_t         LONG64, LONGLONG, INT64;
+typedef uint64_t        ULONG64, * PULONG64, ULONGLONG;
+typedef uint16_t        UINT16;
+typedef uint32_t        UINT32;
+typedef uint64_t        UINT64;
+typedef uintptr_t       ULONG_PTR;
+typedef size_t          SIZE_T, * PSIZE_T;
+typedef LONG            NTSTATUS;
+typedef PVOID           HANDLE, * PHANDLE;
+typedef ULONG           ACCESS_MASK;
+typedef LONG            HRESULT;
+
+typedef struct _GUID {
+	ULONG  Data1;
+	USHORT Data2;
+	USHORT Data3;
+	UCHAR  Data4[8];
+} GUID;
+
+typedef union _LARGE_INTEGER {
+	struct {
+		ULONG LowPart;
+		LONG  HighPart;
+	};
+	LONGLONG QuadPart;
+} LARGE_INTEGER, * PLARGE_INTEGER, PHYSICAL_ADDRESS;
+
+#define TRUE          1
+#define FALSE         0
+#define CONST         const
+#define ANYSIZE_ARRAY 1
+#define MAXULONG      0xFFFFFFFFUL
+
+#define PAGE_SIZE  0x1000
+#define PAGE_SHIFT 12
+
+#define DECLSPEC_ALIGN(x)         __attribute__((aligned(x)))
+#define DECLSPEC_CACHEALIGN       DECLSPEC_ALIGN(64)
+#define __declspec(x)
+#define __cdecl
+#define STDMETHODCALLTYPE
+#define _inline                   inline
+#define UNREFERENCED_PARAMETER(P) (VOID)(P)
+#define _ARRAYSIZE(A)             (sizeof(A) / sizeof((A)[0]))
+#define FIELD_OFFSET(T, F)        ((LONG)offsetof(T, F))
+#define CONTAINING_RECORD(A, T, F) ((T*)((PUCHAR)(A) - offsetof(T, F)))
+
+#define RtlCopyMemory(Destination, Source, Length) memcpy((Destination), (Source), (Length))
+#define RtlMoveMemory(Destination, Source, Length) memmove((Destination), (Source), (Length))
+#define RtlFillMemory(Destination, Length, Fill)   memset((Destination), (Fill), (Length))
+#define RtlZeroMemory(Destination, Length)         memset((Destination), 0x00, (Length))
+
+// SAL annotations are only checked by the Microsoft compiler.
+#define _In_
+#define _In_z_
+#define _In_opt_
+#define _In_reads_(s)
+#define _In_reads_bytes_(s)
+#define _In_reads_bytes_opt_(s)
+#define _Inout_
+#define _Inout_opt_
+#define _Inout_updates_(s)
+#define _Out_
+#define _Out_opt_
+#define _Out_writes_(s)
+#define _Out_writes_bytes_(s)
+#define _Out_writes_bytes_opt_(s)
+#define _Reserved_
+#define _Must_inspect_result_
+#define _Success_(e)
+#define _Use_decl_annotations_
+#define _IRQL_requires_min_(i)
+#define _IRQL_requires_max_(i)
+#define _IRQL_raises_(i)
+
+// Interlocked routines are full barriers, as on Windows.
+#define InterlockedIncrement(Target)              __atomic_add_fetch((Target), 1, __ATOMIC_SEQ_CST)
+#define InterlockedDecrement(Target)              __atomic_sub_fetch((Target), 1, __ATOMIC_SEQ_CST)
+#define InterlockedExchange(Target, Value)        __atomic_exchange_n((Target), (Value), __ATOMIC_SEQ_CST)
+#define InterlockedExchangePointer(Target, Value) __atomic_exchange_n((Target), (Value), __ATOMIC_SEQ_CST)
+#define ReadAcquire(Source)                       __atomic_load_n((Source), __ATOMIC_ACQUIRE)
+#define ReadPointerAcquire(Source)                __atomic_load_n((Source), __ATOMIC_ACQUIRE)
+#define ReadUCharAcquire(Source)                  __atomic_load_n((Source), __ATOMIC_ACQUIRE)
+#define WriteRelease(Target, Value)               __atomic_store_n((Target), (Value), __ATOMIC_RELEASE)
+
+#define InterlockedIncrement64(Target)            __atomic_add_fetch((Target), 1, __ATOMIC_SEQ_CST)
+#define InterlockedExchange64(Target, Value)      __atomic_exchange_n((Target), (Value), __ATOMIC_SEQ_CST)
+#define InterlockedAdd64(Target, Value)           __atomic_add_fetch((Target), (Value), __ATOMIC_SEQ_CST)
+#define ReadAcquire64(Source)                     __atomic_load_n((Source), __ATOMIC_ACQUIRE)
+#define ReadNoFence64(Source)                     __atomic_load_n((Source), __ATOMIC_RELAXED)
+#define WriteRelease64(Target, Value)             __atomic_store_n((Target), (Value), __ATOMIC_RELEASE)
+#define MemoryBarrier()                           __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+static __inline LONG64 InterlockedCompareExchange64(
+	_Inout_ volatile LONG64* Destination,
+	_In_    LONG64           Exchange,
+	_In_    LONG64           Comperand
+) {
+	__atomic_compare_exchange_n(Destination, &Comperand, Exchange, 0x00, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return Comperand;
+}
+
+static __inline PVOID InterlockedCompareExchangePointer(
+	_Inout_ PVOID volatile* Destination,
+	_In_    PVOID           Exchange,
+	_In_    PVOID           Comperand
+) {
+	__atomic_compare_exchange_n(Destination, &Comperand, Exchange, 0x00, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return Comperand;
+}
+
+//
+// Status codes.
+//
+#define STATUS_SUCCESS                ((NTSTATUS)0x00000000L)
+#define STATUS_BUFFER_OVERFLOW        ((NTSTATUS)0x80000005L)
+#define STATUS_NO_MORE_ENTRIES        ((NTSTATUS)0x8000001AL)
+#define STATUS_UNSUCCESSFUL           ((NTSTATUS)0xC0000001L)
+#define STATUS_INVALID_INFO_CLASS     ((NTSTATUS)0xC0000003L)
+#define STATUS_INVALID_HANDLE         ((NTSTATUS)0xC0000008L)
+#define STATUS_INVALID_PARAMETER      ((NTSTATUS)0xC000000DL)
+#define STATUS_NO_MEMORY              ((NTSTATUS)0xC0000017L)
+#define STATUS_ACCESS_DENIED          ((NTSTATUS)0xC0000022L)
+#define STATUS_BUFFER_TOO_SMALL       ((NTSTATUS)0xC0000023L)
+#define STATUS_OBJECT_NAME_INVALID    ((NTSTATUS)0xC0000033L)
+#define STATUS_OBJECT_NAME_NOT_FOUND  ((NTSTATUS)0xC0000034L)
+#define STATUS_INSUFFICIENT_RESOURCES ((NTSTATUS)0xC000009AL)
+#define STATUS_DEVICE_NOT_READY       ((NTSTATUS)0xC00000A3L)
+#define STATUS_NOT_SUPPORTED          ((NTSTATUS)0xC00000BBL)
+#define STATUS_INVALID_PARAMETER_1    ((NTSTATUS)0xC00000EFL)
+#define STATUS_INVALID_PARAMETER_2    ((NTSTATUS)0xC00000F0L)
+#define STATUS_INVALID_ADDRESS        ((NTSTATUS)0xC0000141L)
+
+#define NT_SUCCESS(Status) (((NTSTATUS)(Status)) >= 0)
+#define NT_ERROR(Status)   ((((ULONG)(Status)) >> 30) == 3)
+
+// Assertions are always checked.
+#define NT_ASSERT(e) ((e) ? (VOID)0x00 : KShimAssertionFailure(#e, __FILE__, __LINE__))
+#define ASSERT(e)    NT_ASSERT(e)
+
+//
+// Lists, checked like in the kernel.
+//
+typedef struct _LIST_ENTRY {
+	struct _LIST_ENTRY* Flink;
+	struct _LIST_ENTRY* Blink;
+} LIST_ENTRY, * PLIST_ENTRY;
+
+typedef struct _SINGLE_LIST_ENTRY {
+	struct _SINGLE_LIST_ENTRY* Next;
+} SINGLE_LIST_ENTRY, * PSINGLE_LIST_ENTRY;
+
+typedef struct _RTL_BALANCED_NODE {
+	union {
+		struct _RTL_BALANCED_NODE* Children[2];
+		struct {
+			struct _RTL_BALANCED_NODE* Left;
+			struct _RTL_BALANCED_NODE* Right;
+		};
+	};
+	union {
+		UCHAR     Red : 1;
+		UCHAR     Balance : 2;
+		ULONG_PTR ParentValue;
+	};
+} RTL_BALANCED_NODE, * PRTL_BALANCED_NODE;
+
+/// <summary>
+/// Stop the program on a corrupted list entry, like the fast fail of the kernel.
+/// </summary>
+EXTERN_C VOID KShimListEntryFailure(
+	_In_ PLIST_ENTRY Entry
+);
+
+static __inline VOID InitializeListHead(
+	_Out_ PLIST_ENTRY ListHead
+) {
+	ListHead->Flink = ListHead->Blink = ListHead;
+}
+
+static __inline BOOLEAN IsListEmpty(
+	_In_ CONST LIST_ENTRY* ListHead
+) {
+	return (BOOLEAN)(ListHead->Flink == ListHead);
+}
+
+static __inline BOOLEAN RemoveEntryList(
+	_In_ PLIST_ENTRY Entry
+) {
+	PLIST_ENTRY Flink = Entry->Flink;
+	PLIST_ENTRY Blink = Entry->Blink;
+	if (Flink->Blink != Entry || Blink->Flink != Entry)
+		KShimListEntryFailure(Entry);
+
+	Blink->Flink = Flink;
+	Flink->Blink = Blink;
+	return (BOOLEAN)(Flink == Blink);
+}
+
+static __inline PLIST_ENTRY RemoveHeadList(
+	_Inout_ PLIST_ENTRY ListHead
+) {
+	PLIST_ENTRY Entry = ListHead->Flink;
+	PLIST_ENTRY Flink = Entry->Flink;
+	if (Entry->Blink != ListHead || Flink->Blink != Entry)
+		KShimListEntryFailure(ListHead);
+
+	ListHead->Flink = Flink;
+	Flink->Blink    = ListHead;
+	return Entry;
+}
+
+static __inline PLIST_ENTRY RemoveTailList(
+	_Inout_ PLIST_ENTRY ListHead
+) {
+	PLIST_ENTRY Entry = ListHead->Blink;
+	PLIST_ENTRY Blink = Entry->Blink;
+	if (Entry->Flink != ListHead || Blink->Flink != Entry)
+		KShimListEntryFailure(ListHead);
+
+	ListHead->Blink = Blink;
+	Blink->Flink    = ListHead;
+	return Entry;
+}
+
+static __inline VOID InsertHeadList(
+	_Inout_ PLIST_ENTRY ListHead,
+	_Out_   PLIST_ENTRY Entry
+) {
+	PLIST_ENTRY Flink = ListHead->Flink;
+	if (Flink->Blink != ListHead)
+		KShimListEntryFailure(ListHead);
+
+	Entry->Flink    = Flink;
+	Entry->Blink    = ListHead;
+	Flink->Blink    = Entry;
+	ListHead->Flink = Entry;
+}
+
+static __inline VOID InsertTailList(
+	_Inout_ PLIST_ENTRY ListHead,
+	_Out_   PLIST_ENTRY Entry
+) {
+	PLIST_ENTRY Blink = ListHead->Blink;
+	if (Blink->Flink != ListHead)
+		KShimListEntryFailure(ListHead);
+
+	Entry->Flink    = ListHead;
+	Entry->Blink    = Blink;
+	Blink->Flink    = Entry;
+	ListHead->Blink = Entry;
+}
+
+static __inline VOID PushEntryList(
+	_Inout_ PSINGLE_LIST_ENTRY ListHead,
+	_Out_   PSINGLE_LIST_ENTRY Entry
+) {
+	Entry->Next    = ListHead->Next;
+	ListHead->Next = Entry;
+}
+
+static __inline PSINGLE_LIST_ENTRY PopEntryList(
+	_Inout_ PSINGLE_LIST_ENTRY ListHead
+) {
+	PSINGLE_LIST_ENTRY Entry = ListHead->Next;
+	if (Entry != NULL)
+		ListHead->Next = Entry->Next;
+	return Entry;
+}
+
+//
+// IRQL and spin locks. The IRQL is kept per thread, raised by the spin locks and checked by the
+// routines that can only run at a low IRQL.
+//
+typedef UCHAR     KIRQL, * PKIRQL;
+typedef ULONG_PTR KSPIN_LOCK, * PKSPIN_LOCK;
+
+#define PASSIVE_LEVEL  0
+#define APC_LEVEL      1
+#define DISPATCH_LEVEL 2
+
+#define PAGED_CODE() NT_ASSERT(KeGetCurrentIrql() <= APC_LEVEL)
+
+#define KeAcquireSpinLock(Lock, OldIrql) *(OldIrql) = KeAcquireSpinLockRaiseToDpc(Lock)
+
+EXTERN_C KIRQL KeGetCurrentIrql(
+	VOID
+);
+
+EXTERN_C VOID KeRaiseIrql(
+	_In_  KIRQL  NewIrql,
+	_Out_ PKIRQL OldIrql
+);
+
+EXTERN_C VOID KeLowerIrql(
+	_In_ KIRQL NewIrql
+);
+
+EXTERN_C VOID KeInitializeSpinLock(
+	_Out_ PKSPIN_LOCK SpinLock
+);
+
+EXTERN_C KIRQL KeAcquireSpinLockRaiseToDpc(
+	_Inout_ PKSPIN_LOCK SpinLock
+);
+
+EXTERN_C VOID KeReleaseSpinLock(
+	_Inout_ PKSPIN_LOCK SpinLock,
+	_In_    KIRQL       NewIrql
+);
+
+EXTERN_C VOID KeAcquireSpinLockAtDpcLevel(
+	_Inout_ PKSPIN_LOCK SpinLock
+);
+
+EXTERN_C VOID KeReleaseSpinLockFromDpcLevel(
+	_Inout_ PKSPIN_LOCK SpinLock
+);
+
+EXTERN_C BOOLEAN KeTryToAcquireSpinLockAtDpcLevel(
+	_Inout_ PKSPIN_LOCK SpinLock
+);
+
+//
+// Pool allocations and lookaside lists. Allocations are checked for their tag and their IRQL, and
+// the uninitialised ones are filled with a pattern.
+//
+typedef ULONG64 POOL_FLAGS;
+
+#define POOL_FLAG_UNINITIALIZED  0x0000000000000002ULL
+#define POOL_FLAG_CACHE_ALIGNED  0x0000000000000008ULL
+#define POOL_FLAG_NON_PAGED      0x0000000000000040ULL
+#define POOL_FLAG_PAGED          0x0000000000000100ULL
+
+typedef enum _POOL_TYPE {
+	NonPagedPool   = 0x000,
+	PagedPool      = 0x001,
+	NonPagedPoolNx = 0x200
+} POOL_TYPE;
+
+struct _LOOKASIDE_LIST_EX;
+
+typedef PVOID(*PALLOCATE_FUNCTION_EX)(
+	_In_    POOL_TYPE                  PoolType,
+	_In_    SIZE_T                     NumberOfBytes,
+	_In_    ULONG                      Tag,
+	_Inout_ struct _LOOKASIDE_LIST_EX* Lookaside
+);
+
+typedef VOID(*PFREE_FUNCTION_EX)(
+	_In_    PVOID                      Buffer,
+	_Inout_ struct _LOOKASIDE_LIST_EX* Lookaside
+);
+
+typedef struct _LOOKASIDE_LIST_EX {
+	KSPIN_LOCK            Lock;
+	SINGLE_LIST_ENTRY     ListHead;
+	USHORT                Depth;
+	USHORT                Count;
+	POOL_TYPE             Type;
+	ULONG                 Tag;
+	ULONG                 Size;
+	PALLOCATE_FUNCTION_EX Allocate;
+	PFREE_FUNCTION_EX     Free;
+	ULONG                 TotalAllocates;
+	ULONG                 AllocateHits;
+} LOOKASIDE_LIST_EX, * PLOOKASIDE_LIST_EX;
+
+EXTERN_C PVOID ExAllocatePool2(
+	_In_ POOL_FLAGS Flags,
+	_In_ SIZE_T     NumberOfBytes,
+	_In_ ULONG      Tag
+);
+
+EXTERN_C VOID ExFreePoolWithTag(
+	_In_ PVOID P,
+	_In_ ULONG Tag
+);
+
+EXTERN_C NTSTATUS ExInitializeLookasideListEx(
+	_Out_    PLOOKASIDE_LIST_EX    Lookaside,
+	_In_opt_ PALLOCATE_FUNCTION_EX Allocate,
+	_In_opt_ PFREE_FUNCTION_EX     Free,
+	_In_     POOL_TYPE             PoolType,
+	_In_     ULONG                 Flags,
+	_In_     SIZE_T                Size,
+	_In_     ULONG                 Tag,
+	_In_     USHORT                Depth
+);
+
+EXTERN_C VOID ExDeleteLookasideListEx(
+	_Inout_ PLOOKASIDE_LIST_EX Lookaside
+);
+
+EXTERN_C PVOID ExAllocateFromLookasideListEx(
+	_Inout_ PLOOKASIDE_LIST_EX Lookaside
+);
+
+EXTERN_C VOID ExFreeToLookasideListEx(
+	_Inout_ PLOOKASIDE_LIST_EX Lookaside,
+	_In_    PVOID              Entry
+);
+
+//
+// Unicode strings.
+//
+typedef struct _UNICODE_STRING {
+	USHORT Length;
+	USHORT MaximumLength;
+	PWCH   Buffer;
+} UNICODE_STRING, * PUNICODE_STRING;
+typedef const UNICODE_STRING* PCUNICODE_STRING;
+
+#define RTL_CONSTANT_STRING(s) { sizeof(s) - sizeof((s)[0]), sizeof(s), (PWCH)(s) }
+
+EXTERN_C VOID RtlInitUnicodeString(
+	_Out_    PUNICODE_STRING DestinationString,
+	_In_opt_ PCWSTR          SourceString
+);
+
+EXTERN_C NTSTATUS RtlUnicodeStringInit(
+	_Out_    PUNICODE_STRING DestinationString,
+	_In_opt_ PCWSTR          SourceString
+);
+
+EXTERN_C BOOLEAN RtlEqualUnicodeString(
+	_In_ PCUNICODE_STRING String1,
+	_In_ PCUNICODE_STRING String2,
+	_In_ BOOLEAN          CaseInSensitive
+);
+
+/// <summary>
+/// Format a wide string like the Microsoft C runtime, %s being a wide string. Stops the program if
+/// the buffer is too small, like the default invalid parameter handler.
+/// </summary>
+EXTERN_C INT swprintf_s(
+	_Out_writes_(SizeInWords) PWCHAR Buffer,
+	_In_                      SIZE_T SizeInWords,
+	_In_                      PCWSTR Format,
+	...
+);
+
+//
+// Registry. Keys live in memory, the hives \Registry\Machine\SOFTWARE, \Registry\Machine\SYSTEM and
+// \Registry\User exist from the start. Sub-keys are enumerated in the order they were created.
+//
+#define OBJ_CASE_INSENSITIVE 0x00000040L
+#define OBJ_KERNEL_HANDLE    0x00000200L
+
+#define GENERIC_READ   0x80000000L
+#define KEY_READ       0x00020019L
+#define KEY_ALL_ACCESS 0x000F003FL
+
+#define REG_SZ     1
+#define REG_BINARY 3
+#define REG_DWORD  4
+#define REG_QWORD  11
+
+#define REG_OPTION_NON_VOLATILE 0x00000000L
+#define REG_CREATED_NEW_KEY     0x00000001L
+#define REG_OPENED_EXISTING_KEY 0x00000002L
+
+typedef struct _OBJECT_ATTRIBUTES {
+	ULONG           Length;
+	HANDLE          RootDirectory;
+	PUNICODE_STRING ObjectName;
+	ULONG           Attributes;
+	PVOID           SecurityDescriptor;
+	PVOID           SecurityQualityOfService;
+} OBJECT_ATTRIBUTES, * POBJECT_ATTRIBUTES;
+
+#define InitializeObjectAttributes(p, n, a, r, s) { \
+	(p)->Length                   = sizeof(OBJECT_ATTRIBUTES); \
+	(p)->RootDirectory            = r; \
+	(p)->Attributes               = a; \
+	(p)->ObjectName               = n; \
+	(p)->SecurityDescriptor       = s; \
+	(p)->SecurityQualityOfService = NULL; \
+}
+
+typedef enum _KEY_INFORMATION_CLASS {
+	KeyBasicInformation = 0x00
+} KEY_INFORMATION_CLASS;
+
+typedef enum _KEY_VALUE_INFORMATION_CLASS {
+	KeyValuePartialInformation = 0x02
+} KEY_VALUE_INFORMATION_CLASS;
+
+typedef struct _KEY_BASIC_INFORMATION {
+	LARGE_INTEGER LastWriteTime;
+	ULONG         TitleIndex;
+	ULONG         NameLength;
+	WCHAR         Name[1];     // Not NULL terminated
+} KEY_BASIC_INFORMATION, * PKEY_BASIC_INFORMATION;
+
+typedef struct _KEY_VALUE_PARTIAL_INFORMATION {
+	ULONG TitleIndex;
+	ULONG Type;
+	ULONG DataLength;
+	UCHAR Data[1];
+} KEY_VALUE_PARTIAL_INFORMATION, * PKEY_VALUE_PARTIAL_INFORMATION;
+
+EXTERN_C NTSTATUS ZwCreateKey(
+	_Out_      PHANDLE            KeyHandle,
+	_In_       ACCESS_MASK        DesiredAccess,
+	_In_       POBJECT_ATTRIBUTES ObjectAttributes,
+	_Reserved_ ULONG              TitleIndex,
+	_In_opt_   PUNICODE_STRING    Class,
+	_In_       ULONG              CreateOptions,
+	_Out_opt_  PULONG             Disposition
+);
+
+EXTERN_C NTSTATUS ZwOpenKey(
+	_Out_ PHANDLE            KeyHandle,
+	_In_  ACCESS_MASK        DesiredAccess,
+	_In_  POBJECT_ATTRIBUTES ObjectAttributes
+);
+
+EXTERN_C NTSTATUS ZwSetValueKey(
+	_In_       HANDLE          KeyHandle,
+	_In_       PUNICODE_STRING ValueName,
+	_In_opt_   ULONG           TitleIndex,
+	_In_       ULONG           Type,
+	_In_reads_bytes_opt_(DataSize) PVOID Data,
+	_In_       ULONG           DataSize
+);
+
+EXTERN_C NTSTATUS ZwQueryValueKey(
+	_In_  HANDLE                      KeyHandle,
+	_In_  PUNICODE_STRING             ValueName,
+	_In_  KEY_VALUE_INFORMATION_CLASS KeyValueInformationClass,
+	_Out_writes_bytes_opt_(Length) PVOID KeyValueInformation,
+	_In_  ULONG                       Length,
+	_Out_ PULONG                      ResultLength
+);
+
+EXTERN_C NTSTATUS ZwEnumerateKey(
+	_In_  HANDLE                KeyHandle,
+	_In_  ULONG                 Index,
+	_In_  KEY_INFORMATION_CLASS KeyInformationClass,
+	_Out_writes_bytes_opt_(Length) PVOID KeyInformation,
+	_In_  ULONG                 Length,
+	_Out_ PULONG                ResultLength
+);
+
+EXTERN_C NTSTATUS ZwClose(
+	_In_ HANDLE Handle
+);
+
+//
+// Loaded modules.
+//
+#define AUX_KLIB_MODULE_PATH_LEN 0x100
+
+typedef struct _AUX_MODULE_BASIC_INFO {
+	PVOID ImageBase;
+} AUX_MODULE_BASIC_INFO, * PAUX_MODULE_BASIC_INFO;
+
+typedef struct _AUX_MODULE_EXTENDED_INFO {
+	AUX_MODULE_BASIC_INFO BasicInfo;
+	ULONG                 ImageSize;
+	USHORT                FileNameOffset;
+	UCHAR                 FullPathName[AUX_KLIB_MODULE_PATH_LEN];
+} AUX_MODULE_EXTENDED_INFO, * PAUX_MODULE_EXTENDED_INFO;
+
+EXTERN_C NTSTATUS AuxKlibInitialize(
+	VOID
+);
+
+EXTERN_C NTSTATUS AuxKlibQueryModuleInformation(
+	_In_      PULONG BufferSize,
+	_In_      ULONG  ElementSize,
+	_Out_writes_bytes_opt_(*BufferSize) PVOID QueryInfo
+);
+
+//
+// Memory. Kernel memory is the images of the loaded modules, physical memory the buffer mapped with
+// KShimMapPhysicalMemory at physical address zero.
+//
+#define MM_COPY_MEMORY_PHYSICAL 0x01
+#define MM_COPY_MEMORY_VIRTUAL  0x02
+
+typedef struct _MM_COPY_ADDRESS {
+	union {
+		PVOID            VirtualAddress;
+		PHYSICAL_ADDRESS PhysicalAddress;
+	};
+} MM_COPY_ADDRESS, * PMM_COPY_ADDRESS;
+
+EXTERN_C BOOLEAN MmIsAddressValid(
+	_In_ PVOID VirtualAddress
+);
+
+EXTERN_C NTSTATUS MmCopyMemory(
+	_In_  PVOID           TargetAddress,
+	_In_  MM_COPY_ADDRESS SourceAddress,
+	_In_  SIZE_T          NumberOfBytes,
+	_In_  ULONG           Flags,
+	_Out_ PSIZE_T         NumberOfBytesTransferred
+);
+
+//
+// Objects only pointed to, or embedded in the structures of the memory manager.
+//
+typedef struct _KPROCESS* PEPROCESS;
+typedef struct _KTHREAD*  PETHREAD;
+typedef struct _ERESOURCE* PERESOURCE;
+typedef struct _IRP*      PIRP;
+typedef ULONG_PTR         EX_PUSH_LOCK, * PEX_PUSH_LOCK;
+
+typedef struct _IO_STATUS_BLOCK {
+	union {
+		NTSTATUS Status;
+		PVOID    Pointer;
+	};
+	ULONG_PTR Information;
+} IO_STATUS_BLOCK, * PIO_STATUS_BLOCK;
+
+typedef struct _DISPATCHER_HEADER {
+	LONG       Lock;
+	LONG       SignalState;
+	LIST_ENTRY WaitListHead;
+} DISPATCHER_HEADER;
+
+typedef struct _KGATE {
+	DISPATCHER_HEADER Header;
+} KGATE, * PKGATE;
+
+typedef struct _KAPC {
+	UCHAR             Type;
+	UCHAR             AllFlags;
+	UCHAR             Size;
+	UCHAR             SpareByte1;
+	ULONG             SpareLong0;
+	struct _KTHREAD*  Thread;
+	LIST_ENTRY        ApcListEntry;
+	PVOID             Reserved[3];
+	PVOID             NormalContext;
+	PVOID             SystemArgument1;
+	PVOID             SystemArgument2;
+	CHAR              ApcStateIndex;
+	CHAR              ApcMode;
+	BOOLEAN           Inserted;
+} KAPC, * PKAPC;
+
+typedef struct _MDL {
+	struct _MDL*      Next;
+	CSHORT            Size;
+	CSHORT            MdlFlags;
+	USHORT            AllocationProcessorNumber;
+	USHORT            Reserved;
+	struct _KPROCESS* Process;
+	PVOID             MappedSystemVa;
+	PVOID             StartVa;
+	ULONG             ByteCount;
+	ULONG             ByteOffset;
+} MDL, * PMDL;
+
+typedef struct _WORK_QUEUE_ITEM {
+	LIST_ENTRY     List;
+	PVOID          WorkerRoutine;
+	volatile PVOID Parameter;
+} WORK_QUEUE_ITEM, * PWORK_QUEUE_ITEM;
+
+/// <summary>
+/// File object, only the members up to the name of the file.
+/// </summary>
+typedef struct _FILE_OBJECT {
+	CSHORT                Type;
+	CSHORT                Size;
+	PVOID                 DeviceObject;
+	PVOID                 Vpb;
+	PVOID                 FsContext;
+	PVOID                 FsContext2;
+	PVOID                 SectionObjectPointer;
+	PVOID                 PrivateCacheMap;
+	NTSTATUS              FinalStatus;
+	struct _FILE_OBJECT*  RelatedFileObject;
+	BOOLEAN               LockOperation;
+	BOOLEAN               DeletePending;
+	BOOLEAN               ReadAccess;
+	BOOLEAN               WriteAccess;
+	BOOLEAN               DeleteAccess;
+	BOOLEAN               SharedRead;
+	BOOLEAN               SharedWrite;
+	BOOLEAN               SharedDelete;
+	ULONG                 Flags;
+	UNICODE_STRING        FileName;
+} FILE_OBJECT, * PFILE_OBJECT;
+
+//
+// Driver objects, I/O control codes and debug output.
+//
+typedef struct _DEVICE_OBJECT* PDEVICE_OBJECT;
+typedef struct _DRIVER_OBJECT* PDRIVER_OBJECT;
+
+#define METHOD_BUFFERED  0
+#define METHOD_IN_DIRECT 1
+#define FILE_ANY_ACCESS  0
+
+#define CTL_CODE(DeviceType, Function, Method, Access) \
+	(((DeviceType) << 16) | ((Access) << 14) | ((Function) << 2) | (Method))
+
+/// <summary>
+/// Stack location of an IRP, only the parameters of the I/O control requests.
+/// </summary>
+typedef struct _IO_STACK_LOCATION {
+	UCHAR MajorFunction;
+	UCHAR MinorFunction;
+	UCHAR Flags;
+	UCHAR Control;
+	union {
+		struct {
+			ULONG  OutputBufferLength;
+			ULONG  InputBufferLength;
+			ULONG  IoControlCode;
+			PVOID  Type3InputBuffer;
+		} DeviceIoControl;
+	} Parameters;
+} IO_STACK_LOCATION, * PIO_STACK_LOCATION;
+
+// The output of the driver, as the debugger would print it.
+#define KdPrint(Arguments) DbgPrint Arguments
+
+EXTERN_C ULONG DbgPrint(
+	_In_ PCSTR Format,
+	...
+);
+
+//
+// Fast mutexes and run-down protection. A fast mutex raises the IRQL to APC_LEVEL and cannot be
+// acquired recursively.
+//
+typedef struct _FAST_MUTEX {
+	volatile LONG Count;
+	PVOID         Owner;
+	KIRQL         OldIrql;
+} FAST_MUTEX, * PFAST_MUTEX;
+
+typedef struct _EX_RUNDOWN_REF {
+	volatile ULONG_PTR Count; // References times two, the lowest bit set once running down
+} EX_RUNDOWN_REF, * PEX_RUNDOWN_REF;
+
+EXTERN_C VOID ExInitializeFastMutex(
+	_Out_ PFAST_MUTEX FastMutex
+);
+
+EXTERN_C VOID ExAcquireFastMutex(
+	_Inout_ PFAST_MUTEX FastMutex
+);
+
+EXTERN_C VOID ExReleaseFastMutex(
+	_Inout_ PFAST_MUTEX FastMutex
+);
+
+EXTERN_C VOID ExInitializeRundownProtection(
+	_Out_ PEX_RUNDOWN_REF RunRef
+);
+
+EXTERN_C BOOLEAN ExAcquireRundownProtection(
+	_Inout_ PEX_RUNDOWN_REF RunRef
+);
+
+EXTERN_C VOID ExReleaseRundownProtection(
+	_Inout_ PEX_RUNDOWN_REF RunRef
+);
+
+EXTERN_C VOID ExWaitForRundownProtectionRelease(
+	_Inout_ PEX_RUNDOWN_REF RunRef
+);
+
+//
+// Work items, each run by a system thread of its own. Queueing a work item already queued, or
+// freeing it while queued, stops the program.
+//
+typedef struct _IO_WORKITEM* PIO_WORKITEM;
+
+typedef enum _WORK_QUEUE_TYPE {
+	CriticalWorkQueue = 0x00,
+	DelayedWorkQueue  = 0x01
+} WORK_QUEUE_TYPE;
+
+typedef VOID(*PIO_WORKITEM_ROUTINE)(
+	_In_     PDEVICE_OBJECT DeviceObject,
+	_In_opt_ PVOID          Context
+);
+
+EXTERN_C PIO_WORKITEM IoAllocateWorkItem(
+	_In_ PDEVICE_OBJECT DeviceObject
+);
+
+EXTERN_C VOID IoQueueWorkItem(
+	_Inout_  PIO_WORKITEM         IoWorkItem,
+	_In_     PIO_WORKITEM_ROUTINE WorkerRoutine,
+	_In_     WORK_QUEUE_TYPE      QueueType,
+	_In_opt_ PVOID                Context
+);
+
+EXTERN_C VOID IoFreeWorkItem(
+	_In_ PIO_WORKITEM IoWorkItem
+);
+
+//
+// Processes, threads and object references. The only process is the system process, processes
+// looked up by identifier are not found. References are only counted.
+//
+typedef struct _KAPC_STATE {
+	PEPROCESS Process; // Process attached to before
+	BOOLEAN   Attached;
+} KAPC_STATE, * PKAPC_STATE;
+
+/// <summary>
+/// Image being mapped, as given to the image loading callbacks.
+/// </summary>
+typedef struct _IMAGE_INFO {
+	union {
+		ULONG Properties;
+		struct {
+			ULONG ImageAddressingMode  : 8;
+			ULONG SystemModeImage      : 1;
+			ULONG ImageMappedToAllPids : 1;
+			ULONG ExtendedInfoPresent  : 1;
+			ULONG MachineTypeMismatch  : 1;
+			ULONG ImageSignatureLevel  : 4;
+			ULONG ImageSignatureType   : 3;
+			ULONG ImagePartialMap      : 1;
+			ULONG Reserved             : 12;
+		};
+	};
+	PVOID  ImageBase;
+	ULONG  ImageSelector;
+	SIZE_T ImageSize;
+	ULONG  ImageSectionNumber;
+} IMAGE_INFO, * PIMAGE_INFO;
+
+typedef struct _IMAGE_INFO_EX {
+	SIZE_T       Size;
+	IMAGE_INFO   ImageInfo;
+	PFILE_OBJECT FileObject;
+} IMAGE_INFO_EX, * PIMAGE_INFO_EX;
+
+EXTERN_C PEPROCESS PsGetCurrentProcess(
+	VOID
+);
+
+EXTERN_C HANDLE PsGetCurrentThreadId(
+	VOID
+);
+
+EXTERN_C HANDLE PsGetProcessId(
+	_In_ PEPROCESS Process
+);
+
+EXTERN_C LONGLONG PsGetProcessCreateTimeQuadPart(
+	_In_ PEPROCESS Process
+);
+
+EXTERN_C NTSTATUS PsLookupProcessByProcessId(
+	_In_  HANDLE     ProcessId,
+	_Out_ PEPROCESS* Process
+);
+
+EXTERN_C VOID KeStackAttachProcess(
+	_Inout_ PEPROCESS   Process,
+	_Out_   PKAPC_STATE ApcState
+);
+
+EXTERN_C VOID KeUnstackDetachProcess(
+	_In_ PKAPC_STATE ApcState
+);
+
+EXTERN_C VOID ObReferenceObject(
+	_In_ PVOID Object
+);
+
+EXTERN_C VOID ObDereferenceObject(
+	_In_ PVOID Object
+);
+
+//
+// Virtual memory of the processes. User memory is the memory of the program, the MDLs describe
+// pool allocations and are never mapped in a process.
+//
+#define PAGE_NOACCESS           0x00000001
+#define PAGE_TARGETS_NO_UPDATE  0x40000000
+#define PAGE_REVERT_TO_FILE_MAP 0x80000000
+
+#define MM_SECURE_NO_CHANGE      0x00000002
+#define MM_SECURE_USER_MODE_ONLY 0x00000004
+
+#define MdlMappingNoWrite   0x80000000
+#define MdlMappingNoExecute 0x40000000
+
+#define ALL_PROCESSOR_GROUPS 0xFFFF
+
+typedef enum _MODE {
+	KernelMode = 0x00,
+	UserMode   = 0x01
+} MODE, KPROCESSOR_MODE;
+
+typedef enum _MEMORY_CACHING_TYPE {
+	MmNonCached = 0x00,
+	MmCached    = 0x01
+} MEMORY_CACHING_TYPE;
+
+typedef enum _MM_PAGE_PRIORITY {
+	LowPagePriority    = 0x00,
+	NormalPagePriority = 0x10,
+	HighPagePriority   = 0x20
+} MM_PAGE_PRIORITY;
+
+EXTERN_C KIRQL KfRaiseIrql(
+	_In_ KIRQL NewIrql
+);
+
+EXTERN_C ULONG KeQueryActiveProcessorCountEx(
+	_In_ USHORT GroupNumber
+);
+
+EXTERN_C VOID ProbeForRead(
+	_In_ CONST volatile VOID* Address,
+	_In_ SIZE_T               Length,
+	_In_ ULONG                Alignment
+);
+
+EXTERN_C PMDL IoAllocateMdl(
+	_In_opt_    PVOID   VirtualAddress,
+	_In_        ULONG   Length,
+	_In_        BOOLEAN SecondaryBuffer,
+	_In_        BOOLEAN ChargeQuota,
+	_Inout_opt_ PIRP    Irp
+);
+
+EXTERN_C VOID IoFreeMdl(
+	_In_ PMDL Mdl
+);
+
+EXTERN_C VOID MmBuildMdlForNonPagedPool(
+	_Inout_ PMDL MemoryDescriptorList
+);
+
+EXTERN_C PVOID MmMapLockedPagesSpecifyCache(
+	_In_     PMDL                MemoryDescriptorList,
+	_In_     KPROCESSOR_MODE     AccessMode,
+	_In_     MEMORY_CACHING_TYPE CacheType,
+	_In_opt_ PVOID               RequestedAddress,
+	_In_     ULONG               BugCheckOnFailure,
+	_In_     ULONG               Priority
+);
+
+EXTERN_C VOID MmUnmapLockedPages(
+	_In_ PVOID BaseAddress,
+	_In_ PMDL  MemoryDescriptorList
+);
+
+//
+// Structured exception handling of the Microsoft compiler, for the sources defining KSHIM_EXCEPTIONS
+// after including the headers of the C++ runtime, which define __try. Faults are not caught: the
+// __try block runs once, __leave leaves it and the __except block never runs.
+//
+#if defined(KSHIM_EXCEPTIONS)
+#undef __try
+#define __try       for (INT KShimTry = TRUE; KShimTry; KShimTry = FALSE)
+#define __except(e) if (FALSE)
+#define __leave     break
+
+#define EXCEPTION_EXECUTE_HANDLER 1
+#endif // KSHIM_EXCEPTIONS
+
+//
+// State of the simulated kernel.
+//
+
+/// <summary>
+/// Stop the program on a failed NT_ASSERT.
+/// </summary>
+EXTERN_C VOID KShimAssertionFailure(
+	_In_ PCSTR Expression,
+	_In_ PCSTR File,
+	_In_ INT   Line
+);
+
+/// <summary>
+/// Add a module to the list of loaded modules, its image becoming valid kernel memory.
+/// </summary>
+/// <param name="FullPathName">Full path of the module, e.g. \SystemRoot\system32\ntoskrnl.exe.</param>
+/// <param name="ImageBase">Address of the image of the module.</param>
+/// <param name="ImageSize">Size of the image, in bytes.</param>
+/// <returns>STATUS_SUCCESS, or STATUS_INSUFFICIENT_RESOURCES if too many modules are loaded.</returns>
+EXTERN_C NTSTATUS KShimLoadModule(
+	_In_ PCSTR FullPathName,
+	_In_ PVOID ImageBase,
+	_In_ ULONG ImageSize
+);
+
+/// <summary>
+/// Map a buffer as the physical memory read by MmCopyMemory, from physical address zero.
+/// </summary>
+/// <param name="Buffer">Content of the physical memory, NULL to unmap it.</param>
+/// <param name="Size">Size of the physical memory, in bytes.</param>
+EXTERN_C VOID KShimMapPhysicalMemory(
+	_In_opt_ PVOID  Buffer,
+	_In_     SIZE_T Size
+);
+
+/// <summary>
+/// Fail the pool allocations periodically, as the low resources simulation of Driver Verifier.
+/// </summary>
+/// <param name="Period">Every Period-th allocation fails, 0 to never fail.</param>
+EXTERN_C VOID KShimFailPoolAllocations(
+	_In_ ULONG Period
+);
+
+/// <summary>
+/// Number of pool allocations not freed yet, the lookaside lists included.
+/// </summary>
+EXTERN_C LONG64 KShimQueryPoolAllocations(
+	VOID
+);
+
+/// <summary>
+/// Number of object references not released yet.
+/// </summary>
+EXTERN_C LONG64 KShimQueryObjectReferences(
+	VOID
+);
+
+/// <summary>
+/// Number of registry handles not closed yet.
+/// </summary>
+EXTERN_C ULONG KShimQueryOpenHandles(
+	VOID
+);
+
+/// <summary>
+/// Unload the modules, unmap the physical memory, close the registry handles left open, delete
+/// all the registry keys, stop failing pool allocations and forget the object references.
+/// </summary>
+EXTERN_C VOID KShimReset(
+	VOID
+);
+#endif // _KERNEL_MODE
+
+#endif // !__KSHIM_H_GUARD__
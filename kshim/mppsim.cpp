@@ -0,0 +1,470 @@
+/*+================================================================================================
+Module Name: mppsim.cpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+
+Abstract:
+Run the image name, policy and worker routines of the Memory Patching Protection (MPP) driver in
+user mode, on the simulated kernel. Image names are added and removed by batches and one by one,
+and policies loaded, through the routines of the IOCTLs. The protections of random image paths,
+as queued by the image loading callback, are checked against a brute-force search of the names
+and of the policy, and the callback timed. Some of the updates run out of memory, the previous
+names and policy must then stay published. The work item then protects the images of processes
+that are gone, and is run down while still busy. The number of names and of rounds can be given on
+the command line.
+
+Build: cc -O2 -g [-fsanitize=address,undefined] -c kshim.c && c++ -std=c++17 -O2 -g -pthread [-fsanitize=address,undefined] kshim.o mppsim.cpp ../mpp/mpp/cache.cpp ../mpp/mpp/matcher.cpp ../mpp/mpp/policy.cpp ../mpp/mpp/rcu.cpp ../mpp/mpp/sections.cpp ../mpp/mpp/stats.cpp ../mpp/mpp/trace.cpp -o mppsim
+
+================================================================================================+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <random>
+#include <string>
+#include <vector>
+
+#define KSHIM_EXCEPTIONS
+#include "kshim.h"
+
+#include "../mpp/mpp/mpp.cpp"
+#include "../mpp/mpp/worker.cpp"
+
+// Image paths checked after each update.
+#define MPPSIM_PATHS (ULONG)0x400
+
+// Every round out of MPPSIM_FAILURE_ROUND runs out of memory.
+#define MPPSIM_FAILURE_ROUND (ULONG)0x05
+
+// Every round out of MPPSIM_REPLACE_ROUND replaces all the image names.
+#define MPPSIM_REPLACE_ROUND (ULONG)0x07
+
+// First identifier of the processes loading the images, none of them exists.
+#define MPPSIM_PROCESS_ID (ULONG_PTR)0x1000
+
+/// <summary>
+/// Entry of a policy, kept to search it by brute force.
+/// </summary>
+typedef struct _MPPSIM_POLICY_ENTRY {
+	std::wstring Name;
+	UCHAR        Mode;
+	ULONG        Flags;
+} MPPSIM_POLICY_ENTRY, * PMPPSIM_POLICY_ENTRY;
+
+// Images the integrity of which has been recorded.
+static ULONG MppSimRecordedImages = 0x00;
+
+// Directories and files the image paths are made of.
+static CONST WCHAR* MppSimDirectories[] = {
+	L"\\Device\\HarddiskVolume3\\Windows\\System32\\",
+	L"\\Device\\HarddiskVolume3\\Windows\\SysWOW64\\",
+	L"\\Device\\HarddiskVolume3\\Program Files\\Vendor\\",
+	L"\\SystemRoot\\System32\\drivers\\",
+	L"C:/Tools/"
+};
+static CONST WCHAR* MppSimFiles[] = {
+	L"amsi.dll", L"ntdll.dll", L"kernel32.dll", L"KernelBase.dll", L"clr.dll", L"wldp.dll",
+	L"user32.dll", L"combase.dll", L"mpoav.dll", L"scrrun.dll", L"jscript9.dll", L"vbscript.dll"
+};
+
+
+/// <summary>
+/// Baseline of the ranges of an image, read from its file. The file system is not simulated, and
+/// the worker only records the images of the processes it attaches to, none of which exists.
+/// </summary>
+_Use_decl_annotations_
+VOID __declspec(code_seg("PAGE"))
+MppIntegrity::RecordImage(
+	_In_     PEPROCESS                            Process,
+	_In_     PUCHAR                               ImageBase,
+	_In_opt_ PFILE_OBJECT                         ImageFile,
+	_In_     CONST MppCache::MPP_CACHE_KEY*       Key,
+	_In_     CONST MppSections::MPP_SECTION_PLAN* Plan
+) {
+	UNREFERENCED_PARAMETER(Process);
+	UNREFERENCED_PARAMETER(ImageBase);
+	UNREFERENCED_PARAMETER(ImageFile);
+	UNREFERENCED_PARAMETER(Key);
+	UNREFERENCED_PARAMETER(Plan);
+	MppSimRecordedImages++;
+}
+
+
+/// <summary>
+/// Random image path, the case of the file name changed at times.
+/// </summary>
+static std::wstring MppSimPath(
+	_Inout_ std::mt19937& Random
+) {
+	std::wstring Path = MppSimDirectories[Random() % _ARRAYSIZE(MppSimDirectories)];
+	std::wstring File = MppSimFiles[Random() % _ARRAYSIZE(MppSimFiles)];
+	if ((Random() % 0x04) == 0x00) {
+		for (WCHAR& Character : File)
+			Character = (Character >= L'a' && Character <= L'z') ? (WCHAR)(Character - (L'a' - L'A')) : Character;
+	}
+	if ((Random() % 0x08) == 0x00)
+		File.insert(0x00, std::to_wstring(Random() % 0x10));
+	return Path + File;
+}
+
+
+/// <summary>
+/// Input buffer of the MppUpdateImageNames IOCTL, the names added followed by the names removed.
+/// </summary>
+static std::vector<ULONG64> MppSimPackNames(
+	_In_  CONST std::vector<std::wstring>& Added,
+	_In_  CONST std::vector<std::wstring>& Removed,
+	_In_  ULONG                            Flags,
+	_Out_ SIZE_T*                          Size
+) {
+	*Size = FIELD_OFFSET(MppIoctl::MPP_IMAGE_NAMES, Names);
+	for (CONST std::vector<std::wstring>* Names : { &Added, &Removed }) {
+		for (CONST std::wstring& Name : *Names)
+			*Size += FIELD_OFFSET(MppIoctl::MPP_IMAGE_NAME, Name) + (Name.size() * sizeof(WCHAR));
+	}
+
+	std::vector<ULONG64> Buffer((*Size / sizeof(ULONG64)) + 1);
+	auto Header = reinterpret_cast<MppIoctl::MPP_IMAGE_NAMES*>(Buffer.data());
+	Header->Flags           = Flags;
+	Header->NumberOfAdded   = (ULONG)Added.size();
+	Header->NumberOfRemoved = (ULONG)Removed.size();
+
+	PUCHAR Cursor = reinterpret_cast<PUCHAR>(Header->Names);
+	for (CONST std::vector<std::wstring>* Names : { &Added, &Removed }) {
+		for (CONST std::wstring& Name : *Names) {
+			auto Entry = reinterpret_cast<MppIoctl::MPP_IMAGE_NAME*>(Cursor);
+			Entry->Length = (USHORT)Name.size();
+			RtlCopyMemory(Entry->Name, Name.c_str(), Name.size() * sizeof(WCHAR));
+			Cursor += FIELD_OFFSET(MppIoctl::MPP_IMAGE_NAME, Name) + (Name.size() * sizeof(WCHAR));
+		}
+	}
+	return Buffer;
+}
+
+
+/// <summary>
+/// Load an image, and get the protections queued for it by the image loading callback.
+/// </summary>
+static ULONG MppSimLoadImage(
+	_In_     CONST std::wstring& Path,
+	_In_     HANDLE              ProcessId,
+	_In_opt_ PFILE_OBJECT        FileObject
+) {
+	UNICODE_STRING FullImageName = { 0x00 };
+	FullImageName.Buffer        = const_cast<PWCH>(Path.c_str());
+	FullImageName.Length        = (USHORT)(Path.size() * sizeof(WCHAR));
+	FullImageName.MaximumLength = FullImageName.Length;
+
+	IMAGE_INFO_EX ImageInfoEx = { 0x00 };
+	ImageInfoEx.Size                          = sizeof(IMAGE_INFO_EX);
+	ImageInfoEx.ImageInfo.ExtendedInfoPresent = FileObject != NULL;
+	ImageInfoEx.FileObject                    = FileObject;
+	MppCallbacks::LoadImageNotify(&FullImageName, ProcessId, &ImageInfoEx.ImageInfo);
+
+	// Without a work item, the request stays queued
+	MppWorker::MPP_WORKER_PROTECT_DATA WorkerData = { 0x00 };
+	if (MppWorker::ProtectWorker != nullptr || !MppQueue::Pop(&MppWorker::ProtectQueue, &WorkerData))
+		return 0x00;
+	if (WorkerData.ImageFile != nullptr)
+		ObDereferenceObject(WorkerData.ImageFile);
+	return WorkerData.Flags;
+}
+
+
+/// <summary>
+/// Lower case of the ASCII characters.
+/// </summary>
+static std::wstring MppSimFold(
+	_In_ std::wstring Name
+) {
+	for (WCHAR& Character : Name)
+		Character = (Character >= L'A' && Character <= L'Z') ? (WCHAR)(Character + (L'a' - L'A')) : Character;
+	return Name;
+}
+
+
+/// <summary>
+/// Protections of an image, searched by brute force.
+/// </summary>
+static ULONG MppSimExpected(
+	_In_ CONST std::wstring&                      Path,
+	_In_ CONST std::vector<std::wstring>&         Names,
+	_In_ CONST std::vector<MPPSIM_POLICY_ENTRY>&  Policy
+) {
+	ULONG Flags = 0x00;
+	for (CONST std::wstring& Name : Names) {
+		if (Path.find(Name) != std::wstring::npos)
+			Flags = MppPolicy::ValidFlags;
+	}
+
+	std::wstring Folded = MppSimFold(Path);
+	SIZE_T       Start  = Folded.find_last_of(L"\\/");
+	std::wstring File   = Start == std::wstring::npos ? Folded : Folded.substr(Start + 1);
+	for (CONST MPPSIM_POLICY_ENTRY& Entry : Policy) {
+		std::wstring Name = MppSimFold(Entry.Name);
+		BOOLEAN      Match = FALSE;
+		if (Entry.Mode == MppPolicy::MatchPath)
+			Match = Folded == Name;
+		else if (Entry.Mode == MppPolicy::MatchExact)
+			Match = Start != std::wstring::npos && File == Name;
+		else
+			Match = Folded.size() >= Name.size() && Folded.compare(Folded.size() - Name.size(), Name.size(), Name) == 0x00;
+		if (Match)
+			Flags |= Entry.Flags;
+	}
+	return Flags;
+}
+
+
+/// <summary>
+/// Random policy, as a text specification, and its entries.
+/// </summary>
+static std::string MppSimPolicyText(
+	_Inout_ std::mt19937&                      Random,
+	_Out_   std::vector<MPPSIM_POLICY_ENTRY>&  Entries
+) {
+	static CONST CHAR* Modes[MppPolicy::NumberOfModes] = { "suffix", "exact", "path" };
+
+	Entries.clear();
+	std::string Text = "revision " + std::to_string(Random() % 0x100) + "\n";
+	ULONG       Count = 0x01 + (Random() % 0x10);
+	for (ULONG cx = 0x00; cx < Count; cx++) {
+		MPPSIM_POLICY_ENTRY Entry;
+		Entry.Mode  = (UCHAR)(Random() % MppPolicy::NumberOfModes);
+		Entry.Flags = 0x01 + (Random() % MppPolicy::ValidFlags);
+		if (Entry.Mode == MppPolicy::MatchPath)
+			Entry.Name = MppSimPath(Random);
+		else if (Entry.Mode == MppPolicy::MatchExact)
+			Entry.Name = MppSimFiles[Random() % _ARRAYSIZE(MppSimFiles)];
+		else
+			Entry.Name = std::wstring(L"\\") + MppSimFiles[Random() % _ARRAYSIZE(MppSimFiles)];
+
+		// Paths and file names are ASCII
+		Text += Modes[Entry.Mode];
+		Text += " \"";
+		for (WCHAR Character : Entry.Name)
+			Text += (CHAR)Character;
+		Text += "\"";
+		if (Entry.Flags & MppPolicy::FlagProtect)
+			Text += " protect";
+		if (Entry.Flags & MppPolicy::FlagIntegrity)
+			Text += " integrity";
+		Text += "\n";
+		Entries.push_back(Entry);
+	}
+	return Text;
+}
+
+
+/// <summary>
+/// Whether the list of the image names agrees with its counters.
+/// </summary>
+static BOOLEAN MppSimCheckNames(
+	VOID
+) {
+	ULONG  NumberOfNames = 0x00;
+	SIZE_T Length        = 0x00;
+	for (PLIST_ENTRY Head = MppCallbackData::HeadImageNames.Flink; Head != &MppCallbackData::HeadImageNames; Head = Head->Flink) {
+		NumberOfNames++;
+		Length += CONTAINING_RECORD(Head, MppCallbackData::ImageNameEntry, List)->Length;
+	}
+	return NumberOfNames == MppCallbackData::NumberOfImageNames && Length == MppCallbackData::ImageNamesLength;
+}
+
+
+int main(
+	int   argc,
+	char* argv[]
+) {
+	ULONG NumberOfNames = argc > 0x01 ? (ULONG)strtoul(argv[1], NULL, 0) : 0x40;
+	ULONG Rounds        = argc > 0x02 ? (ULONG)strtoul(argv[2], NULL, 0) : 0x40;
+	if (NumberOfNames == 0x00 || Rounds == 0x00) {
+		fprintf(stderr, "usage: mppsim [names] [rounds]\n");
+		return EXIT_FAILURE;
+	}
+
+	// As DriverEntry, the kernel routines being initialised by their IOCTL
+	MppQueue::Initialise(&MppWorker::ProtectQueue);
+	ExInitializeRundownProtection(&MppWorker::ProtectRundown);
+	MppCache::Initialise(&MppWorker::PlanCache);
+	MppStats::Initialise(&MppGlobals::Statistics);
+	ExInitializeFastMutex(&MppCallbackData::ImageNamesLock);
+	MppRcu::Initialise(&MppCallbackData::ImageNames, nullptr);
+	ExInitializeFastMutex(&MppCallbackData::PolicyLock);
+	MppRcu::Initialise(&MppCallbackData::Policy, nullptr);
+	InitializeListHead(&MppCallbackData::HeadImageNames);
+	MppKernelRoutines::RoutinesInitialised = TRUE;
+
+	std::mt19937                     Random(0x4D5050);
+	std::vector<std::wstring>        Names;
+	std::vector<MPPSIM_POLICY_ENTRY> Policy;
+	ULONG                            Errors   = 0x00;
+	ULONG                            Failures = 0x00;
+	ULONG                            Matched  = 0x00;
+	ULONG64                          Nanoseconds = 0x00;
+
+	for (ULONG Round = 0x00; Round < Rounds; Round++) {
+		// Names to add, some already published, and names to remove, some never added
+		std::vector<std::wstring> Added;
+		std::vector<std::wstring> Removed;
+		ULONG Count = 0x01 + (Random() % NumberOfNames);
+		for (ULONG cx = 0x00; cx < Count; cx++) {
+			std::wstring Name = (Random() % 0x02) == 0x00
+				? std::wstring(MppSimFiles[Random() % _ARRAYSIZE(MppSimFiles)])
+				: MppSimPath(Random);
+			if (Name.size() > 0x08 && (Random() % 0x02) == 0x00)
+				Name.erase(0x00, Random() % (Name.size() - 0x04));
+			if ((Random() % 0x03) == 0x00)
+				Removed.push_back(Name);
+			else
+				Added.push_back(Name);
+		}
+		for (ULONG cx = 0x00; !Names.empty() && cx < (Count / 0x02); cx++)
+			Removed.push_back(Names[Random() % Names.size()]);
+
+		std::vector<MPPSIM_POLICY_ENTRY> NewPolicy;
+		std::string Text = MppSimPolicyText(Random, NewPolicy);
+		ULONG PolicySize = 0x00;
+		ULONG ErrorLine  = 0x00;
+		MppPolicy::Compile(Text.data(), Text.size(), NULL, 0x00, &PolicySize, &ErrorLine);
+		std::vector<ULONG64> Binary((PolicySize / sizeof(ULONG64)) + 1);
+		if (MppPolicy::Compile(Text.data(), Text.size(), Binary.data(), PolicySize, &PolicySize, &ErrorLine) != MppPolicy::PolicySuccess) {
+			fprintf(stderr, "mppsim: policy of round %u rejected, line %u\n", Round, ErrorLine);
+			Errors++;
+			continue;
+		}
+
+		// Some rounds run out of memory, once the removed names are allocated, while allocating the
+		// entries of the names added, compiling the names or loading the policy
+		BOOLEAN LowResources = (Round % MPPSIM_FAILURE_ROUND) == (MPPSIM_FAILURE_ROUND - 1);
+		BOOLEAN Replace      = (Round % MPPSIM_REPLACE_ROUND) == (MPPSIM_REPLACE_ROUND - 1);
+		BOOLEAN OneByOne     = !Replace && (Round % 0x02) != 0x00;
+		ULONG   Period       = 0x02 + (ULONG)Added.size() + (Random() % 0x02);
+		if (!Added.empty() && (Random() % 0x03) == 0x00)
+			Period = 0x02 + (Random() % (ULONG)Added.size());
+		KShimFailPoolAllocations(LowResources ? Period : 0x00);
+		KIRQL OldIrql = 0x00;
+		KeRaiseIrql(APC_LEVEL, &OldIrql);
+
+		NTSTATUS NamesStatus = STATUS_SUCCESS;
+		if (OneByOne) {
+			// As the MppAddImageName and MppRemoveImageName IOCTLs, each name published on its own
+			for (CONST std::wstring& Name : Added) {
+				NTSTATUS Status = MppCallbackData::AddImageName(const_cast<LPWSTR>(Name.c_str()), (Name.size() + 1) * sizeof(WCHAR));
+				if (NT_SUCCESS(Status))
+					Names.push_back(Name);
+				else
+					NamesStatus = Status;
+			}
+			for (CONST std::wstring& Name : Removed) {
+				NTSTATUS Status = MppCallbackData::RemoveImageName(const_cast<LPWSTR>(Name.c_str()));
+				for (SIZE_T cx = 0x00; NT_SUCCESS(Status) && cx < Names.size(); cx++) {
+					if (Names[cx] == Name) {
+						Names.erase(Names.begin() + cx);
+						break;
+					}
+				}
+				if (!NT_SUCCESS(Status))
+					NamesStatus = Status;
+			}
+		}
+		else {
+			SIZE_T               Size   = 0x00;
+			std::vector<ULONG64> Buffer = MppSimPackNames(Added, Removed, Replace ? MppIoctl::MppImageNamesReplace : 0x00, &Size);
+			NamesStatus = MppCallbackData::UpdateImageNames(
+				reinterpret_cast<CONST MppIoctl::MPP_IMAGE_NAMES*>(Buffer.data()),
+				Size
+			);
+			if (NT_SUCCESS(NamesStatus)) {
+				std::vector<std::wstring> Kept;
+				for (CONST std::wstring& Name : Names) {
+					BOOLEAN Remove = Replace;
+					for (CONST std::wstring& Other : Removed)
+						Remove |= Name == Other;
+					if (!Remove)
+						Kept.push_back(Name);
+				}
+				Kept.insert(Kept.end(), Added.begin(), Added.end());
+				Names.swap(Kept);
+			}
+		}
+
+		MppIoctl::MPP_POLICY_RESULT Result = { 0x00 };
+		NTSTATUS PolicyStatus = MppCallbackData::LoadPolicy(Binary.data(), PolicySize, &Result);
+		KeLowerIrql(OldIrql);
+		KShimFailPoolAllocations(0x00);
+
+		if (NT_SUCCESS(PolicyStatus))
+			Policy.swap(NewPolicy);
+		if (!LowResources && (!NT_SUCCESS(NamesStatus) || !NT_SUCCESS(PolicyStatus))) {
+			fprintf(stderr, "mppsim: round %u failed (0x%08X, 0x%08X)\n", Round, (ULONG)NamesStatus, (ULONG)PolicyStatus);
+			Errors++;
+		}
+		Failures += !NT_SUCCESS(NamesStatus) + !NT_SUCCESS(PolicyStatus);
+		if (MppCallbackData::NumberOfImageNames != Names.size() || !MppSimCheckNames()) {
+			fprintf(stderr, "mppsim: %u names published after round %u, %zu expected\n", MppCallbackData::NumberOfImageNames, Round, Names.size());
+			Errors++;
+		}
+
+		// Images loaded, at PASSIVE_LEVEL as the callback
+		std::vector<std::wstring> Paths;
+		for (ULONG cx = 0x00; cx < MPPSIM_PATHS; cx++)
+			Paths.push_back(MppSimPath(Random));
+		std::vector<ULONG> Flags(Paths.size());
+
+		struct timespec Start, End;
+		clock_gettime(CLOCK_MONOTONIC, &Start);
+		for (SIZE_T cx = 0x00; cx < Paths.size(); cx++)
+			Flags[cx] = MppSimLoadImage(Paths[cx], (HANDLE)(MPPSIM_PROCESS_ID + (cx * 0x04)), NULL);
+		clock_gettime(CLOCK_MONOTONIC, &End);
+		Nanoseconds += ((End.tv_sec - Start.tv_sec) * 1000000000ULL) + End.tv_nsec - Start.tv_nsec;
+
+		for (SIZE_T cx = 0x00; cx < Paths.size(); cx++) {
+			ULONG Expected = MppSimExpected(Paths[cx], Names, Policy);
+			Matched += Flags[cx] != 0x00;
+			if (Flags[cx] != Expected) {
+				fprintf(stderr, "mppsim: round %u, %ls: flags 0x%x, 0x%x expected\n", Round, Paths[cx].c_str(), Flags[cx], Expected);
+				Errors++;
+			}
+		}
+	}
+
+	// The work item protects the images of the processes, which are gone, and is run down while busy
+	MppStats::MPP_STATS_SNAPSHOT Before = { 0x00 };
+	MppStats::MPP_STATS_SNAPSHOT After  = { 0x00 };
+	MppStats::Snapshot(&MppGlobals::Statistics, &Before);
+	MppWorker::ProtectWorker = IoAllocateWorkItem(NULL);
+	FILE_OBJECT FileObject = { 0x00 };
+	for (ULONG cx = 0x00; MppWorker::ProtectWorker != nullptr && cx < MPPSIM_PATHS; cx++)
+		MppSimLoadImage(MppSimPath(Random), (HANDLE)(MPPSIM_PROCESS_ID + (cx * 0x04)), &FileObject);
+
+	// As DriverUnload, the callback being removed
+	MppWorker::Rundown();
+	if (MppWorker::ProtectWorker != nullptr)
+		IoFreeWorkItem(MppWorker::ProtectWorker);
+	MppWorker::ProtectWorker = nullptr;
+	MppCallbackData::Free();
+
+	MppStats::Snapshot(&MppGlobals::Statistics, &After);
+	LONG64 Queued    = After.Counters[MppStats::CounterImagesMatched] - Before.Counters[MppStats::CounterImagesMatched];
+	LONG64 Attached  = After.Counters[MppStats::CounterAttachFailures] - Before.Counters[MppStats::CounterAttachFailures];
+	LONG64 Dropped   = After.Counters[MppStats::CounterRequestsDropped] - Before.Counters[MppStats::CounterRequestsDropped];
+	LONG64 Abandoned = Queued - Attached - Dropped;
+	if (Abandoned < 0x00 || MppSimRecordedImages != 0x00) {
+		fprintf(stderr, "mppsim: %lld request(s) queued, %lld process(es) not found, %lld dropped\n", (long long)Queued, (long long)Attached, (long long)Dropped);
+		Errors++;
+	}
+
+	LONG64 Leaks      = KShimQueryPoolAllocations();
+	LONG64 References = KShimQueryObjectReferences();
+	printf("mppsim: %u rounds, %zu names and %zu policy entries published at the end\n", Rounds, Names.size(), Policy.size());
+	printf("mppsim: %.1f ns per image, %u of %u image(s) matched\n", (double)Nanoseconds / ((double)Rounds * MPPSIM_PATHS), Matched, Rounds * MPPSIM_PATHS);
+	printf("mppsim: %u update(s) out of memory\n", Failures);
+	printf("mppsim: worker, %lld request(s) for processes gone, %lld dropped, %lld left at run-down\n", (long long)Attached, (long long)Dropped, (long long)Abandoned);
+	printf("mppsim: %u difference(s), %lld pool allocation(s) and %lld reference(s) leaked\n", Errors, (long long)Leaks, (long long)References);
+
+	KShimReset();
+	return (Errors == 0x00 && Leaks == 0x00 && References == 0x00) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
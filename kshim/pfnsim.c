@@ -0,0 +1,296 @@
+/*+================================================================================================
+Module Name: pfnsim.c
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+
+Abstract:
+Run the PFN database scan of the MManager driver in user mode, on a synthetic MMPFN database.
+Processes are laid out as their page table pages, linked through PteFrame up to a top-level
+page table that is its own PteFrame, and the private pages they map. Shared pages, pages on the
+free, zeroed and bad lists, and private pages whose PteFrame chain is too deep, loops or leaves the
+database are mixed in. The database is scanned in random batches by two scans that are merged,
+as the workers of vadscan do, and the counts per list and per owner checked against the layout.
+The number of processes and of pages per process can be given on the command line.
+
+Build: cc -O2 -g [-fsanitize=address,undefined] kshim.c pfnsim.c -o pfnsim
+
+================================================================================================+*/
+
+#include "kshim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../MManager/MManager/mm/pfndb.c"
+
+// Page tables of each process below the PML4, PDPT and PD.
+#define PFNSIM_PAGE_TABLES 0x04
+
+// Owner table of each scan, and of the merged one.
+#define PFNSIM_MAXIMUM_OWNERS 0x400
+
+// Owner of a page that is not private, and of a private page without a top-level page table.
+#define PFNSIM_NOT_PRIVATE   (ULONG)-1
+#define PFNSIM_UNATTRIBUTED  (ULONG)-2
+
+/// <summary>
+/// Synthetic PFN database.
+/// </summary>
+typedef struct _PFNSIM_DATABASE {
+	PUCHAR   Entries;         // XPFN_ENTRY_SIZE bytes per page
+	ULONG64  NumberOfPages;
+	ULONG64  NextPage;
+	PULONG   Owners;          // Process of each page, or PFNSIM_NOT_PRIVATE or PFNSIM_UNATTRIBUTED
+	PULONG64 TopLevelTables;  // PFN of the PML4 of each process, and of the top of the deep chain
+	ULONG    NumberOfProcesses;
+} PFNSIM_DATABASE, * PPFNSIM_DATABASE;
+
+/// <summary>
+/// Write an MMPFN entry, with random bits around the fields scanned.
+/// </summary>
+static ULONG64 PfnSimAddPage(
+	_Inout_ PPFNSIM_DATABASE Database,
+	_In_    XPFN_LIST        List,
+	_In_    ULONG64          U4,
+	_In_    ULONG            Owner
+) {
+	if (Database->NextPage == Database->NumberOfPages) {
+		fprintf(stderr, "pfnsim: out of simulated pages.\n");
+		exit(EXIT_FAILURE);
+	}
+	ULONG64 PageFrameNumber = Database->NextPage++;
+	PUCHAR  Entry           = Database->Entries + (PageFrameNumber * XPFN_ENTRY_SIZE);
+
+	*(PULONG64)(Entry + XPFN_PTE_ADDRESS)     = 0xFFFFF68000000000 + ((ULONG64)rand() << 3);
+	*(PUSHORT)(Entry + XPFN_REFERENCE_COUNT)  = (USHORT)(List == XPfnListActive ? 0x01 : 0x00);
+	Entry[XPFN_E1]                            = (UCHAR)((rand() & 0xF8) | List);
+	*(PULONG64)(Entry + XPFN_U4)              = U4 | ((ULONG64)(rand() & 0x7FF) << 40);
+	Database->Owners[PageFrameNumber]         = Owner;
+	return PageFrameNumber;
+}
+
+/// <summary>
+/// List of a page mapped by a PTE.
+/// </summary>
+static XPFN_LIST PfnSimMappedList(
+	VOID
+) {
+	static CONST XPFN_LIST Lists[] = {
+		XPfnListActive, XPfnListActive, XPfnListActive, XPfnListStandby,
+		XPfnListModified, XPfnListModifiedNoWrite, XPfnListTransition
+	};
+	return Lists[rand() % _ARRAYSIZE(Lists)];
+}
+
+/// <summary>
+/// Build the synthetic database.
+/// </summary>
+static VOID PfnSimCreateDatabase(
+	_Out_ PPFNSIM_DATABASE Database,
+	_In_  ULONG            NumberOfProcesses,
+	_In_  ULONG            PagesPerProcess
+) {
+	memset(Database, 0x00, sizeof(PFNSIM_DATABASE));
+	Database->NumberOfProcesses = NumberOfProcesses;
+	Database->NumberOfPages     = 0x100 + ((ULONG64)NumberOfProcesses * (0x03 + PFNSIM_PAGE_TABLES + (PagesPerProcess * 0x03)));
+	Database->Entries           = calloc(Database->NumberOfPages, XPFN_ENTRY_SIZE);
+	Database->Owners            = calloc(Database->NumberOfPages, sizeof(ULONG));
+	Database->TopLevelTables    = calloc(NumberOfProcesses + 1, sizeof(ULONG64));
+	if (Database->Entries == NULL || Database->Owners == NULL || Database->TopLevelTables == NULL) {
+		fprintf(stderr, "pfnsim: out of memory.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// PFN zero is never used
+	PfnSimAddPage(Database, XPfnListBad, 0x00, PFNSIM_NOT_PRIVATE);
+
+	for (ULONG Process = 0x00; Process < NumberOfProcesses; Process++) {
+		ULONG64 Pml4 = Database->NextPage;
+		PfnSimAddPage(Database, XPfnListActive, Pml4, Process);
+		ULONG64 Pdpt = PfnSimAddPage(Database, XPfnListActive, Pml4, Process);
+		ULONG64 Pd   = PfnSimAddPage(Database, XPfnListActive, Pdpt, Process);
+		ULONG64 Pts[PFNSIM_PAGE_TABLES];
+		for (ULONG cx = 0x00; cx < PFNSIM_PAGE_TABLES; cx++)
+			Pts[cx] = PfnSimAddPage(Database, XPfnListActive, Pd, Process);
+		Database->TopLevelTables[Process] = Pml4;
+
+		// Private pages of the process, shared and free pages in between
+		for (ULONG cx = 0x00; cx < PagesPerProcess; cx++) {
+			PfnSimAddPage(Database, PfnSimMappedList(), Pts[rand() % PFNSIM_PAGE_TABLES], Process);
+			switch (rand() % 0x04) {
+			case 0x00:
+				PfnSimAddPage(Database, PfnSimMappedList(), XPFN_PROTOTYPE_PTE | (ULONG64)rand(), PFNSIM_NOT_PRIVATE);
+				break;
+			case 0x01:
+				PfnSimAddPage(Database, (XPFN_LIST)(rand() % 0x02), (ULONG64)rand(), PFNSIM_NOT_PRIVATE);
+				break;
+			default:
+				break;
+			}
+		}
+	}
+
+	// PteFrame chain deeper than XPFN_MAXIMUM_DEPTH, ending at a top-level page table
+	ULONG64 Chain = PfnSimAddPage(Database, XPfnListActive, Database->NextPage, PFNSIM_NOT_PRIVATE);
+	for (ULONG cx = 0x00; cx < XPFN_MAXIMUM_DEPTH + 1; cx++)
+		PfnSimAddPage(Database, XPfnListActive, Database->NextPage - 1, PFNSIM_NOT_PRIVATE);
+	ULONG64 Deep = Database->NextPage - 1;
+
+	// Page tables pointing to each other
+	ULONG64 Loop = Database->NextPage;
+	PfnSimAddPage(Database, XPfnListActive, Loop + 1, PFNSIM_UNATTRIBUTED);
+	PfnSimAddPage(Database, XPfnListActive, Loop, PFNSIM_UNATTRIBUTED);
+
+	for (ULONG cx = 0x00; cx < 0x40; cx++) {
+		PfnSimAddPage(Database, PfnSimMappedList(), Deep, PFNSIM_UNATTRIBUTED);
+		PfnSimAddPage(Database, PfnSimMappedList(), Loop, PFNSIM_UNATTRIBUTED);
+		PfnSimAddPage(Database, PfnSimMappedList(), Database->NumberOfPages + cx, PFNSIM_UNATTRIBUTED);
+		PfnSimAddPage(Database, XPfnListBad, (ULONG64)rand(), PFNSIM_NOT_PRIVATE);
+	}
+
+	// Pages of the chain at most XPFN_MAXIMUM_DEPTH tables below its top belong to it
+	for (ULONG64 Page = Chain; Page <= Deep; Page++)
+		Database->Owners[Page] = (Page - Chain) <= XPFN_MAXIMUM_DEPTH ? NumberOfProcesses : PFNSIM_UNATTRIBUTED;
+	Database->TopLevelTables[NumberOfProcesses] = Chain;
+	Database->NumberOfPages = Database->NextPage;
+}
+
+/// <summary>
+/// ReadU4 routine of the scan, over the synthetic database.
+/// </summary>
+static BOOLEAN PfnSimReadU4(
+	_In_opt_ PVOID    Context,
+	_In_     ULONG64  PageFrameNumber,
+	_Out_    PULONG64 U4
+) {
+	PPFNSIM_DATABASE Database = (PPFNSIM_DATABASE)Context;
+	if (PageFrameNumber >= Database->NumberOfPages)
+		return FALSE;
+	*U4 = *(PULONG64)(Database->Entries + (PageFrameNumber * XPFN_ENTRY_SIZE) + XPFN_U4);
+	return TRUE;
+}
+
+/// <summary>
+/// Scan a range of the database in batches of random sizes.
+/// </summary>
+static VOID PfnSimScanRange(
+	_Inout_ PXPFN_SCAN       Scan,
+	_In_    PPFNSIM_DATABASE Database,
+	_In_    ULONG64          First,
+	_In_    ULONG64          Last
+) {
+	for (ULONG64 PageFrameNumber = First; PageFrameNumber < Last;) {
+		ULONG64 Count = 0x01 + (rand() % 0x400);
+		if (Count > Last - PageFrameNumber)
+			Count = Last - PageFrameNumber;
+		XMiScanPfnBatch(Scan, Database->Entries + (PageFrameNumber * XPFN_ENTRY_SIZE), PageFrameNumber, Count);
+		PageFrameNumber += Count;
+	}
+}
+
+
+int main(
+	int   argc,
+	char* argv[]
+) {
+	ULONG NumberOfProcesses = argc > 0x01 ? (ULONG)strtoul(argv[1], NULL, 0) : 0x100;
+	ULONG PagesPerProcess   = argc > 0x02 ? (ULONG)strtoul(argv[2], NULL, 0) : 0x400;
+	if (NumberOfProcesses == 0x00 || NumberOfProcesses >= PFNSIM_MAXIMUM_OWNERS || PagesPerProcess == 0x00) {
+		fprintf(stderr, "usage: pfnsim [processes, less than %u] [pages]\n", PFNSIM_MAXIMUM_OWNERS);
+		return EXIT_FAILURE;
+	}
+	srand(0x50464E);
+
+	PFNSIM_DATABASE Database;
+	PfnSimCreateDatabase(&Database, NumberOfProcesses, PagesPerProcess);
+
+	// Expected counters, one owner more for the top of the deep chain
+	XPFN_COUNTERS  Total        = { 0x00 };
+	XPFN_COUNTERS  Shared       = { 0x00 };
+	XPFN_COUNTERS  Private      = { 0x00 };
+	XPFN_COUNTERS  Unattributed = { 0x00 };
+	PXPFN_COUNTERS Owners       = calloc(NumberOfProcesses + 1, sizeof(XPFN_COUNTERS));
+	PXPFN_SCAN     Scans        = calloc(0x03, sizeof(XPFN_SCAN));
+	PXPFN_OWNER    OwnerTables  = calloc(0x03 * PFNSIM_MAXIMUM_OWNERS, sizeof(XPFN_OWNER));
+	if (Owners == NULL || Scans == NULL || OwnerTables == NULL) {
+		fprintf(stderr, "pfnsim: out of memory.\n");
+		return EXIT_FAILURE;
+	}
+	for (ULONG64 Page = 0x00; Page < Database.NumberOfPages; Page++) {
+		PUCHAR Entry = Database.Entries + (Page * XPFN_ENTRY_SIZE);
+		ULONG  List  = XPFN_PAGE_LOCATION(Entry[XPFN_E1]);
+		Total.Pages[List]++;
+		if (List == XPfnListZeroed || List == XPfnListFree || List == XPfnListBad)
+			continue;
+		if (*(PULONG64)(Entry + XPFN_U4) & XPFN_PROTOTYPE_PTE) {
+			Shared.Pages[List]++;
+			continue;
+		}
+		Private.Pages[List]++;
+		if (Database.Owners[Page] == PFNSIM_UNATTRIBUTED)
+			Unattributed.Pages[List]++;
+		else
+			Owners[Database.Owners[Page]].Pages[List]++;
+	}
+
+	// Two workers over both halves, merged
+	for (ULONG cx = 0x00; cx < 0x03; cx++)
+		XMiInitializePfnScan(&Scans[cx], &OwnerTables[cx * PFNSIM_MAXIMUM_OWNERS], PFNSIM_MAXIMUM_OWNERS, PfnSimReadU4, &Database);
+	ULONG64 Middle = Database.NumberOfPages / 0x02;
+
+	struct timespec Start, End;
+	clock_gettime(CLOCK_MONOTONIC, &Start);
+	PfnSimScanRange(&Scans[0x00], &Database, 0x00, Middle);
+	PfnSimScanRange(&Scans[0x01], &Database, Middle, Database.NumberOfPages);
+	clock_gettime(CLOCK_MONOTONIC, &End);
+	ULONG64 Nanoseconds = ((End.tv_sec - Start.tv_sec) * 1000000000ULL) + End.tv_nsec - Start.tv_nsec;
+
+	XMiMergePfnScan(&Scans[0x02], &Scans[0x00]);
+	XMiMergePfnScan(&Scans[0x02], &Scans[0x01]);
+	PXPFN_SCAN Scan   = &Scans[0x02];
+	ULONG      Errors = 0x00;
+
+	if (memcmp(&Scan->Total, &Total, sizeof(XPFN_COUNTERS)) != 0x00
+		|| memcmp(&Scan->Shared, &Shared, sizeof(XPFN_COUNTERS)) != 0x00
+		|| memcmp(&Scan->Private, &Private, sizeof(XPFN_COUNTERS)) != 0x00
+		|| memcmp(&Scan->Unattributed, &Unattributed, sizeof(XPFN_COUNTERS)) != 0x00) {
+		for (ULONG List = 0x00; List < XPfnListMaximum; List++) {
+			fprintf(stderr, "pfnsim: list %u: %llu/%llu total, %llu/%llu shared, %llu/%llu private, %llu/%llu unattributed\n", List,
+				(unsigned long long)Scan->Total.Pages[List], (unsigned long long)Total.Pages[List],
+				(unsigned long long)Scan->Shared.Pages[List], (unsigned long long)Shared.Pages[List],
+				(unsigned long long)Scan->Private.Pages[List], (unsigned long long)Private.Pages[List],
+				(unsigned long long)Scan->Unattributed.Pages[List], (unsigned long long)Unattributed.Pages[List]);
+		}
+		Errors++;
+	}
+
+	// Owners, by DirectoryTableBase as in KPROCESS
+	for (ULONG Process = 0x00; Process <= NumberOfProcesses; Process++) {
+		PXPFN_OWNER Owner = XMiFindPfnOwner(Scan, (Database.TopLevelTables[Process] << PAGE_SHIFT) | 0x02);
+		if (Owner == NULL || memcmp(&Owner->Counters, &Owners[Process], sizeof(XPFN_COUNTERS)) != 0x00) {
+			fprintf(stderr, "pfnsim: process %u: owner of PFN 0x%llx %s\n", Process,
+				(unsigned long long)Database.TopLevelTables[Process], Owner == NULL ? "not found" : "differs");
+			Errors++;
+		}
+	}
+	if (Scan->NumberOfOwners != NumberOfProcesses + 1) {
+		fprintf(stderr, "pfnsim: %u owner(s), %u expected\n", Scan->NumberOfOwners, NumberOfProcesses + 1);
+		Errors++;
+	}
+
+	printf("pfnsim: %llu page(s), %u process(es)\n", (unsigned long long)Database.NumberOfPages, NumberOfProcesses);
+	printf("pfnsim: %.2f ns per MMPFN entry\n", (double)Nanoseconds / (double)Database.NumberOfPages);
+	printf("pfnsim: %u difference(s)\n", Errors);
+
+	free(OwnerTables);
+	free(Scans);
+	free(Owners);
+	free(Database.TopLevelTables);
+	free(Database.Owners);
+	free(Database.Entries);
+	KShimReset();
+	return Errors == 0x00 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
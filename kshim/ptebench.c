@@ -0,0 +1,172 @@
+/*+================================================================================================
+Module Name: ptebench.c
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+
+Abstract:
+Benchmark of the batch classification of PTEs of the MManager driver against the classification
+of one PTE at a time. Arrays of random PTEs in every state are classified with and without the
+bitmaps, and the counters and bitmaps checked against the scalar classification, including for
+lengths that are not a multiple of the vector or of the bitmap word. The number of PTEs and of
+iterations can be given on the command line.
+
+Build: cc -O2 -g [-fsanitize=address,undefined] kshim.c ptebench.c -o ptebench
+
+================================================================================================+*/
+
+#include "kshim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../MManager/MManager/mm/ptebatch.c"
+
+/// <summary>
+/// Classify an array of PTEs one at a time, as XMiClassifyPteBatch without the vector routine.
+/// </summary>
+static VOID PteBenchClassifyScalar(
+	_In_reads_(NumberOfPtes) CONST ULONG64* Ptes,
+	_In_                     ULONG64        NumberOfPtes,
+	_Inout_                  PXPTE_BATCH    Batch
+) {
+	for (ULONG64 Offset = 0x00; Offset < NumberOfPtes; Offset += 0x40) {
+		ULONG64 Words[XPteStateMaximum] = { 0x00 };
+		ULONG   Block = (NumberOfPtes - Offset) > 0x40 ? 0x40 : (ULONG)(NumberOfPtes - Offset);
+		XMipClassifyPteScalar(&Ptes[Offset], Block, 0x00, Words);
+
+		for (ULONG State = 0x00; State < XPteStateMaximum; State++) {
+			Batch->Count[State] += XMipPopCount64(Words[State]);
+			if (Batch->Bitmap[State] != NULL)
+				Batch->Bitmap[State][Offset / 0x40] = Words[State];
+		}
+	}
+}
+
+/// <summary>
+/// Random PTE, in any of the states of a page.
+/// </summary>
+static ULONG64 PteBenchRandomPte(
+	VOID
+) {
+	ULONG64 Value = ((ULONG64)rand() << 32) ^ ((ULONG64)rand() << 12) ^ (ULONG64)rand();
+	switch (rand() % 0x06) {
+	case 0x00:
+		return Value | XPTE_VALID_BIT;
+	case 0x01:
+		return (Value & ~XPTE_VALID_BIT) | XPTE_TRANSITION_BIT;
+	case 0x02:
+		return (Value & ~XPTE_VALID_BIT) | XPTE_PROTOTYPE_BIT;
+	case 0x03:
+		return Value & ~(XPTE_VALID_BIT | XPTE_PROTOTYPE_BIT | XPTE_TRANSITION_BIT);
+	case 0x04:
+		return Value & ~(XPTE_VALID_BIT | XPTE_PROTOTYPE_BIT | XPTE_TRANSITION_BIT | XPTE_PAGEFILE_HIGH);
+	default:
+		return 0x00;
+	}
+}
+
+/// <summary>
+/// Check the counters and the bitmaps of the batch classification of the first PTEs of an array.
+/// </summary>
+static ULONG PteBenchCheck(
+	_In_reads_(Length) CONST ULONG64* Ptes,
+	_In_               ULONG64        Length,
+	_Inout_            PULONG64       Maps,
+	_In_               ULONG64        Words
+) {
+	XPTE_BATCH Batch    = { 0x00 };
+	XPTE_BATCH Expected = { 0x00 };
+	for (ULONG State = 0x00; State < XPteStateMaximum; State++) {
+		Batch.Bitmap[State]    = &Maps[State * Words];
+		Expected.Bitmap[State] = &Maps[(XPteStateMaximum + State) * Words];
+	}
+	XMiClassifyPteBatch(Ptes, Length, &Batch);
+	PteBenchClassifyScalar(Ptes, Length, &Expected);
+
+	ULONG Errors = 0x00;
+	for (ULONG State = 0x00; State < XPteStateMaximum; State++) {
+		if (Batch.Count[State] != Expected.Count[State]
+			|| memcmp(Batch.Bitmap[State], Expected.Bitmap[State], ((Length + 0x3F) / 0x40) * sizeof(ULONG64)) != 0x00) {
+			fprintf(stderr, "ptebench: %llu PTE(s), state %u: %llu counted, %llu expected\n",
+				(unsigned long long)Length, State, (unsigned long long)Batch.Count[State], (unsigned long long)Expected.Count[State]);
+			Errors++;
+		}
+	}
+	return Errors;
+}
+
+/// <summary>
+/// Time in nanoseconds.
+/// </summary>
+static ULONG64 PteBenchNow(
+	VOID
+) {
+	struct timespec Time;
+	clock_gettime(CLOCK_MONOTONIC, &Time);
+	return ((ULONG64)Time.tv_sec * 1000000000ULL) + (ULONG64)Time.tv_nsec;
+}
+
+
+int main(
+	int   argc,
+	char* argv[]
+) {
+	ULONG64 NumberOfPtes = argc > 0x01 ? strtoull(argv[1], NULL, 0) : 0x100000;
+	ULONG   Iterations   = argc > 0x02 ? (ULONG)strtoul(argv[2], NULL, 0) : 0x40;
+	if (NumberOfPtes == 0x00 || Iterations == 0x00) {
+		fprintf(stderr, "usage: ptebench [ptes] [iterations]\n");
+		return EXIT_FAILURE;
+	}
+
+	ULONG64  Words = (NumberOfPtes + 0x3F) / 0x40;
+	PULONG64 Ptes  = malloc(NumberOfPtes * sizeof(ULONG64));
+	PULONG64 Maps  = calloc(Words * XPteStateMaximum * 0x02, sizeof(ULONG64));
+	if (Ptes == NULL || Maps == NULL) {
+		fprintf(stderr, "ptebench: out of memory.\n");
+		return EXIT_FAILURE;
+	}
+	srand(0x5054);
+	for (ULONG64 cx = 0x00; cx < NumberOfPtes; cx++)
+		Ptes[cx] = PteBenchRandomPte();
+	ULONG Errors = 0x00;
+
+	// Every length up to a few bitmap words, then the whole array, with the bitmaps
+	for (ULONG64 Length = 0x01; Length <= NumberOfPtes && Length <= 0x104; Length++)
+		Errors += PteBenchCheck(Ptes, Length, Maps, Words);
+	Errors += PteBenchCheck(Ptes, NumberOfPtes, Maps, Words);
+
+	// Counters only, as the page table walker
+	XPTE_BATCH Batch    = { 0x00 };
+	XPTE_BATCH Expected = { 0x00 };
+	ULONG64    Start    = PteBenchNow();
+	for (ULONG cx = 0x00; cx < Iterations; cx++)
+		XMiClassifyPteBatch(Ptes, NumberOfPtes, &Batch);
+	ULONG64 BatchTime = PteBenchNow() - Start;
+
+	Start = PteBenchNow();
+	for (ULONG cx = 0x00; cx < Iterations; cx++)
+		PteBenchClassifyScalar(Ptes, NumberOfPtes, &Expected);
+	ULONG64 ScalarTime = PteBenchNow() - Start;
+	if (memcmp(Batch.Count, Expected.Count, sizeof(Batch.Count)) != 0x00) {
+		fprintf(stderr, "ptebench: counters differ\n");
+		Errors++;
+	}
+
+	double Total = (double)NumberOfPtes * Iterations;
+	printf("ptebench: %llu PTE(s), %u iteration(s)\n", (unsigned long long)NumberOfPtes, Iterations);
+#if defined(XPTE_BATCH_SSE2)
+	printf("ptebench: batch  %6.3f ns per PTE (SSE2)\n", (double)BatchTime / Total);
+#else
+	printf("ptebench: batch  %6.3f ns per PTE\n", (double)BatchTime / Total);
+#endif // XPTE_BATCH_SSE2
+	printf("ptebench: scalar %6.3f ns per PTE\n", (double)ScalarTime / Total);
+	printf("ptebench: %u difference(s)\n", Errors);
+
+	free(Maps);
+	free(Ptes);
+	KShimReset();
+	return Errors == 0x00 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,420 @@
+/*+================================================================================================
+Module Name: ptesim.c
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+
+Abstract:
+Run the page table walker of the MManager driver in user mode, on synthetic page tables.
+The address space mixes 1GB and 2MB large pages, page tables of valid, dirty, transition,
+prototype, paged out, swizzled and demand zero PTEs, and empty or non-resident upper level
+entries. Random ranges are walked with the same walker and checked against a recursive walk of
+the tables. Contiguous ranges must read each table once, and a walk that fails to read a table
+must not leave it cached. The number of ranges and the seed can be given on the command line.
+
+Build: cc -O2 -g [-fsanitize=address,undefined] kshim.c ptesim.c -o ptesim
+
+================================================================================================+*/
+
+#include "kshim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../MManager/MManager/mm/ptebatch.c"
+#include "../MManager/MManager/mm/pte.c"
+
+// Large page bit of an upper level entry, MMPTE_HARDWARE.LargePage.
+#define PTESIM_LARGE_PAGE_BIT (ULONG64)0x80
+
+// Top-level entries mapping page tables, the next one is empty and the one after not resident.
+#define PTESIM_TOP_ENTRIES (ULONG)0x02
+
+// Entries of each PDPT and PD pointing to a lower level table.
+#define PTESIM_TABLES_PER_PDPT (ULONG)0x08
+#define PTESIM_TABLES_PER_PD   (ULONG)0x20
+
+// Number of VPNs mapped by the address space, two more top-level entries than populated.
+#define PTESIM_LIMIT ((ULONG64)(PTESIM_TOP_ENTRIES + 0x02) << 27)
+
+/// <summary>
+/// Synthetic page tables, in simulated physical memory.
+/// </summary>
+typedef struct _PTESIM_MEMORY {
+	PULONG64 Pages;             // One table of XPTE_PER_PAGE entries per page
+	ULONG64  NumberOfPages;
+	ULONG64  NextPage;
+	ULONG64  DirectoryTableBase;
+
+	ULONG64  Reads;             // Tables read by the walker
+	ULONG64  FailingTable;      // Physical address of a table that cannot be read
+	ULONG    Seed;
+} PTESIM_MEMORY, * PPTESIM_MEMORY;
+
+/// <summary>
+/// Random number, xorshift of the seed of the simulation.
+/// </summary>
+static ULONG PteSimRandom(
+	_Inout_ PPTESIM_MEMORY Memory
+) {
+	Memory->Seed ^= Memory->Seed << 13;
+	Memory->Seed ^= Memory->Seed >> 17;
+	Memory->Seed ^= Memory->Seed << 5;
+	return Memory->Seed;
+}
+
+/// <summary>
+/// Allocate a page table page.
+/// </summary>
+static ULONG64 PteSimAllocateTable(
+	_Inout_ PPTESIM_MEMORY Memory
+) {
+	if (Memory->NextPage == Memory->NumberOfPages) {
+		fprintf(stderr, "ptesim: out of simulated physical memory.\n");
+		exit(EXIT_FAILURE);
+	}
+	return Memory->NextPage++ << PAGE_SHIFT;
+}
+
+/// <summary>
+/// Entries of a table, by physical address.
+/// </summary>
+static PULONG64 PteSimTable(
+	_In_ PPTESIM_MEMORY Memory,
+	_In_ ULONG64        TableAddress
+) {
+	return &Memory->Pages[(TableAddress >> PAGE_SHIFT) * XPTE_PER_PAGE];
+}
+
+/// <summary>
+/// Random leaf PTE, in any of the states of a page.
+/// </summary>
+static ULONG64 PteSimLeaf(
+	_Inout_ PPTESIM_MEMORY Memory
+) {
+	ULONG64 Frame      = (ULONG64)(0x100 + (PteSimRandom(Memory) % 0x100000)) << PAGE_SHIFT;
+	ULONG64 Protection = (ULONG64)(PteSimRandom(Memory) % 0x20) << 5;
+	ULONG64 Swizzle    = (PteSimRandom(Memory) % 0x04) == 0x00 ? XPTE_SWIZZLE_BIT : 0x00;
+
+	switch (PteSimRandom(Memory) % 0x08) {
+	case 0x00:
+		return Frame | XPTE_VALID_BIT;
+	case 0x01:
+		return Frame | XPTE_VALID_BIT | XPTE_DIRTY_BIT;
+	case 0x02:
+		return Frame | (Protection & 0x3E0) | XPTE_TRANSITION_BIT | Swizzle;
+	case 0x03:
+		return ((ULONG64)PteSimRandom(Memory) << 32) | XPTE_PROTOTYPE_BIT | Swizzle;
+	case 0x04:
+		return ((ULONG64)(0x01 + (PteSimRandom(Memory) % 0xFFFF)) << 32) | Protection | Swizzle;
+	case 0x05:
+		return Protection | Swizzle;
+	default:
+		return 0x00;
+	}
+}
+
+/// <summary>
+/// Build a PD: 2MB large pages, page tables, and empty or non-resident entries.
+/// </summary>
+static ULONG64 PteSimCreatePd(
+	_Inout_ PPTESIM_MEMORY Memory
+) {
+	ULONG64  PdAddress = PteSimAllocateTable(Memory);
+	PULONG64 Pd        = PteSimTable(Memory, PdAddress);
+
+	// Page tables first, placed at random
+	for (ULONG cx = 0x00; cx < PTESIM_TABLES_PER_PD; cx++) {
+		ULONG Index = PteSimRandom(Memory) % XPTE_PER_PAGE;
+		if (Pd[Index] != 0x00)
+			continue;
+
+		ULONG64  PtAddress = PteSimAllocateTable(Memory);
+		PULONG64 Pt        = PteSimTable(Memory, PtAddress);
+		for (ULONG dx = 0x00; dx < XPTE_PER_PAGE; dx++)
+			Pt[dx] = PteSimLeaf(Memory);
+		Pd[Index] = PtAddress | XPTE_VALID_BIT;
+	}
+
+	for (ULONG cx = 0x00; cx < XPTE_PER_PAGE; cx++) {
+		if (Pd[cx] != 0x00)
+			continue;
+		switch (PteSimRandom(Memory) % 0x04) {
+		case 0x00:
+			Pd[cx] = ((ULONG64)(0x200 * (0x01 + cx)) << PAGE_SHIFT) | PTESIM_LARGE_PAGE_BIT | XPTE_VALID_BIT;
+			break;
+		case 0x01:
+			Pd[cx] = (ULONG64)(0x01 + cx) << 32;
+			break;
+		default:
+			break;
+		}
+	}
+	return PdAddress;
+}
+
+/// <summary>
+/// Build the page tables of the address space.
+/// </summary>
+static VOID PteSimCreateMemory(
+	_Out_ PPTESIM_MEMORY Memory,
+	_In_  ULONG          Seed
+) {
+	memset(Memory, 0x00, sizeof(PTESIM_MEMORY));
+	Memory->Seed          = Seed;
+	Memory->FailingTable  = (ULONG64)-1;
+	Memory->NumberOfPages = 0x10 + (PTESIM_TOP_ENTRIES * PTESIM_TABLES_PER_PDPT * (0x02 + PTESIM_TABLES_PER_PD));
+	Memory->Pages         = calloc(Memory->NumberOfPages, PAGE_SIZE);
+	if (Memory->Pages == NULL) {
+		fprintf(stderr, "ptesim: out of memory.\n");
+		exit(EXIT_FAILURE);
+	}
+	Memory->NextPage           = 0x01;
+	Memory->DirectoryTableBase = PteSimAllocateTable(Memory);
+
+	PULONG64 Pml4 = PteSimTable(Memory, Memory->DirectoryTableBase);
+	for (ULONG cx = 0x00; cx < PTESIM_TOP_ENTRIES; cx++) {
+		ULONG64  PdptAddress = PteSimAllocateTable(Memory);
+		PULONG64 Pdpt        = PteSimTable(Memory, PdptAddress);
+
+		// PDs at the start of the PDPT, then 1GB large pages and empty or non-resident entries
+		for (ULONG dx = 0x00; dx < XPTE_PER_PAGE; dx++) {
+			if (dx < PTESIM_TABLES_PER_PDPT) {
+				Pdpt[dx] = PteSimCreatePd(Memory) | XPTE_VALID_BIT;
+				continue;
+			}
+			switch (PteSimRandom(Memory) % 0x04) {
+			case 0x00:
+				Pdpt[dx] = ((ULONG64)(0x40000 * (0x01 + dx)) << PAGE_SHIFT) | PTESIM_LARGE_PAGE_BIT | XPTE_VALID_BIT;
+				break;
+			case 0x01:
+				Pdpt[dx] = (ULONG64)(0x01 + dx) << 32;
+				break;
+			default:
+				break;
+			}
+		}
+		Pml4[cx] = PdptAddress | XPTE_VALID_BIT;
+	}
+
+	// Empty, then not resident
+	Pml4[PTESIM_TOP_ENTRIES]     = 0x00;
+	Pml4[PTESIM_TOP_ENTRIES + 1] = (ULONG64)0x1234 << 32;
+}
+
+/// <summary>
+/// ReadTable routine of the walker, over the simulated physical memory.
+/// </summary>
+static BOOLEAN PteSimReadTable(
+	_In_opt_ PVOID   Context,
+	_In_     ULONG64 PhysicalAddress,
+	_Out_writes_(XPTE_PER_PAGE) PMMPTE Table
+) {
+	PPTESIM_MEMORY Memory = (PPTESIM_MEMORY)Context;
+	if (PhysicalAddress == Memory->FailingTable || (PhysicalAddress >> PAGE_SHIFT) >= Memory->NextPage)
+		return FALSE;
+
+	Memory->Reads++;
+	memcpy(Table, PteSimTable(Memory, PhysicalAddress), PAGE_SIZE);
+	return TRUE;
+}
+
+/// <summary>
+/// Classify the pages of a range by walking the tables recursively, one entry at a time.
+/// </summary>
+static VOID PteSimWalk(
+	_In_    PPTESIM_MEMORY Memory,
+	_In_    ULONG64        TableAddress,
+	_In_    ULONG          Level,
+	_In_    ULONG64        BaseVpn,
+	_In_    ULONG64        StartingVpn,
+	_In_    ULONG64        EndingVpn,
+	_Inout_ PXPTE_STATS    Stats
+) {
+	PULONG64 Table = PteSimTable(Memory, TableAddress);
+	ULONG64  Span  = (ULONG64)1 << (0x09 * (XPTE_LEVELS - 1 - Level));
+
+	for (ULONG cx = 0x00; cx < XPTE_PER_PAGE; cx++) {
+		ULONG64 First = BaseVpn + (cx * Span);
+		ULONG64 Last  = First + Span - 1;
+		if (Last < StartingVpn || First > EndingVpn)
+			continue;
+		First = First < StartingVpn ? StartingVpn : First;
+		Last  = Last > EndingVpn ? EndingVpn : Last;
+
+		ULONG64 Entry = Table[cx];
+		ULONG64 Pages = Last - First + 1;
+		if (Entry & XPTE_VALID_BIT) {
+			if (Level == XPTE_LEVELS - 1 || (Entry & PTESIM_LARGE_PAGE_BIT))
+				Stats->ValidPages += Pages;
+			else
+				PteSimWalk(Memory, Entry & XPTE_PHYSICAL_MASK, Level + 1, BaseVpn + (cx * Span), First, Last, Stats);
+		}
+		else if (Level != XPTE_LEVELS - 1) {
+			if (Entry == 0x00)
+				Stats->DemandZeroPages += Pages;
+			else
+				Stats->PagedOutPages += Pages;
+		}
+		else if (Entry & XPTE_PROTOTYPE_BIT)
+			Stats->PrototypePages++;
+		else if (Entry & XPTE_TRANSITION_BIT)
+			Stats->TransitionPages++;
+		else if (Entry & XPTE_PAGEFILE_HIGH)
+			Stats->PagedOutPages++;
+		else
+			Stats->DemandZeroPages++;
+	}
+}
+
+/// <summary>
+/// Compare the statistics of the walker with the expected ones.
+/// </summary>
+static BOOLEAN PteSimCompare(
+	_In_ CONST XPTE_STATS* Stats,
+	_In_ CONST XPTE_STATS* Expected
+) {
+	return Stats->ValidPages == Expected->ValidPages
+		&& Stats->TransitionPages == Expected->TransitionPages
+		&& Stats->PagedOutPages == Expected->PagedOutPages
+		&& Stats->PrototypePages == Expected->PrototypePages
+		&& Stats->DemandZeroPages == Expected->DemandZeroPages;
+}
+
+/// <summary>
+/// Random range: within a page table, a PD, or over the whole address space.
+/// </summary>
+static VOID PteSimRange(
+	_Inout_ PPTESIM_MEMORY Memory,
+	_Out_   PULONG64       StartingVpn,
+	_Out_   PULONG64       EndingVpn
+) {
+	ULONG64 Length = 0x00;
+	switch (PteSimRandom(Memory) % 0x03) {
+	case 0x00:
+		Length = 0x01 + (PteSimRandom(Memory) % 0x400);
+		break;
+	case 0x01:
+		Length = 0x01 + (PteSimRandom(Memory) % 0x80000);
+		break;
+	default:
+		Length = 0x01 + ((((ULONG64)PteSimRandom(Memory) << 32) | PteSimRandom(Memory)) % PTESIM_LIMIT);
+		break;
+	}
+
+	// Mostly in the first PDs, where the page tables are
+	ULONG64 Base = (PteSimRandom(Memory) % 0x02) == 0x00
+		? ((ULONG64)(PteSimRandom(Memory) % PTESIM_TOP_ENTRIES) << 27) + (PteSimRandom(Memory) % ((ULONG64)PTESIM_TABLES_PER_PDPT << 18))
+		: (((ULONG64)PteSimRandom(Memory) << 32) | PteSimRandom(Memory)) % PTESIM_LIMIT;
+	*StartingVpn = Base;
+	*EndingVpn   = Base + Length - 1 >= PTESIM_LIMIT ? PTESIM_LIMIT - 1 : Base + Length - 1;
+}
+
+
+int main(
+	int   argc,
+	char* argv[]
+) {
+	ULONG NumberOfRanges = argc > 0x01 ? (ULONG)strtoul(argv[1], NULL, 0) : 0x400;
+	ULONG Seed           = argc > 0x02 ? (ULONG)strtoul(argv[2], NULL, 0) : 0x5054;
+	if (NumberOfRanges == 0x00 || Seed == 0x00) {
+		fprintf(stderr, "usage: ptesim [ranges] [seed]\n");
+		return EXIT_FAILURE;
+	}
+
+	PTESIM_MEMORY Memory;
+	PteSimCreateMemory(&Memory, Seed);
+
+	PXPTE_WALKER Walker = calloc(0x01, sizeof(XPTE_WALKER));
+	if (Walker == NULL) {
+		fprintf(stderr, "ptesim: out of memory.\n");
+		return EXIT_FAILURE;
+	}
+	XMiInitializePteWalker(Walker, Memory.DirectoryTableBase, PteSimReadTable, &Memory);
+	ULONG Errors = 0x00;
+
+	// Random ranges, the walker keeping its tables from one range to the next
+	for (ULONG cx = 0x00; cx < NumberOfRanges; cx++) {
+		ULONG64 StartingVpn = 0x00;
+		ULONG64 EndingVpn   = 0x00;
+		PteSimRange(&Memory, &StartingVpn, &EndingVpn);
+
+		XPTE_STATS Stats    = { 0x00 };
+		XPTE_STATS Expected = { 0x00 };
+		NTSTATUS   Status   = XMiWalkPageTables(Walker, StartingVpn, EndingVpn, &Stats);
+		PteSimWalk(&Memory, Memory.DirectoryTableBase, 0x00, 0x00, StartingVpn, EndingVpn, &Expected);
+		if (!NT_SUCCESS(Status) || !PteSimCompare(&Stats, &Expected)) {
+			fprintf(stderr, "ptesim: range 0x%llx-0x%llx: %llu valid, %llu transition, %llu paged out, %llu prototype, %llu demand zero; %llu, %llu, %llu, %llu, %llu expected\n",
+				(unsigned long long)StartingVpn, (unsigned long long)EndingVpn,
+				(unsigned long long)Stats.ValidPages, (unsigned long long)Stats.TransitionPages, (unsigned long long)Stats.PagedOutPages,
+				(unsigned long long)Stats.PrototypePages, (unsigned long long)Stats.DemandZeroPages,
+				(unsigned long long)Expected.ValidPages, (unsigned long long)Expected.TransitionPages, (unsigned long long)Expected.PagedOutPages,
+				(unsigned long long)Expected.PrototypePages, (unsigned long long)Expected.DemandZeroPages);
+			Errors++;
+		}
+	}
+
+	// Contiguous ranges in order, each table read once
+	XMiInitializePteWalker(Walker, Memory.DirectoryTableBase, PteSimReadTable, &Memory);
+	Memory.Reads = 0x00;
+
+	XPTE_STATS      Stats = { 0x00 };
+	struct timespec Start, End;
+	clock_gettime(CLOCK_MONOTONIC, &Start);
+	for (ULONG64 Vpn = 0x00; Vpn < PTESIM_LIMIT; Vpn += 0x1000)
+		XMiWalkPageTables(Walker, Vpn, Vpn + 0x0FFF, &Stats);
+	clock_gettime(CLOCK_MONOTONIC, &End);
+	ULONG64 Nanoseconds = ((End.tv_sec - Start.tv_sec) * 1000000000ULL) + End.tv_nsec - Start.tv_nsec;
+
+	XPTE_STATS Whole    = Stats;
+	XPTE_STATS Expected = { 0x00 };
+	PteSimWalk(&Memory, Memory.DirectoryTableBase, 0x00, 0x00, 0x00, PTESIM_LIMIT - 1, &Expected);
+	if (!PteSimCompare(&Stats, &Expected)) {
+		fprintf(stderr, "ptesim: walk of the whole address space differs\n");
+		Errors++;
+	}
+	if (Memory.Reads != Memory.NextPage - 1) {
+		fprintf(stderr, "ptesim: %llu table(s) read for %llu table(s)\n", (unsigned long long)Memory.Reads, (unsigned long long)(Memory.NextPage - 1));
+		Errors++;
+	}
+
+	// Failure to read a page table, then the same range again
+	PULONG64 Pd = PteSimTable(&Memory, PteSimTable(&Memory, PteSimTable(&Memory, Memory.DirectoryTableBase)[0x00] & XPTE_PHYSICAL_MASK)[0x00] & XPTE_PHYSICAL_MASK);
+	ULONG    Index = 0x00;
+	while (Index < XPTE_PER_PAGE && ((Pd[Index] & XPTE_VALID_BIT) == 0x00 || (Pd[Index] & PTESIM_LARGE_PAGE_BIT) != 0x00))
+		Index++;
+	if (Index < XPTE_PER_PAGE) {
+		XMiInitializePteWalker(Walker, Memory.DirectoryTableBase, PteSimReadTable, &Memory);
+		Memory.FailingTable = Pd[Index] & XPTE_PHYSICAL_MASK;
+
+		XPTE_STATS Failed = { 0x00 };
+		if (XMiWalkPageTables(Walker, (ULONG64)Index << 9, ((ULONG64)Index << 9) + 0x1FF, &Failed) != STATUS_UNSUCCESSFUL) {
+			fprintf(stderr, "ptesim: walk succeeded without reading the page table\n");
+			Errors++;
+		}
+
+		Memory.FailingTable = (ULONG64)-1;
+		memset(&Stats, 0x00, sizeof(XPTE_STATS));
+		memset(&Expected, 0x00, sizeof(XPTE_STATS));
+		XMiWalkPageTables(Walker, (ULONG64)Index << 9, ((ULONG64)Index << 9) + 0x1FF, &Stats);
+		PteSimWalk(&Memory, Memory.DirectoryTableBase, 0x00, 0x00, (ULONG64)Index << 9, ((ULONG64)Index << 9) + 0x1FF, &Expected);
+		if (!PteSimCompare(&Stats, &Expected)) {
+			fprintf(stderr, "ptesim: page table left cached after a failed read\n");
+			Errors++;
+		}
+	}
+
+	printf("ptesim: %llu table(s), %u range(s)\n", (unsigned long long)(Memory.NextPage - 1), NumberOfRanges);
+	printf("ptesim: %llu valid, %llu transition, %llu paged out, %llu prototype, %llu demand zero page(s)\n",
+		(unsigned long long)Whole.ValidPages, (unsigned long long)Whole.TransitionPages, (unsigned long long)Whole.PagedOutPages,
+		(unsigned long long)Whole.PrototypePages, (unsigned long long)Whole.DemandZeroPages);
+	printf("ptesim: %.3f ms per walk of the address space\n", (double)Nanoseconds / 1000000.0);
+	printf("ptesim: %u difference(s)\n", Errors);
+
+	free(Walker);
+	free(Memory.Pages);
+	KShimReset();
+	return Errors == 0x00 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
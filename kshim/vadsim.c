@@ -0,0 +1,508 @@
+/*+================================================================================================
+Module Name: vadsim.c
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+
+Abstract:
+Run the VAD table of the MManager driver in user mode, on the simulated kernel.
+A synthetic process is built: a balanced tree of VADs, private or mapping images and data files
+through their CONTROL_AREA, and the page tables of the VADs in simulated physical memory. The VAD
+table of the process is built and released repeatedly, checked against the synthetic process and
+timed. It is also built once while pool allocations fail, the files lost having to be counted, and
+once while page tables cannot be read, the VADs left without their pages having to be counted.
+The number of VADs and of iterations can be given on the command line.
+
+Build: cc -O2 -g [-fsanitize=address,undefined] kshim.c vadsim.c -o vadsim
+
+================================================================================================+*/
+
+#include "kshim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../MManager/MManager/mm/ptebatch.c"
+#include "../MManager/MManager/mm/pte.c"
+#include "../MManager/MManager/mm/vad.c"
+
+// Offset of the VAD root in EPROCESS, see XMM_GET_PROCESS_VAD_ROOT.
+#define VADSIM_VAD_ROOT_OFFSET 0x7d8
+
+// Number of distinct files mapped.
+#define VADSIM_FILES 0x40
+
+// Pages between the start of two VADs.
+#define VADSIM_STRIDE 0x10
+
+// First VPN of the VADs, and of the VADs mapped above 32-bit VPNs.
+#define VADSIM_LOW_VPN  (ULONG64)0x1000
+#define VADSIM_HIGH_VPN (ULONG64)0x200000000
+
+/// <summary>
+/// FILE_OBJECT aligned as in the pool, the low bits of the pointer holding the reference count.
+/// </summary>
+typedef struct DECLSPEC_ALIGN(0x10) _VADSIM_FILE_OBJECT {
+	FILE_OBJECT Object;
+} VADSIM_FILE_OBJECT, * PVADSIM_FILE_OBJECT;
+
+/// <summary>
+/// Synthetic process.
+/// </summary>
+typedef struct _VADSIM_PROCESS {
+	ULONG               NumberOfVads;
+	PMMVAD              Vads;         // Sorted by VPN
+	PUCHAR              Process;      // EPROCESS, only the VAD root
+
+	CONTROL_AREA        ImageAreas[VADSIM_FILES]; // Image mapping of each file
+	CONTROL_AREA        DataAreas[VADSIM_FILES];  // Data mapping of each file, another FILE_OBJECT
+	CONTROL_AREA        PagefileArea;             // Section backed by the paging file
+	PVADSIM_FILE_OBJECT FileObjects;              // Two per file
+	WCHAR               FileNames[VADSIM_FILES][0x40];
+	PSUBSECTION         Subsections;              // One per VAD
+
+	PUCHAR              PhysicalMemory;
+	ULONG64             NumberOfPhysicalPages;
+	ULONG64             NextPhysicalPage;
+	ULONG64             DirectoryTableBase;
+	ULONG               MaximumLevel;             // Depth of the tree
+} VADSIM_PROCESS, * PVADSIM_PROCESS;
+
+/// <summary>
+/// Expected state of the page of a VAD.
+/// </summary>
+static XPTE_STATE VadSimGetPageState(
+	_In_ ULONG64 Page
+) {
+	switch (Page % 0x04) {
+	case 0x00:
+		return XPteStateValid;
+	case 0x01:
+		return XPteStateDemandZero;
+	case 0x02:
+		return XPteStateTransition;
+	default:
+		return XPteStatePagedOut;
+	}
+}
+
+/// <summary>
+/// Allocate a page table page in the simulated physical memory.
+/// </summary>
+static ULONG64 VadSimAllocateTable(
+	_Inout_ PVADSIM_PROCESS Simulation
+) {
+	if (Simulation->NextPhysicalPage == Simulation->NumberOfPhysicalPages) {
+		fprintf(stderr, "vadsim: out of simulated physical memory.\n");
+		exit(EXIT_FAILURE);
+	}
+	return Simulation->NextPhysicalPage++ << PAGE_SHIFT;
+}
+
+/// <summary>
+/// Write the PTE of a page, allocating the page tables on the way.
+/// </summary>
+static VOID VadSimMapPage(
+	_Inout_ PVADSIM_PROCESS Simulation,
+	_In_    ULONG64         Vpn,
+	_In_    ULONG64         Pte
+) {
+	ULONG64 TableAddress = Simulation->DirectoryTableBase;
+	for (ULONG Level = 0x00; Level < XPTE_LEVELS; Level++) {
+		PULONG64 Table = (PULONG64)(Simulation->PhysicalMemory + TableAddress);
+		ULONG    Index = XPTE_LEVEL_INDEX(Vpn, Level);
+		if (Level == XPTE_LEVELS - 1) {
+			Table[Index] = Pte;
+			return;
+		}
+
+		if (!(Table[Index] & XPTE_VALID_BIT))
+			Table[Index] = VadSimAllocateTable(Simulation) | XPTE_VALID_BIT;
+		TableAddress = Table[Index] & XPTE_PHYSICAL_MASK;
+	}
+}
+
+/// <summary>
+/// Link the VADs of a range of the array into a balanced tree.
+/// </summary>
+static PMMVAD VadSimBuildTree(
+	_Inout_ PVADSIM_PROCESS Simulation,
+	_In_    LONG            First,
+	_In_    LONG            Last,
+	_In_    ULONG           Level
+) {
+	if (First > Last)
+		return NULL;
+	if (Level > Simulation->MaximumLevel)
+		Simulation->MaximumLevel = Level;
+
+	LONG   Middle = First + ((Last - First) / 0x02);
+	PMMVAD Vad    = &Simulation->Vads[Middle];
+	Vad->Core.VadNode.Left  = (PRTL_BALANCED_NODE)VadSimBuildTree(Simulation, First, Middle - 1, Level + 1);
+	Vad->Core.VadNode.Right = (PRTL_BALANCED_NODE)VadSimBuildTree(Simulation, Middle + 1, Last, Level + 1);
+	return Vad;
+}
+
+/// <summary>
+/// Expected number of pages of a VAD.
+/// </summary>
+static ULONG64 VadSimGetNumberOfPages(
+	_In_ ULONG Index
+) {
+	return 0x01 + (Index % 0x0B);
+}
+
+/// <summary>
+/// Expected commit charge of a VAD.
+/// </summary>
+static ULONG64 VadSimGetCommitCharge(
+	_In_ ULONG Index
+) {
+	return (Index % 0x04) == 0x00 ? VadSimGetNumberOfPages(Index) : Index % 0x03;
+}
+
+/// <summary>
+/// Build the synthetic process.
+/// </summary>
+static VOID VadSimCreateProcess(
+	_Out_ PVADSIM_PROCESS Simulation,
+	_In_  ULONG           NumberOfVads
+) {
+	memset(Simulation, 0x00, sizeof(VADSIM_PROCESS));
+	Simulation->NumberOfVads = NumberOfVads;
+	Simulation->Vads         = calloc(NumberOfVads, sizeof(MMVAD));
+	Simulation->Subsections  = calloc(NumberOfVads, sizeof(SUBSECTION));
+	Simulation->Process      = calloc(0x01, VADSIM_VAD_ROOT_OFFSET + sizeof(ULONG64));
+	Simulation->FileObjects  = aligned_alloc(0x10, sizeof(VADSIM_FILE_OBJECT) * VADSIM_FILES * 0x02);
+
+	// Four tables per VAD at most, and the top-level table
+	Simulation->NumberOfPhysicalPages = 0x10 + (NumberOfVads * (ULONG64)XPTE_LEVELS);
+	Simulation->PhysicalMemory        = calloc(Simulation->NumberOfPhysicalPages, PAGE_SIZE);
+	if (Simulation->Vads == NULL || Simulation->Subsections == NULL || Simulation->Process == NULL || Simulation->FileObjects == NULL || Simulation->PhysicalMemory == NULL) {
+		fprintf(stderr, "vadsim: out of memory.\n");
+		exit(EXIT_FAILURE);
+	}
+	Simulation->NextPhysicalPage   = 0x01;
+	Simulation->DirectoryTableBase = VadSimAllocateTable(Simulation);
+
+	// The same file is mapped as an image and as data through two FILE_OBJECT
+	memset(Simulation->FileObjects, 0x00, sizeof(VADSIM_FILE_OBJECT) * VADSIM_FILES * 0x02);
+	for (ULONG cx = 0x00; cx < VADSIM_FILES; cx++) {
+		swprintf(Simulation->FileNames[cx], _ARRAYSIZE(Simulation->FileNames[cx]), L"\\Windows\\System32\\module%03u.dll", cx);
+		for (ULONG dx = 0x00; dx < 0x02; dx++) {
+			PFILE_OBJECT FileObject = &Simulation->FileObjects[(cx * 0x02) + dx].Object;
+			RtlInitUnicodeString(&FileObject->FileName, Simulation->FileNames[cx]);
+
+			// Reference count in the low bits of the pointer
+			PCONTROL_AREA ControlArea = dx == 0x00 ? &Simulation->ImageAreas[cx] : &Simulation->DataAreas[cx];
+			ControlArea->FilePointer.Value = (ULONG64)FileObject | 0x07;
+		}
+	}
+
+	for (ULONG cx = 0x00; cx < NumberOfVads; cx++) {
+		PMMVAD  Vad   = &Simulation->Vads[cx];
+		ULONG64 Pages = VadSimGetNumberOfPages(cx);
+
+		// The last VADs are mapped above 32-bit VPNs
+		ULONG64 StartingVpn = VADSIM_LOW_VPN + ((ULONG64)cx * VADSIM_STRIDE);
+		if (cx >= NumberOfVads - (NumberOfVads / 0x40))
+			StartingVpn += VADSIM_HIGH_VPN;
+		ULONG64 EndingVpn = StartingVpn + Pages - 1;
+
+		Vad->Core.StartingVpn      = (ULONG)StartingVpn;
+		Vad->Core.StartingVpnHigh  = (UCHAR)(StartingVpn >> 32);
+		Vad->Core.EndingVpn        = (ULONG)EndingVpn;
+		Vad->Core.EndingVpnHigh    = (UCHAR)(EndingVpn >> 32);
+		Vad->Core.u1.VadFlags1.CommitCharge = (ULONG)VadSimGetCommitCharge(cx);
+
+		// Private, image, data file or paging file
+		switch (cx % 0x04) {
+		case 0x00:
+			Vad->Core.u.VadFlags.PrivateMemory = 0x01;
+			Vad->Core.u.VadFlags.Protection    = MM_READWRITE;
+			break;
+		case 0x01:
+			Vad->Core.u.VadFlags.VadType       = VadImageMap;
+			Vad->Core.u.VadFlags.Protection    = MM_EXECUTE_WRITECOPY;
+			Simulation->Subsections[cx].ControlArea = &Simulation->ImageAreas[cx % VADSIM_FILES];
+			break;
+		case 0x02:
+			Vad->Core.u.VadFlags.Protection    = MM_READONLY;
+			Simulation->Subsections[cx].ControlArea = &Simulation->DataAreas[(cx / 0x04) % VADSIM_FILES];
+			break;
+		default:
+			Vad->Core.u.VadFlags.Protection    = MM_READWRITE;
+			Simulation->Subsections[cx].ControlArea = &Simulation->PagefileArea;
+			break;
+		}
+		if (!Vad->Core.u.VadFlags.PrivateMemory)
+			Vad->Subsection = &Simulation->Subsections[cx];
+
+		for (ULONG64 Page = 0x00; Page < Pages; Page++) {
+			ULONG64 Pte = 0x00;
+			switch (VadSimGetPageState(Page)) {
+			case XPteStateValid:
+				Pte = ((ULONG64)(cx + 0x100) << PAGE_SHIFT) | XPTE_VALID_BIT;
+				break;
+			case XPteStateTransition:
+				Pte = ((ULONG64)(cx + 0x100) << PAGE_SHIFT) | XPTE_TRANSITION_BIT;
+				break;
+			case XPteStatePagedOut:
+				Pte = (ULONG64)(cx + 0x01) << 32;
+				break;
+			default:
+				break;
+			}
+			VadSimMapPage(Simulation, StartingVpn + Page, Pte);
+		}
+	}
+
+	PMMVAD Root = VadSimBuildTree(Simulation, 0x00, (LONG)NumberOfVads - 1, 0x00);
+	*(PULONG64)(Simulation->Process + VADSIM_VAD_ROOT_OFFSET) = (ULONG64)Root;
+	KShimMapPhysicalMemory(Simulation->PhysicalMemory, Simulation->NumberOfPhysicalPages * PAGE_SIZE);
+}
+
+/// <summary>
+/// Release the synthetic process.
+/// </summary>
+static VOID VadSimDeleteProcess(
+	_Inout_ PVADSIM_PROCESS Simulation
+) {
+	KShimMapPhysicalMemory(NULL, 0x00);
+	free(Simulation->PhysicalMemory);
+	free(Simulation->FileObjects);
+	free(Simulation->Process);
+	free(Simulation->Subsections);
+	free(Simulation->Vads);
+}
+
+/// <summary>
+/// Check a VAD table against the synthetic process.
+/// </summary>
+/// <returns>Number of differences.</returns>
+static ULONG VadSimCheckTable(
+	_In_ PVADSIM_PROCESS Simulation,
+	_In_ PXVAD_TABLE     Table
+) {
+	ULONG   Errors        = 0x00;
+	ULONG64 PrivateCommit = 0x00;
+	ULONG64 SharedCommit  = 0x00;
+	ULONG   ImageVads     = 0x00;
+	ULONG   FileVads[VADSIM_FILES] = { 0x00 };
+
+	// Every VAD, once, with its pages
+	for (PLIST_ENTRY Entry = Table->InsertOrderList.Flink; Entry != &Table->InsertOrderList; Entry = Entry->Flink) {
+		PXVAD_TABLE_ENTRY TableEntry = CONTAINING_RECORD(Entry, XVAD_TABLE_ENTRY, List);
+		ULONG             Index      = (ULONG)(TableEntry->VadNode - Simulation->Vads);
+		PMMVAD            Vad        = &Simulation->Vads[Index];
+
+		ULONG64 StartingVpn = Vad->Core.StartingVpn | ((ULONG64)Vad->Core.StartingVpnHigh << 32);
+		ULONG64 Pages       = VadSimGetNumberOfPages(Index);
+		if (TableEntry->StartingVpn != StartingVpn || TableEntry->EndingVpn != StartingVpn + Pages - 1)
+			Errors++;
+		if (TableEntry->CommitCharge != VadSimGetCommitCharge(Index))
+			Errors++;
+
+		ULONG64 States[XPteStateMaximum] = { 0x00 };
+		for (ULONG64 Page = 0x00; Page < Pages; Page++)
+			States[VadSimGetPageState(Page)]++;
+		if (TableEntry->Pages.ValidPages != States[XPteStateValid]
+			|| TableEntry->Pages.DemandZeroPages != States[XPteStateDemandZero]
+			|| TableEntry->Pages.TransitionPages != States[XPteStateTransition]
+			|| TableEntry->Pages.PagedOutPages != States[XPteStatePagedOut])
+			Errors++;
+
+		// Files by name, whichever FILE_OBJECT maps them
+		if ((Index % 0x04) == 0x01 || (Index % 0x04) == 0x02) {
+			ULONG File = (Index % 0x04) == 0x01 ? Index % VADSIM_FILES : (Index / 0x04) % VADSIM_FILES;
+			if (TableEntry->File == NULL || wcscmp(TableEntry->File->Name->Buffer, Simulation->FileNames[File]) != 0x00)
+				Errors++;
+			FileVads[File]++;
+		}
+		else if (TableEntry->File != NULL) {
+			Errors++;
+		}
+
+		if (Vad->Core.u.VadFlags.PrivateMemory)
+			PrivateCommit += TableEntry->CommitCharge;
+		else
+			SharedCommit += TableEntry->CommitCharge;
+		ImageVads += Vad->Core.u.VadFlags.VadType == VadImageMap;
+	}
+
+	ULONG NumberOfFiles = 0x00;
+	for (ULONG cx = 0x00; cx < VADSIM_FILES; cx++)
+		NumberOfFiles += FileVads[cx] != 0x00;
+
+	for (PLIST_ENTRY Entry = Table->FileList.Flink; Entry != &Table->FileList; Entry = Entry->Flink) {
+		PXVAD_FILE_ENTRY File  = CONTAINING_RECORD(Entry, XVAD_FILE_ENTRY, List);
+		ULONG            Index = (ULONG)wcstoul(File->Name->Buffer + wcslen(L"\\Windows\\System32\\module"), NULL, 10);
+		if (Index >= VADSIM_FILES || File->Stats.NumberOfNodes != FileVads[Index])
+			Errors++;
+	}
+
+	if (Table->NumberOfNodes != Simulation->NumberOfVads
+		|| Table->MaximumLevel != Simulation->MaximumLevel
+		|| Table->NumberOfFiles != NumberOfFiles
+		|| Table->UnresolvedFiles != 0x00
+		|| Table->UnresolvedPages != 0x00
+		|| Table->TotalPrivateCommit != PrivateCommit
+		|| Table->TotalSharedCommit != SharedCommit
+		|| Table->VadTypes[VadImageMap].NumberOfNodes != ImageVads)
+		Errors++;
+	return Errors;
+}
+
+/// <summary>
+/// Check a VAD table built while the pool allocations fail: the mapped VADs that lost their file
+/// are all counted.
+/// </summary>
+/// <returns>Number of differences.</returns>
+static ULONG VadSimCheckLowResources(
+	_In_ PXVAD_TABLE Table
+) {
+	ULONG Unresolved = 0x00;
+	for (PLIST_ENTRY Entry = Table->InsertOrderList.Flink; Entry != &Table->InsertOrderList; Entry = Entry->Flink) {
+		PXVAD_TABLE_ENTRY TableEntry = CONTAINING_RECORD(Entry, XVAD_TABLE_ENTRY, List);
+		if (TableEntry->File == NULL && TableEntry->ControlArea != NULL && TableEntry->ControlArea->FilePointer.Value != 0x00)
+			Unresolved++;
+	}
+	return Unresolved != Table->UnresolvedFiles;
+}
+
+/// <summary>
+/// Read a page table of the simulated physical memory, every third one but the first tables, those
+/// of the first VADs at all levels, failing to be read.
+/// </summary>
+static BOOLEAN VadSimReadTableFailing(
+	_In_opt_ PVOID   Context,
+	_In_     ULONG64 PhysicalAddress,
+	_Out_writes_(XPTE_PER_PAGE) PMMPTE Table
+) {
+	PVADSIM_PROCESS Simulation = Context;
+	ULONG64         Page       = PhysicalAddress >> PAGE_SHIFT;
+	if (Page > (Simulation->DirectoryTableBase >> PAGE_SHIFT) + XPTE_LEVELS && (Page % 0x03) == 0x00)
+		return FALSE;
+	return XMiReadPhysicalTable(NULL, PhysicalAddress, Table);
+}
+
+/// <summary>
+/// Check a VAD table built while page tables cannot be read: the VADs walked through them are all
+/// counted and have no pages, the others all their pages.
+/// </summary>
+/// <returns>Number of differences.</returns>
+static ULONG VadSimCheckUnreadableTables(
+	_In_ PVADSIM_PROCESS Simulation,
+	_In_ PXVAD_TABLE     Table
+) {
+	ULONG Errors     = 0x00;
+	ULONG Unresolved = 0x00;
+	for (PLIST_ENTRY Entry = Table->InsertOrderList.Flink; Entry != &Table->InsertOrderList; Entry = Entry->Flink) {
+		PXVAD_TABLE_ENTRY TableEntry = CONTAINING_RECORD(Entry, XVAD_TABLE_ENTRY, List);
+		ULONG64           Pages      = VadSimGetNumberOfPages((ULONG)(TableEntry->VadNode - Simulation->Vads));
+
+		ULONG64 States[XPteStateMaximum] = { 0x00 };
+		if (TableEntry->PagesUnresolved)
+			Unresolved++;
+		else {
+			for (ULONG64 Page = 0x00; Page < Pages; Page++)
+				States[VadSimGetPageState(Page)]++;
+		}
+		if (TableEntry->Pages.ValidPages != States[XPteStateValid]
+			|| TableEntry->Pages.DemandZeroPages != States[XPteStateDemandZero]
+			|| TableEntry->Pages.TransitionPages != States[XPteStateTransition]
+			|| TableEntry->Pages.PagedOutPages != States[XPteStatePagedOut]
+			|| TableEntry->Pages.PrototypePages != 0x00)
+			Errors++;
+	}
+	return Errors + (Unresolved == 0x00 || Unresolved == Table->NumberOfNodes || Unresolved != Table->UnresolvedPages);
+}
+
+/// <summary>
+/// Initialise a VAD table, with a page table walker of the simulated physical memory.
+/// </summary>
+static VOID VadSimInitializeTable(
+	_In_  PVADSIM_PROCESS Simulation,
+	_Out_ PXVAD_TABLE     Table
+) {
+	XMiInitializeVadTable((PEPROCESS)Simulation->Process, Table);
+
+	// The driver reads CR3 on x64 only, the walker reads the simulated physical memory here
+	if (Table->Walker == NULL) {
+		Table->Walker = ExAllocatePool2(POOL_FLAG_NON_PAGED, sizeof(XPTE_WALKER), XPTE_MM_TAG);
+		if (Table->Walker != NULL)
+			XMiInitializePteWalker(Table->Walker, Simulation->DirectoryTableBase, XMiReadPhysicalTable, NULL);
+	}
+}
+
+int main(
+	int   argc,
+	char* argv[]
+) {
+	ULONG NumberOfVads = argc > 0x01 ? (ULONG)strtoul(argv[1], NULL, 0) : 0x800;
+	ULONG Iterations   = argc > 0x02 ? (ULONG)strtoul(argv[2], NULL, 0) : 0x100;
+	if (NumberOfVads == 0x00 || NumberOfVads > 0x100000 || Iterations == 0x00) {
+		fprintf(stderr, "usage: vadsim [vads] [iterations]\n");
+		return EXIT_FAILURE;
+	}
+
+	VADSIM_PROCESS Simulation;
+	VadSimCreateProcess(&Simulation, NumberOfVads);
+
+	PXVAD_TABLE Table = calloc(0x01, sizeof(XVAD_TABLE));
+	if (Table == NULL || !NT_SUCCESS(XMiInitializeVadLookasideLists())) {
+		fprintf(stderr, "vadsim: unable to initialise the VAD table.\n");
+		return EXIT_FAILURE;
+	}
+
+	// Out of memory first, every 7th allocation failing while the lookaside lists are empty
+	KShimFailPoolAllocations(0x07);
+	VadSimInitializeTable(&Simulation, Table);
+	XMiBuildVadTable(Table, NULL, NULL, 0x00);
+	ULONG Errors     = VadSimCheckLowResources(Table);
+	ULONG Unresolved = Table->UnresolvedFiles;
+	XMiUninitializeVadTable(Table);
+	KShimFailPoolAllocations(0x00);
+
+	// Page tables unreadable, their VADs left without pages
+	VadSimInitializeTable(&Simulation, Table);
+	XMiInitializePteWalker(Table->Walker, Simulation.DirectoryTableBase, VadSimReadTableFailing, &Simulation);
+	XMiBuildVadTable(Table, NULL, NULL, 0x00);
+	Errors += VadSimCheckUnreadableTables(&Simulation, Table);
+	ULONG UnreadableVads = Table->UnresolvedPages;
+	XMiUninitializeVadTable(Table);
+
+	ULONG   NumberOfFiles = 0x00;
+	ULONG64 Nanoseconds   = 0x00;
+	for (ULONG cx = 0x00; cx < Iterations; cx++) {
+		VadSimInitializeTable(&Simulation, Table);
+
+		struct timespec Start, End;
+		clock_gettime(CLOCK_MONOTONIC, &Start);
+		XMiBuildVadTable(Table, NULL, NULL, 0x00);
+		clock_gettime(CLOCK_MONOTONIC, &End);
+		Nanoseconds += ((End.tv_sec - Start.tv_sec) * 1000000000ULL) + End.tv_nsec - Start.tv_nsec;
+
+		if (cx == 0x00) {
+			Errors       += VadSimCheckTable(&Simulation, Table);
+			NumberOfFiles = Table->NumberOfFiles;
+		}
+		XMiUninitializeVadTable(Table);
+	}
+
+	XMiDeleteVadLookasideLists();
+
+	LONG64 Leaks = KShimQueryPoolAllocations();
+	printf("vadsim: %u VADs, %u files, depth %u, %u iterations\n", NumberOfVads, NumberOfFiles, Simulation.MaximumLevel, Iterations);
+	printf("vadsim: %.1f ns per VAD, %.3f ms per table\n", (double)Nanoseconds / ((double)Iterations * NumberOfVads), (double)Nanoseconds / (Iterations * 1000000.0));
+	printf("vadsim: %u file(s) unresolved out of memory\n", Unresolved);
+	printf("vadsim: %u VAD(s) without their pages, page tables unreadable\n", UnreadableVads);
+	printf("vadsim: %u difference(s), %lld pool allocation(s) leaked\n", Errors, (long long)Leaks);
+
+	free(Table);
+	VadSimDeleteProcess(&Simulation);
+	KShimReset();
+	return (Errors == 0x00 && Leaks == 0x00) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,325 @@
+/*+================================================================================================
+Module Name: wkisim.c
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+
+Abstract:
+Run the Windows Kernel Introspection (WKI) symbol loader in user mode, on the simulated kernel.
+The registry is populated with the version of the OS and the symbols of a synthetic kernel image,
+loaded as ntoskrnl.exe. The symbols are loaded, resolved and read back, checked against the image
+and the lookups timed. Initialisation is also checked to fail cleanly when the registry is
+incomplete or malformed. The number of symbols and of iterations can be given on the command line.
+
+Build: cc -O2 -g [-fsanitize=address,undefined] kshim.c wkisim.c -o wkisim
+
+================================================================================================+*/
+
+#include "kshim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../WKI/WKIKM/wki/wki.c"
+
+// Version of the OS, as in the registry.
+#define WKISIM_MAJOR    (DWORD)0x0A
+#define WKISIM_BUILD    L"19044"
+#define WKISIM_REVISION (DWORD)0x6AA
+#define WKISIM_VERSION  L"10.19044.1706"
+
+// RVA of the first symbol, and between two symbols.
+#define WKISIM_FIRST_RVA (ULONG)0x1000
+#define WKISIM_STRIDE    (ULONG)0x10
+
+// Value stored at the address of a symbol.
+#define WKISIM_VALUE(i) (((UINT64)(i) * 0x9E3779B97F4A7C15) | 0x01)
+
+/// <summary>
+/// Synthetic kernel image.
+/// </summary>
+typedef struct _WKISIM_KERNEL {
+	ULONG  NumberOfSymbols;
+	PUCHAR Image;
+	ULONG  ImageSize;
+	PUCHAR Driver;   // Another module loaded before the kernel
+} WKISIM_KERNEL, * PWKISIM_KERNEL;
+
+/// <summary>
+/// Name of a symbol.
+/// </summary>
+static VOID WkiSimGetSymbolName(
+	_In_  ULONG Index,
+	_Out_ PCHAR Name,
+	_In_  SIZE_T Size
+) {
+	snprintf(Name, Size, "WkiSimSymbol%04u", Index);
+}
+
+/// <summary>
+/// DJB2 hash of a symbol name, as computed by WkiGetSymbol.
+/// </summary>
+static UINT32 WkiSimHash(
+	_In_ PCSTR Name
+) {
+	UINT32 Hash = 0x1505;
+	while (*Name != '\0')
+		Hash = ((Hash << 5) + Hash) + (UCHAR)*Name++;
+	return Hash;
+}
+
+/// <summary>
+/// Create a key, relative to another key if any.
+/// </summary>
+static HANDLE WkiSimCreateKey(
+	_In_opt_ HANDLE  RootDirectory,
+	_In_     PCWSTR  Name
+) {
+	UNICODE_STRING    KeyName    = { 0x00 };
+	OBJECT_ATTRIBUTES Attributes = { 0x00 };
+	RtlInitUnicodeString(&KeyName, Name);
+	InitializeObjectAttributes(&Attributes, &KeyName, (OBJ_CASE_INSENSITIVE | OBJ_KERNEL_HANDLE), RootDirectory, 0x00);
+
+	HANDLE Key = NULL;
+	if (NT_ERROR(ZwCreateKey(&Key, KEY_ALL_ACCESS, &Attributes, 0x00, NULL, REG_OPTION_NON_VOLATILE, NULL))) {
+		fprintf(stderr, "wkisim: unable to create key %ls.\n", Name);
+		exit(EXIT_FAILURE);
+	}
+	return Key;
+}
+
+/// <summary>
+/// Set a value of a key.
+/// </summary>
+static VOID WkiSimSetValue(
+	_In_ HANDLE Key,
+	_In_ PCWSTR Name,
+	_In_ ULONG  Type,
+	_In_ PVOID  Data,
+	_In_ ULONG  Size
+) {
+	UNICODE_STRING ValueName = { 0x00 };
+	RtlInitUnicodeString(&ValueName, Name);
+	if (NT_ERROR(ZwSetValueKey(Key, &ValueName, 0x00, Type, Data, Size))) {
+		fprintf(stderr, "wkisim: unable to set value %ls.\n", Name);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/// <summary>
+/// Create the key with the version of the OS.
+/// </summary>
+static VOID WkiSimCreateVersion(
+	VOID
+) {
+	ZwClose(WkiSimCreateKey(NULL, L"\\Registry\\Machine\\SOFTWARE\\Microsoft"));
+	ZwClose(WkiSimCreateKey(NULL, L"\\Registry\\Machine\\SOFTWARE\\Microsoft\\Windows NT"));
+	HANDLE Key = WkiSimCreateKey(NULL, WKI_CURRENTVERSION_KEY_NAME);
+
+	DWORD Major    = WKISIM_MAJOR;
+	DWORD Revision = WKISIM_REVISION;
+	WkiSimSetValue(Key, L"CurrentMajorVersionNumber", REG_DWORD, &Major, sizeof(DWORD));
+	WkiSimSetValue(Key, L"CurrentBuildNumber", REG_SZ, WKISIM_BUILD, sizeof(WKISIM_BUILD));
+	WkiSimSetValue(Key, L"UBR", REG_DWORD, &Revision, sizeof(DWORD));
+	ZwClose(Key);
+}
+
+/// <summary>
+/// Create the key of a symbol.
+/// </summary>
+static VOID WkiSimCreateSymbol(
+	_In_ HANDLE Symbols,
+	_In_ PCSTR  Name,
+	_In_ ULONG  Rva,
+	_In_ ULONG  DjbType
+) {
+	WCHAR WideName[0x40] = { 0x00 };
+	swprintf(WideName, _ARRAYSIZE(WideName), L"%s", Name);
+	HANDLE Key = WkiSimCreateKey(Symbols, WideName);
+
+	UINT64 Djb = WkiSimHash(Name);
+	DWORD  Off = 0x00;
+	DWORD  Seg = 0x01;
+	WkiSimSetValue(Key, L"DJB", DjbType, &Djb, DjbType == REG_QWORD ? sizeof(UINT64) : sizeof(DWORD));
+	WkiSimSetValue(Key, L"OFF", REG_DWORD, &Off, sizeof(DWORD));
+	WkiSimSetValue(Key, L"RVA", REG_DWORD, &Rva, sizeof(DWORD));
+	WkiSimSetValue(Key, L"SEG", REG_DWORD, &Seg, sizeof(DWORD));
+	ZwClose(Key);
+}
+
+/// <summary>
+/// Create the symbols of the kernel, and a symbol with a malformed value.
+/// </summary>
+static VOID WkiSimCreateSymbols(
+	_In_ PWKISIM_KERNEL Kernel
+) {
+	HANDLE Wki     = WkiSimCreateKey(NULL, WKI_KINTROSPECTION_KEY_NAME);
+	HANDLE Version = WkiSimCreateKey(Wki, WKISIM_VERSION);
+	HANDLE Symbols = WkiSimCreateKey(Version, L"Symbols");
+
+	for (ULONG cx = 0x00; cx < Kernel->NumberOfSymbols; cx++) {
+		CHAR Name[0x40] = { 0x00 };
+		WkiSimGetSymbolName(cx, Name, sizeof(Name));
+		WkiSimCreateSymbol(Symbols, Name, WKISIM_FIRST_RVA + (cx * WKISIM_STRIDE), REG_DWORD);
+
+		if (cx == Kernel->NumberOfSymbols / 0x02)
+			WkiSimCreateSymbol(Symbols, "WkiSimMalformed", WKISIM_FIRST_RVA, REG_QWORD);
+	}
+
+	ZwClose(Symbols);
+	ZwClose(Version);
+	ZwClose(Wki);
+}
+
+/// <summary>
+/// Build the kernel image and load it, after another module.
+/// </summary>
+static VOID WkiSimLoadKernel(
+	_Inout_ PWKISIM_KERNEL Kernel
+) {
+	Kernel->ImageSize = (WKISIM_FIRST_RVA + (Kernel->NumberOfSymbols * WKISIM_STRIDE) + (PAGE_SIZE * 0x02) - 1) & ~(PAGE_SIZE - 1);
+	Kernel->Image     = aligned_alloc(PAGE_SIZE, Kernel->ImageSize);
+	Kernel->Driver    = aligned_alloc(PAGE_SIZE, PAGE_SIZE);
+	if (Kernel->Image == NULL || Kernel->Driver == NULL) {
+		fprintf(stderr, "wkisim: out of memory.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	memset(Kernel->Image, 0x00, Kernel->ImageSize);
+	memset(Kernel->Driver, 0x00, PAGE_SIZE);
+	for (ULONG cx = 0x00; cx < Kernel->NumberOfSymbols; cx++) {
+		UINT64 Value = WKISIM_VALUE(cx);
+		memcpy(Kernel->Image + WKISIM_FIRST_RVA + (cx * WKISIM_STRIDE), &Value, sizeof(UINT64));
+	}
+
+	KShimLoadModule("\\SystemRoot\\System32\\drivers\\ACPI.sys", Kernel->Driver, PAGE_SIZE);
+	KShimLoadModule("\\SystemRoot\\system32\\ntoskrnl.exe", Kernel->Image, Kernel->ImageSize);
+}
+
+/// <summary>
+/// Check that nothing is left over by WKI.
+/// </summary>
+/// <returns>Number of differences.</returns>
+static ULONG WkiSimCheckReleased(
+	_In_ PCSTR Step
+) {
+	ULONG  Handles     = KShimQueryOpenHandles();
+	LONG64 Allocations = KShimQueryPoolAllocations();
+	if (Handles == 0x00 && Allocations == 0x00)
+		return 0x00;
+
+	fprintf(stderr, "wkisim: %s: %u handle(s) and %lld pool allocation(s) left.\n", Step, Handles, (long long)Allocations);
+	return 0x01;
+}
+
+/// <summary>
+/// Check that initialisation fails on the registry as it is.
+/// </summary>
+/// <returns>Number of differences.</returns>
+static ULONG WkiSimCheckFailure(
+	_In_ PCSTR Step
+) {
+	ULONG    Errors = 0x00;
+	NTSTATUS Status = WkiInitialise();
+	if (NT_SUCCESS(Status) || WkiInitialised) {
+		fprintf(stderr, "wkisim: %s: initialisation succeeded.\n", Step);
+		Errors++;
+		WkiUninitialise();
+	}
+	return Errors + WkiSimCheckReleased(Step);
+}
+
+/// <summary>
+/// Load the symbols, and check them against the kernel image.
+/// </summary>
+/// <returns>Number of differences.</returns>
+static ULONG WkiSimCheckSymbols(
+	_In_ PWKISIM_KERNEL Kernel
+) {
+	ULONG    Errors = 0x00;
+	NTSTATUS Status = WkiInitialise();
+	if (!NT_SUCCESS(Status)) {
+		fprintf(stderr, "wkisim: initialisation failed with 0x%08x.\n", (UINT32)Status);
+		return 0x01;
+	}
+
+	// The malformed symbol is skipped
+	if (WkiGlobal.NumberOfSymbols != Kernel->NumberOfSymbols || WkiGlobal.KernelBase != (UINT64)Kernel->Image) {
+		fprintf(stderr, "wkisim: %u symbol(s) loaded, kernel at 0x%llx.\n", WkiGlobal.NumberOfSymbols, (unsigned long long)WkiGlobal.KernelBase);
+		Errors++;
+	}
+
+	for (ULONG cx = 0x00; cx < Kernel->NumberOfSymbols; cx++) {
+		CHAR Name[0x40] = { 0x00 };
+		WkiSimGetSymbolName(cx, Name, sizeof(Name));
+
+		PVOID Address = WkiGetSymbol(Name);
+		if (Address != Kernel->Image + WKISIM_FIRST_RVA + (cx * WKISIM_STRIDE) || WkiReadValue(Address, sizeof(UINT64)) != WKISIM_VALUE(cx))
+			Errors++;
+	}
+
+	// Unknown symbols, and memory outside of the modules
+	UINT64 Outside = 0x00;
+	if (WkiGetSymbol("WkiSimMalformed") != NULL || WkiGetSymbol("WkiSimMissing") != NULL)
+		Errors++;
+	if (WkiReadValue(&Outside, sizeof(UINT64)) != 0x00 || WkiReadValue(Kernel->Image, 0x09) != 0x00)
+		Errors++;
+	return Errors;
+}
+
+int main(
+	int   argc,
+	char* argv[]
+) {
+	WKISIM_KERNEL Kernel = { 0x00 };
+	Kernel.NumberOfSymbols = argc > 0x01 ? (ULONG)strtoul(argv[1], NULL, 0) : 0x400;
+	ULONG Iterations       = argc > 0x02 ? (ULONG)strtoul(argv[2], NULL, 0) : 0x40;
+	if (Kernel.NumberOfSymbols == 0x00 || Kernel.NumberOfSymbols > 0x10000 || Iterations == 0x00) {
+		fprintf(stderr, "usage: wkisim [symbols] [iterations]\n");
+		return EXIT_FAILURE;
+	}
+	WkiSimLoadKernel(&Kernel);
+
+	// Registry incomplete: no version of the OS, then no symbols for this version
+	ULONG Errors = WkiSimCheckFailure("no version");
+	WkiSimCreateVersion();
+	Errors += WkiSimCheckFailure("no symbols");
+	WkiSimCreateSymbols(&Kernel);
+
+	// Load the symbols twice, the second time after releasing them
+	Errors += WkiSimCheckSymbols(&Kernel);
+	WkiUninitialise();
+	Errors += WkiSimCheckReleased("first release");
+	Errors += WkiSimCheckSymbols(&Kernel);
+
+	// Resolve every symbol
+	ULONG64 Nanoseconds = 0x00;
+	ULONG64 Resolved    = 0x00;
+	for (ULONG cx = 0x00; cx < Iterations; cx++) {
+		CHAR Name[0x40] = { 0x00 };
+		WkiSimGetSymbolName((cx * 0x9E3779B1) % Kernel.NumberOfSymbols, Name, sizeof(Name));
+
+		struct timespec Start, End;
+		clock_gettime(CLOCK_MONOTONIC, &Start);
+		for (ULONG dx = 0x00; dx < Kernel.NumberOfSymbols; dx++)
+			Resolved += WkiGetSymbol(Name) != NULL;
+		clock_gettime(CLOCK_MONOTONIC, &End);
+		Nanoseconds += ((End.tv_sec - Start.tv_sec) * 1000000000ULL) + End.tv_nsec - Start.tv_nsec;
+	}
+	if (Resolved != (ULONG64)Iterations * Kernel.NumberOfSymbols)
+		Errors++;
+
+	WkiUninitialise();
+	Errors += WkiSimCheckReleased("second release");
+
+	printf("wkisim: %u symbols, %u iterations\n", Kernel.NumberOfSymbols, Iterations);
+	printf("wkisim: %.1f ns per lookup\n", (double)Nanoseconds / (double)Resolved);
+	printf("wkisim: %u difference(s)\n", Errors);
+
+	KShimReset();
+	free(Kernel.Driver);
+	free(Kernel.Image);
+	return Errors == 0x00 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -12,6 +12,10 @@ Wrapper for MMP kernel device access.
 #define __MPPCLIENT_DEVICE_H_GUARD__
 
 #include <Windows.h>
+#include <memory>
+
+#include "../mpp/stats.hpp"
+#include "../mpp/events.hpp"
 
 constexpr ULONG MppAddImageName() {
 	return (ULONG)CTL_CODE(\
@@ -40,8 +44,68 @@ constexpr ULONG MppInitialiseKernelRoutines() {
 	);
 }
 
+constexpr ULONG MppVerifyIntegrity() {
+	return (ULONG)CTL_CODE(\
+		0x8000,            /* DeviceType */\
+		0x803,             /* Function   */\
+		METHOD_BUFFERED,   /* Method     */\
+		FILE_ANY_ACCESS    /* Access     */\
+	);
+}
+
+constexpr ULONG MppDiffImage() {
+	return (ULONG)CTL_CODE(\
+		0x8000,            /* DeviceType */\
+		0x804,             /* Function   */\
+		METHOD_BUFFERED,   /* Method     */\
+		FILE_ANY_ACCESS    /* Access     */\
+	);
+}
+
+constexpr ULONG MppUpdateImageNames() {
+	return (ULONG)CTL_CODE(\
+		0x8000,            /* DeviceType */\
+		0x805,             /* Function   */\
+		METHOD_BUFFERED,   /* Method     */\
+		FILE_ANY_ACCESS    /* Access     */\
+	);
+}
+
+constexpr ULONG MppLoadPolicy() {
+	return (ULONG)CTL_CODE(\
+		0x8000,            /* DeviceType */\
+		0x806,             /* Function   */\
+		METHOD_BUFFERED,   /* Method     */\
+		FILE_ANY_ACCESS    /* Access     */\
+	);
+}
+
+constexpr ULONG MppQueryStatistics() {
+	return (ULONG)CTL_CODE(\
+		0x8000,            /* DeviceType */\
+		0x807,             /* Function   */\
+		METHOD_BUFFERED,   /* Method     */\
+		FILE_ANY_ACCESS    /* Access     */\
+	);
+}
+
+constexpr ULONG MppMapTrace() {
+	return (ULONG)CTL_CODE(\
+		0x8000,            /* DeviceType */\
+		0x808,             /* Function   */\
+		METHOD_BUFFERED,   /* Method     */\
+		FILE_ANY_ACCESS    /* Access     */\
+	);
+}
+
+/// @brief Flag of `MppUpdateImageNames` removing all the image names before adding the new ones.
+constexpr ULONG MppImageNamesReplace = 0x01;
+
 constexpr WCHAR AmsiImageName[] = L"amsi.dll\0";
 
+/// @brief Number of bytes copied per difference, with the bytes around it.
+constexpr ULONG MppDiffContextSize = 0x30;
+
 /// @brief Data structure for `MppInitialiseKernelRoutines` input buffer IOCTL.
 typedef struct _MPP_KERNEL_ROUTINES_OFFSETS {
 	DWORD MiAddSecureEntry;
@@ -61,6 +125,66 @@ typedef struct _MPP_ADD_IMAGE_NAME {
 	WCHAR  Name[MAX_PATH];
 } MPP_ADD_IMAGE_NAME, *PMPP_ADD_IMAGE_NAME;
 
+/// @brief Data structure for `MppVerifyIntegrity` output buffer IOCTL.
+typedef struct _MPP_INTEGRITY_RESULT {
+	ULONG NumberOfRanges;
+	ULONG Intact;
+	ULONG Modified;
+	ULONG Unavailable;
+} MPP_INTEGRITY_RESULT, *PMPP_INTEGRITY_RESULT;
+
+/// @brief Data structure for `MppDiffImage` input buffer IOCTL.
+typedef struct _MPP_DIFF_IMAGE {
+	ULONG64 ProcessId;
+	ULONG64 ImageBase;
+} MPP_DIFF_IMAGE, *PMPP_DIFF_IMAGE;
+
+/// @brief Range of differing bytes returned by `MppDiffImage`.
+typedef struct _MPP_DIFF_ENTRY {
+	ULONG Rva;
+	ULONG Length;
+	ULONG ContextRva;
+	ULONG ContextLength;
+	UCHAR Expected[MppDiffContextSize];
+	UCHAR Actual[MppDiffContextSize];
+} MPP_DIFF_ENTRY, *PMPP_DIFF_ENTRY;
+
+/// @brief Data structure for `MppDiffImage` output buffer IOCTL.
+typedef struct _MPP_DIFF_RESULT {
+	ULONG          NumberOfRanges;
+	ULONG          NumberOfDifferences;
+	ULONG          NumberOfEntries;
+	ULONG          UnreadablePages;
+	MPP_DIFF_ENTRY Entries[ANYSIZE_ARRAY];
+} MPP_DIFF_RESULT, *PMPP_DIFF_RESULT;
+
+/// @brief Image name packed in the `MppUpdateImageNames` input buffer.
+typedef struct _MPP_IMAGE_NAME {
+	USHORT Length;
+	WCHAR  Name[ANYSIZE_ARRAY];
+} MPP_IMAGE_NAME, *PMPP_IMAGE_NAME;
+
+/// @brief Data structure for `MppUpdateImageNames` input buffer IOCTL.
+typedef struct _MPP_IMAGE_NAMES {
+	ULONG  Flags;
+	ULONG  NumberOfAdded;
+	ULONG  NumberOfRemoved;
+	USHORT Names[ANYSIZE_ARRAY];
+} MPP_IMAGE_NAMES, *PMPP_IMAGE_NAMES;
+
+/// @brief Data structure for `MppLoadPolicy` output buffer IOCTL.
+typedef struct _MPP_POLICY_RESULT {
+	ULONG Generation;
+	ULONG Revision;
+	ULONG NumberOfEntries;
+} MPP_POLICY_RESULT, *PMPP_POLICY_RESULT;
+
+/// @brief Data structure for `MppMapTrace` output buffer IOCTL.
+typedef struct _MPP_TRACE_VIEW {
+	ULONG64 Address;
+	ULONG64 Size;
+} MPP_TRACE_VIEW, *PMPP_TRACE_VIEW;
+
 /// @brief Class wrapper to manage kernel device driver.
 class CDeviceManager {
 public:
@@ -104,8 +228,9 @@ public:
 		);
 		if (!Success) {
 			::printf("Failed to initialise kernel routines (%d).\r\n", ::GetLastError());
-			return Success;
+			return FALSE;
 		}
+		return TRUE;
 	}
 
 	/// @brief IOCTL to add a new image name.
@@ -132,6 +257,198 @@ public:
 		}
 	}
 
+	/// @brief IOCTL to add and remove a batch of image names at once.
+	/// @param Added           Names to add.
+	/// @param NumberOfAdded   Number of names to add.
+	/// @param Removed         Names to remove, the same as when added.
+	/// @param NumberOfRemoved Number of names to remove.
+	/// @param Flags           MppImageNamesReplace to remove all the names first.
+	BOOLEAN
+	_Must_inspect_result_
+	SendUpdateImageNames(
+		_In_reads_(NumberOfAdded)   CONST LPCWSTR* Added,
+		_In_                        ULONG          NumberOfAdded,
+		_In_reads_(NumberOfRemoved) CONST LPCWSTR* Removed,
+		_In_                        ULONG          NumberOfRemoved,
+		_In_                        ULONG          Flags
+	) {
+		// Size of the packed names
+		SIZE_T BufferSize = FIELD_OFFSET(MPP_IMAGE_NAMES, Names);
+		for (ULONG cx = 0x00; cx < (NumberOfAdded + NumberOfRemoved); cx++) {
+			LPCWSTR Name = cx < NumberOfAdded ? Added[cx] : Removed[cx - NumberOfAdded];
+			BufferSize += FIELD_OFFSET(MPP_IMAGE_NAME, Name) + (::wcslen(Name) * sizeof(WCHAR));
+		}
+		if (BufferSize > MAXDWORD) {
+			::printf("Too many image names.\r\n");
+			return FALSE;
+		}
+
+		// Names added, followed by the names removed
+		auto  Buffer = std::make_unique<BYTE[]>(BufferSize);
+		auto  Names  = (PMPP_IMAGE_NAMES)Buffer.get();
+		PBYTE Cursor = (PBYTE)Names->Names;
+		Names->Flags           = Flags;
+		Names->NumberOfAdded   = NumberOfAdded;
+		Names->NumberOfRemoved = NumberOfRemoved;
+		for (ULONG cx = 0x00; cx < (NumberOfAdded + NumberOfRemoved); cx++) {
+			LPCWSTR Name  = cx < NumberOfAdded ? Added[cx] : Removed[cx - NumberOfAdded];
+			auto    Entry = (PMPP_IMAGE_NAME)Cursor;
+			Entry->Length = (USHORT)::wcslen(Name);
+			RtlCopyMemory(Entry->Name, Name, Entry->Length * sizeof(WCHAR));
+			Cursor += FIELD_OFFSET(MPP_IMAGE_NAME, Name) + (Entry->Length * sizeof(WCHAR));
+		}
+
+		DWORD ReturnedBytes = 0x00;
+		BOOL Success = ::DeviceIoControl(
+			this->hDevice,
+			MppUpdateImageNames(),
+			Buffer.get(),
+			(DWORD)BufferSize,
+			nullptr,
+			0x00,
+			&ReturnedBytes,
+			nullptr
+		);
+		if (!Success) {
+			::printf("Failed to update image names (%d).\r\n", ::GetLastError());
+			return FALSE;
+		}
+		return TRUE;
+	}
+
+	/// @brief IOCTL to replace the policy.
+	/// @param Policy     Binary policy.
+	/// @param PolicySize Size of the policy, in bytes.
+	/// @param Result     Receives the generation of the policy.
+	BOOLEAN
+	_Must_inspect_result_
+	SendLoadPolicy(
+		_In_reads_bytes_(PolicySize) PVOID              Policy,
+		_In_                         DWORD              PolicySize,
+		_Out_                        MPP_POLICY_RESULT* Result
+	) {
+		DWORD ReturnedBytes = 0x00;
+		BOOL Success = ::DeviceIoControl(
+			this->hDevice,
+			MppLoadPolicy(),
+			Policy,
+			PolicySize,
+			Result,
+			sizeof(MPP_POLICY_RESULT),
+			&ReturnedBytes,
+			nullptr
+		);
+		if (!Success || ReturnedBytes != sizeof(MPP_POLICY_RESULT)) {
+			::printf("Failed to load the policy (%d).\r\n", ::GetLastError());
+			return FALSE;
+		}
+		return TRUE;
+	}
+
+	/// @brief IOCTL to get the counters and latencies of the driver.
+	/// @param Snapshot Receives the sum of all the processors.
+	BOOLEAN
+	_Must_inspect_result_
+	SendQueryStatistics(
+		_Out_ MppStats::MPP_STATS_SNAPSHOT* Snapshot
+	) {
+		DWORD ReturnedBytes = 0x00;
+		BOOL Success = ::DeviceIoControl(
+			this->hDevice,
+			MppQueryStatistics(),
+			nullptr,
+			0x00,
+			Snapshot,
+			sizeof(MppStats::MPP_STATS_SNAPSHOT),
+			&ReturnedBytes,
+			nullptr
+		);
+		if (!Success || ReturnedBytes != sizeof(MppStats::MPP_STATS_SNAPSHOT)) {
+			::printf("Failed to query the statistics (%d).\r\n", ::GetLastError());
+			return FALSE;
+		}
+		return TRUE;
+	}
+
+	/// @brief IOCTL to map the trace of the driver, read-only, until the device is closed.
+	/// @param View Receives the address and the size of the trace.
+	BOOLEAN
+	_Must_inspect_result_
+	SendMapTrace(
+		_Out_ MPP_TRACE_VIEW* View
+	) {
+		DWORD ReturnedBytes = 0x00;
+		BOOL Success = ::DeviceIoControl(
+			this->hDevice,
+			MppMapTrace(),
+			nullptr,
+			0x00,
+			View,
+			sizeof(MPP_TRACE_VIEW),
+			&ReturnedBytes,
+			nullptr
+		);
+		if (!Success || ReturnedBytes != sizeof(MPP_TRACE_VIEW)) {
+			::printf("Failed to map the trace (%d).\r\n", ::GetLastError());
+			return FALSE;
+		}
+		return TRUE;
+	}
+
+	/// @brief IOCTL to verify the protected ranges against their baseline.
+	/// @param Result Receives the number of ranges per outcome.
+	BOOLEAN
+	_Must_inspect_result_
+	SendVerifyIntegrity(
+		_Out_ MPP_INTEGRITY_RESULT* Result
+	) {
+		DWORD ReturnedBytes = 0x00;
+		BOOL Success = ::DeviceIoControl(
+			this->hDevice,
+			MppVerifyIntegrity(),
+			nullptr,
+			0x00,
+			Result,
+			sizeof(MPP_INTEGRITY_RESULT),
+			&ReturnedBytes,
+			nullptr
+		);
+		if (!Success || ReturnedBytes != sizeof(MPP_INTEGRITY_RESULT)) {
+			::printf("Failed to verify integrity (%d).\r\n", ::GetLastError());
+			return FALSE;
+		}
+		return TRUE;
+	}
+
+	/// @brief IOCTL to compare an image with its file.
+	/// @param Image      Process and base address of the image.
+	/// @param Result     Receives the differences.
+	/// @param ResultSize Size of the result, in bytes.
+	BOOLEAN
+	_Must_inspect_result_
+	SendDiffImage(
+		_In_  MPP_DIFF_IMAGE   Image,
+		_Out_ PMPP_DIFF_RESULT Result,
+		_In_  DWORD            ResultSize
+	) {
+		DWORD ReturnedBytes = 0x00;
+		BOOL Success = ::DeviceIoControl(
+			this->hDevice,
+			MppDiffImage(),
+			&Image,
+			sizeof(MPP_DIFF_IMAGE),
+			Result,
+			ResultSize,
+			&ReturnedBytes,
+			nullptr
+		);
+		if (!Success || ReturnedBytes < FIELD_OFFSET(MPP_DIFF_RESULT, Entries)) {
+			::printf("Failed to compare the image (%d).\r\n", ::GetLastError());
+			return FALSE;
+		}
+		return TRUE;
+	}
+
 private:
 	/// @brief Handle to kernel device driver.
 	HANDLE hDevice{ INVALID_HANDLE_VALUE };
@@ -10,31 +10,32 @@ Memory Patching Protection (MPP) Kernel Device Driver User-Mode Client.
 
 
 #include <Windows.h>
+#include <algorithm>
+#include <fstream>
 #include <iostream>
+#include <iterator>
 #include <memory>
+#include <string>
+#include <vector>
 #include <stdio.h>
 
 #include "sym.hpp"
 #include "device.hpp"
+#include "../mpp/policy.hpp"
 
 
-INT32 main(
-	_In_ int         argc,
-	_In_ const char* argv[]
+/// @brief Find the kernel routines securing the ranges in the symbols of ntoskrnl, and send their offsets
+/// to the driver. The driver refuses to protect images until then.
+/// @param DeviceManager Handle to the kernel device.
+/// @return Whether the offsets have been sent.
+static BOOLEAN InitialiseKernelRoutines(
+	_In_ CDeviceManager* DeviceManager
 ) {
-	// Banner
-	wprintf(L"=================================================================\r\n");
-	wprintf(L"Module Name: Memory Patching Protection (MPP) User-Mode Client   \r\n");
-	wprintf(L"Author     : Paul L. (@am0nsec)                                  \r\n");
-	wprintf(L"Origin     : https://github.com/am0nsec/wkpe/                    \r\n");
-	wprintf(L"Tested OS  : Windows 10 (20h2) - 19044.2006                      \r\n");
-	wprintf(L"=================================================================\r\n");
-
 	// Download PDB file of ntoskrnl
 	auto SymDatabase = std::make_unique<CSymDatabase>("C:\\Windows\\System32\\ntoskrnl.exe");
 
 	if (FAILED(SymDatabase->DownloadFromServer()))
-		return EXIT_FAILURE;
+		return FALSE;
 
 	// Add symbols to find
 	SymDatabase->Symbols.insert(std::make_pair("MiAddSecureEntry", 0x00));
@@ -44,29 +45,247 @@ INT32 main(
 	// Find symbols
 	::printf("\r\n[+] Searching symbols ...\r\n");
 	if (FAILED(SymDatabase->LoadAndCheckSym()))
-		return EXIT_FAILURE;
+		return FALSE;
 	::printf("[+] Searching symbols ... OK\r\n");
 
 	// Send information to the kernel driver
-	auto DeviceManager = std::make_unique<CDeviceManager>();
-	if (!DeviceManager->IsDeviceReady()) {
-		::printf("[-] Failed to open handle to kernel device.\r\n");
-		return EXIT_FAILURE;
-	}
-
 	MPP_KERNEL_ROUTINES_OFFSETS KernelRoutines = {
 		.MiAddSecureEntry          = SymDatabase->Symbols["MiAddSecureEntry"],
 		.MiObtainReferencedVadEx   = SymDatabase->Symbols["MiObtainReferencedVadEx"],
 		.MiUnlockAndDereferenceVad = SymDatabase->Symbols["MiUnlockAndDereferenceVad"]
 	};
-	DeviceManager->SendKernelRoutinesOffsets(KernelRoutines);
+	return DeviceManager->SendKernelRoutinesOffsets(KernelRoutines);
+}
 
-	// Add AMSI DLL
-	MPP_ADD_IMAGE_NAME ImageName = { 
-		.Size = ARRAYSIZE(AmsiImageName) * sizeof(WCHAR)
-	};
-	RtlCopyMemory(ImageName.Name, AmsiImageName, ImageName.Size);
-	DeviceManager->SendAddImageName(ImageName);
+
+INT32 main(
+	_In_ int         argc,
+	_In_ const char* argv[]
+) {
+	// Banner
+	wprintf(L"=================================================================\r\n");
+	wprintf(L"Module Name: Memory Patching Protection (MPP) User-Mode Client   \r\n");
+	wprintf(L"Author     : Paul L. (@am0nsec)                                  \r\n");
+	wprintf(L"Origin     : https://github.com/am0nsec/wkpe/                    \r\n");
+	wprintf(L"Tested OS  : Windows 10 (20h2) - 19044.2006                      \r\n");
+	wprintf(L"=================================================================\r\n");
+
+	// Verify the protected ranges only
+	if (argc > 1 && ::strcmp(argv[1], "-v") == 0x00) {
+		auto DeviceManager = std::make_unique<CDeviceManager>();
+		if (!DeviceManager->IsDeviceReady()) {
+			::printf("[-] Failed to open handle to kernel device.\r\n");
+			return EXIT_FAILURE;
+		}
+
+		MPP_INTEGRITY_RESULT Result = { 0x00 };
+		if (!DeviceManager->SendVerifyIntegrity(&Result))
+			return EXIT_FAILURE;
+
+		::printf("[+] Ranges      : %lu\r\n", Result.NumberOfRanges);
+		::printf("[+] Intact      : %lu\r\n", Result.Intact);
+		::printf("[+] Modified    : %lu\r\n", Result.Modified);
+		::printf("[+] Unavailable : %lu\r\n", Result.Unavailable);
+		return Result.Modified == 0x00 ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	// Counters and latencies of the driver
+	if (argc > 1 && ::strcmp(argv[1], "-s") == 0x00) {
+		auto DeviceManager = std::make_unique<CDeviceManager>();
+		if (!DeviceManager->IsDeviceReady()) {
+			::printf("[-] Failed to open handle to kernel device.\r\n");
+			return EXIT_FAILURE;
+		}
+
+		auto Snapshot = std::make_unique<MppStats::MPP_STATS_SNAPSHOT>();
+		if (!DeviceManager->SendQueryStatistics(Snapshot.get()))
+			return EXIT_FAILURE;
+
+		CONST CHAR* Counters[MppStats::NumberOfCounters] = {
+			"Images loaded", "Images matched", "Requests dropped", "Images protected",
+			"Attach failures", "Ranges secured", "Secure failures"
+		};
+		for (ULONG cx = 0x00; cx < MppStats::NumberOfCounters; cx++)
+			::printf("[+] %-17s: %lld\r\n", Counters[cx], Snapshot->Counters[cx]);
+
+		CONST CHAR* Latencies[MppStats::NumberOfLatencies] = {
+			"Match", "Queue wait", "Attach", "Secure"
+		};
+		::printf("\r\n    %-12s %10s %12s %12s %12s %12s (ns)\r\n", "Latency", "Count", "Mean", "P50", "P99", "Max");
+		for (ULONG cx = 0x00; cx < MppStats::NumberOfLatencies; cx++) {
+			CONST MppStats::MPP_STATS_HISTOGRAM* Histogram = &Snapshot->Latencies[cx];
+			::printf("    %-12s %10lld %12lld %12llu %12llu %12lld\r\n",
+				Latencies[cx],
+				Histogram->Count,
+				Histogram->Count != 0x00 ? Histogram->Sum / Histogram->Count : 0x00,
+				MppStats::GetPercentile(Histogram, 50),
+				MppStats::GetPercentile(Histogram, 99),
+				Histogram->Maximum
+			);
+		}
+		return EXIT_SUCCESS;
+	}
+
+	// Events of the driver, read from its trace, and the new ones as they come with -f
+	if (argc > 1 && ::strcmp(argv[1], "-t") == 0x00) {
+		auto DeviceManager = std::make_unique<CDeviceManager>();
+		if (!DeviceManager->IsDeviceReady()) {
+			::printf("[-] Failed to open handle to kernel device.\r\n");
+			return EXIT_FAILURE;
+		}
+
+		MPP_TRACE_VIEW View = { 0x00 };
+		if (!DeviceManager->SendMapTrace(&View))
+			return EXIT_FAILURE;
+		CONST VOID* Buffer = (CONST VOID*)(ULONG_PTR)View.Address;
+		if (!MppTrace::Validate(Buffer, (SIZE_T)View.Size)) {
+			::printf("[-] Invalid trace.\r\n");
+			return EXIT_FAILURE;
+		}
+		auto Trace = static_cast<CONST MppTrace::MPP_TRACE_HEADER*>(Buffer);
+
+		auto Cursor = std::make_unique<MppTrace::MPP_TRACE_CURSOR>();
+		MppTrace::InitialiseCursor(Trace, Cursor.get(), TRUE);
+
+		BOOLEAN Follow = argc > 2 && ::strcmp(argv[2], "-f") == 0x00;
+		std::vector<ULONG64> Records(0x10000 / sizeof(ULONG64));
+		std::vector<CONST MppTrace::MPP_TRACE_RECORD*> Sorted;
+		CHAR Text[0x200] = { 0x00 };
+		LONG64 LostBytes = 0x00;
+
+		do {
+			// Copy the records of all the rings, then order them across the processors
+			SIZE_T Size = 0x00;
+			do {
+				Size = MppTrace::Drain(Trace, Cursor.get(), Records.data(), Records.size() * sizeof(ULONG64));
+
+				Sorted.clear();
+				for (SIZE_T Offset = 0x00; Offset < Size;) {
+					auto Record = (CONST MppTrace::MPP_TRACE_RECORD*)((PUCHAR)Records.data() + Offset);
+					Sorted.push_back(Record);
+					Offset += Record->Size;
+				}
+				std::stable_sort(Sorted.begin(), Sorted.end(), [](auto Left, auto Right) {
+					return Left->Timestamp < Right->Timestamp;
+				});
+
+				for (auto Record : Sorted) {
+					MppTrace::Format(Record, MppEvents::Descriptors, MppEvents::NumberOfEvents, Text, sizeof(Text));
+					::printf("[%12.6f] [%02u] %s\r\n",
+						(double)Record->Timestamp / (double)Trace->Frequency,
+						Record->Ring,
+						Text
+					);
+				}
+			} while (Size != 0x00);
+
+			// Records overwritten before being read
+			if (Cursor->LostBytes != LostBytes) {
+				::printf("[-] %lld byte(s) of records lost.\r\n", Cursor->LostBytes - LostBytes);
+				LostBytes = Cursor->LostBytes;
+			}
+			if (Follow)
+				::Sleep(250);
+		} while (Follow);
+		return EXIT_SUCCESS;
+	}
+
+	// Compare an image with its file, the process being 0 for a kernel module
+	if (argc > 3 && ::strcmp(argv[1], "-d") == 0x00) {
+		auto DeviceManager = std::make_unique<CDeviceManager>();
+		if (!DeviceManager->IsDeviceReady()) {
+			::printf("[-] Failed to open handle to kernel device.\r\n");
+			return EXIT_FAILURE;
+		}
+
+		MPP_DIFF_IMAGE Image = {
+			.ProcessId = ::strtoull(argv[2], nullptr, 0x00),
+			.ImageBase = ::strtoull(argv[3], nullptr, 0x10)
+		};
+		constexpr DWORD ResultSize = FIELD_OFFSET(MPP_DIFF_RESULT, Entries) + (0x40 * sizeof(MPP_DIFF_ENTRY));
+		auto Buffer = std::make_unique<BYTE[]>(ResultSize);
+		auto Result = (PMPP_DIFF_RESULT)Buffer.get();
+		if (!DeviceManager->SendDiffImage(Image, Result, ResultSize))
+			return EXIT_FAILURE;
+
+		::printf("[+] Ranges      : %lu\r\n", Result->NumberOfRanges);
+		::printf("[+] Differences : %lu\r\n", Result->NumberOfDifferences);
+		::printf("[+] Unreadable  : %lu pages\r\n", Result->UnreadablePages);
+		for (ULONG cx = 0x00; cx < Result->NumberOfEntries; cx++) {
+			CONST MPP_DIFF_ENTRY* Entry = &Result->Entries[cx];
+			::printf("\r\n[+] +0x%08lx, %lu bytes\r\n", Entry->Rva, Entry->Length);
+
+			::printf("    File   :");
+			for (ULONG dx = 0x00; dx < Entry->ContextLength; dx++)
+				::printf(" %02x", Entry->Expected[dx]);
+			::printf("\r\n    Memory :");
+			for (ULONG dx = 0x00; dx < Entry->ContextLength; dx++)
+				::printf(" %02x", Entry->Actual[dx]);
+			::printf("\r\n");
+		}
+		return Result->NumberOfDifferences == 0x00 ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	// Compile a policy specification and replace the policy of the driver
+	if (argc > 2 && ::strcmp(argv[1], "-p") == 0x00) {
+		std::ifstream File(argv[2], std::ios::binary);
+		if (!File) {
+			::printf("[-] Failed to open %s.\r\n", argv[2]);
+			return EXIT_FAILURE;
+		}
+		std::string Text{ std::istreambuf_iterator<char>(File), std::istreambuf_iterator<char>() };
+
+		ULONG PolicySize = 0x00;
+		ULONG ErrorLine  = 0x00;
+		MppPolicy::Compile(Text.data(), Text.size(), nullptr, 0x00, &PolicySize, &ErrorLine);
+
+		auto Policy = std::make_unique<ULONG64[]>((PolicySize / sizeof(ULONG64)) + 1);
+		auto Status = MppPolicy::Compile(Text.data(), Text.size(), Policy.get(), PolicySize, &PolicySize, &ErrorLine);
+		if (Status != MppPolicy::PolicySuccess) {
+			::printf("[-] Invalid policy, line %lu (%d).\r\n", ErrorLine, Status);
+			return EXIT_FAILURE;
+		}
+
+		auto DeviceManager = std::make_unique<CDeviceManager>();
+		if (!DeviceManager->IsDeviceReady()) {
+			::printf("[-] Failed to open handle to kernel device.\r\n");
+			return EXIT_FAILURE;
+		}
+
+		// The driver refuses to protect images before knowing the kernel routines
+		if (!InitialiseKernelRoutines(DeviceManager.get()))
+			return EXIT_FAILURE;
+
+		MPP_POLICY_RESULT Result = { 0x00 };
+		if (!DeviceManager->SendLoadPolicy(Policy.get(), PolicySize, &Result))
+			return EXIT_FAILURE;
+
+		::printf("[+] Generation  : %lu\r\n", Result.Generation);
+		::printf("[+] Revision    : %lu\r\n", Result.Revision);
+		::printf("[+] Entries     : %lu\r\n", Result.NumberOfEntries);
+		return EXIT_SUCCESS;
+	}
+
+	// Send information to the kernel driver
+	auto DeviceManager = std::make_unique<CDeviceManager>();
+	if (!DeviceManager->IsDeviceReady()) {
+		::printf("[-] Failed to open handle to kernel device.\r\n");
+		return EXIT_FAILURE;
+	}
+	if (!InitialiseKernelRoutines(DeviceManager.get()))
+		return EXIT_FAILURE;
+
+	// Add AMSI DLL, and the image names given, in one batch
+	auto Names = std::make_unique<std::wstring[]>(argc);
+	auto Added = std::make_unique<LPCWSTR[]>(argc);
+	Added[0x00] = AmsiImageName;
+	for (INT32 cx = 0x01; cx < argc; cx++) {
+		SIZE_T Length = ::strlen(argv[cx]);
+		Names[cx].assign(argv[cx], argv[cx] + Length);
+		Added[cx] = Names[cx].c_str();
+	}
+	if (!DeviceManager->SendUpdateImageNames(Added.get(), (ULONG)argc, nullptr, 0x00, 0x00))
+		return EXIT_FAILURE;
 
 	return EXIT_SUCCESS;
 }
\ No newline at end of file
@@ -0,0 +1,138 @@
+/*+================================================================================================
+Module Name: cache.cpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+Abstract:
+Memory Patching Protection (MPP) cache of the ranges to protect per image.
+A shared image is mapped in every process that loads it, the ranges of its executable sections are
+planned once and reused for the next loads. The cache is a fixed set-associative table, the least
+recently used entry of a set being replaced. It is not synchronised, it belongs to the worker.
+================================================================================================+*/
+
+#include "cache.hpp"
+
+/// @brief Helpers of the cache.
+namespace MppCache {
+
+	static_assert((NumberOfEntries & (NumberOfEntries - 1)) == 0x00, "NumberOfEntries must be a power of two");
+	static_assert((NumberOfEntries % Associativity) == 0x00, "NumberOfEntries must be a multiple of Associativity");
+
+	/// @brief Get the first entry of the set of an image.
+	static MPP_CACHE_ENTRY* GetSet(
+		_In_ MPP_CACHE*           Cache,
+		_In_ CONST MPP_CACHE_KEY* Key
+	) {
+		// Section pointers are aligned, mix in the upper bits
+		ULONG64 Hash = (ULONG64)(SIZE_T)Key->Section;
+		Hash ^= ((ULONG64)Key->TimeDateStamp << 0x20) | Key->SizeOfImage;
+		Hash *= 0x9E3779B97F4A7C15ULL;
+		Hash ^= Hash >> 0x20;
+
+		ULONG NumberOfSets = NumberOfEntries / Associativity;
+		return &Cache->Entries[((ULONG)Hash & (NumberOfSets - 1)) * Associativity];
+	}
+
+	/// @brief Whether two identities are the same image.
+	static _inline BOOLEAN IsSameKey(
+		_In_ CONST MPP_CACHE_KEY* Left,
+		_In_ CONST MPP_CACHE_KEY* Right
+	) {
+		return Left->Section == Right->Section
+			&& Left->TimeDateStamp == Right->TimeDateStamp
+			&& Left->SizeOfImage == Right->SizeOfImage;
+	}
+
+	/// @brief Advance the clock, restarting the ages of all entries when it wraps.
+	static ULONG Tick(
+		_Inout_ MPP_CACHE* Cache
+	) {
+		if (++Cache->Clock == 0x00) {
+			for (ULONG cx = 0x00; cx < NumberOfEntries; cx++) {
+				if (Cache->Entries[cx].LastUse != 0x00)
+					Cache->Entries[cx].LastUse = 0x01;
+			}
+			Cache->Clock = 0x02;
+		}
+		return Cache->Clock;
+	}
+}
+
+
+_Use_decl_annotations_
+VOID MppCache::Initialise(
+	_Out_ MPP_CACHE* Cache
+) {
+	Cache->Clock     = 0x00;
+	Cache->Hits      = 0x00;
+	Cache->Misses    = 0x00;
+	Cache->Evictions = 0x00;
+	for (ULONG cx = 0x00; cx < NumberOfEntries; cx++) {
+		Cache->Entries[cx].LastUse        = 0x00;
+		Cache->Entries[cx].NumberOfRanges = 0x00;
+	}
+}
+
+
+_Use_decl_annotations_
+BOOLEAN MppCache::Lookup(
+	_Inout_ MPP_CACHE*                     Cache,
+	_In_    CONST MPP_CACHE_KEY*           Key,
+	_Out_   MppSections::MPP_SECTION_PLAN* Plan
+) {
+	Plan->SizeOfImage    = 0x00;
+	Plan->NumberOfRanges = 0x00;
+
+	MPP_CACHE_ENTRY* Set = GetSet(Cache, Key);
+	for (ULONG cx = 0x00; cx < Associativity; cx++) {
+		MPP_CACHE_ENTRY* Entry = &Set[cx];
+		if (Entry->LastUse == 0x00 || !IsSameKey(&Entry->Key, Key))
+			continue;
+
+		Entry->LastUse = Tick(Cache);
+		Cache->Hits++;
+
+		Plan->SizeOfImage    = Entry->Key.SizeOfImage;
+		Plan->NumberOfRanges = Entry->NumberOfRanges;
+		for (ULONG dx = 0x00; dx < Entry->NumberOfRanges; dx++)
+			Plan->Ranges[dx] = Entry->Ranges[dx];
+		return TRUE;
+	}
+
+	Cache->Misses++;
+	return FALSE;
+}
+
+
+_Use_decl_annotations_
+BOOLEAN MppCache::Insert(
+	_Inout_ MPP_CACHE*                           Cache,
+	_In_    CONST MPP_CACHE_KEY*                 Key,
+	_In_    CONST MppSections::MPP_SECTION_PLAN* Plan
+) {
+	if (Plan->NumberOfRanges > MaximumRanges)
+		return FALSE;
+
+	// Same image, else an empty entry, else the least recently used one
+	MPP_CACHE_ENTRY* Set    = GetSet(Cache, Key);
+	MPP_CACHE_ENTRY* Victim = &Set[0x00];
+	for (ULONG cx = 0x00; cx < Associativity; cx++) {
+		MPP_CACHE_ENTRY* Entry = &Set[cx];
+		if (Entry->LastUse != 0x00 && IsSameKey(&Entry->Key, Key)) {
+			Victim = Entry;
+			break;
+		}
+		if (Entry->LastUse < Victim->LastUse)
+			Victim = Entry;
+	}
+	if (Victim->LastUse != 0x00 && !IsSameKey(&Victim->Key, Key))
+		Cache->Evictions++;
+
+	Victim->Key            = *Key;
+	Victim->NumberOfRanges = Plan->NumberOfRanges;
+	for (ULONG cx = 0x00; cx < Plan->NumberOfRanges; cx++)
+		Victim->Ranges[cx] = Plan->Ranges[cx];
+	Victim->LastUse = Tick(Cache);
+	return TRUE;
+}
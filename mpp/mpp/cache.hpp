@@ -0,0 +1,87 @@
+/*+================================================================================================
+Module Name: cache.hpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+Abstract:
+Memory Patching Protection (MPP) cache of the ranges to protect per image.
+A shared image is mapped in every process that loads it, the ranges of its executable sections are
+planned once and reused for the next loads. The cache is a fixed set-associative table, the least
+recently used entry of a set being replaced. It is not synchronised, it belongs to the worker.
+================================================================================================+*/
+
+#ifndef __MPP_CACHE_H_GUARD__
+#define __MPP_CACHE_H_GUARD__
+
+#include "portable.hpp"
+#include "sections.hpp"
+
+
+/// @brief Cache of the ranges to protect per image.
+namespace MppCache {
+
+	/// @brief Number of entries, a power of two.
+	constexpr ULONG NumberOfEntries = 0x80;
+
+	/// @brief Number of entries an image can be stored in.
+	constexpr ULONG Associativity = 0x04;
+
+	/// @brief Maximum number of ranges of a cached image, images with more are always planned.
+	constexpr ULONG MaximumRanges = 0x08;
+
+	/// @brief Identity of an image.
+	typedef struct _MPP_CACHE_KEY {
+		CONST VOID* Section;       // Section object pointers of the image file, may be nullptr
+		ULONG       TimeDateStamp; // From the file header
+		ULONG       SizeOfImage;   // From the optional header
+	} MPP_CACHE_KEY, * PMPP_CACHE_KEY;
+
+	/// @brief Ranges of an image.
+	typedef struct _MPP_CACHE_ENTRY {
+		MPP_CACHE_KEY                  Key;
+		ULONG                          LastUse;        // Clock of the last use, 0 if empty
+		ULONG                          NumberOfRanges;
+		MppSections::MPP_SECTION_RANGE Ranges[MaximumRanges];
+	} MPP_CACHE_ENTRY, * PMPP_CACHE_ENTRY;
+
+	/// @brief Cache and its counters.
+	typedef struct _MPP_CACHE {
+		ULONG           Clock;     // Incremented on each use
+		LONG64          Hits;
+		LONG64          Misses;
+		LONG64          Evictions;
+		MPP_CACHE_ENTRY Entries[NumberOfEntries];
+	} MPP_CACHE, * PMPP_CACHE;
+
+	/// @brief Initialise an empty cache.
+	/// @param Cache Cache to initialise.
+	VOID Initialise(
+		_Out_ MPP_CACHE* Cache
+	);
+
+	/// @brief Get the ranges of an image.
+	/// @param Cache Cache to look up.
+	/// @param Key   Identity of the image.
+	/// @param Plan  Receives the ranges.
+	/// @return Whether the image has been found.
+	_Must_inspect_result_
+	BOOLEAN Lookup(
+		_Inout_ MPP_CACHE*                     Cache,
+		_In_    CONST MPP_CACHE_KEY*           Key,
+		_Out_   MppSections::MPP_SECTION_PLAN* Plan
+	);
+
+	/// @brief Store the ranges of an image, replacing the least recently used entry of its set.
+	/// @param Cache Cache to update.
+	/// @param Key   Identity of the image.
+	/// @param Plan  Ranges of the image.
+	/// @return Whether the ranges have been stored, FALSE if there are too many.
+	BOOLEAN Insert(
+		_Inout_ MPP_CACHE*                           Cache,
+		_In_    CONST MPP_CACHE_KEY*                 Key,
+		_In_    CONST MppSections::MPP_SECTION_PLAN* Plan
+	);
+}
+
+#endif // !__MPP_CACHE_H_GUARD__
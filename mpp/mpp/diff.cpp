@@ -0,0 +1,146 @@
+/*+================================================================================================
+Module Name: diff.cpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+Abstract:
+Memory Patching Protection (MPP) differences between the bytes of an image and its file.
+The range rebuilt from the file is compared with the range in memory by chunks of 64 bytes, and
+only the chunks that differ are looked at byte by byte. Close differences are merged into one,
+reported with the expected and actual bytes around it.
+================================================================================================+*/
+
+#include "diff.hpp"
+
+// SSE2 is part of x64, and its registers can be used by the kernel without being saved
+#if defined(_M_X64) || defined(_M_AMD64) || defined(__SSE2__)
+#define MPP_DIFF_SSE2
+#include <emmintrin.h>
+#endif // _M_X64
+
+
+/// @brief Helpers of the differences.
+namespace MppDiff {
+
+	constexpr SIZE_T ChunkSize = 0x40;
+
+	/// @brief Index of the lowest bit set, Value not being 0.
+	static _inline ULONG LowestBit(
+		_In_ ULONG64 Value
+	) {
+#if defined(_MSC_VER)
+		ULONG Index = 0x00;
+		_BitScanForward64(&Index, Value);
+		return Index;
+#else
+		return (ULONG)__builtin_ctzll(Value);
+#endif // _MSC_VER
+	}
+
+	/// @brief Offset of the first differing byte at or after an offset.
+	/// @return Offset of the byte, Size if there is none.
+	static SIZE_T FindDifference(
+		_In_reads_bytes_(Size) CONST UCHAR* Expected,
+		_In_reads_bytes_(Size) CONST UCHAR* Actual,
+		_In_                   SIZE_T       Offset,
+		_In_                   SIZE_T       Size
+	) {
+#if defined(MPP_DIFF_SSE2)
+		// Chunks of 64 bytes, all equal in the common case
+		for (; (Size - Offset) >= ChunkSize; Offset += ChunkSize) {
+			CONST __m128i* Left  = (CONST __m128i*)(Expected + Offset);
+			CONST __m128i* Right = (CONST __m128i*)(Actual + Offset);
+
+			__m128i Equal = _mm_and_si128(
+				_mm_and_si128(
+					_mm_cmpeq_epi8(_mm_loadu_si128(Left + 0x00), _mm_loadu_si128(Right + 0x00)),
+					_mm_cmpeq_epi8(_mm_loadu_si128(Left + 0x01), _mm_loadu_si128(Right + 0x01))
+				),
+				_mm_and_si128(
+					_mm_cmpeq_epi8(_mm_loadu_si128(Left + 0x02), _mm_loadu_si128(Right + 0x02)),
+					_mm_cmpeq_epi8(_mm_loadu_si128(Left + 0x03), _mm_loadu_si128(Right + 0x03))
+				)
+			);
+			if (_mm_movemask_epi8(Equal) == 0xFFFF)
+				continue;
+
+			// Differing 16 bytes of the chunk
+			for (ULONG cx = 0x00; cx < (ChunkSize / 0x10); cx++) {
+				ULONG Mask = (ULONG)_mm_movemask_epi8(
+					_mm_cmpeq_epi8(_mm_loadu_si128(Left + cx), _mm_loadu_si128(Right + cx))
+				) ^ 0xFFFF;
+				if (Mask != 0x00)
+					return Offset + (cx * 0x10) + LowestBit(Mask);
+			}
+		}
+#endif // MPP_DIFF_SSE2
+
+		// Words of 8 bytes, the first differing byte being the lowest differing bits
+		for (; (Size - Offset) >= sizeof(ULONG64); Offset += sizeof(ULONG64)) {
+			ULONG64 Left  = 0x00;
+			ULONG64 Right = 0x00;
+			memcpy(&Left, Expected + Offset, sizeof(ULONG64));
+			memcpy(&Right, Actual + Offset, sizeof(ULONG64));
+			if (Left != Right)
+				return Offset + (LowestBit(Left ^ Right) / 0x08);
+		}
+
+		for (; Offset < Size; Offset++) {
+			if (Expected[Offset] != Actual[Offset])
+				return Offset;
+		}
+		return Size;
+	}
+}
+
+
+_Use_decl_annotations_
+ULONG MppDiff::Compare(
+	_In_reads_bytes_(Size)            CONST UCHAR*    Expected,
+	_In_reads_bytes_(Size)            CONST UCHAR*    Actual,
+	_In_                              SIZE_T          Size,
+	_In_                              ULONG           Rva,
+	_Out_writes_(MaximumEntries)      MPP_DIFF_ENTRY* Entries,
+	_In_                              ULONG           MaximumEntries,
+	_Out_                             ULONG*          NumberOfEntries
+) {
+	*NumberOfEntries = 0x00;
+
+	ULONG  NumberOfDifferences = 0x00;
+	SIZE_T Offset              = FindDifference(Expected, Actual, 0x00, Size);
+	while (Offset < Size) {
+
+		// Extend the difference while the next one is close
+		SIZE_T First = Offset;
+		SIZE_T Last  = Offset;
+		for (;;) {
+			Offset = FindDifference(Expected, Actual, Last + 1, Size);
+			if (Offset >= Size || (Offset - Last) > MergeDistance)
+				break;
+			Last = Offset;
+		}
+		NumberOfDifferences++;
+
+		if (*NumberOfEntries >= MaximumEntries)
+			continue;
+		MPP_DIFF_ENTRY* Entry = &Entries[(*NumberOfEntries)++];
+
+		// Bytes of the difference, with the bytes around it
+		SIZE_T Length       = (Last - First) + 1;
+		SIZE_T ContextFirst = First > ContextSize ? First - ContextSize : 0x00;
+		SIZE_T ContextLast  = (Length > MaximumBytes ? First + MaximumBytes : Last + 1) + ContextSize;
+		if (ContextLast > Size)
+			ContextLast = Size;
+
+		Entry->Rva           = Rva + (ULONG)First;
+		Entry->Length        = (ULONG)Length;
+		Entry->ContextRva    = Rva + (ULONG)ContextFirst;
+		Entry->ContextLength = (ULONG)(ContextLast - ContextFirst);
+		memset(Entry->Expected, 0x00, sizeof(Entry->Expected));
+		memset(Entry->Actual, 0x00, sizeof(Entry->Actual));
+		memcpy(Entry->Expected, Expected + ContextFirst, Entry->ContextLength);
+		memcpy(Entry->Actual, Actual + ContextFirst, Entry->ContextLength);
+	}
+	return NumberOfDifferences;
+}
@@ -0,0 +1,62 @@
+/*+================================================================================================
+Module Name: diff.hpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+Abstract:
+Memory Patching Protection (MPP) differences between the bytes of an image and its file.
+The range rebuilt from the file is compared with the range in memory by chunks of 64 bytes, and
+only the chunks that differ are looked at byte by byte. Close differences are merged into one,
+reported with the expected and actual bytes around it.
+================================================================================================+*/
+
+#ifndef __MPP_DIFF_H_GUARD__
+#define __MPP_DIFF_H_GUARD__
+
+#include "portable.hpp"
+
+
+/// @brief Differences between the bytes of an image and its file.
+namespace MppDiff {
+
+	/// @brief Number of bytes copied before and after a difference.
+	constexpr ULONG ContextSize = 0x08;
+
+	/// @brief Number of bytes of a difference copied, the rest being truncated.
+	constexpr ULONG MaximumBytes = 0x20;
+
+	/// @brief Differences separated by fewer identical bytes are merged.
+	constexpr ULONG MergeDistance = 0x08;
+
+	/// @brief Range of differing bytes.
+	typedef struct _MPP_DIFF_ENTRY {
+		ULONG Rva;           // First differing byte
+		ULONG Length;        // Number of bytes up to the last differing byte
+		ULONG ContextRva;    // First byte copied
+		ULONG ContextLength; // Number of bytes copied
+		UCHAR Expected[ContextSize + MaximumBytes + ContextSize];
+		UCHAR Actual[ContextSize + MaximumBytes + ContextSize];
+	} MPP_DIFF_ENTRY, * PMPP_DIFF_ENTRY;
+
+	/// @brief Compare the expected bytes of a range with the actual ones.
+	/// @param Expected        Bytes rebuilt from the file.
+	/// @param Actual          Bytes in memory.
+	/// @param Size            Size of the range, in bytes.
+	/// @param Rva             Address of the range relative to the image.
+	/// @param Entries         Receives the first differences.
+	/// @param MaximumEntries  Number of entries available.
+	/// @param NumberOfEntries Receives the number of entries filled.
+	/// @return Number of differences found, more than the entries filled if they are too few.
+	ULONG Compare(
+		_In_reads_bytes_(Size)            CONST UCHAR*    Expected,
+		_In_reads_bytes_(Size)            CONST UCHAR*    Actual,
+		_In_                              SIZE_T          Size,
+		_In_                              ULONG           Rva,
+		_Out_writes_(MaximumEntries)      MPP_DIFF_ENTRY* Entries,
+		_In_                              ULONG           MaximumEntries,
+		_Out_                             ULONG*          NumberOfEntries
+	);
+}
+
+#endif // !__MPP_DIFF_H_GUARD__
@@ -0,0 +1,71 @@
+/*+================================================================================================
+Module Name: events.hpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+Abstract:
+Memory Patching Protection (MPP) events of the binary trace.
+The driver writes the identifier and the arguments of an event, the client formats them with the
+descriptor of the event. The number of arguments of each write is checked against the descriptor
+when the driver is compiled.
+================================================================================================+*/
+
+#ifndef __MPP_EVENTS_H_GUARD__
+#define __MPP_EVENTS_H_GUARD__
+
+#include "trace.hpp"
+
+
+/// @brief Events of the binary trace.
+namespace MppEvents {
+
+	/// @brief Identifiers of the events, indexes of their descriptor.
+	typedef enum _MPP_EVENT : USHORT {
+		EventPadding = MppTrace::EventPadding,
+		EventImageMatched,
+		EventRequestDropped,
+		EventProtectBatch,
+		EventPlanCache,
+		EventProtectImage,
+		EventProtectRange,
+		EventProcessNotFound,
+		EventInvalidSections,
+		EventVadNotFound,
+		EventSecureFailed,
+		EventRangeDiffers,
+		EventRangeModified,
+		EventFileOpenFailed,
+		EventNameOpenFailed,
+		EventFileReadFailed,
+		EventFileNameFailed,
+		EventPolicyLoaded,
+		EventRoutinesMissing,
+		NumberOfEvents
+	} MPP_EVENT;
+
+	/// @brief Descriptors of the events, the data being the name of a file.
+	constexpr MppTrace::MPP_TRACE_DESCRIPTOR Descriptors[NumberOfEvents] = {
+		{ EventPadding,         0x00, nullptr },
+		{ EventImageMatched,    0x03, "Image      : process 0x%08x, base 0x%p, flags 0x%x, %s" },
+		{ EventRequestDropped,  0x02, "Protect queue full, request of process 0x%08x for image 0x%p dropped" },
+		{ EventProtectBatch,    0x04, "Batch      : %u request(s), depth %u, high water %u, dropped %u" },
+		{ EventPlanCache,       0x03, "Cache      : %u hit(s), %u miss(es), %u eviction(s)" },
+		{ EventProtectImage,    0x04, "Protect    : process 0x%08x, thread 0x%08x, image 0x%p, flags 0x%x" },
+		{ EventProtectRange,    0x02, "Range      : 0x%p - 0x%p" },
+		{ EventProcessNotFound, 0x02, "Unable to get PEPROCESS of process 0x%08x (0x%08X)." },
+		{ EventInvalidSections, 0x02, "Unable to parse the section table of image 0x%p of process 0x%08x." },
+		{ EventVadNotFound,     0x02, "Unable to get VAD for address 0x%p (0x%08X)." },
+		{ EventSecureFailed,    0x01, "Unable to secure range 0x%p." },
+		{ EventRangeDiffers,    0x01, "Range 0x%p differs from the image file." },
+		{ EventRangeModified,   0x02, "Range 0x%p of process 0x%08x has been modified." },
+		{ EventFileOpenFailed,  0x01, "Unable to open the image file (0x%08X)." },
+		{ EventNameOpenFailed,  0x01, "Unable to open %s (0x%08X)." },
+		{ EventFileReadFailed,  0x01, "Unable to read the image file (0x%08X)." },
+		{ EventFileNameFailed,  0x02, "Unable to get the file of image 0x%p (0x%08X)." },
+		{ EventPolicyLoaded,    0x03, "Policy     : generation %u, revision %u, %u entries" },
+		{ EventRoutinesMissing, 0x02, "Kernel routines not initialised, image 0x%p: %u range(s) not secured." }
+	};
+}
+
+#endif // !__MPP_EVENTS_H_GUARD__
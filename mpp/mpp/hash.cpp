@@ -0,0 +1,187 @@
+/*+================================================================================================
+Module Name: hash.cpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+Abstract:
+Memory Patching Protection (MPP) keyed hash of the protected ranges.
+The buffer is consumed by stripes of 64 bytes into eight 64-bit accumulators, each mixing its data
+with a secret key, so that the hash of a range cannot be predicted without the key. The SSE2 path
+processes two accumulators per instruction and gives the same hash as the portable path.
+================================================================================================+*/
+
+#include "hash.hpp"
+
+// SSE2 is part of x64, and its registers can be used by the kernel without being saved. The portable
+// path can be forced with MPP_HASH_PORTABLE, to check that both give the same hash.
+#if (defined(_M_X64) || defined(_M_AMD64) || defined(__SSE2__)) && !defined(MPP_HASH_PORTABLE)
+#define MPP_HASH_SSE2
+#include <emmintrin.h>
+#endif // _M_X64
+
+
+/// @brief Helpers of the hash.
+namespace MppHash {
+
+	constexpr ULONG   NumberOfLanes   = 0x08;
+	constexpr SIZE_T  StripeSize      = NumberOfLanes * sizeof(ULONG64);
+	constexpr ULONG   StripesPerBlock = 0x10;
+	constexpr SIZE_T  BlockSize       = StripeSize * StripesPerBlock;
+
+	constexpr ULONG64 Prime32         = 0x000000009E3779B1ULL;
+	constexpr ULONG64 Prime64First    = 0x9E3779B185EBCA87ULL;
+	constexpr ULONG64 Prime64Second   = 0xC2B2AE3D27D4EB4FULL;
+	constexpr ULONG64 Prime64Third    = 0x165667B19E3779F9ULL;
+
+	static_assert(StripesPerBlock + NumberOfLanes <= KeyLength, "Key too short for a block");
+
+	/// @brief Read a 64-bit value, whatever its alignment. All targets are little-endian.
+	static _inline ULONG64 Read64(
+		_In_ CONST UCHAR* Buffer
+	) {
+		ULONG64 Value = 0x00;
+		memcpy(&Value, Buffer, sizeof(ULONG64));
+		return Value;
+	}
+
+	/// @brief Spread the bits of a value over all the bits.
+	static _inline ULONG64 Avalanche(
+		_In_ ULONG64 Value
+	) {
+		Value ^= Value >> 0x21;
+		Value *= Prime64Second;
+		Value ^= Value >> 0x1D;
+		Value *= Prime64Third;
+		Value ^= Value >> 0x20;
+		return Value;
+	}
+
+#if defined(MPP_HASH_SSE2)
+	/// @brief Accumulate stripes, then scramble the accumulators if the block is complete.
+	static VOID AccumulateBlock(
+		_Inout_ ULONG64*       Accumulators,
+		_In_    CONST UCHAR*   Data,
+		_In_    ULONG          NumberOfStripes,
+		_In_    CONST ULONG64* Secret
+	) {
+		__m128i Lanes[NumberOfLanes / 0x02];
+		for (ULONG cx = 0x00; cx < (NumberOfLanes / 0x02); cx++)
+			Lanes[cx] = _mm_loadu_si128((CONST __m128i*)(Accumulators + (cx * 0x02)));
+
+		for (ULONG sx = 0x00; sx < NumberOfStripes; sx++) {
+			CONST UCHAR*   Stripe = Data + (sx * StripeSize);
+			CONST ULONG64* Key    = Secret + sx;
+
+			for (ULONG cx = 0x00; cx < (NumberOfLanes / 0x02); cx++) {
+				__m128i Value   = _mm_loadu_si128((CONST __m128i*)(Stripe + (cx * 0x10)));
+				__m128i Keyed   = _mm_xor_si128(Value, _mm_loadu_si128((CONST __m128i*)(Key + (cx * 0x02))));
+				__m128i Product = _mm_mul_epu32(Keyed, _mm_shuffle_epi32(Keyed, _MM_SHUFFLE(0, 3, 0, 1)));
+				__m128i Swapped = _mm_shuffle_epi32(Value, _MM_SHUFFLE(1, 0, 3, 2));
+				Lanes[cx] = _mm_add_epi64(Lanes[cx], _mm_add_epi64(Product, Swapped));
+			}
+		}
+
+		if (NumberOfStripes == StripesPerBlock) {
+			CONST ULONG64* Key   = Secret + (KeyLength - NumberOfLanes);
+			__m128i        Prime = _mm_set1_epi32((int)Prime32);
+
+			for (ULONG cx = 0x00; cx < (NumberOfLanes / 0x02); cx++) {
+				__m128i Value = _mm_xor_si128(Lanes[cx], _mm_srli_epi64(Lanes[cx], 0x2F));
+				Value = _mm_xor_si128(Value, _mm_loadu_si128((CONST __m128i*)(Key + (cx * 0x02))));
+
+				__m128i Low  = _mm_mul_epu32(Value, Prime);
+				__m128i High = _mm_mul_epu32(_mm_srli_epi64(Value, 0x20), Prime);
+				Lanes[cx] = _mm_add_epi64(Low, _mm_slli_epi64(High, 0x20));
+			}
+		}
+
+		for (ULONG cx = 0x00; cx < (NumberOfLanes / 0x02); cx++)
+			_mm_storeu_si128((__m128i*)(Accumulators + (cx * 0x02)), Lanes[cx]);
+	}
+#else
+	/// @brief Accumulate stripes, then scramble the accumulators if the block is complete.
+	static VOID AccumulateBlock(
+		_Inout_ ULONG64*       Accumulators,
+		_In_    CONST UCHAR*   Data,
+		_In_    ULONG          NumberOfStripes,
+		_In_    CONST ULONG64* Secret
+	) {
+		for (ULONG sx = 0x00; sx < NumberOfStripes; sx++) {
+			CONST UCHAR*   Stripe = Data + (sx * StripeSize);
+			CONST ULONG64* Key    = Secret + sx;
+
+			for (ULONG cx = 0x00; cx < NumberOfLanes; cx++) {
+				ULONG64 Value = Read64(Stripe + (cx * sizeof(ULONG64)));
+				ULONG64 Keyed = Value ^ Key[cx];
+				Accumulators[cx ^ 0x01] += Value;
+				Accumulators[cx]        += (Keyed & 0xFFFFFFFF) * (Keyed >> 0x20);
+			}
+		}
+
+		if (NumberOfStripes == StripesPerBlock) {
+			CONST ULONG64* Key = Secret + (KeyLength - NumberOfLanes);
+			for (ULONG cx = 0x00; cx < NumberOfLanes; cx++) {
+				ULONG64 Value = Accumulators[cx] ^ (Accumulators[cx] >> 0x2F);
+				Accumulators[cx] = (Value ^ Key[cx]) * Prime32;
+			}
+		}
+	}
+#endif // MPP_HASH_SSE2
+}
+
+
+_Use_decl_annotations_
+VOID MppHash::InitialiseKey(
+	_Out_ MPP_HASH_KEY* Key,
+	_In_  ULONG64       Seed
+) {
+	// SplitMix64 sequence of the seed
+	for (ULONG cx = 0x00; cx < KeyLength; cx++) {
+		Seed += Prime64First;
+		ULONG64 Value = Seed;
+		Value = (Value ^ (Value >> 0x1E)) * 0xBF58476D1CE4E5B9ULL;
+		Value = (Value ^ (Value >> 0x1B)) * 0x94D049BB133111EBULL;
+		Key->Secret[cx] = Value ^ (Value >> 0x1F);
+	}
+}
+
+
+_Use_decl_annotations_
+ULONG64 MppHash::Compute(
+	_In_                    CONST MPP_HASH_KEY* Key,
+	_In_reads_bytes_(Size)  CONST VOID*         Buffer,
+	_In_                    SIZE_T              Size
+) {
+	ULONG64 Accumulators[NumberOfLanes] = {
+		Prime32,       Prime64First, Prime64Second, Prime64Third,
+		Prime64First,  Prime32,      Prime64Third,  Prime64Second
+	};
+	CONST UCHAR* Data      = (CONST UCHAR*)Buffer;
+	SIZE_T       Remaining = Size;
+
+	// Complete blocks
+	for (; Remaining >= BlockSize; Remaining -= BlockSize, Data += BlockSize)
+		AccumulateBlock(Accumulators, Data, StripesPerBlock, Key->Secret);
+
+	// Complete stripes of the last block
+	ULONG NumberOfStripes = (ULONG)(Remaining / StripeSize);
+	AccumulateBlock(Accumulators, Data, NumberOfStripes, Key->Secret);
+	Data      += NumberOfStripes * StripeSize;
+	Remaining -= NumberOfStripes * StripeSize;
+
+	// Last stripe, padded with zeros, the size being hashed in
+	if (Remaining != 0x00) {
+		UCHAR Stripe[StripeSize] = { 0x00 };
+		memcpy(Stripe, Data, Remaining);
+		AccumulateBlock(Accumulators, Stripe, 0x01, Key->Secret + NumberOfLanes - 0x01);
+	}
+
+	// Merge the accumulators
+	ULONG64 Result = (ULONG64)Size * Prime64First;
+	for (ULONG cx = 0x00; cx < NumberOfLanes; cx++) {
+		Result ^= Avalanche(Accumulators[cx] ^ Key->Secret[cx + NumberOfLanes]);
+		Result  = ((Result << 0x1B) | (Result >> 0x25)) * Prime64First + Prime64Third;
+	}
+	return Avalanche(Result);
+}
@@ -0,0 +1,52 @@
+/*+================================================================================================
+Module Name: hash.hpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+Abstract:
+Memory Patching Protection (MPP) keyed hash of the protected ranges.
+The buffer is consumed by stripes of 64 bytes into eight 64-bit accumulators, each mixing its data
+with a secret key, so that the hash of a range cannot be predicted without the key. The SSE2 path
+processes two accumulators per instruction and gives the same hash as the portable path.
+================================================================================================+*/
+
+#ifndef __MPP_HASH_H_GUARD__
+#define __MPP_HASH_H_GUARD__
+
+#include "portable.hpp"
+
+
+/// @brief Keyed hash of the protected ranges.
+namespace MppHash {
+
+	/// @brief Number of 64-bit words of the secret key, the stripes of a block start at each of the
+	/// first 16 words.
+	constexpr ULONG KeyLength = 0x18;
+
+	/// @brief Secret key of the hash.
+	typedef struct _MPP_HASH_KEY {
+		ULONG64 Secret[KeyLength];
+	} MPP_HASH_KEY, * PMPP_HASH_KEY;
+
+	/// @brief Derive a secret key from a seed.
+	/// @param Key  Receives the key.
+	/// @param Seed Random seed.
+	VOID InitialiseKey(
+		_Out_ MPP_HASH_KEY* Key,
+		_In_  ULONG64       Seed
+	);
+
+	/// @brief Hash a buffer.
+	/// @param Key    Secret key.
+	/// @param Buffer Buffer to hash, not necessarily aligned.
+	/// @param Size   Size of the buffer, in bytes.
+	/// @return Hash of the buffer.
+	ULONG64 Compute(
+		_In_                    CONST MPP_HASH_KEY* Key,
+		_In_reads_bytes_(Size)  CONST VOID*         Buffer,
+		_In_                    SIZE_T              Size
+	);
+}
+
+#endif // !__MPP_HASH_H_GUARD__
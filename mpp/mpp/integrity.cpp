@@ -0,0 +1,587 @@
+/*+================================================================================================
+Module Name: integrity.cpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+Abstract:
+Memory Patching Protection (MPP) integrity of the protected ranges.
+When an image is protected, each of its ranges is hashed in memory and compared against the same
+range rebuilt from the image file and relocated, to detect patches applied before the protection.
+The baselines are kept for the most recent ranges and verified again on demand. Any image, of a
+process or of the kernel, can also be compared byte by byte with its file to locate its patches.
+================================================================================================+*/
+
+#include "integrity.hpp"
+
+
+namespace MppIntegrity {
+
+	/// @brief Secret key of the hashes.
+	MppHash::MPP_HASH_KEY HashKey{};
+
+	/// @brief Mutex protecting the records.
+	FAST_MUTEX RecordsLock{};
+
+	/// @brief Baselines of the most recent ranges.
+	MPP_INTEGRITY_RECORD Records[NumberOfRecords]{};
+
+	/// @brief Next record to replace.
+	ULONG NextRecord = 0x00;
+
+	/// @brief Information class returning the name of the file a view has been mapped from.
+	constexpr MEMORY_INFORMATION_CLASS MemoryMappedFileName = (MEMORY_INFORMATION_CLASS)0x02;
+
+	/// @brief Largest file name returned, in characters.
+	constexpr USHORT MaximumFileName = 0x400;
+}
+
+
+_Use_decl_annotations_
+VOID __declspec(code_seg("PAGE"))
+MppIntegrity::Initialise() {
+	// Ensure current IRQL allow paging.
+	PAGED_CODE();
+
+	// The key only has to be unknown to user mode
+	LARGE_INTEGER Counter = ::KeQueryPerformanceCounter(nullptr);
+	ULONG         Seed    = Counter.LowPart ^ (ULONG)::KeQueryInterruptTime();
+	ULONG64       Random  = ((ULONG64)::RtlRandomEx(&Seed) << 0x20) | ::RtlRandomEx(&Seed);
+	MppHash::InitialiseKey(&HashKey, Random ^ ReadTimeStampCounter());
+
+	::ExInitializeFastMutex(&RecordsLock);
+	RtlZeroMemory(Records, sizeof(Records));
+	NextRecord = 0x00;
+}
+
+
+_Use_decl_annotations_
+VOID __declspec(code_seg("PAGE"))
+MppIntegrity::RecordImage(
+	_In_     PEPROCESS                            Process,
+	_In_     PUCHAR                               ImageBase,
+	_In_opt_ PFILE_OBJECT                         ImageFile,
+	_In_     CONST MppCache::MPP_CACHE_KEY*       Key,
+	_In_     CONST MppSections::MPP_SECTION_PLAN* Plan
+) {
+	// Ensure current IRQL allow paging.
+	PAGED_CODE();
+
+	PUCHAR File     = nullptr;
+	SIZE_T FileSize = 0x00;
+	PUCHAR Mapped   = nullptr;
+	SIZE_T Capacity = 0x00;
+
+	for (ULONG cx = 0x00; cx < Plan->NumberOfRanges; cx++) {
+		CONST MppSections::MPP_SECTION_RANGE* Range = &Plan->Ranges[cx];
+		SIZE_T Size = Range->End - Range->Start;
+
+		MPP_INTEGRITY_RECORD Record = { 0x00 };
+		Record.ProcessId  = ::PsGetProcessId(Process);
+		Record.CreateTime = ::PsGetProcessCreateTimeQuadPart(Process);
+		Record.ImageBase  = ImageBase;
+		Record.Key        = *Key;
+		Record.Range      = *Range;
+
+		// Hash of the range as currently mapped
+		ULONG64 Memory   = 0x00;
+		BOOLEAN Readable = HashRange(ImageBase + Range->Start, Size, &Memory);
+
+		// Baseline from the file, already computed if the image is mapped at the same address elsewhere
+		::ExAcquireFastMutex(&RecordsLock);
+		for (ULONG dx = 0x00; dx < NumberOfRecords; dx++) {
+			CONST MPP_INTEGRITY_RECORD* Other = &Records[dx];
+			if (Other->CreateTime != 0x00
+				&& Other->FromFile
+				&& Other->ImageBase == ImageBase
+				&& Other->Range.Start == Range->Start
+				&& Other->Range.End == Range->End
+				&& Other->Key.Section == Key->Section
+				&& Other->Key.TimeDateStamp == Key->TimeDateStamp
+				&& Other->Key.SizeOfImage == Key->SizeOfImage) {
+				Record.Baseline = Other->Baseline;
+				Record.FromFile = TRUE;
+				break;
+			}
+		}
+		::ExReleaseFastMutex(&RecordsLock);
+
+		// Otherwise rebuild the range from the file, read once for all the ranges
+		if (!Record.FromFile && ImageFile != nullptr) {
+			if (File == nullptr && NT_ERROR(ReadImageFile(ImageFile, &File, &FileSize)))
+				ImageFile = nullptr;
+
+			if (File != nullptr && Capacity < Size) {
+				if (Mapped != nullptr)
+					MppMemory::MemFree(Mapped);
+				Mapped   = MppMemory::MemAlloc<PUCHAR>(Size);
+				Capacity = Mapped != nullptr ? Size : 0x00;
+			}
+
+			if (Mapped != nullptr && MppSections::MapFileRange(File, FileSize, (ULONG64)ImageBase, Range, Mapped)) {
+				Record.Baseline = MppHash::Compute(&HashKey, Mapped, Size);
+				Record.FromFile = TRUE;
+			}
+		}
+
+		// Patched before being protected
+		if (Record.FromFile && Readable && Record.Baseline != Memory) {
+			MppLogger::Trace<MppEvents::EventRangeDiffers>(ImageBase + Range->Start);
+		}
+		if (!Record.FromFile) {
+			if (!Readable)
+				continue;
+			Record.Baseline = Memory;
+		}
+
+		// Replace the oldest record
+		::ExAcquireFastMutex(&RecordsLock);
+		Records[NextRecord] = Record;
+		NextRecord = (NextRecord + 1) % NumberOfRecords;
+		::ExReleaseFastMutex(&RecordsLock);
+	}
+
+	// Cleanup
+	if (Mapped != nullptr)
+		MppMemory::MemFree(Mapped);
+	if (File != nullptr)
+		MppMemory::MemFree(File);
+}
+
+
+_Use_decl_annotations_
+NTSTATUS __declspec(code_seg("PAGE"))
+MppIntegrity::Verify(
+	_Out_ MppIoctl::MPP_INTEGRITY_RESULT* Result
+) {
+	// Ensure current IRQL allow paging.
+	PAGED_CODE();
+	RtlZeroMemory(Result, sizeof(MppIoctl::MPP_INTEGRITY_RESULT));
+
+	// Snapshot of the records, the ranges are hashed without the lock
+	auto Snapshot = MppMemory::MemAlloc<PMPP_INTEGRITY_RECORD>(sizeof(Records));
+	if (Snapshot == nullptr)
+		return STATUS_NO_MEMORY;
+
+	::ExAcquireFastMutex(&RecordsLock);
+	RtlCopyMemory(Snapshot, Records, sizeof(Records));
+	::ExReleaseFastMutex(&RecordsLock);
+
+	for (ULONG cx = 0x00; cx < NumberOfRecords; cx++) {
+		CONST MPP_INTEGRITY_RECORD* Record = &Snapshot[cx];
+		if (Record->CreateTime == 0x00)
+			continue;
+		Result->NumberOfRanges++;
+
+		// Same process, not another one with a recycled identifier
+		PEPROCESS Process = nullptr;
+		if (!NT_SUCCESS(::PsLookupProcessByProcessId(Record->ProcessId, &Process))) {
+			Result->Unavailable++;
+			continue;
+		}
+		if (::PsGetProcessCreateTimeQuadPart(Process) != Record->CreateTime) {
+			::ObDereferenceObject(Process);
+			Result->Unavailable++;
+			continue;
+		}
+
+		// Hash the range again
+		KAPC_STATE ApcState = { 0x00 };
+		ULONG64    Hash     = 0x00;
+		::KeStackAttachProcess(Process, &ApcState);
+		BOOLEAN Readable = HashRange(
+			Record->ImageBase + Record->Range.Start,
+			Record->Range.End - Record->Range.Start,
+			&Hash
+		);
+		::KeUnstackDetachProcess(&ApcState);
+		::ObDereferenceObject(Process);
+
+		if (!Readable) {
+			Result->Unavailable++;
+		}
+		else if (Hash == Record->Baseline) {
+			Result->Intact++;
+		}
+		else {
+			Result->Modified++;
+			MppLogger::Trace<MppEvents::EventRangeModified>(
+				Record->ImageBase + Record->Range.Start,
+				Record->ProcessId
+			);
+		}
+	}
+
+	MppMemory::MemFree(Snapshot);
+	return STATUS_SUCCESS;
+}
+
+
+_Use_decl_annotations_
+NTSTATUS __declspec(code_seg("PAGE"))
+MppIntegrity::DiffImage(
+	_In_  CONST MppIoctl::MPP_DIFF_IMAGE* Request,
+	_Out_ MppIoctl::MPP_DIFF_RESULT*      Result,
+	_In_  ULONG                           MaximumEntries
+) {
+	// Ensure current IRQL allow paging.
+	PAGED_CODE();
+
+	PUCHAR ImageBase = (PUCHAR)Request->ImageBase;
+	RtlZeroMemory(Result, FIELD_OFFSET(MppIoctl::MPP_DIFF_RESULT, Entries));
+
+	// Image of a process, or of the kernel
+	PEPROCESS Process = nullptr;
+	if (Request->ProcessId != 0x00) {
+		if ((PVOID)ImageBase > MM_HIGHEST_USER_ADDRESS)
+			return STATUS_INVALID_PARAMETER;
+
+		NTSTATUS Status = ::PsLookupProcessByProcessId((HANDLE)(ULONG_PTR)Request->ProcessId, &Process);
+		if (NT_ERROR(Status))
+			return Status;
+	}
+	else if ((PVOID)ImageBase < MmSystemRangeStart) {
+		return STATUS_INVALID_PARAMETER;
+	}
+
+	// Content of the file the image has been mapped from
+	PUNICODE_STRING Name     = nullptr;
+	PUCHAR          File     = nullptr;
+	SIZE_T          FileSize = 0x00;
+	NTSTATUS        Status   = GetImageFileName(Process, ImageBase, &Name);
+	if (NT_SUCCESS(Status)) {
+		HANDLE            FileHandle = nullptr;
+		IO_STATUS_BLOCK   IoStatus   = { 0x00 };
+		OBJECT_ATTRIBUTES Attributes = { 0x00 };
+		InitializeObjectAttributes(&Attributes, Name, OBJ_KERNEL_HANDLE | OBJ_CASE_INSENSITIVE, nullptr, nullptr);
+
+		Status = ::ZwCreateFile(
+			&FileHandle,
+			FILE_READ_DATA | SYNCHRONIZE,
+			&Attributes,
+			&IoStatus,
+			nullptr,
+			FILE_ATTRIBUTE_NORMAL,
+			FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+			FILE_OPEN,
+			FILE_NON_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT,
+			nullptr,
+			0x00
+		);
+		if (NT_SUCCESS(Status)) {
+			Status = ReadImageHandle(FileHandle, &File, &FileSize);
+			::ZwClose(FileHandle);
+		}
+		else {
+			MppLogger::TraceName<MppEvents::EventNameOpenFailed>(Name, Status);
+		}
+		MppMemory::MemFree(Name);
+	}
+	if (NT_ERROR(Status)) {
+		if (Process != nullptr)
+			::ObDereferenceObject(Process);
+		return Status;
+	}
+
+	// Same ranges as the ones protected, planned from the headers of the file
+	MppSections::MPP_SECTION_PLAN Plan = { 0x00 };
+	if (!MppSections::Plan(File, FileSize, &Plan)) {
+		MppMemory::MemFree(File);
+		if (Process != nullptr)
+			::ObDereferenceObject(Process);
+		return STATUS_INVALID_IMAGE_FORMAT;
+	}
+
+	SIZE_T Capacity = 0x00;
+	for (ULONG cx = 0x00; cx < Plan.NumberOfRanges; cx++) {
+		if ((SIZE_T)(Plan.Ranges[cx].End - Plan.Ranges[cx].Start) > Capacity)
+			Capacity = Plan.Ranges[cx].End - Plan.Ranges[cx].Start;
+	}
+	PUCHAR Expected = Capacity != 0x00 ? MppMemory::MemAlloc<PUCHAR>(Capacity) : nullptr;
+	PUCHAR Actual   = Capacity != 0x00 ? MppMemory::MemAlloc<PUCHAR>(Capacity) : nullptr;
+	if (Capacity != 0x00 && (Expected == nullptr || Actual == nullptr))
+		Status = STATUS_NO_MEMORY;
+
+	// Rebuild each range for the address the image is loaded at, and compare it with memory
+	KAPC_STATE ApcState = { 0x00 };
+	if (Process != nullptr)
+		::KeStackAttachProcess(Process, &ApcState);
+
+	for (ULONG cx = 0x00; NT_SUCCESS(Status) && cx < Plan.NumberOfRanges; cx++) {
+		CONST MppSections::MPP_SECTION_RANGE* Range = &Plan.Ranges[cx];
+		SIZE_T Size = Range->End - Range->Start;
+
+		if (!MppSections::MapFileRange(File, FileSize, (ULONG64)ImageBase, Range, Expected)) {
+			Status = STATUS_INVALID_IMAGE_FORMAT;
+			break;
+		}
+		Result->UnreadablePages += CopyRange(ImageBase + Range->Start, Size, Actual, Expected);
+
+		ULONG Filled = 0x00;
+		Result->NumberOfDifferences += MppDiff::Compare(
+			Expected,
+			Actual,
+			Size,
+			Range->Start,
+			&Result->Entries[Result->NumberOfEntries],
+			MaximumEntries - Result->NumberOfEntries,
+			&Filled
+		);
+		Result->NumberOfEntries += Filled;
+		Result->NumberOfRanges++;
+	}
+
+	if (Process != nullptr) {
+		::KeUnstackDetachProcess(&ApcState);
+		::ObDereferenceObject(Process);
+	}
+
+	// Cleanup
+	if (Actual != nullptr)
+		MppMemory::MemFree(Actual);
+	if (Expected != nullptr)
+		MppMemory::MemFree(Expected);
+	MppMemory::MemFree(File);
+	return Status;
+}
+
+
+_Use_decl_annotations_
+ULONG __declspec(code_seg("PAGE"))
+MppIntegrity::CopyRange(
+	_In_                     PUCHAR       Address,
+	_In_                     SIZE_T       Size,
+	_Out_writes_bytes_(Size) PUCHAR       Buffer,
+	_In_reads_bytes_(Size)   CONST UCHAR* Expected
+) {
+	// Ensure current IRQL allow paging.
+	PAGED_CODE();
+
+	ULONG Unreadable = 0x00;
+	for (SIZE_T Offset = 0x00; Offset < Size; Offset += MppSections::PageSize) {
+		SIZE_T  Length = (Size - Offset) < MppSections::PageSize ? (Size - Offset) : MppSections::PageSize;
+		BOOLEAN Copied = FALSE;
+
+		if ((PVOID)Address >= MmSystemRangeStart) {
+			// Kernel memory, whose discarded pages cannot be touched without a bug check
+			MM_COPY_ADDRESS Source      = { 0x00 };
+			SIZE_T          BytesCopied = 0x00;
+			Source.VirtualAddress = Address + Offset;
+			Copied = NT_SUCCESS(::MmCopyMemory(Buffer + Offset, Source, Length, MM_COPY_MEMORY_VIRTUAL, &BytesCopied))
+				&& BytesCopied == Length;
+		}
+		else {
+			// User mode memory, which can be unmapped at any time
+			__try {
+				::ProbeForRead(Address + Offset, Length, sizeof(UCHAR));
+				RtlCopyMemory(Buffer + Offset, Address + Offset, Length);
+				Copied = TRUE;
+			}
+			__except (EXCEPTION_EXECUTE_HANDLER) {
+				Copied = FALSE;
+			}
+		}
+
+		// Pages that cannot be read are not reported as different
+		if (!Copied) {
+			RtlCopyMemory(Buffer + Offset, Expected + Offset, Length);
+			Unreadable++;
+		}
+	}
+	return Unreadable;
+}
+
+
+_Use_decl_annotations_
+BOOLEAN __declspec(code_seg("PAGE"))
+MppIntegrity::HashRange(
+	_In_  PUCHAR   Address,
+	_In_  SIZE_T   Size,
+	_Out_ ULONG64* Hash
+) {
+	*Hash = 0x00;
+
+	// User mode memory, which can be unmapped at any time
+	__try {
+		::ProbeForRead(Address, Size, sizeof(UCHAR));
+		*Hash = MppHash::Compute(&HashKey, Address, Size);
+	}
+	__except (EXCEPTION_EXECUTE_HANDLER) {
+		return FALSE;
+	}
+	return TRUE;
+}
+
+
+_Use_decl_annotations_
+NTSTATUS __declspec(code_seg("PAGE"))
+MppIntegrity::ReadImageFile(
+	_In_  PFILE_OBJECT ImageFile,
+	_Out_ PUCHAR*      Buffer,
+	_Out_ SIZE_T*      Size
+) {
+	// Ensure current IRQL allow paging.
+	PAGED_CODE();
+
+	*Buffer = nullptr;
+	*Size   = 0x00;
+
+	// Kernel handle to the file object the image has been mapped from
+	HANDLE   FileHandle = nullptr;
+	NTSTATUS Status     = ::ObOpenObjectByPointer(
+		ImageFile,
+		OBJ_KERNEL_HANDLE,
+		nullptr,
+		FILE_READ_DATA,
+		*IoFileObjectType,
+		KernelMode,
+		&FileHandle
+	);
+	if (NT_ERROR(Status)) {
+		MppLogger::Trace<MppEvents::EventFileOpenFailed>(Status);
+		return Status;
+	}
+
+	Status = ReadImageHandle(FileHandle, Buffer, Size);
+	::ZwClose(FileHandle);
+	return Status;
+}
+
+
+_Use_decl_annotations_
+NTSTATUS __declspec(code_seg("PAGE"))
+MppIntegrity::ReadImageHandle(
+	_In_  HANDLE  FileHandle,
+	_Out_ PUCHAR* Buffer,
+	_Out_ SIZE_T* Size
+) {
+	// Ensure current IRQL allow paging.
+	PAGED_CODE();
+
+	*Buffer = nullptr;
+	*Size   = 0x00;
+
+	// Size of the file
+	IO_STATUS_BLOCK           IoStatus     = { 0x00 };
+	FILE_STANDARD_INFORMATION StandardInfo = { 0x00 };
+	NTSTATUS                  Status       = ::ZwQueryInformationFile(
+		FileHandle,
+		&IoStatus,
+		&StandardInfo,
+		sizeof(FILE_STANDARD_INFORMATION),
+		FileStandardInformation
+	);
+	if (NT_ERROR(Status) || StandardInfo.EndOfFile.QuadPart <= 0x00
+		|| StandardInfo.EndOfFile.QuadPart > (LONGLONG)MaximumFileSize) {
+		return NT_ERROR(Status) ? Status : STATUS_FILE_TOO_LARGE;
+	}
+
+	// Content of the file
+	SIZE_T FileSize = (SIZE_T)StandardInfo.EndOfFile.QuadPart;
+	auto   Content  = MppMemory::MemAlloc<PUCHAR>(FileSize);
+	if (Content == nullptr)
+		return STATUS_NO_MEMORY;
+
+	LARGE_INTEGER Offset = { 0x00 };
+	Status = ::ZwReadFile(
+		FileHandle,
+		nullptr,
+		nullptr,
+		nullptr,
+		&IoStatus,
+		Content,
+		(ULONG)FileSize,
+		&Offset,
+		nullptr
+	);
+	if (Status == STATUS_PENDING) {
+		::ZwWaitForSingleObject(FileHandle, FALSE, nullptr);
+		Status = IoStatus.Status;
+	}
+
+	if (NT_ERROR(Status) || IoStatus.Information != FileSize) {
+		MppLogger::Trace<MppEvents::EventFileReadFailed>(Status);
+		MppMemory::MemFree(Content);
+		return NT_ERROR(Status) ? Status : STATUS_END_OF_FILE;
+	}
+
+	*Buffer = Content;
+	*Size   = FileSize;
+	return STATUS_SUCCESS;
+}
+
+
+_Use_decl_annotations_
+NTSTATUS __declspec(code_seg("PAGE"))
+MppIntegrity::GetImageFileName(
+	_In_opt_ PEPROCESS        Process,
+	_In_     PUCHAR           ImageBase,
+	_Out_    PUNICODE_STRING* Name
+) {
+	// Ensure current IRQL allow paging.
+	PAGED_CODE();
+
+	*Name = nullptr;
+	SIZE_T BufferSize = sizeof(UNICODE_STRING) + (MaximumFileName * sizeof(WCHAR));
+	auto   FileName   = MppMemory::MemAlloc<PUNICODE_STRING>(BufferSize);
+	if (FileName == nullptr)
+		return STATUS_NO_MEMORY;
+	RtlZeroMemory(FileName, BufferSize);
+
+	NTSTATUS Status = STATUS_NOT_FOUND;
+	if (Process != nullptr) {
+		// Name of the file backing the view of the image
+		KAPC_STATE ApcState     = { 0x00 };
+		SIZE_T     ReturnLength = 0x00;
+		::KeStackAttachProcess(Process, &ApcState);
+		Status = ::ZwQueryVirtualMemory(
+			ZwCurrentProcess(),
+			ImageBase,
+			MemoryMappedFileName,
+			FileName,
+			BufferSize,
+			&ReturnLength
+		);
+		::KeUnstackDetachProcess(&ApcState);
+	}
+	else {
+		// Path of the kernel module loaded at this address
+		::AuxKlibInitialize();
+
+		ULONG BufferLength = 0x00;
+		Status = ::AuxKlibQueryModuleInformation(&BufferLength, sizeof(AUX_MODULE_EXTENDED_INFO), NULL);
+		auto ExtendedInfo = NT_SUCCESS(Status) && BufferLength != 0x00
+			? MppMemory::MemAlloc<PAUX_MODULE_EXTENDED_INFO>(BufferLength)
+			: nullptr;
+		if (ExtendedInfo != nullptr)
+			Status = ::AuxKlibQueryModuleInformation(&BufferLength, sizeof(AUX_MODULE_EXTENDED_INFO), (PVOID)ExtendedInfo);
+		else if (NT_SUCCESS(Status))
+			Status = STATUS_NO_MEMORY;
+
+		for (ULONG cx = 0x00; NT_SUCCESS(Status) && cx < (BufferLength / sizeof(AUX_MODULE_EXTENDED_INFO)); cx++) {
+			if (ExtendedInfo[cx].BasicInfo.ImageBase != (PVOID)ImageBase)
+				continue;
+
+			ANSI_STRING Path = { 0x00 };
+			::RtlInitAnsiString(&Path, (PCSZ)ExtendedInfo[cx].FullPathName);
+			FileName->Buffer        = (PWCH)(FileName + 1);
+			FileName->MaximumLength = MaximumFileName * sizeof(WCHAR);
+			Status = ::RtlAnsiStringToUnicodeString(FileName, &Path, FALSE);
+			break;
+		}
+		if (NT_SUCCESS(Status) && FileName->Buffer == nullptr)
+			Status = STATUS_NOT_FOUND;
+
+		if (ExtendedInfo != nullptr)
+			MppMemory::MemFree(ExtendedInfo);
+	}
+
+	if (NT_ERROR(Status)) {
+		MppLogger::Trace<MppEvents::EventFileNameFailed>(ImageBase, Status);
+		MppMemory::MemFree(FileName);
+		return Status;
+	}
+
+	*Name = FileName;
+	return STATUS_SUCCESS;
+}
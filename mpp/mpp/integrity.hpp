@@ -0,0 +1,172 @@
+/*+================================================================================================
+Module Name: integrity.hpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+Abstract:
+Memory Patching Protection (MPP) integrity of the protected ranges.
+When an image is protected, each of its ranges is hashed in memory and compared against the same
+range rebuilt from the image file and relocated, to detect patches applied before the protection.
+The baselines are kept for the most recent ranges and verified again on demand. Any image, of a
+process or of the kernel, can also be compared byte by byte with its file to locate its patches.
+================================================================================================+*/
+
+#ifndef __MPP_INTEGRITY_H_GUARD__
+#define __MPP_INTEGRITY_H_GUARD__
+
+#include "mpp.hpp"
+#include "cache.hpp"
+#include "diff.hpp"
+#include "hash.hpp"
+#include "sections.hpp"
+
+/// @brief Integrity of the protected ranges.
+namespace MppIntegrity {
+
+	/// @brief Number of ranges whose baseline is kept, the oldest being replaced.
+	constexpr ULONG NumberOfRecords = 0x100;
+
+	/// @brief Largest image file rebuilt, in bytes.
+	constexpr SIZE_T MaximumFileSize = 0x4000000;
+
+	/// @brief Baseline of a protected range.
+	typedef struct _MPP_INTEGRITY_RECORD {
+		HANDLE                         ProcessId;
+		LONGLONG                       CreateTime; // Of the process, 0 if the record is free
+		PUCHAR                         ImageBase;
+		MppCache::MPP_CACHE_KEY        Key;        // Identity of the image
+		MppSections::MPP_SECTION_RANGE Range;
+		ULONG64                        Baseline;   // Hash of the range
+		BOOLEAN                        FromFile;   // Baseline rebuilt from the file, else hashed when protected
+	} MPP_INTEGRITY_RECORD, * PMPP_INTEGRITY_RECORD;
+
+	/// @brief Secret key of the hashes.
+	extern MppHash::MPP_HASH_KEY HashKey;
+
+	/// @brief Mutex protecting the records.
+	extern FAST_MUTEX RecordsLock;
+
+	/// @brief Baselines of the most recent ranges.
+	extern MPP_INTEGRITY_RECORD Records[NumberOfRecords];
+
+	/// @brief Next record to replace.
+	extern ULONG NextRecord;
+
+	/// @brief Initialise the key and the records.
+	VOID __declspec(code_seg("PAGE"))
+	_IRQL_requires_max_(PASSIVE_LEVEL)
+	Initialise();
+
+	/// @brief Hash the ranges of an image mapped in the current process and keep their baseline.
+	/// @param Process   Process the image is mapped in, attached to.
+	/// @param ImageBase Base address of the image.
+	/// @param ImageFile File of the image, may be nullptr.
+	/// @param Key       Identity of the image.
+	/// @param Plan      Ranges protected.
+	VOID __declspec(code_seg("PAGE"))
+	_IRQL_requires_min_(PASSIVE_LEVEL)
+	_IRQL_requires_max_(PASSIVE_LEVEL)
+	RecordImage(
+		_In_     PEPROCESS                            Process,
+		_In_     PUCHAR                               ImageBase,
+		_In_opt_ PFILE_OBJECT                         ImageFile,
+		_In_     CONST MppCache::MPP_CACHE_KEY*       Key,
+		_In_     CONST MppSections::MPP_SECTION_PLAN* Plan
+	);
+
+	/// @brief Hash again the ranges recorded and compare them against their baseline.
+	/// @param Result Receives the number of ranges per outcome.
+	/// @return STATUS_SUCCESS, or STATUS_NO_MEMORY.
+	NTSTATUS __declspec(code_seg("PAGE"))
+	_IRQL_requires_min_(PASSIVE_LEVEL)
+	_IRQL_requires_max_(PASSIVE_LEVEL)
+	Verify(
+		_Out_ MppIoctl::MPP_INTEGRITY_RESULT* Result
+	);
+
+	/// @brief Compare the executable ranges of an image with the same ranges rebuilt from its file.
+	/// @param Request        Process and base address of the image, the process being 0 for a kernel module.
+	/// @param Result         Receives the differences.
+	/// @param MaximumEntries Number of entries that fit in the result.
+	/// @return STATUS_SUCCESS, or the reason the image could not be compared.
+	NTSTATUS __declspec(code_seg("PAGE"))
+	_IRQL_requires_min_(PASSIVE_LEVEL)
+	_IRQL_requires_max_(PASSIVE_LEVEL)
+	DiffImage(
+		_In_  CONST MppIoctl::MPP_DIFF_IMAGE* Request,
+		_Out_ MppIoctl::MPP_DIFF_RESULT*      Result,
+		_In_  ULONG                           MaximumEntries
+	);
+
+	/// @brief Copy a range of the current process or of the kernel, page by page.
+	/// @param Address  Start of the range, aligned on a page.
+	/// @param Size     Size of the range, in bytes.
+	/// @param Buffer   Receives the content of the range.
+	/// @param Expected Content copied instead of the pages that cannot be read.
+	/// @return Number of pages that cannot be read.
+	ULONG __declspec(code_seg("PAGE"))
+	_IRQL_requires_min_(PASSIVE_LEVEL)
+	_IRQL_requires_max_(APC_LEVEL)
+	CopyRange(
+		_In_                     PUCHAR       Address,
+		_In_                     SIZE_T       Size,
+		_Out_writes_bytes_(Size) PUCHAR       Buffer,
+		_In_reads_bytes_(Size)   CONST UCHAR* Expected
+	);
+
+	/// @brief Hash a range of the current process.
+	/// @param Address Start of the range.
+	/// @param Size    Size of the range, in bytes.
+	/// @param Hash    Receives the hash.
+	/// @return Whether the range is readable.
+	BOOLEAN __declspec(code_seg("PAGE"))
+	_IRQL_requires_min_(PASSIVE_LEVEL)
+	_IRQL_requires_max_(APC_LEVEL)
+	HashRange(
+		_In_  PUCHAR   Address,
+		_In_  SIZE_T   Size,
+		_Out_ ULONG64* Hash
+	);
+
+	/// @brief Read an image file into a buffer to be freed with MppMemory::MemFree.
+	/// @param ImageFile File of the image.
+	/// @param Buffer    Receives the content of the file.
+	/// @param Size      Receives the size of the file.
+	NTSTATUS __declspec(code_seg("PAGE"))
+	_IRQL_requires_min_(PASSIVE_LEVEL)
+	_IRQL_requires_max_(PASSIVE_LEVEL)
+	ReadImageFile(
+		_In_  PFILE_OBJECT ImageFile,
+		_Out_ PUCHAR*      Buffer,
+		_Out_ SIZE_T*      Size
+	);
+
+	/// @brief Read an opened image file into a buffer to be freed with MppMemory::MemFree.
+	/// @param FileHandle Kernel handle to the file.
+	/// @param Buffer     Receives the content of the file.
+	/// @param Size       Receives the size of the file.
+	NTSTATUS __declspec(code_seg("PAGE"))
+	_IRQL_requires_min_(PASSIVE_LEVEL)
+	_IRQL_requires_max_(PASSIVE_LEVEL)
+	ReadImageHandle(
+		_In_  HANDLE  FileHandle,
+		_Out_ PUCHAR* Buffer,
+		_Out_ SIZE_T* Size
+	);
+
+	/// @brief Get the name of the file an image has been mapped from, to be freed with MppMemory::MemFree.
+	/// @param Process   Process the image is mapped in, nullptr for a kernel module.
+	/// @param ImageBase Base address of the image.
+	/// @param Name      Receives the name of the file.
+	NTSTATUS __declspec(code_seg("PAGE"))
+	_IRQL_requires_min_(PASSIVE_LEVEL)
+	_IRQL_requires_max_(PASSIVE_LEVEL)
+	GetImageFileName(
+		_In_opt_ PEPROCESS        Process,
+		_In_     PUCHAR           ImageBase,
+		_Out_    PUNICODE_STRING* Name
+	);
+}
+
+#endif // !__MPP_INTEGRITY_H_GUARD__
@@ -41,6 +41,18 @@ DriverCreateClose(
 	_Inout_ PIRP           Irp
 );
 
+/// @brief The callback routine for IRP_MJ_CLEANUP, unmapping the trace from the process of the handle.
+/// @param DeviceObject Caller-supplied pointer to a DEVICE_OBJECT structure.This is the device object for the target device, previously created by the driver's AddDevice routine.
+/// @param Irp          Caller-supplied pointer to an IRP structure that describes the requested I/O operation.
+/// @return If the routine succeeds, it must return STATUS_SUCCESS. Otherwise, it must return one of the error status values defined in Ntstatus.h.
+EXTERN_C NTSTATUS
+__drv_dispatchType(IRP_MJ_CLEANUP)
+_IRQL_requires_max_(PASSIVE_LEVEL)
+DriverCleanup(
+	_Inout_ PDEVICE_OBJECT DeviceObject,
+	_Inout_ PIRP           Irp
+);
+
 /// @brief The callback routine services various IRPs. In this case handle user-mode IOCTL. For a list of function codes, see mpp.h.
 /// @param DeviceObject Caller-supplied pointer to a DEVICE_OBJECT structure.This is the device object for the target device, previously created by the driver's AddDevice routine.
 /// @param Irp          Caller-supplied pointer to an IRP structure that describes the requested I/O operation.
@@ -58,6 +70,7 @@ DriverDispatch(
 #pragma alloc_text(INIT, DriverEntry)
 #pragma alloc_text(PAGE, DriverUnload)
 #pragma alloc_text(PAGE, DriverCreateClose)
+#pragma alloc_text(PAGE, DriverCleanup)
 #pragma alloc_text(PAGE, DriverDispatch)
 #endif // ALLOC_PRAGMA
 
@@ -85,6 +98,20 @@ EXTERN_C NTSTATUS DriverEntry(
 	// Local stack variables
 	NTSTATUS       Status       = STATUS_SUCCESS;
 	PDEVICE_OBJECT DeviceObject = nullptr;
+
+	// State of the protect worker, before the image loading callback is registered
+	MppQueue::Initialise(&MppWorker::ProtectQueue);
+	::ExInitializeRundownProtection(&MppWorker::ProtectRundown);
+	MppCache::Initialise(&MppWorker::PlanCache);
+	MppStats::Initialise(&MppGlobals::Statistics);
+	MppIntegrity::Initialise();
+
+	// Binary trace of the events, the driver works without it
+	Status = MppTracing::Initialise();
+	if (NT_ERROR(Status)) {
+		MppLogger::Error("Failed to allocate the trace (0x%08X).\r\n", Status);
+		Status = STATUS_SUCCESS;
+	}
 	
 	// Register device driver and callbacks
 	do {
@@ -127,6 +154,7 @@ EXTERN_C NTSTATUS DriverEntry(
 
 		MppWorker::ProtectWorker = ::IoAllocateWorkItem(DeviceObject);
 		if (MppWorker::ProtectWorker == nullptr) {
+			Status = STATUS_INSUFFICIENT_RESOURCES;
 			MppLogger::Error("Failed to allocate work item (0x%08X).\r\n", Status);
 			break;
 		}
@@ -138,14 +166,19 @@ EXTERN_C NTSTATUS DriverEntry(
 		MppLogger::Info("=================================================================\r\n");
 		MppLogger::Info("Rolling back operations ...\r\n");
 
-		if (MppWorker::ProtectWorker != nullptr)
-			::IoFreeWorkItem(MppWorker::ProtectWorker);
-
 		if (MppCallbacks::LoadImage == TRUE)
 			::PsRemoveLoadImageNotifyRoutine(MppCallbacks::LoadImageNotify);
+		MppCallbacks::LoadImage = FALSE;
+
+		// Requests queued before the work item could be allocated
+		MppWorker::Rundown();
+		if (MppWorker::ProtectWorker != nullptr)
+			::IoFreeWorkItem(MppWorker::ProtectWorker);
+		MppWorker::ProtectWorker = nullptr;
 
 		::IoDeleteSymbolicLink(&MppGlobals::SymlinkName);
 		::IoDeleteDevice(DeviceObject);
+		MppTracing::Free();
 		MppLogger::Info("=================================================================\r\n");
 		return Status;
 	}
@@ -154,12 +187,16 @@ EXTERN_C NTSTATUS DriverEntry(
 	DriverObject->DriverUnload = DriverUnload;
 	DriverObject->MajorFunction[IRP_MJ_CLOSE]          = DriverCreateClose;
 	DriverObject->MajorFunction[IRP_MJ_CREATE]         = DriverCreateClose;
+	DriverObject->MajorFunction[IRP_MJ_CLEANUP]        = DriverCleanup;
 	DriverObject->MajorFunction[IRP_MJ_DEVICE_CONTROL] = DriverDispatch;
 
 	// Set the IOCTL handler
 
 	// Initialise additional data
-	::KeInitializeSpinLock(&MppCallbackData::ImageNamesLock);
+	::ExInitializeFastMutex(&MppCallbackData::ImageNamesLock);
+	MppRcu::Initialise(&MppCallbackData::ImageNames, nullptr);
+	::ExInitializeFastMutex(&MppCallbackData::PolicyLock);
+	MppRcu::Initialise(&MppCallbackData::Policy, nullptr);
 	::InitializeListHead(&MppCallbackData::HeadImageNames);
 
 	// Get kernel base address
@@ -184,17 +221,27 @@ EXTERN_C VOID DriverUnload(
 ) {
 	MppLogger::Info("=================================================================\r\n");
 
-	// Free work item
+	// Remove load image callback first, nothing queues requests afterwards
+	if (MppCallbacks::LoadImage == TRUE)
+		::PsRemoveLoadImageNotifyRoutine(MppCallbacks::LoadImageNotify);
+	MppCallbacks::LoadImage = FALSE;
+
+	// Wait for the routine of the work item to return, release the files of the requests left, then
+	// free it
+	MppWorker::Rundown();
 	if (MppWorker::ProtectWorker != nullptr)
 		::IoFreeWorkItem(MppWorker::ProtectWorker);
+	MppWorker::ProtectWorker = nullptr;
 
-	// Remove load image callback
-	::PsRemoveLoadImageNotifyRoutine(MppCallbacks::LoadImageNotify);
-	MppCallbacks::LoadImage = FALSE;
+	// Free the image names and the policy, the callback is no longer running
+	MppCallbackData::Free();
 
 	// Delete the symbolic link and the device object
 	::IoDeleteSymbolicLink(&MppGlobals::SymlinkName);
 	::IoDeleteDevice(DriverObject->DeviceObject);
+
+	// Free the trace, nothing writes to it anymore
+	MppTracing::Free();
 }
 
 
@@ -214,6 +261,26 @@ EXTERN_C NTSTATUS DriverCreateClose(
 }
 
 
+_Use_decl_annotations_
+EXTERN_C NTSTATUS DriverCleanup(
+	_Inout_ PDEVICE_OBJECT DeviceObject,
+	_Inout_ PIRP           Irp
+) {
+	UNREFERENCED_PARAMETER(DeviceObject);
+
+	// Unmap the trace before the address space of the process goes away
+	PIO_STACK_LOCATION Stack = IoGetCurrentIrpStackLocation(Irp);
+	MppTracing::UnmapView(Stack->FileObject);
+
+	NTSTATUS Status = STATUS_SUCCESS;
+	Irp->IoStatus.Status      = Status;
+	Irp->IoStatus.Information = 0x00;
+
+	::IofCompleteRequest(Irp, IO_NO_INCREMENT);
+	return Status;
+}
+
+
 _Use_decl_annotations_
 EXTERN_C NTSTATUS DriverDispatch(
 	_Inout_ PDEVICE_OBJECT DeviceObject,
@@ -225,7 +292,8 @@ EXTERN_C NTSTATUS DriverDispatch(
 	PIO_STACK_LOCATION Stack = IoGetCurrentIrpStackLocation(Irp);
 
 	// Check if valid IOCTL has been sent
-	NTSTATUS  Status = STATUS_SUCCESS;
+	NTSTATUS  Status      = STATUS_SUCCESS;
+	ULONG_PTR Information = 0x00;
 
 	switch (Stack->Parameters.DeviceIoControl.IoControlCode) {
 	case MppIoctl::MppAddImageName(): {
@@ -283,6 +351,46 @@ EXTERN_C NTSTATUS DriverDispatch(
 		Status = MppCallbackData::RemoveImageName(InputBuffer.Name);
 		break;
 	}
+	case MppIoctl::MppUpdateImageNames(): {
+		// Make sure input buffer is large enough
+		if (!MppMemory::CheckInputBuffer(Stack, FIELD_OFFSET(MppIoctl::MPP_IMAGE_NAMES, Names))) {
+			Status = STATUS_BUFFER_TOO_SMALL;
+			break;
+		}
+
+		// Apply the whole batch, the input buffer being already copied by the I/O manager
+		Status = MppCallbackData::UpdateImageNames(
+			(CONST MppIoctl::MPP_IMAGE_NAMES*)Irp->AssociatedIrp.SystemBuffer,
+			Stack->Parameters.DeviceIoControl.InputBufferLength
+		);
+		break;
+	}
+	case MppIoctl::MppLoadPolicy(): {
+		// Make sure both buffers are large enough
+		if (!MppMemory::CheckInputBuffer(Stack, sizeof(MppPolicy::MPP_POLICY_HEADER))
+			|| Stack->Parameters.DeviceIoControl.OutputBufferLength < sizeof(MppIoctl::MPP_POLICY_RESULT)) {
+			Status = STATUS_BUFFER_TOO_SMALL;
+			break;
+		}
+
+		// Replace the policy, the input buffer being copied before being validated
+		MppIoctl::MPP_POLICY_RESULT Result = { 0x00 };
+		Status = MppCallbackData::LoadPolicy(
+			Irp->AssociatedIrp.SystemBuffer,
+			Stack->Parameters.DeviceIoControl.InputBufferLength,
+			&Result
+		);
+		if (NT_ERROR(Status))
+			break;
+
+		RtlCopyMemory(
+			Irp->AssociatedIrp.SystemBuffer,
+			&Result,
+			sizeof(MppIoctl::MPP_POLICY_RESULT)
+		);
+		Information = sizeof(MppIoctl::MPP_POLICY_RESULT);
+		break;
+	}
 	case MppIoctl::MppInitialiseKernelRoutines(): {
 
 		// Check if routines have already been initialised
@@ -324,7 +432,92 @@ EXTERN_C NTSTATUS DriverDispatch(
 			InputBuffer.MiUnlockAndDereferenceVad
 		);
 
-		MppKernelRoutines::RoutinesInitialised = TRUE;
+		// Published after the routines, read without lock by the worker
+		::WriteUCharRelease(&MppKernelRoutines::RoutinesInitialised, TRUE);
+		break;
+	}
+	case MppIoctl::MppQueryStatistics(): {
+		// Make sure output buffer is large enough
+		if (Stack->Parameters.DeviceIoControl.OutputBufferLength < sizeof(MppStats::MPP_STATS_SNAPSHOT)) {
+			Status = STATUS_BUFFER_TOO_SMALL;
+			break;
+		}
+
+		// Sum the slots of all the processors, directly in the system buffer
+		MppStats::Snapshot(
+			&MppGlobals::Statistics,
+			(MppStats::MPP_STATS_SNAPSHOT*)Irp->AssociatedIrp.SystemBuffer
+		);
+		Information = sizeof(MppStats::MPP_STATS_SNAPSHOT);
+		break;
+	}
+	case MppIoctl::MppMapTrace(): {
+		// Make sure output buffer is large enough
+		if (Stack->Parameters.DeviceIoControl.OutputBufferLength < sizeof(MppIoctl::MPP_TRACE_VIEW)) {
+			Status = STATUS_BUFFER_TOO_SMALL;
+			break;
+		}
+
+		// Map the trace into the calling process, read-only
+		MppIoctl::MPP_TRACE_VIEW View = { 0x00 };
+		Status = MppTracing::MapView(Stack->FileObject, &View);
+		if (NT_ERROR(Status))
+			break;
+
+		RtlCopyMemory(
+			Irp->AssociatedIrp.SystemBuffer,
+			&View,
+			sizeof(MppIoctl::MPP_TRACE_VIEW)
+		);
+		Information = sizeof(MppIoctl::MPP_TRACE_VIEW);
+		break;
+	}
+	case MppIoctl::MppVerifyIntegrity(): {
+		// Make sure output buffer is large enough
+		if (Stack->Parameters.DeviceIoControl.OutputBufferLength < sizeof(MppIoctl::MPP_INTEGRITY_RESULT)) {
+			Status = STATUS_BUFFER_TOO_SMALL;
+			break;
+		}
+
+		// Hash the recorded ranges again
+		MppIoctl::MPP_INTEGRITY_RESULT Result = { 0x00 };
+		Status = MppIntegrity::Verify(&Result);
+		if (NT_ERROR(Status))
+			break;
+
+		RtlCopyMemory(
+			Irp->AssociatedIrp.SystemBuffer,
+			&Result,
+			sizeof(MppIoctl::MPP_INTEGRITY_RESULT)
+		);
+		Information = sizeof(MppIoctl::MPP_INTEGRITY_RESULT);
+		break;
+	}
+	case MppIoctl::MppDiffImage(): {
+		// Make sure both buffers are large enough
+		ULONG OutputLength = Stack->Parameters.DeviceIoControl.OutputBufferLength;
+		if (!MppMemory::CheckInputBuffer(Stack, sizeof(MppIoctl::MPP_DIFF_IMAGE))
+			|| OutputLength < FIELD_OFFSET(MppIoctl::MPP_DIFF_RESULT, Entries)) {
+			Status = STATUS_BUFFER_TOO_SMALL;
+			break;
+		}
+
+		// Get input buffer, overwritten by the result
+		MppIoctl::MPP_DIFF_IMAGE InputBuffer = { 0x00 };
+		RtlCopyMemory(
+			&InputBuffer,
+			Irp->AssociatedIrp.SystemBuffer,
+			sizeof(MppIoctl::MPP_DIFF_IMAGE)
+		);
+
+		// Compare the image with its file, as many differences returned as fit
+		auto  Result         = (MppIoctl::PMPP_DIFF_RESULT)Irp->AssociatedIrp.SystemBuffer;
+		ULONG MaximumEntries = (ULONG)((OutputLength - FIELD_OFFSET(MppIoctl::MPP_DIFF_RESULT, Entries)) / sizeof(MppDiff::MPP_DIFF_ENTRY));
+		Status = MppIntegrity::DiffImage(&InputBuffer, Result, MaximumEntries);
+		if (NT_ERROR(Status))
+			break;
+
+		Information = FIELD_OFFSET(MppIoctl::MPP_DIFF_RESULT, Entries) + (Result->NumberOfEntries * sizeof(MppDiff::MPP_DIFF_ENTRY));
 		break;
 	}
 	default:
@@ -335,7 +528,7 @@ EXTERN_C NTSTATUS DriverDispatch(
 
 	// Complete request
 	Irp->IoStatus.Status      = Status;
-	Irp->IoStatus.Information = 0x00;
+	Irp->IoStatus.Information = Information;
 	IofCompleteRequest(Irp, IO_NO_INCREMENT);
 	return Status;
 }
\ No newline at end of file
@@ -0,0 +1,228 @@
+/*+================================================================================================
+Module Name: matcher.cpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+Abstract:
+Memory Patching Protection (MPP) multi-pattern image name matcher.
+The protected names are compiled into one Aho-Corasick automaton so that an image name is matched
+against all of them in a single pass. The automaton lives in one caller-allocated buffer and the
+routines neither allocate nor depend on the kernel, so that they can also be built in user mode.
+================================================================================================+*/
+
+#include <stdlib.h>
+#include "matcher.hpp"
+
+/// @brief Helpers of the matcher.
+namespace MppMatcher {
+
+	/// @brief Patterns sharing the prefix of a state, used while compiling.
+	typedef struct _MPP_MATCHER_RANGE {
+		ULONG Low;   // First pattern
+		ULONG High;  // Pattern after the last one
+		ULONG Depth; // Length of the prefix
+	} MPP_MATCHER_RANGE, * PMPP_MATCHER_RANGE;
+
+	/// @brief Number of transitions below which they are scanned rather than binary searched.
+	constexpr ULONG LinearSearchEdges = 0x08;
+
+	/// @brief Transition value of no transition, the root is never a target.
+	constexpr ULONG NoState = 0x00;
+
+	/// @brief Round a size up to 8 bytes.
+	constexpr SIZE_T Align(SIZE_T Size) {
+		return (Size + 0x07) & ~(SIZE_T)0x07;
+	}
+
+	/// @brief Order patterns by character, a prefix before the longer patterns.
+	static int ComparePatterns(
+		_In_ CONST VOID* Left,
+		_In_ CONST VOID* Right
+	) {
+		auto First  = static_cast<CONST MPP_MATCHER_PATTERN*>(Left);
+		auto Second = static_cast<CONST MPP_MATCHER_PATTERN*>(Right);
+
+		ULONG Length = First->Length < Second->Length ? First->Length : Second->Length;
+		for (ULONG cx = 0x00; cx < Length; cx++) {
+			if (First->Buffer[cx] != Second->Buffer[cx])
+				return First->Buffer[cx] < Second->Buffer[cx] ? -1 : 1;
+		}
+		if (First->Length == Second->Length)
+			return 0;
+		return First->Length < Second->Length ? -1 : 1;
+	}
+
+	/// @brief Transition of a state on a character, without following the failure links.
+	static inline ULONG Step(
+		_In_ CONST MPP_MATCHER* Matcher,
+		_In_ ULONG              State,
+		_In_ WCHAR              Character
+	) {
+		CONST MPP_MATCHER_STATE& Node = Matcher->States[State];
+		ULONG Low  = Node.FirstEdge;
+		ULONG High = Node.FirstEdge + Node.NumberOfEdges;
+
+		// Binary search down to a few transitions
+		while ((High - Low) > LinearSearchEdges) {
+			ULONG Middle = Low + ((High - Low) / 2);
+			if (Matcher->Characters[Middle] <= Character)
+				Low = Middle;
+			else
+				High = Middle;
+		}
+		for (; Low < High; Low++) {
+			if (Matcher->Characters[Low] == Character)
+				return Matcher->Targets[Low];
+		}
+		return NoState;
+	}
+}
+
+
+_Use_decl_annotations_
+SIZE_T MppMatcher::GetCompiledSize(
+	_In_ ULONG  NumberOfPatterns,
+	_In_ SIZE_T TotalLength
+) {
+	UNREFERENCED_PARAMETER(NumberOfPatterns);
+
+	// At most one state per character, plus the root
+	SIZE_T NumberOfStates = TotalLength + 1;
+	return Align(sizeof(MPP_MATCHER))
+		+ Align(NumberOfStates * sizeof(MPP_MATCHER_STATE))
+		+ Align(TotalLength * sizeof(ULONG))
+		+ Align(TotalLength * sizeof(WCHAR))
+		+ Align(NumberOfStates * sizeof(MPP_MATCHER_RANGE));
+}
+
+
+_Use_decl_annotations_
+MppMatcher::MPP_MATCHER* MppMatcher::Compile(
+	_Inout_updates_(NumberOfPatterns) MPP_MATCHER_PATTERN* Patterns,
+	_In_                              ULONG                NumberOfPatterns,
+	_Out_writes_bytes_(BufferSize)    PVOID                Buffer,
+	_In_                              SIZE_T               BufferSize
+) {
+	SIZE_T TotalLength = 0x00;
+	for (ULONG cx = 0x00; cx < NumberOfPatterns; cx++)
+		TotalLength += Patterns[cx].Length;
+	if (Buffer == nullptr || BufferSize < GetCompiledSize(NumberOfPatterns, TotalLength))
+		return nullptr;
+
+	// Carve the buffer, the ranges are only needed while compiling
+	SIZE_T NumberOfStates = TotalLength + 1;
+	auto   Matcher        = static_cast<MPP_MATCHER*>(Buffer);
+	PUCHAR Cursor         = static_cast<PUCHAR>(Buffer) + Align(sizeof(MPP_MATCHER));
+
+	Matcher->States     = reinterpret_cast<MPP_MATCHER_STATE*>(Cursor);
+	Cursor             += Align(NumberOfStates * sizeof(MPP_MATCHER_STATE));
+	Matcher->Targets    = reinterpret_cast<ULONG*>(Cursor);
+	Cursor             += Align(TotalLength * sizeof(ULONG));
+	Matcher->Characters = reinterpret_cast<WCHAR*>(Cursor);
+	Cursor             += Align(TotalLength * sizeof(WCHAR));
+	Matcher->Size       = Cursor - static_cast<PUCHAR>(Buffer);
+	auto Ranges         = reinterpret_cast<MPP_MATCHER_RANGE*>(Cursor);
+
+	// Sorted, the patterns sharing a prefix are contiguous
+	if (NumberOfPatterns > 0x01)
+		qsort(Patterns, NumberOfPatterns, sizeof(MPP_MATCHER_PATTERN), ComparePatterns);
+
+	// Trie built breadth-first, the transitions of a state are contiguous and sorted
+	ULONG States = 0x01;
+	ULONG Edges  = 0x00;
+	Matcher->States[0x00] = { 0x00, 0x00, 0x00, FALSE };
+	Ranges[0x00]          = { 0x00, NumberOfPatterns, 0x00 };
+
+	for (ULONG State = 0x00; State < States; State++) {
+		MPP_MATCHER_STATE& Node  = Matcher->States[State];
+		MPP_MATCHER_RANGE  Range = Ranges[State];
+
+		// Patterns ending here come first. Matching stops on them, the longer ones are useless.
+		Node.FirstEdge = Edges;
+		if (Range.Low < Range.High && Patterns[Range.Low].Length == Range.Depth) {
+			Node.Match = TRUE;
+			continue;
+		}
+
+		// One transition per distinct next character
+		while (Range.Low < Range.High) {
+			WCHAR Character = Patterns[Range.Low].Buffer[Range.Depth];
+			ULONG End       = Range.Low + 1;
+			while (End < Range.High && Patterns[End].Buffer[Range.Depth] == Character)
+				End++;
+
+			Matcher->Characters[Edges] = Character;
+			Matcher->Targets[Edges]    = States;
+			Matcher->States[States]    = { 0x00, 0x00, 0x00, FALSE };
+			Ranges[States]             = { Range.Low, End, Range.Depth + 1 };
+
+			Edges++;
+			States++;
+			Range.Low = End;
+		}
+		Node.NumberOfEdges = Edges - Node.FirstEdge;
+	}
+	Matcher->NumberOfStates = States;
+	Matcher->NumberOfEdges  = Edges;
+
+	// Failure links, breadth-first so that the ones of shallower states are known
+	for (ULONG State = 0x00; State < States; State++) {
+		CONST MPP_MATCHER_STATE& Node = Matcher->States[State];
+
+		for (ULONG Edge = Node.FirstEdge; Edge < (Node.FirstEdge + Node.NumberOfEdges); Edge++) {
+			MPP_MATCHER_STATE& Child = Matcher->States[Matcher->Targets[Edge]];
+			ULONG              Next  = NoState;
+
+			if (State != 0x00) {
+				ULONG Failure = Node.Failure;
+				while ((Next = Step(Matcher, Failure, Matcher->Characters[Edge])) == NoState && Failure != 0x00)
+					Failure = Matcher->States[Failure].Failure;
+			}
+			Child.Failure = Next;
+			Child.Match  |= Matcher->States[Next].Match;
+		}
+	}
+
+	// Most characters of a path are ASCII and most of them fall back to the root
+	for (ULONG cx = 0x00; cx < RootTableSize; cx++)
+		Matcher->RootTable[cx] = Step(Matcher, 0x00, (WCHAR)cx);
+	return Matcher;
+}
+
+
+_Use_decl_annotations_
+BOOLEAN MppMatcher::Match(
+	_In_               CONST MPP_MATCHER* Matcher,
+	_In_reads_(Length) CONST WCHAR*       Text,
+	_In_               SIZE_T             Length
+) {
+	if (Matcher == nullptr)
+		return FALSE;
+	if (Matcher->States[0x00].Match)
+		return TRUE;
+
+	ULONG State = 0x00;
+	for (SIZE_T cx = 0x00; cx < Length; cx++) {
+		WCHAR Character = Text[cx];
+
+		// Follow the failure links until a transition or the root
+		while (State != 0x00) {
+			ULONG Next = Step(Matcher, State, Character);
+			if (Next != NoState) {
+				State = Next;
+				break;
+			}
+			State = Matcher->States[State].Failure;
+		}
+		if (State == 0x00) {
+			State = (ULONG)Character < RootTableSize
+				? Matcher->RootTable[Character]
+				: Step(Matcher, 0x00, Character);
+		}
+
+		if (Matcher->States[State].Match)
+			return TRUE;
+	}
+	return FALSE;
+}
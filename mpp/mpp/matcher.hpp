@@ -0,0 +1,86 @@
+/*+================================================================================================
+Module Name: matcher.hpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+Abstract:
+Memory Patching Protection (MPP) multi-pattern image name matcher.
+The protected names are compiled into one Aho-Corasick automaton so that an image name is matched
+against all of them in a single pass. The automaton lives in one caller-allocated buffer and the
+routines neither allocate nor depend on the kernel, so that they can also be built in user mode.
+================================================================================================+*/
+
+#ifndef __MPP_MATCHER_H_GUARD__
+#define __MPP_MATCHER_H_GUARD__
+
+#include "portable.hpp"
+
+
+/// @brief Multi-pattern image name matcher.
+namespace MppMatcher {
+
+	/// @brief Number of root transitions looked up in a table, the ASCII characters.
+	constexpr ULONG RootTableSize = 0x80;
+
+	/// @brief Pattern to compile, not NULL terminated.
+	typedef struct _MPP_MATCHER_PATTERN {
+		CONST WCHAR* Buffer;
+		ULONG        Length;
+	} MPP_MATCHER_PATTERN, * PMPP_MATCHER_PATTERN;
+
+	/// @brief State of the automaton, i.e. a prefix of the patterns.
+	typedef struct _MPP_MATCHER_STATE {
+		ULONG   FirstEdge;     // Index of the first transition, sorted by character
+		ULONG   NumberOfEdges; // Number of transitions
+		ULONG   Failure;       // State of the longest proper suffix that is also a prefix
+		BOOLEAN Match;         // A pattern ends here or in one of the failure states
+	} MPP_MATCHER_STATE, * PMPP_MATCHER_STATE;
+
+	/// @brief Compiled automaton, followed by its states and transitions in the same buffer.
+	typedef struct _MPP_MATCHER {
+		SIZE_T             Size;           // Size of the buffer used
+		ULONG              NumberOfStates; // Number of states, the root being the first one
+		ULONG              NumberOfEdges;  // Number of transitions
+
+		MPP_MATCHER_STATE* States;
+		WCHAR*             Characters;     // Character of each transition
+		ULONG*             Targets;        // State of each transition
+
+		ULONG              RootTable[RootTableSize]; // Root transitions of the ASCII characters, 0 if none
+	} MPP_MATCHER, * PMPP_MATCHER;
+
+	/// @brief Size of the buffer required to compile patterns.
+	/// @param NumberOfPatterns Number of patterns.
+	/// @param TotalLength      Sum of the length of the patterns, in characters.
+	SIZE_T GetCompiledSize(
+		_In_ ULONG  NumberOfPatterns,
+		_In_ SIZE_T TotalLength
+	);
+
+	/// @brief Compile patterns into an automaton. Patterns are sorted in place.
+	/// @param Patterns         Patterns to compile, matched as sub-strings, case-sensitive.
+	/// @param NumberOfPatterns Number of patterns.
+	/// @param Buffer           Buffer receiving the automaton, aligned on 8 bytes.
+	/// @param BufferSize       Size of the buffer, at least the size returned by GetCompiledSize.
+	/// @return Pointer to the automaton, at the beginning of the buffer, or nullptr if too small.
+	_Must_inspect_result_
+	MPP_MATCHER* Compile(
+		_Inout_updates_(NumberOfPatterns) MPP_MATCHER_PATTERN* Patterns,
+		_In_                              ULONG                NumberOfPatterns,
+		_Out_writes_bytes_(BufferSize)    PVOID                Buffer,
+		_In_                              SIZE_T               BufferSize
+	);
+
+	/// @brief Whether a name contains any of the patterns.
+	/// @param Matcher Compiled automaton.
+	/// @param Text    Name to check, not necessarily NULL terminated.
+	/// @param Length  Length of the name, in characters.
+	BOOLEAN Match(
+		_In_                 CONST MPP_MATCHER* Matcher,
+		_In_reads_(Length)   CONST WCHAR*       Text,
+		_In_                 SIZE_T             Length
+	);
+}
+
+#endif // !__MPP_MATCHER_H_GUARD__
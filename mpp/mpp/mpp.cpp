@@ -15,7 +15,7 @@ Memory Patching Protection (MPP) Global Kernel Data.
 /// @brief MPP Global variables
 namespace MppGlobals {
 	/// @brief Kernel memory pool tag.
-	ULONG PoolTag = (ULONG)' ppM';
+	ULONG PoolTag = (ULONG)0x2070704D;
 
 	/// @brief Name of the kernel device driver.
 	UNICODE_STRING DeviceName = RTL_CONSTANT_STRING(L"\\Device\\MppDrv");
@@ -31,6 +31,9 @@ namespace MppGlobals {
 		{ 0xa3, 0xc5, 0x6e, 0x3d, 0xc8, 0xf0, 0xba, 0xd9 }
 	};
 
+	/// @brief Counters and latencies of the image loading path.
+	MppStats::MPP_STATS Statistics{};
+
 	/// @brief Work item to protect .text section of a module.
 	PIO_WORKITEM ProtectWorker = nullptr;
 }
@@ -52,8 +55,23 @@ namespace MppCallbackData {
 	/// @brief Number of image names to check for each modules being loaded.
 	ULONG      NumberOfImageNames = 0x00;
 
-	/// @brief Spin lock for double-linked list of image names.
-	KSPIN_LOCK ImageNamesLock = 0x00;
+	/// @brief Sum of the length of the image names, in characters.
+	SIZE_T     ImageNamesLength = 0x00;
+
+	/// @brief Mutex serialising the writers of the image names.
+	FAST_MUTEX ImageNamesLock{};
+
+	/// @brief Mutex serialising the writers of the policy.
+	FAST_MUTEX PolicyLock{};
+
+	/// @brief Index of the current policy, followed by the policy itself, published to the callback.
+	MppRcu::MPP_RCU_DOMAIN Policy{};
+
+	/// @brief Generation of the last policy loaded, 0 if none.
+	ULONG      PolicyGeneration = 0x00;
+
+	/// @brief Image names compiled into one automaton, published to the callback.
+	MppRcu::MPP_RCU_DOMAIN ImageNames{};
 }
 
 
@@ -85,6 +103,16 @@ namespace MppKernelRoutines {
 }
 
 
+/// @brief Binary trace of the driver, mapped into the clients.
+namespace MppTracing {
+	/// @brief Trace written by the driver, nullptr if it could not be allocated.
+	MppTrace::MPP_TRACE_HEADER* Trace = nullptr;
+
+	/// @brief Pages of the trace, mapped into the clients.
+	PMDL TraceMdl = nullptr;
+}
+
+
 _Use_decl_annotations_
 VOID __declspec(code_seg("PAGE"))
 MppCallbacks::LoadImageNotify(
@@ -97,65 +125,71 @@ MppCallbacks::LoadImageNotify(
 	// Cannot check if there is no name
 	if (FullImageName == nullptr)
 		return;
+	ULONG64 StartTime = MppStats::GetTime();
+	MppStats::Increment(&MppGlobals::Statistics, MppStats::CounterImagesLoaded);
 
-	// Acquire spin-lock
-	KLOCK_QUEUE_HANDLE LockHandle = { 0x00 };
-	::KeAcquireInStackQueuedSpinLock(
-		&MppCallbackData::ImageNamesLock,
-		&LockHandle
+	// Snapshot of the compiled names, read without lock
+	MppRcu::MPP_RCU_TOKEN Token = { 0x00 };
+	auto Matcher = static_cast<CONST MppMatcher::MPP_MATCHER*>(
+		MppRcu::ReadLock(&MppCallbackData::ImageNames, &Token)
 	);
 
-	// Check if name is of our interest
-	BOOLEAN     Found = FALSE;
-	PLIST_ENTRY Head  = MppCallbackData::HeadImageNames.Flink;
-
-	for (ULONG cx = 0x00; cx < MppCallbackData::NumberOfImageNames; cx++) {
-		auto Entry = CONTAINING_RECORD(Head, MppCallbackData::ImageNameEntry, List);
-		if (Entry == nullptr)
-			break;
-
-		// Check if name matches
-		if (::wcsstr(FullImageName->Buffer, Entry->Name) != NULL) {
-			Found = TRUE;
-			break;
-		}
+	// Check if name is of our interest, against all the names in one pass
+	BOOLEAN Found = MppMatcher::Match(
+		Matcher,
+		FullImageName->Buffer,
+		FullImageName->Length / sizeof(WCHAR)
+	);
 
-		if (Head->Flink == &MppCallbackData::HeadImageNames)
-			break;
-		Head = Head->Flink;
-	}
+	// Release the snapshot
+	MppRcu::ReadUnlock(&MppCallbackData::ImageNames, Token);
 
-	// Release spin-lock
-	::KeReleaseInStackQueuedSpinLock(&LockHandle);
+	// Protections of the policy, added to all of them for the image names
+	ULONG Flags  = Found ? MppPolicy::ValidFlags : 0x00;
+	auto  Policy = static_cast<CONST MppPolicy::MPP_POLICY_INDEX*>(
+		MppRcu::ReadLock(&MppCallbackData::Policy, &Token)
+	);
+	Flags |= MppPolicy::Lookup(
+		Policy,
+		FullImageName->Buffer,
+		FullImageName->Length / sizeof(WCHAR)
+	);
+	MppRcu::ReadUnlock(&MppCallbackData::Policy, Token);
+	MppStats::Record(&MppGlobals::Statistics, MppStats::LatencyMatch, MppStats::GetTime() - StartTime);
 
 	// Check if found
-	if (!Found)
+	if (Flags == 0x00)
 		return;
+	MppStats::Increment(&MppGlobals::Statistics, MppStats::CounterImagesMatched);
 
 	// Get information required
-	MppLogger::Info("Image      : %wZ\r\n", FullImageName);
+	MppLogger::TraceName<MppEvents::EventImageMatched>(FullImageName, ProcessId, ImageInfo->ImageBase, Flags);
 
-	// Allocate memory for worker context data
-	auto WorkerData = MppMemory::MemAlloc<MppWorker::MPP_WORKER_PROTECT_DATA*>(
-		sizeof(MppWorker::MPP_WORKER_PROTECT_DATA)
-	);
-	if (WorkerData == nullptr) {
-		MppLogger::Error("Unable to allocate memory for protect worker data\r\n");
-		return;
+	// Add information
+	MppWorker::MPP_WORKER_PROTECT_DATA WorkerData = { 0x00 };
+	WorkerData.ThreadId         = ::PsGetCurrentThreadId();
+	WorkerData.ProcessId        = ProcessId;
+	WorkerData.ImageBaseAddress = ImageInfo->ImageBase;
+	WorkerData.Flags            = Flags;
+
+	// Identity of the image file, shared by all the processes mapping it
+	if (ImageInfo->ExtendedInfoPresent) {
+		auto ImageInfoEx = CONTAINING_RECORD(ImageInfo, IMAGE_INFO_EX, ImageInfo);
+		if (ImageInfoEx->FileObject != nullptr) {
+			WorkerData.ImageSection = ImageInfoEx->FileObject->SectionObjectPointer;
+			WorkerData.ImageFile    = ImageInfoEx->FileObject;
+			::ObReferenceObject(WorkerData.ImageFile);
+		}
 	}
 
-	// Add information
-	WorkerData->ThreadId         = ::PsGetCurrentThreadId();
-	WorkerData->ProcessId        = ProcessId;
-	WorkerData->ImageBaseAddress = ImageInfo->ImageBase;
-
-	// Fire the work item from kernel thread pool
-	::IoQueueWorkItem(
-		MppWorker::ProtectWorker,
-		(PIO_WORKITEM_ROUTINE)MppWorker::ProtectWorkerCallback,
-		DelayedWorkQueue,
-		WorkerData
-	);
+	// Hand over to the worker, from the preallocated slots of the queue
+	WorkerData.QueuedTime = MppStats::GetTime();
+	if (!MppWorker::QueueProtect(WorkerData)) {
+		MppStats::Increment(&MppGlobals::Statistics, MppStats::CounterRequestsDropped);
+		MppLogger::Trace<MppEvents::EventRequestDropped>(ProcessId, ImageInfo->ImageBase);
+		if (WorkerData.ImageFile != nullptr)
+			::ObDereferenceObject(WorkerData.ImageFile);
+	}
 }
 
 
@@ -171,24 +205,17 @@ MppCallbackData::AddImageName(
 	// Check for parameters
 	if (ImageName == nullptr)
 		return STATUS_INVALID_PARAMETER_1;
-	if (ImageNameSize == 0x00)
+	if (ImageNameSize == 0x00 || ImageNameSize > (MaximumImageName * sizeof(WCHAR)))
 		return STATUS_INVALID_PARAMETER_2;
 
-	// Allocate memory
-	auto Entry = MppMemory::MemAlloc<ImageNameEntry*>(sizeof(ImageNameEntry));
+	// Allocate memory, up to the terminator if any
+	ULONG Length = (ULONG)::wcsnlen(ImageName, (ImageNameSize / sizeof(WCHAR)));
+	auto  Entry  = AllocateImageName(ImageName, Length < MaximumImageName ? Length : MaximumImageName - 1);
 	if (Entry == nullptr)
 		return STATUS_NO_MEMORY;
 
-	// Move data to 
-	Entry->Size = ImageNameSize;
-	RtlCopyMemory(Entry->Name, ImageName, ImageNameSize);
-
-	// Acquire spin-lock
-	KLOCK_QUEUE_HANDLE LockHandle = { 0x00 };
-	::KeAcquireInStackQueuedSpinLock(
-		&ImageNamesLock,
-		&LockHandle
-	);
+	// Acquire writer lock
+	::ExAcquireFastMutex(&ImageNamesLock);
 
 	// Add entry to the end of the list
 	::InsertTailList(
@@ -196,12 +223,20 @@ MppCallbackData::AddImageName(
 		reinterpret_cast<PLIST_ENTRY>(Entry)
 	);
 	NumberOfImageNames++;
+	ImageNamesLength += Entry->Length;
 
-	// Release spin-lock
-	::KeReleaseInStackQueuedSpinLock(&LockHandle);
+	// Recompile the names, the entry taken back when they cannot be
+	NTSTATUS Status = CompileImageNames();
+	if (!NT_SUCCESS(Status)) {
+		::RemoveEntryList(reinterpret_cast<PLIST_ENTRY>(Entry));
+		NumberOfImageNames--;
+		ImageNamesLength -= Entry->Length;
+		MppMemory::MemFree(Entry);
+	}
 
-	// Return success
-	return STATUS_SUCCESS;
+	// Release writer lock
+	::ExReleaseFastMutex(&ImageNamesLock);
+	return Status;
 }
 
 
@@ -217,12 +252,13 @@ MppCallbackData::RemoveImageName(
 	if (ImageName == nullptr)
 		return STATUS_INVALID_PARAMETER_1;
 
-	// Acquire spin-lock
-	KLOCK_QUEUE_HANDLE LockHandle = { 0x00 };
-	::KeAcquireInStackQueuedSpinLock(
-		&ImageNamesLock,
-		&LockHandle
-	);
+	// Same length as when added, up to the terminator if any
+	ULONG Length = (ULONG)::wcsnlen(ImageName, MaximumImageName);
+	if (Length == MaximumImageName)
+		Length--;
+
+	// Acquire writer lock
+	::ExAcquireFastMutex(&ImageNamesLock);
 	
 	// Parse all entries
 	ImageNameEntry* Entry = nullptr;
@@ -235,8 +271,8 @@ MppCallbackData::RemoveImageName(
 		if (Entry == nullptr)
 			break;
 
-		// Check if name matches
-		if (::wcsstr(ImageName, Entry->Name) != NULL) {
+		// Check if name is the same, as for the batches
+		if (Entry->Length == Length && ::wcsncmp(ImageName, Entry->Name, Length) == 0x00) {
 			Found = TRUE;
 			break;
 		}
@@ -247,20 +283,350 @@ MppCallbackData::RemoveImageName(
 		Head = Head->Flink;
 	}
 
-	// Remove if entry was found
+	// Remove if entry was found, and recompile the names
+	NTSTATUS Status = STATUS_SUCCESS;
 	if (Found) {
+		PLIST_ENTRY Previous = Entry->List.Blink;
 		::RemoveEntryList(reinterpret_cast<PLIST_ENTRY>(Entry));
-		MppMemory::MemFree(Entry);
+		NumberOfImageNames--;
+		ImageNamesLength -= Entry->Length;
+
+		// Only freed once the names are compiled, put back in place otherwise
+		Status = CompileImageNames();
+		if (NT_SUCCESS(Status)) {
+			MppMemory::MemFree(Entry);
+		}
+		else {
+			::InsertHeadList(Previous, reinterpret_cast<PLIST_ENTRY>(Entry));
+			NumberOfImageNames++;
+			ImageNamesLength += Entry->Length;
+		}
 	}
 
-	// Release spin-lock
-	::KeReleaseInStackQueuedSpinLock(&LockHandle);
+	// Release writer lock
+	::ExReleaseFastMutex(&ImageNamesLock);
+	return Status;
+}
+
+
+/// @brief Order of the names removed by a batch, by length and then by characters.
+static int __cdecl CompareImageNames(
+	_In_ CONST VOID* Left,
+	_In_ CONST VOID* Right
+) {
+	auto First  = *static_cast<CONST MppIoctl::MPP_IMAGE_NAME* CONST*>(Left);
+	auto Second = *static_cast<CONST MppIoctl::MPP_IMAGE_NAME* CONST*>(Right);
+	if (First->Length != Second->Length)
+		return First->Length < Second->Length ? -1 : 1;
+	return ::wcsncmp(First->Name, Second->Name, First->Length);
+}
+
 
-	// Return success
+/// @brief Binary search of an entry in the sorted names removed by a batch.
+static BOOLEAN FindImageName(
+	_In_reads_(NumberOfNames) CONST MppIoctl::MPP_IMAGE_NAME**       Names,
+	_In_                      ULONG                                  NumberOfNames,
+	_In_                      CONST MppCallbackData::ImageNameEntry* Entry
+) {
+	ULONG Low  = 0x00;
+	ULONG High = NumberOfNames;
+	while (Low < High) {
+		ULONG Middle = Low + ((High - Low) / 2);
+		int   Order  = Names[Middle]->Length != Entry->Length
+			? (Names[Middle]->Length < Entry->Length ? -1 : 1)
+			: ::wcsncmp(Names[Middle]->Name, Entry->Name, Entry->Length);
+		if (Order == 0x00)
+			return TRUE;
+		if (Order < 0x00)
+			Low = Middle + 1;
+		else
+			High = Middle;
+	}
+	return FALSE;
+}
+
+
+_Use_decl_annotations_
+NTSTATUS __declspec(code_seg("PAGE"))
+MppCallbackData::UpdateImageNames(
+	_In_reads_bytes_(Size) CONST MppIoctl::MPP_IMAGE_NAMES* Names,
+	_In_                   SIZE_T                           Size
+) {
+	// Ensure current IRQL allow paging.
+	PAGED_CODE();
+
+	// Check for parameters
+	if (Names == nullptr)
+		return STATUS_INVALID_PARAMETER_1;
+	if (Size < FIELD_OFFSET(MppIoctl::MPP_IMAGE_NAMES, Names))
+		return STATUS_INVALID_PARAMETER_2;
+
+	// The image names are protected, which cannot be done before the kernel routines are known
+	if (Names->NumberOfAdded != 0x00 && !::ReadUCharAcquire(&MppKernelRoutines::RoutinesInitialised))
+		return STATUS_DEVICE_NOT_READY;
+
+	// Each name takes at least two characters
+	ULONG64 NumberOfNames = (ULONG64)Names->NumberOfAdded + Names->NumberOfRemoved;
+	if (NumberOfNames > (Size / (sizeof(WCHAR) * 2)))
+		return STATUS_INVALID_PARAMETER_2;
+
+	auto Removed = MppMemory::MemAlloc<CONST MppIoctl::MPP_IMAGE_NAME**>(
+		(Names->NumberOfRemoved + 1) * sizeof(CONST MppIoctl::MPP_IMAGE_NAME*)
+	);
+	if (Removed == nullptr)
+		return STATUS_NO_MEMORY;
+
+	// Entries of the names added, all allocated before the image names are changed
+	LIST_ENTRY Added       = { 0x00 };
+	LIST_ENTRY Detached    = { 0x00 };
+	SIZE_T     AddedLength = 0x00;
+	::InitializeListHead(&Added);
+	::InitializeListHead(&Detached);
+
+	NTSTATUS     Status = STATUS_SUCCESS;
+	CONST UCHAR* Cursor = reinterpret_cast<CONST UCHAR*>(Names->Names);
+	CONST UCHAR* End    = reinterpret_cast<CONST UCHAR*>(Names) + Size;
+	for (ULONG cx = 0x00; cx < (ULONG)NumberOfNames; cx++) {
+		auto Name = reinterpret_cast<CONST MppIoctl::MPP_IMAGE_NAME*>(Cursor);
+		if ((SIZE_T)(End - Cursor) < FIELD_OFFSET(MppIoctl::MPP_IMAGE_NAME, Name)
+			|| Name->Length == 0x00
+			|| Name->Length >= MaximumImageName
+			|| (SIZE_T)(End - Cursor) < FIELD_OFFSET(MppIoctl::MPP_IMAGE_NAME, Name) + (Name->Length * sizeof(WCHAR))) {
+			Status = STATUS_INVALID_PARAMETER_2;
+			break;
+		}
+		Cursor += FIELD_OFFSET(MppIoctl::MPP_IMAGE_NAME, Name) + (Name->Length * sizeof(WCHAR));
+
+		if (cx >= Names->NumberOfAdded) {
+			Removed[cx - Names->NumberOfAdded] = Name;
+			continue;
+		}
+
+		auto Entry = AllocateImageName(Name->Name, Name->Length);
+		if (Entry == nullptr) {
+			Status = STATUS_NO_MEMORY;
+			break;
+		}
+		::InsertTailList(&Added, &Entry->List);
+		AddedLength += Entry->Length;
+	}
+
+	if (NT_SUCCESS(Status)) {
+		// Sorted before taking the lock, each entry is then binary searched
+		qsort(Removed, Names->NumberOfRemoved, sizeof(CONST MppIoctl::MPP_IMAGE_NAME*), CompareImageNames);
+
+		// Acquire writer lock
+		::ExAcquireFastMutex(&ImageNamesLock);
+
+		// Detach the names, all of them when replaced, only freed once the batch is compiled
+		PLIST_ENTRY Head = HeadImageNames.Flink;
+		while (Head != &HeadImageNames) {
+			auto Entry = CONTAINING_RECORD(Head, ImageNameEntry, List);
+			Head = Head->Flink;
+
+			BOOLEAN Remove = (Names->Flags & MppIoctl::MppImageNamesReplace) != 0x00
+				|| FindImageName(Removed, Names->NumberOfRemoved, Entry);
+			if (!Remove)
+				continue;
+
+			::RemoveEntryList(&Entry->List);
+			::InsertTailList(&Detached, &Entry->List);
+			NumberOfImageNames--;
+			ImageNamesLength -= Entry->Length;
+		}
+
+		// Add the names
+		ULONG NumberOfAdded = 0x00;
+		while (!::IsListEmpty(&Added)) {
+			::InsertTailList(&HeadImageNames, ::RemoveHeadList(&Added));
+			NumberOfImageNames++;
+			NumberOfAdded++;
+		}
+		ImageNamesLength += AddedLength;
+
+		// Recompile the names once for the whole batch
+		Status = CompileImageNames();
+
+		// Splice everything back, the list and counters matching the names still published
+		if (!NT_SUCCESS(Status)) {
+			for (ULONG cx = 0x00; cx < NumberOfAdded; cx++) {
+				::InsertHeadList(&Added, ::RemoveTailList(&HeadImageNames));
+				NumberOfImageNames--;
+			}
+			ImageNamesLength -= AddedLength;
+
+			while (!::IsListEmpty(&Detached)) {
+				auto Entry = CONTAINING_RECORD(::RemoveHeadList(&Detached), ImageNameEntry, List);
+				::InsertTailList(&HeadImageNames, &Entry->List);
+				NumberOfImageNames++;
+				ImageNamesLength += Entry->Length;
+			}
+		}
+
+		// Release writer lock
+		::ExReleaseFastMutex(&ImageNamesLock);
+	}
+
+	// Cleanup, entries added left only when the batch is rejected, entries detached only when published
+	while (!::IsListEmpty(&Added))
+		MppMemory::MemFree(CONTAINING_RECORD(::RemoveHeadList(&Added), ImageNameEntry, List));
+	while (!::IsListEmpty(&Detached))
+		MppMemory::MemFree(CONTAINING_RECORD(::RemoveHeadList(&Detached), ImageNameEntry, List));
+	MppMemory::MemFree(Removed);
+	return Status;
+}
+
+
+_Use_decl_annotations_
+NTSTATUS __declspec(code_seg("PAGE"))
+MppCallbackData::LoadPolicy(
+	_In_reads_bytes_(Size) CONST VOID*                  Buffer,
+	_In_                   SIZE_T                       Size,
+	_Out_                  MppIoctl::MPP_POLICY_RESULT* Result
+) {
+	// Ensure current IRQL allow paging.
+	PAGED_CODE();
+	RtlZeroMemory(Result, sizeof(MppIoctl::MPP_POLICY_RESULT));
+
+	// Check for parameters
+	if (Buffer == nullptr)
+		return STATUS_INVALID_PARAMETER_1;
+	if (Size < sizeof(MppPolicy::MPP_POLICY_HEADER) || Size > MAXULONG)
+		return STATUS_INVALID_PARAMETER_2;
+	if (static_cast<CONST MppPolicy::MPP_POLICY_HEADER*>(Buffer)->NumberOfEntries > MppPolicy::MaximumEntries)
+		return STATUS_INVALID_PARAMETER;
+
+	// Copy of the policy, after its index, both freed at once when replaced
+	SIZE_T IndexSize = (MppPolicy::GetIndexSize(Buffer) + 0x07) & ~(SIZE_T)0x07;
+	auto   Snapshot  = MppMemory::MemAlloc<PUCHAR>(IndexSize + Size);
+	if (Snapshot == nullptr)
+		return STATUS_NO_MEMORY;
+	RtlCopyMemory(Snapshot + IndexSize, Buffer, Size);
+
+	// Only the copy is validated and indexed
+	if (!MppPolicy::Validate(Snapshot + IndexSize, Size)
+		|| MppPolicy::GetIndexSize(Snapshot + IndexSize) > IndexSize) {
+		MppMemory::MemFree(Snapshot);
+		return STATUS_INVALID_PARAMETER;
+	}
+	MppPolicy::MPP_POLICY_INDEX* Index = MppPolicy::BuildIndex(Snapshot + IndexSize, Snapshot, IndexSize);
+	if (Index == nullptr) {
+		MppMemory::MemFree(Snapshot);
+		return STATUS_UNSUCCESSFUL;
+	}
+
+	// Ranges cannot be secured before the kernel routines are known
+	for (ULONG cx = 0x00; !::ReadUCharAcquire(&MppKernelRoutines::RoutinesInitialised) && cx < Index->NumberOfKeys; cx++) {
+		if (Index->Keys[cx].Flags & MppPolicy::FlagProtect) {
+			MppMemory::MemFree(Snapshot);
+			return STATUS_DEVICE_NOT_READY;
+		}
+	}
+
+	// Acquire writer lock
+	::ExAcquireFastMutex(&PolicyLock);
+
+	// Publish the new policy, the previous one is no longer read once replaced
+	Index->Generation       = ++PolicyGeneration;
+	Result->Generation      = Index->Generation;
+	Result->Revision        = Index->Revision;
+	Result->NumberOfEntries = Index->NumberOfKeys;
+	PVOID Previous = MppRcu::Replace(&Policy, Index);
+
+	// Release writer lock
+	::ExReleaseFastMutex(&PolicyLock);
+	if (Previous != nullptr)
+		MppMemory::MemFree(Previous);
+
+	MppLogger::Trace<MppEvents::EventPolicyLoaded>(
+		Result->Generation,
+		Result->Revision,
+		Result->NumberOfEntries
+	);
 	return STATUS_SUCCESS;
 }
 
 
+_Use_decl_annotations_
+VOID __declspec(code_seg("PAGE"))
+MppCallbackData::Free() {
+	// Ensure current IRQL allow paging.
+	PAGED_CODE();
+
+	PVOID Compiled = MppRcu::Replace(&ImageNames, nullptr);
+	if (Compiled != nullptr)
+		MppMemory::MemFree(Compiled);
+	PVOID Index = MppRcu::Replace(&Policy, nullptr);
+	if (Index != nullptr)
+		MppMemory::MemFree(Index);
+
+	// Entries of the image names, only read by the writers
+	while (!::IsListEmpty(&HeadImageNames))
+		MppMemory::MemFree(CONTAINING_RECORD(::RemoveHeadList(&HeadImageNames), ImageNameEntry, List));
+	NumberOfImageNames = 0x00;
+	ImageNamesLength   = 0x00;
+}
+
+
+_Use_decl_annotations_
+NTSTATUS __declspec(code_seg("PAGE"))
+MppCallbackData::CompileImageNames() {
+	// Ensure current IRQL allow paging.
+	PAGED_CODE();
+
+	// The automaton is followed by the patterns, only needed while compiling
+	SIZE_T MatcherSize = MppMatcher::GetCompiledSize(NumberOfImageNames, ImageNamesLength);
+	SIZE_T BufferSize  = MatcherSize + (NumberOfImageNames * sizeof(MppMatcher::MPP_MATCHER_PATTERN));
+
+	auto Buffer = MppMemory::MemAlloc<PUCHAR>(BufferSize);
+	if (Buffer == nullptr)
+		return STATUS_NO_MEMORY;
+	auto Patterns = reinterpret_cast<MppMatcher::MPP_MATCHER_PATTERN*>(Buffer + MatcherSize);
+
+	// Compile the names
+	PLIST_ENTRY Head = HeadImageNames.Flink;
+	for (ULONG cx = 0x00; cx < NumberOfImageNames; cx++, Head = Head->Flink) {
+		auto Entry = CONTAINING_RECORD(Head, ImageNameEntry, List);
+		Patterns[cx].Buffer = Entry->Name;
+		Patterns[cx].Length = Entry->Length;
+	}
+
+	MppMatcher::MPP_MATCHER* Matcher = MppMatcher::Compile(Patterns, NumberOfImageNames, Buffer, MatcherSize);
+	if (Matcher == nullptr) {
+		MppMemory::MemFree(Buffer);
+		return STATUS_UNSUCCESSFUL;
+	}
+
+	// Publish the new automaton, the previous one is no longer read once replaced
+	PVOID Previous = MppRcu::Replace(&ImageNames, Matcher);
+	if (Previous != nullptr)
+		MppMemory::MemFree(Previous);
+	return STATUS_SUCCESS;
+}
+
+
+_Use_decl_annotations_
+MppCallbackData::ImageNameEntry* __declspec(code_seg("PAGE"))
+MppCallbackData::AllocateImageName(
+	_In_reads_(Length) CONST WCHAR* ImageName,
+	_In_               ULONG        Length
+) {
+	// Ensure current IRQL allow paging.
+	PAGED_CODE();
+
+	auto Entry = MppMemory::MemAlloc<ImageNameEntry*>(
+		FIELD_OFFSET(ImageNameEntry, Name) + ((Length + 1) * sizeof(WCHAR))
+	);
+	if (Entry == nullptr)
+		return nullptr;
+
+	RtlCopyMemory(Entry->Name, ImageName, Length * sizeof(WCHAR));
+	Entry->Name[Length] = L'\0';
+	Entry->Length       = Length;
+	return Entry;
+}
+
+
 _Use_decl_annotations_
 HRESULT __declspec(code_seg("PAGE"))
 MppKernelRoutines::GetNtKernelBase() {
@@ -292,4 +658,133 @@ MppKernelRoutines::GetNtKernelBase() {
 	// Cleanup and return
 	MppMemory::MemFree(ExtendedInfo);
 	return STATUS_SUCCESS;
+}
+
+
+_Use_decl_annotations_
+NTSTATUS __declspec(code_seg("PAGE"))
+MppTracing::Initialise() {
+	PAGED_CODE();
+
+	// One ring per processor, the processors above the last ring sharing the rings
+	ULONG NumberOfRings = ::KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS);
+	if (NumberOfRings > MppTrace::MaximumRings)
+		NumberOfRings = MppTrace::MaximumRings;
+	SIZE_T Size = MppTrace::GetSize(NumberOfRings, RingSize);
+
+	// Non-paged, written at DISPATCH_LEVEL, and aligned on a page to be mapped without leaking pool
+	PVOID Buffer = ::ExAllocatePool2(POOL_FLAG_NON_PAGED, Size, MppGlobals::PoolTag);
+	if (Buffer == nullptr)
+		return STATUS_NO_MEMORY;
+	ASSERT(((ULONG_PTR)Buffer & (PAGE_SIZE - 1)) == 0x00);
+
+	TraceMdl = ::IoAllocateMdl(Buffer, (ULONG)Size, FALSE, FALSE, nullptr);
+	if (TraceMdl == nullptr) {
+		::ExFreePoolWithTag(Buffer, MppGlobals::PoolTag);
+		return STATUS_NO_MEMORY;
+	}
+	::MmBuildMdlForNonPagedPool(TraceMdl);
+
+	Trace = MppTrace::Initialise(Buffer, NumberOfRings, RingSize);
+	return STATUS_SUCCESS;
+}
+
+
+_Use_decl_annotations_
+VOID __declspec(code_seg("PAGE"))
+MppTracing::Free() {
+	PAGED_CODE();
+
+	// The views have been unmapped when their handle was closed
+	if (TraceMdl != nullptr)
+		::IoFreeMdl(TraceMdl);
+	if (Trace != nullptr)
+		::ExFreePoolWithTag(Trace, MppGlobals::PoolTag);
+	TraceMdl = nullptr;
+	Trace    = nullptr;
+}
+
+
+_Use_decl_annotations_
+NTSTATUS __declspec(code_seg("PAGE"))
+MppTracing::MapView(
+	_In_  PFILE_OBJECT              FileObject,
+	_Out_ MppIoctl::MPP_TRACE_VIEW* View
+) {
+	PAGED_CODE();
+	if (Trace == nullptr)
+		return STATUS_NOT_SUPPORTED;
+
+	// Mapped once per handle, into the process that asked for it
+	auto Mapping = static_cast<MPP_TRACE_MAPPING*>(FileObject->FsContext);
+	if (Mapping == nullptr) {
+		Mapping = MppMemory::MemAlloc<MPP_TRACE_MAPPING*>(sizeof(MPP_TRACE_MAPPING));
+		if (Mapping == nullptr)
+			return STATUS_NO_MEMORY;
+		Mapping->Address = nullptr;
+		Mapping->Process = ::PsGetCurrentProcess();
+
+		// Read-only, raises an exception when out of address space
+		__try {
+			Mapping->Address = ::MmMapLockedPagesSpecifyCache(
+				TraceMdl,
+				UserMode,
+				MmCached,
+				nullptr,
+				FALSE,
+				(ULONG)NormalPagePriority | MdlMappingNoWrite | MdlMappingNoExecute
+			);
+		}
+		__except (EXCEPTION_EXECUTE_HANDLER) {
+			Mapping->Address = nullptr;
+		}
+		if (Mapping->Address == nullptr) {
+			MppMemory::MemFree(Mapping);
+			return STATUS_INSUFFICIENT_RESOURCES;
+		}
+		::ObReferenceObject(Mapping->Process);
+
+		// Another request of the same handle may have mapped it first
+		if (::InterlockedCompareExchangePointer(&FileObject->FsContext, Mapping, nullptr) != nullptr) {
+			::MmUnmapLockedPages(Mapping->Address, TraceMdl);
+			::ObDereferenceObject(Mapping->Process);
+			MppMemory::MemFree(Mapping);
+			Mapping = static_cast<MPP_TRACE_MAPPING*>(FileObject->FsContext);
+		}
+	}
+
+	// The view only exists in the address space of its process
+	if (Mapping->Process != ::PsGetCurrentProcess())
+		return STATUS_ACCESS_DENIED;
+
+	View->Address = (ULONG64)(ULONG_PTR)Mapping->Address;
+	View->Size    = Trace->Size;
+	return STATUS_SUCCESS;
+}
+
+
+_Use_decl_annotations_
+VOID __declspec(code_seg("PAGE"))
+MppTracing::UnmapView(
+	_In_ PFILE_OBJECT FileObject
+) {
+	PAGED_CODE();
+
+	auto Mapping = static_cast<MPP_TRACE_MAPPING*>(
+		::InterlockedExchangePointer(&FileObject->FsContext, nullptr)
+	);
+	if (Mapping == nullptr)
+		return;
+
+	// The last handle may be closed by another process it has been duplicated to
+	KAPC_STATE ApcState = { 0x00 };
+	BOOLEAN    Attached = Mapping->Process != ::PsGetCurrentProcess();
+	if (Attached)
+		::KeStackAttachProcess(Mapping->Process, &ApcState);
+	::MmUnmapLockedPages(Mapping->Address, TraceMdl);
+	if (Attached)
+		::KeUnstackDetachProcess(&ApcState);
+
+	::ObDereferenceObject(Mapping->Process);
+	MppMemory::MemFree(Mapping);
 }
\ No newline at end of file
@@ -11,14 +11,23 @@ Memory Patching Protection (MPP) Global Kernel Data.
 #ifndef __MPP_MPP_H_GUARD__
 #define __MPP_MPP_H_GUARD__
 
+#ifndef _NTIFS_
 #include <ntifs.h>
 #include <ntddk.h>
 #include <wdmsec.h>
+#endif // !_NTIFS_
 
 #ifndef _AUX_KLIB_H
 #include <aux_klib.h>
 #endif // !_AUX_KLIB_H
 
+#include "matcher.hpp"
+#include "rcu.hpp"
+#include "diff.hpp"
+#include "policy.hpp"
+#include "stats.hpp"
+#include "events.hpp"
+
 
 /// @brief MPP Global variables
 namespace MppGlobals {
@@ -33,6 +42,9 @@ namespace MppGlobals {
 
 	/// @brief Unique Identifier for the kernel device driver - {F394F785-1D05-4C02-A3C5-6E3DC8F0BAD9}.
 	extern CONST GUID DeviceId;
+
+	/// @brief Counters and latencies of the image loading path.
+	extern MppStats::MPP_STATS Statistics;
 }
 
 
@@ -65,6 +77,63 @@ namespace MppIoctl {
 		);
 	}
 
+	constexpr ULONG MppVerifyIntegrity() {
+		return (ULONG)CTL_CODE(\
+			0x8000,            /* DeviceType */\
+			0x803,             /* Function   */\
+			METHOD_BUFFERED,   /* Method     */\
+			FILE_ANY_ACCESS    /* Access     */\
+		);
+	}
+
+	constexpr ULONG MppDiffImage() {
+		return (ULONG)CTL_CODE(\
+			0x8000,            /* DeviceType */\
+			0x804,             /* Function   */\
+			METHOD_BUFFERED,   /* Method     */\
+			FILE_ANY_ACCESS    /* Access     */\
+		);
+	}
+
+	constexpr ULONG MppUpdateImageNames() {
+		return (ULONG)CTL_CODE(\
+			0x8000,            /* DeviceType */\
+			0x805,             /* Function   */\
+			METHOD_BUFFERED,   /* Method     */\
+			FILE_ANY_ACCESS    /* Access     */\
+		);
+	}
+
+	constexpr ULONG MppLoadPolicy() {
+		return (ULONG)CTL_CODE(\
+			0x8000,            /* DeviceType */\
+			0x806,             /* Function   */\
+			METHOD_BUFFERED,   /* Method     */\
+			FILE_ANY_ACCESS    /* Access     */\
+		);
+	}
+
+	constexpr ULONG MppQueryStatistics() {
+		return (ULONG)CTL_CODE(\
+			0x8000,            /* DeviceType */\
+			0x807,             /* Function   */\
+			METHOD_BUFFERED,   /* Method     */\
+			FILE_ANY_ACCESS    /* Access     */\
+		);
+	}
+
+	constexpr ULONG MppMapTrace() {
+		return (ULONG)CTL_CODE(\
+			0x8000,            /* DeviceType */\
+			0x808,             /* Function   */\
+			METHOD_BUFFERED,   /* Method     */\
+			FILE_ANY_ACCESS    /* Access     */\
+		);
+	}
+
+	/// @brief Flag of `MppUpdateImageNames` removing all the image names before adding the new ones.
+	constexpr ULONG MppImageNamesReplace = 0x01;
+
 	/// @brief Data structure for `MppInitialiseKernelRoutines` input buffer IOCTL.
 	typedef struct _MPP_KERNEL_ROUTINES_OFFSETS {
 		ULONG MiAddSecureEntry;
@@ -83,6 +152,104 @@ namespace MppIoctl {
 		SIZE_T Size;
 		WCHAR  Name[260];
 	} MPP_ADD_IMAGE_NAME, * PMPP_ADD_IMAGE_NAME;
+
+	/// @brief Data structure for `MppVerifyIntegrity` output buffer IOCTL.
+	typedef struct _MPP_INTEGRITY_RESULT {
+		ULONG NumberOfRanges; // Ranges verified
+		ULONG Intact;         // Same as their baseline
+		ULONG Modified;       // Different from their baseline
+		ULONG Unavailable;    // Process exited or range unmapped
+	} MPP_INTEGRITY_RESULT, * PMPP_INTEGRITY_RESULT;
+
+	/// @brief Data structure for `MppDiffImage` input buffer IOCTL.
+	typedef struct _MPP_DIFF_IMAGE {
+		ULONG64 ProcessId; // 0 for a kernel module
+		ULONG64 ImageBase;
+	} MPP_DIFF_IMAGE, * PMPP_DIFF_IMAGE;
+
+	/// @brief Data structure for `MppDiffImage` output buffer IOCTL, followed by as many entries as fit.
+	typedef struct _MPP_DIFF_RESULT {
+		ULONG                   NumberOfRanges;      // Executable ranges compared
+		ULONG                   NumberOfDifferences; // Differences found
+		ULONG                   NumberOfEntries;     // Differences returned
+		ULONG                   UnreadablePages;     // Pages not compared
+		MppDiff::MPP_DIFF_ENTRY Entries[ANYSIZE_ARRAY];
+	} MPP_DIFF_RESULT, * PMPP_DIFF_RESULT;
+
+	/// @brief Image name packed in the `MppUpdateImageNames` input buffer, directly followed by the next one.
+	typedef struct _MPP_IMAGE_NAME {
+		USHORT Length; // Number of characters, without terminator
+		WCHAR  Name[ANYSIZE_ARRAY];
+	} MPP_IMAGE_NAME, * PMPP_IMAGE_NAME;
+
+	/// @brief Data structure for `MppUpdateImageNames` input buffer IOCTL.
+	typedef struct _MPP_IMAGE_NAMES {
+		ULONG  Flags;
+		ULONG  NumberOfAdded;   // Names added, first in the list
+		ULONG  NumberOfRemoved; // Names removed, following the added ones
+		USHORT Names[ANYSIZE_ARRAY]; // Packed MPP_IMAGE_NAME
+	} MPP_IMAGE_NAMES, * PMPP_IMAGE_NAMES;
+
+	/// @brief Data structure for `MppLoadPolicy` output buffer IOCTL, the input buffer being a binary policy.
+	typedef struct _MPP_POLICY_RESULT {
+		ULONG Generation;      // Incremented by each policy loaded, from 1
+		ULONG Revision;        // Set by the author of the policy
+		ULONG NumberOfEntries;
+	} MPP_POLICY_RESULT, * PMPP_POLICY_RESULT;
+
+	/// @brief Data structure for `MppMapTrace` output buffer IOCTL, the trace being mapped read-only.
+	typedef struct _MPP_TRACE_VIEW {
+		ULONG64 Address; // Address of the trace in the calling process
+		ULONG64 Size;
+	} MPP_TRACE_VIEW, * PMPP_TRACE_VIEW;
+}
+
+
+/// @brief Binary trace of the driver, mapped into the clients.
+namespace MppTracing {
+
+	/// @brief Size of the data of the ring of each processor.
+	constexpr ULONG RingSize = 0x4000;
+
+	/// @brief Trace written by the driver, nullptr if it could not be allocated.
+	extern MppTrace::MPP_TRACE_HEADER* Trace;
+
+	/// @brief Pages of the trace, mapped into the clients.
+	extern PMDL TraceMdl;
+
+	/// @brief View of the trace mapped into a client, attached to the file object of its handle.
+	typedef struct _MPP_TRACE_MAPPING {
+		PVOID     Address;
+		PEPROCESS Process;
+	} MPP_TRACE_MAPPING, * PMPP_TRACE_MAPPING;
+
+	/// @brief Allocate the trace, one ring per processor.
+	NTSTATUS __declspec(code_seg("PAGE"))
+	_IRQL_requires_max_(PASSIVE_LEVEL)
+	Initialise();
+
+	/// @brief Free the trace, once nothing writes to it anymore.
+	VOID __declspec(code_seg("PAGE"))
+	_IRQL_requires_max_(PASSIVE_LEVEL)
+	Free();
+
+	/// @brief Map the trace read-only into the calling process, once per handle.
+	/// @param FileObject File object of the handle.
+	/// @param View       Receives the address of the trace.
+	NTSTATUS __declspec(code_seg("PAGE"))
+	_IRQL_requires_max_(PASSIVE_LEVEL)
+	MapView(
+		_In_  PFILE_OBJECT              FileObject,
+		_Out_ MppIoctl::MPP_TRACE_VIEW* View
+	);
+
+	/// @brief Unmap the trace from the process of a handle being closed.
+	/// @param FileObject File object of the handle.
+	VOID __declspec(code_seg("PAGE"))
+	_IRQL_requires_max_(PASSIVE_LEVEL)
+	UnmapView(
+		_In_ PFILE_OBJECT FileObject
+	);
 }
 
 
@@ -103,6 +270,50 @@ namespace MppLogger {
 		::KdPrint((Args...));
 #endif
 	}
+
+	/// @brief Argument of an event.
+	template<typename T>
+	_inline ULONG64 ToArgument(T Value) {
+		return (ULONG64)Value;
+	}
+
+	/// @brief Argument of an event, from an address or a handle.
+	template<typename T>
+	_inline ULONG64 ToArgument(T* Value) {
+		return (ULONG64)(ULONG_PTR)Value;
+	}
+
+	/// @brief Argument of an event, from a status not sign extended.
+	_inline ULONG64 ToArgument(LONG Value) {
+		return (ULONG64)(ULONG)Value;
+	}
+
+	/// @brief Write an event to the trace, the arguments being checked against its descriptor.
+	template<MppEvents::MPP_EVENT Event, typename... Arguments>
+	_inline VOID Trace(Arguments... Args) {
+		static_assert(Event != MppEvents::EventPadding && Event < MppEvents::NumberOfEvents, "Unknown event");
+		static_assert(MppEvents::Descriptors[Event].NumberOfArguments == sizeof...(Args), "Wrong number of arguments");
+
+		CONST ULONG64 Values[] = { ToArgument(Args)..., 0x00 };
+		MppTrace::Write(MppTracing::Trace, Event, Values, sizeof...(Args), nullptr, 0x00);
+	}
+
+	/// @brief Write an event with the name of a file to the trace, keeping the end of a long name.
+	template<MppEvents::MPP_EVENT Event, typename... Arguments>
+	_inline VOID TraceName(_In_opt_ PCUNICODE_STRING Name, Arguments... Args) {
+		static_assert(Event != MppEvents::EventPadding && Event < MppEvents::NumberOfEvents, "Unknown event");
+		static_assert(MppEvents::Descriptors[Event].NumberOfArguments == sizeof...(Args), "Wrong number of arguments");
+
+		CONST ULONG64 Values[] = { ToArgument(Args)..., 0x00 };
+		if (Name == nullptr || Name->Buffer == nullptr) {
+			MppTrace::Write(MppTracing::Trace, Event, Values, sizeof...(Args), nullptr, 0x00);
+			return;
+		}
+
+		USHORT Length = Name->Length & ~(USHORT)0x01;
+		USHORT Skip   = Length > MppTrace::MaximumData ? (USHORT)(Length - MppTrace::MaximumData) : 0x00;
+		MppTrace::Write(MppTracing::Trace, Event, Values, sizeof...(Args), (PUCHAR)Name->Buffer + Skip, Length - Skip);
+	}
 }
 
 
@@ -132,7 +343,7 @@ namespace MppMemory {
 		_In_ PIO_STACK_LOCATION IoStack,
 		_In_ ULONG              Size
 	) {
-		return (IoStack->Parameters.DeviceIoControl.InputBufferLength <= Size);
+		return (IoStack->Parameters.DeviceIoControl.InputBufferLength >= Size);
 	}
 }
 
@@ -167,8 +378,23 @@ namespace MppCallbackData {
 	/// @brief Number of image names to check for each modules being loaded.
 	extern ULONG          NumberOfImageNames;
 
-	/// @brief Spin lock for double-linked list of image names.
-	extern KSPIN_LOCK     ImageNamesLock;
+	/// @brief Sum of the length of the image names, in characters.
+	extern SIZE_T         ImageNamesLength;
+
+	/// @brief Mutex serialising the writers of the image names.
+	extern FAST_MUTEX     ImageNamesLock;
+
+	/// @brief Image names compiled into one automaton, published to the callback.
+	extern MppRcu::MPP_RCU_DOMAIN ImageNames;
+
+	/// @brief Mutex serialising the writers of the policy.
+	extern FAST_MUTEX     PolicyLock;
+
+	/// @brief Index of the current policy, followed by the policy itself, published to the callback.
+	extern MppRcu::MPP_RCU_DOMAIN Policy;
+
+	/// @brief Generation of the last policy loaded, 0 if none.
+	extern ULONG          PolicyGeneration;
 
 	/// @brief Add new image name in the `HeadImageNames` double-linked list..
 	/// @param ImageName     Name of the image to add.
@@ -181,7 +407,7 @@ namespace MppCallbackData {
 		_In_  SIZE_T  ImageNameSize
 	);
 
-	/// @brief Remove image name from `HeadImageNames` double-linked list.
+	/// @brief Remove image name from `HeadImageNames` double-linked list, the names being the same.
 	/// @param ImageName Name of the entry to remove from the list.
 	NTSTATUS __declspec(code_seg("PAGE"))
 	_IRQL_requires_min_(APC_LEVEL)
@@ -190,13 +416,63 @@ namespace MppCallbackData {
 		_In_ LPWSTR ImageName
 	);
 
-	/// @brief Structure used to store each image names to protect.
+	/// @brief Add and remove a batch of image names, published at once. An entry is removed if its name
+	/// is the same as a name removed, as with `RemoveImageName`. Names are only added once the kernel
+	/// routines are initialised, STATUS_DEVICE_NOT_READY being returned before.
+	/// @param Names Names to add and to remove.
+	/// @param Size  Size of the names, in bytes.
+	NTSTATUS __declspec(code_seg("PAGE"))
+	_IRQL_requires_max_(APC_LEVEL)
+	UpdateImageNames(
+		_In_reads_bytes_(Size) CONST MppIoctl::MPP_IMAGE_NAMES* Names,
+		_In_                   SIZE_T                           Size
+	);
+
+	/// @brief Validate a binary policy and replace the current one at once. A policy securing ranges
+	/// is refused with STATUS_DEVICE_NOT_READY until the kernel routines are initialised.
+	/// @param Buffer Binary policy.
+	/// @param Size   Size of the policy, in bytes.
+	/// @param Result Receives the generation of the policy.
+	NTSTATUS __declspec(code_seg("PAGE"))
+	_IRQL_requires_max_(APC_LEVEL)
+	LoadPolicy(
+		_In_reads_bytes_(Size) CONST VOID*                  Buffer,
+		_In_                   SIZE_T                       Size,
+		_Out_                  MppIoctl::MPP_POLICY_RESULT* Result
+	);
+
+	/// @brief Free the image names, compiled or not, and the policy. The callback is no longer running.
+	VOID __declspec(code_seg("PAGE"))
+	_IRQL_requires_max_(APC_LEVEL)
+	Free();
+
+	/// @brief Compile the `HeadImageNames` double-linked list and publish it in `ImageNames`.
+	/// The caller holds `ImageNamesLock`.
+	NTSTATUS __declspec(code_seg("PAGE"))
+	_IRQL_requires_min_(APC_LEVEL)
+	_IRQL_requires_max_(APC_LEVEL)
+	CompileImageNames();
+
+	/// @brief Largest image name, in characters with the terminator.
+	constexpr ULONG MaximumImageName = 260;
+
+	/// @brief Structure used to store each image names to protect, allocated to the size of the name.
 	typedef struct ImageNameEntry {
 		LIST_ENTRY List;
 
-		SIZE_T Size;
-		WCHAR  Name[260];
+		ULONG  Length; // Number of characters of the name, without the terminator
+		WCHAR  Name[ANYSIZE_ARRAY];
 	} ImageNameEntry;
+
+	/// @brief Allocate the entry of an image name, to be freed with MppMemory::MemFree.
+	/// @param ImageName Name of the image, not necessarily terminated.
+	/// @param Length    Number of characters of the name.
+	ImageNameEntry* __declspec(code_seg("PAGE"))
+	_IRQL_requires_max_(APC_LEVEL)
+	AllocateImageName(
+		_In_reads_(Length) CONST WCHAR* ImageName,
+		_In_               ULONG        Length
+	);
 }
 
 
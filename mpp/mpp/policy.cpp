@@ -0,0 +1,589 @@
+/*+================================================================================================
+Module Name: policy.cpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+Abstract:
+Memory Patching Protection (MPP) protection policy.
+A policy is a list of image name patterns, each with a match mode and the protections to apply.
+It is written as a text specification, compiled by the client into a compact binary policy, and
+validated and indexed by the driver before replacing the current one. The routines neither allocate
+nor depend on the kernel, so that the client and the driver share them.
+================================================================================================+*/
+
+#include "policy.hpp"
+
+
+/// @brief Helpers of the policy.
+namespace MppPolicy {
+
+	constexpr ULONG ChecksumBasis = 0x811C9DC5;
+	constexpr ULONG ChecksumPrime = 0x01000193;
+
+	/// @brief Line of a text specification being tokenised.
+	typedef struct _MPP_POLICY_LINE {
+		CONST CHAR* Cursor;
+		CONST CHAR* End;
+	} MPP_POLICY_LINE, * PMPP_POLICY_LINE;
+
+	/// @brief FNV-1a of a buffer.
+	static ULONG Checksum(
+		_In_reads_bytes_(Size) CONST UCHAR* Buffer,
+		_In_                   SIZE_T       Size
+	) {
+		ULONG Hash = ChecksumBasis;
+		for (SIZE_T cx = 0x00; cx < Size; cx++)
+			Hash = (Hash ^ Buffer[cx]) * ChecksumPrime;
+		return Hash;
+	}
+
+	/// @brief Lower case of the ASCII characters, the names being compared ignoring their case.
+	static _inline WCHAR Fold(
+		_In_ WCHAR Character
+	) {
+		return (Character >= L'A' && Character <= L'Z') ? (WCHAR)(Character + (L'a' - L'A')) : Character;
+	}
+
+	/// @brief Compare two names by length, then from their last character as paths mostly differ at the end.
+	/// Only equality matters to the lookup, the order just has to be total.
+	static LONG CompareNames(
+		_In_reads_(LeftLength)  CONST WCHAR* Left,
+		_In_                    SIZE_T       LeftLength,
+		_In_reads_(RightLength) CONST WCHAR* Right,
+		_In_                    SIZE_T       RightLength
+	) {
+		if (LeftLength != RightLength)
+			return LeftLength < RightLength ? -1 : 1;
+
+		for (SIZE_T cx = LeftLength; cx > 0x00; cx--) {
+			WCHAR L = Fold(Left[cx - 1]);
+			WCHAR R = Fold(Right[cx - 1]);
+			if (L != R)
+				return L < R ? -1 : 1;
+		}
+		return 0x00;
+	}
+
+	/// @brief Compare two keys.
+	static _inline LONG CompareKeys(
+		_In_ CONST MPP_POLICY_KEY* Left,
+		_In_ CONST MPP_POLICY_KEY* Right
+	) {
+		return CompareNames(Left->Name, Left->Length, Right->Name, Right->Length);
+	}
+
+	/// @brief Heap sort, in place and without allocation.
+	template<typename T, typename Less>
+	static VOID HeapSort(
+		_Inout_updates_(Count) T*     Items,
+		_In_                   ULONG  Count,
+		_In_                   Less   IsLess
+	) {
+		auto SiftDown = [&](ULONG Root, ULONG Limit) {
+			for (;;) {
+				ULONG Child = (Root * 2) + 1;
+				if (Child >= Limit)
+					return;
+				if (Child + 1 < Limit && IsLess(Items[Child], Items[Child + 1]))
+					Child++;
+				if (!IsLess(Items[Root], Items[Child]))
+					return;
+				T Swap        = Items[Root];
+				Items[Root]   = Items[Child];
+				Items[Child]  = Swap;
+				Root          = Child;
+			}
+		};
+
+		for (ULONG cx = Count / 2; cx > 0x00; cx--)
+			SiftDown(cx - 1, Count);
+		for (ULONG cx = Count; cx > 0x01; cx--) {
+			T Swap         = Items[0x00];
+			Items[0x00]    = Items[cx - 1];
+			Items[cx - 1]  = Swap;
+			SiftDown(0x00, cx - 1);
+		}
+	}
+
+	/// @brief Next token of a line, a quoted token possibly containing spaces.
+	/// @return Whether there is a token, FALSE at the end of the line or if a quote is not closed.
+	static BOOLEAN NextToken(
+		_Inout_ MPP_POLICY_LINE* Line,
+		_Out_   CONST CHAR**     Token,
+		_Out_   SIZE_T*          Length,
+		_Out_   BOOLEAN*         Unterminated
+	) {
+		*Token        = nullptr;
+		*Length       = 0x00;
+		*Unterminated = FALSE;
+
+		while (Line->Cursor < Line->End && (*Line->Cursor == ' ' || *Line->Cursor == '\t'))
+			Line->Cursor++;
+		if (Line->Cursor == Line->End || *Line->Cursor == '#')
+			return FALSE;
+
+		CONST CHAR* Start = Line->Cursor;
+		if (*Start == '"') {
+			Start++;
+			Line->Cursor = Start;
+			while (Line->Cursor < Line->End && *Line->Cursor != '"')
+				Line->Cursor++;
+			if (Line->Cursor == Line->End) {
+				*Unterminated = TRUE;
+				return FALSE;
+			}
+			*Token  = Start;
+			*Length = (SIZE_T)(Line->Cursor - Start);
+			Line->Cursor++;
+			return TRUE;
+		}
+
+		while (Line->Cursor < Line->End && *Line->Cursor != ' ' && *Line->Cursor != '\t' && *Line->Cursor != '#')
+			Line->Cursor++;
+		*Token  = Start;
+		*Length = (SIZE_T)(Line->Cursor - Start);
+		return TRUE;
+	}
+
+	/// @brief Whether a token is a keyword.
+	static BOOLEAN IsKeyword(
+		_In_reads_(Length) CONST CHAR* Token,
+		_In_               SIZE_T      Length,
+		_In_               CONST CHAR* Keyword
+	) {
+		SIZE_T cx = 0x00;
+		for (; cx < Length && Keyword[cx] != '\0'; cx++) {
+			if (Token[cx] != Keyword[cx])
+				return FALSE;
+		}
+		return cx == Length && Keyword[cx] == '\0';
+	}
+
+	/// @brief Decode a name from UTF-8 to UTF-16, in lower case.
+	/// @param Output     Receives the characters, may be nullptr to count them.
+	/// @param Characters Receives the number of characters.
+	/// @return Whether the name is valid UTF-8 without NULL character.
+	static BOOLEAN DecodeName(
+		_In_reads_(Length) CONST CHAR* Token,
+		_In_               SIZE_T      Length,
+		_Out_opt_          WCHAR*      Output,
+		_Out_              ULONG*      Characters
+	) {
+		*Characters = 0x00;
+		CONST UCHAR* Bytes = reinterpret_cast<CONST UCHAR*>(Token);
+
+		for (SIZE_T cx = 0x00; cx < Length;) {
+			ULONG  Point = Bytes[cx];
+			SIZE_T Extra = 0x00;
+			if (Point == 0x00)
+				return FALSE;
+			else if (Point < 0x80)
+				Extra = 0x00;
+			else if ((Point & 0xE0) == 0xC0)
+				Point &= 0x1F, Extra = 0x01;
+			else if ((Point & 0xF0) == 0xE0)
+				Point &= 0x0F, Extra = 0x02;
+			else if ((Point & 0xF8) == 0xF0)
+				Point &= 0x07, Extra = 0x03;
+			else
+				return FALSE;
+
+			if (Extra > (Length - cx - 1))
+				return FALSE;
+			for (SIZE_T dx = 0x01; dx <= Extra; dx++) {
+				if ((Bytes[cx + dx] & 0xC0) != 0x80)
+					return FALSE;
+				Point = (Point << 0x06) | (Bytes[cx + dx] & 0x3F);
+			}
+			cx += Extra + 1;
+
+			// Overlong encodings, surrogates and points outside of Unicode
+			static CONST ULONG Minimum[0x04] = { 0x00, 0x80, 0x800, 0x10000 };
+			if (Point < Minimum[Extra] || Point > 0x10FFFF || (Point >= 0xD800 && Point <= 0xDFFF))
+				return FALSE;
+
+			if (Point < 0x10000) {
+				if (Output != nullptr)
+					Output[*Characters] = Fold((WCHAR)Point);
+				*Characters += 1;
+			}
+			else {
+				if (Output != nullptr) {
+					Output[*Characters]     = (WCHAR)(0xD800 + ((Point - 0x10000) >> 0x0A));
+					Output[*Characters + 1] = (WCHAR)(0xDC00 + ((Point - 0x10000) & 0x3FF));
+				}
+				*Characters += 2;
+			}
+		}
+		return TRUE;
+	}
+
+	/// @brief Parse a text specification, counting the entries and characters, and writing them if requested.
+	/// @param Header     Receives the revision and the counts.
+	/// @param Entries    Receives the entries, may be nullptr to count them.
+	/// @param Names      Receives the characters of the names, may be nullptr to count them.
+	/// @param ErrorLine  Receives the line of the error.
+	static MPP_POLICY_STATUS Parse(
+		_In_reads_bytes_(TextSize) CONST CHAR*        Text,
+		_In_                       SIZE_T             TextSize,
+		_Out_                      MPP_POLICY_HEADER* Header,
+		_Out_opt_                  MPP_POLICY_ENTRY*  Entries,
+		_Out_opt_                  WCHAR*             Names,
+		_Out_                      ULONG*             ErrorLine
+	) {
+		Header->Revision           = 0x00;
+		Header->NumberOfEntries    = 0x00;
+		Header->NumberOfCharacters = 0x00;
+
+		BOOLEAN     Revision   = FALSE;
+		ULONG       LineNumber = 0x00;
+		CONST CHAR* Cursor     = Text;
+		CONST CHAR* End        = Text + TextSize;
+		while (Cursor < End) {
+			MPP_POLICY_LINE Line = { Cursor, Cursor };
+			while (Line.End < End && *Line.End != '\n')
+				Line.End++;
+			Cursor = Line.End < End ? Line.End + 1 : End;
+			if (Line.End > Line.Cursor && *(Line.End - 1) == '\r')
+				Line.End--;
+			*ErrorLine = ++LineNumber;
+
+			CONST CHAR* Token        = nullptr;
+			SIZE_T      Length       = 0x00;
+			BOOLEAN     Unterminated = FALSE;
+			if (!NextToken(&Line, &Token, &Length, &Unterminated)) {
+				if (Unterminated)
+					return PolicySyntaxError;
+				continue;
+			}
+
+			// Revision of the policy, once
+			if (IsKeyword(Token, Length, "revision")) {
+				if (Revision || !NextToken(&Line, &Token, &Length, &Unterminated) || Length == 0x00)
+					return PolicySyntaxError;
+
+				ULONG64 Value = 0x00;
+				for (SIZE_T cx = 0x00; cx < Length; cx++) {
+					if (Token[cx] < '0' || Token[cx] > '9')
+						return PolicySyntaxError;
+					Value = (Value * 10) + (ULONG64)(Token[cx] - '0');
+					if (Value > 0xFFFFFFFF)
+						return PolicyTooLarge;
+				}
+				if (NextToken(&Line, &Token, &Length, &Unterminated) || Unterminated)
+					return PolicySyntaxError;
+
+				Header->Revision = (ULONG)Value;
+				Revision         = TRUE;
+				continue;
+			}
+
+			// Entry, with its mode, its name and its protections
+			UCHAR Mode = NumberOfModes;
+			if (IsKeyword(Token, Length, "suffix"))
+				Mode = MatchSuffix;
+			else if (IsKeyword(Token, Length, "exact"))
+				Mode = MatchExact;
+			else if (IsKeyword(Token, Length, "path"))
+				Mode = MatchPath;
+			else
+				return PolicySyntaxError;
+
+			if (!NextToken(&Line, &Token, &Length, &Unterminated) || Length == 0x00)
+				return PolicySyntaxError;
+
+			ULONG Characters = 0x00;
+			if (!DecodeName(Token, Length, nullptr, &Characters))
+				return PolicySyntaxError;
+			if (Characters > MaximumName || Header->NumberOfEntries >= MaximumEntries)
+				return PolicyTooLarge;
+			if (Mode == MatchExact) {
+				for (SIZE_T cx = 0x00; cx < Length; cx++) {
+					if (Token[cx] == '\\' || Token[cx] == '/')
+						return PolicySyntaxError;
+				}
+			}
+
+			ULONG Flags = 0x00;
+			CONST CHAR* Name       = Token;
+			SIZE_T      NameLength = Length;
+			while (NextToken(&Line, &Token, &Length, &Unterminated)) {
+				if (IsKeyword(Token, Length, "protect"))
+					Flags |= FlagProtect;
+				else if (IsKeyword(Token, Length, "integrity"))
+					Flags |= FlagIntegrity;
+				else
+					return PolicySyntaxError;
+			}
+			if (Unterminated || Flags == 0x00)
+				return PolicySyntaxError;
+
+			if (Entries != nullptr && Names != nullptr) {
+				MPP_POLICY_ENTRY* Entry = &Entries[Header->NumberOfEntries];
+				Entry->NameOffset = Header->NumberOfCharacters;
+				Entry->NameLength = (USHORT)Characters;
+				Entry->Mode       = Mode;
+				Entry->Reserved   = 0x00;
+				Entry->Flags      = Flags;
+				DecodeName(Name, NameLength, Names + Header->NumberOfCharacters, &Characters);
+			}
+			Header->NumberOfEntries++;
+			Header->NumberOfCharacters += Characters;
+		}
+
+		*ErrorLine = 0x00;
+		return PolicySuccess;
+	}
+
+	/// @brief Protections of the keys of a mode equal to a name.
+	static ULONG FindAll(
+		_In_               CONST MPP_POLICY_INDEX* Index,
+		_In_               UCHAR                   Mode,
+		_In_reads_(Length) CONST WCHAR*            Name,
+		_In_               SIZE_T                  Length
+	) {
+		ULONG Low  = Index->FirstKey[Mode];
+		ULONG High = Index->FirstKey[Mode + 1];
+
+		// First key not lower than the name
+		while (Low < High) {
+			ULONG Middle = Low + ((High - Low) / 2);
+			CONST MPP_POLICY_KEY* Key = &Index->Keys[Middle];
+			if (CompareNames(Key->Name, Key->Length, Name, Length) < 0x00)
+				Low = Middle + 1;
+			else
+				High = Middle;
+		}
+
+		ULONG Flags = 0x00;
+		for (; Low < Index->FirstKey[Mode + 1]; Low++) {
+			CONST MPP_POLICY_KEY* Key = &Index->Keys[Low];
+			if (CompareNames(Key->Name, Key->Length, Name, Length) != 0x00)
+				break;
+			Flags |= Key->Flags;
+		}
+		return Flags;
+	}
+}
+
+
+_Use_decl_annotations_
+MppPolicy::MPP_POLICY_STATUS MppPolicy::Compile(
+	_In_reads_bytes_(TextSize)             CONST CHAR* Text,
+	_In_                                   SIZE_T      TextSize,
+	_Out_writes_bytes_opt_(BufferSize)     PVOID       Buffer,
+	_In_                                   SIZE_T      BufferSize,
+	_Out_                                  ULONG*      PolicySize,
+	_Out_                                  ULONG*      ErrorLine
+) {
+	*PolicySize = 0x00;
+	*ErrorLine  = 0x00;
+
+	// Count the entries and the characters first
+	MPP_POLICY_HEADER Counts = { 0x00 };
+	MPP_POLICY_STATUS Status = Parse(Text, TextSize, &Counts, nullptr, nullptr, ErrorLine);
+	if (Status != PolicySuccess)
+		return Status;
+
+	ULONG64 Size = sizeof(MPP_POLICY_HEADER)
+		+ ((ULONG64)Counts.NumberOfEntries * sizeof(MPP_POLICY_ENTRY))
+		+ ((ULONG64)Counts.NumberOfCharacters * sizeof(WCHAR));
+	if (Size > 0xFFFFFFFF)
+		return PolicyTooLarge;
+	*PolicySize = (ULONG)Size;
+	if (Buffer == nullptr || BufferSize < Size)
+		return PolicyBufferTooSmall;
+
+	// Write the entries and the names
+	auto Header  = static_cast<MPP_POLICY_HEADER*>(Buffer);
+	auto Entries = reinterpret_cast<MPP_POLICY_ENTRY*>(Header + 1);
+	auto Names   = reinterpret_cast<WCHAR*>(Entries + Counts.NumberOfEntries);
+	Parse(Text, TextSize, Header, Entries, Names, ErrorLine);
+
+	Header->Signature  = Signature;
+	Header->Version    = FormatVersion;
+	Header->HeaderSize = sizeof(MPP_POLICY_HEADER);
+	Header->Size       = (ULONG)Size;
+	Header->Reserved   = 0x00;
+	Header->Checksum   = Checksum(reinterpret_cast<CONST UCHAR*>(Header + 1), (SIZE_T)Size - sizeof(MPP_POLICY_HEADER));
+	return PolicySuccess;
+}
+
+
+_Use_decl_annotations_
+BOOLEAN MppPolicy::Validate(
+	_In_reads_bytes_(Size) CONST VOID* Buffer,
+	_In_                   SIZE_T      Size
+) {
+	if (Buffer == nullptr || Size < sizeof(MPP_POLICY_HEADER))
+		return FALSE;
+
+	// Header, and the exact size of what follows it
+	auto Header = static_cast<CONST MPP_POLICY_HEADER*>(Buffer);
+	if (Header->Signature != Signature
+		|| Header->Version != FormatVersion
+		|| Header->HeaderSize != sizeof(MPP_POLICY_HEADER)
+		|| Header->Size != Size
+		|| Header->Reserved != 0x00
+		|| Header->NumberOfEntries > MaximumEntries
+		|| Header->NumberOfCharacters > (MaximumEntries * (ULONG)MaximumName)) {
+		return FALSE;
+	}
+
+	ULONG64 Expected = sizeof(MPP_POLICY_HEADER)
+		+ ((ULONG64)Header->NumberOfEntries * sizeof(MPP_POLICY_ENTRY))
+		+ ((ULONG64)Header->NumberOfCharacters * sizeof(WCHAR));
+	if (Expected != Size)
+		return FALSE;
+	if (Checksum(reinterpret_cast<CONST UCHAR*>(Header + 1), Size - sizeof(MPP_POLICY_HEADER)) != Header->Checksum)
+		return FALSE;
+
+	// Characters of the names, in lower case and without NULL character
+	auto Entries = reinterpret_cast<CONST MPP_POLICY_ENTRY*>(Header + 1);
+	auto Names   = reinterpret_cast<CONST WCHAR*>(Entries + Header->NumberOfEntries);
+	for (ULONG cx = 0x00; cx < Header->NumberOfCharacters; cx++) {
+		if (Names[cx] == L'\0' || Names[cx] != Fold(Names[cx]))
+			return FALSE;
+	}
+
+	// Entries, with a name within the characters
+	for (ULONG cx = 0x00; cx < Header->NumberOfEntries; cx++) {
+		CONST MPP_POLICY_ENTRY* Entry = &Entries[cx];
+		if (Entry->Mode >= NumberOfModes
+			|| Entry->Reserved != 0x00
+			|| Entry->Flags == 0x00
+			|| (Entry->Flags & ~ValidFlags) != 0x00
+			|| Entry->NameLength == 0x00
+			|| Entry->NameLength > MaximumName
+			|| ((ULONG64)Entry->NameOffset + Entry->NameLength) > Header->NumberOfCharacters) {
+			return FALSE;
+		}
+
+		if (Entry->Mode == MatchExact) {
+			for (ULONG dx = 0x00; dx < Entry->NameLength; dx++) {
+				if (Names[Entry->NameOffset + dx] == L'\\' || Names[Entry->NameOffset + dx] == L'/')
+					return FALSE;
+			}
+		}
+	}
+	return TRUE;
+}
+
+
+_Use_decl_annotations_
+SIZE_T MppPolicy::GetIndexSize(
+	_In_ CONST VOID* Buffer
+) {
+	auto Header = static_cast<CONST MPP_POLICY_HEADER*>(Buffer);
+
+	// Index, keys, and the lengths of the suffixes
+	SIZE_T Size = (sizeof(MPP_POLICY_INDEX) + 0x07) & ~(SIZE_T)0x07;
+	Size += (SIZE_T)Header->NumberOfEntries * sizeof(MPP_POLICY_KEY);
+	Size += (SIZE_T)Header->NumberOfEntries * sizeof(ULONG);
+	return Size;
+}
+
+
+_Use_decl_annotations_
+MppPolicy::MPP_POLICY_INDEX* MppPolicy::BuildIndex(
+	_In_                          CONST VOID* Buffer,
+	_Out_writes_bytes_(IndexSize) PVOID       Index,
+	_In_                          SIZE_T      IndexSize
+) {
+	if (Buffer == nullptr || Index == nullptr || IndexSize < GetIndexSize(Buffer))
+		return nullptr;
+
+	auto Header  = static_cast<CONST MPP_POLICY_HEADER*>(Buffer);
+	auto Entries = reinterpret_cast<CONST MPP_POLICY_ENTRY*>(Header + 1);
+	auto Names   = reinterpret_cast<CONST WCHAR*>(Entries + Header->NumberOfEntries);
+
+	PUCHAR Cursor = static_cast<PUCHAR>(Index);
+	auto   Result = reinterpret_cast<MPP_POLICY_INDEX*>(Cursor);
+	Cursor += (sizeof(MPP_POLICY_INDEX) + 0x07) & ~(SIZE_T)0x07;
+
+	Result->Size                  = GetIndexSize(Buffer);
+	Result->Revision              = Header->Revision;
+	Result->Generation            = 0x00;
+	Result->NumberOfKeys          = Header->NumberOfEntries;
+	Result->NumberOfSuffixLengths = 0x00;
+	Result->Keys                  = reinterpret_cast<MPP_POLICY_KEY*>(Cursor);
+	Cursor += (SIZE_T)Header->NumberOfEntries * sizeof(MPP_POLICY_KEY);
+	Result->SuffixLengths         = reinterpret_cast<ULONG*>(Cursor);
+
+	// Keys grouped by mode
+	for (ULONG cx = 0x00; cx <= NumberOfModes; cx++)
+		Result->FirstKey[cx] = 0x00;
+	for (ULONG cx = 0x00; cx < Header->NumberOfEntries; cx++)
+		Result->FirstKey[Entries[cx].Mode + 1]++;
+	for (ULONG cx = 0x01; cx <= NumberOfModes; cx++)
+		Result->FirstKey[cx] += Result->FirstKey[cx - 1];
+
+	ULONG Next[NumberOfModes] = { 0x00 };
+	for (ULONG cx = 0x00; cx < NumberOfModes; cx++)
+		Next[cx] = Result->FirstKey[cx];
+	for (ULONG cx = 0x00; cx < Header->NumberOfEntries; cx++) {
+		CONST MPP_POLICY_ENTRY* Entry = &Entries[cx];
+		MPP_POLICY_KEY*         Key   = &Result->Keys[Next[Entry->Mode]++];
+		Key->Name   = Names + Entry->NameOffset;
+		Key->Length = Entry->NameLength;
+		Key->Mode   = Entry->Mode;
+		Key->Flags  = Entry->Flags;
+	}
+
+	// Sorted within each mode, to be binary searched
+	for (ULONG cx = 0x00; cx < NumberOfModes; cx++) {
+		HeapSort(
+			&Result->Keys[Result->FirstKey[cx]],
+			Result->FirstKey[cx + 1] - Result->FirstKey[cx],
+			[](CONST MPP_POLICY_KEY& Left, CONST MPP_POLICY_KEY& Right) { return CompareKeys(&Left, &Right) < 0x00; }
+		);
+	}
+
+	// Distinct lengths of the suffixes, each one looked up at the end of the names
+	ULONG NumberOfSuffixes = Result->FirstKey[MatchSuffix + 1] - Result->FirstKey[MatchSuffix];
+	for (ULONG cx = 0x00; cx < NumberOfSuffixes; cx++)
+		Result->SuffixLengths[cx] = Result->Keys[Result->FirstKey[MatchSuffix] + cx].Length;
+	HeapSort(
+		Result->SuffixLengths,
+		NumberOfSuffixes,
+		[](CONST ULONG& Left, CONST ULONG& Right) { return Left < Right; }
+	);
+	for (ULONG cx = 0x00; cx < NumberOfSuffixes; cx++) {
+		if (Result->NumberOfSuffixLengths == 0x00
+			|| Result->SuffixLengths[Result->NumberOfSuffixLengths - 1] != Result->SuffixLengths[cx]) {
+			Result->SuffixLengths[Result->NumberOfSuffixLengths++] = Result->SuffixLengths[cx];
+		}
+	}
+	return Result;
+}
+
+
+_Use_decl_annotations_
+ULONG MppPolicy::Lookup(
+	_In_opt_           CONST MPP_POLICY_INDEX* Index,
+	_In_reads_(Length) CONST WCHAR*            Name,
+	_In_               SIZE_T                  Length
+) {
+	if (Index == nullptr || Name == nullptr || Length == 0x00)
+		return 0x00;
+
+	// Whole name
+	ULONG Flags = FindAll(Index, MatchPath, Name, Length);
+
+	// File name, after the last separator
+	SIZE_T Start = Length;
+	while (Start > 0x00 && Name[Start - 1] != L'\\' && Name[Start - 1] != L'/')
+		Start--;
+	if (Start < Length)
+		Flags |= FindAll(Index, MatchExact, Name + Start, Length - Start);
+
+	// End of the name, once per length of suffix
+	for (ULONG cx = 0x00; cx < Index->NumberOfSuffixLengths; cx++) {
+		ULONG Suffix = Index->SuffixLengths[cx];
+		if (Suffix > Length)
+			break;
+		Flags |= FindAll(Index, MatchSuffix, Name + (Length - Suffix), Suffix);
+	}
+	return Flags;
+}
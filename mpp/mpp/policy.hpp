@@ -0,0 +1,156 @@
+/*+================================================================================================
+Module Name: policy.hpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+Abstract:
+Memory Patching Protection (MPP) protection policy.
+A policy is a list of image name patterns, each with a match mode and the protections to apply.
+It is written as a text specification, compiled by the client into a compact binary policy, and
+validated and indexed by the driver before replacing the current one. The routines neither allocate
+nor depend on the kernel, so that the client and the driver share them.
+
+Text specification, one statement per line, '#' starting a comment:
+    revision <number>
+    <suffix|exact|path> <name or "quoted name"> <protect|integrity>...
+================================================================================================+*/
+
+#ifndef __MPP_POLICY_H_GUARD__
+#define __MPP_POLICY_H_GUARD__
+
+#include "portable.hpp"
+
+
+/// @brief Protection policy.
+namespace MppPolicy {
+
+	/// @brief Signature of a binary policy, "MPPL".
+	constexpr ULONG Signature = 0x4C50504D;
+
+	/// @brief Version of the binary format.
+	constexpr USHORT FormatVersion = 0x01;
+
+	/// @brief Largest number of entries of a policy.
+	constexpr ULONG MaximumEntries = 0x10000;
+
+	/// @brief Largest name of an entry, in characters.
+	constexpr USHORT MaximumName = 0x400;
+
+	/// @brief How the name of an entry is compared with the full name of an image, ignoring the ASCII case.
+	constexpr UCHAR MatchSuffix = 0x00; // The full name ends with the name
+	constexpr UCHAR MatchExact  = 0x01; // The file name, after the last separator, is the name
+	constexpr UCHAR MatchPath   = 0x02; // The full name is the name
+	constexpr UCHAR NumberOfModes = 0x03;
+
+	/// @brief Protections applied to the images matched, at least one per entry.
+	constexpr ULONG FlagProtect   = 0x01; // Secure the executable ranges
+	constexpr ULONG FlagIntegrity = 0x02; // Record the baseline of the executable ranges
+	constexpr ULONG ValidFlags    = FlagProtect | FlagIntegrity;
+
+	/// @brief Header of a binary policy, followed by the entries and then by the characters of the names.
+	typedef struct _MPP_POLICY_HEADER {
+		ULONG  Signature;
+		USHORT Version;
+		USHORT HeaderSize;         // Size of the header
+		ULONG  Size;               // Size of the whole policy
+		ULONG  Checksum;           // FNV-1a of everything after the header
+		ULONG  Revision;           // Set by the author of the policy
+		ULONG  NumberOfEntries;
+		ULONG  NumberOfCharacters; // Characters of all the names, stored in lower case
+		ULONG  Reserved;
+	} MPP_POLICY_HEADER, * PMPP_POLICY_HEADER;
+
+	/// @brief Entry of a binary policy.
+	typedef struct _MPP_POLICY_ENTRY {
+		ULONG  NameOffset; // Index of the first character of the name
+		USHORT NameLength; // Number of characters of the name
+		UCHAR  Mode;
+		UCHAR  Reserved;
+		ULONG  Flags;
+	} MPP_POLICY_ENTRY, * PMPP_POLICY_ENTRY;
+
+	/// @brief Name of an entry, sorted in the index.
+	typedef struct _MPP_POLICY_KEY {
+		CONST WCHAR* Name;
+		ULONG        Length;
+		ULONG        Mode;
+		ULONG        Flags;
+	} MPP_POLICY_KEY, * PMPP_POLICY_KEY;
+
+	/// @brief Index of a validated policy, followed by its keys in the same buffer.
+	typedef struct _MPP_POLICY_INDEX {
+		SIZE_T          Size;                         // Size of the buffer used
+		ULONG           Revision;
+		ULONG           Generation;                   // Set by the owner of the index
+		ULONG           NumberOfKeys;
+		ULONG           FirstKey[NumberOfModes + 1];  // Keys of each mode, sorted
+		ULONG           NumberOfSuffixLengths;        // Distinct lengths of the suffixes, increasing
+		MPP_POLICY_KEY* Keys;
+		ULONG*          SuffixLengths;
+	} MPP_POLICY_INDEX, * PMPP_POLICY_INDEX;
+
+	/// @brief Outcome of the compilation of a text specification.
+	typedef enum _MPP_POLICY_STATUS {
+		PolicySuccess = 0x00,
+		PolicyBufferTooSmall,   // The required size is returned
+		PolicySyntaxError,      // The line is returned
+		PolicyTooLarge          // Too many entries, or a name too long
+	} MPP_POLICY_STATUS;
+
+	/// @brief Compile a text specification into a binary policy.
+	/// @param Text       Specification, in UTF-8.
+	/// @param TextSize   Size of the specification, in bytes.
+	/// @param Buffer     Receives the policy, may be nullptr to get its size.
+	/// @param BufferSize Size of the buffer, in bytes.
+	/// @param PolicySize Receives the size of the policy, required when the buffer is too small.
+	/// @param ErrorLine  Receives the line of the error, from 1, 0 if none.
+	MPP_POLICY_STATUS Compile(
+		_In_reads_bytes_(TextSize)             CONST CHAR* Text,
+		_In_                                   SIZE_T      TextSize,
+		_Out_writes_bytes_opt_(BufferSize)     PVOID       Buffer,
+		_In_                                   SIZE_T      BufferSize,
+		_Out_                                  ULONG*      PolicySize,
+		_Out_                                  ULONG*      ErrorLine
+	);
+
+	/// @brief Whether a binary policy is well formed, to be checked before indexing it.
+	/// @param Buffer Binary policy.
+	/// @param Size   Size of the buffer, in bytes.
+	_Must_inspect_result_
+	BOOLEAN Validate(
+		_In_reads_bytes_(Size) CONST VOID* Buffer,
+		_In_                   SIZE_T      Size
+	);
+
+	/// @brief Size of the buffer required to index a validated policy.
+	/// @param Buffer Binary policy.
+	SIZE_T GetIndexSize(
+		_In_ CONST VOID* Buffer
+	);
+
+	/// @brief Index a validated policy. The names are not copied, the policy must outlive the index.
+	/// @param Buffer     Binary policy.
+	/// @param Index      Buffer receiving the index, aligned on 8 bytes.
+	/// @param IndexSize  Size of the buffer, at least the size returned by GetIndexSize.
+	/// @return Pointer to the index, at the beginning of the buffer, or nullptr if too small.
+	_Must_inspect_result_
+	MPP_POLICY_INDEX* BuildIndex(
+		_In_                          CONST VOID* Buffer,
+		_Out_writes_bytes_(IndexSize) PVOID       Index,
+		_In_                          SIZE_T      IndexSize
+	);
+
+	/// @brief Protections of an image, those of all the entries it matches.
+	/// @param Index  Index of the policy, may be nullptr.
+	/// @param Name   Full name of the image, not necessarily NULL terminated.
+	/// @param Length Length of the name, in characters.
+	/// @return Protection flags, 0 if no entry matches.
+	ULONG Lookup(
+		_In_opt_           CONST MPP_POLICY_INDEX* Index,
+		_In_reads_(Length) CONST WCHAR*            Name,
+		_In_               SIZE_T                  Length
+	);
+}
+
+#endif // !__MPP_POLICY_H_GUARD__
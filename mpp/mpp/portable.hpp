@@ -0,0 +1,18 @@
+/*+================================================================================================
+Module Name: portable.hpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+Abstract:
+Memory Patching Protection (MPP) definitions shared by the routines that do not depend on the kernel.
+They are those of kshim.h: the WDK in the driver, the SDK in user mode, and the C runtime and the
+GCC builtins on POSIX systems, where wide characters are 32-bit.
+================================================================================================+*/
+
+#ifndef __MPP_PORTABLE_H_GUARD__
+#define __MPP_PORTABLE_H_GUARD__
+
+#include "../../kshim/kshim.h"
+
+#endif // !__MPP_PORTABLE_H_GUARD__
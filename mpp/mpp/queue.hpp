@@ -0,0 +1,163 @@
+/*+================================================================================================
+Module Name: queue.hpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+Abstract:
+Memory Patching Protection (MPP) bounded multi-producer single-consumer queue.
+Requests are copied into preallocated slots, each tagged with a sequence number telling whether it
+is free for the producer of a position or filled for the consumer. Producers claim positions with
+a compare-exchange and never wait, a full queue drops the request and counts it.
+================================================================================================+*/
+
+#ifndef __MPP_QUEUE_H_GUARD__
+#define __MPP_QUEUE_H_GUARD__
+
+#include "portable.hpp"
+
+
+/// @brief Bounded multi-producer single-consumer queue.
+namespace MppQueue {
+
+	/// @brief Counters of a queue.
+	typedef struct _MPP_QUEUE_STATISTICS {
+		LONG64 Depth;     // Requests waiting
+		LONG64 HighWater; // Deepest the queue has been
+		LONG64 Pushed;    // Requests queued
+		LONG64 Popped;    // Requests dequeued
+		LONG64 Dropped;   // Requests lost because the queue was full
+	} MPP_QUEUE_STATISTICS, * PMPP_QUEUE_STATISTICS;
+
+	/// @brief Queue of up to Capacity requests of type T, Capacity being a power of two.
+	template<typename T, ULONG Capacity>
+	struct MPP_QUEUE {
+		static_assert(Capacity != 0x00 && (Capacity & (Capacity - 1)) == 0x00, "Capacity must be a power of two");
+
+		/// @brief Request and position it holds: position when free, position + 1 when filled.
+		typedef struct _MPP_QUEUE_SLOT {
+			volatile LONG64 Sequence;
+			T               Data;
+		} MPP_QUEUE_SLOT;
+
+		DECLSPEC_CACHEALIGN volatile LONG64 Tail; // Next position of the producers
+		DECLSPEC_CACHEALIGN volatile LONG64 Head; // Next position of the consumer
+		DECLSPEC_CACHEALIGN volatile LONG64 Pushed;
+		volatile LONG64                     Popped;
+		volatile LONG64                     Dropped;
+		volatile LONG64                     HighWater;
+
+		MPP_QUEUE_SLOT Slots[Capacity];
+	};
+
+	/// @brief Initialise an empty queue.
+	/// @param Queue Queue to initialise.
+	template<typename T, ULONG Capacity>
+	_inline VOID Initialise(
+		_Out_ MPP_QUEUE<T, Capacity>* Queue
+	) {
+		Queue->Tail      = 0x00;
+		Queue->Head      = 0x00;
+		Queue->Pushed    = 0x00;
+		Queue->Popped    = 0x00;
+		Queue->Dropped   = 0x00;
+		Queue->HighWater = 0x00;
+		for (ULONG cx = 0x00; cx < Capacity; cx++)
+			Queue->Slots[cx].Sequence = cx;
+	}
+
+	/// @brief Copy a request into the queue, from any number of producers.
+	/// @param Queue Queue to push to.
+	/// @param Data  Request to copy.
+	/// @return Whether the request has been queued, FALSE if the queue was full.
+	template<typename T, ULONG Capacity>
+	_inline BOOLEAN Push(
+		_Inout_ MPP_QUEUE<T, Capacity>* Queue,
+		_In_    CONST T&                Data
+	) {
+		LONG64 Position = ReadNoFence64(&Queue->Tail);
+		typename MPP_QUEUE<T, Capacity>::MPP_QUEUE_SLOT* Slot = nullptr;
+
+		for (;;) {
+			Slot = &Queue->Slots[Position & (Capacity - 1)];
+			LONG64 Difference = ReadAcquire64(&Slot->Sequence) - Position;
+
+			// Free for this position, claim it
+			if (Difference == 0x00) {
+				LONG64 Current = InterlockedCompareExchange64(&Queue->Tail, Position + 1, Position);
+				if (Current == Position)
+					break;
+				Position = Current;
+			}
+			// Still holding the request of the previous lap
+			else if (Difference < 0x00) {
+				InterlockedIncrement64(&Queue->Dropped);
+				return FALSE;
+			}
+			// Claimed by another producer
+			else {
+				Position = ReadNoFence64(&Queue->Tail);
+			}
+		}
+
+		// Fill and hand over to the consumer
+		Slot->Data = Data;
+		WriteRelease64(&Slot->Sequence, Position + 1);
+		InterlockedIncrement64(&Queue->Pushed);
+
+		// Deepest the queue has been, from the point of view of this producer
+		LONG64 Depth     = (Position + 1) - ReadNoFence64(&Queue->Head);
+		LONG64 HighWater = ReadNoFence64(&Queue->HighWater);
+		while (Depth > HighWater) {
+			LONG64 Current = InterlockedCompareExchange64(&Queue->HighWater, Depth, HighWater);
+			if (Current == HighWater)
+				break;
+			HighWater = Current;
+		}
+		return TRUE;
+	}
+
+	/// @brief Copy the oldest request out of the queue, from the single consumer.
+	/// @param Queue Queue to pop from.
+	/// @param Data  Receives the request.
+	/// @return Whether a request has been dequeued, FALSE if none is ready.
+	template<typename T, ULONG Capacity>
+	_inline BOOLEAN Pop(
+		_Inout_ MPP_QUEUE<T, Capacity>* Queue,
+		_Out_   T*                      Data
+	) {
+		LONG64 Position = Queue->Head;
+		typename MPP_QUEUE<T, Capacity>::MPP_QUEUE_SLOT* Slot = &Queue->Slots[Position & (Capacity - 1)];
+
+		// Empty, or the producer of this position is still copying
+		if (ReadAcquire64(&Slot->Sequence) != (Position + 1))
+			return FALSE;
+
+		// Copy and free the slot for the next lap
+		*Data = Slot->Data;
+		WriteRelease64(&Queue->Head, Position + 1);
+		WriteRelease64(&Slot->Sequence, Position + Capacity);
+		InterlockedIncrement64(&Queue->Popped);
+		return TRUE;
+	}
+
+	/// @brief Snapshot of the counters of a queue.
+	/// @param Queue      Queue to read.
+	/// @param Statistics Receives the counters.
+	template<typename T, ULONG Capacity>
+	_inline VOID GetStatistics(
+		_In_  MPP_QUEUE<T, Capacity>* Queue,
+		_Out_ MPP_QUEUE_STATISTICS*   Statistics
+	) {
+		Statistics->Pushed    = ReadAcquire64(&Queue->Pushed);
+		Statistics->Popped    = ReadAcquire64(&Queue->Popped);
+		Statistics->Dropped   = ReadAcquire64(&Queue->Dropped);
+		Statistics->HighWater = ReadAcquire64(&Queue->HighWater);
+
+		// Head first, the tail is never behind it
+		LONG64 Head = ReadAcquire64(&Queue->Head);
+		Statistics->Depth = ReadAcquire64(&Queue->Tail) - Head;
+	}
+}
+
+#endif // !__MPP_QUEUE_H_GUARD__
@@ -0,0 +1,122 @@
+/*+================================================================================================
+Module Name: rcu.cpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+Abstract:
+Memory Patching Protection (MPP) read-copy-update of read-mostly data.
+Readers take a reference on the current epoch and read the published snapshot without lock.
+Writers publish a new snapshot atomically and wait for the readers of the previous epochs before
+reclaiming the previous one. References are counted per processor slot to keep readers of
+different processors off each other's cache lines.
+================================================================================================+*/
+
+#include "rcu.hpp"
+
+#if !defined(_KERNEL_MODE) && !defined(_WIN32)
+#include <sched.h>
+#endif // !_KERNEL_MODE && !_WIN32
+
+/// @brief Helpers of the read-copy-update.
+namespace MppRcu {
+
+	/// @brief Slot of the counters of the current processor.
+	static inline ULONG GetSlot() {
+#if defined(_KERNEL_MODE)
+		return ::KeGetCurrentProcessorIndex() % NumberOfSlots;
+#elif defined(_WIN32)
+		return ::GetCurrentProcessorNumber() % NumberOfSlots;
+#else
+		int Processor = ::sched_getcpu();
+		return Processor < 0x00 ? 0x00 : (ULONG)Processor % NumberOfSlots;
+#endif // _KERNEL_MODE
+	}
+
+	/// @brief Let the readers run while waiting for them.
+	static VOID Pause() {
+#if defined(_KERNEL_MODE)
+		// 1 ms, readers may have been preempted
+		if (::KeGetCurrentIrql() <= APC_LEVEL) {
+			LARGE_INTEGER Interval = { 0x00 };
+			Interval.QuadPart = -10000LL;
+			::KeDelayExecutionThread(KernelMode, FALSE, &Interval);
+		}
+		else {
+			YieldProcessor();
+		}
+#elif defined(_WIN32)
+		::SwitchToThread();
+#else
+		::sched_yield();
+#endif // _KERNEL_MODE
+	}
+}
+
+
+_Use_decl_annotations_
+VOID MppRcu::Initialise(
+	_Out_    MPP_RCU_DOMAIN* Domain,
+	_In_opt_ PVOID           Initial
+) {
+	Domain->Current = Initial;
+	Domain->Epoch   = 0x00;
+	for (ULONG Epoch = 0x00; Epoch < 0x02; Epoch++) {
+		for (ULONG Slot = 0x00; Slot < NumberOfSlots; Slot++)
+			Domain->Counters[Epoch][Slot].References = 0x00;
+	}
+}
+
+
+_Use_decl_annotations_
+PVOID MppRcu::ReadLock(
+	_Inout_ MPP_RCU_DOMAIN* Domain,
+	_Out_   MPP_RCU_TOKEN*  Token
+) {
+	Token->Epoch = (ULONG)ReadAcquire(&Domain->Epoch);
+	Token->Slot  = GetSlot();
+
+	// The reference is visible before the snapshot is read. A writer that has not seen it has
+	// already published the snapshot read here.
+	InterlockedIncrement(&Domain->Counters[Token->Epoch][Token->Slot].References);
+	return ReadPointerAcquire(&Domain->Current);
+}
+
+
+_Use_decl_annotations_
+VOID MppRcu::ReadUnlock(
+	_Inout_ MPP_RCU_DOMAIN* Domain,
+	_In_    MPP_RCU_TOKEN   Token
+) {
+	// Same slot as the reference, even if the thread moved to another processor
+	InterlockedDecrement(&Domain->Counters[Token.Epoch][Token.Slot].References);
+}
+
+
+_Use_decl_annotations_
+PVOID MppRcu::Replace(
+	_Inout_  MPP_RCU_DOMAIN* Domain,
+	_In_opt_ PVOID           Snapshot
+) {
+	PVOID Previous = InterlockedExchangePointer(&Domain->Current, Snapshot);
+	Synchronize(Domain);
+	return Previous;
+}
+
+
+_Use_decl_annotations_
+VOID MppRcu::Synchronize(
+	_Inout_ MPP_RCU_DOMAIN* Domain
+) {
+	// Twice, a reader may have read the epoch before the previous flip and taken its reference
+	// after the previous writer waited for that epoch.
+	for (ULONG cx = 0x00; cx < 0x02; cx++) {
+		LONG Epoch = ReadAcquire(&Domain->Epoch);
+		InterlockedExchange(&Domain->Epoch, Epoch ^ 0x01);
+
+		for (ULONG Slot = 0x00; Slot < NumberOfSlots; Slot++) {
+			while (ReadAcquire(&Domain->Counters[Epoch][Slot].References) != 0x00)
+				Pause();
+		}
+	}
+}
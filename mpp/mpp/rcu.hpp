@@ -0,0 +1,88 @@
+/*+================================================================================================
+Module Name: rcu.hpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+Abstract:
+Memory Patching Protection (MPP) read-copy-update of read-mostly data.
+Readers take a reference on the current epoch and read the published snapshot without lock.
+Writers publish a new snapshot atomically and wait for the readers of the previous epochs before
+reclaiming the previous one. References are counted per processor slot to keep readers of
+different processors off each other's cache lines.
+================================================================================================+*/
+
+#ifndef __MPP_RCU_H_GUARD__
+#define __MPP_RCU_H_GUARD__
+
+#include "portable.hpp"
+
+
+/// @brief Read-copy-update of read-mostly data.
+namespace MppRcu {
+
+	/// @brief Number of reference counters per epoch, readers use the one of their processor.
+	constexpr ULONG NumberOfSlots = 0x40;
+
+	/// @brief Reference counter of one slot, alone in its cache line.
+	typedef struct DECLSPEC_CACHEALIGN _MPP_RCU_COUNTER {
+		volatile LONG References;
+	} MPP_RCU_COUNTER, * PMPP_RCU_COUNTER;
+
+	/// @brief Published snapshot and readers of the two epochs.
+	typedef struct _MPP_RCU_DOMAIN {
+		PVOID volatile  Current;                         // Current snapshot, may be nullptr
+		volatile LONG   Epoch;                           // Epoch of the new readers, 0 or 1
+		MPP_RCU_COUNTER Counters[0x02][NumberOfSlots];   // Readers per epoch and slot
+	} MPP_RCU_DOMAIN, * PMPP_RCU_DOMAIN;
+
+	/// @brief Reference of a reader, released with ReadUnlock.
+	typedef struct _MPP_RCU_TOKEN {
+		ULONG Epoch;
+		ULONG Slot;
+	} MPP_RCU_TOKEN, * PMPP_RCU_TOKEN;
+
+	/// @brief Initialise a domain.
+	/// @param Domain  Domain to initialise.
+	/// @param Initial First snapshot, may be nullptr.
+	VOID Initialise(
+		_Out_    MPP_RCU_DOMAIN* Domain,
+		_In_opt_ PVOID           Initial
+	);
+
+	/// @brief Take a reference on the current epoch and get the current snapshot.
+	/// @param Domain Domain to read.
+	/// @param Token  Reference to release with ReadUnlock.
+	/// @return Current snapshot, valid until ReadUnlock.
+	PVOID ReadLock(
+		_Inout_ MPP_RCU_DOMAIN* Domain,
+		_Out_   MPP_RCU_TOKEN*  Token
+	);
+
+	/// @brief Release a reference taken with ReadLock.
+	/// @param Domain Domain read.
+	/// @param Token  Reference returned by ReadLock.
+	VOID ReadUnlock(
+		_Inout_ MPP_RCU_DOMAIN* Domain,
+		_In_    MPP_RCU_TOKEN   Token
+	);
+
+	/// @brief Publish a new snapshot and wait until no reader can still see the previous one.
+	/// Writers must be serialised by the caller.
+	/// @param Domain   Domain to update.
+	/// @param Snapshot New snapshot, may be nullptr.
+	/// @return Previous snapshot, which can be reclaimed.
+	PVOID Replace(
+		_Inout_  MPP_RCU_DOMAIN* Domain,
+		_In_opt_ PVOID           Snapshot
+	);
+
+	/// @brief Wait until all the readers that started before the call are gone.
+	/// Writers must be serialised by the caller.
+	/// @param Domain Domain to wait for.
+	VOID Synchronize(
+		_Inout_ MPP_RCU_DOMAIN* Domain
+	);
+}
+
+#endif // !__MPP_RCU_H_GUARD__
@@ -0,0 +1,476 @@
+/*+================================================================================================
+Module Name: sections.cpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+Abstract:
+Memory Patching Protection (MPP) planner of the ranges of an image to protect.
+The section table of the headers is walked within bounds, and the executable sections are turned
+into page-aligned ranges, adjacent and overlapping ones merged together. The headers are read byte
+by byte so that they can come from an untrusted image, and the routines do not depend on the
+kernel so that they can also be built in user mode.
+================================================================================================+*/
+
+#include "sections.hpp"
+
+/// @brief Layout of the headers and helpers of the planner.
+namespace MppSections {
+
+	constexpr ULONG DosSignature         = 0x5A4D;     // MZ
+	constexpr ULONG NtSignature          = 0x00004550; // PE\0\0
+	constexpr ULONG DosNtHeadersOffset   = 0x3C;       // e_lfanew
+
+	constexpr ULONG FileNumberOfSections = 0x06;       // From the NT signature
+	constexpr ULONG FileTimeDateStamp    = 0x08;
+	constexpr ULONG FileSizeOfOptional   = 0x14;
+	constexpr ULONG OptionalHeaderOffset = 0x18;
+
+	constexpr ULONG OptionalMagic32      = 0x010B;
+	constexpr ULONG OptionalMagic64      = 0x020B;
+	constexpr ULONG OptionalSizeOfImage  = 0x38;       // Same offset in both formats
+	constexpr ULONG OptionalMinimumSize  = 0x3C;
+	constexpr ULONG OptionalImageBase32  = 0x1C;
+	constexpr ULONG OptionalImageBase64  = 0x18;
+	constexpr ULONG OptionalDirectory32  = 0x60;       // Preceded by their number
+	constexpr ULONG OptionalDirectory64  = 0x70;
+	constexpr ULONG DirectoryRelocations = 0x05;
+	constexpr ULONG DirectorySize        = 0x08;
+
+	constexpr ULONG SectionHeaderSize    = 0x28;
+	constexpr ULONG SectionVirtualSize   = 0x08;
+	constexpr ULONG SectionAddress       = 0x0C;
+	constexpr ULONG SectionSizeOfRawData = 0x10;
+	constexpr ULONG SectionPointerToRaw  = 0x14;
+	constexpr ULONG SectionFlags         = 0x24;
+	constexpr ULONG SectionExecute       = 0x20000000; // IMAGE_SCN_MEM_EXECUTE
+
+	constexpr ULONG RelocationAbsolute   = 0x00;       // IMAGE_REL_BASED_*
+	constexpr ULONG RelocationHigh       = 0x01;
+	constexpr ULONG RelocationLow        = 0x02;
+	constexpr ULONG RelocationHighLow    = 0x03;
+	constexpr ULONG RelocationHighAdj    = 0x04;
+	constexpr ULONG RelocationDir64      = 0x0A;
+
+	/// @brief Image file being rebuilt.
+	typedef struct _MPP_SECTION_FILE {
+		CONST UCHAR* File;
+		SIZE_T       FileSize;
+		CONST UCHAR* Sections;         // Section table, within the file
+		ULONG        NumberOfSections;
+	} MPP_SECTION_FILE, * PMPP_SECTION_FILE;
+
+	/// @brief Read a little-endian 16-bit value, whatever its alignment.
+	static _inline ULONG Read16(
+		_In_ CONST UCHAR* Buffer
+	) {
+		return (ULONG)Buffer[0x00] | ((ULONG)Buffer[0x01] << 0x08);
+	}
+
+	/// @brief Read a little-endian 32-bit value, whatever its alignment.
+	static _inline ULONG Read32(
+		_In_ CONST UCHAR* Buffer
+	) {
+		return Read16(Buffer) | (Read16(Buffer + 0x02) << 0x10);
+	}
+
+	/// @brief Read a little-endian 64-bit value, whatever its alignment.
+	static _inline ULONG64 Read64(
+		_In_ CONST UCHAR* Buffer
+	) {
+		return (ULONG64)Read32(Buffer) | ((ULONG64)Read32(Buffer + 0x04) << 0x20);
+	}
+
+	/// @brief Write a little-endian value of up to 64 bits, whatever its alignment.
+	static _inline VOID WriteValue(
+		_Out_ UCHAR*  Buffer,
+		_In_  ULONG   Width,
+		_In_  ULONG64 Value
+	) {
+		for (ULONG cx = 0x00; cx < Width; cx++)
+			Buffer[cx] = (UCHAR)(Value >> (cx * 0x08));
+	}
+
+	/// @brief Read a little-endian value of up to 64 bits, whatever its alignment.
+	static _inline ULONG64 ReadValue(
+		_In_ CONST UCHAR* Buffer,
+		_In_ ULONG        Width
+	) {
+		ULONG64 Value = 0x00;
+		for (ULONG cx = 0x00; cx < Width; cx++)
+			Value |= (ULONG64)Buffer[cx] << (cx * 0x08);
+		return Value;
+	}
+
+	/// @brief Get the size of a section as mapped, and of its data in the file.
+	static _inline VOID GetSectionSizes(
+		_In_  CONST UCHAR* Section,
+		_Out_ ULONG*       VirtualSize,
+		_Out_ ULONG*       RawSize
+	) {
+		// The loader maps the raw data size when there is no virtual size, and zero fills the rest
+		ULONG Raw     = Read32(Section + SectionSizeOfRawData);
+		ULONG Virtual = Read32(Section + SectionVirtualSize);
+		if (Virtual == 0x00)
+			Virtual = Raw;
+
+		*VirtualSize = Virtual;
+		*RawSize     = Raw < Virtual ? Raw : Virtual;
+	}
+
+	/// @brief Copy bytes of an image as mapped from its file, before relocation.
+	/// @param Image  Image file.
+	/// @param Rva    First byte to copy.
+	/// @param Size   Number of bytes to copy.
+	/// @param Buffer Receives the bytes, zeros outside of the data of the sections.
+	/// @return Whether the data of the sections is within the file.
+	static BOOLEAN CopyImage(
+		_In_  CONST MPP_SECTION_FILE* Image,
+		_In_  ULONG64                 Rva,
+		_In_  SIZE_T                  Size,
+		_Out_ UCHAR*                  Buffer
+	) {
+		memset(Buffer, 0x00, Size);
+
+		for (ULONG cx = 0x00; cx < Image->NumberOfSections; cx++) {
+			CONST UCHAR* Section = Image->Sections + ((SIZE_T)cx * SectionHeaderSize);
+			ULONG VirtualSize = 0x00;
+			ULONG RawSize     = 0x00;
+			GetSectionSizes(Section, &VirtualSize, &RawSize);
+
+			ULONG64 Address = Read32(Section + SectionAddress);
+			ULONG64 Low     = Rva > Address ? Rva : Address;
+			ULONG64 High    = (Rva + Size) < (Address + RawSize) ? (Rva + Size) : (Address + RawSize);
+			if (Low >= High)
+				continue;
+
+			ULONG64 Offset = Read32(Section + SectionPointerToRaw) + (Low - Address);
+			if (Offset > Image->FileSize || (Image->FileSize - Offset) < (High - Low))
+				return FALSE;
+			memcpy(Buffer + (Low - Rva), Image->File + Offset, (SIZE_T)(High - Low));
+		}
+		return TRUE;
+	}
+
+	/// @brief Get the offset in the file of bytes of the data of a section.
+	/// @param Image  Image file.
+	/// @param Rva    First byte.
+	/// @param Size   Number of bytes.
+	/// @param Offset Receives the offset in the file.
+	/// @return Whether the bytes are within the data of one section and within the file.
+	static BOOLEAN GetFileOffset(
+		_In_  CONST MPP_SECTION_FILE* Image,
+		_In_  ULONG64                 Rva,
+		_In_  ULONG64                 Size,
+		_Out_ SIZE_T*                 Offset
+	) {
+		for (ULONG cx = 0x00; cx < Image->NumberOfSections; cx++) {
+			CONST UCHAR* Section = Image->Sections + ((SIZE_T)cx * SectionHeaderSize);
+			ULONG VirtualSize = 0x00;
+			ULONG RawSize     = 0x00;
+			GetSectionSizes(Section, &VirtualSize, &RawSize);
+
+			ULONG64 Address = Read32(Section + SectionAddress);
+			if (Rva < Address || (Rva + Size) > (Address + RawSize))
+				continue;
+
+			ULONG64 Position = Read32(Section + SectionPointerToRaw) + (Rva - Address);
+			if (Position > Image->FileSize || (Image->FileSize - Position) < Size)
+				return FALSE;
+			*Offset = (SIZE_T)Position;
+			return TRUE;
+		}
+		return FALSE;
+	}
+
+	/// @brief Apply one relocation to the bytes of a rebuilt range.
+	/// @param Image    Image file.
+	/// @param Range    Range rebuilt.
+	/// @param Buffer   Bytes of the range.
+	/// @param Type     Type of the relocation.
+	/// @param Target   First byte relocated.
+	/// @param Argument Low 16 bits of the target of a high adjusted relocation.
+	/// @param Delta    Difference between the address of the image and its preferred address.
+	/// @return Whether the bytes outside of the range could be read.
+	static BOOLEAN ApplyRelocation(
+		_In_    CONST MPP_SECTION_FILE*  Image,
+		_In_    CONST MPP_SECTION_RANGE* Range,
+		_Inout_ UCHAR*                   Buffer,
+		_In_    ULONG                    Type,
+		_In_    ULONG64                  Target,
+		_In_    ULONG                    Argument,
+		_In_    ULONG64                  Delta
+	) {
+		ULONG Width = Type == RelocationDir64 ? 0x08 : (Type == RelocationHighLow ? 0x04 : 0x02);
+		if ((Target + Width) <= Range->Start || Target >= Range->End)
+			return TRUE;
+
+		// Value relocated, from the range or from the file for the bytes crossing its bounds
+		UCHAR  Bytes[0x08] = { 0x00 };
+		UCHAR* Value       = Bytes;
+		if (Target >= Range->Start && (Target + Width) <= Range->End) {
+			Value = Buffer + (Target - Range->Start);
+		}
+		else {
+			if (!CopyImage(Image, Target, Width, Bytes))
+				return FALSE;
+			for (ULONG cx = 0x00; cx < Width; cx++) {
+				ULONG64 Rva = Target + cx;
+				if (Rva >= Range->Start && Rva < Range->End)
+					Bytes[cx] = Buffer[Rva - Range->Start];
+			}
+		}
+
+		ULONG64 Relocated = ReadValue(Value, Width);
+		switch (Type) {
+		case RelocationHigh:
+			Relocated = (((Relocated << 0x10) + (ULONG)Delta) >> 0x10);
+			break;
+		case RelocationLow:
+		case RelocationHighLow:
+		case RelocationDir64:
+			Relocated += Delta;
+			break;
+		case RelocationHighAdj: {
+			LONG Low = (LONG)(Argument & 0xFFFF) - ((Argument & 0x8000) ? 0x10000 : 0x00);
+			ULONG Full = (ULONG)(Relocated << 0x10) + (ULONG)Low + (ULONG)Delta + 0x8000;
+			Relocated = Full >> 0x10;
+			break;
+		}
+		}
+		WriteValue(Value, Width, Relocated);
+
+		// Copy back the bytes within the range
+		if (Value == Bytes) {
+			for (ULONG cx = 0x00; cx < Width; cx++) {
+				ULONG64 Rva = Target + cx;
+				if (Rva >= Range->Start && Rva < Range->End)
+					Buffer[Rva - Range->Start] = Bytes[cx];
+			}
+		}
+		return TRUE;
+	}
+
+	/// @brief Locate and check the NT headers, up to the fields of the optional header used.
+	/// @param Headers     Headers of the image, as mapped.
+	/// @param HeadersSize Number of bytes readable from the headers.
+	/// @param NtHeaders   Receives the offset of the NT headers.
+	/// @return Whether the headers are valid, FALSE if truncated or malformed.
+	static BOOLEAN FindNtHeaders(
+		_In_reads_(HeadersSize) CONST UCHAR* Headers,
+		_In_                    SIZE_T       HeadersSize,
+		_Out_                   SIZE_T*      NtHeaders
+	) {
+		*NtHeaders = 0x00;
+		if (Headers == nullptr || HeadersSize < (DosNtHeadersOffset + 0x04))
+			return FALSE;
+
+		// DOS header
+		if (Read16(Headers) != DosSignature)
+			return FALSE;
+		SIZE_T Offset = Read32(Headers + DosNtHeadersOffset);
+		if (Offset > HeadersSize || (HeadersSize - Offset) < (OptionalHeaderOffset + OptionalMinimumSize))
+			return FALSE;
+
+		// NT headers
+		CONST UCHAR* Nt = Headers + Offset;
+		if (Read32(Nt) != NtSignature)
+			return FALSE;
+
+		ULONG Magic = Read16(Nt + OptionalHeaderOffset);
+		if (Magic != OptionalMagic32 && Magic != OptionalMagic64)
+			return FALSE;
+
+		*NtHeaders = Offset;
+		return TRUE;
+	}
+}
+
+
+_Use_decl_annotations_
+BOOLEAN MppSections::GetIdentity(
+	_In_reads_(HeadersSize) CONST UCHAR*          Headers,
+	_In_                    SIZE_T                HeadersSize,
+	_Out_                   MPP_SECTION_IDENTITY* Identity
+) {
+	Identity->TimeDateStamp = 0x00;
+	Identity->SizeOfImage   = 0x00;
+
+	SIZE_T NtHeaders = 0x00;
+	if (!FindNtHeaders(Headers, HeadersSize, &NtHeaders))
+		return FALSE;
+
+	CONST UCHAR* Nt = Headers + NtHeaders;
+	Identity->TimeDateStamp = Read32(Nt + FileTimeDateStamp);
+	Identity->SizeOfImage   = Read32(Nt + OptionalHeaderOffset + OptionalSizeOfImage);
+	return TRUE;
+}
+
+
+_Use_decl_annotations_
+BOOLEAN MppSections::Plan(
+	_In_reads_(HeadersSize) CONST UCHAR*      Headers,
+	_In_                    SIZE_T            HeadersSize,
+	_Out_                   MPP_SECTION_PLAN* Plan
+) {
+	Plan->SizeOfImage    = 0x00;
+	Plan->NumberOfRanges = 0x00;
+
+	SIZE_T NtHeaders = 0x00;
+	if (!FindNtHeaders(Headers, HeadersSize, &NtHeaders))
+		return FALSE;
+
+	// NT headers
+	CONST UCHAR* Nt = Headers + NtHeaders;
+	ULONG NumberOfSections   = Read16(Nt + FileNumberOfSections);
+	ULONG SizeOfOptional     = Read16(Nt + FileSizeOfOptional);
+	if (NumberOfSections > MaximumSections || SizeOfOptional < OptionalMinimumSize)
+		return FALSE;
+	Plan->SizeOfImage = Read32(Nt + OptionalHeaderOffset + OptionalSizeOfImage);
+
+	// Section table, entirely within the headers
+	SIZE_T SectionTable = NtHeaders + OptionalHeaderOffset + SizeOfOptional;
+	if (SectionTable > HeadersSize || ((HeadersSize - SectionTable) / SectionHeaderSize) < NumberOfSections)
+		return FALSE;
+
+	// Executable sections, page-aligned and within the image
+	MPP_SECTION_RANGE* Ranges = Plan->Ranges;
+	ULONG              Count  = 0x00;
+	for (ULONG cx = 0x00; cx < NumberOfSections; cx++) {
+		CONST UCHAR* Section = Headers + SectionTable + ((SIZE_T)cx * SectionHeaderSize);
+		if ((Read32(Section + SectionFlags) & SectionExecute) == 0x00)
+			continue;
+
+		// The loader maps the raw data size when there is no virtual size
+		LONG64 Address = Read32(Section + SectionAddress);
+		LONG64 Size    = Read32(Section + SectionVirtualSize);
+		if (Size == 0x00)
+			Size = Read32(Section + SectionSizeOfRawData);
+		if (Size == 0x00)
+			continue;
+
+		LONG64 Start = Address & ~(LONG64)(PageSize - 1);
+		LONG64 End   = (Address + Size + (PageSize - 1)) & ~(LONG64)(PageSize - 1);
+		if (End > (LONG64)Plan->SizeOfImage)
+			End = Plan->SizeOfImage;
+		if (Start >= End)
+			continue;
+
+		// Insert sorted by start, sections are usually in order already
+		ULONG Index = Count;
+		while (Index != 0x00 && Ranges[Index - 1].Start > (ULONG)Start) {
+			Ranges[Index] = Ranges[Index - 1];
+			Index--;
+		}
+		Ranges[Index].Start = (ULONG)Start;
+		Ranges[Index].End   = (ULONG)End;
+		Count++;
+	}
+
+	// Merge the adjacent and overlapping ranges
+	ULONG Merged = 0x00;
+	for (ULONG cx = 0x00; cx < Count; cx++) {
+		if (Merged != 0x00 && Ranges[cx].Start <= Ranges[Merged - 1].End) {
+			if (Ranges[cx].End > Ranges[Merged - 1].End)
+				Ranges[Merged - 1].End = Ranges[cx].End;
+			continue;
+		}
+		Ranges[Merged++] = Ranges[cx];
+	}
+	Plan->NumberOfRanges = Merged;
+	return TRUE;
+}
+
+
+_Use_decl_annotations_
+BOOLEAN MppSections::MapFileRange(
+	_In_reads_(FileSize) CONST UCHAR*             File,
+	_In_                 SIZE_T                   FileSize,
+	_In_                 ULONG64                  ImageBase,
+	_In_                 CONST MPP_SECTION_RANGE* Range,
+	_Out_                UCHAR*                   Buffer
+) {
+	if (Range->Start > Range->End)
+		return FALSE;
+
+	// The headers are at the beginning of the file
+	SIZE_T NtHeaders = 0x00;
+	if (!FindNtHeaders(File, FileSize, &NtHeaders))
+		return FALSE;
+
+	CONST UCHAR* Nt       = File + NtHeaders;
+	CONST UCHAR* Optional = Nt + OptionalHeaderOffset;
+	ULONG NumberOfSections = Read16(Nt + FileNumberOfSections);
+	ULONG SizeOfOptional   = Read16(Nt + FileSizeOfOptional);
+	if (NumberOfSections > MaximumSections || SizeOfOptional < OptionalMinimumSize)
+		return FALSE;
+
+	SIZE_T SectionTable = NtHeaders + OptionalHeaderOffset + SizeOfOptional;
+	if (SectionTable > FileSize || ((FileSize - SectionTable) / SectionHeaderSize) < NumberOfSections)
+		return FALSE;
+
+	MPP_SECTION_FILE Image = { File, FileSize, File + SectionTable, NumberOfSections };
+
+	// Section data as mapped
+	if (!CopyImage(&Image, Range->Start, Range->End - Range->Start, Buffer))
+		return FALSE;
+
+	// Preferred address and relocation directory, of either format
+	BOOLEAN Is64        = Read16(Optional) == OptionalMagic64;
+	ULONG64 Preferred   = Is64 ? Read64(Optional + OptionalImageBase64) : Read32(Optional + OptionalImageBase32);
+	ULONG   Directories = Is64 ? OptionalDirectory64 : OptionalDirectory32;
+	ULONG64 Delta       = ImageBase - Preferred;
+	if (Delta == 0x00)
+		return TRUE;
+
+	ULONG Directory = Directories + (DirectoryRelocations * DirectorySize);
+	if (SizeOfOptional < (Directory + DirectorySize) || Read32(Optional + Directories - 0x04) <= DirectoryRelocations)
+		return FALSE;
+	ULONG RelocationsRva  = Read32(Optional + Directory);
+	ULONG RelocationsSize = Read32(Optional + Directory + 0x04);
+	if (RelocationsRva == 0x00 || RelocationsSize == 0x00)
+		return FALSE;
+
+	SIZE_T Relocations = 0x00;
+	if (!GetFileOffset(&Image, RelocationsRva, RelocationsSize, &Relocations))
+		return FALSE;
+
+	// Blocks of relocations, each for one page
+	CONST UCHAR* Block     = File + Relocations;
+	SIZE_T       Remaining = RelocationsSize;
+	while (Remaining >= DirectorySize) {
+		ULONG64 Page      = Read32(Block);
+		ULONG   BlockSize = Read32(Block + 0x04);
+		if (BlockSize < DirectorySize || BlockSize > Remaining)
+			return FALSE;
+
+		// Skip the pages away from the range
+		ULONG NumberOfEntries = (BlockSize - DirectorySize) / sizeof(USHORT);
+		if ((Page + PageSize + 0x08) > Range->Start && Page < Range->End) {
+			for (ULONG cx = 0x00; cx < NumberOfEntries; cx++) {
+				ULONG Entry = Read16(Block + DirectorySize + (cx * sizeof(USHORT)));
+				ULONG Type  = Entry >> 0x0C;
+				ULONG Argument = 0x00;
+
+				if (Type == RelocationAbsolute)
+					continue;
+				if (Type == RelocationHighAdj) {
+					if (++cx >= NumberOfEntries)
+						return FALSE;
+					Argument = Read16(Block + DirectorySize + (cx * sizeof(USHORT)));
+				}
+				else if (Type != RelocationHigh && Type != RelocationLow
+					&& Type != RelocationHighLow && Type != RelocationDir64) {
+					return FALSE;
+				}
+
+				if (!ApplyRelocation(&Image, Range, Buffer, Type, Page + (Entry & 0x0FFF), Argument, Delta))
+					return FALSE;
+			}
+		}
+
+		Block     += BlockSize;
+		Remaining -= BlockSize;
+	}
+	return TRUE;
+}
@@ -0,0 +1,90 @@
+/*+================================================================================================
+Module Name: sections.hpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+Abstract:
+Memory Patching Protection (MPP) planner of the ranges of an image to protect.
+The section table of the headers is walked within bounds, and the executable sections are turned
+into page-aligned ranges, adjacent and overlapping ones merged together. The headers are read byte
+by byte so that they can come from an untrusted image, and the routines do not depend on the
+kernel so that they can also be built in user mode.
+================================================================================================+*/
+
+#ifndef __MPP_SECTIONS_H_GUARD__
+#define __MPP_SECTIONS_H_GUARD__
+
+#include "portable.hpp"
+
+
+/// @brief Planner of the ranges of an image to protect.
+namespace MppSections {
+
+	/// @brief Granularity of the ranges.
+	constexpr ULONG PageSize = 0x1000;
+
+	/// @brief Maximum number of sections of an image, as enforced by the loader.
+	constexpr ULONG MaximumSections = 0x60;
+
+	/// @brief Range of an image, relative to its base address, both bounds page-aligned.
+	typedef struct _MPP_SECTION_RANGE {
+		ULONG Start; // First byte
+		ULONG End;   // Byte after the last one
+	} MPP_SECTION_RANGE, * PMPP_SECTION_RANGE;
+
+	/// @brief Ranges of an image to protect, sorted and disjoint.
+	typedef struct _MPP_SECTION_PLAN {
+		ULONG             SizeOfImage;    // Size of the image, all ranges are within it
+		ULONG             NumberOfRanges; // Number of ranges, 0 if nothing is executable
+		MPP_SECTION_RANGE Ranges[MaximumSections];
+	} MPP_SECTION_PLAN, * PMPP_SECTION_PLAN;
+
+	/// @brief Identity of an image, as stamped by the linker.
+	typedef struct _MPP_SECTION_IDENTITY {
+		ULONG TimeDateStamp;
+		ULONG SizeOfImage;
+	} MPP_SECTION_IDENTITY, * PMPP_SECTION_IDENTITY;
+
+	/// @brief Get the identity of an image, without walking the section table.
+	/// @param Headers     Headers of the image, as mapped.
+	/// @param HeadersSize Number of bytes readable from the headers.
+	/// @param Identity    Receives the identity.
+	/// @return Whether the headers are valid, FALSE if truncated or malformed.
+	_Must_inspect_result_
+	BOOLEAN GetIdentity(
+		_In_reads_(HeadersSize) CONST UCHAR*          Headers,
+		_In_                    SIZE_T                HeadersSize,
+		_Out_                   MPP_SECTION_IDENTITY* Identity
+	);
+
+	/// @brief Rebuild a range of an image from its file, as mapped and relocated by the loader.
+	/// @param File      Content of the image file.
+	/// @param FileSize  Size of the file, in bytes.
+	/// @param ImageBase Address the image is mapped at.
+	/// @param Range     Range to rebuild.
+	/// @param Buffer    Receives the range, of Range->End - Range->Start bytes.
+	/// @return Whether the range has been rebuilt, FALSE if the file is malformed or not relocatable.
+	_Must_inspect_result_
+	BOOLEAN MapFileRange(
+		_In_reads_(FileSize) CONST UCHAR*             File,
+		_In_                 SIZE_T                   FileSize,
+		_In_                 ULONG64                  ImageBase,
+		_In_                 CONST MPP_SECTION_RANGE* Range,
+		_Out_                UCHAR*                   Buffer
+	);
+
+	/// @brief Plan the ranges of the executable sections of an image.
+	/// @param Headers     Headers of the image, as mapped.
+	/// @param HeadersSize Number of bytes readable from the headers.
+	/// @param Plan        Receives the ranges.
+	/// @return Whether the headers are valid, FALSE if truncated or malformed.
+	_Must_inspect_result_
+	BOOLEAN Plan(
+		_In_reads_(HeadersSize) CONST UCHAR*      Headers,
+		_In_                    SIZE_T            HeadersSize,
+		_Out_                   MPP_SECTION_PLAN* Plan
+	);
+}
+
+#endif // !__MPP_SECTIONS_H_GUARD__
@@ -0,0 +1,196 @@
+/*+================================================================================================
+Module Name: stats.cpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+Abstract:
+Memory Patching Protection (MPP) runtime statistics.
+Counters and latency histograms are kept per processor slot, each alone in its cache lines, and
+only summed when queried. Latencies are counted in buckets of powers of two nanoseconds.
+================================================================================================+*/
+
+#include "stats.hpp"
+
+#if !defined(_KERNEL_MODE) && !defined(_WIN32)
+#include <sched.h>
+#include <time.h>
+#endif // !_KERNEL_MODE && !_WIN32
+
+/// @brief Helpers of the statistics.
+namespace MppStats {
+
+	/// @brief Slot of the current processor.
+	static inline ULONG GetSlot() {
+#if defined(_KERNEL_MODE)
+		return ::KeGetCurrentProcessorIndex() % NumberOfSlots;
+#elif defined(_WIN32)
+		return ::GetCurrentProcessorNumber() % NumberOfSlots;
+#else
+		int Processor = ::sched_getcpu();
+		return Processor < 0x00 ? 0x00 : (ULONG)Processor % NumberOfSlots;
+#endif // _KERNEL_MODE
+	}
+
+	/// @brief Convert ticks of a counter into nanoseconds, without overflowing.
+	static inline ULONG64 ToNanoseconds(
+		_In_ ULONG64 Ticks,
+		_In_ ULONG64 Frequency
+	) {
+		return ((Ticks / Frequency) * 1000000000ULL) + (((Ticks % Frequency) * 1000000000ULL) / Frequency);
+	}
+}
+
+
+_Use_decl_annotations_
+VOID MppStats::Initialise(
+	_Out_ MPP_STATS* Stats
+) {
+	for (ULONG Slot = 0x00; Slot < NumberOfSlots; Slot++) {
+		MPP_STATS_SLOT* Current = &Stats->Slots[Slot];
+		for (ULONG Counter = 0x00; Counter < NumberOfCounters; Counter++)
+			Current->Counters[Counter] = 0x00;
+
+		for (ULONG Latency = 0x00; Latency < NumberOfLatencies; Latency++) {
+			Current->Latencies[Latency].Count   = 0x00;
+			Current->Latencies[Latency].Sum     = 0x00;
+			Current->Latencies[Latency].Maximum = 0x00;
+			for (ULONG Bucket = 0x00; Bucket < NumberOfBuckets; Bucket++)
+				Current->Latencies[Latency].Buckets[Bucket] = 0x00;
+		}
+	}
+}
+
+
+ULONG64 MppStats::GetTime() {
+#if defined(_KERNEL_MODE)
+	LARGE_INTEGER Frequency = { 0x00 };
+	LARGE_INTEGER Counter   = ::KeQueryPerformanceCounter(&Frequency);
+	return ToNanoseconds((ULONG64)Counter.QuadPart, (ULONG64)Frequency.QuadPart);
+#elif defined(_WIN32)
+	LARGE_INTEGER Frequency = { 0x00 };
+	LARGE_INTEGER Counter   = { 0x00 };
+	::QueryPerformanceFrequency(&Frequency);
+	::QueryPerformanceCounter(&Counter);
+	return ToNanoseconds((ULONG64)Counter.QuadPart, (ULONG64)Frequency.QuadPart);
+#else
+	struct timespec Time = { 0x00, 0x00 };
+	::clock_gettime(CLOCK_MONOTONIC, &Time);
+	return ((ULONG64)Time.tv_sec * 1000000000ULL) + (ULONG64)Time.tv_nsec;
+#endif // _KERNEL_MODE
+}
+
+
+_Use_decl_annotations_
+VOID MppStats::Increment(
+	_Inout_ MPP_STATS*        Stats,
+	_In_    MPP_STATS_COUNTER Counter
+) {
+	// Interlocked, the thread may be preempted by another one of the same processor
+	InterlockedIncrement64(&Stats->Slots[GetSlot()].Counters[Counter]);
+}
+
+
+_Use_decl_annotations_
+VOID MppStats::Record(
+	_Inout_ MPP_STATS*        Stats,
+	_In_    MPP_STATS_LATENCY Latency,
+	_In_    ULONG64           Duration
+) {
+	// A clock going backwards, between processors, is counted as 0
+	LONG64 Value = (LONG64)Duration < 0x00 ? 0x00 : (LONG64)Duration;
+
+	volatile MPP_STATS_HISTOGRAM* Histogram = &Stats->Slots[GetSlot()].Latencies[Latency];
+	InterlockedIncrement64(&Histogram->Count);
+	InterlockedAdd64(&Histogram->Sum, Value);
+	InterlockedIncrement64(&Histogram->Buckets[GetBucket((ULONG64)Value)]);
+
+	// Raise the maximum, rarely more than once
+	LONG64 Maximum = ReadNoFence64(&Histogram->Maximum);
+	while (Value > Maximum) {
+		LONG64 Current = InterlockedCompareExchange64(&Histogram->Maximum, Value, Maximum);
+		if (Current == Maximum)
+			break;
+		Maximum = Current;
+	}
+}
+
+
+_Use_decl_annotations_
+VOID MppStats::Snapshot(
+	_In_  CONST MPP_STATS*    Stats,
+	_Out_ MPP_STATS_SNAPSHOT* Snapshot
+) {
+	for (ULONG Counter = 0x00; Counter < NumberOfCounters; Counter++)
+		Snapshot->Counters[Counter] = 0x00;
+	for (ULONG Latency = 0x00; Latency < NumberOfLatencies; Latency++) {
+		Snapshot->Latencies[Latency].Count   = 0x00;
+		Snapshot->Latencies[Latency].Sum     = 0x00;
+		Snapshot->Latencies[Latency].Maximum = 0x00;
+		for (ULONG Bucket = 0x00; Bucket < NumberOfBuckets; Bucket++)
+			Snapshot->Latencies[Latency].Buckets[Bucket] = 0x00;
+	}
+
+	for (ULONG Slot = 0x00; Slot < NumberOfSlots; Slot++) {
+		CONST MPP_STATS_SLOT* Current = &Stats->Slots[Slot];
+		for (ULONG Counter = 0x00; Counter < NumberOfCounters; Counter++)
+			Snapshot->Counters[Counter] += ReadNoFence64(&Current->Counters[Counter]);
+
+		for (ULONG Latency = 0x00; Latency < NumberOfLatencies; Latency++) {
+			CONST volatile MPP_STATS_HISTOGRAM* Source = &Current->Latencies[Latency];
+			MPP_STATS_HISTOGRAM*                Target = &Snapshot->Latencies[Latency];
+
+			Target->Count += ReadNoFence64(&Source->Count);
+			Target->Sum   += ReadNoFence64(&Source->Sum);
+			LONG64 Maximum = ReadNoFence64(&Source->Maximum);
+			if (Maximum > Target->Maximum)
+				Target->Maximum = Maximum;
+			for (ULONG Bucket = 0x00; Bucket < NumberOfBuckets; Bucket++)
+				Target->Buckets[Bucket] += ReadNoFence64(&Source->Buckets[Bucket]);
+		}
+	}
+}
+
+
+_Use_decl_annotations_
+ULONG MppStats::GetBucket(
+	_In_ ULONG64 Duration
+) {
+	// Number of significant bits, found by halving the width
+	ULONG Bits = 0x00;
+	for (ULONG Shift = 0x20; Shift != 0x00; Shift >>= 1) {
+		if ((Duration >> Shift) != 0x00) {
+			Duration >>= Shift;
+			Bits      += Shift;
+		}
+	}
+	Bits += (ULONG)Duration;
+	return Bits < NumberOfBuckets ? Bits : NumberOfBuckets - 1;
+}
+
+
+_Use_decl_annotations_
+ULONG64 MppStats::GetPercentile(
+	_In_ CONST MPP_STATS_HISTOGRAM* Histogram,
+	_In_ ULONG                      Percent
+) {
+	if (Histogram->Count <= 0x00 || Percent == 0x00)
+		return 0x00;
+
+	// Rank of the percentile, rounded up
+	LONG64 Count = 0x00;
+	for (ULONG Bucket = 0x00; Bucket < NumberOfBuckets; Bucket++)
+		Count += Histogram->Buckets[Bucket];
+	LONG64 Rank = ((Count * (Percent > 100 ? 100 : Percent)) + 99) / 100;
+
+	LONG64 Seen = 0x00;
+	for (ULONG Bucket = 0x00; Bucket < NumberOfBuckets - 1; Bucket++) {
+		Seen += Histogram->Buckets[Bucket];
+		if (Seen < Rank)
+			continue;
+
+		ULONG64 Bound = Bucket == 0x00 ? 0x00 : (1ULL << Bucket) - 1;
+		return Bound < (ULONG64)Histogram->Maximum ? Bound : (ULONG64)Histogram->Maximum;
+	}
+	return (ULONG64)Histogram->Maximum;
+}
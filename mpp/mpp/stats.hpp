@@ -0,0 +1,126 @@
+/*+================================================================================================
+Module Name: stats.hpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+Abstract:
+Memory Patching Protection (MPP) runtime statistics.
+Counters and latency histograms are kept per processor slot, each alone in its cache lines, and
+only summed when queried. Latencies are counted in buckets of powers of two nanoseconds.
+================================================================================================+*/
+
+#ifndef __MPP_STATS_H_GUARD__
+#define __MPP_STATS_H_GUARD__
+
+#include "portable.hpp"
+
+
+/// @brief Runtime statistics.
+namespace MppStats {
+
+	/// @brief Number of slots, updaters use the one of their processor.
+	constexpr ULONG NumberOfSlots = 0x40;
+
+	/// @brief Number of buckets of a histogram. Bucket 0 counts 0 ns, bucket n counts
+	/// [2^(n-1), 2^n) ns, and the last bucket everything above.
+	constexpr ULONG NumberOfBuckets = 0x20;
+
+	/// @brief Events counted.
+	typedef enum _MPP_STATS_COUNTER {
+		CounterImagesLoaded = 0x00, // Images seen by the load image callback
+		CounterImagesMatched,       // Images matching an image name or the policy
+		CounterRequestsDropped,     // Requests lost because the protect queue was full
+		CounterImagesProtected,     // Images whose ranges have been planned by the worker
+		CounterAttachFailures,      // Processes gone before the worker attached to them
+		CounterRangesSecured,
+		CounterSecureFailures,
+		NumberOfCounters
+	} MPP_STATS_COUNTER;
+
+	/// @brief Latencies measured.
+	typedef enum _MPP_STATS_LATENCY {
+		LatencyMatch = 0x00, // Image names and policy lookups of the load image callback
+		LatencyQueueWait,    // From the callback queueing a request to the worker dequeuing it
+		LatencyAttach,       // Lookup of the process and attach to it
+		LatencySecure,       // MiAddSecureEntry
+		NumberOfLatencies
+	} MPP_STATS_LATENCY;
+
+	/// @brief Histogram of a latency, in nanoseconds.
+	typedef struct _MPP_STATS_HISTOGRAM {
+		LONG64 Count;
+		LONG64 Sum;
+		LONG64 Maximum;
+		LONG64 Buckets[NumberOfBuckets];
+	} MPP_STATS_HISTOGRAM, * PMPP_STATS_HISTOGRAM;
+
+	/// @brief Statistics of the threads of one processor.
+	typedef struct DECLSPEC_CACHEALIGN _MPP_STATS_SLOT {
+		volatile LONG64              Counters[NumberOfCounters];
+		volatile MPP_STATS_HISTOGRAM Latencies[NumberOfLatencies];
+	} MPP_STATS_SLOT, * PMPP_STATS_SLOT;
+
+	/// @brief Statistics of all the processors.
+	typedef struct _MPP_STATS {
+		MPP_STATS_SLOT Slots[NumberOfSlots];
+	} MPP_STATS, * PMPP_STATS;
+
+	/// @brief Sum of the slots, returned by the `MppQueryStatistics` IOCTL.
+	typedef struct _MPP_STATS_SNAPSHOT {
+		LONG64              Counters[NumberOfCounters];
+		MPP_STATS_HISTOGRAM Latencies[NumberOfLatencies];
+	} MPP_STATS_SNAPSHOT, * PMPP_STATS_SNAPSHOT;
+
+	/// @brief Reset all the slots.
+	/// @param Stats Statistics to initialise.
+	VOID Initialise(
+		_Out_ MPP_STATS* Stats
+	);
+
+	/// @brief Monotonic time, in nanoseconds.
+	ULONG64 GetTime();
+
+	/// @brief Count an event.
+	/// @param Stats   Statistics to update.
+	/// @param Counter Event to count.
+	VOID Increment(
+		_Inout_ MPP_STATS*        Stats,
+		_In_    MPP_STATS_COUNTER Counter
+	);
+
+	/// @brief Add a measure to the histogram of a latency.
+	/// @param Stats    Statistics to update.
+	/// @param Latency  Latency measured.
+	/// @param Duration Measure, in nanoseconds.
+	VOID Record(
+		_Inout_ MPP_STATS*        Stats,
+		_In_    MPP_STATS_LATENCY Latency,
+		_In_    ULONG64           Duration
+	);
+
+	/// @brief Sum the slots. The slots keep being updated, the sum is not a consistent cut.
+	/// @param Stats    Statistics to read.
+	/// @param Snapshot Receives the sum.
+	VOID Snapshot(
+		_In_  CONST MPP_STATS*    Stats,
+		_Out_ MPP_STATS_SNAPSHOT* Snapshot
+	);
+
+	/// @brief Bucket of a measure.
+	/// @param Duration Measure, in nanoseconds.
+	ULONG GetBucket(
+		_In_ ULONG64 Duration
+	);
+
+	/// @brief Upper bound of a percentile, the largest value of its bucket capped by the maximum.
+	/// @param Histogram Histogram to read.
+	/// @param Percent   Percentile, from 1 to 100.
+	/// @return Bound, in nanoseconds, 0 if the histogram is empty.
+	ULONG64 GetPercentile(
+		_In_ CONST MPP_STATS_HISTOGRAM* Histogram,
+		_In_ ULONG                      Percent
+	);
+}
+
+#endif // !__MPP_STATS_H_GUARD__
@@ -0,0 +1,614 @@
+/*+================================================================================================
+Module Name: trace.cpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+Abstract:
+Memory Patching Protection (MPP) binary trace.
+Events are written as an identifier, a timestamp and packed arguments into one ring per processor,
+without lock and without formatting. Writers reserve their record with a compare-exchange on the
+head of the ring and commit it by writing its position last, the oldest records being overwritten.
+A reader maps the rings read-only, copies the committed records in bulk and detects the records
+overwritten while it was copying them. Records are only formatted by the reader.
+================================================================================================+*/
+
+#include "trace.hpp"
+
+#if !defined(_KERNEL_MODE) && !defined(_WIN32)
+#include <sched.h>
+#include <time.h>
+#endif // !_KERNEL_MODE && !_WIN32
+
+/// @brief Helpers of the trace.
+namespace MppTrace {
+
+	/// @brief Granularity of the data of the rings.
+	constexpr ULONG PageSize = 0x1000;
+
+	/// @brief Largest size of the data of a ring.
+	constexpr ULONG MaximumRingSize = 0x1000000;
+
+	/// @brief Ring of the current processor.
+	static inline ULONG GetRing(
+		_In_ ULONG NumberOfRings
+	) {
+#if defined(_KERNEL_MODE)
+		return ::KeGetCurrentProcessorIndex() % NumberOfRings;
+#elif defined(_WIN32)
+		return ::GetCurrentProcessorNumber() % NumberOfRings;
+#else
+		int Processor = ::sched_getcpu();
+		return Processor < 0x00 ? 0x00 : (ULONG)Processor % NumberOfRings;
+#endif // _KERNEL_MODE
+	}
+
+	/// @brief Current value of the clock of the timestamps.
+	static inline ULONG64 GetTimestamp() {
+#if defined(_KERNEL_MODE)
+		return (ULONG64)::KeQueryPerformanceCounter(nullptr).QuadPart;
+#elif defined(_WIN32)
+		LARGE_INTEGER Counter = { 0x00 };
+		::QueryPerformanceCounter(&Counter);
+		return (ULONG64)Counter.QuadPart;
+#else
+		struct timespec Time = { 0x00, 0x00 };
+		::clock_gettime(CLOCK_MONOTONIC, &Time);
+		return ((ULONG64)Time.tv_sec * 1000000000ULL) + (ULONG64)Time.tv_nsec;
+#endif // _KERNEL_MODE
+	}
+
+	/// @brief Ticks of the clock of the timestamps per second.
+	static inline ULONG64 GetFrequency() {
+#if defined(_KERNEL_MODE)
+		LARGE_INTEGER Frequency = { 0x00 };
+		::KeQueryPerformanceCounter(&Frequency);
+		return (ULONG64)Frequency.QuadPart;
+#elif defined(_WIN32)
+		LARGE_INTEGER Frequency = { 0x00 };
+		::QueryPerformanceFrequency(&Frequency);
+		return (ULONG64)Frequency.QuadPart;
+#else
+		return 1000000000ULL;
+#endif // _KERNEL_MODE
+	}
+
+	/// @brief Offset of the data of the first ring.
+	static inline SIZE_T GetDataOffset(
+		_In_ ULONG NumberOfRings
+	) {
+		SIZE_T Size = sizeof(MPP_TRACE_HEADER) + ((SIZE_T)NumberOfRings * sizeof(MPP_TRACE_RING));
+		return (Size + PageSize - 1) & ~(SIZE_T)(PageSize - 1);
+	}
+
+	/// @brief Rings of a trace, after its header.
+	static inline MPP_TRACE_RING* GetRings(
+		_In_ CONST MPP_TRACE_HEADER* Trace
+	) {
+		return (MPP_TRACE_RING*)((ULONG_PTR)Trace + Trace->HeaderSize);
+	}
+
+	/// @brief First position of the oldest lap of a ring, where a record always starts.
+	static inline LONG64 GetOldest(
+		_In_ LONG64 Head,
+		_In_ ULONG  RingSize
+	) {
+		if (Head <= (LONG64)RingSize)
+			return 0x00;
+		return (Head - RingSize + RingSize - 1) & ~(LONG64)(RingSize - 1);
+	}
+
+	/// @brief Append a character to a text, keeping room for the terminator.
+	static inline VOID Append(
+		_Inout_updates_(TextSize) CHAR*   Text,
+		_In_                      SIZE_T  TextSize,
+		_Inout_                   SIZE_T* Length,
+		_In_                      CHAR    Character
+	) {
+		if (*Length + 1 < TextSize)
+			Text[(*Length)++] = Character;
+	}
+
+	/// @brief Append characters to a text, truncated to the room left before the terminator.
+	static inline VOID AppendRun(
+		_Inout_updates_(TextSize)  CHAR*       Text,
+		_In_                       SIZE_T      TextSize,
+		_Inout_                    SIZE_T*     Length,
+		_In_reads_(RunLength)      CONST CHAR* Run,
+		_In_                       SIZE_T      RunLength
+	) {
+		SIZE_T Room = TextSize - 1 - *Length;
+		RunLength = RunLength < Room ? RunLength : Room;
+		::memcpy(Text + *Length, Run, RunLength);
+		*Length += RunLength;
+	}
+
+	/// @brief Append a character repeated, truncated to the room left before the terminator.
+	static inline VOID AppendFill(
+		_Inout_updates_(TextSize) CHAR*   Text,
+		_In_                      SIZE_T  TextSize,
+		_Inout_                   SIZE_T* Length,
+		_In_                      CHAR    Character,
+		_In_                      SIZE_T  Count
+	) {
+		SIZE_T Room = TextSize - 1 - *Length;
+		Count = Count < Room ? Count : Room;
+		::memset(Text + *Length, Character, Count);
+		*Length += Count;
+	}
+
+	/// @brief Append a number to a text.
+	/// Digits are produced with shifts in base 16 and two at a time in base 10, a division by a
+	/// variable base costing more than the rest of the record.
+	static VOID AppendNumber(
+		_Inout_updates_(TextSize) CHAR*   Text,
+		_In_                      SIZE_T  TextSize,
+		_Inout_                   SIZE_T* Length,
+		_In_                      ULONG64 Value,
+		_In_                      BOOLEAN Negative,
+		_In_                      ULONG   Base,
+		_In_                      BOOLEAN Upper,
+		_In_                      ULONG   Width,
+		_In_                      BOOLEAN Zero,
+		_In_                      BOOLEAN Left
+	) {
+		static CONST CHAR Pairs[] =
+			"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+			"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+			"8081828384858687888990919293949596979899";
+
+		CHAR  Digits[0x18];
+		CHAR* Cursor = Digits + sizeof(Digits);
+		if (Base == 16) {
+			CONST CHAR* Hexadecimal = Upper ? "0123456789ABCDEF" : "0123456789abcdef";
+			do {
+				*--Cursor = Hexadecimal[Value & 0x0F];
+				Value >>= 4;
+			} while (Value != 0x00);
+		}
+		else {
+			while (Value >= 100) {
+				ULONG Pair = (ULONG)(Value % 100);
+				Value /= 100;
+				Cursor -= 2;
+				Cursor[0] = Pairs[Pair * 2];
+				Cursor[1] = Pairs[(Pair * 2) + 1];
+			}
+			if (Value >= 10) {
+				Cursor -= 2;
+				Cursor[0] = Pairs[Value * 2];
+				Cursor[1] = Pairs[(Value * 2) + 1];
+			}
+			else {
+				*--Cursor = (CHAR)('0' + Value);
+			}
+		}
+
+		SIZE_T Count   = (SIZE_T)((Digits + sizeof(Digits)) - Cursor);
+		SIZE_T Size    = Count + (Negative ? 1 : 0);
+		SIZE_T Padding = Width > Size ? Width - Size : 0x00;
+		if (Negative && Zero)
+			Append(Text, TextSize, Length, '-');
+		if (!Left)
+			AppendFill(Text, TextSize, Length, Zero ? '0' : ' ', Padding);
+		if (Negative && !Zero)
+			Append(Text, TextSize, Length, '-');
+		AppendRun(Text, TextSize, Length, Cursor, Count);
+		if (Left)
+			AppendFill(Text, TextSize, Length, ' ', Padding);
+	}
+
+	/// @brief Append UTF-16 data to a text, in UTF-8.
+	static VOID AppendString(
+		_Inout_updates_(TextSize)  CHAR*        Text,
+		_In_                       SIZE_T       TextSize,
+		_Inout_                    SIZE_T*      Length,
+		_In_reads_bytes_(DataSize) CONST UCHAR* Data,
+		_In_                       SIZE_T       DataSize
+	) {
+		SIZE_T Index = *Length;
+		for (SIZE_T Offset = 0x00; Offset + 1 < DataSize; Offset += sizeof(USHORT)) {
+			ULONG Character = (ULONG)Data[Offset] | ((ULONG)Data[Offset + 1] << 8);
+			if (Character == 0x00)
+				break;
+
+			// ASCII, most of the paths
+			if (Character < 0x80) {
+				if (Index + 2 > TextSize)
+					break;
+				Text[Index++] = (CHAR)Character;
+				continue;
+			}
+
+			// Surrogate pairs, a lone surrogate being replaced
+			if (Character >= 0xD800 && Character <= 0xDBFF && Offset + 3 < DataSize) {
+				ULONG Low = (ULONG)Data[Offset + 2] | ((ULONG)Data[Offset + 3] << 8);
+				if (Low >= 0xDC00 && Low <= 0xDFFF) {
+					Character = 0x10000 + ((Character - 0xD800) << 10) + (Low - 0xDC00);
+					Offset   += sizeof(USHORT);
+				}
+			}
+			if (Character >= 0xD800 && Character <= 0xDFFF)
+				Character = 0xFFFD;
+
+			// Whole characters only, never truncated in the middle
+			SIZE_T Needed = Character < 0x800 ? 2 : Character < 0x10000 ? 3 : 4;
+			if (Index + Needed + 1 > TextSize)
+				break;
+			if (Needed == 2) {
+				Text[Index++] = (CHAR)(0xC0 | (Character >> 6));
+			}
+			else if (Needed == 3) {
+				Text[Index++] = (CHAR)(0xE0 | (Character >> 12));
+				Text[Index++] = (CHAR)(0x80 | ((Character >> 6) & 0x3F));
+			}
+			else {
+				Text[Index++] = (CHAR)(0xF0 | (Character >> 18));
+				Text[Index++] = (CHAR)(0x80 | ((Character >> 12) & 0x3F));
+				Text[Index++] = (CHAR)(0x80 | ((Character >> 6) & 0x3F));
+			}
+			Text[Index++] = (CHAR)(0x80 | (Character & 0x3F));
+		}
+		*Length = Index;
+	}
+}
+
+
+_Use_decl_annotations_
+SIZE_T MppTrace::GetSize(
+	_In_ ULONG NumberOfRings,
+	_In_ ULONG RingSize
+) {
+	return GetDataOffset(NumberOfRings) + ((SIZE_T)NumberOfRings * RingSize);
+}
+
+
+_Use_decl_annotations_
+MppTrace::MPP_TRACE_HEADER* MppTrace::Initialise(
+	_Out_ PVOID Buffer,
+	_In_  ULONG NumberOfRings,
+	_In_  ULONG RingSize
+) {
+	auto Trace = static_cast<MPP_TRACE_HEADER*>(Buffer);
+	::memset(Trace, 0x00, GetDataOffset(NumberOfRings));
+
+	Trace->Signature     = Signature;
+	Trace->Version       = FormatVersion;
+	Trace->HeaderSize    = sizeof(MPP_TRACE_HEADER);
+	Trace->Size          = GetSize(NumberOfRings, RingSize);
+	Trace->NumberOfRings = NumberOfRings;
+	Trace->RingSize      = RingSize;
+	Trace->Frequency     = GetFrequency();
+
+	MPP_TRACE_RING* Rings = GetRings(Trace);
+	for (ULONG Index = 0x00; Index < NumberOfRings; Index++) {
+		Rings[Index].Head       = 0x00;
+		Rings[Index].DataOffset = GetDataOffset(NumberOfRings) + ((ULONG64)Index * RingSize);
+	}
+
+	// No position is negative, no record is taken as committed before being written
+	::memset((PUCHAR)Trace + GetDataOffset(NumberOfRings), 0xFF, (SIZE_T)NumberOfRings * RingSize);
+	return Trace;
+}
+
+
+_Use_decl_annotations_
+VOID MppTrace::Write(
+	_Inout_opt_                    MPP_TRACE_HEADER* Trace,
+	_In_                           USHORT            EventId,
+	_In_reads_(NumberOfArguments)  CONST ULONG64*    Arguments,
+	_In_                           ULONG             NumberOfArguments,
+	_In_reads_bytes_opt_(DataSize) CONST VOID*       Data,
+	_In_                           SIZE_T            DataSize
+) {
+	if (Trace == nullptr || EventId == EventPadding)
+		return;
+	if (NumberOfArguments > MaximumArguments)
+		NumberOfArguments = MaximumArguments;
+	if (Data == nullptr || DataSize > MaximumData)
+		DataSize = Data == nullptr ? 0x00 : MaximumData;
+
+	ULONG Size = (ULONG)(sizeof(MPP_TRACE_RECORD) + (NumberOfArguments * sizeof(ULONG64)) + DataSize);
+	Size = (Size + 0x07) & ~(ULONG)0x07;
+
+#if defined(_KERNEL_MODE)
+	// The data may be pageable, copy it before raising the IRQL
+	UCHAR Local[MaximumData];
+	if (DataSize != 0x00) {
+		::memcpy(Local, Data, DataSize);
+		Data = Local;
+	}
+
+	// Not preempted between the reservation and the commit, a record lapped by the other writers of
+	// the processor while being written is lost with the one it overwrites
+	KIRQL OldIrql = ::KeGetCurrentIrql();
+	if (OldIrql < DISPATCH_LEVEL)
+		::KfRaiseIrql(DISPATCH_LEVEL);
+#endif // _KERNEL_MODE
+
+	ULONG           Index = GetRing(Trace->NumberOfRings);
+	MPP_TRACE_RING* Ring  = &GetRings(Trace)[Index];
+	PUCHAR          Base  = (PUCHAR)Trace + Ring->DataOffset;
+	LONG64          Mask  = (LONG64)Trace->RingSize - 1;
+
+	// Reserve the record, and the end of the ring if it does not fit before
+	LONG64 Head    = 0x00;
+	LONG64 Padding = 0x00;
+	do {
+		Head    = ReadNoFence64(&Ring->Head);
+		Padding = (Trace->RingSize - (Head & Mask)) < Size ? (Trace->RingSize - (Head & Mask)) : 0x00;
+	} while (InterlockedCompareExchange64(&Ring->Head, Head + Padding + Size, Head) != Head);
+
+	// Skipped by the readers, implicitly if too small for a record
+	if (Padding >= (LONG64)sizeof(MPP_TRACE_RECORD)) {
+		auto Record = (MPP_TRACE_RECORD*)(Base + (Head & Mask));
+		InterlockedExchange64(&Record->Position, -1);
+		Record->Timestamp         = 0x00;
+		Record->EventId           = EventPadding;
+		Record->Size              = (USHORT)Padding;
+		Record->NumberOfArguments = 0x00;
+		Record->Ring              = (UCHAR)Index;
+		Record->DataSize          = 0x00;
+		WriteRelease64(&Record->Position, Head);
+	}
+	Head += Padding;
+
+	// Invalidated before being written, a reader still copying the record overwritten sees it changed
+	auto Record = (MPP_TRACE_RECORD*)(Base + (Head & Mask));
+	InterlockedExchange64(&Record->Position, -1);
+	Record->Timestamp         = GetTimestamp();
+	Record->EventId           = EventId;
+	Record->Size              = (USHORT)Size;
+	Record->NumberOfArguments = (UCHAR)NumberOfArguments;
+	Record->Ring              = (UCHAR)Index;
+	Record->DataSize          = (USHORT)DataSize;
+
+	ULONG64* Values = (ULONG64*)(Record + 1);
+	for (ULONG cx = 0x00; cx < NumberOfArguments; cx++)
+		Values[cx] = Arguments[cx];
+	if (DataSize != 0x00)
+		::memcpy(Values + NumberOfArguments, Data, DataSize);
+
+	// Commit, the readers only copy records whose position is theirs
+	WriteRelease64(&Record->Position, Head);
+
+#if defined(_KERNEL_MODE)
+	if (OldIrql < DISPATCH_LEVEL)
+		::KeLowerIrql(OldIrql);
+#endif // _KERNEL_MODE
+}
+
+
+_Use_decl_annotations_
+BOOLEAN MppTrace::Validate(
+	_In_reads_bytes_(Size) CONST VOID* Buffer,
+	_In_                   SIZE_T      Size
+) {
+	if (Buffer == nullptr || Size < sizeof(MPP_TRACE_HEADER))
+		return FALSE;
+
+	auto Trace = static_cast<CONST MPP_TRACE_HEADER*>(Buffer);
+	if (Trace->Signature != Signature
+		|| Trace->Version != FormatVersion
+		|| Trace->HeaderSize != sizeof(MPP_TRACE_HEADER)
+		|| Trace->NumberOfRings == 0x00
+		|| Trace->NumberOfRings > MaximumRings
+		|| Trace->RingSize < PageSize
+		|| Trace->RingSize > MaximumRingSize
+		|| (Trace->RingSize & (Trace->RingSize - 1)) != 0x00
+		|| Trace->Frequency == 0x00
+		|| Trace->Size > Size
+		|| Trace->Size < GetSize(Trace->NumberOfRings, Trace->RingSize)) {
+		return FALSE;
+	}
+
+	// Data of the rings inside the trace, after the rings
+	CONST MPP_TRACE_RING* Rings = GetRings(Trace);
+	for (ULONG Index = 0x00; Index < Trace->NumberOfRings; Index++) {
+		ULONG64 DataOffset = Rings[Index].DataOffset;
+		if (DataOffset < GetDataOffset(Trace->NumberOfRings)
+			|| (DataOffset & 0x07) != 0x00
+			|| DataOffset > Trace->Size
+			|| Trace->Size - DataOffset < Trace->RingSize) {
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+
+_Use_decl_annotations_
+VOID MppTrace::InitialiseCursor(
+	_In_  CONST MPP_TRACE_HEADER* Trace,
+	_Out_ MPP_TRACE_CURSOR*       Cursor,
+	_In_  BOOLEAN                 Oldest
+) {
+	CONST MPP_TRACE_RING* Rings = GetRings(Trace);
+	for (ULONG Index = 0x00; Index < MaximumRings; Index++) {
+		LONG64 Head = Index < Trace->NumberOfRings ? ReadAcquire64(&Rings[Index].Head) : 0x00;
+		Cursor->Positions[Index] = Oldest ? GetOldest(Head, Trace->RingSize) : Head;
+	}
+	Cursor->LostBytes = 0x00;
+}
+
+
+_Use_decl_annotations_
+SIZE_T MppTrace::Drain(
+	_In_                           CONST MPP_TRACE_HEADER* Trace,
+	_Inout_                        MPP_TRACE_CURSOR*       Cursor,
+	_Out_writes_bytes_(BufferSize) PVOID                   Buffer,
+	_In_                           SIZE_T                  BufferSize
+) {
+	PUCHAR Output   = static_cast<PUCHAR>(Buffer);
+	SIZE_T Copied   = 0x00;
+	LONG64 RingSize = Trace->RingSize;
+	LONG64 Mask     = RingSize - 1;
+
+	CONST MPP_TRACE_RING* Rings = GetRings(Trace);
+	for (ULONG Index = 0x00; Index < Trace->NumberOfRings; Index++) {
+		CONST UCHAR* Base     = (CONST UCHAR*)Trace + Rings[Index].DataOffset;
+		LONG64       Position = Cursor->Positions[Index];
+
+		while (TRUE) {
+			// Overwritten before being read, resume at the oldest lap
+			LONG64 Head = ReadAcquire64(&Rings[Index].Head);
+			if (Head - Position > RingSize) {
+				LONG64 Oldest = GetOldest(Head, Trace->RingSize);
+				Cursor->LostBytes += Oldest - Position;
+				Position = Oldest;
+			}
+			if (Position >= Head)
+				break;
+
+			// Too small for a record, the writer went to the next lap
+			LONG64 Remaining = RingSize - (Position & Mask);
+			if (Remaining < (LONG64)sizeof(MPP_TRACE_RECORD)) {
+				Position += Remaining;
+				continue;
+			}
+
+			// Not committed yet, unless it has just been overwritten
+			auto Record = (CONST MPP_TRACE_RECORD*)(Base + (Position & Mask));
+			if (ReadAcquire64(&Record->Position) != Position) {
+				if (ReadAcquire64(&Rings[Index].Head) - Position > RingSize)
+					continue;
+				break;
+			}
+
+			// Bounded by the lap, the size may come from a writer overwriting the record
+			LONG64 Size    = Record->Size;
+			BOOLEAN Padding = Record->EventId == EventPadding;
+			if (Size < (LONG64)sizeof(MPP_TRACE_RECORD) || Size > Remaining || (Size & 0x07) != 0x00) {
+				Size    = Remaining;
+				Padding = TRUE;
+			}
+			if (!Padding && Copied + Size > BufferSize) {
+				Cursor->Positions[Index] = Position;
+				return Copied;
+			}
+			if (!Padding)
+				::memcpy(Output + Copied, Record, (SIZE_T)Size);
+
+			// Discarded if a writer started overwriting the record while it was copied
+			MemoryBarrier();
+			if (ReadNoFence64(&Record->Position) != Position || ReadAcquire64(&Rings[Index].Head) - Position > RingSize)
+				continue;
+
+			auto Copy = (CONST MPP_TRACE_RECORD*)(Output + Copied);
+			if (!Padding
+				&& Copy->Position == Position
+				&& Copy->Size == Size
+				&& Copy->NumberOfArguments <= MaximumArguments
+				&& Copy->DataSize <= MaximumData
+				&& (LONG64)(sizeof(MPP_TRACE_RECORD) + (Copy->NumberOfArguments * sizeof(ULONG64)) + Copy->DataSize) <= Size) {
+				Copied += (SIZE_T)Size;
+			}
+			Position += Size;
+		}
+		Cursor->Positions[Index] = Position;
+	}
+	return Copied;
+}
+
+
+_Use_decl_annotations_
+SIZE_T MppTrace::Format(
+	_In_                            CONST MPP_TRACE_RECORD*     Record,
+	_In_reads_(NumberOfDescriptors) CONST MPP_TRACE_DESCRIPTOR* Descriptors,
+	_In_                            ULONG                       NumberOfDescriptors,
+	_Out_writes_(TextSize)          CHAR*                       Text,
+	_In_                            SIZE_T                      TextSize
+) {
+	SIZE_T Length = 0x00;
+	if (TextSize == 0x00)
+		return 0x00;
+
+	// Descriptors are usually indexed by their identifier
+	CONST MPP_TRACE_DESCRIPTOR* Descriptor = nullptr;
+	if (Record->EventId < NumberOfDescriptors && Descriptors[Record->EventId].EventId == Record->EventId) {
+		Descriptor = &Descriptors[Record->EventId];
+	}
+	else {
+		for (ULONG cx = 0x00; cx < NumberOfDescriptors && Descriptor == nullptr; cx++) {
+			if (Descriptors[cx].EventId == Record->EventId)
+				Descriptor = &Descriptors[cx];
+		}
+	}
+
+	auto         Arguments = (CONST ULONG64*)(Record + 1);
+	CONST UCHAR* Data      = (CONST UCHAR*)(Arguments + Record->NumberOfArguments);
+
+	// Unknown events are dumped
+	if (Descriptor == nullptr || Descriptor->Format == nullptr) {
+		AppendRun(Text, TextSize, &Length, "Event ", sizeof("Event ") - 1);
+		AppendNumber(Text, TextSize, &Length, Record->EventId, FALSE, 10, FALSE, 0x00, FALSE, FALSE);
+		for (ULONG cx = 0x00; cx < Record->NumberOfArguments; cx++) {
+			Append(Text, TextSize, &Length, ' ');
+			AppendNumber(Text, TextSize, &Length, Arguments[cx], FALSE, 16, FALSE, 0x00, FALSE, FALSE);
+		}
+		Text[Length] = '\0';
+		return Length;
+	}
+
+	ULONG Argument = 0x00;
+	for (CONST CHAR* Cursor = Descriptor->Format; *Cursor != '\0'; Cursor++) {
+		// Text up to the next conversion copied at once, a trailing % included
+		if (*Cursor != '%' || Cursor[1] == '\0') {
+			SIZE_T Run = 0x01;
+			while (Cursor[Run] != '\0' && Cursor[Run] != '%')
+				Run++;
+			AppendRun(Text, TextSize, &Length, Cursor, Run);
+			Cursor += Run - 1;
+			continue;
+		}
+		Cursor++;
+
+		// Flags, width and length, the arguments all being 64-bit
+		BOOLEAN Zero  = FALSE;
+		BOOLEAN Left  = FALSE;
+		ULONG   Width = 0x00;
+		for (; *Cursor == '0' || *Cursor == '-'; Cursor++) {
+			Zero |= *Cursor == '0';
+			Left |= *Cursor == '-';
+		}
+		for (; *Cursor >= '0' && *Cursor <= '9'; Cursor++)
+			Width = Width < 0x40 ? (Width * 10) + (ULONG)(*Cursor - '0') : Width;
+		while (*Cursor == 'l' || *Cursor == 'h' || *Cursor == 'z' || *Cursor == 'I' || *Cursor == '6' || *Cursor == '4')
+			Cursor++;
+		if (*Cursor == '\0')
+			break;
+
+		ULONG64 Value = Argument < Record->NumberOfArguments ? Arguments[Argument] : 0x00;
+		switch (*Cursor) {
+		case 'd':
+			AppendNumber(Text, TextSize, &Length, (LONG64)Value < 0x00 ? 0x00 - Value : Value, (LONG64)Value < 0x00, 10, FALSE, Width, Zero && !Left, Left);
+			Argument++;
+			break;
+		case 'u':
+			AppendNumber(Text, TextSize, &Length, Value, FALSE, 10, FALSE, Width, Zero && !Left, Left);
+			Argument++;
+			break;
+		case 'x':
+		case 'X':
+			AppendNumber(Text, TextSize, &Length, Value, FALSE, 16, *Cursor == 'X', Width, Zero && !Left, Left);
+			Argument++;
+			break;
+		case 'p':
+			AppendNumber(Text, TextSize, &Length, Value, FALSE, 16, TRUE, 0x10, TRUE, FALSE);
+			Argument++;
+			break;
+		case 'c':
+			Append(Text, TextSize, &Length, (CHAR)Value);
+			Argument++;
+			break;
+		case 's':
+			AppendString(Text, TextSize, &Length, Data, Record->DataSize);
+			break;
+		default:
+			Append(Text, TextSize, &Length, *Cursor);
+			break;
+		}
+	}
+	Text[Length] = '\0';
+	return Length;
+}
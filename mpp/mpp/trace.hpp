@@ -0,0 +1,169 @@
+/*+================================================================================================
+Module Name: trace.hpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+Abstract:
+Memory Patching Protection (MPP) binary trace.
+Events are written as an identifier, a timestamp and packed arguments into one ring per processor,
+without lock and without formatting. Writers reserve their record with a compare-exchange on the
+head of the ring and commit it by writing its position last, the oldest records being overwritten.
+A reader maps the rings read-only, copies the committed records in bulk and detects the records
+overwritten while it was copying them. Records are only formatted by the reader.
+================================================================================================+*/
+
+#ifndef __MPP_TRACE_H_GUARD__
+#define __MPP_TRACE_H_GUARD__
+
+#include "portable.hpp"
+
+
+/// @brief Binary trace.
+namespace MppTrace {
+
+	/// @brief Signature of a trace, "MPTR".
+	constexpr ULONG Signature = 0x5254504D;
+
+	/// @brief Version of the layout of a trace.
+	constexpr USHORT FormatVersion = 0x01;
+
+	/// @brief Largest number of rings, one per processor.
+	constexpr ULONG MaximumRings = 0x40;
+
+	/// @brief Largest number of arguments of a record.
+	constexpr ULONG MaximumArguments = 0x08;
+
+	/// @brief Largest data of a record, in bytes.
+	constexpr ULONG MaximumData = 0x100;
+
+	/// @brief Identifier of the records filling the end of a ring.
+	constexpr USHORT EventPadding = 0x00;
+
+	/// @brief Header of a trace, followed by its rings and then by the data of the rings.
+	typedef struct DECLSPEC_CACHEALIGN _MPP_TRACE_HEADER {
+		ULONG   Signature;
+		USHORT  Version;
+		USHORT  HeaderSize;    // Size of the header
+		ULONG64 Size;          // Size of the whole trace
+		ULONG   NumberOfRings;
+		ULONG   RingSize;      // Size of the data of each ring, a power of two
+		ULONG64 Frequency;     // Ticks of the timestamps per second
+	} MPP_TRACE_HEADER, * PMPP_TRACE_HEADER;
+
+	/// @brief Ring of one processor.
+	typedef struct DECLSPEC_CACHEALIGN _MPP_TRACE_RING {
+		volatile LONG64 Head;       // Bytes reserved since the creation of the ring
+		ULONG64         DataOffset; // Offset of the data from the header
+	} MPP_TRACE_RING, * PMPP_TRACE_RING;
+
+	/// @brief Record of an event, followed by its arguments and then by its data, aligned on 8 bytes.
+	typedef struct _MPP_TRACE_RECORD {
+		volatile LONG64 Position;          // Position of the record in its ring, written last
+		ULONG64         Timestamp;
+		USHORT          EventId;
+		USHORT          Size;              // Size of the whole record
+		UCHAR           NumberOfArguments;
+		UCHAR           Ring;
+		USHORT          DataSize;          // Size of the data, in bytes
+	} MPP_TRACE_RECORD, * PMPP_TRACE_RECORD;
+
+	/// @brief Position of a reader in each ring.
+	typedef struct _MPP_TRACE_CURSOR {
+		LONG64 Positions[MaximumRings];
+		LONG64 LostBytes;                  // Bytes overwritten before being read
+	} MPP_TRACE_CURSOR, * PMPP_TRACE_CURSOR;
+
+	/// @brief How the records of an event are formatted by the reader.
+	/// The format only takes the arguments, with %d %u %x %X %p %c, and the data as a UTF-16
+	/// string, with %s.
+	typedef struct _MPP_TRACE_DESCRIPTOR {
+		USHORT      EventId;
+		UCHAR       NumberOfArguments;
+		CONST CHAR* Format;
+	} MPP_TRACE_DESCRIPTOR, * PMPP_TRACE_DESCRIPTOR;
+
+	/// @brief Size of a trace.
+	/// @param NumberOfRings Number of rings, up to MaximumRings.
+	/// @param RingSize      Size of the data of each ring, a power of two of at least a page.
+	SIZE_T GetSize(
+		_In_ ULONG NumberOfRings,
+		_In_ ULONG RingSize
+	);
+
+	/// @brief Initialise an empty trace.
+	/// @param Buffer        Buffer of at least GetSize bytes, aligned on a page.
+	/// @param NumberOfRings Number of rings, up to MaximumRings.
+	/// @param RingSize      Size of the data of each ring, a power of two of at least a page.
+	/// @return Trace, at the beginning of the buffer.
+	MPP_TRACE_HEADER* Initialise(
+		_Out_ PVOID Buffer,
+		_In_  ULONG NumberOfRings,
+		_In_  ULONG RingSize
+	);
+
+	/// @brief Write a record in the ring of the current processor. Never waits.
+	/// @param Trace             Trace to write to, may be nullptr.
+	/// @param EventId           Identifier of the event, not EventPadding.
+	/// @param Arguments         Arguments of the event.
+	/// @param NumberOfArguments Number of arguments, up to MaximumArguments.
+	/// @param Data              Data of the event, may be nullptr.
+	/// @param DataSize          Size of the data, truncated to MaximumData.
+	VOID Write(
+		_Inout_opt_                    MPP_TRACE_HEADER* Trace,
+		_In_                           USHORT            EventId,
+		_In_reads_(NumberOfArguments)  CONST ULONG64*    Arguments,
+		_In_                           ULONG             NumberOfArguments,
+		_In_reads_bytes_opt_(DataSize) CONST VOID*       Data,
+		_In_                           SIZE_T            DataSize
+	);
+
+	/// @brief Whether a mapped trace is well formed, to be checked before reading it.
+	/// @param Buffer Mapped trace.
+	/// @param Size   Size of the mapping, in bytes.
+	_Must_inspect_result_
+	BOOLEAN Validate(
+		_In_reads_bytes_(Size) CONST VOID* Buffer,
+		_In_                   SIZE_T      Size
+	);
+
+	/// @brief Position a reader at the oldest records still in the rings, or after the newest ones.
+	/// @param Trace  Validated trace.
+	/// @param Cursor Receives the positions.
+	/// @param Oldest Whether to read the records already written.
+	VOID InitialiseCursor(
+		_In_  CONST MPP_TRACE_HEADER* Trace,
+		_Out_ MPP_TRACE_CURSOR*       Cursor,
+		_In_  BOOLEAN                 Oldest
+	);
+
+	/// @brief Copy the records committed since the cursor, ring after ring, and advance the cursor.
+	/// @param Trace      Validated trace.
+	/// @param Cursor     Position of the reader.
+	/// @param Buffer     Receives the records, one after the other, aligned on 8 bytes.
+	/// @param BufferSize Size of the buffer, in bytes.
+	/// @return Number of bytes copied.
+	SIZE_T Drain(
+		_In_                           CONST MPP_TRACE_HEADER* Trace,
+		_Inout_                        MPP_TRACE_CURSOR*       Cursor,
+		_Out_writes_bytes_(BufferSize) PVOID                   Buffer,
+		_In_                           SIZE_T                  BufferSize
+	);
+
+	/// @brief Format a record copied by Drain.
+	/// @param Record              Record to format.
+	/// @param Descriptors         Formats of the events.
+	/// @param NumberOfDescriptors Number of formats.
+	/// @param Text                Receives the NULL terminated text, truncated if too small.
+	/// @param TextSize            Size of the text, in characters.
+	/// @return Length of the text, in characters.
+	SIZE_T Format(
+		_In_                            CONST MPP_TRACE_RECORD*     Record,
+		_In_reads_(NumberOfDescriptors) CONST MPP_TRACE_DESCRIPTOR* Descriptors,
+		_In_                            ULONG                       NumberOfDescriptors,
+		_Out_writes_(TextSize)          CHAR*                       Text,
+		_In_                            SIZE_T                      TextSize
+	);
+}
+
+#endif // !__MPP_TRACE_H_GUARD__
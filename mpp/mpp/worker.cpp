@@ -16,6 +16,61 @@ namespace MppWorker {
 
 	/// @brief Work item to protect .text section of a module.
 	PIO_WORKITEM ProtectWorker = nullptr;
+
+	/// @brief Requests of the image loading callback, drained by the work item.
+	MppQueue::MPP_QUEUE<MPP_WORKER_PROTECT_DATA, ProtectQueueCapacity> ProtectQueue{};
+
+	/// @brief Whether the work item is queued or draining the queue.
+	volatile LONG ProtectScheduled = FALSE;
+
+	/// @brief Held from the queueing of the work item until its routine returns.
+	EX_RUNDOWN_REF ProtectRundown{};
+
+	/// @brief Ranges of the images already protected, only used by the work item.
+	MppCache::MPP_CACHE PlanCache{};
+}
+
+
+_Use_decl_annotations_
+BOOLEAN MppWorker::QueueProtect(
+	_In_ CONST MPP_WORKER_PROTECT_DATA& WorkerData
+) {
+	if (!MppQueue::Push(&ProtectQueue, WorkerData))
+		return FALSE;
+
+	// A single work item, queued again once the worker went idle. Not queued anymore once running
+	// down, the request being released by Rundown.
+	if (ProtectWorker != nullptr && ::InterlockedExchange(&ProtectScheduled, TRUE) == FALSE) {
+		if (::ExAcquireRundownProtection(&ProtectRundown)) {
+			::IoQueueWorkItem(
+				ProtectWorker,
+				(PIO_WORKITEM_ROUTINE)MppWorker::ProtectWorkerCallback,
+				DelayedWorkQueue,
+				nullptr
+			);
+		}
+		else
+			::InterlockedExchange(&ProtectScheduled, FALSE);
+	}
+	return TRUE;
+}
+
+
+_Use_decl_annotations_
+VOID __declspec(code_seg("PAGE"))
+MppWorker::Rundown() {
+	PAGED_CODE();
+
+	// The routine finishes the batch it is protecting and returns, the work item is not queued
+	// anymore afterwards
+	::ExWaitForRundownProtectionRelease(&ProtectRundown);
+
+	// Requests left, popped by this thread only from now on
+	MPP_WORKER_PROTECT_DATA WorkerData = { 0x00 };
+	while (MppQueue::Pop(&ProtectQueue, &WorkerData)) {
+		if (WorkerData.ImageFile != nullptr)
+			::ObDereferenceObject(WorkerData.ImageFile);
+	}
 }
 
 
@@ -23,125 +78,224 @@ _Use_decl_annotations_
 VOID __declspec(code_seg("PAGE"))
 MppWorker::ProtectWorkerCallback(
 	_In_     PDEVICE_OBJECT DeviceObject,
-	_In_opt_ PVOID          WorkerData
+	_In_opt_ PVOID          Context
 ) {
 	UNREFERENCED_PARAMETER(DeviceObject);
-	if (WorkerData == nullptr)
-		return;
-	
-	// Get local stack copy of the worker data
-	MppWorker::MPP_WORKER_PROTECT_DATA LocalWorkerData = { 0x00 };
-	RtlCopyMemory(
-		&LocalWorkerData,
-		WorkerData,
-		sizeof(MppWorker::MPP_WORKER_PROTECT_DATA)
-	);
-	MppMemory::MemFree(WorkerData);
-	
+	UNREFERENCED_PARAMETER(Context);
+
+	MPP_WORKER_PROTECT_DATA Batch[ProtectBatchSize] = { 0x00 };
+	MppQueue::MPP_QUEUE_STATISTICS Statistics = { 0x00 };
+
+	do {
+		// Drain by batches, the producers do not wait for the worker
+		ULONG Count = 0x00;
+		do {
+			Count = 0x00;
+			while (Count < ProtectBatchSize && MppQueue::Pop(&ProtectQueue, &Batch[Count]))
+				Count++;
+			for (ULONG cx = 0x00; cx < Count; cx++) {
+				MppStats::Record(&MppGlobals::Statistics, MppStats::LatencyQueueWait, MppStats::GetTime() - Batch[cx].QueuedTime);
+				MppWorker::ProtectImage(Batch[cx]);
+				if (Batch[cx].ImageFile != nullptr)
+					::ObDereferenceObject(Batch[cx].ImageFile);
+			}
+
+			if (Count != 0x00) {
+				MppQueue::GetStatistics(&ProtectQueue, &Statistics);
+				MppLogger::Trace<MppEvents::EventProtectBatch>(
+					Count,
+					Statistics.Depth,
+					Statistics.HighWater,
+					Statistics.Dropped
+				);
+				MppLogger::Trace<MppEvents::EventPlanCache>(
+					PlanCache.Hits,
+					PlanCache.Misses,
+					PlanCache.Evictions
+				);
+			}
+		} while (Count == ProtectBatchSize);
+
+		// Go idle. A request queued after the last pop either sees it and queues the work item, or
+		// is picked up here.
+		::InterlockedExchange(&ProtectScheduled, FALSE);
+		MppQueue::GetStatistics(&ProtectQueue, &Statistics);
+	} while (Statistics.Depth != 0x00 && ::InterlockedExchange(&ProtectScheduled, TRUE) == FALSE);
+
+	// Last action, the work item can be freed once released
+	::ExReleaseRundownProtection(&ProtectRundown);
+}
+
+
+_Use_decl_annotations_
+VOID __declspec(code_seg("PAGE"))
+MppWorker::ProtectImage(
+	_In_ CONST MPP_WORKER_PROTECT_DATA& LocalWorkerData
+) {
 	// Log the information sent via from the callback
-	MppLogger::Info("Process ID : 0x%08x\r\n", ::HandleToULong(LocalWorkerData.ProcessId));
-	MppLogger::Info("Thread  ID : 0x%08x\r\n", ::HandleToULong(LocalWorkerData.ThreadId));
-	MppLogger::Info("Image      : 0x%p\r\n",   LocalWorkerData.ImageBaseAddress);
+	MppLogger::Trace<MppEvents::EventProtectImage>(
+		LocalWorkerData.ProcessId,
+		LocalWorkerData.ThreadId,
+		LocalWorkerData.ImageBaseAddress,
+		LocalWorkerData.Flags
+	);
 
 	// Attack to process
 	PEPROCESS  TargetProcess  = NULL;
 	KAPC_STATE ApcState       = { 0x00 };
 
-	NTSTATUS Status = ::PsLookupProcessByProcessId(LocalWorkerData.ProcessId, &TargetProcess);
+	ULONG64  StartTime = MppStats::GetTime();
+	NTSTATUS Status    = ::PsLookupProcessByProcessId(LocalWorkerData.ProcessId, &TargetProcess);
 	if (!NT_SUCCESS(Status)) {
-		MppLogger::Error("Unable to get PEPROCESS from PID (0x%08X).\r\n", Status);
+		MppStats::Increment(&MppGlobals::Statistics, MppStats::CounterAttachFailures);
+		MppLogger::Trace<MppEvents::EventProcessNotFound>(LocalWorkerData.ProcessId, Status);
 		return;
 	}
 	::KeStackAttachProcess(TargetProcess, &ApcState);
+	MppStats::Record(&MppGlobals::Statistics, MppStats::LatencyAttach, MppStats::GetTime() - StartTime);
 
-	// Get the start and end address of the .text section of the image
-	PVOID AddressStart = nullptr;
-	PVOID AddressEnd   = nullptr;
-
-	MppWorker::GetImageTextSectionAddresses(
-		LocalWorkerData.ImageBaseAddress,
-		&AddressStart,
-		&AddressEnd
-	);
-	if (AddressStart == nullptr || AddressEnd == nullptr) {
+	// Get the page-aligned ranges of the executable sections of the image
+	MppCache::MPP_CACHE_KEY       Key  = { 0x00 };
+	MppSections::MPP_SECTION_PLAN Plan = { 0x00 };
+	if (!MppWorker::GetImagePlan(LocalWorkerData.ImageBaseAddress, LocalWorkerData.ImageSection, &Key, &Plan)) {
 		::KeUnstackDetachProcess(&ApcState);
+		::ObDereferenceObject(TargetProcess);
 
-		MppLogger::Error("Unable get the start and end address of the .text section.\r\n");
+		MppLogger::Trace<MppEvents::EventInvalidSections>(LocalWorkerData.ImageBaseAddress, LocalWorkerData.ProcessId);
 		return;
 	}
-	MppLogger::Info(".text start: 0x%p\r\n", AddressStart);
-	MppLogger::Info(".text end  : 0x%p\r\n", AddressEnd);
+	MppStats::Increment(&MppGlobals::Statistics, MppStats::CounterImagesProtected);
+
+	// One secure entry per range, adjacent sections being merged. Image names added one by one are
+	// accepted before the kernel routines are known, their ranges are counted as not secured.
+	PUCHAR  ImageBase = (PUCHAR)LocalWorkerData.ImageBaseAddress;
+	BOOLEAN Protect   = (LocalWorkerData.Flags & MppPolicy::FlagProtect) != 0x00;
+	if (Protect && !::ReadUCharAcquire(&MppKernelRoutines::RoutinesInitialised)) {
+		MppLogger::Trace<MppEvents::EventRoutinesMissing>(LocalWorkerData.ImageBaseAddress, Plan.NumberOfRanges);
+		for (ULONG cx = 0x00; cx < Plan.NumberOfRanges; cx++)
+			MppStats::Increment(&MppGlobals::Statistics, MppStats::CounterSecureFailures);
+		Protect = FALSE;
+	}
+	for (ULONG cx = 0x00; Protect && cx < Plan.NumberOfRanges; cx++) {
+		PVOID AddressStart = ImageBase + Plan.Ranges[cx].Start;
+		PVOID AddressEnd   = ImageBase + Plan.Ranges[cx].End - 1;
+
+		MppLogger::Trace<MppEvents::EventProtectRange>(AddressStart, AddressEnd);
+		MppWorker::ProtectRange(AddressStart, AddressEnd);
+	}
+
+	// Baseline of the ranges, against the image file, to verify them later
+	if (LocalWorkerData.Flags & MppPolicy::FlagIntegrity) {
+		MppIntegrity::RecordImage(
+			TargetProcess,
+			ImageBase,
+			LocalWorkerData.ImageFile,
+			&Key,
+			&Plan
+		);
+	}
 
+	// Cleanup
+	::KeUnstackDetachProcess(&ApcState);
+	::ObDereferenceObject(TargetProcess);
+	return;
+}
+
+
+_Use_decl_annotations_
+BOOLEAN __declspec(code_seg("PAGE"))
+MppWorker::GetImagePlan(
+	_In_     PVOID                          ImageBaseAddress,
+	_In_opt_ PVOID                          ImageSection,
+	_Out_    MppCache::MPP_CACHE_KEY*       Key,
+	_Out_    MppSections::MPP_SECTION_PLAN* Plan
+) {
+	RtlZeroMemory(Key, sizeof(MppCache::MPP_CACHE_KEY));
+	Plan->SizeOfImage    = 0x00;
+	Plan->NumberOfRanges = 0x00;
+	if (ImageBaseAddress == NULL)
+		return FALSE;
+
+	// The headers are mapped in user mode, the process can change or unmap them at any time
+	MppSections::MPP_SECTION_IDENTITY Identity = { 0x00 };
+	BOOLEAN                           Valid    = FALSE;
+	BOOLEAN                           Cached   = FALSE;
+	__try {
+		::ProbeForRead(ImageBaseAddress, MppSections::PageSize, sizeof(UCHAR));
+		Valid = MppSections::GetIdentity(
+			(CONST UCHAR*)ImageBaseAddress,
+			MppSections::PageSize,
+			&Identity
+		);
+		if (!Valid)
+			__leave;
+
+		// The image is shared between the processes loading it, plan it only once
+		Key->Section       = ImageSection;
+		Key->TimeDateStamp = Identity.TimeDateStamp;
+		Key->SizeOfImage   = Identity.SizeOfImage;
+		Cached = MppCache::Lookup(&PlanCache, Key, Plan);
+		if (Cached)
+			__leave;
+
+		Valid = MppSections::Plan(
+			(CONST UCHAR*)ImageBaseAddress,
+			MppSections::PageSize,
+			Plan
+		);
+		if (Valid)
+			MppCache::Insert(&PlanCache, Key, Plan);
+	}
+	__except (EXCEPTION_EXECUTE_HANDLER) {
+		Valid = FALSE;
+	}
+	return Valid;
+}
+
+
+_Use_decl_annotations_
+BOOLEAN __declspec(code_seg("PAGE"))
+MppWorker::ProtectRange(
+	_In_ PVOID AddressStart,
+	_In_ PVOID AddressEnd
+) {
 	// Raise IRQL to APC_LEVEL (1)
 	KIRQL OldIRQL = ::KfRaiseIrql(APC_LEVEL);
 
 	// Get a reference to the Virtual Address Descriptor (VAD)
+	NTSTATUS Status = STATUS_SUCCESS;
 	PVOID VadObject = MppKernelRoutines::MiObtainReferencedVadEx(
 		AddressStart,
 		0x00,
 		&Status
 	);
 	if (!NT_SUCCESS(Status)) {
-		MppLogger::Error("Unable to get VAD for address (0x%08X).\r\n", Status);
+		MppLogger::Trace<MppEvents::EventVadNotFound>(AddressStart, Status);
 
 		::KeLowerIrql(OldIRQL);
-		::KeUnstackDetachProcess(&ApcState);
-		return;
+		return FALSE;
 	}
 
-	// Enforce non-writable and non-modifiable memory pages
-	PVOID PoolMm = MppKernelRoutines::MiAddSecureEntry(
+	// Enforce non-writable and non-modifiable memory pages, the end address being inclusive
+	ULONG64 StartTime = MppStats::GetTime();
+	PVOID   PoolMm    = MppKernelRoutines::MiAddSecureEntry(
 		VadObject,
 		AddressStart,
 		AddressEnd,
 		(PAGE_REVERT_TO_FILE_MAP | PAGE_TARGETS_NO_UPDATE | PAGE_NOACCESS),
 		(MM_SECURE_USER_MODE_ONLY | MM_SECURE_NO_CHANGE)
 	);
-	if (!(PoolMm >= 0x00)) {
-		MppLogger::Error("Unable to secure image (0x%08X).\r\n", Status);
-	}
+	MppStats::Record(&MppGlobals::Statistics, MppStats::LatencySecure, MppStats::GetTime() - StartTime);
+	MppStats::Increment(
+		&MppGlobals::Statistics,
+		PoolMm != nullptr ? MppStats::CounterRangesSecured : MppStats::CounterSecureFailures
+	);
+	if (PoolMm == nullptr)
+		MppLogger::Trace<MppEvents::EventSecureFailed>(AddressStart);
 
 	// Cleanup
 	MppKernelRoutines::MiUnlockAndDereferenceVad(VadObject);
 
 	::KeLowerIrql(OldIRQL);
-	::KeUnstackDetachProcess(&ApcState);
-	return;
-}
-
-
-_Use_decl_annotations_
-VOID __declspec(code_seg("PAGE"))
-MppWorker::GetImageTextSectionAddresses(
-	_In_  PVOID  ImageBaseAddress,
-	_Out_ PVOID* AddressStart,
-	_Out_ PVOID* AddressEnd
-) {
-	if (ImageBaseAddress == NULL)
-		return;
-	*AddressStart = 0x00;
-	*AddressEnd   = 0x00;
-
-	PIMAGE_DOS_HEADER ImageDOSHeader = (PIMAGE_DOS_HEADER)ImageBaseAddress;
-	if (ImageDOSHeader->e_magic != IMAGE_DOS_SIGNATURE) {
-		MppLogger::Error("Invalid DOS signature.\r\n");
-		return;
-	}
-
-	PIMAGE_NT_HEADERS ImageNTHeaders = (PIMAGE_NT_HEADERS)((PUCHAR)ImageBaseAddress + ImageDOSHeader->e_lfanew);
-	if (ImageNTHeaders->Signature != IMAGE_NT_SIGNATURE) {
-		MppLogger::Error("Invalid NT Headers signature.\r\n");
-		return;
-	}
-
-	PIMAGE_SECTION_HEADER SectionHeader = IMAGE_FIRST_SECTION(ImageNTHeaders);
-	while (TRUE) {
-		if (MppWorker::IsTextSection(SectionHeader->Name))
-			break;
-		SectionHeader = (PIMAGE_SECTION_HEADER)((PUCHAR)SectionHeader + IMAGE_SIZEOF_SECTION_HEADER);
-	}
-
-	*AddressStart = (PVOID)(((ULONG_PTR)ImageBaseAddress  + SectionHeader->VirtualAddress) & 0xFFFFFFFFFFFFF000);
-	*AddressEnd   = (PVOID)((ULONG_PTR)*AddressStart + SectionHeader->SizeOfRawData);
-	return;
+	return PoolMm != nullptr;
 }
@@ -12,58 +12,111 @@ Memory Patching Protection (MPP) Worker for Image .text section protection.
 #define __MPP_WORKER_H_GUARD__
 
 #include "mpp.hpp"
+#include "cache.hpp"
+#include "integrity.hpp"
+#include "queue.hpp"
+#include "sections.hpp"
 #include "worker.hpp"
 
 /// @brief System worker information
 namespace MppWorker {
 
+	/// @brief Number of requests the protect queue can hold.
+	constexpr ULONG ProtectQueueCapacity = 0x100;
+
+	/// @brief Number of requests dequeued at once by the worker.
+	constexpr ULONG ProtectBatchSize = 0x10;
+
+	/// @brief Data Context for the protect worker.
+	typedef struct _MPP_WORKER_PROTECT_DATA {
+		HANDLE       ThreadId;
+		HANDLE       ProcessId;
+		PVOID        ImageBaseAddress;
+		PVOID        ImageSection; // Section object pointers of the image file, may be nullptr
+		PFILE_OBJECT ImageFile;    // Referenced file of the image, released by the worker, may be nullptr
+		ULONG        Flags;        // Protections to apply, MppPolicy::Flag*
+		ULONG64      QueuedTime;   // MppStats::GetTime when queued
+	} MPP_WORKER_PROTECT_DATA, *PMPP_WORKER_PROTECT_DATA;
+
 	/// @brief Work item to protect .text section of a module.
 	extern PIO_WORKITEM ProtectWorker;
 
-	/// @brief Image Loading callback registered via PsSetLoadImageNotifyRoutine.
-	/// @param FullImageName Name of the image loaded from the system.
-	/// @param ProcessId     Current process unique ID.
-	/// @param ImageInfo     Further information about the image being loaded.
+	/// @brief Requests of the image loading callback, drained by the work item.
+	extern MppQueue::MPP_QUEUE<MPP_WORKER_PROTECT_DATA, ProtectQueueCapacity> ProtectQueue;
+
+	/// @brief Whether the work item is queued or draining the queue.
+	extern volatile LONG ProtectScheduled;
+
+	/// @brief Held from the queueing of the work item until its routine returns.
+	extern EX_RUNDOWN_REF ProtectRundown;
+
+	/// @brief Ranges of the images already protected, only used by the work item.
+	extern MppCache::MPP_CACHE PlanCache;
+
+	/// @brief Queue a request and schedule the work item if idle. Does not wait.
+	/// @param WorkerData Request to copy.
+	/// @return Whether the request has been queued, FALSE if the queue was full.
+	BOOLEAN
+	_IRQL_requires_max_(DISPATCH_LEVEL)
+	QueueProtect(
+		_In_ CONST MPP_WORKER_PROTECT_DATA& WorkerData
+	);
+
+	/// @brief Wait for the routine of the work item to return and release the requests left in the
+	/// queue. The work item is not queued anymore, it can be freed afterwards.
+	VOID __declspec(code_seg("PAGE"))
+	_IRQL_requires_min_(PASSIVE_LEVEL)
+	_IRQL_requires_max_(PASSIVE_LEVEL)
+	Rundown();
+
+	/// @brief Work item routine, protect the images of the queued requests by batches.
+	/// @param DeviceObject Device object of the work item.
+	/// @param Context      Unused.
 	VOID __declspec(code_seg("PAGE"))
 	_IRQL_requires_min_(PASSIVE_LEVEL)
 	_IRQL_requires_max_(PASSIVE_LEVEL)
 	ProtectWorkerCallback(
 		_In_     PDEVICE_OBJECT DeviceObject,
-		_In_opt_ PVOID          WorkerData
+		_In_opt_ PVOID          Context
 	);
 
-
-	/// @brief Get the start and end address of the .text section of an image
-	/// @param ImageBaseAddress Base address of the image being loaded.
-	/// @param AddressStart     Start address.
-	/// @param AddressEnd       End address.
+	/// @brief Protect the executable sections of an image.
+	/// @param WorkerData Process and image to protect.
 	VOID __declspec(code_seg("PAGE"))
 	_IRQL_requires_min_(PASSIVE_LEVEL)
 	_IRQL_requires_max_(PASSIVE_LEVEL)
-	GetImageTextSectionAddresses(
-		_In_  PVOID  ImageBaseAddress,
-		_Out_ PVOID* AddressStart,
-		_Out_ PVOID* AddressEnd
+	ProtectImage(
+		_In_ CONST MPP_WORKER_PROTECT_DATA& WorkerData
 	);
 
-	/// @brief Check if section name is ".text"
-	/// @param x Section name array.
-	constexpr bool IsTextSection(UCHAR x[0x08]) {
-		return (
-			x[0x00] == '.'
-			&& x[0x01] == 't'
-			&& x[0x02] == 'e'
-			&& x[0x03] == 'x'
-			&& x[0x04] == 't'
-		);
-	}
+	/// @brief Get the ranges of the executable sections of an image, mapped in the current process.
+	/// Only the identity of the image is read if its ranges are cached.
+	/// @param ImageBaseAddress Base address of the image being loaded.
+	/// @param ImageSection     Section object pointers of the image file, may be nullptr.
+	/// @param Key              Receives the identity of the image.
+	/// @param Plan             Receives the ranges.
+	/// @return Whether the headers are valid and readable.
+	BOOLEAN __declspec(code_seg("PAGE"))
+	_IRQL_requires_min_(PASSIVE_LEVEL)
+	_IRQL_requires_max_(PASSIVE_LEVEL)
+	GetImagePlan(
+		_In_     PVOID                          ImageBaseAddress,
+		_In_opt_ PVOID                          ImageSection,
+		_Out_    MppCache::MPP_CACHE_KEY*       Key,
+		_Out_    MppSections::MPP_SECTION_PLAN* Plan
+	);
 
-	/// @brief Data Context for the protect worker.
-	typedef struct _MPP_WORKER_PROTECT_DATA {
-		HANDLE ThreadId;
-		HANDLE ProcessId;
-		PVOID  ImageBaseAddress;
-	} MPP_WORKER_PROTECT_DATA, *PMPP_WORKER_PROTECT_DATA;
+	/// @brief Make a range of the current process non-writable and non-modifiable.
+	/// @param AddressStart First byte of the range.
+	/// @param AddressEnd   Last byte of the range.
+	/// @return Whether the range has been secured.
+	BOOLEAN __declspec(code_seg("PAGE"))
+	_IRQL_requires_min_(PASSIVE_LEVEL)
+	_IRQL_requires_max_(PASSIVE_LEVEL)
+	ProtectRange(
+		_In_ PVOID AddressStart,
+		_In_ PVOID AddressEnd
+	);
 }
 
 #endif // !__MPP_WORKER_H_GUARD__
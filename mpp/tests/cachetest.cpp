@@ -0,0 +1,298 @@
+/*+================================================================================================
+Module Name: cachetest.cpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+Abstract:
+Test of the Memory Patching Protection (MPP) cache of the ranges to protect per image.
+Images of the same set are inserted and looked up in a fixed order, the least recently used one
+being evicted, including when the clock wraps. An image whose section, TimeDateStamp or SizeOfImage
+changed is another image and must miss, and an image with too many ranges is never stored. Last,
+random lookups and insertions of images sharing the sets are compared with a model of each set in
+order of use, ranges and counters included. The number of operations can be given on the command
+line.
+
+Build: c++ -std=c++17 -O2 -g [-fsanitize=address,undefined] ../mpp/cache.cpp cachetest.cpp -o cachetest
+================================================================================================+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "../mpp/cache.hpp"
+
+/// @brief Default number of random operations.
+#define CACHETEST_OPERATIONS (ULONG)0x100000
+
+/// @brief Number of images of the random operations, a few per set.
+#define CACHETEST_IMAGES (ULONG)0x180
+
+/// @brief Number of sets of the cache.
+#define CACHETEST_SETS (MppCache::NumberOfEntries / MppCache::Associativity)
+
+/// @brief Image of the tests and the ranges last inserted for it.
+typedef struct _CACHETEST_IMAGE {
+	MppCache::MPP_CACHE_KEY       Key;
+	ULONG                         Set;
+	MppSections::MPP_SECTION_PLAN Plan;
+} CACHETEST_IMAGE, * PCACHETEST_IMAGE;
+
+/// @brief Set an image is stored in, found by inserting it in an empty cache.
+static ULONG CacheTestGetSet(
+	_In_ CONST MppCache::MPP_CACHE_KEY& Key
+) {
+	static MppCache::MPP_CACHE Cache;
+	MppCache::Initialise(&Cache);
+
+	MppSections::MPP_SECTION_PLAN Plan = { 0x00 };
+	(VOID)MppCache::Insert(&Cache, &Key, &Plan);
+	for (ULONG cx = 0x00; cx < MppCache::NumberOfEntries; cx++) {
+		if (Cache.Entries[cx].LastUse != 0x00)
+			return cx / MppCache::Associativity;
+	}
+	return 0x00;
+}
+
+/// @brief Random image, with random ranges.
+static CACHETEST_IMAGE CacheTestGenerate(
+	_Inout_ std::mt19937_64& Random
+) {
+	CACHETEST_IMAGE Image = { 0x00 };
+
+	// Section object pointers are aligned, the image of a kernel module has none
+	Image.Key.Section       = (Random() % 0x10) == 0x00 ? nullptr : (CONST VOID*)(ULONG_PTR)(0xFFFF800000000000ULL | (Random() & 0x7FFFFFFFFFF0ULL));
+	Image.Key.TimeDateStamp = (ULONG)Random();
+	Image.Key.SizeOfImage   = ((ULONG)Random() & 0x00FFF000) + 0x1000;
+	Image.Set               = CacheTestGetSet(Image.Key);
+
+	Image.Plan.SizeOfImage    = Image.Key.SizeOfImage;
+	Image.Plan.NumberOfRanges = (ULONG)(Random() % (MppCache::MaximumRanges + 0x01));
+	for (ULONG cx = 0x00; cx < Image.Plan.NumberOfRanges; cx++) {
+		ULONG Start = (ULONG)(Random() % Image.Key.SizeOfImage);
+		Image.Plan.Ranges[cx] = { Start, Start + (ULONG)(Random() % (Image.Key.SizeOfImage - Start + 0x01)) };
+	}
+	return Image;
+}
+
+/// @brief Images of the same set, all different.
+static std::vector<CACHETEST_IMAGE> CacheTestGenerateSet(
+	_Inout_ std::mt19937_64& Random,
+	_In_    ULONG            NumberOfImages
+) {
+	std::vector<CACHETEST_IMAGE> Images = { CacheTestGenerate(Random) };
+	while (Images.size() < NumberOfImages) {
+		CACHETEST_IMAGE Image = CacheTestGenerate(Random);
+		if (Image.Set == Images[0x00].Set)
+			Images.push_back(Image);
+	}
+	return Images;
+}
+
+/// @brief Whether an image is found, with the ranges last inserted for it.
+static BOOLEAN CacheTestLookup(
+	_Inout_ MppCache::MPP_CACHE*   Cache,
+	_In_    CONST CACHETEST_IMAGE& Image
+) {
+	MppSections::MPP_SECTION_PLAN Plan = { 0x00 };
+	if (!MppCache::Lookup(Cache, &Image.Key, &Plan))
+		return FALSE;
+
+	BOOLEAN Same = Plan.SizeOfImage == Image.Plan.SizeOfImage && Plan.NumberOfRanges == Image.Plan.NumberOfRanges;
+	for (ULONG cx = 0x00; Same && cx < Plan.NumberOfRanges; cx++) {
+		Same = Plan.Ranges[cx].Start == Image.Plan.Ranges[cx].Start
+			&& Plan.Ranges[cx].End == Image.Plan.Ranges[cx].End;
+	}
+	if (!Same)
+		::printf("[-] Image 0x%08X: ranges are not the ones inserted\r\n", Image.Key.TimeDateStamp);
+	return Same;
+}
+
+/// @brief Compare which images of a set are found with the ones expected, in order.
+static ULONG CacheTestExpect(
+	_Inout_ MppCache::MPP_CACHE*                Cache,
+	_In_    CONST std::vector<CACHETEST_IMAGE>& Images,
+	_In_    CONST CHAR*                         Found,
+	_In_    CONST CHAR*                         Test
+) {
+	ULONG Differences = 0x00;
+	for (ULONG cx = 0x00; cx < Images.size(); cx++) {
+		BOOLEAN Expected = Found[cx] == '1';
+		if (CacheTestLookup(Cache, Images[cx]) != Expected) {
+			::printf("[-] %s: image %u %s\r\n", Test, cx, Expected ? "evicted" : "kept");
+			Differences++;
+		}
+	}
+	return Differences;
+}
+
+/// @brief Evictions of the least recently used image of a set.
+static ULONG CacheTestEvictions(
+	_Inout_ std::mt19937_64& Random
+) {
+	std::unique_ptr<MppCache::MPP_CACHE> Cache(new MppCache::MPP_CACHE);
+	std::vector<CACHETEST_IMAGE>         Images = CacheTestGenerateSet(Random, 0x07);
+	ULONG                                Differences = 0x00;
+
+	// Filled, then 0 and 2 used again, 1 then 3 are the oldest
+	MppCache::Initialise(Cache.get());
+	for (ULONG cx = 0x00; cx < MppCache::Associativity; cx++)
+		(VOID)MppCache::Insert(Cache.get(), &Images[cx].Key, &Images[cx].Plan);
+	(VOID)CacheTestLookup(Cache.get(), Images[0x00]);
+	(VOID)CacheTestLookup(Cache.get(), Images[0x02]);
+	(VOID)MppCache::Insert(Cache.get(), &Images[0x04].Key, &Images[0x04].Plan);
+	(VOID)MppCache::Insert(Cache.get(), &Images[0x05].Key, &Images[0x05].Plan);
+	Differences += CacheTestExpect(Cache.get(), Images, "1010110", "Least recently used");
+	if (Cache->Evictions != 0x02) {
+		::printf("[-] Least recently used: %lld eviction(s), 2 expected\r\n", (long long)Cache->Evictions);
+		Differences++;
+	}
+
+	// Inserted again in place, the others of the set are kept
+	Images[0x04].Plan.NumberOfRanges = 0x00;
+	(VOID)MppCache::Insert(Cache.get(), &Images[0x04].Key, &Images[0x04].Plan);
+	Differences += CacheTestExpect(Cache.get(), Images, "1010110", "Inserted again");
+
+	// Lookups of 0, 2, 4 and 5 in that order above, 0 is now the oldest
+	(VOID)MppCache::Insert(Cache.get(), &Images[0x06].Key, &Images[0x06].Plan);
+	Differences += CacheTestExpect(Cache.get(), Images, "0010111", "Oldest lookup");
+	if (Cache->Evictions != 0x03) {
+		::printf("[-] Oldest lookup: %lld eviction(s), 3 expected\r\n", (long long)Cache->Evictions);
+		Differences++;
+	}
+
+	// The clock wraps after the first two insertions, 1 used again after it and 0 is the oldest
+	MppCache::Initialise(Cache.get());
+	Cache->Clock = 0xFFFFFFFD;
+	for (ULONG cx = 0x00; cx < MppCache::Associativity; cx++)
+		(VOID)MppCache::Insert(Cache.get(), &Images[cx].Key, &Images[cx].Plan);
+	(VOID)CacheTestLookup(Cache.get(), Images[0x01]);
+	(VOID)MppCache::Insert(Cache.get(), &Images[0x04].Key, &Images[0x04].Plan);
+	Differences += CacheTestExpect(Cache.get(), Images, "0111100", "Clock wrapped");
+	return Differences;
+}
+
+/// @brief Images whose identity changed, and images with too many ranges.
+static ULONG CacheTestKeys(
+	_Inout_ std::mt19937_64& Random
+) {
+	std::unique_ptr<MppCache::MPP_CACHE> Cache(new MppCache::MPP_CACHE);
+	ULONG                                Differences = 0x00;
+	MppCache::Initialise(Cache.get());
+
+	for (ULONG cx = 0x00; cx < 0x100; cx++) {
+		CACHETEST_IMAGE Image = CacheTestGenerate(Random);
+		(VOID)MppCache::Insert(Cache.get(), &Image.Key, &Image.Plan);
+
+		// Rebuilt, or another file mapped from the same section, in the same set so that only the
+		// comparison of the identities tells them apart
+		CACHETEST_IMAGE Changed[0x03] = { Image, Image, Image };
+		do {
+			Changed[0x00].Key.TimeDateStamp = (ULONG)Random();
+		} while (Changed[0x00].Key.TimeDateStamp == Image.Key.TimeDateStamp || CacheTestGetSet(Changed[0x00].Key) != Image.Set);
+		do {
+			Changed[0x01].Key.SizeOfImage += 0x1000;
+		} while (CacheTestGetSet(Changed[0x01].Key) != Image.Set);
+		do {
+			Changed[0x02].Key.Section = (CONST VOID*)((ULONG_PTR)Changed[0x02].Key.Section + 0x10);
+		} while (CacheTestGetSet(Changed[0x02].Key) != Image.Set);
+		for (ULONG dx = 0x00; dx < 0x03; dx++) {
+			MppSections::MPP_SECTION_PLAN Plan = { 0x00 };
+			if (MppCache::Lookup(Cache.get(), &Changed[dx].Key, &Plan)) {
+				CONST CHAR* Fields[0x03] = { "TimeDateStamp", "SizeOfImage", "Section" };
+				::printf("[-] Image 0x%08X: found with another %s\r\n", Image.Key.TimeDateStamp, Fields[dx]);
+				Differences++;
+			}
+		}
+		if (!CacheTestLookup(Cache.get(), Image)) {
+			::printf("[-] Image 0x%08X: not found\r\n", Image.Key.TimeDateStamp);
+			Differences++;
+		}
+	}
+
+	// Always planned again
+	CACHETEST_IMAGE Image = CacheTestGenerate(Random);
+	Image.Plan.NumberOfRanges = MppCache::MaximumRanges + 0x01;
+	if (MppCache::Insert(Cache.get(), &Image.Key, &Image.Plan) || CacheTestLookup(Cache.get(), Image)) {
+		::printf("[-] Image with %u ranges stored\r\n", Image.Plan.NumberOfRanges);
+		Differences++;
+	}
+	return Differences;
+}
+
+/// @brief Random lookups and insertions, compared with the images of each set in order of use.
+static ULONG CacheTestRandom(
+	_Inout_ std::mt19937_64& Random,
+	_In_    ULONG            NumberOfOperations
+) {
+	std::unique_ptr<MppCache::MPP_CACHE> Cache(new MppCache::MPP_CACHE);
+	std::vector<CACHETEST_IMAGE>         Images;
+	std::vector<std::vector<ULONG>>      Sets(CACHETEST_SETS);
+	LONG64                               Hits = 0x00, Misses = 0x00, Evictions = 0x00;
+	ULONG                                Differences = 0x00;
+
+	MppCache::Initialise(Cache.get());
+	for (ULONG cx = 0x00; cx < CACHETEST_IMAGES; cx++)
+		Images.push_back(CacheTestGenerate(Random));
+
+	for (ULONG cx = 0x00; cx < NumberOfOperations && Differences < 0x10; cx++) {
+		ULONG               Index = (ULONG)(Random() % Images.size());
+		CACHETEST_IMAGE&    Image = Images[Index];
+		std::vector<ULONG>& Set   = Sets[Image.Set];
+		auto                Used  = std::find(Set.begin(), Set.end(), Index);
+		BOOLEAN             Found = Used != Set.end();
+		if (Found)
+			Set.erase(Used);
+
+		if ((Random() % 0x02) == 0x00) {
+			// Found or not, the image is then inserted as after being planned
+			if (CacheTestLookup(Cache.get(), Image) != Found) {
+				::printf("[-] Operation %u: image %u %s\r\n", cx, Index, Found ? "not found" : "found");
+				Differences++;
+			}
+			Hits   += Found;
+			Misses += !Found;
+			if (Found) {
+				Set.insert(Set.begin(), Index);
+				continue;
+			}
+		}
+
+		// Planned again at times, with the same ranges or not
+		if ((Random() % 0x04) == 0x00)
+			Image.Plan.NumberOfRanges = (ULONG)(Random() % (MppCache::MaximumRanges + 0x01));
+		if (!Found && Set.size() == MppCache::Associativity) {
+			Set.pop_back();
+			Evictions++;
+		}
+		Set.insert(Set.begin(), Index);
+		(VOID)MppCache::Insert(Cache.get(), &Image.Key, &Image.Plan);
+	}
+
+	if (Cache->Hits != Hits || Cache->Misses != Misses || Cache->Evictions != Evictions) {
+		::printf("[-] %lld hit(s), %lld miss(es) and %lld eviction(s), %lld, %lld and %lld expected\r\n",
+			(long long)Cache->Hits, (long long)Cache->Misses, (long long)Cache->Evictions, (long long)Hits, (long long)Misses, (long long)Evictions);
+		Differences++;
+	}
+	::printf("[+] %u operation(s), %lld hit(s), %lld miss(es), %lld eviction(s)\r\n", NumberOfOperations, (long long)Hits, (long long)Misses, (long long)Evictions);
+	return Differences;
+}
+
+int main(int argc, char** argv) {
+	ULONG NumberOfOperations = argc > 1 ? (ULONG)strtoul(argv[1], NULL, 0x00) : CACHETEST_OPERATIONS;
+	if (NumberOfOperations == 0x00) {
+		::printf("usage: %s [operations]\r\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	std::mt19937_64 Random(0x4341434845);
+	ULONG           Differences = CacheTestEvictions(Random);
+	Differences += CacheTestKeys(Random);
+	Differences += CacheTestRandom(Random, NumberOfOperations);
+
+	::printf("[+] %u difference(s)\r\n", Differences);
+	return Differences == 0x00 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
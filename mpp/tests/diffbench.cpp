@@ -0,0 +1,305 @@
+/*+================================================================================================
+Module Name: diffbench.cpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+Abstract:
+Benchmark of the Memory Patching Protection (MPP) differences between an image and its file.
+Buffers of every size up to a few chunks, with differences at their bounds, close to each other
+by the merge distance or longer than the bytes copied, are compared and checked entry by entry
+against a comparison byte by byte. Random images are then loaded at another address and patched,
+and their ranges compared with the ones rebuilt from their file, as DiffImage does: each patch of
+code must be reported once, and nothing else. The number of images and the size of the buffer
+timed can be given on the command line.
+
+Build: c++ -std=c++17 -O2 -g [-fsanitize=address,undefined] ../mpp/diff.cpp ../mpp/sections.cpp diffbench.cpp -o diffbench
+================================================================================================+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <random>
+
+#include "../mpp/diff.hpp"
+#include "../mpp/sections.hpp"
+#include "peimage.hpp"
+
+/// @brief Default number of images, and size of the buffer timed.
+#define DIFFBENCH_IMAGES (ULONG)0x40
+#define DIFFBENCH_SIZE   (SIZE_T)0x100000
+
+/// @brief Largest buffer checked one size at a time.
+#define DIFFBENCH_CHECKED (SIZE_T)0x140
+
+/// @brief Entries filled per comparison, as many as a result of the IOCTL.
+#define DIFFBENCH_ENTRIES (ULONG)0x20
+
+/// @brief Patch written over the code of an image.
+typedef struct _DIFFBENCH_PATCH {
+	ULONG Rva;
+	ULONG Length;
+} DIFFBENCH_PATCH, * PDIFFBENCH_PATCH;
+
+/// @brief Compare byte by byte, with the merging and the copies documented.
+static ULONG DiffBenchReference(
+	_In_  CONST UCHAR*                         Expected,
+	_In_  CONST UCHAR*                         Actual,
+	_In_  SIZE_T                               Size,
+	_In_  ULONG                                Rva,
+	_In_  ULONG                                MaximumEntries,
+	_Out_ std::vector<MppDiff::MPP_DIFF_ENTRY>& Entries
+) {
+	Entries.clear();
+	ULONG NumberOfDifferences = 0x00;
+	for (SIZE_T First = 0x00; First < Size; First++) {
+		if (Expected[First] == Actual[First])
+			continue;
+
+		// Fewer than MergeDistance identical bytes between two differences
+		SIZE_T Last = First;
+		for (SIZE_T Next = First + 1; Next < Size && (Next - Last) <= MppDiff::MergeDistance; Next++) {
+			if (Expected[Next] != Actual[Next])
+				Last = Next;
+		}
+		NumberOfDifferences++;
+
+		if (Entries.size() < MaximumEntries) {
+			MppDiff::MPP_DIFF_ENTRY Entry = { 0x00 };
+			SIZE_T Copied = (Last - First + 1) < MppDiff::MaximumBytes ? (Last - First + 1) : MppDiff::MaximumBytes;
+			SIZE_T Before = First < MppDiff::ContextSize ? First : MppDiff::ContextSize;
+			SIZE_T After  = (Size - (First + Copied)) < MppDiff::ContextSize ? (Size - (First + Copied)) : MppDiff::ContextSize;
+
+			Entry.Rva           = Rva + (ULONG)First;
+			Entry.Length        = (ULONG)(Last - First + 1);
+			Entry.ContextRva    = Rva + (ULONG)(First - Before);
+			Entry.ContextLength = (ULONG)(Before + Copied + After);
+			for (ULONG cx = 0x00; cx < Entry.ContextLength; cx++) {
+				Entry.Expected[cx] = Expected[First - Before + cx];
+				Entry.Actual[cx]   = Actual[First - Before + cx];
+			}
+			Entries.push_back(Entry);
+		}
+		First = Last;
+	}
+	return NumberOfDifferences;
+}
+
+/// @brief Check the comparison of two buffers against the reference, for a few numbers of entries.
+static ULONG DiffBenchCheck(
+	_In_ CONST std::vector<UCHAR>& Expected,
+	_In_ CONST std::vector<UCHAR>& Actual,
+	_In_ ULONG                     Rva
+) {
+	static CONST ULONG Maximums[] = { 0x00, 0x01, 0x03, DIFFBENCH_ENTRIES };
+
+	ULONG Differences = 0x00;
+	for (ULONG MaximumEntries : Maximums) {
+		std::vector<MppDiff::MPP_DIFF_ENTRY> Entries(MaximumEntries + 0x01);
+		std::vector<MppDiff::MPP_DIFF_ENTRY> Reference;
+		ULONG NumberOfEntries = 0x00;
+
+		memset(Entries.data(), 0xEE, Entries.size() * sizeof(MppDiff::MPP_DIFF_ENTRY));
+		ULONG Found          = MppDiff::Compare(Expected.data(), Actual.data(), Expected.size(), Rva, Entries.data(), MaximumEntries, &NumberOfEntries);
+		ULONG ReferenceFound = DiffBenchReference(Expected.data(), Actual.data(), Expected.size(), Rva, MaximumEntries, Reference);
+
+		BOOLEAN Same = Found == ReferenceFound && NumberOfEntries == Reference.size() && Entries[NumberOfEntries].Rva == 0xEEEEEEEE;
+		for (ULONG cx = 0x00; Same && cx < NumberOfEntries; cx++)
+			Same = memcmp(&Entries[cx], &Reference[cx], sizeof(MppDiff::MPP_DIFF_ENTRY)) == 0x00;
+		if (!Same) {
+			::printf("[-] %zu byte(s), %u entries: %u difference(s) in %u entries, %u in %zu expected\r\n",
+				Expected.size(), MaximumEntries, Found, NumberOfEntries, ReferenceFound, Reference.size());
+			Differences++;
+		}
+	}
+	return Differences;
+}
+
+/// @brief Check buffers of every size, with differences placed where they are merged or copied apart.
+static ULONG DiffBenchCheckBuffers(
+	_Inout_ std::mt19937& Random
+) {
+	ULONG Differences = 0x00;
+	for (SIZE_T Size = 0x00; Size <= DIFFBENCH_CHECKED; Size++) {
+		std::vector<UCHAR> Expected(Size);
+		for (UCHAR& Byte : Expected)
+			Byte = (UCHAR)Random();
+
+		for (ULONG Round = 0x00; Round < 0x10; Round++) {
+			std::vector<UCHAR> Actual = Expected;
+			if (Size != 0x00) {
+				switch (Round % 0x08) {
+				case 0x00:
+					break;
+				case 0x01:
+					Actual.front() ^= 0x01;
+					Actual.back()  ^= 0x80;
+					break;
+				case 0x02: {
+					// Differences separated by the merge distance, and one byte more or less
+					SIZE_T Position = Random() % Size;
+					SIZE_T Gap      = MppDiff::MergeDistance - 0x01 + (Random() % 0x03);
+					for (; Position < Size; Position += Gap + 0x01)
+						Actual[Position] ^= 0xFF;
+					break;
+				}
+				case 0x03: {
+					// Longer than the bytes copied
+					SIZE_T Position = Random() % Size;
+					SIZE_T Length   = MppDiff::MaximumBytes - 0x02 + (Random() % 0x08);
+					for (SIZE_T cx = Position; cx < Size && cx < Position + Length; cx++)
+						Actual[cx] ^= 0x5A;
+					break;
+				}
+				default: {
+					ULONG Count = 0x01 + (Random() % 0x10);
+					for (ULONG cx = 0x00; cx < Count; cx++)
+						Actual[Random() % Size] ^= (UCHAR)(0x01 + (Random() % 0xFF));
+					break;
+				}
+				}
+			}
+			Differences += DiffBenchCheck(Expected, Actual, 0x1000 + (ULONG)(Random() % 0x10000));
+		}
+	}
+	return Differences;
+}
+
+/// @brief Compare the ranges of an image with the ones rebuilt from its file, as DiffImage does.
+/// @return Number of differences, and the entries of the first ones.
+static ULONG DiffBenchDiffImage(
+	_In_  CONST std::vector<UCHAR>&             File,
+	_In_  ULONG64                               ImageBase,
+	_In_  CONST std::vector<UCHAR>&             Image,
+	_Out_ std::vector<MppDiff::MPP_DIFF_ENTRY>& Entries
+) {
+	Entries.assign(DIFFBENCH_ENTRIES, {});
+	ULONG NumberOfEntries     = 0x00;
+	ULONG NumberOfDifferences = 0x00;
+
+	MppSections::MPP_SECTION_PLAN Plan = { 0x00 };
+	if (!MppSections::Plan(File.data(), File.size(), &Plan))
+		return 0xFFFFFFFF;
+
+	for (ULONG cx = 0x00; cx < Plan.NumberOfRanges; cx++) {
+		CONST MppSections::MPP_SECTION_RANGE* Range = &Plan.Ranges[cx];
+		std::vector<UCHAR> Expected(Range->End - Range->Start);
+		if (!MppSections::MapFileRange(File.data(), File.size(), ImageBase, Range, Expected.data()))
+			return 0xFFFFFFFF;
+
+		ULONG Filled = 0x00;
+		NumberOfDifferences += MppDiff::Compare(
+			Expected.data(),
+			Image.data() + Range->Start,
+			Expected.size(),
+			Range->Start,
+			&Entries[NumberOfEntries],
+			DIFFBENCH_ENTRIES - NumberOfEntries,
+			&Filled
+		);
+		NumberOfEntries += Filled;
+	}
+	Entries.resize(NumberOfEntries);
+	return NumberOfDifferences;
+}
+
+/// @brief Load a random image at another address, patch it, and check the differences reported.
+static ULONG DiffBenchCheckImage(
+	_Inout_ std::mt19937& Random,
+	_In_    BOOLEAN       Is64
+) {
+	PEIMAGE            Image     = PeImageGenerate(Random, Is64);
+	std::vector<UCHAR> File      = PeImageBuild(Image);
+	ULONG64            ImageBase = Image.ImageBase + ((ULONG64)(0x01 + (Random() % 0x100)) << 0x10);
+	std::vector<UCHAR> Loaded    = PeImageLoad(Image, ImageBase);
+
+	// Unchanged, then as mapped at the preferred address
+	std::vector<MppDiff::MPP_DIFF_ENTRY> Entries;
+	ULONG Differences = DiffBenchDiffImage(File, ImageBase, Loaded, Entries) != 0x00;
+	Differences += DiffBenchDiffImage(File, ImageBase, PeImageLoad(Image, Image.ImageBase), Entries) == 0x00;
+
+	// Hooks, breakpoints and patches over relocations, far enough apart not to be merged
+	std::vector<DIFFBENCH_PATCH> Patches;
+	ULONG Rva = Image.Sections[0x00].VirtualAddress;
+	for (;;) {
+		Rva += 0x40 + (Random() % 0x400);
+		DIFFBENCH_PATCH Patch = { Rva, (Random() % 0x02) == 0x00 ? 0x01 : 0x01 + (ULONG)(Random() % 0x30) };
+		ULONG           Section = 0x00;
+		while (Section < 0x03 && (Patch.Rva + Patch.Length) > (Image.Sections[Section].VirtualAddress + (ULONG)Image.Sections[Section].Data.size()))
+			Section++;
+		if (Section == 0x03)
+			break;
+		if (Patch.Rva < Image.Sections[Section].VirtualAddress)
+			continue;
+
+		for (ULONG cx = 0x00; cx < Patch.Length; cx++)
+			Loaded[Patch.Rva + cx] ^= (UCHAR)(0x01 + (Random() % 0xFF));
+		if ((Image.Sections[Section].Characteristics & PEIMAGE_SCN_EXECUTE) != 0x00)
+			Patches.push_back(Patch);
+		Rva = Patch.Rva + Patch.Length;
+	}
+
+	ULONG Found = DiffBenchDiffImage(File, ImageBase, Loaded, Entries);
+	if (Found != Patches.size()) {
+		::printf("[-] PE32%s: %u difference(s), %zu patch(es) of code\r\n", Is64 ? "+" : "", Found, Patches.size());
+		return Differences + 0x01;
+	}
+	for (SIZE_T cx = 0x00; cx < Entries.size(); cx++) {
+		if (Entries[cx].Rva != Patches[cx].Rva || Entries[cx].Length != Patches[cx].Length) {
+			::printf("[-] PE32%s: difference at 0x%X of %u byte(s), patch at 0x%X of %u\r\n", Is64 ? "+" : "",
+				Entries[cx].Rva, Entries[cx].Length, Patches[cx].Rva, Patches[cx].Length);
+			Differences++;
+		}
+	}
+	return Differences;
+}
+
+int main(int argc, char** argv) {
+	ULONG  NumberOfImages = argc > 1 ? (ULONG)strtoul(argv[1], NULL, 0x00) : DIFFBENCH_IMAGES;
+	SIZE_T Size           = argc > 2 ? (SIZE_T)strtoull(argv[2], NULL, 0x00) : DIFFBENCH_SIZE;
+	if (NumberOfImages == 0x00 || Size == 0x00) {
+		::printf("usage: %s [images] [size]\r\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	std::mt19937 Random(0x44494646);
+	ULONG        Differences = DiffBenchCheckBuffers(Random);
+	for (ULONG cx = 0x00; cx < NumberOfImages; cx++)
+		Differences += DiffBenchCheckImage(Random, (cx % 0x02) == 0x01);
+
+	// Unchanged range, the common case, then a few patches
+	std::vector<UCHAR> Expected(Size);
+	for (UCHAR& Byte : Expected)
+		Byte = (UCHAR)Random();
+	std::vector<UCHAR> Actual = Expected;
+
+	std::vector<MppDiff::MPP_DIFF_ENTRY> Entries(DIFFBENCH_ENTRIES);
+	std::vector<MppDiff::MPP_DIFF_ENTRY> Reference;
+	ULONG NumberOfEntries = 0x00;
+	for (ULONG Round = 0x00; Round < 0x02; Round++) {
+		if (Round == 0x01) {
+			for (ULONG cx = 0x00; cx < 0x10; cx++)
+				Actual[Random() % Size] ^= 0xCC;
+		}
+
+		auto   TimeStart = std::chrono::steady_clock::now();
+		ULONG  Found     = MppDiff::Compare(Expected.data(), Actual.data(), Size, 0x1000, Entries.data(), DIFFBENCH_ENTRIES, &NumberOfEntries);
+		double Time      = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - TimeStart).count();
+
+		TimeStart = std::chrono::steady_clock::now();
+		ULONG  ReferenceFound = DiffBenchReference(Expected.data(), Actual.data(), Size, 0x1000, DIFFBENCH_ENTRIES, Reference);
+		double ReferenceTime = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - TimeStart).count();
+
+		if (Found != ReferenceFound) {
+			::printf("[-] %zu byte(s): %u difference(s), %u expected\r\n", Size, Found, ReferenceFound);
+			Differences++;
+		}
+		::printf("[+] %zu byte(s), %u difference(s)\r\n", Size, Found);
+		::printf("[+] Compare   : %10.1f us\r\n", Time);
+		::printf("[+] Reference : %10.1f us\r\n", ReferenceTime);
+	}
+
+	::printf("[+] %u image(s) patched and compared\r\n", NumberOfImages);
+	::printf("[+] %u difference(s)\r\n", Differences);
+	return Differences == 0x00 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
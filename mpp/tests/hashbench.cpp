@@ -0,0 +1,155 @@
+/*+================================================================================================
+Module Name: hashbench.cpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+Abstract:
+Benchmark of the Memory Patching Protection (MPP) keyed hash, SSE2 path against the portable path.
+The hash is built twice, the portable path being renamed, and both must give the same hash of
+every size up to a few blocks, at every alignment and with different keys. A change of one byte,
+of the size or of the key must change the hash. Both paths then hash a buffer the size of a code
+section. The size of the buffer and the number of times it is hashed can be given on the command
+line.
+
+Build: c++ -std=c++17 -O2 -g [-fsanitize=address,undefined] hashbench.cpp -o hashbench
+================================================================================================+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <random>
+#include <vector>
+
+// Portable path, renamed so that the SSE2 path can be built next to it
+#define MPP_HASH_PORTABLE
+#define MppHash MppHashPortable
+#include "../mpp/hash.cpp"
+#undef MppHash
+#undef MPP_HASH_PORTABLE
+#undef __MPP_HASH_H_GUARD__
+#include "../mpp/hash.cpp"
+
+/// @brief Default size of the buffer hashed, and number of times it is hashed.
+#define HASHBENCH_SIZE   (SIZE_T)0x100000
+#define HASHBENCH_ROUNDS (ULONG)0x100
+
+/// @brief Largest size checked one by one, a few blocks and a stripe.
+#define HASHBENCH_CHECKED (SIZE_T)0x1100
+
+/// @brief Seeds of the keys checked.
+static CONST ULONG64 HashBenchSeeds[] = { 0x00, 0x01, 0x4D5050484153484B, 0xFFFFFFFFFFFFFFFF };
+
+/// @brief Compare both paths on all sizes and alignments of a buffer, with a key.
+static ULONG HashBenchCheck(
+	_In_ ULONG64                   Seed,
+	_In_ CONST std::vector<UCHAR>& Buffer
+) {
+	MppHash::MPP_HASH_KEY         Key         = { 0x00 };
+	MppHashPortable::MPP_HASH_KEY PortableKey = { 0x00 };
+	MppHash::InitialiseKey(&Key, Seed);
+	MppHashPortable::InitialiseKey(&PortableKey, Seed);
+
+	ULONG Differences = 0x00;
+	for (SIZE_T Offset = 0x00; Offset < 0x08; Offset++) {
+		for (SIZE_T Size = 0x00; Size <= HASHBENCH_CHECKED; Size++) {
+			ULONG64 Hash     = MppHash::Compute(&Key, Buffer.data() + Offset, Size);
+			ULONG64 Portable = MppHashPortable::Compute(&PortableKey, Buffer.data() + Offset, Size);
+			if (Hash != Portable) {
+				::printf("[-] Seed 0x%llX, offset %zu, %zu byte(s): 0x%016llX, 0x%016llX portable\r\n",
+					(unsigned long long)Seed, Offset, Size, (unsigned long long)Hash, (unsigned long long)Portable);
+				Differences++;
+			}
+		}
+	}
+	return Differences;
+}
+
+/// @brief Check that a change of one byte, of the size or of the key changes the hash.
+static ULONG HashBenchCheckChanges(
+	_Inout_ std::vector<UCHAR>& Buffer,
+	_Inout_ std::mt19937&       Random
+) {
+	MppHash::MPP_HASH_KEY Key   = { 0x00 };
+	MppHash::MPP_HASH_KEY Other = { 0x00 };
+	MppHash::InitialiseKey(&Key, 0x01);
+	MppHash::InitialiseKey(&Other, 0x02);
+
+	ULONG Differences = 0x00;
+	for (ULONG cx = 0x00; cx < 0x1000; cx++) {
+		SIZE_T  Size     = 0x01 + (Random() % HASHBENCH_CHECKED);
+		SIZE_T  Position = Random() % Size;
+		ULONG64 Hash     = MppHash::Compute(&Key, Buffer.data(), Size);
+
+		UCHAR   Mask     = (UCHAR)(0x01 << (Random() % 0x08));
+
+		Buffer[Position] ^= Mask;
+		BOOLEAN Changed = MppHash::Compute(&Key, Buffer.data(), Size) != Hash;
+		Buffer[Position] ^= Mask;
+
+		if (!Changed || MppHash::Compute(&Other, Buffer.data(), Size) == MppHash::Compute(&Key, Buffer.data(), Size)) {
+			::printf("[-] %zu byte(s): byte %zu or key not hashed\r\n", Size, Position);
+			Differences++;
+		}
+	}
+
+	// Zeros of every size
+	std::vector<UCHAR> Zeros(HASHBENCH_CHECKED + 0x01, 0x00);
+	for (SIZE_T Size = 0x00; Size < HASHBENCH_CHECKED; Size++) {
+		if (MppHash::Compute(&Key, Zeros.data(), Size) == MppHash::Compute(&Key, Zeros.data(), Size + 0x01)) {
+			::printf("[-] %zu and %zu zero(s): same hash\r\n", Size, Size + 0x01);
+			Differences++;
+		}
+	}
+	return Differences;
+}
+
+int main(int argc, char** argv) {
+	SIZE_T Size             = argc > 1 ? (SIZE_T)strtoull(argv[1], NULL, 0x00) : HASHBENCH_SIZE;
+	ULONG  NumberOfRounds   = argc > 2 ? (ULONG)strtoul(argv[2], NULL, 0x00) : HASHBENCH_ROUNDS;
+	if (Size == 0x00 || NumberOfRounds == 0x00) {
+		::printf("usage: %s [size] [rounds]\r\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	// Random bytes, enough for the checks at every alignment
+	std::mt19937       Random(0x48415348);
+	std::vector<UCHAR> Buffer(Size > (HASHBENCH_CHECKED + 0x08) ? Size : (HASHBENCH_CHECKED + 0x08));
+	for (UCHAR& Byte : Buffer)
+		Byte = (UCHAR)Random();
+
+	ULONG Differences = 0x00;
+	for (ULONG64 Seed : HashBenchSeeds)
+		Differences += HashBenchCheck(Seed, Buffer);
+	Differences += HashBenchCheckChanges(Buffer, Random);
+
+	// Both paths on the same buffer
+	MppHash::MPP_HASH_KEY         Key         = { 0x00 };
+	MppHashPortable::MPP_HASH_KEY PortableKey = { 0x00 };
+	MppHash::InitialiseKey(&Key, HashBenchSeeds[0x02]);
+	MppHashPortable::InitialiseKey(&PortableKey, HashBenchSeeds[0x02]);
+
+	ULONG64 Hash      = 0x00;
+	auto    TimeStart = std::chrono::steady_clock::now();
+	for (ULONG cx = 0x00; cx < NumberOfRounds; cx++)
+		Hash ^= MppHash::Compute(&Key, Buffer.data(), Size);
+	double Time = std::chrono::duration<double>(std::chrono::steady_clock::now() - TimeStart).count();
+
+	ULONG64 Portable = 0x00;
+	TimeStart = std::chrono::steady_clock::now();
+	for (ULONG cx = 0x00; cx < NumberOfRounds; cx++)
+		Portable ^= MppHashPortable::Compute(&PortableKey, Buffer.data(), Size);
+	double PortableTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - TimeStart).count();
+
+	if (Hash != Portable) {
+		::printf("[-] %zu byte(s): 0x%016llX, 0x%016llX portable\r\n", Size, (unsigned long long)Hash, (unsigned long long)Portable);
+		Differences++;
+	}
+
+	double Bytes = (double)Size * (double)NumberOfRounds;
+	::printf("[+] %zu byte(s) hashed %u time(s)\r\n", Size, NumberOfRounds);
+	::printf("[+] SSE2     : %8.2f GB/s\r\n", Bytes / Time / 1000000000.0);
+	::printf("[+] Portable : %8.2f GB/s\r\n", Bytes / PortableTime / 1000000000.0);
+	::printf("[+] %u difference(s)\r\n", Differences);
+	return Differences == 0x00 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
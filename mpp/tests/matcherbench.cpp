@@ -0,0 +1,200 @@
+/*+================================================================================================
+Module Name: matcherbench.cpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+Abstract:
+Benchmark of the Memory Patching Protection (MPP) image name matcher against a search of each
+pattern in turn. Thousands of patterns, file names, directories and fragments of both, some with
+non-ASCII characters, sharing prefixes and suffixes or duplicated, are compiled and random image
+paths matched. Every result is checked against the search of each pattern, and the automaton
+compiled from a few patterns and from none is checked the same way. The number of patterns and
+of image paths can be given on the command line.
+
+Build: c++ -std=c++17 -O2 -g [-fsanitize=address,undefined] ../mpp/matcher.cpp matcherbench.cpp -o matcherbench
+================================================================================================+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../mpp/matcher.hpp"
+
+/// @brief Default number of patterns, and of image paths.
+#define MATCHERBENCH_PATTERNS (ULONG)0x1000
+#define MATCHERBENCH_PATHS    (SIZE_T)0x4000
+
+/// @brief Words the patterns and the image paths are made of.
+static CONST WCHAR* MatcherBenchWords[] = {
+	L"Windows", L"System32", L"SysWOW64", L"Program Files", L"Microsoft", L"Defender", L"amsi",
+	L"ntdll", L"kernel32", L"KernelBase", L"clr", L"mscoree", L"wldp", L"user32", L"combase",
+	L"Caf\u00E9", L"\u0417\u0430\u0449\u0438\u0442\u0430", L"\u65E5\u672C", L"Temp", L"Users", L"AppData"
+};
+
+/// @brief Random word.
+static std::wstring MatcherBenchWord(
+	_Inout_ std::mt19937& Random
+) {
+	return MatcherBenchWords[Random() % _ARRAYSIZE(MatcherBenchWords)];
+}
+
+/// @brief Random image path, a device, directories and a file name.
+static std::wstring MatcherBenchPath(
+	_Inout_ std::mt19937& Random
+) {
+	std::wstring Path = (Random() % 0x02) == 0x00 ? L"\\Device\\HarddiskVolume3" : L"C:";
+	ULONG        Depth = 0x01 + (Random() % 0x05);
+	for (ULONG cx = 0x00; cx < Depth; cx++)
+		Path += L"\\" + MatcherBenchWord(Random) + ((Random() % 0x02) == 0x00 ? std::to_wstring(Random() % 0x40) : L"");
+	Path += L"\\" + MatcherBenchWord(Random) + std::to_wstring(Random() % 0x100) + ((Random() % 0x02) == 0x00 ? L".dll" : L".exe");
+	return Path;
+}
+
+/// @brief Random pattern: a file name, a directory, or a fragment of a path.
+static std::wstring MatcherBenchPattern(
+	_Inout_ std::mt19937& Random
+) {
+	switch (Random() % 0x04) {
+	case 0x00:
+		return L"\\" + MatcherBenchWord(Random) + std::to_wstring(Random() % 0x100) + L".dll";
+	case 0x01:
+		return L"\\" + MatcherBenchWord(Random) + std::to_wstring(Random() % 0x40) + L"\\";
+	case 0x02: {
+		std::wstring Path = MatcherBenchPath(Random);
+		if (Path.size() <= 0x10)
+			return Path;
+		SIZE_T       Start = Random() % (Path.size() - 0x10);
+		return Path.substr(Start, 0x10 + (Random() % (Path.size() - Start - 0x0F)));
+	}
+	default:
+		return MatcherBenchWord(Random) + std::to_wstring(Random() % 0x40) + L"\\" + MatcherBenchWord(Random);
+	}
+}
+
+/// @brief Compile patterns into a buffer of the size given by GetCompiledSize.
+static MppMatcher::MPP_MATCHER* MatcherBenchCompile(
+	_In_  CONST std::vector<std::wstring>& Patterns,
+	_Out_ std::vector<ULONG64>&            Buffer
+) {
+	std::vector<MppMatcher::MPP_MATCHER_PATTERN> Compiled;
+	SIZE_T                                       TotalLength = 0x00;
+	for (CONST std::wstring& Pattern : Patterns) {
+		Compiled.push_back({ Pattern.c_str(), (ULONG)Pattern.size() });
+		TotalLength += Pattern.size();
+	}
+
+	SIZE_T Size = MppMatcher::GetCompiledSize((ULONG)Patterns.size(), TotalLength);
+	Buffer.assign((Size / sizeof(ULONG64)) + 1, 0x00);
+	return MppMatcher::Compile(Compiled.data(), (ULONG)Compiled.size(), Buffer.data(), Size);
+}
+
+/// @brief Whether a path contains any of the patterns, searched one by one.
+static BOOLEAN MatcherBenchSearch(
+	_In_ CONST std::vector<std::wstring>& Patterns,
+	_In_ CONST std::wstring&              Path
+) {
+	for (CONST std::wstring& Pattern : Patterns) {
+		if (Path.find(Pattern) != std::wstring::npos)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+/// @brief Check the matcher of some patterns against the search of each pattern.
+static ULONG MatcherBenchCheck(
+	_In_ CONST std::vector<std::wstring>& Patterns,
+	_In_ CONST std::vector<std::wstring>& Paths
+) {
+	std::vector<ULONG64> Buffer;
+	auto Matcher = MatcherBenchCompile(Patterns, Buffer);
+	if (Matcher == nullptr) {
+		::printf("[-] Unable to compile %zu pattern(s)\r\n", Patterns.size());
+		return 0x01;
+	}
+
+	ULONG Differences = 0x00;
+	for (CONST std::wstring& Path : Paths) {
+		if (MppMatcher::Match(Matcher, Path.c_str(), Path.size()) != MatcherBenchSearch(Patterns, Path)) {
+			::printf("[-] %zu pattern(s): path %ls\r\n", Patterns.size(), Path.c_str());
+			Differences++;
+		}
+	}
+	return Differences;
+}
+
+int main(int argc, char** argv) {
+	ULONG  NumberOfPatterns = argc > 1 ? (ULONG)strtoul(argv[1], NULL, 0x00) : MATCHERBENCH_PATTERNS;
+	SIZE_T NumberOfPaths    = argc > 2 ? (SIZE_T)strtoull(argv[2], NULL, 0x00) : MATCHERBENCH_PATHS;
+	if (NumberOfPatterns == 0x00 || NumberOfPaths == 0x00) {
+		::printf("usage: %s [patterns] [paths]\r\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	// Patterns, some of them twice
+	std::mt19937              Random(0x4D415443);
+	std::vector<std::wstring> Patterns;
+	for (ULONG cx = 0x00; cx < NumberOfPatterns; cx++) {
+		if (!Patterns.empty() && (Random() % 0x10) == 0x00)
+			Patterns.push_back(Patterns[Random() % Patterns.size()]);
+		else
+			Patterns.push_back(MatcherBenchPattern(Random));
+	}
+
+	// Image paths, a few empty or made of the patterns
+	std::vector<std::wstring> Paths;
+	Paths.push_back(L"");
+	for (SIZE_T cx = 0x01; cx < NumberOfPaths; cx++) {
+		std::wstring Path = MatcherBenchPath(Random);
+		if ((Random() % 0x08) == 0x00)
+			Path.insert(Random() % Path.size(), Patterns[Random() % Patterns.size()]);
+		Paths.push_back(Path);
+	}
+
+	// Empty automaton, and small ones of overlapping patterns
+	ULONG Differences = MatcherBenchCheck({}, Paths);
+	Differences += MatcherBenchCheck({ L"a", L"aa", L"aaa", L"ab", L"ba" }, Paths);
+	Differences += MatcherBenchCheck({ L"\\Windows\\System32\\", L"System32\\amsi", L"32\\a" }, Paths);
+	Differences += MatcherBenchCheck({ L"Caf\u00E9", L"\u65E5" }, Paths);
+
+	// All the patterns
+	auto                 CompileStart = std::chrono::steady_clock::now();
+	std::vector<ULONG64> Buffer;
+	auto                 Matcher = MatcherBenchCompile(Patterns, Buffer);
+	double               CompileTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - CompileStart).count();
+	if (Matcher == nullptr) {
+		::printf("[-] Unable to compile %u pattern(s)\r\n", NumberOfPatterns);
+		return EXIT_FAILURE;
+	}
+
+	std::vector<BOOLEAN> Found(Paths.size());
+	auto                 TimeStart = std::chrono::steady_clock::now();
+	for (SIZE_T cx = 0x00; cx < Paths.size(); cx++)
+		Found[cx] = MppMatcher::Match(Matcher, Paths[cx].c_str(), Paths[cx].size());
+	double MatchTime = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - TimeStart).count();
+
+	std::vector<BOOLEAN> Expected(Paths.size());
+	TimeStart = std::chrono::steady_clock::now();
+	for (SIZE_T cx = 0x00; cx < Paths.size(); cx++)
+		Expected[cx] = MatcherBenchSearch(Patterns, Paths[cx]);
+	double SearchTime = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - TimeStart).count();
+
+	SIZE_T Matched = 0x00;
+	for (SIZE_T cx = 0x00; cx < Paths.size(); cx++) {
+		Matched += Found[cx];
+		if (Found[cx] != Expected[cx]) {
+			::printf("[-] Path %ls: %u, %u expected\r\n", Paths[cx].c_str(), Found[cx], Expected[cx]);
+			Differences++;
+		}
+	}
+
+	::printf("[+] %u pattern(s), %u state(s), %zu bytes, compiled in %.3f ms\r\n", NumberOfPatterns, Matcher->NumberOfStates, Matcher->Size, CompileTime);
+	::printf("[+] %zu path(s), %zu matched\r\n", Paths.size(), Matched);
+	::printf("[+] Automaton : %10.1f ns per path\r\n", MatchTime / (double)Paths.size());
+	::printf("[+] Search    : %10.1f ns per path\r\n", SearchTime / (double)Paths.size());
+	::printf("[+] %u difference(s)\r\n", Differences);
+	return Differences == 0x00 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,289 @@
+/*+================================================================================================
+Module Name: peimage.hpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+Abstract:
+Synthetic PE32 and PE32+ images for the Memory Patching Protection (MPP) test harnesses.
+An image is described by its format, preferred address and sections, and written out as its file:
+a DOS header, NT headers with the sixteen data directories and a section table, then the data of
+each section aligned on 512 bytes. The relocations are written to a ".reloc" section appended to
+the image, and the image can be loaded at any address as the loader does, to check the ranges
+rebuilt from the file against it. Random images can be generated, with relocations in all their
+sections.
+================================================================================================+*/
+
+#ifndef __MPP_PEIMAGE_H_GUARD__
+#define __MPP_PEIMAGE_H_GUARD__
+
+#include <string.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "../mpp/portable.hpp"
+
+/// @brief Layout of the headers written.
+#define PEIMAGE_NT_HEADERS      (ULONG)0x80
+#define PEIMAGE_OPTIONAL        (ULONG)(PEIMAGE_NT_HEADERS + 0x18)
+#define PEIMAGE_OPTIONAL_SIZE32 (ULONG)0xE0
+#define PEIMAGE_OPTIONAL_SIZE64 (ULONG)0xF0
+#define PEIMAGE_DIRECTORIES     (ULONG)0x10
+#define PEIMAGE_SECTION_SIZE    (ULONG)0x28
+#define PEIMAGE_FILE_ALIGNMENT  (ULONG)0x200
+#define PEIMAGE_PAGE_SIZE       (ULONG)0x1000
+
+/// @brief Flags of the sections.
+#define PEIMAGE_SCN_CODE    (ULONG)0x60000020 // IMAGE_SCN_CNT_CODE | IMAGE_SCN_MEM_EXECUTE | IMAGE_SCN_MEM_READ
+#define PEIMAGE_SCN_RDATA   (ULONG)0x40000040 // IMAGE_SCN_CNT_INITIALIZED_DATA | IMAGE_SCN_MEM_READ
+#define PEIMAGE_SCN_DATA    (ULONG)0xC0000040 // Same, and IMAGE_SCN_MEM_WRITE
+#define PEIMAGE_SCN_EXECUTE (ULONG)0x20000000 // IMAGE_SCN_MEM_EXECUTE
+
+/// @brief Types of the relocations.
+#define PEIMAGE_REL_ABSOLUTE (ULONG)0x00
+#define PEIMAGE_REL_HIGH     (ULONG)0x01
+#define PEIMAGE_REL_LOW      (ULONG)0x02
+#define PEIMAGE_REL_HIGHLOW  (ULONG)0x03
+#define PEIMAGE_REL_HIGHADJ  (ULONG)0x04
+#define PEIMAGE_REL_DIR64    (ULONG)0x0A
+
+/// @brief Section of an image.
+typedef struct _PEIMAGE_SECTION {
+	CHAR               Name[0x08];
+	ULONG              VirtualAddress;
+	ULONG              VirtualSize;     // 0 to map the data only
+	ULONG              Characteristics;
+	std::vector<UCHAR> Data;            // Written as is, SizeOfRawData rounded up to the file alignment
+} PEIMAGE_SECTION, * PPEIMAGE_SECTION;
+
+/// @brief Relocation of an image.
+typedef struct _PEIMAGE_RELOCATION {
+	ULONG Rva;
+	ULONG Type;
+	ULONG Argument; // Low 16 bits of the target of a high adjusted relocation
+} PEIMAGE_RELOCATION, * PPEIMAGE_RELOCATION;
+
+/// @brief Image to write.
+typedef struct _PEIMAGE {
+	BOOLEAN                         Is64;
+	ULONG64                         ImageBase;     // Preferred address
+	ULONG                           TimeDateStamp;
+	ULONG                           SizeOfImage;   // Page-aligned, grown by the relocations
+	std::vector<PEIMAGE_SECTION>    Sections;
+	std::vector<PEIMAGE_RELOCATION> Relocations;   // None to write no relocation directory
+} PEIMAGE, * PPEIMAGE;
+
+/// @brief Write a little-endian value of up to 64 bits.
+static inline VOID PeImageWrite(
+	_Inout_ std::vector<UCHAR>& File,
+	_In_    SIZE_T              Offset,
+	_In_    ULONG               Width,
+	_In_    ULONG64             Value
+) {
+	for (ULONG cx = 0x00; cx < Width; cx++)
+		File[Offset + cx] = (UCHAR)(Value >> (cx * 0x08));
+}
+
+/// @brief Write the relocations of an image, in blocks of one page sorted by address.
+static inline std::vector<UCHAR> PeImageBuildRelocations(
+	_In_ CONST PEIMAGE& Image
+) {
+	std::vector<PEIMAGE_RELOCATION> Relocations = Image.Relocations;
+	std::stable_sort(Relocations.begin(), Relocations.end(),
+		[](CONST PEIMAGE_RELOCATION& Left, CONST PEIMAGE_RELOCATION& Right) { return (Left.Rva & ~0xFFF) < (Right.Rva & ~0xFFF); });
+
+	std::vector<UCHAR> Blocks;
+	for (SIZE_T cx = 0x00; cx < Relocations.size();) {
+		ULONG  Page  = Relocations[cx].Rva & ~0xFFF;
+		SIZE_T Block = Blocks.size();
+		Blocks.resize(Block + 0x08, 0x00);
+		for (; cx < Relocations.size() && (Relocations[cx].Rva & ~0xFFF) == Page; cx++) {
+			Blocks.resize(Blocks.size() + 0x02, 0x00);
+			PeImageWrite(Blocks, Blocks.size() - 0x02, 0x02, (Relocations[cx].Type << 0x0C) | (Relocations[cx].Rva & 0xFFF));
+			if (Relocations[cx].Type == PEIMAGE_REL_HIGHADJ) {
+				Blocks.resize(Blocks.size() + 0x02, 0x00);
+				PeImageWrite(Blocks, Blocks.size() - 0x02, 0x02, Relocations[cx].Argument);
+			}
+		}
+
+		// Blocks are aligned on 32 bits, padded with an absolute relocation
+		Blocks.resize((Blocks.size() + 0x03) & ~(SIZE_T)0x03, 0x00);
+		PeImageWrite(Blocks, Block + 0x00, 0x04, Page);
+		PeImageWrite(Blocks, Block + 0x04, 0x04, Blocks.size() - Block);
+	}
+	return Blocks;
+}
+
+/// @brief Sections of an image as written, with the ".reloc" section if there are relocations.
+static inline std::vector<PEIMAGE_SECTION> PeImageGetSections(
+	_In_ CONST PEIMAGE& Image
+) {
+	std::vector<PEIMAGE_SECTION> Sections = Image.Sections;
+	if (!Image.Relocations.empty()) {
+		PEIMAGE_SECTION Relocations = { ".reloc", Image.SizeOfImage, 0x00, PEIMAGE_SCN_RDATA, PeImageBuildRelocations(Image) };
+		Relocations.VirtualSize = (ULONG)Relocations.Data.size();
+		Sections.push_back(Relocations);
+	}
+	return Sections;
+}
+
+/// @brief Size of an image as written, with the ".reloc" section if there are relocations.
+static inline ULONG PeImageGetSizeOfImage(
+	_In_ CONST PEIMAGE& Image
+) {
+	std::vector<PEIMAGE_SECTION> Sections = PeImageGetSections(Image);
+	if (Sections.size() == Image.Sections.size())
+		return Image.SizeOfImage;
+	return Image.SizeOfImage + (((ULONG)Sections.back().Data.size() + (PEIMAGE_PAGE_SIZE - 1)) & ~(PEIMAGE_PAGE_SIZE - 1));
+}
+
+/// @brief Size of the headers of an image, up to the end of its section table.
+static inline ULONG PeImageGetHeadersSize(
+	_In_ CONST PEIMAGE& Image
+) {
+	return PEIMAGE_OPTIONAL + (Image.Is64 ? PEIMAGE_OPTIONAL_SIZE64 : PEIMAGE_OPTIONAL_SIZE32)
+		+ ((ULONG)PeImageGetSections(Image).size() * PEIMAGE_SECTION_SIZE);
+}
+
+/// @brief Write the file of an image.
+static inline std::vector<UCHAR> PeImageBuild(
+	_In_ CONST PEIMAGE& Image
+) {
+	std::vector<PEIMAGE_SECTION> Sections = PeImageGetSections(Image);
+	ULONG HeadersSize  = PeImageGetHeadersSize(Image);
+	ULONG SizeOfRaw    = (HeadersSize + (PEIMAGE_FILE_ALIGNMENT - 1)) & ~(PEIMAGE_FILE_ALIGNMENT - 1);
+	ULONG OptionalSize = Image.Is64 ? PEIMAGE_OPTIONAL_SIZE64 : PEIMAGE_OPTIONAL_SIZE32;
+
+	std::vector<UCHAR> File(SizeOfRaw, 0x00);
+	PeImageWrite(File, 0x00, 0x02, 0x5A4D);              // MZ
+	PeImageWrite(File, 0x3C, 0x04, PEIMAGE_NT_HEADERS);  // e_lfanew
+
+	// File header
+	PeImageWrite(File, PEIMAGE_NT_HEADERS + 0x00, 0x04, 0x00004550);
+	PeImageWrite(File, PEIMAGE_NT_HEADERS + 0x04, 0x02, Image.Is64 ? 0x8664 : 0x014C);
+	PeImageWrite(File, PEIMAGE_NT_HEADERS + 0x06, 0x02, Sections.size());
+	PeImageWrite(File, PEIMAGE_NT_HEADERS + 0x08, 0x04, Image.TimeDateStamp);
+	PeImageWrite(File, PEIMAGE_NT_HEADERS + 0x14, 0x02, OptionalSize);
+	PeImageWrite(File, PEIMAGE_NT_HEADERS + 0x16, 0x02, Image.Is64 ? 0x2022 : 0x2102);
+
+	// Optional header, the fields after the preferred address are at the same offsets
+	PeImageWrite(File, PEIMAGE_OPTIONAL + 0x00, 0x02, Image.Is64 ? 0x020B : 0x010B);
+	if (Image.Is64)
+		PeImageWrite(File, PEIMAGE_OPTIONAL + 0x18, 0x08, Image.ImageBase);
+	else
+		PeImageWrite(File, PEIMAGE_OPTIONAL + 0x1C, 0x04, Image.ImageBase);
+	PeImageWrite(File, PEIMAGE_OPTIONAL + 0x20, 0x04, PEIMAGE_PAGE_SIZE);
+	PeImageWrite(File, PEIMAGE_OPTIONAL + 0x24, 0x04, PEIMAGE_FILE_ALIGNMENT);
+	PeImageWrite(File, PEIMAGE_OPTIONAL + 0x38, 0x04, PeImageGetSizeOfImage(Image));
+	PeImageWrite(File, PEIMAGE_OPTIONAL + 0x3C, 0x04, SizeOfRaw);
+	PeImageWrite(File, PEIMAGE_OPTIONAL + (Image.Is64 ? 0x6C : 0x5C), 0x04, PEIMAGE_DIRECTORIES);
+	if (Sections.size() != Image.Sections.size()) {
+		SIZE_T Directory = PEIMAGE_OPTIONAL + (Image.Is64 ? 0x70 : 0x60) + (0x05 * 0x08);
+		PeImageWrite(File, Directory + 0x00, 0x04, Sections.back().VirtualAddress);
+		PeImageWrite(File, Directory + 0x04, 0x04, Sections.back().Data.size());
+	}
+
+	// Section table, and the data of the sections after the headers
+	for (SIZE_T cx = 0x00; cx < Sections.size(); cx++) {
+		CONST PEIMAGE_SECTION& Section = Sections[cx];
+		SIZE_T Header  = PEIMAGE_OPTIONAL + OptionalSize + (cx * PEIMAGE_SECTION_SIZE);
+		ULONG  RawSize = ((ULONG)Section.Data.size() + (PEIMAGE_FILE_ALIGNMENT - 1)) & ~(PEIMAGE_FILE_ALIGNMENT - 1);
+		ULONG  Raw     = RawSize != 0x00 ? (ULONG)File.size() : 0x00;
+
+		memcpy(&File[Header], Section.Name, sizeof(Section.Name));
+		PeImageWrite(File, Header + 0x08, 0x04, Section.VirtualSize);
+		PeImageWrite(File, Header + 0x0C, 0x04, Section.VirtualAddress);
+		PeImageWrite(File, Header + 0x10, 0x04, RawSize);
+		PeImageWrite(File, Header + 0x14, 0x04, Raw);
+		PeImageWrite(File, Header + 0x24, 0x04, Section.Characteristics);
+
+		File.insert(File.end(), Section.Data.begin(), Section.Data.end());
+		File.resize(File.size() + (RawSize - Section.Data.size()), 0x00);
+	}
+	return File;
+}
+
+/// @brief Load an image at an address as the loader does: map each section, then relocate.
+/// @return Bytes of the image, of the size of the image.
+static inline std::vector<UCHAR> PeImageLoad(
+	_In_ CONST PEIMAGE& Image,
+	_In_ ULONG64        ImageBase
+) {
+	std::vector<UCHAR> Loaded(PeImageGetSizeOfImage(Image), 0x00);
+	for (CONST PEIMAGE_SECTION& Section : PeImageGetSections(Image)) {
+		SIZE_T Size = Section.VirtualSize != 0x00 && Section.VirtualSize < Section.Data.size() ? Section.VirtualSize : Section.Data.size();
+		std::copy(Section.Data.begin(), Section.Data.begin() + Size, Loaded.begin() + Section.VirtualAddress);
+	}
+
+	ULONG64 Delta = ImageBase - Image.ImageBase;
+	for (CONST PEIMAGE_RELOCATION& Relocation : Image.Relocations) {
+		ULONG64 Value = 0x00;
+		ULONG   Width = Relocation.Type == PEIMAGE_REL_DIR64 ? 0x08 : (Relocation.Type == PEIMAGE_REL_HIGHLOW ? 0x04 : 0x02);
+		for (ULONG cx = 0x00; cx < Width; cx++)
+			Value |= (ULONG64)Loaded[Relocation.Rva + cx] << (cx * 0x08);
+
+		switch (Relocation.Type) {
+		case PEIMAGE_REL_HIGH:
+			Value = (ULONG)((Value << 0x10) + (ULONG)Delta) >> 0x10;
+			break;
+		case PEIMAGE_REL_HIGHADJ:
+			Value = (ULONG)((Value << 0x10) + (ULONG)(LONG)(SHORT)Relocation.Argument + (ULONG)Delta + 0x8000) >> 0x10;
+			break;
+		case PEIMAGE_REL_ABSOLUTE:
+			break;
+		default:
+			Value += Delta;
+			break;
+		}
+		PeImageWrite(Loaded, Relocation.Rva, Width, Value);
+	}
+	return Loaded;
+}
+
+/// @brief Random image: two code sections and a data section of random bytes, with relocations of
+/// every type valid for its format in all of them.
+static inline PEIMAGE PeImageGenerate(
+	_Inout_ std::mt19937& Random,
+	_In_    BOOLEAN       Is64
+) {
+	PEIMAGE Image = { Is64, Is64 ? 0x180000000ULL : 0x10000000ULL, (ULONG)Random(), 0x00, {}, {} };
+
+	ULONG Address = PEIMAGE_PAGE_SIZE;
+	for (ULONG cx = 0x00; cx < 0x03; cx++) {
+		PEIMAGE_SECTION Section = { ".text", Address, 0x00, cx == 0x02 ? PEIMAGE_SCN_DATA : PEIMAGE_SCN_CODE, {} };
+		if (cx == 0x02)
+			memcpy(Section.Name, ".data\0\0", sizeof(Section.Name));
+		else if (cx == 0x01)
+			memcpy(Section.Name, "PAGE\0\0\0", sizeof(Section.Name));
+
+		Section.Data.resize(0x100 + (Random() % 0x4000));
+		for (UCHAR& Byte : Section.Data)
+			Byte = (UCHAR)Random();
+		Section.VirtualSize = (ULONG)Section.Data.size() + ((Random() % 0x02) * (Random() % 0x800));
+		Image.Sections.push_back(Section);
+		Address = (Address + Section.VirtualSize + (PEIMAGE_PAGE_SIZE - 1)) & ~(PEIMAGE_PAGE_SIZE - 1);
+	}
+	Image.SizeOfImage = Address;
+
+	// Relocations not overlapping each other, some across the pages, within the data of the sections
+	static CONST ULONG Types32[] = { PEIMAGE_REL_HIGHLOW, PEIMAGE_REL_HIGHLOW, PEIMAGE_REL_HIGH, PEIMAGE_REL_LOW, PEIMAGE_REL_HIGHADJ, PEIMAGE_REL_ABSOLUTE };
+	static CONST ULONG Types64[] = { PEIMAGE_REL_DIR64, PEIMAGE_REL_DIR64, PEIMAGE_REL_HIGHLOW, PEIMAGE_REL_HIGH, PEIMAGE_REL_LOW, PEIMAGE_REL_HIGHADJ };
+	for (CONST PEIMAGE_SECTION& Section : Image.Sections) {
+		ULONG Rva = Section.VirtualAddress;
+		ULONG End = Section.VirtualAddress + (ULONG)Section.Data.size() - 0x08;
+		for (;;) {
+			ULONG Page = (Rva + PEIMAGE_PAGE_SIZE) & ~(PEIMAGE_PAGE_SIZE - 1);
+			Rva += (Random() % 0x20) == 0x00 && Page > (Rva + 0x08) ? (Page - Rva) - (0x01 + (Random() % 0x07)) : 0x01 + (Random() % 0x40);
+			if (Rva >= End)
+				break;
+
+			ULONG Type = Is64 ? Types64[Random() % _ARRAYSIZE(Types64)] : Types32[Random() % _ARRAYSIZE(Types32)];
+			Image.Relocations.push_back({ Rva, Type, (ULONG)Random() & 0xFFFF });
+			Rva += 0x08;
+		}
+	}
+	return Image;
+}
+
+#endif // !__MPP_PEIMAGE_H_GUARD__
@@ -0,0 +1,598 @@
+/*+================================================================================================
+Module Name: policyfuzz.cpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+Abstract:
+Fuzzer of the Memory Patching Protection (MPP) protection policy.
+Specifications with comments, quoted names, non-ASCII names and every kind of error are compiled
+and checked against the entries or the error expected. Random specifications are compiled, and
+every policy compiled must be valid. A compiled policy is then altered field by field, each one
+being refused, and at random, each policy still valid being indexed and looked up safely. Last, a
+large random policy is compiled, and random image names, some of them made of its entries in
+another case, looked up and checked against a search of each entry. The number of entries and of
+image names can be given on the command line.
+
+Build: c++ -std=c++17 -O2 -g [-fsanitize=address,undefined] ../mpp/policy.cpp policyfuzz.cpp -o policyfuzz
+================================================================================================+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../mpp/policy.hpp"
+
+/// @brief Default number of entries of the large policy, and of image names looked up.
+#define POLICYFUZZ_ENTRIES (ULONG)0x1388
+#define POLICYFUZZ_NAMES   (SIZE_T)0x8000
+
+/// @brief Number of random specifications compiled, and of alterations of a policy.
+#define POLICYFUZZ_SPECIFICATIONS (ULONG)0x4000
+#define POLICYFUZZ_ALTERATIONS    (ULONG)0x4000
+
+/// @brief Entry of a policy, its name in lower case.
+typedef struct _POLICYFUZZ_ENTRY {
+	std::wstring Name;
+	UCHAR        Mode;
+	ULONG        Flags;
+} POLICYFUZZ_ENTRY, * PPOLICYFUZZ_ENTRY;
+
+/// @brief Compiled policy, in a buffer of exactly its size.
+typedef struct _POLICYFUZZ_POLICY {
+	std::unique_ptr<UCHAR[]> Buffer;
+	ULONG                    Size;
+} POLICYFUZZ_POLICY, * PPOLICYFUZZ_POLICY;
+
+/// @brief Words the names of the entries and of the images are made of, some of them non-ASCII.
+static CONST WCHAR* PolicyFuzzWords[] = {
+	L"Windows", L"System32", L"SysWOW64", L"Program Files", L"Microsoft", L"Defender", L"amsi",
+	L"ntdll", L"kernel32", L"KernelBase", L"clr", L"mscoree", L"wldp", L"user32", L"combase",
+	L"Caf\u00E9", L"\u0417\u0430\u0449\u0438\u0442\u0430", L"\u65E5\u672C", L"\xD83D\xDE00", L"Temp", L"a#b"
+};
+
+/// @brief Lower case of the ASCII characters.
+static std::wstring PolicyFuzzFold(
+	_In_ std::wstring Name
+) {
+	for (WCHAR& Character : Name) {
+		if (Character >= L'A' && Character <= L'Z')
+			Character = (WCHAR)(Character + (L'a' - L'A'));
+	}
+	return Name;
+}
+
+/// @brief Encode UTF-16 characters to UTF-8.
+static std::string PolicyFuzzUtf8(
+	_In_ CONST std::wstring& Name
+) {
+	std::string Text;
+	for (SIZE_T cx = 0x00; cx < Name.size(); cx++) {
+		ULONG Point = (ULONG)Name[cx];
+		if (Point >= 0xD800 && Point <= 0xDBFF && (cx + 1) < Name.size())
+			Point = 0x10000 + ((Point - 0xD800) << 0x0A) + ((ULONG)Name[++cx] - 0xDC00);
+
+		if (Point < 0x80) {
+			Text += (CHAR)Point;
+		}
+		else if (Point < 0x800) {
+			Text += (CHAR)(0xC0 | (Point >> 0x06));
+			Text += (CHAR)(0x80 | (Point & 0x3F));
+		}
+		else if (Point < 0x10000) {
+			Text += (CHAR)(0xE0 | (Point >> 0x0C));
+			Text += (CHAR)(0x80 | ((Point >> 0x06) & 0x3F));
+			Text += (CHAR)(0x80 | (Point & 0x3F));
+		}
+		else {
+			Text += (CHAR)(0xF0 | (Point >> 0x12));
+			Text += (CHAR)(0x80 | ((Point >> 0x0C) & 0x3F));
+			Text += (CHAR)(0x80 | ((Point >> 0x06) & 0x3F));
+			Text += (CHAR)(0x80 | (Point & 0x3F));
+		}
+	}
+	return Text;
+}
+
+/// @brief Compile a specification, first for its size as the client does.
+static MppPolicy::MPP_POLICY_STATUS PolicyFuzzCompile(
+	_In_  CONST std::string& Text,
+	_Out_ POLICYFUZZ_POLICY* Policy,
+	_Out_ ULONG*             ErrorLine
+) {
+	Policy->Buffer.reset();
+	Policy->Size = 0x00;
+
+	ULONG PolicySize = 0x00;
+	auto  Status     = MppPolicy::Compile(Text.data(), Text.size(), nullptr, 0x00, &PolicySize, ErrorLine);
+	if (Status != MppPolicy::PolicyBufferTooSmall)
+		return Status;
+
+	// One byte short, then exactly the size
+	std::unique_ptr<UCHAR[]> Buffer(new UCHAR[PolicySize]);
+	ULONG Required = 0x00;
+	if (MppPolicy::Compile(Text.data(), Text.size(), Buffer.get(), PolicySize - 0x01, &Required, ErrorLine) != MppPolicy::PolicyBufferTooSmall || Required != PolicySize) {
+		::printf("[-] Policy of %u bytes compiled in a smaller buffer\r\n", PolicySize);
+		return MppPolicy::PolicyBufferTooSmall;
+	}
+	Status = MppPolicy::Compile(Text.data(), Text.size(), Buffer.get(), PolicySize, &Required, ErrorLine);
+	if (Status == MppPolicy::PolicySuccess) {
+		Policy->Buffer = std::move(Buffer);
+		Policy->Size   = PolicySize;
+	}
+	return Status;
+}
+
+/// @brief Entries of a compiled policy.
+static std::vector<POLICYFUZZ_ENTRY> PolicyFuzzGetEntries(
+	_In_ CONST UCHAR* Policy
+) {
+	auto Header  = reinterpret_cast<CONST MppPolicy::MPP_POLICY_HEADER*>(Policy);
+	auto Entries = reinterpret_cast<CONST MppPolicy::MPP_POLICY_ENTRY*>(Header + 1);
+	auto Names   = reinterpret_cast<CONST WCHAR*>(Entries + Header->NumberOfEntries);
+
+	std::vector<POLICYFUZZ_ENTRY> Result;
+	for (ULONG cx = 0x00; cx < Header->NumberOfEntries; cx++)
+		Result.push_back({ std::wstring(Names + Entries[cx].NameOffset, Entries[cx].NameLength), Entries[cx].Mode, Entries[cx].Flags });
+	return Result;
+}
+
+/// @brief Protections of an image, searching each entry.
+static ULONG PolicyFuzzSearch(
+	_In_ CONST std::vector<POLICYFUZZ_ENTRY>& Entries,
+	_In_ CONST std::wstring&                  Name
+) {
+	std::wstring Folded   = PolicyFuzzFold(Name);
+	SIZE_T       Position = Folded.find_last_of(L"\\/");
+	std::wstring FileName = Position == std::wstring::npos ? Folded : Folded.substr(Position + 1);
+
+	ULONG Flags = 0x00;
+	for (CONST POLICYFUZZ_ENTRY& Entry : Entries) {
+		BOOLEAN Match = FALSE;
+		if (Entry.Mode == MppPolicy::MatchPath)
+			Match = Folded == Entry.Name;
+		else if (Entry.Mode == MppPolicy::MatchExact)
+			Match = FileName == Entry.Name;
+		else
+			Match = Folded.size() >= Entry.Name.size() && Folded.compare(Folded.size() - Entry.Name.size(), Entry.Name.size(), Entry.Name) == 0x00;
+		if (Match)
+			Flags |= Entry.Flags;
+	}
+	return Name.empty() ? 0x00 : Flags;
+}
+
+/// @brief Index a policy and check its lookups against the search of each entry.
+static ULONG PolicyFuzzCheckLookups(
+	_In_ CONST UCHAR*                     Policy,
+	_In_ CONST std::vector<std::wstring>& Names
+) {
+	std::vector<ULONG64> Buffer((MppPolicy::GetIndexSize(Policy) / sizeof(ULONG64)) + 0x01);
+	auto Index = MppPolicy::BuildIndex(Policy, Buffer.data(), Buffer.size() * sizeof(ULONG64));
+	if (Index == nullptr) {
+		::printf("[-] Unable to index the policy\r\n");
+		return 0x01;
+	}
+
+	std::vector<POLICYFUZZ_ENTRY> Entries = PolicyFuzzGetEntries(Policy);
+	ULONG                         Differences = 0x00;
+	for (CONST std::wstring& Name : Names) {
+		ULONG Flags    = MppPolicy::Lookup(Index, Name.c_str(), Name.size());
+		ULONG Expected = PolicyFuzzSearch(Entries, Name);
+		if (Flags != Expected && Differences++ < 0x08)
+			::printf("[-] %ls: 0x%X, 0x%X expected\r\n", Name.c_str(), Flags, Expected);
+	}
+	return Differences;
+}
+
+/// @brief Compile specifications, valid or not, and check the entries or the error.
+static ULONG PolicyFuzzCheckSpecifications() {
+	typedef struct _POLICYFUZZ_SPECIFICATION {
+		CONST CHAR*                  Text;
+		MppPolicy::MPP_POLICY_STATUS Status;
+		ULONG                        ErrorLine;
+	} POLICYFUZZ_SPECIFICATION;
+
+	static CONST POLICYFUZZ_SPECIFICATION Errors[] = {
+		{ "suffix amsi.dll", MppPolicy::PolicySyntaxError, 0x01 },
+		{ "\n\nsuffix amsi.dll protect\nexact ntdll.dll integrity bogus", MppPolicy::PolicySyntaxError, 0x04 },
+		{ "include amsi.dll protect", MppPolicy::PolicySyntaxError, 0x01 },
+		{ "suffix \"amsi.dll protect", MppPolicy::PolicySyntaxError, 0x01 },
+		{ "suffix \"\" protect", MppPolicy::PolicySyntaxError, 0x01 },
+		{ "exact \\amsi.dll protect", MppPolicy::PolicySyntaxError, 0x01 },
+		{ "exact a/b protect", MppPolicy::PolicySyntaxError, 0x01 },
+		{ "revision 1\r\nrevision 2", MppPolicy::PolicySyntaxError, 0x02 },
+		{ "revision", MppPolicy::PolicySyntaxError, 0x01 },
+		{ "revision 1x", MppPolicy::PolicySyntaxError, 0x01 },
+		{ "revision 1 2", MppPolicy::PolicySyntaxError, 0x01 },
+		{ "revision 4294967296", MppPolicy::PolicyTooLarge, 0x01 },
+		{ "suffix \xC0\xAF protect", MppPolicy::PolicySyntaxError, 0x01 },
+		{ "suffix \xED\xA0\x80 protect", MppPolicy::PolicySyntaxError, 0x01 },
+		{ "suffix \xF4\x90\x80\x80 protect", MppPolicy::PolicySyntaxError, 0x01 },
+		{ "suffix \xE6\x97 protect", MppPolicy::PolicySyntaxError, 0x01 },
+		{ "suffix \x80 protect", MppPolicy::PolicySyntaxError, 0x01 },
+		{ "PROTECT amsi.dll suffix", MppPolicy::PolicySyntaxError, 0x01 }
+	};
+
+	ULONG Differences = 0x00;
+	for (CONST POLICYFUZZ_SPECIFICATION& Error : Errors) {
+		POLICYFUZZ_POLICY Policy    = {};
+		ULONG             ErrorLine = 0x00;
+		auto              Status    = PolicyFuzzCompile(Error.Text, &Policy, &ErrorLine);
+		if (Status != Error.Status || ErrorLine != Error.ErrorLine) {
+			::printf("[-] \"%s\": status %u at line %u, %u at line %u expected\r\n", Error.Text, Status, ErrorLine, Error.Status, Error.ErrorLine);
+			Differences++;
+		}
+	}
+
+	// NULL character in a name, and names too long
+	std::string Text = std::string("suffix a") + '\0' + "b protect";
+	POLICYFUZZ_POLICY Policy    = {};
+	ULONG             ErrorLine = 0x00;
+	if (PolicyFuzzCompile(Text, &Policy, &ErrorLine) != MppPolicy::PolicySyntaxError
+		|| PolicyFuzzCompile("path " + std::string(MppPolicy::MaximumName + 0x01, 'a') + " protect", &Policy, &ErrorLine) != MppPolicy::PolicyTooLarge
+		|| PolicyFuzzCompile("path " + std::string(MppPolicy::MaximumName, 'a') + " protect", &Policy, &ErrorLine) != MppPolicy::PolicySuccess) {
+		::printf("[-] NULL character or length of a name\r\n");
+		Differences++;
+	}
+
+	// Comments, blank lines, quotes, cases and non-ASCII names
+	Text =
+		"# Protection policy\r\n"
+		"revision 42  # of the day\r\n"
+		"\r\n"
+		"\tsuffix   \\AMSI.dll protect#no space\n"
+		"exact \"Program Files.exe\" integrity protect\n"
+		"path \"\\Device\\HarddiskVolume3\\Caf\xC3\xA9\\\xF0\x9F\x98\x80.DLL\" integrity\n"
+		"suffix \\amsi.dll integrity\n"
+		"   # indented comment";
+	static CONST POLICYFUZZ_ENTRY Expected[] = {
+		{ L"\\amsi.dll", MppPolicy::MatchSuffix, MppPolicy::FlagProtect },
+		{ L"program files.exe", MppPolicy::MatchExact, MppPolicy::FlagProtect | MppPolicy::FlagIntegrity },
+		{ L"\\device\\harddiskvolume3\\caf\u00E9\\\xD83D\xDE00.dll", MppPolicy::MatchPath, MppPolicy::FlagIntegrity },
+		{ L"\\amsi.dll", MppPolicy::MatchSuffix, MppPolicy::FlagIntegrity }
+	};
+
+	auto Status = PolicyFuzzCompile(Text, &Policy, &ErrorLine);
+	if (Status != MppPolicy::PolicySuccess || !MppPolicy::Validate(Policy.Buffer.get(), Policy.Size)) {
+		::printf("[-] Specification: status %u at line %u\r\n", Status, ErrorLine);
+		return Differences + 0x01;
+	}
+
+	auto                          Header  = reinterpret_cast<CONST MppPolicy::MPP_POLICY_HEADER*>(Policy.Buffer.get());
+	std::vector<POLICYFUZZ_ENTRY> Entries = PolicyFuzzGetEntries(Policy.Buffer.get());
+	BOOLEAN Same = Header->Revision == 42 && Entries.size() == _ARRAYSIZE(Expected);
+	for (SIZE_T cx = 0x00; Same && cx < Entries.size(); cx++)
+		Same = Entries[cx].Name == Expected[cx].Name && Entries[cx].Mode == Expected[cx].Mode && Entries[cx].Flags == Expected[cx].Flags;
+	if (!Same) {
+		::printf("[-] Specification: revision %u, %zu entries\r\n", Header->Revision, Entries.size());
+		Differences++;
+	}
+
+	// Both suffixes of the same name, and the cases of the image names
+	Differences += PolicyFuzzCheckLookups(Policy.Buffer.get(), {
+		L"C:\\Windows\\System32\\amsi.dll", L"\\AMSI.DLL", L"amsi.dll", L"C:\\Program Files.exe", L"Program Files.exe",
+		L"C:\\Program Files.exe\\", L"\\DEVICE\\HarddiskVolume3\\Caf\u00E9\\\xD83D\xDE00.dll", L"\\Device\\HarddiskVolume3\\CAF\u00C9\\\xD83D\xDE00.dll"
+	});
+	return Differences;
+}
+
+/// @brief Random specification, from the tokens of the language and a few bytes of anything.
+static std::string PolicyFuzzSpecification(
+	_Inout_ std::mt19937& Random
+) {
+	static CONST CHAR* Tokens[] = {
+		"revision", "suffix", "exact", "path", "protect", "integrity", "#", "\"", " ", "\t", "\r\n", "\n",
+		"12", "4294967295", "amsi.dll", "\\Windows\\", "a/b", "Caf\xC3\xA9", "\xF0\x9F\x98\x80", "\xC0\xAF", "\xED\xA0\x80", "\xE6\x97"
+	};
+
+	std::string Text;
+	ULONG       Count = Random() % 0x40;
+	for (ULONG cx = 0x00; cx < Count; cx++) {
+		switch (Random() % 0x08) {
+		case 0x00:
+			Text += (CHAR)Random();
+			break;
+		case 0x01:
+			Text += "\nsuffix \"\\" + std::string(Tokens[Random() % _ARRAYSIZE(Tokens)]) + "\" protect";
+			break;
+		default:
+			Text += Tokens[Random() % _ARRAYSIZE(Tokens)];
+			if ((Random() % 0x02) == 0x00)
+				Text += ' ';
+			break;
+		}
+	}
+	return Text;
+}
+
+/// @brief Compile random specifications, every policy compiled being valid.
+static ULONG PolicyFuzzCheckCompiler(
+	_Inout_ std::mt19937& Random,
+	_Out_   ULONG*        Compiled
+) {
+	ULONG Differences = 0x00;
+	*Compiled = 0x00;
+	for (ULONG cx = 0x00; cx < POLICYFUZZ_SPECIFICATIONS; cx++) {
+		std::string       Text      = PolicyFuzzSpecification(Random);
+		POLICYFUZZ_POLICY Policy    = {};
+		ULONG             ErrorLine = 0x00;
+		auto              Status    = PolicyFuzzCompile(Text, &Policy, &ErrorLine);
+		if (Status != MppPolicy::PolicySuccess)
+			continue;
+
+		(*Compiled)++;
+		if (!MppPolicy::Validate(Policy.Buffer.get(), Policy.Size)) {
+			::printf("[-] Policy compiled not valid\r\n");
+			Differences++;
+		}
+	}
+	return Differences;
+}
+
+/// @brief FNV-1a of what follows the header, as the compiler sets it.
+static VOID PolicyFuzzSetChecksum(
+	_Inout_ UCHAR* Policy,
+	_In_    SIZE_T Size
+) {
+	ULONG Hash = 0x811C9DC5;
+	for (SIZE_T cx = sizeof(MppPolicy::MPP_POLICY_HEADER); cx < Size; cx++)
+		Hash = (Hash ^ Policy[cx]) * 0x01000193;
+	reinterpret_cast<MppPolicy::MPP_POLICY_HEADER*>(Policy)->Checksum = Hash;
+}
+
+/// @brief Alter a compiled policy field by field, then at random.
+static ULONG PolicyFuzzCheckValidator(
+	_Inout_ std::mt19937&                    Random,
+	_In_    CONST POLICYFUZZ_POLICY&         Policy,
+	_In_    CONST std::vector<std::wstring>& Names,
+	_Out_   ULONG*                           Accepted
+) {
+	typedef MppPolicy::MPP_POLICY_HEADER HEADER;
+	typedef MppPolicy::MPP_POLICY_ENTRY  ENTRY;
+
+	auto   Header    = reinterpret_cast<CONST HEADER*>(Policy.Buffer.get());
+	SIZE_T NameTable = sizeof(HEADER) + (Header->NumberOfEntries * sizeof(ENTRY));
+	ULONG  Last      = Header->NumberOfEntries - 0x01;
+
+	// Each alteration on its own, with the checksum set again unless altering it
+	std::vector<std::function<VOID(UCHAR*)>> Alterations = {
+		[](UCHAR* Buffer) { reinterpret_cast<HEADER*>(Buffer)->Signature ^= 0x01; },
+		[](UCHAR* Buffer) { reinterpret_cast<HEADER*>(Buffer)->Version++; },
+		[](UCHAR* Buffer) { reinterpret_cast<HEADER*>(Buffer)->HeaderSize--; },
+		[](UCHAR* Buffer) { reinterpret_cast<HEADER*>(Buffer)->Size--; },
+		[](UCHAR* Buffer) { reinterpret_cast<HEADER*>(Buffer)->Reserved = 0x01; },
+		[](UCHAR* Buffer) { reinterpret_cast<HEADER*>(Buffer)->NumberOfEntries--; },
+		[](UCHAR* Buffer) { reinterpret_cast<HEADER*>(Buffer)->NumberOfCharacters++; },
+		[](UCHAR* Buffer) { reinterpret_cast<HEADER*>(Buffer)->NumberOfEntries = MppPolicy::MaximumEntries + 0x01; },
+		[Last](UCHAR* Buffer) { reinterpret_cast<ENTRY*>(Buffer + sizeof(HEADER))[Last].Mode = MppPolicy::NumberOfModes; },
+		[Last](UCHAR* Buffer) { reinterpret_cast<ENTRY*>(Buffer + sizeof(HEADER))[Last].Reserved = 0x01; },
+		[Last](UCHAR* Buffer) { reinterpret_cast<ENTRY*>(Buffer + sizeof(HEADER))[Last].Flags = 0x00; },
+		[Last](UCHAR* Buffer) { reinterpret_cast<ENTRY*>(Buffer + sizeof(HEADER))[Last].Flags |= 0x04; },
+		[Last](UCHAR* Buffer) { reinterpret_cast<ENTRY*>(Buffer + sizeof(HEADER))[Last].NameLength = 0x00; },
+		[Last](UCHAR* Buffer) { reinterpret_cast<ENTRY*>(Buffer + sizeof(HEADER))[Last].NameLength++; },
+		[Last](UCHAR* Buffer) { reinterpret_cast<ENTRY*>(Buffer + sizeof(HEADER))[Last].NameOffset = 0xFFFFFFFF; },
+		[NameTable](UCHAR* Buffer) { reinterpret_cast<WCHAR*>(Buffer + NameTable)[0x00] = L'\0'; },
+		[NameTable](UCHAR* Buffer) { reinterpret_cast<WCHAR*>(Buffer + NameTable)[0x00] = L'A'; },
+		[Last, NameTable](UCHAR* Buffer) {
+			auto Entry = &reinterpret_cast<ENTRY*>(Buffer + sizeof(HEADER))[Last];
+			Entry->Mode = MppPolicy::MatchExact;
+			reinterpret_cast<WCHAR*>(Buffer + NameTable)[Entry->NameOffset] = L'\\';
+		}
+	};
+
+	ULONG Differences = 0x00;
+	std::unique_ptr<UCHAR[]> Copy(new UCHAR[Policy.Size]);
+	memcpy(Copy.get(), Policy.Buffer.get(), Policy.Size);
+	if (!MppPolicy::Validate(Copy.get(), Policy.Size) || MppPolicy::Validate(Copy.get(), Policy.Size - 0x01) || MppPolicy::Validate(nullptr, Policy.Size)) {
+		::printf("[-] Policy not valid, or valid truncated\r\n");
+		Differences++;
+	}
+	for (SIZE_T cx = 0x00; cx <= Alterations.size(); cx++) {
+		memcpy(Copy.get(), Policy.Buffer.get(), Policy.Size);
+		if (cx == Alterations.size()) {
+			Copy[Policy.Size - 0x01] ^= 0x01;
+		}
+		else {
+			Alterations[cx](Copy.get());
+			PolicyFuzzSetChecksum(Copy.get(), Policy.Size);
+		}
+		if (MppPolicy::Validate(Copy.get(), Policy.Size)) {
+			::printf("[-] Alteration %zu accepted\r\n", cx);
+			Differences++;
+		}
+	}
+
+	// At random, the checksum set again most of the time, the policies accepted being safe to use
+	*Accepted = 0x00;
+	for (ULONG cx = 0x00; cx < POLICYFUZZ_ALTERATIONS; cx++) {
+		SIZE_T Size = (Random() % 0x08) == 0x00 ? Random() % (Policy.Size + 0x20) : Policy.Size;
+		std::unique_ptr<UCHAR[]> Altered(new UCHAR[Size + 0x01]);
+		memset(Altered.get(), 0x00, Size);
+		memcpy(Altered.get(), Policy.Buffer.get(), Size < Policy.Size ? Size : Policy.Size);
+
+		ULONG Count = 0x01 + (Random() % 0x04);
+		for (ULONG dx = 0x00; dx < Count && Size != 0x00; dx++) {
+			SIZE_T Position = (Random() % 0x02) == 0x00 ? Random() % (Size < sizeof(HEADER) + 0x40 ? Size : sizeof(HEADER) + 0x40) : Random() % Size;
+			Altered[Position] = (Random() % 0x02) == 0x00 ? (UCHAR)Random() : (UCHAR)(Altered[Position] ^ (0x01 << (Random() % 0x08)));
+		}
+		if (Size >= sizeof(HEADER) && (Random() % 0x04) != 0x00)
+			PolicyFuzzSetChecksum(Altered.get(), Size);
+
+		if (MppPolicy::Validate(Altered.get(), Size)) {
+			(*Accepted)++;
+			std::vector<std::wstring> Some(Names.begin(), Names.begin() + (Names.size() < 0x40 ? Names.size() : 0x40));
+			Differences += PolicyFuzzCheckLookups(Altered.get(), Some);
+		}
+	}
+	return Differences;
+}
+
+/// @brief Random image name, a device, directories and a file name.
+static std::wstring PolicyFuzzPath(
+	_Inout_ std::mt19937& Random
+) {
+	std::wstring Path  = (Random() % 0x02) == 0x00 ? L"\\Device\\HarddiskVolume3" : L"C:";
+	ULONG        Depth = 0x01 + (Random() % 0x04);
+	for (ULONG cx = 0x00; cx < Depth; cx++)
+		Path += ((Random() % 0x08) == 0x00 ? L"/" : L"\\") + std::wstring(PolicyFuzzWords[Random() % _ARRAYSIZE(PolicyFuzzWords)]);
+	Path += L"\\" + std::wstring(PolicyFuzzWords[Random() % _ARRAYSIZE(PolicyFuzzWords)]) + std::to_wstring(Random() % 0x20) + ((Random() % 0x02) == 0x00 ? L".dll" : L".exe");
+	return Path;
+}
+
+/// @brief Change the case of random ASCII letters.
+static std::wstring PolicyFuzzCase(
+	_Inout_ std::mt19937& Random,
+	_In_    std::wstring  Name
+) {
+	for (WCHAR& Character : Name) {
+		if ((Random() % 0x02) == 0x00 && ((Character >= L'a' && Character <= L'z') || (Character >= L'A' && Character <= L'Z')))
+			Character ^= 0x20;
+	}
+	return Name;
+}
+
+/// @brief Specification of random entries, names quoted when they must be.
+static std::string PolicyFuzzLargeSpecification(
+	_Inout_ std::mt19937&                  Random,
+	_In_    ULONG                          NumberOfEntries,
+	_Out_   std::vector<POLICYFUZZ_ENTRY>& Entries
+) {
+	static CONST CHAR* Modes[] = { "suffix", "exact", "path" };
+
+	std::string Text = "revision " + std::to_string(Random()) + "\n";
+	Entries.clear();
+	for (ULONG cx = 0x00; cx < NumberOfEntries; cx++) {
+		POLICYFUZZ_ENTRY Entry = { PolicyFuzzPath(Random), (UCHAR)(Random() % MppPolicy::NumberOfModes), 0x01 + (ULONG)(Random() % MppPolicy::ValidFlags) };
+		if (!Entries.empty() && (Random() % 0x10) == 0x00)
+			Entry.Name = Entries[Random() % Entries.size()].Name;
+		if (Entry.Mode == MppPolicy::MatchExact)
+			Entry.Name = Entry.Name.substr(Entry.Name.find_last_of(L"\\/") + 1);
+		else if (Entry.Mode == MppPolicy::MatchSuffix) {
+			// Mostly from a separator, as suffixes are written, else from anywhere
+			SIZE_T Start = Entry.Name.find_last_of(L"\\/.");
+			if (Start == std::wstring::npos || (Random() % 0x08) == 0x00)
+				Start = Random() % Entry.Name.size();
+			if (Entry.Name[Start] >= 0xDC00 && Entry.Name[Start] <= 0xDFFF)
+				Start--;
+			Entry.Name = Entry.Name.substr(Start);
+		}
+		Entry.Name = PolicyFuzzFold(Entry.Name);
+		Entries.push_back(Entry);
+
+		std::string Name   = PolicyFuzzUtf8(PolicyFuzzCase(Random, Entry.Name));
+		BOOLEAN     Quoted = Name.find_first_of(" \t#") != std::string::npos || (Random() % 0x02) == 0x00;
+		Text += std::string(Modes[Entry.Mode]) + " " + (Quoted ? "\"" + Name + "\"" : Name);
+		if ((Entry.Flags & MppPolicy::FlagProtect) != 0x00)
+			Text += " protect";
+		if ((Entry.Flags & MppPolicy::FlagIntegrity) != 0x00)
+			Text += " integrity";
+		Text += (Random() % 0x04) == 0x00 ? " # entry\r\n" : "\n";
+	}
+	return Text;
+}
+
+int main(int argc, char** argv) {
+	ULONG  NumberOfEntries = argc > 1 ? (ULONG)strtoul(argv[1], NULL, 0x00) : POLICYFUZZ_ENTRIES;
+	SIZE_T NumberOfNames   = argc > 2 ? (SIZE_T)strtoull(argv[2], NULL, 0x00) : POLICYFUZZ_NAMES;
+	if (NumberOfEntries == 0x00 || NumberOfEntries > MppPolicy::MaximumEntries || NumberOfNames == 0x00) {
+		::printf("usage: %s [entries] [names]\r\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	std::mt19937 Random(0x504F4C49);
+	ULONG        Compiled    = 0x00;
+	ULONG        Differences = PolicyFuzzCheckSpecifications();
+	Differences += PolicyFuzzCheckCompiler(Random, &Compiled);
+
+	// Large policy, compiled from its specification
+	std::vector<POLICYFUZZ_ENTRY> Entries;
+	std::string                   Text      = PolicyFuzzLargeSpecification(Random, NumberOfEntries, Entries);
+	POLICYFUZZ_POLICY             Policy    = {};
+	ULONG                         ErrorLine = 0x00;
+	auto                          Status    = PolicyFuzzCompile(Text, &Policy, &ErrorLine);
+	if (Status != MppPolicy::PolicySuccess) {
+		::printf("[-] Unable to compile %u entries: status %u at line %u\r\n", NumberOfEntries, Status, ErrorLine);
+		return EXIT_FAILURE;
+	}
+
+	std::vector<POLICYFUZZ_ENTRY> Decoded = PolicyFuzzGetEntries(Policy.Buffer.get());
+	for (SIZE_T cx = 0x00; cx < Entries.size(); cx++) {
+		if (Decoded[cx].Name != Entries[cx].Name || Decoded[cx].Mode != Entries[cx].Mode || Decoded[cx].Flags != Entries[cx].Flags) {
+			::printf("[-] Entry %zu: %ls compiled as %ls\r\n", cx, Entries[cx].Name.c_str(), Decoded[cx].Name.c_str());
+			Differences++;
+		}
+	}
+
+	// Image names, some of them made of the entries
+	std::vector<std::wstring> Names;
+	Names.push_back(L"");
+	for (SIZE_T cx = 0x01; cx < NumberOfNames; cx++) {
+		CONST POLICYFUZZ_ENTRY& Entry = Entries[Random() % Entries.size()];
+		switch (Random() % 0x04) {
+		case 0x00:
+			Names.push_back(PolicyFuzzCase(Random, Entry.Mode == MppPolicy::MatchPath ? Entry.Name : PolicyFuzzPath(Random) + L"\\" + Entry.Name));
+			break;
+		case 0x01:
+			Names.push_back(PolicyFuzzCase(Random, Entry.Name + ((Random() % 0x02) == 0x00 ? L"x" : L"")));
+			break;
+		default:
+			Names.push_back(PolicyFuzzPath(Random));
+			break;
+		}
+	}
+
+	// Alterations of a small policy, for each one accepted to be indexed quickly
+	std::vector<POLICYFUZZ_ENTRY> SmallEntries;
+	POLICYFUZZ_POLICY             Small    = {};
+	ULONG                         Accepted = 0x00;
+	if (PolicyFuzzCompile(PolicyFuzzLargeSpecification(Random, 0x40, SmallEntries), &Small, &ErrorLine) != MppPolicy::PolicySuccess) {
+		::printf("[-] Unable to compile 64 entries: line %u\r\n", ErrorLine);
+		return EXIT_FAILURE;
+	}
+	Differences += PolicyFuzzCheckValidator(Random, Small, Names, &Accepted);
+
+	// Validated and indexed as the driver does, then looked up
+	auto    TimeStart = std::chrono::steady_clock::now();
+	BOOLEAN Valid     = MppPolicy::Validate(Policy.Buffer.get(), Policy.Size);
+	std::vector<ULONG64> Buffer((MppPolicy::GetIndexSize(Policy.Buffer.get()) / sizeof(ULONG64)) + 0x01);
+	auto    Index     = MppPolicy::BuildIndex(Policy.Buffer.get(), Buffer.data(), Buffer.size() * sizeof(ULONG64));
+	double  LoadTime  = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - TimeStart).count();
+	if (!Valid || Index == nullptr) {
+		::printf("[-] Unable to validate and index %u entries\r\n", NumberOfEntries);
+		return EXIT_FAILURE;
+	}
+
+	std::vector<ULONG> Found(Names.size());
+	TimeStart = std::chrono::steady_clock::now();
+	for (SIZE_T cx = 0x00; cx < Names.size(); cx++)
+		Found[cx] = MppPolicy::Lookup(Index, Names[cx].c_str(), Names[cx].size());
+	double LookupTime = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - TimeStart).count();
+
+	std::vector<ULONG> Expected(Names.size());
+	TimeStart = std::chrono::steady_clock::now();
+	for (SIZE_T cx = 0x00; cx < Names.size(); cx++)
+		Expected[cx] = PolicyFuzzSearch(Entries, Names[cx]);
+	double SearchTime = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - TimeStart).count();
+
+	SIZE_T Matched = 0x00;
+	for (SIZE_T cx = 0x00; cx < Names.size(); cx++) {
+		Matched += Found[cx] != 0x00;
+		if (Found[cx] != Expected[cx] && Differences++ < 0x10)
+			::printf("[-] %ls: 0x%X, 0x%X expected\r\n", Names[cx].c_str(), Found[cx], Expected[cx]);
+	}
+
+	::printf("[+] %u random specification(s) compiled, %u alteration(s) accepted\r\n", Compiled, Accepted);
+	::printf("[+] %u entries, %u bytes, validated and indexed in %.3f ms\r\n", NumberOfEntries, Policy.Size, LoadTime);
+	::printf("[+] %u length(s) of suffix searched per name\r\n", Index->NumberOfSuffixLengths);
+	::printf("[+] %zu name(s), %zu matched\r\n", Names.size(), Matched);
+	::printf("[+] Lookup : %10.1f ns per name\r\n", LookupTime / (double)Names.size());
+	::printf("[+] Search : %10.1f ns per name\r\n", SearchTime / (double)Names.size());
+	::printf("[+] %u difference(s)\r\n", Differences);
+	return Differences == 0x00 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,156 @@
+/*+================================================================================================
+Module Name: queuestress.cpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+Abstract:
+Stress test of the Memory Patching Protection (MPP) bounded multi-producer single-consumer queue.
+Producer threads push numbered requests into a small queue, so that it fills up and drops some of
+them, while one consumer pops them. The requests of each producer must be popped in the order
+they were pushed, whole and once, and the counters of the queue must add up: pushed and dropped
+requests to the attempts, popped requests to the pushed ones. The number of producers and of
+requests per producer can be given on the command line.
+
+Build: c++ -std=c++17 -O2 -g -pthread [-fsanitize=address,undefined | -fsanitize=thread] queuestress.cpp -o queuestress
+================================================================================================+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "../mpp/queue.hpp"
+
+/// @brief Default number of producers, and of requests per producer.
+#define QUEUESTRESS_PRODUCERS (ULONG)0x04
+#define QUEUESTRESS_REQUESTS  (ULONG64)0x40000
+
+/// @brief Slots of the queue, small so that it fills up.
+#define QUEUESTRESS_CAPACITY (ULONG)0x40
+
+/// @brief Request of a producer, larger than a word so that a torn copy can be seen.
+typedef struct _QUEUESTRESS_REQUEST {
+	ULONG   Producer;
+	ULONG64 Sequence;
+	ULONG64 Check;    // Producer and sequence mixed, to check the copy
+} QUEUESTRESS_REQUEST, * PQUEUESTRESS_REQUEST;
+
+/// @brief Results of a producer.
+typedef struct _QUEUESTRESS_PRODUCER {
+	ULONG64 Pushed;
+	ULONG64 Dropped;
+} QUEUESTRESS_PRODUCER, * PQUEUESTRESS_PRODUCER;
+
+static MppQueue::MPP_QUEUE<QUEUESTRESS_REQUEST, QUEUESTRESS_CAPACITY> QueueStressQueue;
+static std::atomic<ULONG>                                             QueueStressRunning{ 0x00 };
+
+/// @brief Value of the Check field of a request.
+static ULONG64 QueueStressCheck(
+	_In_ ULONG   Producer,
+	_In_ ULONG64 Sequence
+) {
+	return (Sequence * 0x9E3779B97F4A7C15) ^ ((ULONG64)Producer << 48);
+}
+
+/// @brief Push numbered requests, as the image load callback does, without waiting.
+static VOID QueueStressProduce(
+	_In_  ULONG                 Producer,
+	_In_  ULONG64               NumberOfRequests,
+	_Out_ PQUEUESTRESS_PRODUCER Results
+) {
+	Results->Pushed  = 0x00;
+	Results->Dropped = 0x00;
+	for (ULONG64 Sequence = 0x00; Sequence < NumberOfRequests; Sequence++) {
+		QUEUESTRESS_REQUEST Request = { Producer, Sequence, QueueStressCheck(Producer, Sequence) };
+		if (MppQueue::Push(&QueueStressQueue, Request))
+			Results->Pushed++;
+		else
+			Results->Dropped++;
+
+		// Give the consumer a chance on a single processor
+		if ((Sequence & 0xFF) == 0x00)
+			std::this_thread::yield();
+	}
+	QueueStressRunning.fetch_sub(0x01, std::memory_order_release);
+}
+
+int main(int argc, char** argv) {
+	ULONG   NumberOfProducers = argc > 1 ? (ULONG)strtoul(argv[1], NULL, 0x00) : QUEUESTRESS_PRODUCERS;
+	ULONG64 NumberOfRequests  = argc > 2 ? (ULONG64)strtoull(argv[2], NULL, 0x00) : QUEUESTRESS_REQUESTS;
+	if (NumberOfProducers == 0x00 || NumberOfRequests == 0x00) {
+		::printf("usage: %s [producers] [requests]\r\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	MppQueue::Initialise(&QueueStressQueue);
+
+	std::vector<QUEUESTRESS_PRODUCER> Producers(NumberOfProducers);
+	std::vector<ULONG64>              Next(NumberOfProducers, 0x00);  // Lowest sequence each producer may pop next
+	std::vector<ULONG64>              Popped(NumberOfProducers, 0x00);
+	std::vector<std::thread>          Threads;
+
+	auto TimeStart = std::chrono::steady_clock::now();
+	QueueStressRunning.store(NumberOfProducers, std::memory_order_release);
+	for (ULONG cx = 0x00; cx < NumberOfProducers; cx++)
+		Threads.emplace_back(QueueStressProduce, cx, NumberOfRequests, &Producers[cx]);
+
+	// Single consumer, as the work item, until the producers are done and the queue empty
+	ULONG64 Errors = 0x00;
+	for (;;) {
+		BOOLEAN             Done    = QueueStressRunning.load(std::memory_order_acquire) == 0x00;
+		QUEUESTRESS_REQUEST Request = { 0x00 };
+		if (!MppQueue::Pop(&QueueStressQueue, &Request)) {
+			if (Done)
+				break;
+			std::this_thread::yield();
+			continue;
+		}
+
+		if (Request.Producer >= NumberOfProducers || Request.Check != QueueStressCheck(Request.Producer, Request.Sequence)) {
+			::printf("[-] Torn request: producer %u, sequence %llu\r\n", Request.Producer, (unsigned long long)Request.Sequence);
+			Errors++;
+			continue;
+		}
+		if (Request.Sequence < Next[Request.Producer]) {
+			::printf("[-] Producer %u: sequence %llu popped after %llu\r\n", Request.Producer,
+				(unsigned long long)Request.Sequence, (unsigned long long)(Next[Request.Producer] - 1));
+			Errors++;
+		}
+		Next[Request.Producer] = Request.Sequence + 1;
+		Popped[Request.Producer]++;
+	}
+	for (std::thread& Thread : Threads)
+		Thread.join();
+	double Time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - TimeStart).count();
+
+	// Every request pushed is popped once, the counters add up
+	MppQueue::MPP_QUEUE_STATISTICS Statistics = { 0x00 };
+	MppQueue::GetStatistics(&QueueStressQueue, &Statistics);
+	ULONG64 Pushed  = 0x00;
+	ULONG64 Dropped = 0x00;
+	for (ULONG cx = 0x00; cx < NumberOfProducers; cx++) {
+		if (Popped[cx] != Producers[cx].Pushed) {
+			::printf("[-] Producer %u: %llu popped, %llu pushed\r\n", cx, (unsigned long long)Popped[cx], (unsigned long long)Producers[cx].Pushed);
+			Errors++;
+		}
+		Pushed  += Producers[cx].Pushed;
+		Dropped += Producers[cx].Dropped;
+	}
+	if ((ULONG64)Statistics.Pushed != Pushed || (ULONG64)Statistics.Dropped != Dropped
+		|| (ULONG64)(Statistics.Pushed + Statistics.Dropped) != NumberOfProducers * NumberOfRequests
+		|| Statistics.Popped != Statistics.Pushed || Statistics.Depth != 0x00
+		|| Statistics.HighWater > QUEUESTRESS_CAPACITY) {
+		::printf("[-] Counters: %lld pushed, %lld dropped, %lld popped, depth %lld, high water %lld\r\n",
+			(long long)Statistics.Pushed, (long long)Statistics.Dropped, (long long)Statistics.Popped,
+			(long long)Statistics.Depth, (long long)Statistics.HighWater);
+		Errors++;
+	}
+
+	::printf("[+] %u producer(s), %llu request(s) each, %u slot(s)\r\n", NumberOfProducers, (unsigned long long)NumberOfRequests, QUEUESTRESS_CAPACITY);
+	::printf("[+] %llu pushed, %llu dropped, high water %lld\r\n", (unsigned long long)Pushed, (unsigned long long)Dropped, (long long)Statistics.HighWater);
+	::printf("[+] %.1f ns per request\r\n", (Time * 1000000.0) / (double)(NumberOfProducers * NumberOfRequests));
+	::printf("[+] %llu error(s)\r\n", (unsigned long long)Errors);
+	return Errors == 0x00 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,148 @@
+/*+================================================================================================
+Module Name: rcustress.cpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+Abstract:
+Stress test of the Memory Patching Protection (MPP) read-copy-update.
+Reader threads read the published snapshot in a loop while a writer replaces it, then poisons and
+frees the previous one as the driver reclaims its image names and policies. A reader must never
+see a poisoned or freed snapshot, which AddressSanitizer reports, nor an older snapshot than one
+it has already read. The number of readers, of snapshots and the duration of the reads can be
+given on the command line.
+
+Build: c++ -std=c++17 -O2 -g -pthread [-fsanitize=address,undefined | -fsanitize=thread] ../mpp/rcu.cpp rcustress.cpp -o rcustress
+================================================================================================+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "../mpp/rcu.hpp"
+
+/// @brief Default number of readers, and of snapshots published by the writer.
+#define RCUSTRESS_READERS   (ULONG)0x04
+#define RCUSTRESS_SNAPSHOTS (ULONG)0x4000
+
+/// @brief Number of values of a snapshot, read by the readers.
+#define RCUSTRESS_VALUES (ULONG)0x40
+
+/// @brief Marker of a published snapshot, and of a reclaimed one.
+#define RCUSTRESS_MAGIC    (ULONG64)0x5243555354524553
+#define RCUSTRESS_POISONED (UCHAR)0xDD
+
+/// @brief Snapshot published by the writer.
+typedef struct _RCUSTRESS_SNAPSHOT {
+	ULONG64 Magic;
+	ULONG64 Generation;
+	ULONG64 Values[RCUSTRESS_VALUES]; // Generation plus the index of the value
+} RCUSTRESS_SNAPSHOT, * PRCUSTRESS_SNAPSHOT;
+
+/// @brief Results of a reader.
+typedef struct _RCUSTRESS_READER {
+	ULONG64 Reads;
+	ULONG64 Errors;
+} RCUSTRESS_READER, * PRCUSTRESS_READER;
+
+static MppRcu::MPP_RCU_DOMAIN RcuStressDomain;
+static std::atomic<BOOLEAN>   RcuStressDone{ FALSE };
+
+/// @brief Allocate and fill a snapshot.
+static PRCUSTRESS_SNAPSHOT RcuStressCreate(
+	_In_ ULONG64 Generation
+) {
+	auto Snapshot = new RCUSTRESS_SNAPSHOT;
+	Snapshot->Magic      = RCUSTRESS_MAGIC;
+	Snapshot->Generation = Generation;
+	for (ULONG cx = 0x00; cx < RCUSTRESS_VALUES; cx++)
+		Snapshot->Values[cx] = Generation + cx;
+	return Snapshot;
+}
+
+/// @brief Poison and free a snapshot no reader can see anymore.
+static VOID RcuStressReclaim(
+	_In_opt_ PVOID Snapshot
+) {
+	if (Snapshot == nullptr)
+		return;
+	::memset(Snapshot, RCUSTRESS_POISONED, sizeof(RCUSTRESS_SNAPSHOT));
+	delete static_cast<PRCUSTRESS_SNAPSHOT>(Snapshot);
+}
+
+/// @brief Read the published snapshot until the writer is done.
+static VOID RcuStressRead(
+	_Out_ PRCUSTRESS_READER Reader
+) {
+	Reader->Reads  = 0x00;
+	Reader->Errors = 0x00;
+	ULONG64 Last   = 0x00;
+
+	while (!RcuStressDone.load(std::memory_order_acquire)) {
+		MppRcu::MPP_RCU_TOKEN Token = { 0x00 };
+		auto Snapshot = static_cast<PRCUSTRESS_SNAPSHOT>(MppRcu::ReadLock(&RcuStressDomain, &Token));
+
+		BOOLEAN Valid = Snapshot != nullptr && Snapshot->Magic == RCUSTRESS_MAGIC && Snapshot->Generation >= Last;
+		for (ULONG cx = 0x00; Valid && cx < RCUSTRESS_VALUES; cx++)
+			Valid = Snapshot->Values[cx] == Snapshot->Generation + cx;
+
+		// Still valid at the end of the read
+		if (Valid) {
+			std::this_thread::yield();
+			Valid = Snapshot->Magic == RCUSTRESS_MAGIC;
+			Last  = Snapshot->Generation;
+		}
+		MppRcu::ReadUnlock(&RcuStressDomain, Token);
+
+		Reader->Reads++;
+		Reader->Errors += !Valid;
+	}
+}
+
+int main(int argc, char** argv) {
+	ULONG NumberOfReaders   = argc > 1 ? (ULONG)strtoul(argv[1], NULL, 0x00) : RCUSTRESS_READERS;
+	ULONG NumberOfSnapshots = argc > 2 ? (ULONG)strtoul(argv[2], NULL, 0x00) : RCUSTRESS_SNAPSHOTS;
+	if (NumberOfReaders == 0x00 || NumberOfSnapshots == 0x00) {
+		::printf("usage: %s [readers] [snapshots]\r\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	MppRcu::Initialise(&RcuStressDomain, RcuStressCreate(0x01));
+
+	std::vector<RCUSTRESS_READER> Readers(NumberOfReaders);
+	std::vector<std::thread>      Threads;
+	for (ULONG cx = 0x00; cx < NumberOfReaders; cx++)
+		Threads.emplace_back(RcuStressRead, &Readers[cx]);
+
+	// Writer, serialised as the driver does with its lock
+	auto TimeStart = std::chrono::steady_clock::now();
+	for (ULONG64 Generation = 0x02; Generation <= NumberOfSnapshots; Generation++)
+		RcuStressReclaim(MppRcu::Replace(&RcuStressDomain, RcuStressCreate(Generation)));
+	double WriteTime = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - TimeStart).count();
+
+	RcuStressDone.store(TRUE, std::memory_order_release);
+	for (std::thread& Thread : Threads)
+		Thread.join();
+
+	// The last snapshot, then none
+	auto Last = static_cast<PRCUSTRESS_SNAPSHOT>(MppRcu::Replace(&RcuStressDomain, nullptr));
+	ULONG64 Errors = Last == nullptr || Last->Generation != NumberOfSnapshots;
+	RcuStressReclaim(Last);
+	MppRcu::MPP_RCU_TOKEN Token = { 0x00 };
+	Errors += MppRcu::ReadLock(&RcuStressDomain, &Token) != nullptr;
+	MppRcu::ReadUnlock(&RcuStressDomain, Token);
+
+	ULONG64 Reads = 0x00;
+	for (CONST RCUSTRESS_READER& Reader : Readers) {
+		Reads  += Reader.Reads;
+		Errors += Reader.Errors;
+	}
+
+	::printf("[+] %u reader(s), %llu read(s)\r\n", NumberOfReaders, (unsigned long long)Reads);
+	::printf("[+] %u snapshot(s), %.1f us per replacement\r\n", NumberOfSnapshots, WriteTime / (double)NumberOfSnapshots);
+	::printf("[+] %llu error(s)\r\n", (unsigned long long)Errors);
+	return Errors == 0x00 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
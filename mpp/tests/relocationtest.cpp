@@ -0,0 +1,164 @@
+/*+================================================================================================
+Module Name: relocationtest.cpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+Abstract:
+Test of the Memory Patching Protection (MPP) rebuilding of the ranges of an image from its file.
+Random PE32 and PE32+ images, with relocations of every type in their code and data, some of them
+across page boundaries, are loaded at their preferred address and at others, as the loader does.
+Each planned range, and random ranges cutting through relocations, rebuilt from the file must be
+the same as the bytes of the image loaded. An image without relocations can only be rebuilt at its
+preferred address, and a file with truncated or invalid relocations is refused. The number of
+images can be given on the command line.
+
+Build: c++ -std=c++17 -O2 -g [-fsanitize=address,undefined] ../mpp/sections.cpp relocationtest.cpp -o relocationtest
+================================================================================================+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory>
+#include <random>
+
+#include "../mpp/sections.hpp"
+#include "peimage.hpp"
+
+/// @brief Default number of images.
+#define RELOCATIONTEST_IMAGES (ULONG)0x100
+
+/// @brief Number of random ranges rebuilt per image and address.
+#define RELOCATIONTEST_RANGES (ULONG)0x40
+
+/// @brief Rebuild ranges of a file and compare them with the image loaded at the same address.
+static ULONG RelocationTestCompare(
+	_Inout_ std::mt19937&             Random,
+	_In_    CONST PEIMAGE&            Image,
+	_In_    CONST std::vector<UCHAR>& File,
+	_In_    ULONG64                   ImageBase
+) {
+	std::vector<UCHAR> Loaded = PeImageLoad(Image, ImageBase);
+
+	// Planned ranges, then random ones of any alignment
+	MppSections::MPP_SECTION_PLAN Plan = { 0x00 };
+	if (!MppSections::Plan(File.data(), File.size(), &Plan) || Plan.NumberOfRanges == 0x00) {
+		::printf("[-] Unable to plan the image\r\n");
+		return 0x01;
+	}
+	std::vector<MppSections::MPP_SECTION_RANGE> Ranges(Plan.Ranges, Plan.Ranges + Plan.NumberOfRanges);
+	for (ULONG cx = 0x00; cx < RELOCATIONTEST_RANGES; cx++) {
+		ULONG Start = Random() % (ULONG)Loaded.size();
+		ULONG Size  = (Random() % 0x02) == 0x00 ? Random() % 0x10 : Random() % ((ULONG)Loaded.size() - Start + 0x01);
+		Ranges.push_back({ Start, Start + Size < (ULONG)Loaded.size() ? Start + Size : (ULONG)Loaded.size() });
+	}
+
+	ULONG Differences = 0x00;
+	for (CONST MppSections::MPP_SECTION_RANGE& Range : Ranges) {
+		std::vector<UCHAR> Buffer(Range.End - Range.Start + 0x01, 0xEE);
+		if (!MppSections::MapFileRange(File.data(), File.size(), ImageBase, &Range, Buffer.data())) {
+			::printf("[-] 0x%llX: range [0x%X, 0x%X) not rebuilt\r\n", (unsigned long long)ImageBase, Range.Start, Range.End);
+			Differences++;
+			continue;
+		}
+		if (!std::equal(Loaded.begin() + Range.Start, Loaded.begin() + Range.End, Buffer.begin()) || Buffer.back() != 0xEE) {
+			::printf("[-] 0x%llX: range [0x%X, 0x%X) different\r\n", (unsigned long long)ImageBase, Range.Start, Range.End);
+			Differences++;
+		}
+	}
+	return Differences;
+}
+
+/// @brief Whether a range of a file, altered, can be rebuilt, exactly the bytes of the file given.
+static BOOLEAN RelocationTestMap(
+	_In_ CONST std::vector<UCHAR>&              File,
+	_In_ SIZE_T                                 FileSize,
+	_In_ ULONG64                                ImageBase,
+	_In_ CONST MppSections::MPP_SECTION_RANGE& Range
+) {
+	std::unique_ptr<UCHAR[]> Copy(new UCHAR[FileSize + 0x01]);
+	std::vector<UCHAR>       Buffer(Range.End - Range.Start + 0x01);
+	memcpy(Copy.get(), File.data(), FileSize);
+	return MppSections::MapFileRange(Copy.get(), FileSize, ImageBase, &Range, Buffer.data());
+}
+
+/// @brief Check the files that cannot be rebuilt.
+static ULONG RelocationTestRefuse(
+	_Inout_ std::mt19937& Random,
+	_In_    BOOLEAN       Is64
+) {
+	PEIMAGE                          Image = PeImageGenerate(Random, Is64);
+	std::vector<UCHAR>               File  = PeImageBuild(Image);
+	MppSections::MPP_SECTION_RANGE   Whole = { 0x00, PeImageGetSizeOfImage(Image) };
+	ULONG64                          Moved = Image.ImageBase + 0x10000;
+	ULONG                            Differences = 0x00;
+
+	// Relocation directory, in the ".reloc" section at the end of the file
+	SIZE_T Directory = PEIMAGE_OPTIONAL + (Is64 ? 0x70 : 0x60) + (0x05 * 0x08);
+	SIZE_T Blocks    = File.size() - ((PeImageBuildRelocations(Image).size() + (PEIMAGE_FILE_ALIGNMENT - 1)) & ~(SIZE_T)(PEIMAGE_FILE_ALIGNMENT - 1));
+
+	// Without relocations, only at the preferred address
+	PEIMAGE Fixed = Image;
+	Fixed.Relocations.clear();
+	std::vector<UCHAR> FixedFile = PeImageBuild(Fixed);
+	if (!RelocationTestMap(FixedFile, FixedFile.size(), Fixed.ImageBase, Whole) || RelocationTestMap(FixedFile, FixedFile.size(), Moved, Whole)) {
+		::printf("[-] PE32%s: image without relocations\r\n", Is64 ? "+" : "");
+		Differences++;
+	}
+
+	// Relocations cut, or an invalid block size or type
+	std::vector<UCHAR> Altered = File;
+	PeImageWrite(Altered, Blocks + 0x04, 0x04, 0x04);
+	Differences += RelocationTestMap(Altered, Altered.size(), Moved, Whole);
+	Altered = File;
+	PeImageWrite(Altered, Blocks + 0x04, 0x04, 0x10000);
+	Differences += RelocationTestMap(Altered, Altered.size(), Moved, Whole);
+	Altered = File;
+	PeImageWrite(Altered, Blocks + 0x08, 0x02, 0x5000);
+	Differences += RelocationTestMap(Altered, Altered.size(), Moved, Whole);
+	Differences += RelocationTestMap(File, Blocks + 0x08, Moved, Whole);
+	Altered = File;
+	PeImageWrite(Altered, Directory + 0x04, 0x04, File.size());
+	Differences += RelocationTestMap(Altered, Altered.size(), Moved, Whole);
+	if (Differences != 0x00)
+		::printf("[-] PE32%s: invalid relocations rebuilt\r\n", Is64 ? "+" : "");
+
+	// Truncated anywhere, for the sanitizers only
+	for (ULONG cx = 0x00; cx < 0x100; cx++) {
+		SIZE_T                         Size  = Random() % File.size();
+		ULONG                          Start = Random() % Whole.End;
+		MppSections::MPP_SECTION_RANGE Range = { Start, Start + (ULONG)(Random() % (Whole.End - Start + 0x01)) };
+		(VOID)RelocationTestMap(File, Size, Moved, Range);
+	}
+	return Differences;
+}
+
+int main(int argc, char** argv) {
+	ULONG NumberOfImages = argc > 1 ? (ULONG)strtoul(argv[1], NULL, 0x00) : RELOCATIONTEST_IMAGES;
+	if (NumberOfImages == 0x00) {
+		::printf("usage: %s [images]\r\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	std::mt19937 Random(0x52454C4F);
+	ULONG        Differences = RelocationTestRefuse(Random, FALSE);
+	Differences += RelocationTestRefuse(Random, TRUE);
+
+	SIZE_T NumberOfRelocations = 0x00;
+	for (ULONG cx = 0x00; cx < NumberOfImages && Differences < 0x10; cx++) {
+		BOOLEAN            Is64  = (cx % 0x02) == 0x01;
+		PEIMAGE            Image = PeImageGenerate(Random, Is64);
+		std::vector<UCHAR> File  = PeImageBuild(Image);
+		NumberOfRelocations += Image.Relocations.size();
+
+		// Preferred address, close to it either way, and anywhere
+		ULONG64 Anywhere = Is64 ? (0xFFFFF80000000000ULL | ((ULONG64)Random() << 0x10)) : (ULONG64)(Random() & 0xFFFF0000);
+		Differences += RelocationTestCompare(Random, Image, File, Image.ImageBase);
+		Differences += RelocationTestCompare(Random, Image, File, Image.ImageBase + 0x10000);
+		Differences += RelocationTestCompare(Random, Image, File, Image.ImageBase - 0x8000000);
+		Differences += RelocationTestCompare(Random, Image, File, Anywhere);
+	}
+
+	::printf("[+] %u image(s), %zu relocation(s)\r\n", NumberOfImages, NumberOfRelocations);
+	::printf("[+] %u difference(s)\r\n", Differences);
+	return Differences == 0x00 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,319 @@
+/*+================================================================================================
+Module Name: sectionsfuzz.cpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+Abstract:
+Fuzzer of the Memory Patching Protection (MPP) planner of the ranges of an image to protect.
+A PE32 and a PE32+ image, with code sections out of order, adjacent, overlapping, without virtual
+size or past the end of the image, are planned and checked against the ranges expected, then with
+their headers truncated at every length. The headers are then mutated at random and truncated, and
+the plan of each checked against a second reading of the section table: same validity, sorted and
+disjoint page-aligned ranges within the image, covering the same bytes as the executable sections.
+The number of mutations can be given on the command line.
+
+Build: c++ -std=c++17 -O2 -g [-fsanitize=address,undefined] ../mpp/sections.cpp sectionsfuzz.cpp -o sectionsfuzz
+================================================================================================+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <random>
+
+#include "../mpp/sections.hpp"
+#include "peimage.hpp"
+
+/// @brief Default number of mutations.
+#define SECTIONSFUZZ_MUTATIONS (ULONG)0x40000
+
+/// @brief Size of the headers mutated, enough for the largest section table.
+#define SECTIONSFUZZ_HEADERS (SIZE_T)0x2000
+
+/// @brief Size of the fixtures, the last code section crossing it.
+#define SECTIONSFUZZ_SIZE_OF_IMAGE (ULONG)0x9000
+
+/// @brief Range of an executable section, as the loader maps it and clipped to the image.
+typedef struct _SECTIONSFUZZ_INTERVAL {
+	LONG64 Start;
+	LONG64 End;
+} SECTIONSFUZZ_INTERVAL, * PSECTIONSFUZZ_INTERVAL;
+
+/// @brief Read a little-endian value of up to 32 bits.
+static ULONG SectionsFuzzRead(
+	_In_ CONST UCHAR* Buffer,
+	_In_ ULONG        Width
+) {
+	ULONG Value = 0x00;
+	for (ULONG cx = 0x00; cx < Width; cx++)
+		Value |= (ULONG)Buffer[cx] << (cx * 0x08);
+	return Value;
+}
+
+/// @brief Second reading of the headers: whether they are valid, and the executable ranges.
+static BOOLEAN SectionsFuzzReference(
+	_In_  CONST UCHAR*                        Headers,
+	_In_  SIZE_T                              HeadersSize,
+	_Out_ ULONG*                              SizeOfImage,
+	_Out_ std::vector<SECTIONSFUZZ_INTERVAL>& Intervals
+) {
+	*SizeOfImage = 0x00;
+	Intervals.clear();
+	if (HeadersSize < 0x40 || SectionsFuzzRead(Headers, 0x02) != 0x5A4D)
+		return FALSE;
+
+	ULONG64 Nt = SectionsFuzzRead(Headers + 0x3C, 0x04);
+	if ((Nt + 0x18 + 0x3C) > HeadersSize || SectionsFuzzRead(Headers + Nt, 0x04) != 0x00004550)
+		return FALSE;
+	ULONG Magic = SectionsFuzzRead(Headers + Nt + 0x18, 0x02);
+	if (Magic != 0x010B && Magic != 0x020B)
+		return FALSE;
+
+	ULONG NumberOfSections = SectionsFuzzRead(Headers + Nt + 0x06, 0x02);
+	ULONG SizeOfOptional   = SectionsFuzzRead(Headers + Nt + 0x14, 0x02);
+	if (NumberOfSections > MppSections::MaximumSections || SizeOfOptional < 0x3C)
+		return FALSE;
+	*SizeOfImage = SectionsFuzzRead(Headers + Nt + 0x18 + 0x38, 0x04);
+
+	ULONG64 Table = Nt + 0x18 + SizeOfOptional;
+	if ((Table + ((ULONG64)NumberOfSections * 0x28)) > HeadersSize)
+		return FALSE;
+
+	for (ULONG cx = 0x00; cx < NumberOfSections; cx++) {
+		CONST UCHAR* Section = Headers + Table + (cx * 0x28);
+		if ((SectionsFuzzRead(Section + 0x24, 0x04) & PEIMAGE_SCN_EXECUTE) == 0x00)
+			continue;
+
+		LONG64 Address = SectionsFuzzRead(Section + 0x0C, 0x04);
+		LONG64 Size    = SectionsFuzzRead(Section + 0x08, 0x04);
+		if (Size == 0x00)
+			Size = SectionsFuzzRead(Section + 0x10, 0x04);
+
+		SECTIONSFUZZ_INTERVAL Interval = {
+			(Address / PEIMAGE_PAGE_SIZE) * PEIMAGE_PAGE_SIZE,
+			std::min<LONG64>(((Address + Size + PEIMAGE_PAGE_SIZE - 1) / PEIMAGE_PAGE_SIZE) * PEIMAGE_PAGE_SIZE, *SizeOfImage)
+		};
+		if (Size != 0x00 && Interval.Start < Interval.End)
+			Intervals.push_back(Interval);
+	}
+	return TRUE;
+}
+
+/// @brief Check a plan against the second reading of the same headers.
+static ULONG SectionsFuzzCheck(
+	_In_ CONST UCHAR* Headers,
+	_In_ SIZE_T       HeadersSize
+) {
+	// Exactly the bytes given, so that reading past them is reported
+	std::unique_ptr<UCHAR[]> Copy(new UCHAR[HeadersSize + 0x01]);
+	if (HeadersSize != 0x00)
+		memcpy(Copy.get(), Headers, HeadersSize);
+
+	MppSections::MPP_SECTION_PLAN     Plan     = { 0x00 };
+	MppSections::MPP_SECTION_IDENTITY Identity = { 0x00 };
+	BOOLEAN Valid       = MppSections::Plan(Copy.get(), HeadersSize, &Plan);
+	BOOLEAN Identified  = MppSections::GetIdentity(Copy.get(), HeadersSize, &Identity);
+
+	ULONG                              SizeOfImage = 0x00;
+	std::vector<SECTIONSFUZZ_INTERVAL> Intervals;
+	BOOLEAN Expected = SectionsFuzzReference(Headers, HeadersSize, &SizeOfImage, Intervals);
+
+	if (Valid != Expected || (Valid && !Identified) || (Identified && Identity.SizeOfImage != SectionsFuzzRead(Headers + SectionsFuzzRead(Headers + 0x3C, 0x04) + 0x18 + 0x38, 0x04))) {
+		::printf("[-] %zu byte(s): plan %u, identity %u, %u expected\r\n", HeadersSize, Valid, Identified, Expected);
+		return 0x01;
+	}
+	if (!Valid)
+		return Plan.NumberOfRanges != 0x00;
+	if (Plan.SizeOfImage != SizeOfImage || Plan.NumberOfRanges > MppSections::MaximumSections) {
+		::printf("[-] %zu byte(s): size of image 0x%X, %u range(s)\r\n", HeadersSize, Plan.SizeOfImage, Plan.NumberOfRanges);
+		return 0x01;
+	}
+
+	// Sorted, disjoint and not adjacent, page-aligned unless clipped to the image
+	for (ULONG cx = 0x00; cx < Plan.NumberOfRanges; cx++) {
+		CONST MppSections::MPP_SECTION_RANGE& Range = Plan.Ranges[cx];
+		if (Range.Start >= Range.End || Range.End > SizeOfImage
+			|| (Range.Start % PEIMAGE_PAGE_SIZE) != 0x00
+			|| ((Range.End % PEIMAGE_PAGE_SIZE) != 0x00 && Range.End != SizeOfImage)
+			|| (cx != 0x00 && Range.Start <= Plan.Ranges[cx - 1].End)) {
+			::printf("[-] %zu byte(s): range %u [0x%X, 0x%X)\r\n", HeadersSize, cx, Range.Start, Range.End);
+			return 0x01;
+		}
+	}
+
+	// Same bytes covered, both being constant between the bounds of the ranges
+	std::vector<LONG64> Points;
+	for (CONST SECTIONSFUZZ_INTERVAL& Interval : Intervals) {
+		Points.push_back(Interval.Start);
+		Points.push_back(Interval.End - 0x01);
+		Points.push_back(Interval.End);
+	}
+	for (ULONG cx = 0x00; cx < Plan.NumberOfRanges; cx++) {
+		Points.push_back(Plan.Ranges[cx].Start);
+		Points.push_back((LONG64)Plan.Ranges[cx].Start - 0x01);
+		Points.push_back(Plan.Ranges[cx].End);
+	}
+	for (LONG64 Point : Points) {
+		BOOLEAN Covered = std::any_of(Intervals.begin(), Intervals.end(),
+			[Point](CONST SECTIONSFUZZ_INTERVAL& Interval) { return Point >= Interval.Start && Point < Interval.End; });
+		BOOLEAN Planned = std::any_of(Plan.Ranges, Plan.Ranges + Plan.NumberOfRanges,
+			[Point](CONST MppSections::MPP_SECTION_RANGE& Range) { return Point >= Range.Start && Point < Range.End; });
+		if (Covered != Planned) {
+			::printf("[-] %zu byte(s): byte 0x%llX planned %u, %u expected\r\n", HeadersSize, (unsigned long long)Point, Planned, Covered);
+			return 0x01;
+		}
+	}
+	return 0x00;
+}
+
+/// @brief PE32 or PE32+ image with code sections to plan.
+static PEIMAGE SectionsFuzzFixture(
+	_In_ BOOLEAN Is64
+) {
+	PEIMAGE Image = { Is64, Is64 ? 0x140000000ULL : 0x00400000ULL, 0x5F5E1000, SECTIONSFUZZ_SIZE_OF_IMAGE, {} };
+	Image.Sections.push_back({ ".text",  0x1000, 0x2345, PEIMAGE_SCN_CODE,  std::vector<UCHAR>(0x2345, 0xCC) });
+	Image.Sections.push_back({ ".rdata", 0x4000, 0x0800, PEIMAGE_SCN_RDATA, std::vector<UCHAR>(0x0800, 0x11) });
+	Image.Sections.push_back({ "PAGE",   0x5000, 0x0F00, PEIMAGE_SCN_CODE,  std::vector<UCHAR>(0x0F00, 0x90) });
+	Image.Sections.push_back({ "INIT",   0x6000, 0x0000, PEIMAGE_SCN_CODE,  std::vector<UCHAR>(0x0300, 0x90) });
+	Image.Sections.push_back({ ".data",  0x7000, 0x0100, PEIMAGE_SCN_DATA,  std::vector<UCHAR>(0x0100, 0x22) });
+	Image.Sections.push_back({ "EMPTY",  0x7800, 0x0000, PEIMAGE_SCN_CODE,  {} });
+	Image.Sections.push_back({ ".tail",  0x8800, 0x2000, PEIMAGE_SCN_CODE,  std::vector<UCHAR>(0x0200, 0xC3) });
+	Image.Sections.push_back({ "ORDER",  0x2000, 0x0100, PEIMAGE_SCN_CODE,  std::vector<UCHAR>(0x0100, 0xCC) });
+	return Image;
+}
+
+/// @brief Check the plan of a fixture, whole and truncated.
+static ULONG SectionsFuzzCheckFixture(
+	_In_ BOOLEAN Is64
+) {
+	static CONST MppSections::MPP_SECTION_RANGE Expected[] = { { 0x1000, 0x4000 }, { 0x5000, 0x7000 }, { 0x8000, 0x9000 } };
+
+	PEIMAGE            Image       = SectionsFuzzFixture(Is64);
+	std::vector<UCHAR> File        = PeImageBuild(Image);
+	SIZE_T             HeadersSize = PeImageGetHeadersSize(Image);
+
+	MppSections::MPP_SECTION_PLAN     Plan     = { 0x00 };
+	MppSections::MPP_SECTION_IDENTITY Identity = { 0x00 };
+	BOOLEAN Valid = MppSections::Plan(File.data(), File.size(), &Plan) && MppSections::GetIdentity(File.data(), File.size(), &Identity);
+	if (!Valid || Identity.TimeDateStamp != Image.TimeDateStamp || Identity.SizeOfImage != Image.SizeOfImage
+		|| Plan.NumberOfRanges != _ARRAYSIZE(Expected)) {
+		::printf("[-] PE32%s: %u range(s), %u expected\r\n", Is64 ? "+" : "", Plan.NumberOfRanges, (ULONG)_ARRAYSIZE(Expected));
+		return 0x01;
+	}
+
+	ULONG Differences = 0x00;
+	for (ULONG cx = 0x00; cx < _ARRAYSIZE(Expected); cx++) {
+		if (Plan.Ranges[cx].Start != Expected[cx].Start || Plan.Ranges[cx].End != Expected[cx].End) {
+			::printf("[-] PE32%s: range [0x%X, 0x%X), [0x%X, 0x%X) expected\r\n", Is64 ? "+" : "",
+				Plan.Ranges[cx].Start, Plan.Ranges[cx].End, Expected[cx].Start, Expected[cx].End);
+			Differences++;
+		}
+	}
+
+	// Valid only once the section table is complete
+	for (SIZE_T Size = 0x00; Size <= File.size(); Size++) {
+		Differences += SectionsFuzzCheck(File.data(), Size);
+		if (MppSections::Plan(File.data(), Size, &Plan) != (Size >= HeadersSize)) {
+			::printf("[-] PE32%s: %zu byte(s) of %zu planned\r\n", Is64 ? "+" : "", Size, HeadersSize);
+			Differences++;
+		}
+		if (Size == HeadersSize + 0x08)
+			Size = File.size() - 0x01;
+	}
+	return Differences;
+}
+
+/// @brief Mutate the headers of a fixture.
+static VOID SectionsFuzzMutate(
+	_Inout_ std::mt19937&        Random,
+	_Inout_ std::vector<UCHAR>&  Headers
+) {
+	CONST SIZE_T Nt = PEIMAGE_NT_HEADERS;
+
+	// Fields read by the planner
+	if ((Random() % 0x04) == 0x00)
+		PeImageWrite(Headers, Nt + 0x06, 0x02, (Random() % 0x02) == 0x00 ? Random() % (MppSections::MaximumSections + 0x08) : Random());
+	if ((Random() % 0x04) == 0x00) {
+		static CONST ULONG Sizes[] = { 0x00, 0x3B, 0x3C, 0xE0, 0xF0, 0x1F0 };
+		PeImageWrite(Headers, Nt + 0x14, 0x02, (Random() % 0x02) == 0x00 ? Sizes[Random() % _ARRAYSIZE(Sizes)] : Random());
+	}
+	if ((Random() % 0x04) == 0x00)
+		PeImageWrite(Headers, Nt + 0x18 + 0x38, 0x04, (Random() % 0x02) == 0x00 ? Random() % 0x10000 : Random());
+	if ((Random() % 0x10) == 0x00)
+		PeImageWrite(Headers, 0x3C, 0x04, (Random() % 0x02) == 0x00 ? Random() % 0x200 : Random());
+	if ((Random() % 0x10) == 0x00)
+		PeImageWrite(Headers, Nt + 0x18, 0x02, (Random() % 0x02) == 0x00 ? 0x010B : Random());
+
+	// Section headers, wherever the table now is
+	ULONG Table = Nt + 0x18 + SectionsFuzzRead(&Headers[Nt + 0x14], 0x02);
+	ULONG Count = Random() % 0x10;
+	for (ULONG cx = 0x00; cx < Count; cx++) {
+		SIZE_T Section = Table + ((Random() % MppSections::MaximumSections) * 0x28);
+		if ((Section + 0x28) > Headers.size())
+			continue;
+
+		switch (Random() % 0x04) {
+		case 0x00:
+			PeImageWrite(Headers, Section + 0x0C, 0x04, (Random() % 0x02) == 0x00 ? Random() % 0x20000 : 0xFFFFFFFF - (Random() % 0x2000));
+			break;
+		case 0x01:
+			PeImageWrite(Headers, Section + 0x08, 0x04, (Random() % 0x02) == 0x00 ? Random() % 0x8000 : Random());
+			break;
+		case 0x02:
+			PeImageWrite(Headers, Section + 0x10, 0x04, (Random() % 0x02) == 0x00 ? Random() % 0x8000 : Random());
+			break;
+		default:
+			PeImageWrite(Headers, Section + 0x24, 0x04, Random() ^ ((Random() % 0x02) * PEIMAGE_SCN_EXECUTE));
+			break;
+		}
+	}
+
+	// A few bytes anywhere in the headers
+	Count = Random() % 0x04;
+	for (ULONG cx = 0x00; cx < Count; cx++)
+		Headers[Random() % 0x400] ^= (UCHAR)(0x01 << (Random() % 0x08));
+}
+
+int main(int argc, char** argv) {
+	ULONG NumberOfMutations = argc > 1 ? (ULONG)strtoul(argv[1], NULL, 0x00) : SECTIONSFUZZ_MUTATIONS;
+	if (NumberOfMutations == 0x00) {
+		::printf("usage: %s [mutations]\r\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	// Fixtures, whole and truncated
+	ULONG Differences = SectionsFuzzCheckFixture(FALSE);
+	Differences += SectionsFuzzCheckFixture(TRUE);
+
+	// Headers of the fixtures, padded for the largest section table
+	std::vector<UCHAR> Fixtures[0x02];
+	for (ULONG cx = 0x00; cx < 0x02; cx++) {
+		Fixtures[cx] = PeImageBuild(SectionsFuzzFixture(cx == 0x01));
+		Fixtures[cx].resize(SECTIONSFUZZ_HEADERS, 0x00);
+	}
+
+	std::mt19937 Random(0x53454354);
+	ULONG        Valid     = 0x00;
+	auto         TimeStart = std::chrono::steady_clock::now();
+	for (ULONG cx = 0x00; cx < NumberOfMutations && Differences < 0x10; cx++) {
+		std::vector<UCHAR> Headers = Fixtures[Random() % 0x02];
+		SectionsFuzzMutate(Random, Headers);
+
+		SIZE_T Size = (Random() % 0x04) == 0x00 ? Random() % (Headers.size() + 0x01) : Headers.size();
+		ULONG  Error = SectionsFuzzCheck(Headers.data(), Size);
+		if (Error != 0x00)
+			::printf("[-] Mutation %u\r\n", cx);
+		Differences += Error;
+
+		MppSections::MPP_SECTION_PLAN Plan = { 0x00 };
+		Valid += MppSections::Plan(Headers.data(), Size, &Plan);
+	}
+	double Time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - TimeStart).count();
+
+	::printf("[+] PE32 and PE32+ fixtures checked\r\n");
+	::printf("[+] %u mutation(s), %u valid, %.3f ms\r\n", NumberOfMutations, Valid, Time);
+	::printf("[+] %u difference(s)\r\n", Differences);
+	return Differences == 0x00 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,338 @@
+/*+================================================================================================
+Module Name: statsbench.cpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+Abstract:
+Test and benchmark of the Memory Patching Protection (MPP) runtime statistics.
+The bucket of every power of two, and of random measures, must be the number of significant bits
+of the measure. Threads then count events and record random measures, some of them of a clock
+going backwards, while another one sums the slots, each sum not lower than the previous one. Once
+they are done, the sum must be exactly the counters and histograms expected, and each percentile
+the bound of the bucket of the exact percentile. Last, recording, counting and summing are timed.
+The number of threads and of measures per thread can be given on the command line.
+
+Build: c++ -std=c++17 -O2 -g -pthread [-fsanitize=address,undefined | -fsanitize=thread] ../mpp/stats.cpp statsbench.cpp -o statsbench
+================================================================================================+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "../mpp/stats.hpp"
+
+/// @brief Default number of threads, and of measures per thread.
+#define STATSBENCH_THREADS  (ULONG)0x08
+#define STATSBENCH_MEASURES (ULONG)0x40000
+
+/// @brief Number of calls timed.
+#define STATSBENCH_CALLS (ULONG)0x100000
+
+/// @brief Percentiles checked, 0 and above 100 included.
+static CONST ULONG StatsBenchPercents[] = { 0x00, 0x01, 0x0A, 0x19, 0x32, 0x4B, 0x5A, 0x63, 0x64, 0x96 };
+
+static MppStats::MPP_STATS StatsBenchStats;
+static std::atomic<ULONG>  StatsBenchRunning{ 0x00 };
+
+/// @brief Bucket of a measure, counting its significant bits one by one.
+static ULONG StatsBenchGetBucket(
+	_In_ ULONG64 Duration
+) {
+	ULONG Bits = 0x00;
+	for (; Duration != 0x00; Duration >>= 1)
+		Bits++;
+	return Bits < MppStats::NumberOfBuckets ? Bits : MppStats::NumberOfBuckets - 1;
+}
+
+/// @brief Random measure, from 0 to above the last bucket, or of a clock going backwards.
+static ULONG64 StatsBenchMeasure(
+	_Inout_ std::mt19937_64& Random
+) {
+	switch (Random() % 0x10) {
+	case 0x00:
+		return 0x00;
+	case 0x01:
+		return (ULONG64)0x00 - (0x01 + (Random() % 0x3E8));
+	case 0x02:
+		return (0x01ULL << MppStats::NumberOfBuckets) + (Random() >> 0x18);
+	default:
+		return (Random() >> 0x20) >> (Random() % 0x20);
+	}
+}
+
+/// @brief Check the bucket of every power of two, its neighbours, and random measures.
+static ULONG StatsBenchCheckBuckets(
+	_Inout_ std::mt19937_64& Random
+) {
+	std::vector<ULONG64> Measures = { 0x00, 0xFFFFFFFFFFFFFFFF };
+	for (ULONG Bit = 0x00; Bit < 0x40; Bit++) {
+		Measures.push_back((0x01ULL << Bit) - 0x01);
+		Measures.push_back(0x01ULL << Bit);
+		Measures.push_back((0x01ULL << Bit) + 0x01);
+	}
+	for (ULONG cx = 0x00; cx < 0x100000; cx++)
+		Measures.push_back(Random() >> (Random() % 0x40));
+
+	ULONG Differences = 0x00;
+	for (ULONG64 Measure : Measures) {
+		ULONG Bucket = MppStats::GetBucket(Measure);
+		if (Bucket != StatsBenchGetBucket(Measure) && Differences++ < 0x08)
+			::printf("[-] 0x%llX: bucket %u, %u expected\r\n", (unsigned long long)Measure, Bucket, StatsBenchGetBucket(Measure));
+	}
+	return Differences;
+}
+
+/// @brief Count events and record measures, as the callback and the worker do.
+static VOID StatsBenchUpdate(
+	_In_ ULONG                       Thread,
+	_In_ CONST std::vector<ULONG64>* Measures
+) {
+	auto Counter = (MppStats::MPP_STATS_COUNTER)(Thread % MppStats::NumberOfCounters);
+	auto Latency = (MppStats::MPP_STATS_LATENCY)(Thread % MppStats::NumberOfLatencies);
+	for (SIZE_T cx = 0x00; cx < Measures->size(); cx++) {
+		MppStats::Increment(&StatsBenchStats, Counter);
+		MppStats::Record(&StatsBenchStats, Latency, (*Measures)[cx]);
+
+		// Let the other threads run on a single processor
+		if ((cx & 0xFFF) == 0x00)
+			std::this_thread::yield();
+	}
+	StatsBenchRunning.fetch_sub(0x01, std::memory_order_release);
+}
+
+/// @brief Sum the slots while they are updated, each sum not lower than the previous one.
+static ULONG StatsBenchSum(
+	_Out_ ULONG* NumberOfSums
+) {
+	MppStats::MPP_STATS_SNAPSHOT Previous    = { 0x00 };
+	MppStats::MPP_STATS_SNAPSHOT Current     = { 0x00 };
+	ULONG                        Differences = 0x00;
+
+	*NumberOfSums = 0x00;
+	while (StatsBenchRunning.load(std::memory_order_acquire) != 0x00) {
+		MppStats::Snapshot(&StatsBenchStats, &Current);
+		(*NumberOfSums)++;
+
+		BOOLEAN Lower = FALSE;
+		for (ULONG Counter = 0x00; Counter < MppStats::NumberOfCounters; Counter++)
+			Lower |= Current.Counters[Counter] < Previous.Counters[Counter];
+		for (ULONG Latency = 0x00; Latency < MppStats::NumberOfLatencies; Latency++) {
+			CONST MppStats::MPP_STATS_HISTOGRAM& Histogram = Current.Latencies[Latency];
+			CONST MppStats::MPP_STATS_HISTOGRAM& Last      = Previous.Latencies[Latency];
+			Lower |= Histogram.Count < Last.Count || Histogram.Sum < Last.Sum || Histogram.Maximum < Last.Maximum;
+			for (ULONG Bucket = 0x00; Bucket < MppStats::NumberOfBuckets; Bucket++)
+				Lower |= Histogram.Buckets[Bucket] < Last.Buckets[Bucket];
+		}
+		if (Lower && Differences++ < 0x08)
+			::printf("[-] Sum %u lower than the previous one\r\n", *NumberOfSums);
+
+		Previous = Current;
+		std::this_thread::yield();
+	}
+	return Differences;
+}
+
+/// @brief Check the percentiles of a histogram against the sorted measures.
+static ULONG StatsBenchCheckPercentiles(
+	_In_    CONST MppStats::MPP_STATS_HISTOGRAM& Histogram,
+	_Inout_ std::vector<ULONG64>&                Values
+) {
+	std::sort(Values.begin(), Values.end());
+
+	ULONG Differences = 0x00;
+	for (ULONG Percent : StatsBenchPercents) {
+		ULONG64 Expected = 0x00;
+		if (!Values.empty() && Percent != 0x00) {
+			SIZE_T  Rank   = ((Values.size() * (Percent > 100 ? 100 : Percent)) + 99) / 100;
+			ULONG64 Exact  = Values[Rank - 0x01];
+			ULONG   Bucket = StatsBenchGetBucket(Exact);
+
+			Expected = Bucket == 0x00 ? 0x00 : (0x01ULL << Bucket) - 0x01;
+			if (Bucket == MppStats::NumberOfBuckets - 1 || Expected > (ULONG64)Histogram.Maximum)
+				Expected = (ULONG64)Histogram.Maximum;
+			if (Expected < Exact) {
+				::printf("[-] p%u: bound 0x%llX lower than 0x%llX\r\n", Percent, (unsigned long long)Expected, (unsigned long long)Exact);
+				Differences++;
+			}
+		}
+
+		ULONG64 Bound = MppStats::GetPercentile(&Histogram, Percent);
+		if (Bound != Expected) {
+			::printf("[-] p%u: 0x%llX, 0x%llX expected\r\n", Percent, (unsigned long long)Bound, (unsigned long long)Expected);
+			Differences++;
+		}
+	}
+	return Differences;
+}
+
+/// @brief Add a measure to a histogram expected, as recording it does.
+static ULONG64 StatsBenchAdd(
+	_Inout_ MppStats::MPP_STATS_HISTOGRAM* Histogram,
+	_In_    ULONG64                        Measure
+) {
+	ULONG64 Value = (LONG64)Measure < 0x00 ? 0x00 : Measure;
+	Histogram->Count++;
+	Histogram->Sum    += (LONG64)Value;
+	Histogram->Maximum = (LONG64)Value > Histogram->Maximum ? (LONG64)Value : Histogram->Maximum;
+	Histogram->Buckets[StatsBenchGetBucket(Value)]++;
+	return Value;
+}
+
+/// @brief Check histograms of a few measures, for the rank of each percentile to be exact.
+static ULONG StatsBenchCheckSmall(
+	_Inout_ std::mt19937_64& Random
+) {
+	static MppStats::MPP_STATS Stats;
+
+	ULONG Differences = 0x00;
+	for (ULONG cx = 0x00; cx < 0x400 && Differences < 0x08; cx++) {
+		MppStats::MPP_STATS_HISTOGRAM Expected = { 0x00 };
+		std::vector<ULONG64>          Values;
+		ULONG                         Count    = 0x01 + (ULONG)(Random() % 0x10);
+		MppStats::Initialise(&Stats);
+		for (ULONG dx = 0x00; dx < Count; dx++) {
+			ULONG64 Measure = (Random() % 0x02) == 0x00 ? Random() % 0x20 : StatsBenchMeasure(Random);
+			MppStats::Record(&Stats, MppStats::LatencyAttach, Measure);
+			Values.push_back(StatsBenchAdd(&Expected, Measure));
+		}
+
+		MppStats::MPP_STATS_SNAPSHOT Snapshot = { 0x00 };
+		MppStats::Snapshot(&Stats, &Snapshot);
+		if (memcmp(&Snapshot.Latencies[MppStats::LatencyAttach], &Expected, sizeof(Expected)) != 0x00) {
+			::printf("[-] %u measure(s): maximum %lld, %lld expected\r\n", Count,
+				(long long)Snapshot.Latencies[MppStats::LatencyAttach].Maximum, (long long)Expected.Maximum);
+			Differences++;
+		}
+		Differences += StatsBenchCheckPercentiles(Snapshot.Latencies[MppStats::LatencyAttach], Values);
+	}
+	return Differences;
+}
+
+/// @brief Check the sum of the slots against the counters and histograms expected.
+static ULONG StatsBenchCheckSum(
+	_In_ ULONG                                    NumberOfThreads,
+	_In_ CONST std::vector<std::vector<ULONG64>>& Measures
+) {
+	MppStats::MPP_STATS_SNAPSHOT Expected = { 0x00 };
+	std::vector<ULONG64>         Values[MppStats::NumberOfLatencies];
+	for (ULONG Thread = 0x00; Thread < NumberOfThreads; Thread++) {
+		MppStats::MPP_STATS_HISTOGRAM* Histogram = &Expected.Latencies[Thread % MppStats::NumberOfLatencies];
+		Expected.Counters[Thread % MppStats::NumberOfCounters] += (LONG64)Measures[Thread].size();
+
+		for (ULONG64 Measure : Measures[Thread])
+			Values[Thread % MppStats::NumberOfLatencies].push_back(StatsBenchAdd(Histogram, Measure));
+	}
+
+	MppStats::MPP_STATS_SNAPSHOT Snapshot = { 0x00 };
+	MppStats::Snapshot(&StatsBenchStats, &Snapshot);
+
+	ULONG Differences = 0x00;
+	for (ULONG Counter = 0x00; Counter < MppStats::NumberOfCounters; Counter++) {
+		if (Snapshot.Counters[Counter] != Expected.Counters[Counter]) {
+			::printf("[-] Counter %u: %lld, %lld expected\r\n", Counter, (long long)Snapshot.Counters[Counter], (long long)Expected.Counters[Counter]);
+			Differences++;
+		}
+	}
+	for (ULONG Latency = 0x00; Latency < MppStats::NumberOfLatencies; Latency++) {
+		if (memcmp(&Snapshot.Latencies[Latency], &Expected.Latencies[Latency], sizeof(MppStats::MPP_STATS_HISTOGRAM)) != 0x00) {
+			::printf("[-] Latency %u: count %lld, sum %lld, maximum %lld, %lld, %lld, %lld expected\r\n", Latency,
+				(long long)Snapshot.Latencies[Latency].Count, (long long)Snapshot.Latencies[Latency].Sum, (long long)Snapshot.Latencies[Latency].Maximum,
+				(long long)Expected.Latencies[Latency].Count, (long long)Expected.Latencies[Latency].Sum, (long long)Expected.Latencies[Latency].Maximum);
+			Differences++;
+		}
+		Differences += StatsBenchCheckPercentiles(Snapshot.Latencies[Latency], Values[Latency]);
+	}
+	return Differences;
+}
+
+int main(int argc, char** argv) {
+	ULONG NumberOfThreads  = argc > 1 ? (ULONG)strtoul(argv[1], NULL, 0x00) : STATSBENCH_THREADS;
+	ULONG NumberOfMeasures = argc > 2 ? (ULONG)strtoul(argv[2], NULL, 0x00) : STATSBENCH_MEASURES;
+	if (NumberOfThreads == 0x00 || NumberOfMeasures == 0x00) {
+		::printf("usage: %s [threads] [measures]\r\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	std::mt19937_64 Random(0x5354415453);
+	ULONG           Differences = StatsBenchCheckBuckets(Random);
+	Differences += StatsBenchCheckSmall(Random);
+
+	// Nothing recorded yet
+	MppStats::Initialise(&StatsBenchStats);
+	MppStats::MPP_STATS_SNAPSHOT Empty = { 0x00 };
+	MppStats::Snapshot(&StatsBenchStats, &Empty);
+	for (ULONG Percent : StatsBenchPercents) {
+		if (MppStats::GetPercentile(&Empty.Latencies[MppStats::LatencyMatch], Percent) != 0x00) {
+			::printf("[-] p%u of an empty histogram\r\n", Percent);
+			Differences++;
+		}
+	}
+
+	// Measures of each thread, drawn before so that the sum expected can be computed
+	std::vector<std::vector<ULONG64>> Measures(NumberOfThreads);
+	for (std::vector<ULONG64>& Thread : Measures) {
+		for (ULONG cx = 0x00; cx < NumberOfMeasures; cx++)
+			Thread.push_back(StatsBenchMeasure(Random));
+	}
+
+	auto                     TimeStart = std::chrono::steady_clock::now();
+	std::vector<std::thread> Threads;
+	StatsBenchRunning.store(NumberOfThreads, std::memory_order_release);
+	for (ULONG Thread = 0x00; Thread < NumberOfThreads; Thread++)
+		Threads.emplace_back(StatsBenchUpdate, Thread, &Measures[Thread]);
+
+	ULONG NumberOfSums = 0x00;
+	Differences += StatsBenchSum(&NumberOfSums);
+	for (std::thread& Thread : Threads)
+		Thread.join();
+	double Time = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - TimeStart).count();
+	Differences += StatsBenchCheckSum(NumberOfThreads, Measures);
+
+	// One thread alone
+	ULONG64 Last      = MppStats::GetTime();
+	ULONG   Backwards = 0x00;
+	TimeStart = std::chrono::steady_clock::now();
+	for (ULONG cx = 0x00; cx < STATSBENCH_CALLS; cx++) {
+		ULONG64 Now = MppStats::GetTime();
+		Backwards += Now < Last;
+		Last       = Now;
+	}
+	double ClockTime = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - TimeStart).count();
+	if (Backwards != 0x00) {
+		::printf("[-] Time going backwards %u time(s)\r\n", Backwards);
+		Differences++;
+	}
+
+	TimeStart = std::chrono::steady_clock::now();
+	for (ULONG cx = 0x00; cx < STATSBENCH_CALLS; cx++)
+		MppStats::Increment(&StatsBenchStats, MppStats::CounterImagesLoaded);
+	double IncrementTime = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - TimeStart).count();
+
+	TimeStart = std::chrono::steady_clock::now();
+	for (ULONG cx = 0x00; cx < STATSBENCH_CALLS; cx++)
+		MppStats::Record(&StatsBenchStats, MppStats::LatencyMatch, Measures[0x00][cx % NumberOfMeasures]);
+	double RecordTime = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - TimeStart).count();
+
+	MppStats::MPP_STATS_SNAPSHOT Snapshot = { 0x00 };
+	TimeStart = std::chrono::steady_clock::now();
+	for (ULONG cx = 0x00; cx < 0x1000; cx++)
+		MppStats::Snapshot(&StatsBenchStats, &Snapshot);
+	double SnapshotTime = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - TimeStart).count();
+
+	double Updates = (double)NumberOfThreads * (double)NumberOfMeasures;
+	::printf("[+] %u thread(s), %u measure(s) per thread, summed %u time(s)\r\n", NumberOfThreads, NumberOfMeasures, NumberOfSums);
+	::printf("[+] Threads   : %10.1f ns per measure and event\r\n", Time / Updates);
+	::printf("[+] GetTime   : %10.1f ns\r\n", ClockTime / (double)STATSBENCH_CALLS);
+	::printf("[+] Increment : %10.1f ns\r\n", IncrementTime / (double)STATSBENCH_CALLS);
+	::printf("[+] Record    : %10.1f ns\r\n", RecordTime / (double)STATSBENCH_CALLS);
+	::printf("[+] Snapshot  : %10.2f us\r\n", SnapshotTime / 4096.0);
+	::printf("[+] %u difference(s)\r\n", Differences);
+	return Differences == 0x00 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
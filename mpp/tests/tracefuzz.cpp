@@ -0,0 +1,504 @@
+/*+================================================================================================
+Module Name: tracefuzz.cpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+Abstract:
+Fuzzer of the Memory Patching Protection (MPP) binary trace formatter.
+Random formats, made of text and of conversions with flags, widths and lengths, are generated with
+the text expected, each number being formatted by snprintf and each name converted from UTF-16,
+lone surrogates included. Records with fewer arguments than the format, unknown events, events
+without format and descriptors not indexed by their identifier are formatted too, into texts large
+enough and too small, and each record is only as large as its data. Last, the records of the events of the driver are formatted,
+and timed against snprintf. The number of formats can be given on the command line.
+
+Build: c++ -std=c++17 -O2 -g [-fsanitize=address,undefined] ../mpp/trace.cpp tracefuzz.cpp -o tracefuzz
+================================================================================================+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../mpp/events.hpp"
+
+/// @brief Default number of formats.
+#define TRACEFUZZ_FORMATS (ULONG)0x10000
+
+/// @brief Number of records of the events of the driver formatted and timed.
+#define TRACEFUZZ_RECORDS (ULONG)0x40000
+
+/// @brief Record, as copied by Drain, only as large as its arguments and data.
+typedef struct _TRACEFUZZ_RECORD {
+	std::unique_ptr<ULONG64[]>  Buffer;
+	MppTrace::MPP_TRACE_RECORD* Record;
+} TRACEFUZZ_RECORD, * PTRACEFUZZ_RECORD;
+
+/// @brief Part of the text expected: bytes cut anywhere, or a character of a name, never cut.
+typedef struct _TRACEFUZZ_PIECE {
+	std::string Bytes;
+	ULONG       Name; // Conversion of the name, 0 for bytes
+} TRACEFUZZ_PIECE, * PTRACEFUZZ_PIECE;
+
+/// @brief Build a record, with the exact size of its arguments and data.
+static VOID TraceFuzzBuild(
+	_Out_ TRACEFUZZ_RECORD*           Result,
+	_In_  USHORT                      EventId,
+	_In_  CONST std::vector<ULONG64>& Arguments,
+	_In_  CONST std::vector<UCHAR>&   Data
+) {
+	SIZE_T Size = sizeof(MppTrace::MPP_TRACE_RECORD) + (Arguments.size() * sizeof(ULONG64)) + Data.size();
+	Result->Buffer.reset(new ULONG64[(Size + 0x07) / sizeof(ULONG64)]);
+	Result->Record = reinterpret_cast<MppTrace::MPP_TRACE_RECORD*>(Result->Buffer.get());
+
+	MppTrace::MPP_TRACE_RECORD* Record = Result->Record;
+	Record->Position          = 0x00;
+	Record->Timestamp         = 0x00;
+	Record->EventId           = EventId;
+	Record->Size              = (USHORT)((Size + 0x07) & ~(SIZE_T)0x07);
+	Record->NumberOfArguments = (UCHAR)Arguments.size();
+	Record->Ring              = 0x00;
+	Record->DataSize          = (USHORT)Data.size();
+
+	auto Values = reinterpret_cast<ULONG64*>(Record + 1);
+	for (SIZE_T cx = 0x00; cx < Arguments.size(); cx++)
+		Values[cx] = Arguments[cx];
+	if (!Data.empty())
+		memcpy(Values + Arguments.size(), Data.data(), Data.size());
+}
+
+/// @brief Characters of UTF-16 data in UTF-8, up to its first NULL character.
+static std::vector<std::string> TraceFuzzString(
+	_In_ CONST std::vector<UCHAR>& Data
+) {
+	std::vector<ULONG> Units;
+	for (SIZE_T cx = 0x00; cx + 1 < Data.size(); cx += 0x02) {
+		Units.push_back((ULONG)Data[cx] | ((ULONG)Data[cx + 1] << 0x08));
+		if (Units.back() == 0x00) {
+			Units.pop_back();
+			break;
+		}
+	}
+
+	std::vector<std::string> Characters;
+	for (SIZE_T cx = 0x00; cx < Units.size(); cx++) {
+		std::string Text;
+		ULONG       Point = Units[cx];
+		if (Point >= 0xD800 && Point <= 0xDBFF && (cx + 1) < Units.size() && Units[cx + 1] >= 0xDC00 && Units[cx + 1] <= 0xDFFF)
+			Point = 0x10000 + ((Point - 0xD800) << 0x0A) + (Units[++cx] - 0xDC00);
+		else if (Point >= 0xD800 && Point <= 0xDFFF)
+			Point = 0xFFFD;
+
+		if (Point < 0x80) {
+			Text += (CHAR)Point;
+		}
+		else if (Point < 0x800) {
+			Text += (CHAR)(0xC0 | (Point >> 0x06));
+			Text += (CHAR)(0x80 | (Point & 0x3F));
+		}
+		else if (Point < 0x10000) {
+			Text += (CHAR)(0xE0 | (Point >> 0x0C));
+			Text += (CHAR)(0x80 | ((Point >> 0x06) & 0x3F));
+			Text += (CHAR)(0x80 | (Point & 0x3F));
+		}
+		else {
+			Text += (CHAR)(0xF0 | (Point >> 0x12));
+			Text += (CHAR)(0x80 | ((Point >> 0x0C) & 0x3F));
+			Text += (CHAR)(0x80 | ((Point >> 0x06) & 0x3F));
+			Text += (CHAR)(0x80 | (Point & 0x3F));
+		}
+		Characters.push_back(Text);
+	}
+	return Characters;
+}
+
+/// @brief Text expected in a text of a given size, as many bytes as fit and whole characters of names.
+static std::string TraceFuzzTruncate(
+	_In_ CONST std::vector<TRACEFUZZ_PIECE>& Pieces,
+	_In_ SIZE_T                              TextSize
+) {
+	std::string Text;
+	ULONG       Skipped = 0x00;
+	for (CONST TRACEFUZZ_PIECE& Piece : Pieces) {
+		if (Piece.Name == 0x00) {
+			for (CHAR Byte : Piece.Bytes) {
+				if (Text.size() + 0x01 < TextSize)
+					Text += Byte;
+			}
+		}
+		else if (Piece.Name != Skipped) {
+			// The rest of a name is left out after its first character not fitting
+			if (Text.size() + Piece.Bytes.size() + 0x01 > TextSize)
+				Skipped = Piece.Name;
+			else
+				Text += Piece.Bytes;
+		}
+	}
+	return Text;
+}
+
+/// @brief Text of a number, formatted by snprintf.
+static std::string TraceFuzzNumber(
+	_In_ CONST std::string& Specification,
+	_In_ ULONG64            Value
+) {
+	CHAR Text[0x100] = { 0x00 };
+	if (Specification.back() == 'd')
+		::snprintf(Text, sizeof(Text), Specification.c_str(), (long long)Value);
+	else
+		::snprintf(Text, sizeof(Text), Specification.c_str(), (unsigned long long)Value);
+	return Text;
+}
+
+/// @brief Random argument, small, large, negative or a pointer.
+static ULONG64 TraceFuzzArgument(
+	_Inout_ std::mt19937_64& Random
+) {
+	switch (Random() % 0x06) {
+	case 0x00:
+		return Random() % 0x100;
+	case 0x01:
+		return (ULONG64)0x00 - (Random() % 0x10000);
+	case 0x02:
+		return 0xFFFFF80000000000 | (Random() & 0xFFFFFFFFFF);
+	case 0x03:
+		return (Random() % 0x02) == 0x00 ? 0x8000000000000000 : 0xFFFFFFFFFFFFFFFF;
+	default:
+		return Random() >> (Random() % 0x40);
+	}
+}
+
+/// @brief Random UTF-16 data: ASCII, non-ASCII, surrogate pairs, lone surrogates and NULL characters.
+static std::vector<UCHAR> TraceFuzzData(
+	_Inout_ std::mt19937_64& Random
+) {
+	std::vector<UCHAR> Data;
+	ULONG              Count = (ULONG)(Random() % ((MppTrace::MaximumData / 0x02) + 0x01));
+	for (ULONG cx = 0x00; cx < Count; cx++) {
+		USHORT Unit = 0x00;
+		switch (Random() % 0x10) {
+		case 0x00:
+			Unit = (USHORT)(0xD800 + (Random() % 0x800));
+			break;
+		case 0x01:
+			Unit = (USHORT)(0x80 + (Random() % 0x780));
+			break;
+		case 0x02:
+			Unit = (USHORT)(0x800 + (Random() % 0xD000));
+			break;
+		case 0x03:
+			if (cx + 1 < Count) {
+				Unit = (USHORT)(0xD800 + (Random() % 0x400));
+				Data.push_back((UCHAR)Unit);
+				Data.push_back((UCHAR)(Unit >> 0x08));
+				Unit = (USHORT)(0xDC00 + (Random() % 0x400));
+				cx++;
+			}
+			break;
+		case 0x04:
+			Unit = (Random() % 0x08) == 0x00 ? 0x00 : 0x41;
+			break;
+		default:
+			Unit = (USHORT)(0x20 + (Random() % 0x5F));
+			break;
+		}
+		Data.push_back((UCHAR)Unit);
+		Data.push_back((UCHAR)(Unit >> 0x08));
+	}
+
+	// An odd size, the last byte being ignored
+	if ((Random() % 0x08) == 0x00 && Data.size() < MppTrace::MaximumData)
+		Data.push_back((UCHAR)Random());
+	return Data;
+}
+
+/// @brief Random format, with the text expected for the arguments and the data given.
+static std::string TraceFuzzFormat(
+	_Inout_ std::mt19937_64&              Random,
+	_In_    CONST std::vector<ULONG64>&   Arguments,
+	_In_    CONST std::vector<UCHAR>&     Data,
+	_Out_   std::vector<TRACEFUZZ_PIECE>* Expected
+) {
+	static CONST CHAR* Lengths[] = { "", "", "l", "ll", "h", "hh", "z", "I64" };
+	static CONST CHAR  Unknown[] = { 'q', 'y', 'k', 'n', 'o', '!', ' ', '%' };
+
+	std::string Format;
+	SIZE_T      Argument = 0x00;
+	ULONG       Count    = (ULONG)(Random() % 0x10);
+	Expected->clear();
+	for (ULONG cx = 0x00; cx < Count; cx++) {
+		// Text, any character but the percent sign and the NULL character
+		if ((Random() % 0x03) == 0x00) {
+			ULONG Length = (ULONG)(Random() % 0x10);
+			for (ULONG dx = 0x00; dx < Length; dx++) {
+				CHAR Character = (CHAR)(0x01 + (Random() % 0xFF));
+				if (Character == '%')
+					Character = '#';
+				Format += Character;
+				Expected->push_back({ std::string(0x01, Character), 0x00 });
+			}
+			continue;
+		}
+
+		// Conversion, with flags and width for the numbers
+		CHAR        Conversion = "duxXpcs?"[Random() % 0x08];
+		std::string Flags;
+		std::string Width;
+		if (Conversion != 'p' && Conversion != 'c' && Conversion != 's' && Conversion != '?') {
+			ULONG NumberOfFlags = (ULONG)(Random() % 0x03);
+			for (ULONG dx = 0x00; dx < NumberOfFlags; dx++)
+				Flags += (Random() % 0x02) == 0x00 ? '0' : '-';
+			if ((Random() % 0x02) == 0x00)
+				Width = std::to_string(0x01 + (Random() % 0x28));
+		}
+		if (Conversion == '?')
+			Conversion = Unknown[Random() % sizeof(Unknown)];
+		Format += "%" + Flags + Width + Lengths[Random() % 0x08] + Conversion;
+
+		ULONG64 Value = Argument < Arguments.size() ? Arguments[Argument] : 0x00;
+		switch (Conversion) {
+		case 'd':
+		case 'u':
+		case 'x':
+		case 'X':
+			Expected->push_back({ TraceFuzzNumber("%" + Flags + Width + "ll" + Conversion, Value), 0x00 });
+			Argument++;
+			break;
+		case 'p':
+			Expected->push_back({ TraceFuzzNumber("%016llX", Value), 0x00 });
+			Argument++;
+			break;
+		case 'c':
+			Expected->push_back({ std::string(0x01, (CHAR)Value), 0x00 });
+			Argument++;
+			break;
+		case 's':
+			for (CONST std::string& Character : TraceFuzzString(Data))
+				Expected->push_back({ Character, cx + 0x01 });
+			break;
+		default:
+			Expected->push_back({ std::string(0x01, Conversion), 0x00 });
+			break;
+		}
+	}
+
+	// A lone percent sign at the end
+	if ((Random() % 0x10) == 0x00) {
+		Format += '%';
+		Expected->push_back({ "%", 0x00 });
+	}
+	return Format;
+}
+
+/// @brief Format a record into texts large enough and too small, the text expected given.
+static ULONG TraceFuzzCheck(
+	_In_ CONST MppTrace::MPP_TRACE_RECORD*     Record,
+	_In_ CONST MppTrace::MPP_TRACE_DESCRIPTOR* Descriptors,
+	_In_ ULONG                                 NumberOfDescriptors,
+	_In_ CONST std::vector<TRACEFUZZ_PIECE>&   Pieces
+) {
+	// Larger, exact, one short, then every small size and the sizes close to the text
+	SIZE_T              Whole = TraceFuzzTruncate(Pieces, (SIZE_T)-1).size();
+	std::vector<SIZE_T> Sizes = { Whole + 0x10, Whole + 0x01 };
+	for (SIZE_T Size = 0x01; Size <= Whole && Size <= 0x10; Size++)
+		Sizes.push_back(Size);
+	for (SIZE_T Size = Whole; Size > 0x10 && Size + 0x10 > Whole; Size--)
+		Sizes.push_back(Size);
+
+	ULONG Differences = 0x00;
+	for (SIZE_T TextSize : Sizes) {
+		std::unique_ptr<CHAR[]> Text(new CHAR[TextSize]);
+		SIZE_T                  Length   = MppTrace::Format(Record, Descriptors, NumberOfDescriptors, Text.get(), TextSize);
+		std::string             Expected = TraceFuzzTruncate(Pieces, TextSize);
+		if (Length != Expected.size() || Text[Length] != '\0' || memcmp(Text.get(), Expected.data(), Length) != 0x00) {
+			if (Differences++ < 0x04)
+				::printf("[-] Event %u, %zu byte(s): \"%.*s\", \"%s\" expected\r\n", Record->EventId, TextSize, (int)(Length < TextSize ? Length : 0x00), Text.get(), Expected.c_str());
+		}
+	}
+
+	// Nothing written without room
+	CHAR Guard = 0x55;
+	if (MppTrace::Format(Record, Descriptors, NumberOfDescriptors, &Guard, 0x00) != 0x00 || Guard != 0x55) {
+		::printf("[-] Event %u formatted without room\r\n", Record->EventId);
+		Differences++;
+	}
+	return Differences;
+}
+
+/// @brief Format records of random formats and events.
+static ULONG TraceFuzzCheckFormats(
+	_Inout_ std::mt19937_64& Random,
+	_In_    ULONG            NumberOfFormats
+) {
+	ULONG Differences = 0x00;
+	for (ULONG cx = 0x00; cx < NumberOfFormats && Differences < 0x10; cx++) {
+		std::vector<ULONG64> Arguments((SIZE_T)(Random() % (MppTrace::MaximumArguments + 0x01)));
+		for (ULONG64& Argument : Arguments)
+			Argument = TraceFuzzArgument(Random);
+		std::vector<UCHAR> Data = TraceFuzzData(Random);
+
+		std::vector<TRACEFUZZ_PIECE> Expected;
+		std::string                  Format = TraceFuzzFormat(Random, Arguments, Data, &Expected);
+
+		// Indexed by identifier, or searched for, the other descriptors never used
+		USHORT                                      EventId = (USHORT)(0x01 + (Random() % 0x20));
+		std::vector<MppTrace::MPP_TRACE_DESCRIPTOR> Descriptors(0x01 + (Random() % 0x28), { 0xFFFF, 0x00, "wrong descriptor" });
+		SIZE_T                                      Index   = EventId < Descriptors.size() && (Random() % 0x02) == 0x00 ? EventId : Random() % Descriptors.size();
+		Descriptors[Index] = { EventId, (UCHAR)Arguments.size(), Format.c_str() };
+
+		TRACEFUZZ_RECORD Record = {};
+		TraceFuzzBuild(&Record, EventId, Arguments, Data);
+		Differences += TraceFuzzCheck(Record.Record, Descriptors.data(), (ULONG)Descriptors.size(), Expected);
+
+		// Without format, or unknown, dumped
+		std::string Dump;
+		for (ULONG64 Argument : Arguments)
+			Dump += " " + TraceFuzzNumber("%llx", Argument);
+		Descriptors[Index].Format = nullptr;
+		Differences += TraceFuzzCheck(Record.Record, Descriptors.data(), (ULONG)Descriptors.size(), { { "Event " + std::to_string(EventId) + Dump, 0x00 } });
+		Record.Record->EventId = (USHORT)(0x100 + EventId);
+		Differences += TraceFuzzCheck(Record.Record, Descriptors.data(), (ULONG)Descriptors.size(), { { "Event " + std::to_string(0x100 + EventId) + Dump, 0x00 } });
+	}
+	return Differences;
+}
+
+/// @brief Format of an event of the driver for snprintf, the numbers being 64-bit.
+/// @return Index of the conversion of the name, NumberOfArguments if there is none.
+static ULONG TraceFuzzPrintfFormat(
+	_In_  CONST MppTrace::MPP_TRACE_DESCRIPTOR& Descriptor,
+	_Out_ std::string*                          Format
+) {
+	std::string Source(Descriptor.Format);
+	ULONG       Conversion = 0x00;
+	ULONG       Name       = Descriptor.NumberOfArguments;
+	Format->clear();
+	for (SIZE_T cx = 0x00; cx < Source.size(); cx++) {
+		if (Source[cx] != '%') {
+			*Format += Source[cx];
+			continue;
+		}
+		SIZE_T End = Source.find_first_of("duxXps", cx + 1);
+		if (Source[End] == 's') {
+			*Format += "%s";
+			Name     = Conversion;
+		}
+		else if (Source[End] == 'p') {
+			*Format += "%016llX";
+		}
+		else {
+			*Format += Source.substr(cx, End - cx) + "ll" + Source[End];
+		}
+		Conversion++;
+		cx = End;
+	}
+	return Name;
+}
+
+/// @brief Text of a record of an event of the driver, formatted by snprintf.
+static SIZE_T TraceFuzzPrintf(
+	_In_  CONST std::string&                Format,
+	_In_  ULONG                             Name,
+	_In_  CONST MppTrace::MPP_TRACE_RECORD* Record,
+	_In_  CONST CHAR*                       String,
+	_Out_ CHAR*                             Text,
+	_In_  SIZE_T                            TextSize
+) {
+	// The events of the driver take up to four numbers
+	ULONG64 Values[0x04] = { 0x00 };
+	auto    Arguments    = reinterpret_cast<CONST ULONG64*>(Record + 1);
+	for (ULONG cx = 0x00; cx < Record->NumberOfArguments && cx < 0x04; cx++)
+		Values[cx] = Arguments[cx];
+
+	int Length = 0x00;
+	switch (Name) {
+	case 0x00:
+		Length = ::snprintf(Text, TextSize, Format.c_str(), String, Values[0x00], Values[0x01], Values[0x02], Values[0x03]);
+		break;
+	case 0x01:
+		Length = ::snprintf(Text, TextSize, Format.c_str(), Values[0x00], String, Values[0x01], Values[0x02], Values[0x03]);
+		break;
+	case 0x02:
+		Length = ::snprintf(Text, TextSize, Format.c_str(), Values[0x00], Values[0x01], String, Values[0x02], Values[0x03]);
+		break;
+	case 0x03:
+		Length = ::snprintf(Text, TextSize, Format.c_str(), Values[0x00], Values[0x01], Values[0x02], String, Values[0x03]);
+		break;
+	default:
+		Length = ::snprintf(Text, TextSize, Format.c_str(), Values[0x00], Values[0x01], Values[0x02], Values[0x03], String);
+		break;
+	}
+	return Length < 0x00 ? 0x00 : (SIZE_T)Length;
+}
+
+int main(int argc, char** argv) {
+	ULONG NumberOfFormats = argc > 1 ? (ULONG)strtoul(argv[1], NULL, 0x00) : TRACEFUZZ_FORMATS;
+	if (NumberOfFormats == 0x00) {
+		::printf("usage: %s [formats]\r\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	std::mt19937_64 Random(0x54524346555A5A);
+	ULONG           Differences = TraceFuzzCheckFormats(Random, NumberOfFormats);
+
+	// Records of the events of the driver, the names being paths
+	std::string        Path = "\\Device\\HarddiskVolume3\\Windows\\System32\\amsi.dll";
+	std::vector<UCHAR> Name;
+	for (CHAR Character : Path) {
+		Name.push_back((UCHAR)Character);
+		Name.push_back(0x00);
+	}
+
+	std::string Formats[MppEvents::NumberOfEvents];
+	ULONG       Names[MppEvents::NumberOfEvents] = { 0x00 };
+	for (ULONG cx = 0x01; cx < MppEvents::NumberOfEvents; cx++)
+		Names[cx] = TraceFuzzPrintfFormat(MppEvents::Descriptors[cx], &Formats[cx]);
+
+	std::vector<TRACEFUZZ_RECORD> Records(TRACEFUZZ_RECORDS);
+	for (ULONG cx = 0x00; cx < TRACEFUZZ_RECORDS; cx++) {
+		CONST MppTrace::MPP_TRACE_DESCRIPTOR& Descriptor = MppEvents::Descriptors[0x01 + (cx % (MppEvents::NumberOfEvents - 0x01))];
+		std::vector<ULONG64>                  Arguments(Descriptor.NumberOfArguments);
+		for (ULONG64& Argument : Arguments)
+			Argument = (Random() % 0x02) == 0x00 ? (Random() & 0xFFFFFFFF) : TraceFuzzArgument(Random);
+		TraceFuzzBuild(&Records[cx], Descriptor.EventId, Arguments, Name);
+	}
+
+	CHAR Text[0x200]     = { 0x00 };
+	CHAR Expected[0x200] = { 0x00 };
+	for (ULONG cx = 0x00; cx < TRACEFUZZ_RECORDS; cx++) {
+		USHORT EventId  = Records[cx].Record->EventId;
+		SIZE_T Length   = MppTrace::Format(Records[cx].Record, MppEvents::Descriptors, MppEvents::NumberOfEvents, Text, sizeof(Text));
+		SIZE_T Printed  = TraceFuzzPrintf(Formats[EventId], Names[EventId], Records[cx].Record, Path.c_str(), Expected, sizeof(Expected));
+		if ((Length != Printed || memcmp(Text, Expected, Length) != 0x00) && Differences++ < 0x18)
+			::printf("[-] \"%s\", \"%s\" expected\r\n", Text, Expected);
+	}
+
+	// Formatted by the trace, then by snprintf
+	SIZE_T Total     = 0x00;
+	auto   TimeStart = std::chrono::steady_clock::now();
+	for (ULONG cx = 0x00; cx < TRACEFUZZ_RECORDS; cx++)
+		Total += MppTrace::Format(Records[cx].Record, MppEvents::Descriptors, MppEvents::NumberOfEvents, Text, sizeof(Text));
+	double FormatTime = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - TimeStart).count();
+
+	TimeStart = std::chrono::steady_clock::now();
+	for (ULONG cx = 0x00; cx < TRACEFUZZ_RECORDS; cx++) {
+		USHORT EventId = Records[cx].Record->EventId;
+		Total -= TraceFuzzPrintf(Formats[EventId], Names[EventId], Records[cx].Record, Path.c_str(), Text, sizeof(Text));
+	}
+	double PrintTime = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - TimeStart).count();
+
+	::printf("[+] %u random format(s)\r\n", NumberOfFormats);
+	::printf("[+] %u record(s) of %u event(s)\r\n", TRACEFUZZ_RECORDS, MppEvents::NumberOfEvents - 0x01);
+	::printf("[+] Format   : %10.1f ns per record\r\n", FormatTime / (double)TRACEFUZZ_RECORDS);
+	::printf("[+] snprintf : %10.1f ns per record\r\n", PrintTime / (double)TRACEFUZZ_RECORDS);
+	if (Total != 0x00) {
+		::printf("[-] Texts of different lengths\r\n");
+		Differences++;
+	}
+	::printf("[+] %u difference(s)\r\n", Differences);
+	return Differences == 0x00 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,401 @@
+/*+================================================================================================
+Module Name: tracestress.cpp
+Author     : Paul L. (@am0nsec)
+Origin     : https://github.com/am0nsec/wkpe/
+Copyright  : This project has been released under the GNU Public License v3 license.
+
+Abstract:
+Stress test of the Memory Patching Protection (MPP) binary trace.
+Writer threads write numbered records, of every number of arguments and size of data, while one
+reader drains the rings. With small rings the reader falls behind and records are overwritten:
+each record read must be whole, and the records of a writer in a ring read in the order they were
+written, once. With rings large enough for all the records, every record must be read exactly
+once, and again from the oldest record once the writers are done. A single writer also checks
+that a reader lapped, or with a small buffer, resumes where expected and counts the bytes lost.
+Last, writing and draining are timed. The number of writers and of records per writer can be given on the command line.
+
+Build: c++ -std=c++17 -O2 -g -pthread [-fsanitize=address,undefined] ../mpp/trace.cpp tracestress.cpp -o tracestress
+================================================================================================+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "../mpp/trace.hpp"
+
+/// @brief Default number of writers, and of records per writer.
+#define TRACESTRESS_WRITERS (ULONG)0x04
+#define TRACESTRESS_RECORDS (ULONG)0x40000
+
+/// @brief Rings of the trace overwritten, and of the trace large enough for all the records.
+#define TRACESTRESS_SMALL_RINGS (ULONG)0x04
+#define TRACESTRESS_SMALL_SIZE  (ULONG)0x10000
+#define TRACESTRESS_LARGE_RINGS (ULONG)0x02
+#define TRACESTRESS_LARGE_SIZE  (ULONG)0x1000000
+
+/// @brief Ring of the single writer, the smallest so that it is lapped often.
+#define TRACESTRESS_LAP_SIZE (ULONG)0x1000
+
+/// @brief Size of the buffer of the reader.
+#define TRACESTRESS_BUFFER (SIZE_T)0x10000
+
+/// @brief Arguments of a record always written: writer, sequence and check.
+#define TRACESTRESS_ARGUMENTS (ULONG)0x03
+
+/// @brief Largest record written.
+#define TRACESTRESS_MAXIMUM_RECORD (ULONG)((sizeof(MppTrace::MPP_TRACE_RECORD) + (MppTrace::MaximumArguments * sizeof(ULONG64)) + MppTrace::MaximumData + 0x07) & ~0x07)
+
+/// @brief Results of the reader.
+typedef struct _TRACESTRESS_RESULTS {
+	ULONG64 Records;
+	ULONG64 Bytes;
+	ULONG64 Errors;
+} TRACESTRESS_RESULTS, * PTRACESTRESS_RESULTS;
+
+static std::atomic<ULONG> TraceStressRunning{ 0x00 };
+
+/// @brief Value of the check argument of a record.
+static ULONG64 TraceStressCheck(
+	_In_ ULONG   Writer,
+	_In_ ULONG64 Sequence
+) {
+	return (Sequence * 0x9E3779B97F4A7C15) ^ ((ULONG64)Writer << 48);
+}
+
+/// @brief Number of arguments, and number of characters of the data, of a record.
+static VOID TraceStressGetShape(
+	_In_  ULONG64 Sequence,
+	_Out_ ULONG*  NumberOfArguments,
+	_Out_ ULONG*  NumberOfCharacters
+) {
+	*NumberOfArguments  = TRACESTRESS_ARGUMENTS + (ULONG)(Sequence % (MppTrace::MaximumArguments - TRACESTRESS_ARGUMENTS + 0x01));
+	*NumberOfCharacters = (ULONG)((Sequence * 0x07) % ((MppTrace::MaximumData / sizeof(USHORT)) + 0x01));
+}
+
+/// @brief Character of the data of a record.
+static USHORT TraceStressGetCharacter(
+	_In_ ULONG   Writer,
+	_In_ ULONG64 Sequence,
+	_In_ ULONG   Index
+) {
+	return (USHORT)(0x20 + ((Writer * 0x1F) + Sequence + Index) % 0x5E);
+}
+
+/// @brief Write numbered records.
+static VOID TraceStressWrite(
+	_In_ MppTrace::MPP_TRACE_HEADER* Trace,
+	_In_ ULONG                       Writer,
+	_In_ ULONG                       NumberOfRecords
+) {
+	for (ULONG64 Sequence = 0x00; Sequence < NumberOfRecords; Sequence++) {
+		ULONG NumberOfArguments  = 0x00;
+		ULONG NumberOfCharacters = 0x00;
+		TraceStressGetShape(Sequence, &NumberOfArguments, &NumberOfCharacters);
+
+		ULONG64 Check                                        = TraceStressCheck(Writer, Sequence);
+		ULONG64 Arguments[MppTrace::MaximumArguments]        = { Writer, Sequence, Check };
+		USHORT  Data[MppTrace::MaximumData / sizeof(USHORT)] = { 0x00 };
+		for (ULONG cx = TRACESTRESS_ARGUMENTS; cx < NumberOfArguments; cx++)
+			Arguments[cx] = Check ^ cx;
+		for (ULONG cx = 0x00; cx < NumberOfCharacters; cx++)
+			Data[cx] = TraceStressGetCharacter(Writer, Sequence, cx);
+
+		MppTrace::Write(Trace, (USHORT)(0x01 + (Sequence % 0x10)), Arguments, NumberOfArguments, Data, NumberOfCharacters * sizeof(USHORT));
+
+		// The driver is not preempted within a record, give the other threads a chance between them
+		if ((Sequence & 0xFF) == 0x00)
+			std::this_thread::yield();
+	}
+	TraceStressRunning.fetch_sub(0x01, std::memory_order_release);
+}
+
+/// @brief Check the records copied by Drain.
+static VOID TraceStressCheckRecords(
+	_In_    CONST UCHAR*         Buffer,
+	_In_    SIZE_T               Size,
+	_In_    ULONG                NumberOfWriters,
+	_In_    ULONG                NumberOfRecords,
+	_Inout_ std::vector<LONG64>& Last,
+	_Inout_ TRACESTRESS_RESULTS* Results
+) {
+	for (SIZE_T Offset = 0x00; Offset < Size;) {
+		auto   Record = reinterpret_cast<CONST MppTrace::MPP_TRACE_RECORD*>(Buffer + Offset);
+		SIZE_T Left   = Size - Offset;
+		if (Left < sizeof(MppTrace::MPP_TRACE_RECORD) || Record->Size < sizeof(MppTrace::MPP_TRACE_RECORD) || Record->Size > Left || (Record->Size & 0x07) != 0x00) {
+			if (Results->Errors++ < 0x08)
+				::printf("[-] Record of %u byte(s) at offset 0x%zX\r\n", Left < sizeof(MppTrace::MPP_TRACE_RECORD) ? 0x00 : Record->Size, Offset);
+			return;
+		}
+		Offset += Record->Size;
+		Results->Records++;
+		Results->Bytes += Record->Size;
+
+		auto    Arguments = reinterpret_cast<CONST ULONG64*>(Record + 1);
+		auto    Data      = reinterpret_cast<CONST USHORT*>(Arguments + Record->NumberOfArguments);
+		ULONG   Writer    = Record->NumberOfArguments >= TRACESTRESS_ARGUMENTS ? (ULONG)Arguments[0x00] : 0xFFFFFFFF;
+		ULONG64 Sequence  = Record->NumberOfArguments >= TRACESTRESS_ARGUMENTS ? Arguments[0x01] : 0x00;
+		if (Writer >= NumberOfWriters || Sequence >= NumberOfRecords || Arguments[0x02] != TraceStressCheck(Writer, Sequence)) {
+			if (Results->Errors++ < 0x08)
+				::printf("[-] Record of %u argument(s) torn\r\n", Record->NumberOfArguments);
+			continue;
+		}
+
+		// Exactly what the writer wrote
+		ULONG NumberOfArguments  = 0x00;
+		ULONG NumberOfCharacters = 0x00;
+		TraceStressGetShape(Sequence, &NumberOfArguments, &NumberOfCharacters);
+		BOOLEAN Whole = Record->EventId == (USHORT)(0x01 + (Sequence % 0x10))
+			&& Record->NumberOfArguments == NumberOfArguments
+			&& Record->DataSize == NumberOfCharacters * sizeof(USHORT)
+			&& Record->Ring < MppTrace::MaximumRings
+			&& Record->Timestamp != 0x00;
+		for (ULONG cx = TRACESTRESS_ARGUMENTS; Whole && cx < NumberOfArguments; cx++)
+			Whole = Arguments[cx] == (Arguments[0x02] ^ cx);
+		for (ULONG cx = 0x00; Whole && cx < NumberOfCharacters; cx++)
+			Whole = Data[cx] == TraceStressGetCharacter(Writer, Sequence, cx);
+		if (!Whole) {
+			if (Results->Errors++ < 0x08)
+				::printf("[-] Record %llu of writer %u torn\r\n", (unsigned long long)Sequence, Writer);
+			continue;
+		}
+
+		// In order and once, in the ring of the processor the writer was running on
+		LONG64& Previous = Last[((SIZE_T)Writer * MppTrace::MaximumRings) + Record->Ring];
+		if ((LONG64)Sequence <= Previous && Results->Errors++ < 0x08)
+			::printf("[-] Record %llu of writer %u read after record %lld\r\n", (unsigned long long)Sequence, Writer, (long long)Previous);
+		Previous = (LONG64)Sequence;
+	}
+}
+
+/// @brief Write records one by one and drain them now and then, into buffers of any size, checking
+/// the records read and the bytes lost against where each record has been written.
+static ULONG TraceStressCheckLaps(
+	_Inout_ std::mt19937& Random,
+	_In_    ULONG         NumberOfRecords
+) {
+	SIZE_T Size  = MppTrace::GetSize(0x01, TRACESTRESS_LAP_SIZE);
+	PVOID  Block = ::operator new(Size, std::align_val_t(0x1000));
+	auto   Trace = MppTrace::Initialise(Block, 0x01, TRACESTRESS_LAP_SIZE);
+	auto   Ring  = reinterpret_cast<CONST MppTrace::MPP_TRACE_RING*>(Trace + 1);
+
+	MppTrace::MPP_TRACE_CURSOR Cursor = { 0x00 };
+	MppTrace::InitialiseCursor(Trace, &Cursor, TRUE);
+
+	// Positions and sizes of the records written, and where the reader is expected to be
+	std::vector<LONG64> Positions;
+	std::vector<LONG64> Sizes;
+	SIZE_T              Next      = 0x00;
+	LONG64              Position  = 0x00;
+	LONG64              LostBytes = 0x00;
+
+	std::vector<UCHAR>  Buffer(TRACESTRESS_LAP_SIZE);
+	std::vector<LONG64> Last(MppTrace::MaximumRings, -1);
+	TRACESTRESS_RESULTS Results = { 0x00 };
+	ULONG               Errors  = 0x00;
+	for (ULONG64 Sequence = 0x00; Sequence < NumberOfRecords && Errors < 0x08; Sequence++) {
+		ULONG NumberOfArguments  = 0x00;
+		ULONG NumberOfCharacters = 0x00;
+		TraceStressGetShape(Sequence, &NumberOfArguments, &NumberOfCharacters);
+
+		ULONG64 Check                                        = TraceStressCheck(0x00, Sequence);
+		ULONG64 Arguments[MppTrace::MaximumArguments]        = { 0x00, Sequence, Check };
+		USHORT  Data[MppTrace::MaximumData / sizeof(USHORT)] = { 0x00 };
+		for (ULONG cx = TRACESTRESS_ARGUMENTS; cx < NumberOfArguments; cx++)
+			Arguments[cx] = Check ^ cx;
+		for (ULONG cx = 0x00; cx < NumberOfCharacters; cx++)
+			Data[cx] = TraceStressGetCharacter(0x00, Sequence, cx);
+		MppTrace::Write(Trace, (USHORT)(0x01 + (Sequence % 0x10)), Arguments, NumberOfArguments, Data, NumberOfCharacters * sizeof(USHORT));
+
+		LONG64 Head = Ring->Head;
+		Sizes.push_back((LONG64)((sizeof(MppTrace::MPP_TRACE_RECORD) + (NumberOfArguments * sizeof(ULONG64)) + (NumberOfCharacters * sizeof(USHORT)) + 0x07) & ~0x07));
+		Positions.push_back(Head - Sizes.back());
+		if ((Random() % (0x01 + (Random() % 0x40))) != 0x00)
+			continue;
+
+		// Lapped, resuming at the first lap still whole
+		if (Head - Position > (LONG64)TRACESTRESS_LAP_SIZE) {
+			LONG64 Oldest = (Head - 0x01) & ~(LONG64)(TRACESTRESS_LAP_SIZE - 0x01);
+			LostBytes += Oldest - Position;
+			Position   = Oldest;
+		}
+		while (Next < Positions.size() && Positions[Next] < Position)
+			Next++;
+
+		// Records expected, as many as the buffer holds
+		SIZE_T              BufferSize = Random() % (Buffer.size() + 0x01);
+		SIZE_T              Copied     = 0x00;
+		std::vector<LONG64> Expected;
+		for (; Next < Positions.size() && Copied + Sizes[Next] <= BufferSize; Next++) {
+			Expected.push_back((LONG64)Next);
+			Copied  += Sizes[Next];
+			Position = Positions[Next] + Sizes[Next];
+		}
+		if (Next < Positions.size())
+			Position = Positions[Next];
+
+		SIZE_T Drained = MppTrace::Drain(Trace, &Cursor, Buffer.data(), BufferSize);
+		TraceStressCheckRecords(Buffer.data(), Drained, 0x01, NumberOfRecords, Last, &Results);
+
+		std::vector<LONG64> Read;
+		for (SIZE_T Offset = 0x00; Offset < Drained; Offset += reinterpret_cast<CONST MppTrace::MPP_TRACE_RECORD*>(&Buffer[Offset])->Size)
+			Read.push_back((LONG64)reinterpret_cast<CONST ULONG64*>(&Buffer[Offset] + sizeof(MppTrace::MPP_TRACE_RECORD))[0x01]);
+		if (Read != Expected || Drained != Copied || Cursor.LostBytes != LostBytes || Cursor.Positions[0x00] != Position) {
+			::printf("[-] Record %llu: %zu record(s) read from 0x%llX, %zu expected from 0x%llX, %lld byte(s) lost, %lld expected\r\n",
+				(unsigned long long)Sequence, Read.size(), (unsigned long long)Cursor.Positions[0x00], Expected.size(), (unsigned long long)Position, (long long)Cursor.LostBytes, (long long)LostBytes);
+			Cursor.Positions[0x00] = Position;
+			Cursor.LostBytes       = LostBytes;
+			Errors++;
+		}
+	}
+
+	// Nothing from after the newest record
+	MppTrace::InitialiseCursor(Trace, &Cursor, FALSE);
+	if (MppTrace::Drain(Trace, &Cursor, Buffer.data(), Buffer.size()) != 0x00) {
+		::printf("[-] Records read after the newest one\r\n");
+		Errors++;
+	}
+	::operator delete(Block, std::align_val_t(0x1000));
+	return Errors + (ULONG)Results.Errors;
+}
+
+/// @brief Write and drain a trace concurrently, then check the records read.
+static ULONG TraceStressRun(
+	_In_  ULONG                NumberOfWriters,
+	_In_  ULONG                NumberOfRecords,
+	_In_  ULONG                NumberOfRings,
+	_In_  ULONG                RingSize,
+	_Out_ TRACESTRESS_RESULTS* Results,
+	_Out_ LONG64*              LostBytes
+) {
+	SIZE_T Size  = MppTrace::GetSize(NumberOfRings, RingSize);
+	PVOID  Block = ::operator new(Size, std::align_val_t(0x1000));
+	auto   Trace = MppTrace::Initialise(Block, NumberOfRings, RingSize);
+
+	ULONG Errors = 0x00;
+	if (!MppTrace::Validate(Trace, Size) || MppTrace::Validate(Trace, Size - 0x01)) {
+		::printf("[-] Trace of %u ring(s) of 0x%X byte(s) not valid\r\n", NumberOfRings, RingSize);
+		Errors++;
+	}
+
+	MppTrace::MPP_TRACE_CURSOR Cursor = { 0x00 };
+	MppTrace::InitialiseCursor(Trace, &Cursor, TRUE);
+
+	std::vector<std::thread> Threads;
+	TraceStressRunning.store(NumberOfWriters, std::memory_order_release);
+	for (ULONG Writer = 0x00; Writer < NumberOfWriters; Writer++)
+		Threads.emplace_back(TraceStressWrite, Trace, Writer, NumberOfRecords);
+
+	// Drain until the writers are done, then what is left
+	std::vector<UCHAR>  Buffer(TRACESTRESS_BUFFER);
+	std::vector<LONG64> Last((SIZE_T)NumberOfWriters * MppTrace::MaximumRings, -1);
+	*Results = { 0x00 };
+	while (TRUE) {
+		BOOLEAN Running = TraceStressRunning.load(std::memory_order_acquire) != 0x00;
+		SIZE_T  Copied  = MppTrace::Drain(Trace, &Cursor, Buffer.data(), Buffer.size());
+		TraceStressCheckRecords(Buffer.data(), Copied, NumberOfWriters, NumberOfRecords, Last, Results);
+		if (Copied == 0x00 && !Running)
+			break;
+		if (Copied == 0x00)
+			std::this_thread::yield();
+	}
+	for (std::thread& Thread : Threads)
+		Thread.join();
+	*LostBytes = Cursor.LostBytes;
+
+	// Nothing left to read
+	auto Rings = reinterpret_cast<CONST MppTrace::MPP_TRACE_RING*>(Trace + 1);
+	for (ULONG Index = 0x00; Index < NumberOfRings; Index++) {
+		if (Cursor.Positions[Index] != Rings[Index].Head) {
+			::printf("[-] Ring %u: read up to 0x%llX, head 0x%llX\r\n", Index, (unsigned long long)Cursor.Positions[Index], (unsigned long long)Rings[Index].Head);
+			Errors++;
+		}
+	}
+
+	// Every record read once, unless some have been lost
+	ULONG64 Expected = (ULONG64)NumberOfWriters * NumberOfRecords;
+	if (Results->Records > Expected || (*LostBytes == 0x00 && Results->Records != Expected)) {
+		::printf("[-] %llu record(s) read, %llu written, %lld byte(s) lost\r\n", (unsigned long long)Results->Records, (unsigned long long)Expected, (long long)*LostBytes);
+		Errors++;
+	}
+
+	// Again from the oldest record, all of them if nothing has been overwritten
+	if (*LostBytes == 0x00) {
+		TRACESTRESS_RESULTS Again = { 0x00 };
+		std::fill(Last.begin(), Last.end(), -1);
+		MppTrace::InitialiseCursor(Trace, &Cursor, TRUE);
+		for (SIZE_T Copied = 0x01; Copied != 0x00;) {
+			Copied = MppTrace::Drain(Trace, &Cursor, Buffer.data(), Buffer.size());
+			TraceStressCheckRecords(Buffer.data(), Copied, NumberOfWriters, NumberOfRecords, Last, &Again);
+		}
+		if (Again.Records != Expected || Cursor.LostBytes != 0x00) {
+			::printf("[-] %llu record(s) read again, %llu written\r\n", (unsigned long long)Again.Records, (unsigned long long)Expected);
+			Errors++;
+		}
+		Results->Errors += Again.Errors;
+	}
+
+	::operator delete(Block, std::align_val_t(0x1000));
+	return Errors + (ULONG)Results->Errors;
+}
+
+int main(int argc, char** argv) {
+	ULONG NumberOfWriters = argc > 1 ? (ULONG)strtoul(argv[1], NULL, 0x00) : TRACESTRESS_WRITERS;
+	ULONG NumberOfRecords = argc > 2 ? (ULONG)strtoul(argv[2], NULL, 0x00) : TRACESTRESS_RECORDS;
+	if (NumberOfWriters == 0x00 || NumberOfRecords == 0x00) {
+		::printf("usage: %s [writers] [records]\r\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	std::mt19937 Random(0x54524143);
+	ULONG        Differences = TraceStressCheckLaps(Random, NumberOfRecords);
+
+	// Small rings, overwritten while the reader falls behind
+	TRACESTRESS_RESULTS Small     = { 0x00 };
+	LONG64              SmallLost = 0x00;
+	Differences += TraceStressRun(NumberOfWriters, NumberOfRecords, TRACESTRESS_SMALL_RINGS, TRACESTRESS_SMALL_SIZE, &Small, &SmallLost);
+
+	// Rings large enough for all the records, even all in one ring
+	ULONG               Fitting   = TRACESTRESS_LARGE_SIZE / (NumberOfWriters * TRACESTRESS_MAXIMUM_RECORD);
+	TRACESTRESS_RESULTS Large     = { 0x00 };
+	LONG64              LargeLost = 0x00;
+	Differences += TraceStressRun(NumberOfWriters, Fitting < NumberOfRecords ? Fitting : NumberOfRecords, TRACESTRESS_LARGE_RINGS, TRACESTRESS_LARGE_SIZE, &Large, &LargeLost);
+	if (LargeLost != 0x00) {
+		::printf("[-] %lld byte(s) lost from rings large enough\r\n", (long long)LargeLost);
+		Differences++;
+	}
+
+	// One writer alone, then draining a full ring
+	SIZE_T Size  = MppTrace::GetSize(0x01, TRACESTRESS_LARGE_SIZE);
+	PVOID  Block = ::operator new(Size, std::align_val_t(0x1000));
+	auto   Trace = MppTrace::Initialise(Block, 0x01, TRACESTRESS_LARGE_SIZE);
+
+	ULONG64 Arguments[0x03] = { 0x1234, 0xFFFFF80000000000, 0x03 };
+	WCHAR   Name[]          = L"\\Device\\HarddiskVolume3\\Windows\\System32\\amsi.dll";
+	auto    TimeStart       = std::chrono::steady_clock::now();
+	for (ULONG cx = 0x00; cx < NumberOfRecords; cx++)
+		MppTrace::Write(Trace, 0x01, Arguments, 0x03, Name, sizeof(Name));
+	double WriteTime = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - TimeStart).count();
+
+	MppTrace::MPP_TRACE_CURSOR Cursor = { 0x00 };
+	std::vector<UCHAR>         Buffer(TRACESTRESS_LARGE_SIZE);
+	MppTrace::InitialiseCursor(Trace, &Cursor, TRUE);
+	TimeStart = std::chrono::steady_clock::now();
+	SIZE_T Drained   = MppTrace::Drain(Trace, &Cursor, Buffer.data(), Buffer.size());
+	double DrainTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - TimeStart).count();
+	::operator delete(Block, std::align_val_t(0x1000));
+
+	::printf("[+] %u writer(s), %u record(s) per writer\r\n", NumberOfWriters, NumberOfRecords);
+	::printf("[+] Small rings : %llu record(s) read, %lld byte(s) lost\r\n", (unsigned long long)Small.Records, (long long)SmallLost);
+	::printf("[+] Large rings : %llu record(s) read\r\n", (unsigned long long)Large.Records);
+	::printf("[+] Write       : %10.1f ns\r\n", WriteTime / (double)NumberOfRecords);
+	::printf("[+] Drain       : %10.2f GB/s\r\n", (double)Drained / DrainTime / 1000000000.0);
+	::printf("[+] %u difference(s)\r\n", Differences);
+	return Differences == 0x00 ? EXIT_SUCCESS : EXIT_FAILURE;
+}